@@ -1,16 +1,219 @@
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <string>
 
 typedef void (*sighandler_t)(int sig);
 
+#include <lz4.h>
+
 #include "impl_msgq.h"
 #include "impl_zmq.h"
 #include "services.h"
 
+// Batched mode (BRIDGE_BATCH=1 on both ends) coalesces the messages of each topic into
+// frames, so a busy topic costs one zmq_send per frame instead of one per message.
+// A frame is a bridge_frame_header_t followed by [uint32 size][data] records,
+// LZ4 compressed as a whole when BRIDGE_LZ4=1 and that makes it smaller.
+#define BRIDGE_FRAME_MAGIC 0x31475242 // "BRG1"
+#define BRIDGE_FRAME_LZ4 (1 << 0)
+
+struct bridge_frame_header_t {
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t count;
+  uint32_t raw_size;
+};
+
+typedef std::chrono::steady_clock bridge_clock;
+
+static double millis_since(bridge_clock::time_point t) {
+  return std::chrono::duration<double, std::milli>(bridge_clock::now() - t).count();
+}
+
+static size_t env_size(const char *name, size_t default_value) {
+  const char *v = std::getenv(name);
+  return v ? std::stoul(v) : default_value;
+}
+
+struct BridgeStats {
+  uint64_t msgs = 0;
+  uint64_t frames = 0;
+  uint64_t raw_bytes = 0;
+  uint64_t wire_bytes = 0;
+  // sender: time a message waited in its batch, receiver: time to unpack and publish a frame
+  double latency_sum_ms = 0;
+  uint64_t latency_count = 0;
+  double latency_max_ms = 0;
+  bridge_clock::time_point start = bridge_clock::now();
+
+  void add_latency(double sum_ms, uint64_t count, double max_ms) {
+    latency_sum_ms += sum_ms;
+    latency_count += count;
+    latency_max_ms = std::max(latency_max_ms, max_ms);
+  }
+
+  void print_and_reset(const char *direction) {
+    double dt = millis_since(start) / 1000.0;
+    printf("%s: %.0f msgs/s, %.0f frames/s, %.1f KB/s in, %.1f KB/s on the wire (%.2fx), latency mean %.2f ms max %.2f ms\n",
+           direction, msgs / dt, frames / dt, raw_bytes / dt / 1024.0, wire_bytes / dt / 1024.0,
+           wire_bytes ? (double)raw_bytes / wire_bytes : 1.0,
+           latency_count ? latency_sum_ms / latency_count : 0.0, latency_max_ms);
+    fflush(stdout);
+    *this = BridgeStats();
+  }
+};
+
+struct TopicBatch {
+  PubSocket *pub_sock;
+  std::string payload;
+  uint32_t count = 0;
+  bridge_clock::time_point first;
+  double added_sum_ms = 0; // sum of the message arrival times, relative to first
+};
+
+class BridgeBatcher {
+public:
+  BridgeBatcher(size_t max_bytes, double max_ms, bool lz4) : max_bytes(max_bytes), max_ms(max_ms), lz4(lz4) {}
+
+  void add(TopicBatch &b, const char *data, size_t size) {
+    if (b.count > 0 && b.payload.size() + sizeof(uint32_t) + size > max_bytes) {
+      flush(b);
+    }
+
+    double offset_ms = 0;
+    if (b.count == 0) {
+      b.first = bridge_clock::now();
+    } else {
+      offset_ms = millis_since(b.first);
+    }
+
+    uint32_t sz = size;
+    b.payload.append((const char *)&sz, sizeof(sz));
+    b.payload.append(data, size);
+    b.count++;
+    b.added_sum_ms += offset_ms;
+    stats.msgs++;
+    stats.raw_bytes += size;
+
+    if (b.payload.size() >= max_bytes) {
+      flush(b);
+    }
+  }
+
+  void flush(TopicBatch &b) {
+    if (b.count == 0) return;
+
+    bridge_frame_header_t header = {BRIDGE_FRAME_MAGIC, 0, b.count, (uint32_t)b.payload.size()};
+    const char *body = b.payload.data();
+    size_t body_size = b.payload.size();
+
+    if (lz4) {
+      int bound = LZ4_compressBound(body_size);
+      if (compressed.size() < (size_t)bound) compressed.resize(bound);
+      int r = LZ4_compress_default(body, &compressed[0], body_size, bound);
+      if (r > 0 && (size_t)r < body_size) {
+        header.flags |= BRIDGE_FRAME_LZ4;
+        body = compressed.data();
+        body_size = r;
+      }
+    }
+
+    frame.resize(sizeof(header) + body_size);
+    memcpy(&frame[0], &header, sizeof(header));
+    memcpy(&frame[sizeof(header)], body, body_size);
+    b.pub_sock->send(&frame[0], frame.size());
+
+    double age_ms = millis_since(b.first);
+    stats.add_latency(b.count * age_ms - b.added_sum_ms, b.count, age_ms);
+    stats.frames++;
+    stats.wire_bytes += frame.size();
+
+    b.payload.clear();
+    b.count = 0;
+    b.added_sum_ms = 0;
+  }
+
+  // flushes the batches older than max_ms, returns the poll timeout until the next one is due
+  int flush_expired(std::map<SubSocket*, TopicBatch> &batches, int max_timeout) {
+    double timeout = max_timeout;
+    for (auto &it : batches) {
+      TopicBatch &b = it.second;
+      if (b.count == 0) continue;
+
+      double remaining = max_ms - millis_since(b.first);
+      if (remaining <= 0) {
+        flush(b);
+      } else {
+        timeout = std::min(timeout, remaining);
+      }
+    }
+    return std::max(1, (int)std::ceil(timeout));
+  }
+
+  BridgeStats stats;
+
+private:
+  size_t max_bytes;
+  double max_ms;
+  bool lz4;
+  std::string compressed;
+  std::string frame;
+};
+
+// unpacks a frame from the batched sender and republishes its messages with a single msgq publish
+static bool bridge_unpack_frame(Message *msg, PubSocket *pub_sock, std::string &decompressed, BridgeStats &stats) {
+  auto start = bridge_clock::now();
+
+  bridge_frame_header_t header;
+  if (msg->getSize() < sizeof(header)) return false;
+  memcpy(&header, msg->getData(), sizeof(header));
+  if (header.magic != BRIDGE_FRAME_MAGIC) return false;
+
+  const char *body = msg->getData() + sizeof(header);
+  size_t body_size = msg->getSize() - sizeof(header);
+
+  if (header.flags & BRIDGE_FRAME_LZ4) {
+    if (decompressed.size() < header.raw_size) decompressed.resize(header.raw_size);
+    int r = LZ4_decompress_safe(body, &decompressed[0], body_size, header.raw_size);
+    if (r != (int)header.raw_size) return false;
+    body = decompressed.data();
+    body_size = r;
+  } else if (body_size != header.raw_size) {
+    return false;
+  }
+
+  std::vector<kj::ArrayPtr<capnp::byte>> messages;
+  messages.reserve(header.count);
+  size_t pos = 0;
+  for (uint32_t i = 0; i < header.count; i++) {
+    uint32_t sz;
+    if (pos + sizeof(sz) > body_size) return false;
+    memcpy(&sz, body + pos, sizeof(sz));
+    pos += sizeof(sz);
+    if (pos + sz > body_size) return false;
+    messages.push_back(kj::ArrayPtr<capnp::byte>((capnp::byte *)body + pos, sz));
+    pos += sz;
+  }
+
+  pub_sock->sendv(messages);
+
+  double latency_ms = millis_since(start);
+  stats.msgs += header.count;
+  stats.frames++;
+  stats.raw_bytes += body_size;
+  stats.wire_bytes += msg->getSize();
+  stats.add_latency(latency_ms, 1, latency_ms);
+  return true;
+}
+
 void sigpipe_handler(int sig) {
   assert(sig == SIGPIPE);
   std::cout << "SIGPIPE received" << std::endl;
@@ -36,6 +239,15 @@ int main(int argc, char** argv) {
   std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
   std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
 
+  bool batch = std::getenv("BRIDGE_BATCH") != nullptr;
+  // a frame is republished with one msgq batch send, which has to fit in a third of the smallest segment
+  size_t min_segment_size = DEFAULT_SEGMENT_SIZE;
+  for (const auto& it : services) min_segment_size = std::min(min_segment_size, it.segment_size);
+  size_t batch_bytes = std::min(env_size("BRIDGE_BATCH_KB", 64) * 1024, min_segment_size / 3);
+  double batch_ms = env_size("BRIDGE_BATCH_MS", 10);
+  bool lz4 = std::getenv("BRIDGE_LZ4") != nullptr;
+  double stats_interval_ms = env_size("BRIDGE_STATS_S", 5) * 1000.0;
+
   Poller *poller;
   Context *pub_context;
   Context *sub_context;
@@ -50,6 +262,7 @@ int main(int argc, char** argv) {
   }
 
   std::map<SubSocket*, PubSocket*> sub2pub;
+  std::map<SubSocket*, TopicBatch> batches;
   for (auto endpoint: get_services(whitelist_str, zmq_to_msgq)) {
     PubSocket * pub_sock;
     SubSocket * sub_sock;
@@ -65,14 +278,50 @@ int main(int argc, char** argv) {
 
     poller->registerSocket(sub_sock);
     sub2pub[sub_sock] = pub_sock;
+    batches[sub_sock].pub_sock = pub_sock;
+  }
+
+  if (!batch) {
+    while (true) {
+      for (auto sub_sock : poller->poll(100)) {
+        Message * msg = sub_sock->receive();
+        if (msg == NULL) continue;
+        sub2pub[sub_sock]->sendMessage(msg);
+        delete msg;
+      }
+    }
+    return 0;
   }
 
-  while (true) {
-    for (auto sub_sock : poller->poll(100)) {
-      Message * msg = sub_sock->receive();
-      if (msg == NULL) continue;
-      sub2pub[sub_sock]->sendMessage(msg);
-      delete msg;
+  if (zmq_to_msgq) {
+    BridgeStats stats;
+    std::string decompressed;
+    while (true) {
+      for (auto sub_sock : poller->poll(100)) {
+        Message * msg = sub_sock->receive();
+        if (msg == NULL) continue;
+        if (!bridge_unpack_frame(msg, sub2pub[sub_sock], decompressed, stats)) {
+          std::cout << "dropping malformed bridge frame" << std::endl;
+        }
+        delete msg;
+      }
+      if (millis_since(stats.start) > stats_interval_ms) stats.print_and_reset("zmq -> msgq");
+    }
+  } else {
+    BridgeBatcher batcher(batch_bytes, batch_ms, lz4);
+    int timeout = 100;
+    while (true) {
+      for (auto sub_sock : poller->poll(timeout)) {
+        TopicBatch &b = batches[sub_sock];
+        // drain everything that's queued, the poller only tells us there is at least one
+        Message * msg;
+        while ((msg = sub_sock->receive(true)) != NULL) {
+          batcher.add(b, msg->getData(), msg->getSize());
+          delete msg;
+        }
+      }
+      timeout = batcher.flush_expired(batches, 100);
+      if (millis_since(batcher.stats.start) > stats_interval_ms) batcher.stats.print_and_reset("msgq -> zmq");
     }
   }
   return 0;
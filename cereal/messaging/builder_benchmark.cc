@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <new>
+
+#include "messaging.h"
+
+// Counts heap allocations per message for a fresh MessageBuilder and for one built on a MessageArena.
+// usage: builder_benchmark [count] [can frames per message]
+
+static size_t num_allocs = 0;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+
+extern "C" void *malloc(size_t size) {
+  num_allocs++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  num_allocs++;
+  return __libc_calloc(n, size);
+}
+
+static void build_can(MessageBuilder &msg, int num_frames) {
+  uint8_t dat[8] = {};
+  auto can = msg.initEvent().initCan(num_frames);
+  for (int i = 0; i < num_frames; i++) {
+    can[i].setAddress(0x100 + i);
+    can[i].setBusTime(i);
+    can[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+    can[i].setSrc(i % 3);
+  }
+}
+
+template <typename F>
+static void run(const char *name, int count, F build) {
+  size_t bytes = 0;
+  size_t allocs_start = num_allocs;
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < count; i++) {
+    bytes += build();
+  }
+
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  printf("%-16s %6.2f allocs/msg %8.2f us/msg %8zu bytes/msg\n", name, (double)(num_allocs - allocs_start) / count,
+         us / count, bytes / count);
+}
+
+int main(int argc, char *argv[]) {
+  const int count = argc > 1 ? atoi(argv[1]) : 10000;
+  const int num_frames = argc > 2 ? atoi(argv[2]) : 256;
+
+  run("MessageBuilder", count, [&]() {
+    MessageBuilder msg;
+    build_can(msg, num_frames);
+    return msg.toBytes().size();
+  });
+
+  MessageArena arena;
+  run("MessageArena", count, [&]() {
+    MessageBuilder msg(arena);
+    build_can(msg, num_frames);
+    return msg.toBytes().size();
+  });
+
+  return 0;
+}
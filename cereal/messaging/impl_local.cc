@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "impl_local.h"
+
+struct LocalEntry {
+  std::shared_ptr<const std::vector<capnp::word>> words;
+  size_t size;
+};
+
+struct LocalSubscriber {
+  std::string endpoint;
+  bool conflate;
+  std::deque<LocalEntry> queue;
+  // the thread that last waited on or received from the queue, wait_idle doesn't wait for it to empty
+  std::thread::id reader;
+};
+
+// One lock and condition variable for all queues. Replay runs are about determinism, not contention
+struct LocalState {
+  std::mutex lock;
+  std::condition_variable cv;
+  std::map<std::string, std::vector<LocalSubscriber *>> subscribers;
+  // threads that received a message and haven't blocked waiting for the next one since
+  int busy_threads = 0;
+};
+
+static LocalState &local_state() {
+  static LocalState state;
+  return state;
+}
+
+// a thread that exits busy is done with its message too
+static thread_local struct BusyFlag {
+  bool busy = false;
+  ~BusyFlag() {
+    if (busy) {
+      auto &s = local_state();
+      std::lock_guard lk(s.lock);
+      s.busy_threads--;
+      s.cv.notify_all();
+    }
+  }
+} thread_busy;
+
+static void set_busy(LocalState &s, bool busy) {
+  if (thread_busy.busy != busy) {
+    thread_busy.busy = busy;
+    s.busy_threads += busy ? 1 : -1;
+    s.cv.notify_all();
+  }
+}
+
+template <class Predicate>
+static void wait_for(LocalState &s, std::unique_lock<std::mutex> &lk, int timeout, Predicate pred) {
+  if (timeout < 0) {
+    s.cv.wait(lk, pred);
+  } else {
+    s.cv.wait_for(lk, std::chrono::milliseconds(timeout), pred);
+  }
+}
+
+static std::shared_ptr<const std::vector<capnp::word>> copy_words(const char *data, size_t size) {
+  auto words = std::make_shared<std::vector<capnp::word>>(size / sizeof(capnp::word) + 1);
+  memcpy(words->data(), data, size);
+  return words;
+}
+
+
+void LocalMessage::init(size_t sz) {
+  auto w = std::make_shared<std::vector<capnp::word>>(sz / sizeof(capnp::word) + 1);
+  data = (char*)w->data();
+  words = w;
+  size = sz;
+}
+
+void LocalMessage::init(char * d, size_t sz) {
+  init(copy_words(d, sz), sz);
+}
+
+void LocalMessage::init(std::shared_ptr<const std::vector<capnp::word>> w, size_t sz) {
+  words = w;
+  data = (char*)words->data();
+  size = sz;
+}
+
+void LocalMessage::close() {
+  words.reset();
+  data = nullptr;
+  size = 0;
+}
+
+LocalMessage::~LocalMessage() {
+  this->close();
+}
+
+
+int LocalSubSocket::connect(Context *context, std::string endpoint, std::string address, bool conflate, bool check_endpoint){
+  auto &s = local_state();
+  std::lock_guard lk(s.lock);
+  sub = std::make_shared<LocalSubscriber>();
+  sub->endpoint = endpoint;
+  sub->conflate = conflate;
+  s.subscribers[endpoint].push_back(sub.get());
+  return 0;
+}
+
+void LocalSubSocket::setTimeout(int t){
+  timeout = t;
+}
+
+Message * LocalSubSocket::receive(bool non_blocking){
+  auto &s = local_state();
+  std::unique_lock lk(s.lock);
+  sub->reader = std::this_thread::get_id();
+
+  if (sub->queue.empty() && !non_blocking && timeout != 0) {
+    set_busy(s, false);
+    wait_for(s, lk, timeout, [&]() { return !sub->queue.empty(); });
+  }
+  if (sub->queue.empty()) return nullptr;
+
+  LocalEntry e = std::move(sub->queue.front());
+  sub->queue.pop_front();
+  set_busy(s, true);
+  s.cv.notify_all();
+
+  LocalMessage *r = new LocalMessage;
+  r->init(e.words, e.size);
+  return r;
+}
+
+kj::ArrayPtr<const capnp::word> LocalSubSocket::receiveView(bool non_blocking){
+  Message *msg = receive(non_blocking);
+  if (msg == nullptr) return {};
+
+  // the message stays alive in view until the next receive
+  view = copy_words(msg->getData(), msg->getSize());
+  const size_t num_words = msg->getSize() / sizeof(capnp::word);
+  delete msg;
+  return kj::arrayPtr(view->data(), num_words);
+}
+
+LocalSubSocket::~LocalSubSocket(){
+  if (!sub) return;
+
+  auto &s = local_state();
+  std::lock_guard lk(s.lock);
+  auto &subs = s.subscribers[sub->endpoint];
+  subs.erase(std::remove(subs.begin(), subs.end(), sub.get()), subs.end());
+  s.cv.notify_all();
+}
+
+
+int LocalPubSocket::connect(Context *context, std::string e, bool check_endpoint){
+  endpoint = e;
+  return 0;
+}
+
+int LocalPubSocket::sendMessage(Message *message){
+  return send(message->getData(), message->getSize());
+}
+
+int LocalPubSocket::send(char *data, size_t size){
+  return sendv({kj::arrayPtr((capnp::byte*)data, size)});
+}
+
+int LocalPubSocket::sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages){
+  // copied once, the subscribers share the copy
+  std::vector<LocalEntry> entries;
+  int total = 0;
+  for (auto &m : messages){
+    entries.push_back({copy_words((const char*)m.begin(), m.size()), m.size()});
+    total += m.size();
+  }
+
+  auto &s = local_state();
+  std::lock_guard lk(s.lock);
+  for (LocalSubscriber *sub : s.subscribers[endpoint]){
+    if (sub->conflate){
+      sub->queue.clear();
+      if (!entries.empty()) sub->queue.push_back(entries.back());
+    } else {
+      sub->queue.insert(sub->queue.end(), entries.begin(), entries.end());
+    }
+  }
+  s.cv.notify_all();
+  return total;
+}
+
+bool LocalPubSocket::all_readers_updated(){
+  auto &s = local_state();
+  std::lock_guard lk(s.lock);
+  for (LocalSubscriber *sub : s.subscribers[endpoint]){
+    if (!sub->queue.empty()) return false;
+  }
+  return true;
+}
+
+
+void LocalPoller::registerSocket(SubSocket *socket){
+  sockets.push_back(socket);
+}
+
+std::vector<SubSocket*> LocalPoller::poll(int timeout){
+  std::vector<SubSocket*> r(sockets.size());
+  r.resize(poll(timeout, r.data(), r.size()));
+  return r;
+}
+
+size_t LocalPoller::poll(int timeout, SubSocket **ready, size_t max_ready){
+  auto &s = local_state();
+  std::unique_lock lk(s.lock);
+
+  size_t num = 0;
+  auto collect = [&]() {
+    num = 0;
+    for (SubSocket *socket : sockets){
+      LocalSubscriber *sub = (LocalSubscriber*)socket->getRawSocket();
+      sub->reader = std::this_thread::get_id();
+      if (!sub->queue.empty() && num < max_ready) ready[num++] = socket;
+    }
+    return num > 0;
+  };
+
+  if (!collect() && timeout != 0){
+    set_busy(s, false);
+    wait_for(s, lk, timeout, collect);
+  }
+  return num;
+}
+
+
+namespace local_messaging {
+
+void set_time(uint64_t nanos) {
+  messaging_replay_time.store(nanos);
+}
+
+bool wait_idle(int timeout_ms) {
+  auto &s = local_state();
+  std::unique_lock lk(s.lock);
+  // the caller is waiting too, and the queues it reads are for it to drain
+  set_busy(s, false);
+  const auto self = std::this_thread::get_id();
+  auto idle = [&]() {
+    if (s.busy_threads > 0) return false;
+    for (auto &[endpoint, subs] : s.subscribers){
+      for (LocalSubscriber *sub : subs){
+        if (!sub->queue.empty() && sub->reader != self) return false;
+      }
+    }
+    return true;
+  };
+  wait_for(s, lk, timeout_ms, idle);
+  return idle();
+}
+
+}  // namespace local_messaging
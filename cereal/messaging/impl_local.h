@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "messaging.h"
+
+// In process transport, selected with MESSAGING_LOCAL=1. Every socket of the process shares one
+// set of queues, so daemons linked into one replay binary talk without msgq or zmq. Together with
+// local_messaging::set_time and wait_idle, a replay can step them in lockstep with the log
+
+class LocalContext : public Context {
+public:
+  void * getRawContext() {return nullptr;}
+  ~LocalContext() {}
+};
+
+class LocalMessage : public Message {
+private:
+  // shared by the subscribers that got the message
+  std::shared_ptr<const std::vector<capnp::word>> words;
+  char * data = nullptr;
+  size_t size = 0;
+public:
+  void init(size_t size);
+  void init(char *data, size_t size);
+  void init(std::shared_ptr<const std::vector<capnp::word>> words, size_t size);
+  size_t getSize(){return size;}
+  char * getData(){return data;}
+  void close();
+  ~LocalMessage();
+};
+
+struct LocalSubscriber;
+
+class LocalSubSocket : public SubSocket {
+private:
+  std::shared_ptr<LocalSubscriber> sub;
+  int timeout = -1;
+  // the message handed out by receiveView
+  std::shared_ptr<const std::vector<capnp::word>> view;
+public:
+  int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
+  void setTimeout(int timeout);
+  void * getRawSocket() {return (void*)sub.get();}
+  Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false);
+  bool viewValid() {return true;}
+  ~LocalSubSocket();
+};
+
+class LocalPubSocket : public PubSocket {
+private:
+  std::string endpoint;
+public:
+  int connect(Context *context, std::string endpoint, bool check_endpoint=true);
+  int sendMessage(Message *message);
+  int send(char *data, size_t size);
+  int sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages);
+  bool all_readers_updated();
+  ~LocalPubSocket() {}
+};
+
+class LocalPoller : public Poller {
+private:
+  std::vector<SubSocket*> sockets;
+
+public:
+  void registerSocket(SubSocket *socket);
+  std::vector<SubSocket*> poll(int timeout);
+  size_t poll(int timeout, SubSocket **ready, size_t max_ready);
+  ~LocalPoller() {}
+};
+
+namespace local_messaging {
+
+// logMonoTime of the events built from now on and the time SubMaster checks liveness against,
+// a replay sets it to the logMonoTime of the messages it publishes. 0 goes back to CLOCK_BOOTTIME
+void set_time(uint64_t nanos);
+
+// Waits until every message sent is received, and every thread that received one is blocked
+// waiting for the next, in a blocking receive or a poll. False on timeout
+bool wait_idle(int timeout_ms = -1);
+
+}  // namespace local_messaging
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <thread>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "impl_local.h"
+
+static std::string receive_str(SubSocket *sock){
+  Message *msg = sock->receive(true);
+  REQUIRE(msg != nullptr);
+  std::string r(msg->getData(), msg->getSize());
+  delete msg;
+  return r;
+}
+
+TEST_CASE("Local send reaches every subscriber"){
+  LocalContext ctx;
+  LocalPubSocket pub;
+  LocalSubSocket sub1, sub2;
+  pub.connect(&ctx, "test_local");
+  sub1.connect(&ctx, "test_local", "127.0.0.1");
+  sub2.connect(&ctx, "test_local", "127.0.0.1");
+
+  REQUIRE(pub.all_readers_updated());
+  REQUIRE(pub.send((char *)"one", 3) == 3);
+  REQUIRE(pub.send((char *)"two", 3) == 3);
+  REQUIRE(!pub.all_readers_updated());
+
+  REQUIRE(receive_str(&sub1) == "one");
+  REQUIRE(receive_str(&sub1) == "two");
+  REQUIRE(sub1.receive(true) == nullptr);
+  REQUIRE(receive_str(&sub2) == "one");
+  REQUIRE(receive_str(&sub2) == "two");
+  REQUIRE(pub.all_readers_updated());
+}
+
+TEST_CASE("Local conflated subscriber keeps the newest message"){
+  LocalContext ctx;
+  LocalPubSocket pub;
+  LocalSubSocket sub;
+  pub.connect(&ctx, "test_local_conflate");
+  sub.connect(&ctx, "test_local_conflate", "127.0.0.1", true);
+
+  pub.send((char *)"one", 3);
+  pub.send((char *)"two", 3);
+  REQUIRE(receive_str(&sub) == "two");
+  REQUIRE(sub.receive(true) == nullptr);
+}
+
+TEST_CASE("wait_idle waits for the daemon to handle the message"){
+  LocalContext ctx;
+  LocalPubSocket input, output;
+  LocalSubSocket daemon_in, replay_out;
+  input.connect(&ctx, "test_local_in");
+  output.connect(&ctx, "test_local_out");
+  daemon_in.connect(&ctx, "test_local_in", "127.0.0.1");
+  replay_out.connect(&ctx, "test_local_out", "127.0.0.1");
+  REQUIRE(replay_out.receive(true) == nullptr);
+
+  // echoes every input, after a delay the replay must not race
+  std::thread daemon([&](){
+    for (int i = 0; i < 3; i++){
+      Message *msg = daemon_in.receive();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      output.sendMessage(msg);
+      delete msg;
+    }
+  });
+
+  for (int i = 0; i < 3; i++){
+    std::string s = std::to_string(i);
+    local_messaging::set_time(i + 1);
+    input.send((char *)s.data(), s.size());
+    REQUIRE(local_messaging::wait_idle(1000));
+    REQUIRE(receive_str(&replay_out) == s);
+  }
+  local_messaging::set_time(0);
+  daemon.join();
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -25,14 +26,24 @@ static bool service_exists(std::string path){
   return false;
 }
 
+// Services have their segment size in the service list, other endpoints get the default
 static size_t get_size(std::string endpoint){
-  size_t sz = DEFAULT_SEGMENT_SIZE;
-
-  if (endpoint == "roadCameraState" || endpoint == "driverCameraState" || endpoint == "wideRoadCameraState"){
-    sz *= 10;
+  for (const auto& it : services) {
+    if (it.name == endpoint) {
+      return it.segment_size;
+    }
   }
+  return DEFAULT_SEGMENT_SIZE;
+}
 
-  return sz;
+// Widely subscribed services have a larger reader table in the service list, 0 is the default
+static size_t get_num_readers(std::string endpoint){
+  for (const auto& it : services) {
+    if (it.name == endpoint && it.num_readers > 0) {
+      return it.num_readers;
+    }
+  }
+  return DEFAULT_NUM_READERS;
 }
 
 
@@ -58,6 +69,12 @@ void MSGQMessage::takeOwnership(char * d, size_t sz) {
   data = d;
 }
 
+char * MSGQMessage::release() {
+  if (size == 0) return nullptr;
+  size = 0;
+  return data;
+}
+
 void MSGQMessage::close() {
   if (size > 0){
     delete[] data;
@@ -78,7 +95,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -95,7 +112,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
 }
 
 
-Message * MSGQSubSocket::receive(bool non_blocking){
+int MSGQSubSocket::receive_msg(msgq_msg_t *msg, bool non_blocking, bool view){
   msgq_do_exit = 0;
 
   void (*prev_handler_sigint)(int);
@@ -105,11 +122,8 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     prev_handler_sigterm = std::signal(SIGTERM, sig_handler);
   }
 
-  msgq_msg_t msg;
-
-  MSGQMessage *r = NULL;
-
-  int rc = msgq_msg_recv(&msg, q);
+  auto recv = view ? msgq_msg_recv_view : msgq_msg_recv;
+  int rc = recv(msg, q);
 
   // Hack to implement blocking read with a poller. Don't use this
   while (!non_blocking && rc == 0 && msgq_do_exit == 0){
@@ -119,7 +133,7 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     int t = (timeout != -1) ? timeout : 100;
 
     int n = msgq_poll(items, 1, t);
-    rc = msgq_msg_recv(&msg, q);
+    rc = recv(msg, q);
 
     // The poll indicated a message was ready, but the receive failed. Try again
     if (n == 1 && rc == 0){
@@ -139,18 +153,46 @@ Message * MSGQSubSocket::receive(bool non_blocking){
 
   errno = msgq_do_exit ? EINTR : 0;
 
-  if (rc > 0){
-    if (msgq_do_exit){
-      msgq_msg_close(&msg); // Free unused message on exit
-    } else {
-      r = new MSGQMessage;
-      r->takeOwnership(msg.data, msg.size);
+  if (rc > 0 && msgq_do_exit){
+    if (!view){
+      msgq_msg_close(msg); // Free unused message on exit
     }
+    rc = 0;
+  }
+
+  return rc;
+}
+
+Message * MSGQSubSocket::receive(bool non_blocking){
+  msgq_msg_t msg;
+  MSGQMessage *r = NULL;
+
+  int rc = receive_msg(&msg, non_blocking, false);
+  if (rc > 0){
+    r = new MSGQMessage;
+    r->takeOwnership(msg.data, msg.size);
   }
 
   return (Message*)r;
 }
 
+kj::ArrayPtr<const capnp::word> MSGQSubSocket::receiveView(bool non_blocking){
+  msgq_msg_t msg;
+  kj::ArrayPtr<const capnp::word> r;
+
+  // Messages are stored 8 byte aligned in the segment, so capnp can read them in place
+  int rc = receive_msg(&msg, non_blocking, true);
+  if (rc > 0){
+    r = kj::ArrayPtr<const capnp::word>((const capnp::word*)msg.data, msg.size / sizeof(capnp::word));
+  }
+
+  return r;
+}
+
+bool MSGQSubSocket::viewValid(){
+  return msgq_msg_view_valid(q);
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
@@ -170,7 +212,7 @@ int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_en
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -196,6 +238,16 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+int MSGQPubSocket::sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages){
+  std::vector<msgq_msg_t> msgs(messages.size());
+  for (size_t i = 0; i < messages.size(); i++){
+    msgs[i].data = (char *)messages[i].begin();
+    msgs[i].size = messages[i].size();
+  }
+
+  return msgq_msg_send_batch(msgs.data(), msgs.size(), q);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
@@ -208,23 +260,38 @@ MSGQPubSocket::~MSGQPubSocket(){
 }
 
 
+MSGQPoller::MSGQPoller(){
+  msgq_poller_init(&poller);
+}
+
 void MSGQPoller::registerSocket(SubSocket * socket){
-  assert(num_polls + 1 < MAX_POLLERS);
-  polls[num_polls].q = (msgq_queue_t*)socket->getRawSocket();
+  assert(sockets.size() + 1 < MAX_POLLERS);
+  int r = msgq_poller_add(&poller, (msgq_queue_t*)socket->getRawSocket());
+  assert(r >= 0);
 
   sockets.push_back(socket);
-  num_polls++;
 }
 
 std::vector<SubSocket*> MSGQPoller::poll(int timeout){
   std::vector<SubSocket*> r;
 
-  msgq_poll(polls, num_polls, timeout);
-  for (size_t i = 0; i < num_polls; i++){
-    if (polls[i].revents){
-      r.push_back(sockets[i]);
-    }
+  size_t num = msgq_poller_poll(&poller, ready, MAX_POLLERS, timeout);
+  for (size_t i = 0; i < num; i++){
+    r.push_back(sockets[ready[i]]);
   }
 
   return r;
 }
+
+size_t MSGQPoller::poll(int timeout, SubSocket **ready_sockets, size_t max_ready){
+  size_t num = msgq_poller_poll(&poller, ready, std::min(max_ready, (size_t)MAX_POLLERS), timeout);
+  for (size_t i = 0; i < num; i++){
+    ready_sockets[i] = sockets[ready[i]];
+  }
+
+  return num;
+}
+
+MSGQPoller::~MSGQPoller(){
+  msgq_poller_close(&poller);
+}
@@ -25,6 +25,7 @@ public:
   void takeOwnership(char *data, size_t size);
   size_t getSize(){return size;}
   char * getData(){return data;}
+  char * release();
   void close();
   ~MSGQMessage();
 };
@@ -33,11 +34,14 @@ class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
   int timeout;
+  int receive_msg(msgq_msg_t *msg, bool non_blocking, bool view);
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false);
+  bool viewValid();
   ~MSGQSubSocket();
 };
 
@@ -48,18 +52,23 @@ public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages);
   bool all_readers_updated();
   ~MSGQPubSocket();
 };
 
+static_assert(MAX_POLLERS <= MSGQ_POLL_GROUP_ITEMS, "MSGQPoller can't hold MAX_POLLERS sockets");
+
 class MSGQPoller : public Poller {
 private:
   std::vector<SubSocket*> sockets;
-  msgq_pollitem_t polls[MAX_POLLERS];
-  size_t num_polls = 0;
+  msgq_poller_t poller;
+  size_t ready[MAX_POLLERS];
 
 public:
+  MSGQPoller();
   void registerSocket(SubSocket *socket);
   std::vector<SubSocket*> poll(int timeout);
-  ~MSGQPoller(){};
+  size_t poll(int timeout, SubSocket **ready, size_t max_ready);
+  ~MSGQPoller();
 };
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <cerrno>
+#include <cstdint>
 
 #include <zmq.h>
 
@@ -31,22 +32,48 @@ ZMQContext::~ZMQContext() {
   zmq_ctx_term(context);
 }
 
+static inline bool is_word_aligned(const void *p) {
+  return ((uintptr_t)p % sizeof(capnp::word)) == 0;
+}
+
+ZMQMessage::ZMQMessage() {
+  zmq_msg_init(&frame);
+}
+
 void ZMQMessage::init(size_t sz) {
+  close();
   size = sz;
-  data = new char[size];
+  copy = data = new char[size];
 }
 
 void ZMQMessage::init(char * d, size_t sz) {
-  size = sz;
-  data = new char[size];
+  init(sz);
   memcpy(data, d, size);
 }
 
-void ZMQMessage::close() {
-  if (size > 0){
-    delete[] data;
+void ZMQMessage::init(zmq_msg_t *f) {
+  close();
+  zmq_msg_move(&frame, f);
+  size = zmq_msg_size(&frame);
+  data = (char*)zmq_msg_data(&frame);
+
+  // Small frames live inside the zmq_msg_t and frames can point into the receive buffer,
+  // readers expect word aligned data
+  if (!is_word_aligned(data)){
+    copy = new char[size];
+    memcpy(copy, data, size);
+    data = copy;
+    zmq_msg_close(&frame);
+    zmq_msg_init(&frame);
   }
+}
+
+void ZMQMessage::close() {
+  delete[] copy;
+  copy = data = NULL;
   size = 0;
+  zmq_msg_close(&frame);
+  zmq_msg_init(&frame);
 }
 
 ZMQMessage::~ZMQMessage() {
@@ -90,20 +117,44 @@ Message * ZMQSubSocket::receive(bool non_blocking){
   Message *r = NULL;
 
   if (rc >= 0){
-    // Make a copy to ensure the data is aligned
-    r = new ZMQMessage;
-    r->init((char*)zmq_msg_data(&msg), zmq_msg_size(&msg));
+    ZMQMessage *m = new ZMQMessage;
+    m->init(&msg);
+    r = m;
   }
 
   zmq_msg_close(&msg);
   return r;
 }
 
+ZMQSubSocket::ZMQSubSocket() {
+  zmq_msg_init(&view_frame);
+}
+
+kj::ArrayPtr<const capnp::word> ZMQSubSocket::receiveView(bool non_blocking){
+  // The frame of the previous view is released here, receiving into it closes it
+  int flags = non_blocking ? ZMQ_DONTWAIT : 0;
+  int rc = zmq_msg_recv(&view_frame, sock, flags);
+  kj::ArrayPtr<const capnp::word> r;
+
+  if (rc >= 0){
+    const char *data = (const char*)zmq_msg_data(&view_frame);
+    const size_t size = zmq_msg_size(&view_frame);
+    if (is_word_aligned(data) && size % sizeof(capnp::word) == 0){
+      r = kj::arrayPtr((const capnp::word*)data, size / sizeof(capnp::word));
+    } else {
+      r = view_buf.align(data, size);
+    }
+  }
+
+  return r;
+}
+
 void ZMQSubSocket::setTimeout(int timeout){
   zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(int));
 }
 
 ZMQSubSocket::~ZMQSubSocket(){
+  zmq_msg_close(&view_frame);
   zmq_close(sock);
 }
 
@@ -124,13 +175,37 @@ int ZMQPubSocket::connect(Context *context, std::string endpoint, bool check_end
 }
 
 int ZMQPubSocket::sendMessage(Message *message){
-  return zmq_send(sock, message->getData(), message->getSize(), ZMQ_DONTWAIT);
+  const size_t size = message->getSize();
+  char *data = message->release();
+  if (data == NULL){
+    return zmq_send(sock, message->getData(), size, ZMQ_DONTWAIT);
+  }
+
+  // Zero copy, zmq frees the buffer once it's on the wire
+  zmq_msg_t msg;
+  zmq_msg_init_data(&msg, data, size, [](void *d, void *) { delete[] (char*)d; }, NULL);
+  int r = zmq_msg_send(&msg, sock, ZMQ_DONTWAIT);
+  if (r < 0){
+    zmq_msg_close(&msg);
+  }
+  return r;
 }
 
 int ZMQPubSocket::send(char *data, size_t size){
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+int ZMQPubSocket::sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages){
+  // No batching in zmq, send them one by one
+  int total = 0;
+  for (auto &m : messages){
+    int r = zmq_send(sock, m.begin(), m.size(), ZMQ_DONTWAIT);
+    if (r < 0) return r;
+    total += r;
+  }
+  return total;
+}
+
 bool ZMQPubSocket::all_readers_updated() {
   assert(false); // TODO not implemented
   return false;
@@ -166,3 +241,19 @@ std::vector<SubSocket*> ZMQPoller::poll(int timeout){
 
   return r;
 }
+
+size_t ZMQPoller::poll(int timeout, SubSocket **ready, size_t max_ready){
+  int rc = zmq_poll(polls, num_polls, timeout);
+  if (rc < 0){
+    return 0;
+  }
+
+  size_t num = 0;
+  for (size_t i = 0; i < num_polls && num < max_ready; i++){
+    if (polls[i].revents){
+      ready[num++] = sockets[i];
+    }
+  }
+
+  return num;
+}
@@ -16,11 +16,17 @@ public:
 
 class ZMQMessage : public Message {
 private:
-  char * data;
-  size_t size;
+  // a received frame is kept and read in place, copy is only allocated when it wasn't word aligned
+  zmq_msg_t frame;
+  char * copy = NULL;
+  char * data = NULL;
+  size_t size = 0;
 public:
+  ZMQMessage();
   void init(size_t size);
   void init(char *data, size_t size);
+  // takes over the received frame, it's reset to an empty one
+  void init(zmq_msg_t *frame);
   size_t getSize(){return size;}
   char * getData(){return data;}
   void close();
@@ -31,11 +37,17 @@ class ZMQSubSocket : public SubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  // the frame handed out by receiveView, view_buf holds a copy of it when it wasn't word aligned
+  zmq_msg_t view_frame;
+  AlignedBuffer view_buf;
 public:
+  ZMQSubSocket();
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return sock;}
   Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false);
+  bool viewValid() {return true;}
   ~ZMQSubSocket();
 };
 
@@ -45,8 +57,11 @@ private:
   std::string full_endpoint;
 public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
+  // takes the buffer of messages that can release it, zmq frees it once it's sent
   int sendMessage(Message *message);
+  // zmq copies data, the caller keeps it
   int send(char *data, size_t size);
+  int sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages);
   bool all_readers_updated();
   ~ZMQPubSocket();
 };
@@ -60,5 +75,6 @@ private:
 public:
   void registerSocket(SubSocket *socket);
   std::vector<SubSocket*> poll(int timeout);
+  size_t poll(int timeout, SubSocket **ready, size_t max_ready);
   ~ZMQPoller(){};
 };
@@ -1,6 +1,7 @@
 #include "messaging.h"
 #include "impl_zmq.h"
 #include "impl_msgq.h"
+#include "impl_local.h"
 
 #ifdef __APPLE__
 const bool MUST_USE_ZMQ = true;
@@ -12,9 +13,15 @@ bool messaging_use_zmq(){
   return std::getenv("ZMQ") || MUST_USE_ZMQ;
 }
 
+bool messaging_use_local(){
+  return std::getenv("MESSAGING_LOCAL") != nullptr;
+}
+
 Context * Context::create(){
   Context * c;
-  if (messaging_use_zmq()){
+  if (messaging_use_local()){
+    c = new LocalContext();
+  } else if (messaging_use_zmq()){
     c = new ZMQContext();
   } else {
     c = new MSGQContext();
@@ -24,7 +31,9 @@ Context * Context::create(){
 
 SubSocket * SubSocket::create(){
   SubSocket * s;
-  if (messaging_use_zmq()){
+  if (messaging_use_local()){
+    s = new LocalSubSocket();
+  } else if (messaging_use_zmq()){
     s = new ZMQSubSocket();
   } else {
     s = new MSGQSubSocket();
@@ -46,7 +55,9 @@ SubSocket * SubSocket::create(Context * context, std::string endpoint, std::stri
 
 PubSocket * PubSocket::create(){
   PubSocket * s;
-  if (messaging_use_zmq()){
+  if (messaging_use_local()){
+    s = new LocalPubSocket();
+  } else if (messaging_use_zmq()){
     s = new ZMQPubSocket();
   } else {
     s = new MSGQPubSocket();
@@ -68,7 +79,9 @@ PubSocket * PubSocket::create(Context * context, std::string endpoint, bool chec
 
 Poller * Poller::create(){
   Poller * p;
-  if (messaging_use_zmq()){
+  if (messaging_use_local()){
+    p = new LocalPoller();
+  } else if (messaging_use_zmq()){
     p = new ZMQPoller();
   } else {
     p = new MSGQPoller();
@@ -1,5 +1,7 @@
 #pragma once
+#include <atomic>
 #include <cstddef>
+#include <cstring>
 #include <map>
 #include <string>
 #include <vector>
@@ -13,6 +15,10 @@
 #define MSG_MULTIPLE_PUBLISHERS 100
 
 bool messaging_use_zmq();
+bool messaging_use_local();
+
+// Replayed time in ns, 0 for CLOCK_BOOTTIME. Set by local_messaging::set_time in lockstep replays
+inline std::atomic<uint64_t> messaging_replay_time{0};
 
 class Context {
 public:
@@ -28,6 +34,9 @@ public:
   virtual void close() = 0;
   virtual size_t getSize() = 0;
   virtual char * getData() = 0;
+  // Hands the data buffer over, to be freed with delete[], and leaves the message empty.
+  // nullptr for messages that can't give up their buffer
+  virtual char * release() {return nullptr;}
   virtual ~Message(){};
 };
 
@@ -37,6 +46,10 @@ public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Borrowed, word aligned view of the next message. It is valid until the next receive on this socket,
+  // check viewValid() after reading it to detect that the publisher overwrote it in the meantime
+  virtual kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false) = 0;
+  virtual bool viewValid() = 0;
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -48,6 +61,8 @@ public:
   virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  // Publishes several messages at once, with msgq readers see them atomically and are woken once
+  virtual int sendv(const std::vector<kj::ArrayPtr<capnp::byte>> &messages) = 0;
   virtual bool all_readers_updated() = 0;
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
@@ -59,6 +74,8 @@ class Poller {
 public:
   virtual void registerSocket(SubSocket *socket) = 0;
   virtual std::vector<SubSocket*> poll(int timeout) = 0;
+  // Same without allocating, writes up to max_ready sockets and returns how many were written
+  virtual size_t poll(int timeout, SubSocket **ready, size_t max_ready) = 0;
   static Poller * create();
   static Poller * create(std::vector<SubSocket*> sockets);
   virtual ~Poller(){};
@@ -66,6 +83,9 @@ public:
 
 class SubMaster {
 public:
+  // Resolve the service name once, the accessors taking a handle are plain array indexing
+  struct Handle { size_t idx; };
+
   SubMaster(const std::vector<const char *> &service_list,
             const char *address = nullptr, const std::vector<const char *> &ignore_alive = {});
   void update(int timeout = 1000);
@@ -77,53 +97,111 @@ public:
   ~SubMaster();
 
   uint64_t frame = 0;
-  bool updated(const char *name) const;
-  bool alive(const char *name) const;
-  bool valid(const char *name) const;
-  uint64_t rcv_frame(const char *name) const;
-  uint64_t rcv_time(const char *name) const;
-  cereal::Event::Reader &operator[](const char *name) const;
+  Handle handle(const char *name) const;
+  bool updated(const char *name) const { return updated(handle(name)); }
+  bool alive(const char *name) const { return alive(handle(name)); }
+  bool valid(const char *name) const { return valid(handle(name)); }
+  uint64_t rcv_frame(const char *name) const { return rcv_frame(handle(name)); }
+  uint64_t rcv_time(const char *name) const { return rcv_time(handle(name)); }
+  double freq(const char *name) const { return freq(handle(name)); }
+  double jitter(const char *name) const { return jitter(handle(name)); }
+  cereal::Event::Reader &operator[](const char *name) const { return (*this)[handle(name)]; }
+
+  bool updated(Handle h) const;
+  bool alive(Handle h) const;
+  bool valid(Handle h) const;
+  uint64_t rcv_frame(Handle h) const;
+  uint64_t rcv_time(Handle h) const;
+  // Hz and seconds, moving estimates of the rate and the inter-arrival jitter of the messages as they
+  // were received, 0 until there were two
+  double freq(Handle h) const;
+  double jitter(Handle h) const;
+  cereal::Event::Reader &operator[](Handle h) const;
 
 private:
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
-  Poller *poller_ = nullptr;
+  void update_msg(uint64_t current_time, size_t idx, cereal::Event::Reader event);
   struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  bool alive_(const SubMessage &m) const;
+  Poller *poller_ = nullptr;
+  // of the last update, alive is as of then
+  uint64_t update_time_ = 0;
+  std::vector<SubMessage> messages_;
+  std::vector<SubSocket *> ready_;
+  std::map<std::string, size_t, std::less<>> services_;
+};
+
+// First segment and serialization buffer that outlive a single MessageBuilder. Publishers
+// that send at a high rate keep one around to avoid mallocing both for every message.
+// Only one MessageBuilder can use an arena at a time.
+class MessageArena {
+public:
+  explicit MessageArena(size_t first_segment_words = 8192) : first_segment_(kj::heapArray<capnp::word>(first_segment_words)) {
+    // capnp requires a zeroed first segment, MallocMessageBuilder zeroes it again when it's done with it
+    memset(first_segment_.begin(), 0, first_segment_.asBytes().size());
+  }
+
+private:
+  friend class MessageBuilder;
+  kj::Array<capnp::word> first_segment_;
+  kj::Array<capnp::word> output_;
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  explicit MessageBuilder(MessageArena &arena) : capnp::MallocMessageBuilder(arena.first_segment_), arena_(&arena) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
-    struct timespec t;
-    clock_gettime(CLOCK_BOOTTIME, &t);
-    uint64_t current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
+    uint64_t current_time = messaging_replay_time.load(std::memory_order_relaxed);
+    if (current_time == 0) {
+      struct timespec t;
+      clock_gettime(CLOCK_BOOTTIME, &t);
+      current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
+    }
     event.setLogMonoTime(current_time);
     event.setValid(valid);
     return event;
   }
 
   kj::ArrayPtr<capnp::byte> toBytes() {
-    heapArray_ = capnp::messageToFlatArray(*this);
-    return heapArray_.asBytes();
+    if (arena_ == nullptr) {
+      heapArray_ = capnp::messageToFlatArray(*this);
+      return heapArray_.asBytes();
+    }
+
+    // Serialize into the arena, it only grows when a message is bigger than any before
+    size_t size = capnp::computeSerializedSizeInWords(*this);
+    if (arena_->output_.size() < size) {
+      arena_->output_ = kj::heapArray<capnp::word>(size);
+    }
+    kj::ArrayOutputStream stream(arena_->output_.asBytes());
+    capnp::writeMessage(stream, *this);
+    return stream.getArray();
   }
 
 private:
   kj::Array<capnp::word> heapArray_;
+  MessageArena *arena_ = nullptr;
 };
 
 class PubMaster {
 public:
+  struct Handle { size_t idx; };
+
   PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
-  int send(const char *name, MessageBuilder &msg);
+  Handle handle(const char *name) const;
+  inline int send(const char *name, capnp::byte *data, size_t size) { return send(handle(name), data, size); }
+  inline int send(Handle h, capnp::byte *data, size_t size) { return sockets_[h.idx]->send((char *)data, size); }
+  int send(const char *name, MessageBuilder &msg) { return send(handle(name), msg); }
+  int send(Handle h, MessageBuilder &msg);
+  int send_batch(const char *name, const std::vector<MessageBuilder *> &msgs);
   ~PubMaster();
 
 private:
-  std::map<std::string, PubSocket *> sockets_;
+  std::vector<PubSocket *> sockets_;
+  std::map<std::string, size_t, std::less<>> services_;
 };
 
 class AlignedBuffer {
@@ -0,0 +1,587 @@
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "messaging.h"
+#include "msgq.h"
+#include "visionipc/visionipc_client.h"
+#include "visionipc/visionipc_server.h"
+
+// The messaging stack through the interface the processes use (PubSocket, SubSocket, Poller and
+// VisionIpc) for each transport, in one run so an optimization can be compared against a baseline:
+//   throughput  one publisher sending as fast as it can to 1 to 8 readers, 64B to 1MB
+//   latency     send to receive of paced messages, 64B to 1MB
+//   conflate    draining a burst of 100 messages after a stall, conflated and not
+//   poller      send to the ready socket out of the poll, 1 to 50 sockets
+//   visionipc   VisionIpcServer::send to VisionIpcClient::recv of a road camera frame
+//   tlb         dTLB misses of a reader of many msgq queues and of camera frames, with and without
+//               MSGQ_HUGEPAGES and VISIONBUF_HUGEPAGES. Needs perf events (perf_event_paranoid <= 2)
+// Prints a JSON object per measurement on stdout, times in us, progress on stderr.
+// usage: messaging_bench [--transport msgq|zmq] [--bench name] [--count N]
+
+const size_t SIZES[] = {64, 1024, 16 * 1024, 128 * 1024, 1024 * 1024};
+const int ZMQ_BASE_PORT = 48100;
+
+static std::string transport;
+static int zmq_port = ZMQ_BASE_PORT;
+
+static inline uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void set_transport(const std::string &name) {
+  transport = name;
+  unsetenv("MESSAGING_LOCAL");
+  if (name == "zmq") {
+    setenv("ZMQ", "1", 1);
+  } else {
+    unsetenv("ZMQ");
+  }
+}
+
+// A name for msgq, they're reused so the queues in /dev/shm don't pile up. A port for zmq, a new
+// one every time since a closed socket can keep its port for a while
+static std::string endpoint(int i) {
+  if (transport == "zmq") return std::to_string(zmq_port++);
+  return "messaging_bench_" + std::to_string(i);
+}
+
+// One JSON object, the fields in the order they're added
+class Record {
+public:
+  explicit Record(const char *bench) {
+    s = "{\"bench\": \"" + std::string(bench) + "\", \"transport\": \"" + transport + "\"";
+  }
+  Record &num(const char *key, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), value == (int64_t)value ? ", \"%s\": %.0f" : ", \"%s\": %.3f", key, value);
+    s += buf;
+    return *this;
+  }
+  // the percentiles of latency samples in ns, as us
+  Record &latency(std::vector<uint64_t> &samples) {
+    num("n", samples.size());
+    if (samples.empty()) return *this;
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (uint64_t v : samples) sum += v;
+    auto pct = [&](double p) { return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))] / 1000.0; };
+    return num("mean_us", sum / samples.size() / 1000.0).num("p50_us", pct(0.5)).num("p99_us", pct(0.99))
+          .num("p999_us", pct(0.999)).num("max_us", samples.back() / 1000.0);
+  }
+  void print() {
+    printf("%s}\n", s.c_str());
+    fflush(stdout);
+  }
+
+private:
+  std::string s;
+};
+
+struct Sockets {
+  std::unique_ptr<PubSocket> pub;
+  std::vector<std::unique_ptr<SubSocket>> subs;
+};
+
+static void drain(SubSocket *sub) {
+  while (Message *msg = sub->receive(true)) delete msg;
+}
+
+// A publisher and its readers that got a first message, zmq subscriptions take a while to reach the
+// publisher, msgq readers only see what's sent after they attached
+static bool connect_sockets(Sockets &s, Context *ctx, const std::string &ep, int num_readers, bool conflate = false) {
+  s.pub.reset(PubSocket::create(ctx, ep, false));
+  if (!s.pub) return false;
+  for (int i = 0; i < num_readers; i++) {
+    SubSocket *sub = SubSocket::create(ctx, ep, "127.0.0.1", conflate, false);
+    if (!sub) return false;
+    sub->setTimeout(100);
+    s.subs.emplace_back(sub);
+  }
+
+  std::vector<bool> got(num_readers);
+  uint64_t ping = 0;
+  for (int tries = 0; tries < 500; tries++) {
+    s.pub->send((char *)&ping, sizeof(ping));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    bool all = true;
+    for (int i = 0; i < num_readers; i++) {
+      while (Message *msg = s.subs[i]->receive(true)) {
+        got[i] = true;
+        delete msg;
+      }
+      all = all && got[i];
+    }
+    if (all) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      for (auto &sub : s.subs) drain(sub.get());
+      return true;
+    }
+  }
+  return false;
+}
+
+static void bench_throughput(Context *ctx, int count) {
+  for (size_t size : SIZES) {
+    // about 256MB per reader
+    const int n = std::clamp((int)((256 << 20) / size), 200, std::max(count * 10, 200));
+    for (int num_readers : {1, 2, 4, 8}) {
+      Sockets s;
+      if (!connect_sockets(s, ctx, endpoint(0), num_readers)) {
+        fprintf(stderr, "throughput: failed to connect %zuB %d readers\n", size, num_readers);
+        continue;
+      }
+
+      std::atomic<bool> done = false;
+      std::vector<uint64_t> received(num_readers), last(num_readers);
+      std::vector<std::thread> readers;
+      for (int i = 0; i < num_readers; i++) {
+        readers.emplace_back([&, i]() {
+          while (true) {
+            Message *msg = s.subs[i]->receive();
+            if (msg == nullptr) {
+              if (done) break;
+              continue;
+            }
+            received[i]++;
+            last[i] = nanos_monotonic();
+            delete msg;
+          }
+        });
+      }
+
+      std::vector<char> data(size);
+      const uint64_t t0 = nanos_monotonic();
+      for (int i = 0; i < n; i++) {
+        s.pub->send(data.data(), size);
+      }
+      const uint64_t t1 = nanos_monotonic();
+      done = true;
+      for (auto &t : readers) t.join();
+
+      double recv_rate = 0, delivered = 1.0;
+      for (int i = 0; i < num_readers; i++) {
+        if (received[i] > 0) recv_rate += received[i] / ((last[i] - t0) * 1e-9);
+        delivered = std::min(delivered, (double)received[i] / n);
+      }
+      const double send_rate = n / ((t1 - t0) * 1e-9);
+      Record("throughput").num("size", size).num("readers", num_readers).num("n", n)
+        .num("send_msgs_per_s", send_rate).num("send_MB_per_s", send_rate * size / 1e6)
+        .num("recv_msgs_per_s", recv_rate / num_readers).num("delivered", delivered).print();
+    }
+  }
+}
+
+static void bench_latency(Context *ctx, int count) {
+  for (size_t size : SIZES) {
+    // paced so the reader is waiting for each message, the big ones slower to not measure the bandwidth
+    const int pace_us = size >= 128 * 1024 ? 5000 : 1000;
+    const int n = size >= 128 * 1024 ? std::min(count, 1000) : count;
+    for (int num_readers : {1, 4}) {
+      Sockets s;
+      if (!connect_sockets(s, ctx, endpoint(0), num_readers)) {
+        fprintf(stderr, "latency: failed to connect %zuB %d readers\n", size, num_readers);
+        continue;
+      }
+
+      std::atomic<bool> done = false;
+      std::vector<std::vector<uint64_t>> samples(num_readers);
+      std::vector<std::thread> readers;
+      for (int i = 0; i < num_readers; i++) {
+        samples[i].reserve(n);
+        readers.emplace_back([&, i]() {
+          while (true) {
+            Message *msg = s.subs[i]->receive();
+            if (msg == nullptr) {
+              if (done) break;
+              continue;
+            }
+            const uint64_t t = nanos_monotonic();
+            uint64_t sent;
+            memcpy(&sent, msg->getData(), sizeof(sent));
+            samples[i].push_back(t - sent);
+            delete msg;
+          }
+        });
+      }
+
+      std::vector<char> data(size);
+      for (int i = 0; i < n; i++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(pace_us));
+        const uint64_t t = nanos_monotonic();
+        memcpy(data.data(), &t, sizeof(t));
+        s.pub->send(data.data(), size);
+      }
+      done = true;
+      for (auto &t : readers) t.join();
+
+      std::vector<uint64_t> all;
+      for (auto &v : samples) all.insert(all.end(), v.begin(), v.end());
+      Record("latency").num("size", size).num("readers", num_readers).num("sent", n).latency(all).print();
+    }
+  }
+}
+
+static void bench_conflate(Context *ctx, int count) {
+  // a burst of can messages of a few pandas, a reader that stalled for a second
+  const size_t size = 2048;
+  const int burst = 100;
+  const int n = std::max(count / 10, 10);
+
+  for (bool conflate : {false, true}) {
+    Sockets s;
+    if (!connect_sockets(s, ctx, endpoint(0), 1, conflate)) {
+      fprintf(stderr, "conflate: failed to connect\n");
+      continue;
+    }
+    SubSocket *sub = s.subs[0].get();
+
+    std::vector<char> data(size);
+    std::vector<uint64_t> samples;
+    uint64_t received = 0, newest = 0;
+    for (int i = 0; i < n; i++) {
+      uint64_t seq = 0;
+      for (int j = 0; j < burst; j++) {
+        seq = (uint64_t)i * burst + j + 1;
+        memcpy(data.data(), &seq, sizeof(seq));
+        s.pub->send(data.data(), size);
+      }
+      // for zmq to have it all on the reader's side
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+      const uint64_t t = nanos_monotonic();
+      uint64_t last = 0;
+      while (Message *msg = sub->receive(true)) {
+        memcpy(&last, msg->getData(), sizeof(last));
+        received++;
+        delete msg;
+      }
+      samples.push_back(nanos_monotonic() - t);
+      newest += last == seq;
+    }
+    Record("conflate").num("conflate", conflate).num("size", size).num("burst", burst)
+      .num("recv_per_burst", (double)received / n).num("newest", (double)newest / n).latency(samples).print();
+  }
+}
+
+static void bench_poller(Context *ctx, int count) {
+  for (int num_sockets : {1, 2, 5, 10, 20, 50}) {
+    std::vector<Sockets> sockets(num_sockets);
+    std::vector<SubSocket *> subs;
+    bool ok = true;
+    for (int i = 0; i < num_sockets && ok; i++) {
+      ok = connect_sockets(sockets[i], ctx, endpoint(i), 1);
+      if (ok) subs.push_back(sockets[i].subs[0].get());
+    }
+    if (!ok) {
+      fprintf(stderr, "poller: failed to connect %d sockets\n", num_sockets);
+      continue;
+    }
+    std::unique_ptr<Poller> poller(Poller::create(subs));
+
+    char data[64] = {};
+    std::vector<uint64_t> samples;
+    samples.reserve(count);
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+      const int idx = (i * 7) % num_sockets;
+      const uint64_t t = nanos_monotonic();
+      sockets[idx].pub->send(data, sizeof(data));
+
+      SubSocket *ready[1];
+      size_t num = 0;
+      for (int tries = 0; tries < 10 && num == 0; tries++) num = poller->poll(100, ready, 1);
+      samples.push_back(nanos_monotonic() - t);
+      if (num == 0) continue;
+
+      wrong += ready[0] != subs[idx];
+      drain(ready[0]);
+      drain(subs[idx]);
+    }
+    Record("poller").num("sockets", num_sockets).num("wrong_ready", wrong).latency(samples).print();
+  }
+}
+
+static void bench_visionipc(int count) {
+  const size_t width = 1928, height = 1208;
+  for (bool conflate : {false, true}) {
+    VisionIpcServer server("messaging_bench");
+    server.create_buffers(VISION_STREAM_YUV_BACK, 4, false, width, height);
+    server.start_listener();
+
+    VisionIpcClient client("messaging_bench", VISION_STREAM_YUV_BACK, conflate);
+    if (!client.connect(true)) {
+      fprintf(stderr, "visionipc: failed to connect\n");
+      continue;
+    }
+
+    // the first frame that comes through, zmq needs a moment for the subscription
+    VisionIpcBufExtra extra = {};
+    bool synced = false;
+    for (int tries = 0; tries < 100 && !synced; tries++) {
+      server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+      synced = client.recv(&extra, 50) != nullptr;
+    }
+    if (!synced) {
+      fprintf(stderr, "visionipc: no frames\n");
+      continue;
+    }
+    while (client.recv(&extra, 10) != nullptr) {}
+
+    std::atomic<bool> done = false;
+    std::vector<uint64_t> samples;
+    samples.reserve(count);
+    std::thread reader([&]() {
+      while (!done) {
+        VisionIpcBufExtra recv_extra = {};
+        if (client.recv(&recv_extra, 100) != nullptr) {
+          samples.push_back(nanos_monotonic() - recv_extra.timestamp_eof);
+        }
+      }
+    });
+
+    // at 50Hz, a bit faster than the cameras
+    for (int i = 0; i < count; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      VisionBuf *buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+      VisionIpcBufExtra send_extra = {.frame_id = (uint32_t)i, .timestamp_eof = nanos_monotonic()};
+      server.send(buf, &send_extra);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    done = true;
+    reader.join();
+
+    Record("visionipc").num("conflate", conflate).num("width", width).num("height", height)
+      .num("sent", count).latency(samples).print();
+  }
+}
+
+#ifdef __linux__
+// dTLB load misses of the calling thread, in user space
+class TlbMisses {
+public:
+  TlbMisses() {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~TlbMisses() {
+    if (fd >= 0) close(fd);
+  }
+  bool valid() const { return fd >= 0; }
+  uint64_t count() const {
+    uint64_t v = 0;
+    return ::read(fd, &v, sizeof(v)) == sizeof(v) ? v : 0;
+  }
+
+private:
+  int fd;
+};
+
+// a word of every cache line, as a reader going through the message
+static uint64_t touch(const void *data, size_t size) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i + sizeof(uint64_t) <= size; i += 64) sum += *(const uint64_t *)((const char *)data + i);
+  return sum;
+}
+
+// of /proc/self/smaps_rollup, how much of the shared memory is mapped with huge pages
+static double smaps_kb(const char *field) {
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (f == nullptr) return -1;
+  char line[256];
+  double kb = -1;
+  const size_t len = strlen(field);
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, field, len) == 0 && line[len] == ':') kb = atof(line + len + 1);
+  }
+  fclose(f);
+  return kb;
+}
+
+static void set_hugepages(bool huge) {
+  if (huge) {
+    setenv("MSGQ_HUGEPAGES", "1", 1);
+    setenv("VISIONBUF_HUGEPAGES", "1", 1);
+  } else {
+    unsetenv("MSGQ_HUGEPAGES");
+    unsetenv("VISIONBUF_HUGEPAGES");
+  }
+}
+
+static void bench_tlb_msgq(int count) {
+  // loggerd reads dozens of queues, the rings are smaller here to fit the /dev/shm of a container
+  const int num_queues = 24;
+  const size_t queue_size = 2 * 1024 * 1024, size = 16 * 1024;
+  const int rounds = std::max(count / 4, 256);
+
+  for (bool huge : {false, true}) {
+    set_hugepages(huge);
+    const char *prefix = std::getenv("OPENPILOT_PREFIX");
+    const std::string dir = prefix ? "/dev/shm/" + std::string(prefix) + "/" : "/dev/shm/";
+
+    std::vector<msgq_queue_t> pubs(num_queues), subs(num_queues);
+    std::vector<std::string> names;
+    bool ok = true;
+    for (int i = 0; i < num_queues && ok; i++) {
+      // new files, the pages of one from a run before are already there in their size
+      names.push_back("messaging_bench_tlb_" + std::to_string(i));
+      unlink((dir + names.back()).c_str());
+      ok = msgq_new_queue(&pubs[i], names.back().c_str(), queue_size) == 0 &&
+           msgq_new_queue(&subs[i], names.back().c_str(), queue_size) == 0;
+      if (ok) {
+        msgq_init_publisher(&pubs[i]);
+        msgq_init_subscriber(&subs[i]);
+      }
+    }
+    if (!ok) {
+      fprintf(stderr, "tlb: failed to create queues\n");
+      set_hugepages(false);
+      return;
+    }
+
+    TlbMisses tlb;
+    if (!tlb.valid()) fprintf(stderr, "tlb: no perf events, only the times\n");
+
+    std::vector<char> data(size);
+    uint64_t misses = 0, ns = 0, sum = 0;
+    int msgs = 0;
+    for (int r = 0; r < rounds; r++) {
+      for (auto &pub : pubs) {
+        msgq_msg_t msg;
+        msg.data = data.data();
+        msg.size = size;
+        msgq_msg_send(&msg, &pub);
+      }
+
+      const uint64_t t = nanos_monotonic();
+      const uint64_t m = tlb.valid() ? tlb.count() : 0;
+      for (auto &sub : subs) {
+        msgq_msg_t msg;
+        if (msgq_msg_recv_view(&msg, &sub) > 0) {
+          sum += touch(msg.data, msg.size);
+          msgs++;
+        }
+      }
+      if (tlb.valid()) misses += tlb.count() - m;
+      ns += nanos_monotonic() - t;
+    }
+
+    Record("tlb_msgq").num("hugepages", huge).num("queues", num_queues).num("size", size).num("msgs", msgs)
+      .num("dtlb_misses_per_msg", tlb.valid() ? (double)misses / msgs : -1).num("ns_per_msg", (double)ns / msgs)
+      .num("shmem_pmd_mapped_kB", smaps_kb("ShmemPmdMapped")).num("checksum", sum % 1000).print();
+
+    for (int i = 0; i < num_queues; i++) {
+      msgq_close_queue(&subs[i]);
+      msgq_close_queue(&pubs[i]);
+      unlink((dir + names[i]).c_str());
+    }
+  }
+  set_hugepages(false);
+}
+
+static void bench_tlb_visionipc(int count) {
+  const size_t width = 1928, height = 1208;
+  for (bool huge : {false, true}) {
+    set_hugepages(huge);
+    VisionIpcServer server("messaging_bench");
+    server.create_buffers(VISION_STREAM_YUV_BACK, 4, false, width, height);
+    server.start_listener();
+
+    VisionIpcClient client("messaging_bench", VISION_STREAM_YUV_BACK, false);
+    if (!client.connect(true)) {
+      fprintf(stderr, "tlb: failed to connect to visionipc\n");
+      continue;
+    }
+
+    TlbMisses tlb;
+    VisionIpcBufExtra extra = {};
+    uint64_t misses = 0, ns = 0, sum = 0;
+    int frames = 0;
+    for (int i = 0; i < count; i++) {
+      server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+      VisionBuf *buf = client.recv(&extra, 100);
+      if (buf == nullptr) continue;
+
+      const uint64_t t = nanos_monotonic();
+      const uint64_t m = tlb.valid() ? tlb.count() : 0;
+      sum += touch(buf->addr, buf->len);
+      if (tlb.valid()) misses += tlb.count() - m;
+      ns += nanos_monotonic() - t;
+      frames++;
+    }
+
+    Record("tlb_visionipc").num("hugepages", huge).num("width", width).num("height", height).num("frames", frames)
+      .num("dtlb_misses_per_frame", tlb.valid() && frames ? (double)misses / frames : -1)
+      .num("us_per_frame", frames ? ns / 1000.0 / frames : 0)
+      .num("shmem_pmd_mapped_kB", smaps_kb("ShmemPmdMapped")).num("hugetlb_kB", smaps_kb("Shared_Hugetlb"))
+      .num("checksum", sum % 1000).print();
+  }
+  set_hugepages(false);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> transports = {"msgq", "zmq"};
+  std::string only;
+  int count = 2000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--transport") == 0 && i + 1 < argc) {
+      transports = {argv[++i]};
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      only = argv[++i];
+    } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+      count = std::max(atoi(argv[++i]), 10);
+    } else {
+      fprintf(stderr, "usage: %s [--transport msgq|zmq] [--bench throughput|latency|conflate|poller|visionipc|tlb] [--count N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for (const std::string &t : transports) {
+    set_transport(t);
+    std::unique_ptr<Context> ctx(Context::create());
+
+    auto run = [&](const char *name, auto &&bench) {
+      if (!only.empty() && only != name) return;
+      fprintf(stderr, "%s: %s\n", t.c_str(), name);
+      bench();
+    };
+    run("throughput", [&]() { bench_throughput(ctx.get(), count); });
+    run("latency", [&]() { bench_latency(ctx.get(), count); });
+    run("conflate", [&]() { bench_conflate(ctx.get(), count); });
+    run("poller", [&]() { bench_poller(ctx.get(), count); });
+    run("visionipc", [&]() { bench_visionipc(count / 4); });
+#ifdef __linux__
+    // the hugepages options are of msgq and the buffers, the same for every transport
+    if (t == "msgq") {
+      run("tlb", [&]() {
+        bench_tlb_msgq(count);
+        bench_tlb_visionipc(count / 4);
+      });
+    }
+#endif
+  }
+  return 0;
+}
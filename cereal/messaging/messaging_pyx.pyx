@@ -119,6 +119,38 @@ cdef class SubSocket:
 
       return m
 
+  def drain_raw(self, int max_msgs=-1, bool latest_only=False, bool wait_for_one=False):
+    """All the messages available on the queue, at most max_msgs. With latest_only just the newest one,
+    the ones before it are dropped without being copied to Python"""
+    cdef list ret = []
+    cdef cppMessage *msg
+    cdef cppMessage *latest = NULL
+    cdef bool non_blocking = not wait_for_one
+    cdef int count = 0
+
+    while max_msgs < 0 or count < max_msgs:
+      msg = self.socket.receive(non_blocking)
+      if msg == NULL:
+        if not non_blocking and errno.errno == errno.EINTR:
+          print("SIGINT received, exiting")
+          sys.exit(1)
+        break
+
+      non_blocking = True
+      count += 1
+      if latest_only:
+        del latest
+        latest = msg
+      else:
+        ret.append(msg.getData()[:msg.getSize()])
+        del msg
+
+    if latest != NULL:
+      ret.append(latest.getData()[:latest.getSize()])
+      del latest
+
+    return ret
+
 
 cdef class PubSocket:
   cdef cppPubSocket * socket
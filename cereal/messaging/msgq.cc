@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <csignal>
 #include <random>
+#include <string>
 
 #include <poll.h>
 #include <sys/ioctl.h>
@@ -19,10 +20,28 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
 #include <stdio.h>
 
 #include "msgq.h"
 
+// Memory orders of the send and receive paths. The data segment is handed over with a
+// release store of the write pointer, overwrites are detected seqlock style: the publisher
+// clears read_valid before touching a reader's data, the reader checks it after copying.
+// Build with MSGQ_SEQ_CST to make every access sequentially consistent again
+#ifdef MSGQ_SEQ_CST
+#define MSGQ_RELAXED std::memory_order_seq_cst
+#define MSGQ_ACQUIRE std::memory_order_seq_cst
+#define MSGQ_RELEASE std::memory_order_seq_cst
+#else
+#define MSGQ_RELAXED std::memory_order_relaxed
+#define MSGQ_ACQUIRE std::memory_order_acquire
+#define MSGQ_RELEASE std::memory_order_release
+#endif
+
 void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
 }
@@ -69,8 +88,28 @@ int msgq_msg_close(msgq_msg_t * msg){
 
 void msgq_reset_reader(msgq_queue_t * q){
   int id = q->reader_id;
-  q->read_valids[id]->store(true);
-  q->read_pointers[id]->store(*q->write_pointer);
+  q->view_pending = false;
+  q->read_valids[id]->store(true, MSGQ_RELAXED);
+  q->read_pointers[id]->store(q->write_pointer->load(MSGQ_ACQUIRE), MSGQ_RELEASE);
+}
+
+// The publisher overwrote data before we got to read it
+static void msgq_reader_lapped(msgq_queue_t * q){
+  (*q->read_resets[q->reader_id])++;
+  msgq_reset_reader(q);
+}
+
+static uint64_t msgq_nanos(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void msgq_record_latency(msgq_queue_t * q, uint64_t send_time){
+  uint64_t latency = msgq_nanos() - send_time;
+  if (latency > q->read_max_latencies[q->reader_id]->load(MSGQ_RELAXED)){
+    q->read_max_latencies[q->reader_id]->store(latency, MSGQ_RELAXED);
+  }
 }
 
 void msgq_wait_for_subscriber(msgq_queue_t *q){
@@ -82,34 +121,45 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
 }
 
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers){
   assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
+  assert(max_readers > 0 && max_readers <= MAX_NUM_READERS);
   std::signal(SIGUSR2, sigusr2_handler);
 
-  const char * prefix = "/dev/shm/";
-  char * full_path = new char[strlen(path) + strlen(prefix) + 1];
-  strcpy(full_path, prefix);
-  strcat(full_path, path);
+  // OPENPILOT_PREFIX keeps the queues of stacks running side by side apart, in /dev/shm/<prefix>/
+  std::string full_path = "/dev/shm/";
+  if (const char *prefix = std::getenv("OPENPILOT_PREFIX")) {
+    full_path += prefix;
+    mkdir(full_path.c_str(), 0777);
+    full_path += "/";
+  }
+  full_path += path;
 
-  auto fd = open(full_path, O_RDWR | O_CREAT, 0777);
+  auto fd = open(full_path.c_str(), O_RDWR | O_CREAT, 0777);
   if (fd < 0) {
     std::cout << "Warning, could not open: " << full_path << std::endl;
-    delete[] full_path;
     return -1;
   }
-  delete[] full_path;
 
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
+  const size_t header_size = msgq_header_size(max_readers);
+  int rc = ftruncate(fd, size + header_size);
   if (rc < 0){
     close(fd);
     return -1;
   }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char * mem = (char*)mmap(NULL, size + header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   close(fd);
 
   if (mem == NULL){
     return -1;
   }
+#ifdef MADV_HUGEPAGE
+  // MSGQ_HUGEPAGES asks for transparent huge pages, in every process that maps the queue. They're only
+  // used with /sys/kernel/mm/transparent_hugepage/shmem_enabled at advise, else the queue stays on 4KB pages
+  if (std::getenv("MSGQ_HUGEPAGES")) {
+    madvise(mem, size + header_size, MADV_HUGEPAGE);
+  }
+#endif
   q->mmap_p = mem;
 
   msgq_header_t *header = (msgq_header_t *)mem;
@@ -118,26 +168,45 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
-
-  for (size_t i = 0; i < NUM_READERS; i++){
-    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
-    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
-    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
+  q->msgs_sent = reinterpret_cast<std::atomic<uint64_t>*>(&header->msgs_sent);
+  q->bytes_sent = reinterpret_cast<std::atomic<uint64_t>*>(&header->bytes_sent);
+  q->last_msg_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->last_msg_pointer);
+  header->max_readers = max_readers;
+
+  uint64_t *reader_table = reinterpret_cast<uint64_t*>(header + 1);
+  q->read_pointers.resize(max_readers);
+  q->read_valids.resize(max_readers);
+  q->read_uids.resize(max_readers);
+  q->read_wake_slots.resize(max_readers);
+  q->read_resets.resize(max_readers);
+  q->read_max_latencies.resize(max_readers);
+  q->read_poll_bits.resize(max_readers);
+
+  for (size_t i = 0; i < max_readers; i++){
+    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[i]);
+    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[max_readers + i]);
+    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[2 * max_readers + i]);
+    q->read_wake_slots[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[3 * max_readers + i]);
+    q->read_resets[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[4 * max_readers + i]);
+    q->read_max_latencies[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[5 * max_readers + i]);
+    q->read_poll_bits[i] = reinterpret_cast<std::atomic<uint64_t>*>(&reader_table[6 * max_readers + i]);
   }
 
-  q->data = mem + sizeof(msgq_header_t);
+  q->data = mem + header_size;
   q->size = size;
+  q->max_readers = max_readers;
   q->reader_id = -1;
 
   q->endpoint = path;
   q->read_conflate = false;
+  q->view_pending = false;
 
   return 0;
 }
 
 void msgq_close_queue(msgq_queue_t *q){
   if (q->mmap_p != NULL){
-    munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
+    munmap(q->mmap_p, q->size + msgq_header_size(q->max_readers));
   }
 }
 
@@ -148,10 +217,14 @@ void msgq_init_publisher(msgq_queue_t * q) {
 
   *q->write_uid = uid;
   *q->num_readers = 0;
+  *q->msgs_sent = 0;
+  *q->bytes_sent = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
+  for (size_t i = 0; i < q->max_readers; i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
+    *q->read_wake_slots[i] = 0;
+    *q->read_poll_bits[i] = 0;
   }
 
   q->write_uid_local = uid;
@@ -166,6 +239,91 @@ static void thread_signal(uint32_t tid) {
   #endif
 }
 
+static msgq_futex_slot_t *msgq_futex_table() {
+  // The table is shared by all queues and mapped once per process.
+  // Set MSGQ_NO_FUTEX to force the SIGUSR2 wakeup path
+  static msgq_futex_slot_t *table = []() -> msgq_futex_slot_t * {
+  #ifdef __linux__
+    if (std::getenv("MSGQ_NO_FUTEX")) return NULL;
+
+    const size_t size = MSGQ_FUTEX_SLOTS * sizeof(msgq_futex_slot_t) + MSGQ_POLL_GROUPS * sizeof(msgq_poll_group_t);
+    auto fd = open("/dev/shm/msgq_futex", O_RDWR | O_CREAT, 0777);
+    if (fd < 0) return NULL;
+
+    int rc = ftruncate(fd, size);
+    if (rc < 0){
+      close(fd);
+      return NULL;
+    }
+    void * mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return (mem == MAP_FAILED) ? NULL : (msgq_futex_slot_t *)mem;
+  #else
+    return NULL;
+  #endif
+  }();
+
+  return table;
+}
+
+static msgq_poll_group_t *msgq_poll_groups() {
+  msgq_futex_slot_t *table = msgq_futex_table();
+  return table ? reinterpret_cast<msgq_poll_group_t*>(table + MSGQ_FUTEX_SLOTS) : NULL;
+}
+
+bool msgq_futex_enabled() {
+  return msgq_futex_table() != NULL;
+}
+
+static uint32_t msgq_futex_slot() {
+  #ifdef __linux__
+    static thread_local uint32_t slot = syscall(SYS_gettid) % MSGQ_FUTEX_SLOTS;
+    return slot;
+  #else
+    return 0;
+  #endif
+}
+
+static int futex_wait(msgq_futex_slot_t *slot, uint32_t seq, const struct timespec *ts) {
+  #ifdef __linux__
+    // Not FUTEX_PRIVATE_FLAG, the waker lives in another process
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&slot->seq), FUTEX_WAIT, seq, ts, NULL, 0);
+  #else
+    return nanosleep(ts, NULL);
+  #endif
+}
+
+static void futex_wake(msgq_futex_slot_t *slot) {
+  #ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&slot->seq), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+  #endif
+}
+
+static void msgq_wake_reader(uint64_t reader_uid, uint64_t wake_slot, uint64_t poll_bits) {
+  msgq_futex_slot_t *table = msgq_futex_table();
+
+  if (wake_slot > 0 && table != NULL) {
+    // Mark the queue in the readiness bitmap of its poller before bumping the sequence,
+    // a poller that saw the old sequence is then guaranteed to find the bit
+    uint32_t group = poll_bits >> 32;
+    uint32_t item = poll_bits & 0xFFFFFFFF;
+    if (group > 0 && group <= MSGQ_POLL_GROUPS && item < MSGQ_POLL_GROUP_ITEMS) {
+      msgq_poll_groups()[group - 1].ready[item / 64] |= 1ULL << (item % 64);
+    }
+
+    msgq_futex_slot_t *slot = &table[(wake_slot - 1) % MSGQ_FUTEX_SLOTS];
+    slot->seq++;
+
+    // Only pay for the syscall when someone is actually sleeping on this slot
+    if (slot->waiters > 0) {
+      futex_wake(slot);
+    }
+  } else {
+    thread_signal(reader_uid & 0xFFFFFFFF);
+  }
+}
+
 void msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
@@ -178,18 +336,22 @@ void msgq_init_subscriber(msgq_queue_t * q) {
     uint64_t new_num_readers = cur_num_readers + 1;
 
     // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
+    if (new_num_readers > q->max_readers){
       std::cout << "Warning, evicting all subscribers!" << std::endl;
       *q->num_readers = 0;
 
-      for (size_t i = 0; i < NUM_READERS; i++){
+      for (size_t i = 0; i < q->max_readers; i++){
         *q->read_valids[i] = false;
 
         uint64_t old_uid = *q->read_uids[i];
+        uint64_t old_wake_slot = *q->read_wake_slots[i];
+        uint64_t old_poll_bits = *q->read_poll_bits[i];
         *q->read_uids[i] = 0;
+        *q->read_wake_slots[i] = 0;
+        *q->read_poll_bits[i] = 0;
 
         // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
+        msgq_wake_reader(old_uid, old_wake_slot, old_poll_bits);
       }
 
       continue;
@@ -207,6 +369,10 @@ void msgq_init_subscriber(msgq_queue_t * q) {
       // on the first read the read pointer will be synchronized with the write pointer
       *q->read_valids[cur_num_readers] = false;
       *q->read_pointers[cur_num_readers] = 0;
+      *q->read_wake_slots[cur_num_readers] = msgq_futex_enabled() ? msgq_futex_slot() + 1 : 0;
+      *q->read_resets[cur_num_readers] = 0;
+      *q->read_max_latencies[cur_num_readers] = 0;
+      *q->read_poll_bits[cur_num_readers] = 0;
       *q->read_uids[cur_num_readers] = uid;
       break;
     }
@@ -216,24 +382,10 @@ void msgq_init_subscriber(msgq_queue_t * q) {
   msgq_reset_reader(q);
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
-  // Die if we are no longer the active publisher
-  if (q->write_uid_local != *q->write_uid){
-    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
-    errno = EADDRINUSE;
-    return -1;
-  }
-
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
-
-  // We need to fit at least three messages in the queue,
-  // then we can always safely access the last message
-  assert(3 * total_msg_size <= q->size);
-
-  uint64_t num_readers = *q->num_readers;
-
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+// Writes one message at the local write pointer. The shared write pointer isn't touched,
+// readers only see the message once the caller publishes the new position. Returns where it starts
+static uint64_t msgq_msg_write(msgq_msg_t * msg, msgq_queue_t *q, uint64_t num_readers, uint64_t send_time, uint32_t &write_cycles, uint32_t &write_pointer){
+  uint64_t total_msg_size = ALIGN(msg->size + MSGQ_MSG_HEADER_SIZE);
 
   char *p = q->data + write_pointer; // add base offset
 
@@ -241,63 +393,113 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
   // Always leave space for a wraparound tag for the next message, including alignment
   int64_t remaining_space = q->size - write_pointer - total_msg_size - sizeof(int64_t);
   if (remaining_space <= 0){
-    // Write -1 size tag indicating wraparound
-    *(int64_t*)p = -1;
-
     // Invalidate all readers that are beyond the write pointer
     // TODO: should we handle the case where a new reader shows up while this is running?
     for (uint64_t i = 0; i < num_readers; i++){
-      uint64_t read_pointer = *q->read_pointers[i];
+      uint64_t read_pointer = q->read_pointers[i]->load(MSGQ_ACQUIRE);
       uint64_t read_cycles = read_pointer >> 32;
       read_pointer &= 0xFFFFFFFF;
 
       if ((read_pointer > write_pointer) && (read_cycles != write_cycles)) {
-        *q->read_valids[i] = false;
+        q->read_valids[i]->store(false, MSGQ_RELAXED);
       }
     }
+    // The invalidations have to be visible before the first byte is overwritten
+    std::atomic_thread_fence(MSGQ_RELEASE);
+
+    // Write -1 size tag indicating wraparound
+    reinterpret_cast<std::atomic<int64_t>*>(p)->store(-1, MSGQ_RELAXED);
 
-    // Update global and local copies of write pointer and write_cycles
+    // Update local copies of write pointer and write_cycles
     write_pointer = 0;
     write_cycles = write_cycles + 1;
-    PACK64(*q->write_pointer, write_cycles, write_pointer);
 
     // Set actual pointer to the beginning of the data segment
     p = q->data;
   }
 
+  uint64_t msg_pointer;
+  PACK64(msg_pointer, write_cycles, write_pointer);
+
   // Invalidate readers that are in the area that will be written
   uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  uint64_t end = ALIGN(start + MSGQ_MSG_HEADER_SIZE + msg->size);
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
-    UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
+    UNPACK64(read_cycles, read_pointer, q->read_pointers[i]->load(MSGQ_ACQUIRE));
 
     if ((read_pointer >= start) && (read_pointer < end) && (read_cycles != write_cycles)) {
-      *q->read_valids[i] = false;
+      q->read_valids[i]->store(false, MSGQ_RELAXED);
     }
   }
+  std::atomic_thread_fence(MSGQ_RELEASE);
 
-
-  // Write size tag
+  // Write size tag and send time
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
-  *size_p = msg->size;
+  size_p->store(msg->size, MSGQ_RELAXED);
+  *(uint64_t*)(p + sizeof(int64_t)) = send_time;
 
   // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
-  __sync_synchronize();
+  memcpy(p + MSGQ_MSG_HEADER_SIZE, msg->data, msg->size);
+
+  write_pointer = ALIGN(write_pointer + msg->size + MSGQ_MSG_HEADER_SIZE);
+  return msg_pointer;
+}
+
+int msgq_msg_send_batch(msgq_msg_t * msgs, size_t num_msgs, msgq_queue_t *q){
+  // Die if we are no longer the active publisher
+  if (q->write_uid_local != *q->write_uid){
+    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  // We need to fit at least three batches in the queue, then the batch
+  // can't overwrite itself and we can always safely access the last message
+  uint64_t total_batch_size = 0;
+  int total_data_size = 0;
+  for (size_t i = 0; i < num_msgs; i++){
+    total_batch_size += ALIGN(msgs[i].size + MSGQ_MSG_HEADER_SIZE);
+    total_data_size += msgs[i].size;
+  }
+  assert(3 * total_batch_size <= q->size);
+
+  // A reader fills in its entry after claiming it in msgq_init_subscriber, a half initialized
+  // entry is harmless since the reader starts out invalid and resets on its first receive
+  uint64_t num_readers = q->num_readers->load(MSGQ_ACQUIRE);
+
+  // Only this publisher moves the write pointer
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, q->write_pointer->load(MSGQ_RELAXED));
+
+  uint64_t send_time = msgq_nanos();
+  uint64_t last_msg_pointer = 0;
+  for (size_t i = 0; i < num_msgs; i++){
+    last_msg_pointer = msgq_msg_write(&msgs[i], q, num_readers, send_time, write_cycles, write_pointer);
+  }
+
+  // Update write pointer, this makes the whole batch visible at once
+  uint64_t new_write_pointer;
+  PACK64(new_write_pointer, write_cycles, write_pointer);
+  q->write_pointer->store(new_write_pointer, MSGQ_RELEASE);
+  // After the write pointer, a reader that sees the new last message also sees the batch
+  if (num_msgs > 0) q->last_msg_pointer->store(last_msg_pointer, MSGQ_RELEASE);
 
-  // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
-  PACK64(*q->write_pointer, write_cycles, new_ptr);
+  // Statistics only, no need for a read-modify-write with a single publisher
+  q->msgs_sent->store(q->msgs_sent->load(MSGQ_RELAXED) + num_msgs, MSGQ_RELAXED);
+  q->bytes_sent->store(q->bytes_sent->load(MSGQ_RELAXED) + total_data_size, MSGQ_RELAXED);
 
   // Notify readers
   for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+    msgq_wake_reader(*q->read_uids[i], *q->read_wake_slots[i], *q->read_poll_bits[i]);
   }
 
-  return msg->size;
+  return total_data_size;
+}
+
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  return msgq_msg_send_batch(msg, 1, q);
 }
 
 
@@ -314,21 +516,34 @@ int msgq_msg_ready(msgq_queue_t * q){
 
   // Check valid
   if (!*q->read_valids[id]){
-    msgq_reset_reader(q);
+    msgq_reader_lapped(q);
     goto start;
   }
 
+  // A borrowed message is consumed, even though the read pointer wasn't moved past it yet
   uint32_t read_cycles, read_pointer;
-  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+  UNPACK64(read_cycles, read_pointer, q->view_pending ? q->view_read_pointer : q->read_pointers[id]->load(MSGQ_RELAXED));
 
   uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  UNPACK64(write_cycles, write_pointer, q->write_pointer->load(MSGQ_RELAXED));
 
   // Check if new message is available
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+static void msgq_release_view(msgq_queue_t * q){
+  if (!q->view_pending) return;
+  q->view_pending = false;
+
+  int id = q->reader_id;
+  if (q->read_uid_local == *q->read_uids[id]){
+    q->read_pointers[id]->store(q->view_read_pointer, MSGQ_RELEASE);
+  }
+}
+
+static int msgq_msg_recv_internal(msgq_msg_t * msg, msgq_queue_t * q, bool view){
+  msgq_release_view(q);
+
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
@@ -340,16 +555,40 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   }
 
   // Check valid
-  if (!*q->read_valids[id]){
-    msgq_reset_reader(q);
+  if (!q->read_valids[id]->load(MSGQ_RELAXED)){
+    msgq_reader_lapped(q);
     goto start;
   }
 
+  // A conflated reader seeks straight to the last message sent instead of walking the ones before it.
+  // Cycles and offsets pack into positions that compare in send order
+  if (q->read_conflate){
+    uint64_t read_packed = q->read_pointers[id]->load(MSGQ_RELAXED);
+    uint64_t last_packed = q->last_msg_pointer->load(MSGQ_ACQUIRE);
+    if (last_packed > read_packed && (last_packed & 0xFFFFFFFF) < q->size){
+      q->read_pointers[id]->store(last_packed, MSGQ_RELEASE);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      // The publisher only invalidates this reader for writes after the new read pointer was stored.
+      // The message is at most a batch behind the write pointer, unless it was lapped in between
+      uint32_t last_cycles, last_pointer, write_cycles, write_pointer;
+      UNPACK64(last_cycles, last_pointer, last_packed);
+      UNPACK64(write_cycles, write_pointer, q->write_pointer->load(MSGQ_ACQUIRE));
+      uint64_t lag = (uint64_t)(write_cycles - last_cycles) * q->size + write_pointer - last_pointer;
+      if (lag > 2 * q->size / 3){
+        msgq_reader_lapped(q);
+      }
+      goto start;
+    }
+  }
+
+  // Only this reader moves its read pointer
   uint32_t read_cycles, read_pointer;
-  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+  UNPACK64(read_cycles, read_pointer, q->read_pointers[id]->load(MSGQ_RELAXED));
 
+  // Acquire pairs with the release in msgq_msg_send_batch, everything up to the write pointer is written
   uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  UNPACK64(write_cycles, write_pointer, q->write_pointer->load(MSGQ_ACQUIRE));
 
   char * p = q->data + read_pointer;
 
@@ -361,18 +600,21 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
 
   // Read potential message size
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
-  std::int64_t size = *size_p;
+  std::int64_t size = size_p->load(MSGQ_RELAXED);
 
-  // Check if the size that was read is valid
-  if (!*q->read_valids[id]){
-    msgq_reset_reader(q);
+  // Check if the size that was read is valid, the fence keeps the read of the size before the check
+  std::atomic_thread_fence(MSGQ_ACQUIRE);
+  if (!q->read_valids[id]->load(MSGQ_RELAXED)){
+    msgq_reader_lapped(q);
     goto start;
   }
 
   // If size is -1 the buffer was full, and we need to wrap around
   if (size == -1){
     read_cycles++;
-    PACK64(*q->read_pointers[id], read_cycles, 0);
+    uint64_t new_read_pointer;
+    PACK64(new_read_pointer, read_cycles, 0);
+    q->read_pointers[id]->store(new_read_pointer, MSGQ_RELEASE);
     goto start;
   }
 
@@ -381,50 +623,161 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   assert((uint64_t)size < q->size);
   assert(size > 0);
 
-  uint32_t new_read_pointer = ALIGN(read_pointer + sizeof(std::int64_t) + size);
+  uint32_t new_read_pointer = ALIGN(read_pointer + MSGQ_MSG_HEADER_SIZE + size);
 
-  // If conflate is true, check if this is the latest message, else start over
+  // If conflate is true, check if this is the latest message, else start over. Only a batch newer
+  // than the last message that was seeked to is walked like this
   if (q->read_conflate){
     if (new_read_pointer != write_pointer){
       // Update read pointer
-      PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+      uint64_t read_pointer_packed;
+      PACK64(read_pointer_packed, read_cycles, new_read_pointer);
+      q->read_pointers[id]->store(read_pointer_packed, MSGQ_RELEASE);
       goto start;
     }
   }
 
+  // Only trusted once the read is known to be valid
+  uint64_t send_time = *(uint64_t*)(p + sizeof(int64_t));
+
+  // Hand out a pointer into the queue. The read pointer stays on the message until it is released,
+  // so the publisher invalidates this reader once it starts overwriting the message
+  if (view){
+    msg->size = size;
+    msg->data = p + MSGQ_MSG_HEADER_SIZE;
+    PACK64(q->view_read_pointer, read_cycles, new_read_pointer);
+    q->view_pending = true;
+
+    std::atomic_thread_fence(MSGQ_ACQUIRE);
+    if (!q->read_valids[id]->load(MSGQ_RELAXED)){
+      msgq_reader_lapped(q);
+      goto start;
+    }
+
+    msgq_record_latency(q, send_time);
+    return msg->size;
+  }
+
   // Copy message
   if (msgq_msg_init_size(msg, size) < 0)
     return -1;
 
-  __sync_synchronize();
-  memcpy(msg->data, p + sizeof(int64_t), size);
-  __sync_synchronize();
+  memcpy(msg->data, p + MSGQ_MSG_HEADER_SIZE, size);
 
-  // Update read pointer
-  PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+  // Update read pointer, release keeps the copy before the publisher can see it's done with the message
+  uint64_t read_pointer_packed;
+  PACK64(read_pointer_packed, read_cycles, new_read_pointer);
+  q->read_pointers[id]->store(read_pointer_packed, MSGQ_RELEASE);
 
-  // Check if the actual data that was copied is valid
-  if (!*q->read_valids[id]){
+  // Check if the actual data that was copied is valid, the fence keeps the copy before the check
+  std::atomic_thread_fence(MSGQ_ACQUIRE);
+  if (!q->read_valids[id]->load(MSGQ_RELAXED)){
     msgq_msg_close(msg);
-    msgq_reset_reader(q);
+    msgq_reader_lapped(q);
     goto start;
   }
 
+  msgq_record_latency(q, send_time);
 
   return msg->size;
 }
 
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  return msgq_msg_recv_internal(msg, q, false);
+}
 
+int msgq_msg_recv_view(msgq_msg_t * msg, msgq_queue_t * q){
+  return msgq_msg_recv_internal(msg, q, true);
+}
 
-int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+bool msgq_msg_view_valid(msgq_queue_t * q){
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  // Called after reading the view, the fence keeps those reads before the check
+  std::atomic_thread_fence(MSGQ_ACQUIRE);
+  return q->view_pending && q->read_uid_local == *q->read_uids[id] && q->read_valids[id]->load(MSGQ_RELAXED);
+}
+
+static msgq_futex_slot_t *msgq_futex_claim(msgq_pollitem_t * items, size_t nitems){
+  msgq_futex_slot_t *table = msgq_futex_table();
+  if (table == NULL) return NULL;
+
+  // Readers can be polled from a different thread than the one that subscribed,
+  // point the wakeups of all polled queues at the slot of the calling thread
+  uint64_t wake_slot = msgq_futex_slot() + 1;
+  for (size_t i = 0; i < nitems; i++) {
+    msgq_queue_t *q = items[i].q;
+    int id = q->reader_id;
+    assert(id >= 0); // Make sure subscriber is initialized
+
+    if (q->read_uid_local == *q->read_uids[id] && *q->read_wake_slots[id] != wake_slot){
+      *q->read_wake_slots[id] = wake_slot;
+    }
+  }
+
+  return &table[wake_slot - 1];
+}
+
+static int msgq_poll_ready(msgq_pollitem_t * items, size_t nitems){
+  int num = 0;
+
+  for (size_t i = 0; i < nitems; i++) {
+    if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
+      items[i].revents = 1;
+    }
+    num += items[i].revents;
+  }
+
+  return num;
+}
+
+static int msgq_poll_futex(msgq_futex_slot_t *slot, msgq_pollitem_t * items, size_t nitems, int timeout){
   int num = 0;
 
-  // Check if messages ready
+  int ms = (timeout == -1) ? 100 : timeout;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+
+  while (true) {
+    // Sample the sequence before checking the queues, a message sent
+    // in between changes it and makes the futex wait return immediately
+    uint32_t seq = slot->seq;
+
+    num = msgq_poll_ready(items, nitems);
+    if (num > 0) break;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      if (timeout != -1) break;
+      deadline = now + std::chrono::milliseconds(ms);
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+    struct timespec ts;
+    ts.tv_sec = remaining / 1000000000;
+    ts.tv_nsec = remaining % 1000000000;
+
+    slot->waiters++;
+    futex_wait(slot, seq, &ts);
+    slot->waiters--;
+  }
+
+  return num;
+}
+
+int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
   for (size_t i = 0; i < nitems; i++) {
-    items[i].revents = msgq_msg_ready(items[i].q);
-    if (items[i].revents) num++;
+    items[i].revents = 0;
+  }
+
+  msgq_futex_slot_t *slot = msgq_futex_claim(items, nitems);
+  if (slot != NULL) {
+    return msgq_poll_futex(slot, items, nitems, timeout);
   }
 
+  // Fallback, sleep until a SIGUSR2 from the publisher interrupts us
+  int num = msgq_poll_ready(items, nitems);
+
   int ms = (timeout == -1) ? 100 : timeout;
   struct timespec ts;
   ts.tv_sec = ms / 1000;
@@ -437,12 +790,7 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
     ret = nanosleep(&ts, &ts);
 
     // Check if messages ready
-    for (size_t i = 0; i < nitems; i++) {
-      if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
-        num += 1;
-        items[i].revents = 1;
-      }
-    }
+    num = msgq_poll_ready(items, nitems);
 
     // exit if we had a timeout and the sleep finished
     if (timeout != -1 && ret == 0){
@@ -453,6 +801,202 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
   return num;
 }
 
+static bool msgq_pid_alive(uint64_t pid){
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void msgq_poller_init(msgq_poller_t *p){
+  p->nitems = 0;
+  p->group = NULL;
+  p->poll_bits = 0;
+  p->wake_slot = 0;
+  p->last_scan = 0;
+  memset(p->pending, 0, sizeof(p->pending));
+
+  msgq_poll_group_t *groups = msgq_poll_groups();
+  if (groups == NULL) return;
+
+  // Claim a free group, or one left behind by a process that died.
+  // If none is available the poller falls back to scanning all queues
+  uint64_t pid = getpid();
+  for (size_t i = 0; i < MSGQ_POLL_GROUPS; i++){
+    uint64_t owner = groups[i].owner;
+    if (owner != 0 && msgq_pid_alive(owner)) continue;
+
+    if (groups[i].owner.compare_exchange_strong(owner, pid)){
+      p->group = &groups[i];
+      p->poll_bits = (uint64_t)(i + 1) << 32;
+      for (auto &w : p->group->ready) w = 0;
+      return;
+    }
+  }
+}
+
+void msgq_poller_close(msgq_poller_t *p){
+  // The queues may already be closed, so their entries are left alone.
+  // Publishers can still set bits in the group, that only causes spurious checks for its next owner
+  if (p->group != NULL){
+    p->group->owner = 0;
+    p->group = NULL;
+  }
+}
+
+int msgq_poller_add(msgq_poller_t *p, msgq_queue_t *q){
+  assert(q->reader_id >= 0); // Make sure subscriber is initialized
+  if (p->nitems >= MSGQ_POLL_GROUP_ITEMS) return -1;
+
+  size_t i = p->nitems++;
+  p->items[i].q = q;
+  p->items[i].revents = 0;
+
+  // Reset the wake slot, the next poll points all queues at the polling thread and checks them
+  p->wake_slot = 0;
+  return i;
+}
+
+// Points the wakeups of a queue at the polling thread and the bitmap of the poller.
+// Returns whether the reader table entry had to be changed
+static bool msgq_poller_point(msgq_poller_t *p, size_t i){
+  msgq_queue_t *q = p->items[i].q;
+  int id = q->reader_id;
+
+  // Evicted, msgq_msg_ready reconnects it
+  if (q->read_uid_local != *q->read_uids[id]) return false;
+
+  bool changed = false;
+  if (*q->read_wake_slots[id] != p->wake_slot){
+    *q->read_wake_slots[id] = p->wake_slot;
+    changed = true;
+  }
+
+  uint64_t poll_bits = p->poll_bits | i;
+  if (*q->read_poll_bits[id] != poll_bits){
+    *q->read_poll_bits[id] = poll_bits;
+    changed = true;
+  }
+  return changed;
+}
+
+static bool msgq_poller_check(msgq_poller_t *p, size_t i){
+  // Point the entry first, a message sent after the check then sets the bit
+  msgq_poller_point(p, i);
+  bool ready = msgq_msg_ready(p->items[i].q);
+
+  // msgq_msg_ready reconnects evicted readers with a fresh entry
+  if (!ready && msgq_poller_point(p, i)){
+    ready = msgq_msg_ready(p->items[i].q);
+  }
+  return ready;
+}
+
+size_t msgq_poller_poll(msgq_poller_t *p, size_t *ready, size_t max_ready, int timeout){
+  const size_t num_words = MSGQ_POLL_GROUP_ITEMS / 64;
+
+  if (p->group == NULL){
+    msgq_poll(p->items, p->nitems, timeout);
+
+    size_t num = 0;
+    for (size_t i = 0; i < p->nitems && num < max_ready; i++){
+      if (p->items[i].revents) ready[num++] = i;
+    }
+    return num;
+  }
+
+  uint64_t wake_slot = msgq_futex_slot() + 1;
+  msgq_futex_slot_t *slot = &msgq_futex_table()[wake_slot - 1];
+
+  // First poll, new queues or a different thread than last time
+  bool rescan = p->wake_slot != wake_slot;
+  p->wake_slot = wake_slot;
+
+  int ms = (timeout == -1) ? 100 : timeout;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+
+  size_t num = 0;
+  while (true) {
+    // Sample the sequence before taking the bits, a message sent
+    // in between changes it and makes the futex wait return immediately
+    uint32_t seq = slot->seq;
+
+    // A publisher that restarted drops all readers without waking them,
+    // a periodic full check reconnects those
+    uint64_t now_ns = msgq_nanos();
+    if (now_ns - p->last_scan >= 100 * 1000 * 1000ULL) rescan = true;
+    if (rescan) p->last_scan = now_ns;
+
+    uint64_t candidates[num_words];
+    for (size_t w = 0; w < num_words; w++){
+      candidates[w] = p->pending[w] | p->group->ready[w].exchange(0);
+      if (rescan) candidates[w] = ~0ULL;
+      p->pending[w] = 0;
+    }
+    rescan = false;
+
+    size_t found = 0;
+    for (size_t w = 0; w < num_words; w++){
+      uint64_t bits = candidates[w];
+      while (bits){
+        size_t i = w * 64 + __builtin_ctzll(bits);
+        bits &= bits - 1;
+        if (i >= p->nitems) break;
+
+        if (msgq_poller_check(p, i)){
+          // Report it again next time if the caller doesn't drain it, and keep what didn't fit
+          p->pending[w] |= 1ULL << (i % 64);
+          if (num < max_ready) ready[num++] = i;
+          found++;
+        }
+      }
+    }
+    if (found > 0) break;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      if (timeout != -1) break;
+      deadline = now + std::chrono::milliseconds(ms);
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+    struct timespec ts;
+    ts.tv_sec = remaining / 1000000000;
+    ts.tv_nsec = remaining % 1000000000;
+
+    slot->waiters++;
+    futex_wait(slot, seq, &ts);
+    slot->waiters--;
+  }
+
+  return num;
+}
+
+void msgq_get_stats(msgq_queue_t *q, msgq_stats_t *stats) {
+  stats->msgs_sent = *q->msgs_sent;
+  stats->bytes_sent = *q->bytes_sent;
+  stats->num_readers = std::min((uint64_t)*q->num_readers, (uint64_t)q->max_readers);
+  stats->readers.resize(stats->num_readers);
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  for (uint64_t i = 0; i < stats->num_readers; i++) {
+    msgq_reader_stats_t &r = stats->readers[i];
+    r.uid = *q->read_uids[i];
+    r.valid = *q->read_valids[i];
+    r.resets = *q->read_resets[i];
+    r.max_latency = *q->read_max_latencies[i];
+
+    // Bytes the reader still has to consume. Across a wraparound this includes the unused
+    // space at the end of the segment, a reader more than one cycle behind has been lapped
+    uint32_t read_cycles, read_pointer;
+    UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
+    if (read_cycles == write_cycles) {
+      r.lag = write_pointer - read_pointer;
+    } else {
+      r.lag = (q->size - read_pointer) + write_pointer;
+    }
+  }
+}
+
 bool msgq_all_readers_updated(msgq_queue_t *q) {
   uint64_t num_readers = *q->num_readers;
   for (uint64_t i = 0; i < num_readers; i++) {
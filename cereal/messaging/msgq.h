@@ -3,11 +3,19 @@
 #include <cstring>
 #include <string>
 #include <atomic>
+#include <vector>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 10
+#define DEFAULT_NUM_READERS 10
+#define MAX_NUM_READERS 128
+#define MSGQ_FUTEX_SLOTS 1024
+#define MSGQ_POLL_GROUPS 1024
+#define MSGQ_POLL_GROUP_ITEMS 128
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
+// Every message is prefixed with its size and the time it was sent
+#define MSGQ_MSG_HEADER_SIZE (2 * sizeof(int64_t))
+
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
 #define PACK64(output, higher, lower) output = ((uint64_t)higher << 32 ) | ((uint64_t)lower & 0xFFFFFFFF)
 
@@ -15,25 +23,64 @@ struct  msgq_header_t {
   uint64_t num_readers;
   uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  uint64_t max_readers;
+  uint64_t msgs_sent;
+  uint64_t bytes_sent;
+  // Packed cycles and offset of the last message sent, for conflated readers to seek to.
+  // Published after the write pointer, so it never runs ahead of it
+  uint64_t last_msg_pointer;
+  // Followed by the reader table, seven arrays of max_readers entries each: read_pointers, read_valids,
+  // read_uids, read_wake_slots (futex slot + 1, 0 means wake with SIGUSR2), read_resets, read_max_latencies
+  // and read_poll_bits (poll group + 1 in the upper half and item index in the lower half, 0 means none)
+};
+
+// The reader table is sized when the queue is created. Like the segment size,
+// every process that opens a queue has to use the same number of readers
+inline size_t msgq_header_size(size_t max_readers) {
+  return sizeof(msgq_header_t) + 7 * max_readers * sizeof(uint64_t);
+}
+
+// Readers are woken through a futex word in a process-shared table. Threads are hashed
+// into a slot by tid, a collision only causes a spurious wakeup.
+struct msgq_futex_slot_t {
+  std::atomic<uint32_t> seq;
+  std::atomic<uint32_t> waiters;
+};
+
+// Readiness bitmap of one msgq_poller_t, it follows the futex slots in the same table.
+// The publisher sets the bit of a reader before waking it, so the poller only has to look
+// at the queues that were sent to. Groups are claimed by pid and reclaimed from dead processes.
+struct msgq_poll_group_t {
+  std::atomic<uint64_t> owner;
+  std::atomic<uint64_t> ready[MSGQ_POLL_GROUP_ITEMS / 64];
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint64_t> *msgs_sent;
+  std::atomic<uint64_t> *bytes_sent;
+  std::atomic<uint64_t> *last_msg_pointer;
+  std::vector<std::atomic<uint64_t>*> read_pointers;
+  std::vector<std::atomic<uint64_t>*> read_valids;
+  std::vector<std::atomic<uint64_t>*> read_uids;
+  std::vector<std::atomic<uint64_t>*> read_wake_slots;
+  std::vector<std::atomic<uint64_t>*> read_resets;
+  std::vector<std::atomic<uint64_t>*> read_max_latencies;
+  std::vector<std::atomic<uint64_t>*> read_poll_bits;
   char * mmap_p;
   char * data;
   size_t size;
+  size_t max_readers;
   int reader_id;
   uint64_t read_uid_local;
   uint64_t write_uid_local;
 
+  // Read pointer to commit once the message handed out by msgq_msg_recv_view is released
+  bool view_pending;
+  uint64_t view_read_pointer;
+
   bool read_conflate;
   std::string endpoint;
 };
@@ -43,11 +90,39 @@ struct msgq_msg_t {
   char * data;
 };
 
+struct msgq_reader_stats_t {
+  uint64_t uid;
+  bool valid;
+  uint64_t lag;         // bytes not yet consumed
+  uint64_t resets;      // times the reader was lapped by the publisher
+  uint64_t max_latency; // ns between send and receive
+};
+
+struct msgq_stats_t {
+  uint64_t msgs_sent;
+  uint64_t bytes_sent;
+  uint64_t num_readers;
+  std::vector<msgq_reader_stats_t> readers;
+};
+
 struct msgq_pollitem_t {
   msgq_queue_t *q;
   int revents;
 };
 
+// Poller that keeps its queues registered, poll is O(ready) instead of O(registered).
+// A queue should only be in one msgq_poller_t at a time, the last one added to wins the wakeups.
+// Without futex support it falls back to msgq_poll over all queues
+struct msgq_poller_t {
+  msgq_pollitem_t items[MSGQ_POLL_GROUP_ITEMS];
+  size_t nitems;
+  msgq_poll_group_t *group;
+  uint64_t poll_bits; // value for read_poll_bits without the item index
+  uint64_t wake_slot;
+  uint64_t pending[MSGQ_POLL_GROUP_ITEMS / 64]; // returned by the last poll, checked again on the next
+  uint64_t last_scan; // ns, all queues are checked at least every 100ms
+};
+
 void msgq_wait_for_subscriber(msgq_queue_t *q);
 void msgq_reset_reader(msgq_queue_t *q);
 
@@ -55,14 +130,30 @@ int msgq_msg_init_size(msgq_msg_t *msg, size_t size);
 int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers = DEFAULT_NUM_READERS);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
 void msgq_init_subscriber(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+// Publishes all messages with a single write pointer update and a single wakeup per reader
+int msgq_msg_send_batch(msgq_msg_t *msgs, size_t num_msgs, msgq_queue_t *q);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+// msg points into the queue and is valid until the next receive, don't call msgq_msg_close on it.
+// msgq_msg_view_valid returns false once the publisher has started overwriting the message
+int msgq_msg_recv_view(msgq_msg_t *msg, msgq_queue_t *q);
+bool msgq_msg_view_valid(msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
+void msgq_poller_init(msgq_poller_t *p);
+void msgq_poller_close(msgq_poller_t *p);
+// Returns the index of the queue in the poller, or -1 when it's full
+int msgq_poller_add(msgq_poller_t *p, msgq_queue_t *q);
+// Writes the indices of up to max_ready ready queues to ready and returns how many there are.
+// Queues are reported again as long as they have messages, like msgq_poll
+size_t msgq_poller_poll(msgq_poller_t *p, size_t *ready, size_t max_ready, int timeout);
+
 bool msgq_all_readers_updated(msgq_queue_t *q);
+void msgq_get_stats(msgq_queue_t *q, msgq_stats_t *stats);
+bool msgq_futex_enabled();
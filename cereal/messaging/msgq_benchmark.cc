@@ -0,0 +1,302 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include "msgq.h"
+
+// msgq_benchmark wakeup [count] [period_us]
+//   send to wakeup latency of a reader blocked in msgq_poll.
+//   Run with MSGQ_NO_FUTEX=1 to benchmark the SIGUSR2 fallback.
+// msgq_benchmark send [count] [max_readers]
+//   cost of msgq_msg_send as the number of attached readers grows
+// msgq_benchmark size [count]
+//   per message cost of send and receive for 64B and 300KB messages. Compare against
+//   msgq_benchmark_seq_cst, which is built with sequentially consistent atomics
+// msgq_benchmark poll [count] [num_queues]
+//   cost of finding the one ready queue out of num_queues, msgq_poll against msgq_poller_t
+// msgq_benchmark conflate [count] [stall_ms]
+//   catching up after a reader stalled for stall_ms on can at 100Hz, a conflated receive
+//   against draining the queue
+
+static inline uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void print_stats(const char *name, std::vector<uint64_t> &samples) {
+  std::sort(samples.begin(), samples.end());
+  uint64_t sum = 0;
+  for (auto s : samples) sum += s;
+
+  auto pct = [&](double p) { return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))] / 1000.0; };
+  printf("%-20s n=%zu mean=%.1fus p50=%.1fus p99=%.1fus max=%.1fus\n", name, samples.size(),
+         sum / 1000.0 / samples.size(), pct(0.5), pct(0.99), samples.back() / 1000.0);
+}
+
+static int benchmark_wakeup(int count, int period_us) {
+  msgq_queue_t pub;
+  if (msgq_new_queue(&pub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE) != 0) {
+    printf("failed to create queue\n");
+    return 1;
+  }
+  msgq_init_publisher(&pub);
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(count);
+  std::atomic<bool> done = false;
+
+  std::thread reader([&]() {
+    msgq_queue_t sub;
+    msgq_new_queue(&sub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE);
+    msgq_init_subscriber(&sub);
+
+    msgq_pollitem_t items[1];
+    items[0].q = &sub;
+
+    while (latencies.size() < (size_t)count) {
+      if (msgq_poll(items, 1, 1000) == 0) {
+        if (done) break;
+        continue;
+      }
+
+      msgq_msg_t msg;
+      if (msgq_msg_recv(&msg, &sub) > 0) {
+        uint64_t sent = *(uint64_t *)msg.data;
+        latencies.push_back(nanos_monotonic() - sent);
+        msgq_msg_close(&msg);
+      }
+    }
+    msgq_close_queue(&sub);
+  });
+
+  msgq_wait_for_subscriber(&pub);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  for (int i = 0; i < count; i++) {
+    // Give the reader time to go back to sleep, we want the wakeup cost not the throughput
+    std::this_thread::sleep_for(std::chrono::microseconds(period_us));
+
+    uint64_t t = nanos_monotonic();
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char *)&t, sizeof(t));
+    msgq_msg_send(&msg, &pub);
+    msgq_msg_close(&msg);
+  }
+
+  done = true;
+  reader.join();
+  msgq_close_queue(&pub);
+
+  print_stats(msgq_futex_enabled() ? "futex wakeup" : "SIGUSR2 wakeup", latencies);
+  return 0;
+}
+
+static int benchmark_send(int count, int max_readers) {
+  char data[1024] = {};
+
+  for (int num_readers = 1; num_readers <= max_readers; num_readers *= 2) {
+    msgq_queue_t pub;
+    if (msgq_new_queue(&pub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE, max_readers) != 0) {
+      printf("failed to create queue\n");
+      return 1;
+    }
+    msgq_init_publisher(&pub);
+
+    std::vector<msgq_queue_t> subs(num_readers);
+    for (auto &sub : subs) {
+      msgq_new_queue(&sub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE, max_readers);
+      msgq_init_subscriber(&sub);
+    }
+
+    std::vector<uint64_t> samples;
+    samples.reserve(count);
+    for (int i = 0; i < count; i++) {
+      msgq_msg_t msg;
+      msg.data = data;
+      msg.size = sizeof(data);
+
+      uint64_t t = nanos_monotonic();
+      msgq_msg_send(&msg, &pub);
+      samples.push_back(nanos_monotonic() - t);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "send, %d readers", num_readers);
+    print_stats(name, samples);
+
+    for (auto &sub : subs) msgq_close_queue(&sub);
+    msgq_close_queue(&pub);
+  }
+  return 0;
+}
+
+static int benchmark_size(int count) {
+  for (size_t size : {(size_t)64, (size_t)300 * 1024}) {
+    msgq_queue_t pub, sub;
+    if (msgq_new_queue(&pub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE) != 0) {
+      printf("failed to create queue\n");
+      return 1;
+    }
+    msgq_new_queue(&sub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE);
+    msgq_init_publisher(&pub);
+    msgq_init_subscriber(&sub);
+
+    // Timed over the whole loop, a single small send is close to the clock resolution
+    std::vector<char> data(size);
+    for (int view = 0; view < 2; view++) {
+      uint64_t send_ns = 0, recv_ns = 0;
+      for (int i = 0; i < count; i++) {
+        msgq_msg_t msg;
+        msg.data = data.data();
+        msg.size = size;
+
+        uint64_t t0 = nanos_monotonic();
+        msgq_msg_send(&msg, &pub);
+        uint64_t t1 = nanos_monotonic();
+        int r = view ? msgq_msg_recv_view(&msg, &sub) : msgq_msg_recv(&msg, &sub);
+        uint64_t t2 = nanos_monotonic();
+        assert(r == (int)size);
+
+        if (!view) msgq_msg_close(&msg);
+        send_ns += t1 - t0;
+        recv_ns += t2 - t1;
+      }
+      printf("%zuB: send %.0f ns, %s %.0f ns\n", size, (double)send_ns / count,
+             view ? "recv_view" : "recv", (double)recv_ns / count);
+    }
+
+    msgq_close_queue(&sub);
+    msgq_close_queue(&pub);
+  }
+  return 0;
+}
+
+static int benchmark_poll(int count, int num_queues) {
+  std::vector<msgq_queue_t> pubs(num_queues), subs(num_queues);
+  std::vector<msgq_pollitem_t> items(num_queues);
+
+  msgq_poller_t poller;
+  msgq_poller_init(&poller);
+  for (int i = 0; i < num_queues; i++) {
+    std::string path = "msgq_benchmark_" + std::to_string(i);
+    if (msgq_new_queue(&pubs[i], path.c_str(), 1024 * 1024) != 0) {
+      printf("failed to create queue\n");
+      return 1;
+    }
+    msgq_new_queue(&subs[i], path.c_str(), 1024 * 1024);
+    msgq_init_publisher(&pubs[i]);
+    msgq_init_subscriber(&subs[i]);
+    items[i].q = &subs[i];
+    msgq_poller_add(&poller, &subs[i]);
+  }
+
+  char data[64] = {};
+  for (int use_poller = 0; use_poller < 2; use_poller++) {
+    std::vector<uint64_t> samples;
+    samples.reserve(count);
+    for (int i = 0; i < count; i++) {
+      int idx = i % num_queues;
+      msgq_msg_t msg;
+      msg.data = data;
+      msg.size = sizeof(data);
+      msgq_msg_send(&msg, &pubs[idx]);
+
+      uint64_t t = nanos_monotonic();
+      size_t ready[1];
+      size_t num = use_poller ? msgq_poller_poll(&poller, ready, 1, 100) : msgq_poll(items.data(), num_queues, 100);
+      samples.push_back(nanos_monotonic() - t);
+
+      assert(num == 1);
+      msgq_msg_recv(&msg, &subs[idx]);
+      msgq_msg_close(&msg);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s, %d queues", use_poller ? "msgq_poller" : "msgq_poll", num_queues);
+    print_stats(name, samples);
+  }
+
+  msgq_poller_close(&poller);
+  for (int i = 0; i < num_queues; i++) {
+    msgq_close_queue(&subs[i]);
+    msgq_close_queue(&pubs[i]);
+  }
+  return 0;
+}
+
+static int benchmark_conflate(int count, int stall_ms) {
+  // a can message of a few pandas, at 100Hz
+  const size_t size = 2048;
+  const int stall_msgs = stall_ms / 10;
+
+  msgq_queue_t pub, sub;
+  if (msgq_new_queue(&pub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE) != 0) {
+    printf("failed to create queue\n");
+    return 1;
+  }
+  msgq_new_queue(&sub, "msgq_benchmark", DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  std::vector<char> data(size);
+  for (int conflate = 0; conflate < 2; conflate++) {
+    sub.read_conflate = conflate;
+    std::vector<uint64_t> samples;
+    samples.reserve(count);
+    for (int i = 0; i < count; i++) {
+      for (int j = 0; j < stall_msgs; j++) {
+        msgq_msg_t msg;
+        msg.data = data.data();
+        msg.size = size;
+        msgq_msg_send(&msg, &pub);
+      }
+
+      // to the newest message
+      uint64_t t = nanos_monotonic();
+      msgq_msg_t msg;
+      int received = 0;
+      while (msgq_msg_recv(&msg, &sub) > 0) {
+        msgq_msg_close(&msg);
+        received++;
+      }
+      samples.push_back(nanos_monotonic() - t);
+      assert(received == (conflate ? 1 : stall_msgs));
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s, %d msgs", conflate ? "conflated recv" : "drain", stall_msgs);
+    print_stats(name, samples);
+  }
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::string mode = argc > 1 ? argv[1] : "wakeup";
+  const int count = argc > 2 ? atoi(argv[2]) : 1000;
+
+  if (mode == "wakeup") {
+    return benchmark_wakeup(count, argc > 3 ? atoi(argv[3]) : 1000);
+  } else if (mode == "send") {
+    return benchmark_send(count, argc > 3 ? atoi(argv[3]) : MAX_NUM_READERS);
+  } else if (mode == "size") {
+    return benchmark_size(count);
+  } else if (mode == "poll") {
+    return benchmark_poll(count, std::min(argc > 3 ? atoi(argv[3]) : 40, MSGQ_POLL_GROUP_ITEMS));
+  } else if (mode == "conflate") {
+    return benchmark_conflate(count, argc > 3 ? atoi(argv[3]) : 1000);
+  }
+
+  printf("usage: %s [wakeup | send | size | poll | conflate] [count] [period_us | max_readers | num_queues | stall_ms]\n", argv[0]);
+  return 1;
+}
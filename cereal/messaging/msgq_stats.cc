@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "msgq.h"
+#include "services.h"
+
+// Dumps the counters kept in the msgq headers once per second.
+// usage: msgq_stats [service ...], defaults to all services with an existing queue
+
+static bool open_existing_queue(msgq_queue_t *q, const std::string &name) {
+  const char *prefix = std::getenv("OPENPILOT_PREFIX");
+  std::string path = "/dev/shm/" + (prefix ? std::string(prefix) + "/" : "") + name;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  // The reader table size is recorded in the header, the segment size follows from the file size
+  struct stat st;
+  msgq_header_t header = {};
+  bool ok = fstat(fd, &st) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header);
+  close(fd);
+
+  if (!ok || header.max_readers == 0 || header.max_readers > MAX_NUM_READERS) return false;
+  size_t header_size = msgq_header_size(header.max_readers);
+  if ((size_t)st.st_size <= header_size) return false;
+
+  return msgq_new_queue(q, name.c_str(), st.st_size - header_size, header.max_readers) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> names;
+  for (int i = 1; i < argc; i++) {
+    names.push_back(argv[i]);
+  }
+  if (names.empty()) {
+    for (const auto &it : services) names.push_back(it.name);
+  }
+
+  std::map<std::string, msgq_queue_t *> queues;
+  for (auto &name : names) {
+    msgq_queue_t *q = new msgq_queue_t;
+    if (open_existing_queue(q, name)) {
+      queues[name] = q;
+    } else {
+      delete q;
+    }
+  }
+
+  if (queues.empty()) {
+    printf("no queues found\n");
+    return 1;
+  }
+
+  std::map<std::string, msgq_stats_t> prev;
+  while (true) {
+    printf("\033[2J\033[H");
+    printf("%-24s %10s %10s %8s\n", "service", "msgs/s", "kB/s", "readers");
+    printf("  %-20s %10s %10s %8s %12s\n", "reader", "valid", "lag kB", "resets", "max lat ms");
+
+    for (auto &[name, q] : queues) {
+      msgq_stats_t stats;
+      msgq_get_stats(q, &stats);
+
+      auto &p = prev[name];
+      printf("%-24s %10lu %10.1f %8lu\n", name.c_str(), stats.msgs_sent - p.msgs_sent,
+             (stats.bytes_sent - p.bytes_sent) / 1024.0, stats.num_readers);
+      for (auto &r : stats.readers) {
+        printf("  %-20lu %10s %10.1f %8lu %12.2f\n", r.uid & 0xFFFFFFFF, r.valid ? "yes" : "no",
+               r.lag / 1024.0, r.resets, r.max_latency / 1e6);
+      }
+      p = stats;
+    }
+
+    fflush(stdout);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+
+  return 0;
+}
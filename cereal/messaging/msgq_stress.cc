@@ -0,0 +1,186 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "msgq.h"
+
+// msgq_stress [seconds] [num_queues] [readers_per_queue]
+//   a publisher per queue sends checksummed messages between 64B and 300KB as fast as it can,
+//   the readers verify every message they get. Readers are lapped all the time, which exercises
+//   the invalidation paths. Exits non-zero if a reader gets a corrupt message.
+
+#define STRESS_SEGMENT_SIZE (1024 * 1024)
+#define STRESS_MAX_MSG_SIZE (300 * 1024)
+
+struct stress_header_t {
+  uint64_t seq;
+  uint64_t size;
+  uint64_t checksum;
+};
+
+static uint64_t fnv1a(const char *data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static uint64_t xorshift(uint64_t &state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+struct StressCounters {
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> views_lapped{0};
+  std::atomic<uint64_t> corrupt{0};
+};
+
+// Payloads are generated up front, the publisher has to be fast enough to lap the readers
+static std::vector<std::vector<char>> make_payloads(size_t num, size_t max_size, uint64_t rng) {
+  std::vector<std::vector<char>> payloads(num);
+  for (auto &buf : payloads) {
+    // Mostly small messages, with a large one every now and then
+    uint64_t r = xorshift(rng);
+    size_t size = std::min((r % 8 == 0) ? 64 + r % max_size : 64 + r % 4096, max_size);
+    buf.resize(size);
+    for (size_t i = sizeof(stress_header_t); i < size; i++) {
+      buf[i] = xorshift(rng);
+    }
+
+    stress_header_t header = {0, size, fnv1a(buf.data() + sizeof(header), size - sizeof(header))};
+    memcpy(buf.data(), &header, sizeof(header));
+  }
+  return payloads;
+}
+
+static bool verify_message(const char *data, size_t size, uint64_t &last_seq) {
+  stress_header_t header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, data, sizeof(header));
+
+  bool ok = header.size == size && header.checksum == fnv1a(data + sizeof(header), size - sizeof(header));
+  // Messages can be skipped when the reader is lapped, but never repeat or go back
+  ok = ok && (last_seq == UINT64_MAX || header.seq > last_seq);
+  last_seq = header.seq;
+  return ok;
+}
+
+static void publisher(msgq_queue_t *q, std::atomic<bool> &exit, StressCounters &counters) {
+  uint64_t rng = 0x9e3779b97f4a7c15ULL ^ std::hash<std::string>()(q->endpoint);
+  auto singles = make_payloads(64, STRESS_MAX_MSG_SIZE, xorshift(rng));
+  auto batched = make_payloads(64, 4096, xorshift(rng));
+
+  uint64_t seq = 0;
+  while (!exit) {
+    // Alternate between single sends and batches of small messages
+    size_t num = (xorshift(rng) % 4 == 0) ? 4 : 1;
+    auto &pool = num > 1 ? batched : singles;
+    // Distinct buffers, the sequence number is stamped into the pooled payload
+    size_t first = xorshift(rng) % (pool.size() - num);
+    msgq_msg_t msgs[4];
+    for (size_t i = 0; i < num; i++) {
+      auto &buf = pool[first + i];
+      ((stress_header_t *)buf.data())->seq = seq++;
+      msgs[i].data = buf.data();
+      msgs[i].size = buf.size();
+    }
+    msgq_msg_send_batch(msgs, num, q);
+    counters.sent += num;
+  }
+}
+
+static void reader(const std::string &path, bool view, std::atomic<bool> &exit, StressCounters &counters) {
+  msgq_queue_t q;
+  msgq_new_queue(&q, path.c_str(), STRESS_SEGMENT_SIZE);
+  msgq_init_subscriber(&q);
+
+  msgq_pollitem_t items[1];
+  items[0].q = &q;
+
+  uint64_t last_seq = UINT64_MAX;
+  while (!exit) {
+    if (msgq_poll(items, 1, 100) == 0) continue;
+
+    msgq_msg_t msg;
+    int r = view ? msgq_msg_recv_view(&msg, &q) : msgq_msg_recv(&msg, &q);
+    if (r <= 0) continue;
+
+    uint64_t seq = last_seq;
+    bool ok = verify_message(msg.data, msg.size, seq);
+    if (view && !msgq_msg_view_valid(&q)) {
+      // Overwritten while we were checking it, the result means nothing
+      counters.views_lapped++;
+    } else {
+      last_seq = seq;
+      counters.received++;
+      if (!ok) {
+        counters.corrupt++;
+        printf("%s: corrupt message of %zu bytes\n", path.c_str(), msg.size);
+      }
+    }
+
+    if (!view) msgq_msg_close(&msg);
+  }
+
+  msgq_close_queue(&q);
+}
+
+int main(int argc, char *argv[]) {
+  const int seconds = argc > 1 ? atoi(argv[1]) : 10;
+  const int num_queues = argc > 2 ? atoi(argv[2]) : 4;
+  const int readers_per_queue = argc > 3 ? atoi(argv[3]) : 3;
+
+  std::atomic<bool> exit = false;
+  std::vector<StressCounters> counters(num_queues);
+  std::vector<msgq_queue_t> pubs(num_queues);
+  std::vector<std::thread> threads;
+
+  // Set up the publishers first, initializing a publisher drops all readers
+  for (int i = 0; i < num_queues; i++) {
+    std::string path = "msgq_stress_" + std::to_string(i);
+    msgq_new_queue(&pubs[i], path.c_str(), STRESS_SEGMENT_SIZE);
+    msgq_init_publisher(&pubs[i]);
+
+    // Every other reader uses the borrowed view
+    for (int j = 0; j < readers_per_queue; j++) {
+      threads.emplace_back(reader, path, j % 2 == 1, std::ref(exit), std::ref(counters[i]));
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  for (int i = 0; i < num_queues; i++) {
+    threads.emplace_back(publisher, &pubs[i], std::ref(exit), std::ref(counters[i]));
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  exit = true;
+  for (auto &t : threads) t.join();
+  for (auto &q : pubs) msgq_close_queue(&q);
+
+  uint64_t total_corrupt = 0, total_received = 0;
+  for (int i = 0; i < num_queues; i++) {
+    auto &c = counters[i];
+    printf("msgq_stress_%d: sent %lu, received %lu, views lapped %lu, corrupt %lu\n", i,
+           (unsigned long)c.sent, (unsigned long)c.received, (unsigned long)c.views_lapped, (unsigned long)c.corrupt);
+    total_corrupt += c.corrupt;
+    total_received += c.received;
+  }
+
+  if (total_corrupt > 0 || total_received == 0) {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,378 @@
+#include <thread>
+#include <chrono>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "msgq.h"
+
+static void msgq_setup(msgq_queue_t *q, const char *path, size_t size = 1024 * 1024){
+  REQUIRE(msgq_new_queue(q, path, size) == 0);
+}
+
+static int msgq_send_str(msgq_queue_t *q, const char *str){
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, (char *)str, strlen(str) + 1);
+  int r = msgq_msg_send(&msg, q);
+  msgq_msg_close(&msg);
+  return r;
+}
+
+TEST_CASE("msgq_msg_init_data"){
+  char data[] = "hello";
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, data, sizeof(data));
+
+  REQUIRE(msg.size == sizeof(data));
+  REQUIRE(memcmp(msg.data, data, sizeof(data)) == 0);
+  msgq_msg_close(&msg);
+  REQUIRE(msg.size == 0);
+}
+
+TEST_CASE("Send and receive"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue");
+  msgq_setup(&sub, "test_queue");
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  REQUIRE(msgq_msg_ready(&sub) == 0);
+  REQUIRE(msgq_send_str(&pub, "msgq") == 5);
+  REQUIRE(msgq_msg_ready(&sub) == 1);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &sub) == 5);
+  REQUIRE(strcmp(msg.data, "msgq") == 0);
+  msgq_msg_close(&msg);
+
+  REQUIRE(msgq_msg_recv(&msg, &sub) == 0);
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Poll timeout"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue");
+  msgq_setup(&sub, "test_queue");
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  msgq_pollitem_t items[1];
+  items[0].q = &sub;
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(msgq_poll(items, 1, 50) == 0);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(elapsed >= std::chrono::milliseconds(50));
+  REQUIRE(items[0].revents == 0);
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Poll wakes up blocked reader"){
+  msgq_queue_t pub, sub1, sub2;
+  msgq_setup(&pub, "test_queue");
+  msgq_setup(&sub1, "test_queue");
+  msgq_setup(&sub2, "test_queue_2");
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub1);
+  msgq_init_subscriber(&sub2);
+
+  // Poll from another thread than the one that subscribed,
+  // SIGUSR2 only reaches the subscribing thread so this needs the futex path
+  int num = 0;
+  msgq_pollitem_t items[2];
+  items[0].q = &sub2;
+  items[1].q = &sub1;
+  std::thread poller([&]() { num = msgq_poll(items, 2, 5000); });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto start = std::chrono::steady_clock::now();
+  msgq_send_str(&pub, "wakeup");
+  poller.join();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  REQUIRE(num == 1);
+  REQUIRE(items[0].revents == 0);
+  REQUIRE(items[1].revents == 1);
+  if (msgq_futex_enabled()){
+    REQUIRE(elapsed < std::chrono::milliseconds(1000));
+  }
+
+  msgq_close_queue(&sub2);
+  msgq_close_queue(&sub1);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Receive view"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue", 1024);
+  msgq_setup(&sub, "test_queue", 1024);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  msgq_send_str(&pub, "first");
+  msgq_send_str(&pub, "second");
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv_view(&msg, &sub) == 6);
+  REQUIRE(strcmp(msg.data, "first") == 0);
+  REQUIRE(((uintptr_t)msg.data % 8) == 0);
+  REQUIRE(msgq_msg_view_valid(&sub));
+
+  // The borrowed message counts as consumed
+  REQUIRE(msgq_msg_ready(&sub) == 1);
+  REQUIRE(msgq_msg_recv_view(&msg, &sub) == 7);
+  REQUIRE(strcmp(msg.data, "second") == 0);
+  REQUIRE(msgq_msg_ready(&sub) == 0);
+  REQUIRE(msgq_msg_recv_view(&msg, &sub) == 0);
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Receive view detects lapping publisher"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue", 1024);
+  msgq_setup(&sub, "test_queue", 1024);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  char data[200] = {};
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, data, sizeof(data));
+  msgq_msg_send(&msg, &pub);
+
+  msgq_msg_t view;
+  REQUIRE(msgq_msg_recv_view(&view, &sub) == sizeof(data));
+  REQUIRE(msgq_msg_view_valid(&sub));
+
+  // Wrap around and overwrite the borrowed message
+  for (int i = 0; i < 10; i++){
+    msgq_msg_send(&msg, &pub);
+  }
+  msgq_msg_close(&msg);
+
+  REQUIRE(!msgq_msg_view_valid(&sub));
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Reader table sized at creation"){
+  const size_t max_readers = 4 * DEFAULT_NUM_READERS;
+
+  msgq_queue_t pub;
+  REQUIRE(msgq_new_queue(&pub, "test_queue_readers", 1024 * 1024, max_readers) == 0);
+  msgq_init_publisher(&pub);
+
+  std::vector<msgq_queue_t> subs(max_readers);
+  for (auto &sub : subs){
+    REQUIRE(msgq_new_queue(&sub, "test_queue_readers", 1024 * 1024, max_readers) == 0);
+    msgq_init_subscriber(&sub);
+  }
+  REQUIRE(*pub.num_readers == max_readers);
+
+  // No reader was evicted, all of them get the message
+  msgq_send_str(&pub, "fanout");
+  for (auto &sub : subs){
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &sub) == 7);
+    msgq_msg_close(&msg);
+  }
+
+  for (auto &sub : subs) msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Send batch"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue", 1024);
+  msgq_setup(&sub, "test_queue", 1024);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  // Enough batches to wrap around a few times
+  for (int n = 0; n < 20; n++){
+    char data[3][40];
+    msgq_msg_t msgs[3];
+    for (int i = 0; i < 3; i++){
+      snprintf(data[i], sizeof(data[i]), "batch %d msg %d", n, i);
+      msgs[i].data = data[i];
+      msgs[i].size = sizeof(data[i]);
+    }
+    REQUIRE(msgq_msg_send_batch(msgs, 3, &pub) == 3 * sizeof(data[0]));
+
+    for (int i = 0; i < 3; i++){
+      msgq_msg_t msg;
+      REQUIRE(msgq_msg_recv(&msg, &sub) == sizeof(data[i]));
+      REQUIRE(strcmp(msg.data, data[i]) == 0);
+      msgq_msg_close(&msg);
+    }
+    REQUIRE(msgq_msg_ready(&sub) == 0);
+  }
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Conflated receive gets the newest message"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue", 1024);
+  msgq_setup(&sub, "test_queue", 1024);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+  sub.read_conflate = true;
+
+  // Across wraparounds, and with batches newer than the message that was seeked to
+  for (int n = 0; n < 20; n++){
+    char data[40];
+    for (int i = 0; i < 5; i++){
+      snprintf(data, sizeof(data), "round %d msg %d", n, i);
+      REQUIRE(msgq_send_str(&pub, data) == strlen(data) + 1);
+    }
+
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &sub) == strlen(data) + 1);
+    REQUIRE(strcmp(msg.data, data) == 0);
+    msgq_msg_close(&msg);
+    REQUIRE(msgq_msg_recv(&msg, &sub) == 0);
+  }
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Queue statistics"){
+  msgq_queue_t pub, sub;
+  msgq_setup(&pub, "test_queue", 1024);
+  msgq_setup(&sub, "test_queue", 1024);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  char data[100] = {};
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, data, sizeof(data));
+  msgq_msg_send(&msg, &pub);
+  msgq_msg_send(&msg, &pub);
+
+  msgq_stats_t stats;
+  msgq_get_stats(&pub, &stats);
+  REQUIRE(stats.msgs_sent == 2);
+  REQUIRE(stats.bytes_sent == 2 * sizeof(data));
+  REQUIRE(stats.num_readers == 1);
+  REQUIRE(stats.readers[0].lag >= 2 * ALIGN(sizeof(data) + MSGQ_MSG_HEADER_SIZE));
+  REQUIRE(stats.readers[0].resets == 0);
+
+  // Lap the reader
+  for (int i = 0; i < 20; i++){
+    msgq_msg_send(&msg, &pub);
+  }
+  msgq_msg_close(&msg);
+
+  msgq_msg_t recv;
+  REQUIRE(msgq_msg_recv(&recv, &sub) == 0);
+
+  msgq_send_str(&pub, "latest");
+  REQUIRE(msgq_msg_recv(&recv, &sub) == 7);
+  msgq_msg_close(&recv);
+
+  msgq_get_stats(&pub, &stats);
+  REQUIRE(stats.msgs_sent == 23);
+  REQUIRE(stats.readers[0].lag == 0);
+  REQUIRE(stats.readers[0].resets == 1);
+  REQUIRE(stats.readers[0].max_latency > 0);
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+}
+
+TEST_CASE("Poller reports ready queues"){
+  const size_t num_queues = 40;
+  msgq_queue_t pubs[num_queues], subs[num_queues];
+
+  msgq_poller_t poller;
+  msgq_poller_init(&poller);
+  for (size_t i = 0; i < num_queues; i++){
+    std::string path = "test_poller_" + std::to_string(i);
+    msgq_setup(&pubs[i], path.c_str(), 4096);
+    msgq_setup(&subs[i], path.c_str(), 4096);
+    msgq_init_publisher(&pubs[i]);
+    msgq_init_subscriber(&subs[i]);
+    REQUIRE(msgq_poller_add(&poller, &subs[i]) == (int)i);
+  }
+
+  size_t ready[num_queues];
+  REQUIRE(msgq_poller_poll(&poller, ready, num_queues, 0) == 0);
+
+  msgq_send_str(&pubs[3], "three");
+  msgq_send_str(&pubs[37], "thirty seven");
+  msgq_send_str(&pubs[20], "twenty");
+
+  // What doesn't fit is reported on the next poll
+  REQUIRE(msgq_poller_poll(&poller, ready, 2, 100) == 2);
+  REQUIRE(ready[0] == 3);
+  REQUIRE(ready[1] == 20);
+
+  // Queues stay ready until they are drained
+  REQUIRE(msgq_poller_poll(&poller, ready, num_queues, 100) == 3);
+  REQUIRE(ready[2] == 37);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &subs[3]) > 0);
+  msgq_msg_close(&msg);
+  REQUIRE(msgq_msg_recv(&msg, &subs[20]) > 0);
+  msgq_msg_close(&msg);
+
+  REQUIRE(msgq_poller_poll(&poller, ready, num_queues, 100) == 1);
+  REQUIRE(ready[0] == 37);
+
+  REQUIRE(msgq_msg_recv(&msg, &subs[37]) > 0);
+  msgq_msg_close(&msg);
+  REQUIRE(msgq_poller_poll(&poller, ready, num_queues, 0) == 0);
+
+  msgq_poller_close(&poller);
+  for (size_t i = 0; i < num_queues; i++){
+    msgq_close_queue(&subs[i]);
+    msgq_close_queue(&pubs[i]);
+  }
+}
+
+TEST_CASE("Poller wakes up blocked reader"){
+  const size_t num_queues = 8;
+  msgq_queue_t pubs[num_queues], subs[num_queues];
+
+  msgq_poller_t poller;
+  msgq_poller_init(&poller);
+  for (size_t i = 0; i < num_queues; i++){
+    std::string path = "test_poller_" + std::to_string(i);
+    msgq_setup(&pubs[i], path.c_str(), 4096);
+    msgq_setup(&subs[i], path.c_str(), 4096);
+    msgq_init_publisher(&pubs[i]);
+    msgq_init_subscriber(&subs[i]);
+    msgq_poller_add(&poller, &subs[i]);
+  }
+
+  size_t num = 0;
+  size_t ready[num_queues];
+  std::thread poll_thread([&]() { num = msgq_poller_poll(&poller, ready, num_queues, 5000); });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto start = std::chrono::steady_clock::now();
+  msgq_send_str(&pubs[5], "wakeup");
+  poll_thread.join();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  REQUIRE(num == 1);
+  REQUIRE(ready[0] == 5);
+  if (msgq_futex_enabled()){
+    REQUIRE(elapsed < std::chrono::milliseconds(1000));
+  }
+
+  msgq_poller_close(&poller);
+  for (size_t i = 0; i < num_queues; i++){
+    msgq_close_queue(&subs[i]);
+    msgq_close_queue(&pubs[i]);
+  }
+}
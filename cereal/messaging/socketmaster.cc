@@ -1,8 +1,10 @@
 #include <time.h>
 #include <assert.h>
+#include <cmath>
 #include <stdlib.h>
 #include <string>
 #include <mutex>
+#include <stdexcept>
 
 #include "services.h"
 #include "messaging.h"
@@ -10,6 +12,9 @@
 const bool SIMULATION = (getenv("SIMULATION") != nullptr) && (std::string(getenv("SIMULATION")) == "1");
 
 static inline uint64_t nanos_since_boot() {
+  const uint64_t replay_time = messaging_replay_time.load(std::memory_order_relaxed);
+  if (replay_time != 0) return replay_time;
+
   struct timespec t;
   clock_gettime(CLOCK_BOOTTIME, &t);
   return t.tv_sec * 1000000000ULL + t.tv_nsec;
@@ -44,12 +49,19 @@ private:
 
 MessageContext message_context;
 
+// The inter-arrival times are filtered like the jitter of RFC 3550, with a gain of 1/16
+const double ARRIVAL_GAIN = 1.0 / 16.0;
+
 struct SubMaster::SubMessage {
   std::string name;
   SubSocket *socket = nullptr;
   int freq = 0;
-  bool updated = false, alive = false, valid = true, ignore_alive;
+  bool updated = false, valid = true, ignore_alive;
   uint64_t rcv_time = 0, rcv_frame = 0;
+  // alive until 10 periods after the last message, none for services without a frequency
+  uint64_t alive_timeout = 0, alive_deadline = 0;
+  bool received = false;
+  double mean_dt = 0, jitter = 0;  // ns
   void *allocated_msg_reader = nullptr;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
   AlignedBuffer aligned_buf;
@@ -59,50 +71,61 @@ struct SubMaster::SubMessage {
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *address,
                      const std::vector<const char *> &ignore_alive) {
   poller_ = Poller::create();
+  messages_.reserve(service_list.size());
   for (auto name : service_list) {
     const service *serv = get_service(name);
     assert(serv != nullptr);
     SubSocket *socket = SubSocket::create(message_context.context(), name, address ? address : "127.0.0.1", true);
     assert(socket != 0);
     poller_->registerSocket(socket);
-    SubMessage *m = new SubMessage{
+    messages_.push_back(SubMessage{
       .name = name,
       .socket = socket,
       .freq = serv->frequency,
       .ignore_alive = inList(ignore_alive, name),
-      .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader))};
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
-    services_[name] = m;
+      .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader))});
+    SubMessage &m = messages_.back();
+    if (m.freq > 0) {
+      // the smallest whole ns the double check (dt * 1e-9) < 10.0 / freq fails at
+      m.alive_timeout = (10000000000ULL + m.freq - 1) / m.freq;
+      m.alive_deadline = m.alive_timeout;
+    }
+    m.msg_reader = new (m.allocated_msg_reader) capnp::FlatArrayMessageReader({});
+    services_[name] = messages_.size() - 1;
   }
+  ready_.resize(messages_.size());
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto &m : messages_) m.updated = false;
 
-  auto sockets = poller_->poll(timeout);
+  size_t num_ready = poller_->poll(timeout, ready_.data(), ready_.size());
   uint64_t current_time = nanos_since_boot();
+  if (++frame == UINT64_MAX) frame = 1;
 
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
-
-  for (auto s : sockets) {
+  for (size_t i = 0; i < num_ready; i++) {
+    SubSocket *s = ready_[i];
     Message *msg = s->receive(true);
     if (msg == nullptr) continue;
 
-    SubMessage *m = messages_.at(s);
+    // A linear scan beats a map for the handful of sockets a SubMaster has
+    size_t idx = 0;
+    while (messages_[idx].socket != s) idx++;
+    SubMessage &m = messages_[idx];
 
-    m->msg_reader->~FlatArrayMessageReader();
+    m.msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
+    m.msg_reader = new (m.allocated_msg_reader) capnp::FlatArrayMessageReader(m.aligned_buf.align(msg), options);
     delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    update_msg(current_time, idx, m.msg_reader->getRoot<cereal::Event>());
   }
 
-  update_msgs(current_time, messages);
+  update_time_ = current_time;
 }
 
 void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
+  for (auto &m : messages_) m.updated = false;
   if (++frame == UINT64_MAX) frame = 1;
 
   for(auto &kv : messages) {
@@ -110,29 +133,44 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
     if (m_find == services_.end()){
       continue;
     }
-    SubMessage *m = m_find->second;
-    m->event = kv.second;
-    m->updated = true;
-    m->rcv_time = current_time;
-    m->rcv_frame = frame;
-    m->valid = m->event.getValid();
-    if (SIMULATION) m->alive = true;
+    update_msg(current_time, m_find->second, kv.second);
   }
 
-  if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
-      m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
+  update_time_ = current_time;
+}
+
+void SubMaster::update_msg(uint64_t current_time, size_t idx, cereal::Event::Reader event) {
+  SubMessage &m = messages_[idx];
+  if (m.received) {
+    const double dt = current_time - m.rcv_time;
+    if (m.mean_dt == 0) {
+      m.mean_dt = dt;
+    } else {
+      m.jitter += (std::abs(dt - m.mean_dt) - m.jitter) * ARRIVAL_GAIN;
+      m.mean_dt += (dt - m.mean_dt) * ARRIVAL_GAIN;
     }
   }
+  m.event = event;
+  m.updated = true;
+  m.received = true;
+  m.rcv_time = current_time;
+  m.rcv_frame = frame;
+  m.alive_deadline = current_time + m.alive_timeout;
+  m.valid = m.event.getValid();
+}
+
+bool SubMaster::alive_(const SubMessage &m) const {
+  // in simulation a service is alive once it sent something
+  if (SIMULATION) return m.received;
+  // nothing is alive before the first update
+  return frame != 0 && (m.alive_timeout == 0 || update_time_ < m.alive_deadline);
 }
 
 bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
   int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
-      found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
+  for (auto &m : messages_) {
+    if (service_list.size() == 0 || inList(service_list, m.name.c_str())) {
+      found += (!valid || m.valid) && (!alive || (m.ignore_alive || alive_(m)));
     }
   }
   return service_list.size() == 0 ? found == messages_.size() : found == service_list.size();
@@ -140,49 +178,66 @@ bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid,
 
 void SubMaster::drain() {
   while (true) {
-    auto polls = poller_->poll(0);
-    if (polls.size() == 0)
+    size_t num_ready = poller_->poll(0, ready_.data(), ready_.size());
+    if (num_ready == 0)
       break;
 
-    for (auto sock : polls) {
-      Message *msg = sock->receive(true);
+    for (size_t i = 0; i < num_ready; i++) {
+      Message *msg = ready_[i]->receive(true);
       delete msg;
     }
   }
 }
 
-bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
+SubMaster::Handle SubMaster::handle(const char *name) const {
+  // find doesn't make a std::string of name, unlike at()
+  auto it = services_.find(name);
+  if (it == services_.end()) {
+    throw std::out_of_range(std::string("service ") + name + " not subscribed to");
+  }
+  return {it->second};
+}
+
+bool SubMaster::updated(Handle h) const {
+  return messages_[h.idx].updated;
+}
+
+bool SubMaster::alive(Handle h) const {
+  return alive_(messages_[h.idx]);
 }
 
-bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
+bool SubMaster::valid(Handle h) const {
+  return messages_[h.idx].valid;
 }
 
-bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
+uint64_t SubMaster::rcv_frame(Handle h) const {
+  return messages_[h.idx].rcv_frame;
 }
 
-uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
+uint64_t SubMaster::rcv_time(Handle h) const {
+  return messages_[h.idx].rcv_time;
 }
 
-uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
+double SubMaster::freq(Handle h) const {
+  const double mean_dt = messages_[h.idx].mean_dt;
+  return mean_dt > 0 ? 1e9 / mean_dt : 0;
 }
 
-cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
+double SubMaster::jitter(Handle h) const {
+  return messages_[h.idx].jitter * 1e-9;
+}
+
+cereal::Event::Reader &SubMaster::operator[](Handle h) const {
+  // The event is handed out for reading and assigning like before, the const only covers the SubMaster itself
+  return const_cast<SubMessage &>(messages_[h.idx]).event;
 };
 
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    m->msg_reader->~FlatArrayMessageReader();
-    free(m->allocated_msg_reader);
-    delete m->socket;
-    delete m;
+  for (auto &m : messages_) {
+    m.msg_reader->~FlatArrayMessageReader();
+    free(m.allocated_msg_reader);
+    delete m.socket;
   }
 }
 
@@ -191,15 +246,34 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
     assert(get_service(name) != nullptr);
     PubSocket *socket = PubSocket::create(message_context.context(), name);
     assert(socket);
-    sockets_[name] = socket;
+    sockets_.push_back(socket);
+    services_[name] = sockets_.size() - 1;
   }
 }
 
-int PubMaster::send(const char *name, MessageBuilder &msg) {
+PubMaster::Handle PubMaster::handle(const char *name) const {
+  // find doesn't make a std::string of name, unlike at()
+  auto it = services_.find(name);
+  if (it == services_.end()) {
+    throw std::out_of_range(std::string("service ") + name + " not published");
+  }
+  return {it->second};
+}
+
+int PubMaster::send(Handle h, MessageBuilder &msg) {
   auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  return send(h, bytes.begin(), bytes.size());
+}
+
+int PubMaster::send_batch(const char *name, const std::vector<MessageBuilder *> &msgs) {
+  std::vector<kj::ArrayPtr<capnp::byte>> bytes;
+  bytes.reserve(msgs.size());
+  for (auto msg : msgs) {
+    bytes.push_back(msg->toBytes());
+  }
+  return sockets_[handle(name).idx]->sendv(bytes);
 }
 
 PubMaster::~PubMaster() {
-  for (auto s : sockets_) delete s.second;
+  for (auto s : sockets_) delete s;
 }
@@ -0,0 +1,63 @@
+#include <cmath>
+
+#include "catch2/catch.hpp"
+#include "messaging.h"
+
+// carState is 100Hz, alive for 10 periods. logMessage has no frequency, it's always alive
+static const uint64_t MS = 1000000ULL;
+
+static void update_car_state(SubMaster &sm, MessageBuilder &msg, uint64_t t) {
+  sm.update_msgs(t, {{"carState", msg.getRoot<cereal::Event>().asReader()}});
+}
+
+TEST_CASE("SubMaster alive is as of the last update"){
+  SubMaster sm({"carState", "logMessage"});
+  MessageBuilder msg;
+  msg.initEvent().initCarState();
+
+  REQUIRE(!sm.alive("carState"));
+  REQUIRE(!sm.alive("logMessage"));
+
+  const uint64_t t0 = 1000 * MS;
+  update_car_state(sm, msg, t0);
+  REQUIRE(sm.alive("carState"));
+  REQUIRE(sm.alive("logMessage"));
+
+  sm.update_msgs(t0 + 99 * MS, {});
+  REQUIRE(sm.alive("carState"));
+  sm.update_msgs(t0 + 100 * MS, {});
+  REQUIRE(!sm.alive("carState"));
+  REQUIRE(sm.alive("logMessage"));
+  REQUIRE(!sm.allAlive());
+  REQUIRE(sm.allAlive({"logMessage"}));
+
+  update_car_state(sm, msg, t0 + 150 * MS);
+  REQUIRE(sm.alive("carState"));
+  REQUIRE(sm.allAlive());
+}
+
+TEST_CASE("SubMaster freq and jitter"){
+  SubMaster sm({"carState"});
+  MessageBuilder msg;
+  msg.initEvent().initCarState();
+
+  REQUIRE(sm.freq("carState") == 0);
+  uint64_t t = 1000 * MS;
+  update_car_state(sm, msg, t);
+  REQUIRE(sm.freq("carState") == 0);
+
+  // at 100Hz, then every other period is 2ms early and 2ms late
+  for (int i = 0; i < 200; i++) {
+    t += 10 * MS;
+    update_car_state(sm, msg, t);
+  }
+  REQUIRE(std::abs(sm.freq("carState") - 100.0) < 1e-6);
+  REQUIRE(sm.jitter("carState") < 1e-9);
+
+  for (int i = 0; i < 400; i++) {
+    t += (i % 2 ? 12 : 8) * MS;
+    update_car_state(sm, msg, t);
+  }
+  REQUIRE(std::abs(sm.freq("carState") - 100.0) < 2.0);
+  REQUIRE(std::abs(sm.jitter("carState") - 0.002) < 0.0005);
+}
@@ -13,8 +13,10 @@ def new_port(port: int):
 
 
 class Service:
-  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
+  def __init__(self, port: int, segment_size: int, num_readers: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
     self.port = port
+    self.segment_size = segment_size
+    self.num_readers = num_readers
     self.should_log = should_log
     self.frequency = frequency
     self.decimation = decimation
@@ -36,6 +38,7 @@ services = {
   "logMessage": (True, 0.),
   "liveCalibration": (True, 4., 4),
   "androidLog": (True, 0., 1),
+  "androidLogs": (True, 0., 1),
   "carState": (True, 100., 10),
   "carControl": (True, 100., 10),
   "longitudinalPlan": (True, 20., 5),
@@ -59,11 +62,63 @@ services = {
   "wideRoadEncodeIdx": (True, 20., 1),
   "wideRoadCameraState": (True, 20., 20),
   "modelV2": (True, 20., 40),
+  "modelV2Compact": (True, 20., 4),
   "managerState": (True, 2., 1),
   "uploaderState": (True, 0., 1),
   "liveMapData": (False, 0.),
+  "loggerdState": (True, 1., 1),
+  "encoderStats": (True, 1., 1),
+  "boarddStats": (True, 2., 1),
+  "threadLog": (True, 10.),
+  "roadEncodeData": (False, 20.),
+  "driverEncodeData": (False, DCAM_FREQ),
+  "wideRoadEncodeData": (False, 20.),
+  "qRoadEncodeData": (False, 20.),
+  "canPacked": (False, 100.),
 }
-service_list = {name: Service(new_port(idx), *vals) for  # type: ignore
+
+MB = 1024 * 1024
+SERVICE_SEGMENT_SIZE = 2 * MB
+
+# Size of the msgq ring buffer of the services that need more than SERVICE_SEGMENT_SIZE. A reader that
+# falls behind by a segment loses messages, so it should hold a few seconds of the busiest stretch of
+# the service. selfdrive/debug/msgq_margin.py reports that margin on rlogs
+segment_sizes = {
+  "can": 10 * MB,
+  "canPacked": 4 * MB,
+  "sensorEvents": 4 * MB,
+  "ubloxRaw": 4 * MB,
+  "logMessage": 4 * MB,
+  "androidLog": 4 * MB,
+  "androidLogs": 4 * MB,
+  "liveLocationKalman": 4 * MB,
+  "modelV2": 10 * MB,
+  # the frame image can be attached for debugging
+  "roadCameraState": 100 * MB,
+  "driverCameraState": 100 * MB,
+  "wideRoadCameraState": 100 * MB,
+  "roadEncodeData": 10 * MB,
+  "driverEncodeData": 10 * MB,
+  "wideRoadEncodeData": 10 * MB,
+}
+
+# Reader slots of the msgq queue of the widely subscribed services, so attaching the UI, loggerd and
+# debugging tools doesn't evict every reader. The others get DEFAULT_NUM_READERS of msgq.h
+HIGH_FANOUT_READERS = 40
+num_readers = {
+  "carState": HIGH_FANOUT_READERS,
+  "controlsState": HIGH_FANOUT_READERS,
+  "deviceState": HIGH_FANOUT_READERS,
+  "pandaState": HIGH_FANOUT_READERS,
+  "radarState": HIGH_FANOUT_READERS,
+  "modelV2": HIGH_FANOUT_READERS,
+  "liveLocationKalman": HIGH_FANOUT_READERS,
+  "lateralPlan": HIGH_FANOUT_READERS,
+  "longitudinalPlan": HIGH_FANOUT_READERS,
+  "can": HIGH_FANOUT_READERS,
+}
+
+service_list = {name: Service(new_port(idx), segment_sizes.get(name, SERVICE_SEGMENT_SIZE), num_readers.get(name, 0), *vals) for  # type: ignore
                 idx, (name, vals) in enumerate(services.items())}
 
 
@@ -72,13 +127,13 @@ def build_header():
   h += "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT services.py */\n"
   h += "#ifndef __SERVICES_H\n"
   h += "#define __SERVICES_H\n"
-  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; };\n"
+  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; size_t segment_size; int num_readers; };\n"
   h += "static struct service services[] = {\n"
   for k, v in service_list.items():
     should_log = "true" if v.should_log else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", %d, %s, %d, %d },\n' % \
-         (k, v.port, should_log, v.frequency, decimation)
+    h += '  { "%s", %d, %s, %d, %d, %d, %d },\n' % \
+         (k, v.port, should_log, v.frequency, decimation, v.segment_size, v.num_readers)
   h += "};\n"
   h += "#endif\n"
   return h
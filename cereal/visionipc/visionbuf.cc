@@ -1,5 +1,7 @@
 #include "visionbuf.h"
 
+#include <algorithm>
+
 #define ALIGN(x, align) (((x) + (align)-1) & ~((align)-1))
 
 #ifdef QCOM
@@ -29,6 +31,44 @@ void VisionBuf::init_rgb(size_t width, size_t height, size_t stride) {
   this->stride = stride;
 }
 
+void VisionBuf::init_nv12(size_t width, size_t height, size_t stride, size_t uv_offset){
+  this->rgb = false;
+  this->nv12 = true;
+  this->width = width;
+  this->height = height;
+  this->stride = stride;
+  this->uv_offset = uv_offset;
+
+  this->y = (uint8_t *)this->addr;
+  this->u = this->y + uv_offset;
+  this->v = this->u + 1;
+}
+
+int VisionBuf::sync(int dir) {
+  return sync_range(0, this->len, dir);
+}
+
+int VisionBuf::sync_rows(size_t row, size_t rows, int dir) {
+  if (row >= this->height) return 0;
+  rows = std::min(rows, this->height - row);
+  if (this->rgb) {
+    return sync_range(row * this->stride, rows * this->stride, dir);
+  }
+
+  // the chroma rows of the luma rows, a chroma row per two luma rows
+  const size_t uv_row = row / 2, uv_rows = (row + rows + 1) / 2 - uv_row;
+  if (this->nv12) {
+    int err = sync_range(row * this->stride, rows * this->stride, dir);
+    return err ? err : sync_range(this->uv_offset + uv_row * this->stride, uv_rows * this->stride, dir);
+  }
+
+  const size_t w = this->width, uv_w = this->width / 2;
+  int err = sync_range(row * w, rows * w, dir);
+  if (!err) err = sync_range((this->u - this->y) + uv_row * uv_w, uv_rows * uv_w, dir);
+  if (!err) err = sync_range((this->v - this->y) + uv_row * uv_w, uv_rows * uv_w, dir);
+  return err;
+}
+
 void VisionBuf::init_yuv(size_t width, size_t height){
   this->rgb = false;
   this->width = width;
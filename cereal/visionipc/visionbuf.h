@@ -11,7 +11,8 @@
 #define VISIONBUF_SYNC_FROM_DEVICE 0
 #define VISIONBUF_SYNC_TO_DEVICE 1
 
-enum VisionStreamType {
+// Named streams created at runtime get the types after VISION_STREAM_MAX
+enum VisionStreamType : int {
   VISION_STREAM_RGB_BACK,
   VISION_STREAM_RGB_FRONT,
   VISION_STREAM_RGB_WIDE,
@@ -21,6 +22,17 @@ enum VisionStreamType {
   VISION_STREAM_MAX,
 };
 
+struct VisionStreamInfo {
+  VisionStreamType type;
+  char name[VISIONIPC_MAX_NAME_LEN]; // empty for the fixed stream types
+  bool rgb;
+  bool nv12;
+  size_t width;
+  size_t height;
+  size_t stride;
+  size_t num_buffers;
+};
+
 class VisionBuf {
  public:
   size_t len = 0;
@@ -38,6 +50,10 @@ class VisionBuf {
   uint8_t * u = nullptr;
   uint8_t * v = nullptr;
 
+  // NV12, u points to the interleaved uv plane and v = u + 1
+  bool nv12 = false;
+  size_t uv_offset = 0;
+
   // Visionipc
   uint64_t server_id = 0;
   size_t idx = 0;
@@ -55,7 +71,12 @@ class VisionBuf {
   void init_cl(cl_device_id device_id, cl_context ctx);
   void init_rgb(size_t width, size_t height, size_t stride);
   void init_yuv(size_t width, size_t height);
+  void init_nv12(size_t width, size_t height, size_t stride, size_t uv_offset);
   int sync(int dir);
+  // the bytes [offset, offset + len) of the buffer
+  int sync_range(size_t offset, size_t len, int dir);
+  // rows [row, row + rows) of the frame, of a yuv or nv12 frame its y rows and their rows of u and v
+  int sync_rows(size_t row, size_t rows, int dir);
   int free();
 };
 
@@ -11,9 +11,49 @@
 
 std::atomic<int> offset = 0;
 
-static void *malloc_with_fd(size_t len, int *fd) {
+// The buffers are CL_MEM_USE_HOST_PTR over the shared memory and synced by mapping them, where the
+// device can use host memory that maps the memory itself without a copy. VISIONBUF_CL_COPY=1 reads
+// and writes the whole buffer instead, for drivers that are slow to map
+static const bool sync_copy = getenv("VISIONBUF_CL_COPY") != nullptr;
+
+#ifdef __linux__
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// VISIONBUF_HUGEPAGES backs the buffers with 2MB pages: a hugetlb memfd when there are pages reserved
+// for it (vm.nr_hugepages), else the shm file with transparent huge pages, which are only used with
+// /sys/kernel/mm/transparent_hugepage/shmem_enabled at advise. Read on every allocation and import
+static bool use_hugepages() {
+  return getenv("VISIONBUF_HUGEPAGES") != nullptr;
+}
+
+static void *malloc_hugetlb(size_t len, size_t *mmap_len, int *fd) {
+  const size_t huge_len = (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  int hfd = memfd_create("visionbuf", MFD_HUGETLB);
+  if (hfd < 0) return nullptr;
+
+  // the pages are reserved on mmap, it fails when there aren't enough
+  if (ftruncate(hfd, huge_len) == 0) {
+    void *addr = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_SHARED, hfd, 0);
+    if (addr != MAP_FAILED) {
+      *fd = hfd;
+      *mmap_len = huge_len;
+      return addr;
+    }
+  }
+  close(hfd);
+  return nullptr;
+}
+#endif
+
+static void *malloc_with_fd(size_t len, size_t *mmap_len, int *fd) {
   char full_path[0x100];
 
+#ifdef __linux__
+  if (use_hugepages()) {
+    if (void *addr = malloc_hugetlb(len, mmap_len, fd)) return addr;
+  }
+#endif
+
 #ifdef __APPLE__
   snprintf(full_path, sizeof(full_path)-1, "/tmp/visionbuf_%d_%d", getpid(), offset++);
 #else
@@ -28,16 +68,21 @@ static void *malloc_with_fd(size_t len, int *fd) {
   ftruncate(*fd, len);
   void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
   assert(addr != MAP_FAILED);
+#ifdef __linux__
+  if (use_hugepages()) madvise(addr, len, MADV_HUGEPAGE);
+#endif
 
+  *mmap_len = len;
   return addr;
 }
 
 void VisionBuf::allocate(size_t len) {
   int fd;
-  void *addr = malloc_with_fd(len, &fd);
+  size_t mmap_len;
+  void *addr = malloc_with_fd(len, &mmap_len, &fd);
 
   this->len = len;
-  this->mmap_len = len;
+  this->mmap_len = mmap_len;
   this->addr = addr;
   this->fd = fd;
 }
@@ -57,17 +102,33 @@ void VisionBuf::import(){
   assert(this->fd >= 0);
   this->addr = mmap(NULL, this->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
   assert(this->addr != MAP_FAILED);
+#ifdef __linux__
+  // the transparent huge pages of the shm file are only mapped as such where the mapping asked for them
+  if (use_hugepages()) madvise(this->addr, this->mmap_len, MADV_HUGEPAGE);
+#endif
 }
 
 
-int VisionBuf::sync(int dir) {
+int VisionBuf::sync_range(size_t offset, size_t len, int dir) {
   int err = 0;
-  if (!this->buf_cl) return 0;
-
-  if (dir == VISIONBUF_SYNC_FROM_DEVICE) {
-    err = clEnqueueReadBuffer(this->copy_q, this->buf_cl, CL_FALSE, 0, this->len, this->addr, 0, NULL, NULL);
+  if (!this->buf_cl || len == 0) return 0;
+  assert(offset + len <= this->len);
+  uint8_t *host = (uint8_t *)this->addr + offset;
+
+  if (sync_copy) {
+    if (dir == VISIONBUF_SYNC_FROM_DEVICE) {
+      err = clEnqueueReadBuffer(this->copy_q, this->buf_cl, CL_FALSE, offset, len, host, 0, NULL, NULL);
+    } else {
+      err = clEnqueueWriteBuffer(this->copy_q, this->buf_cl, CL_FALSE, offset, len, host, 0, NULL, NULL);
+    }
   } else {
-    err = clEnqueueWriteBuffer(this->copy_q, this->buf_cl, CL_FALSE, 0, this->len, this->addr, 0, NULL, NULL);
+    // the host's writes are the content for the device, its copy isn't read back first
+    cl_map_flags flags = (dir == VISIONBUF_SYNC_FROM_DEVICE) ? CL_MAP_READ : CL_MAP_WRITE_INVALIDATE_REGION;
+    void *ptr = clEnqueueMapBuffer(this->copy_q, this->buf_cl, CL_TRUE, flags, offset, len, 0, NULL, NULL, &err);
+    if (err == 0) {
+      assert(ptr == host);
+      err = clEnqueueUnmapMemObject(this->copy_q, this->buf_cl, ptr, 0, NULL, NULL);
+    }
   }
 
   if (err == 0){
@@ -87,7 +148,7 @@ int VisionBuf::free() {
     if (err != 0) return err;
   }
 
-  err = munmap(this->addr, this->len);
+  err = munmap(this->addr, this->mmap_len);
   if (err != 0) return err;
 
   err = close(this->fd);
@@ -104,12 +104,16 @@ void VisionBuf::init_cl(cl_device_id device_id, cl_context ctx) {
 }
 
 
-int VisionBuf::sync(int dir) {
+int VisionBuf::sync_range(size_t offset, size_t len, int dir) {
+  if (len == 0) return 0;
+  assert(offset + len <= this->len);
+
   struct ion_flush_data flush_data = {0};
   flush_data.handle = this->handle;
-  flush_data.vaddr = this->addr;
+  // msm_ion cleans and invalidates [vaddr, vaddr + length) of the mapping, it doesn't add the offset
+  flush_data.vaddr = (uint8_t *)this->addr + offset;
   flush_data.offset = 0;
-  flush_data.length = this->len;
+  flush_data.length = len;
 
   // ION_IOC_INV_CACHES ~= DMA_FROM_DEVICE
   // ION_IOC_CLEAN_CACHES ~= DMA_TO_DEVICE
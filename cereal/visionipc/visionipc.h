@@ -1,14 +1,24 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 
 constexpr int VISIONIPC_MAX_FDS = 128;
+constexpr int VISIONIPC_RING_SIZE = 16;
+constexpr int VISIONIPC_MAX_CLIENTS = 16;
+constexpr int VISIONIPC_MAX_NAME_LEN = 64;
+constexpr int VISIONIPC_MAX_STREAMS = 64;
+constexpr uint32_t VISIONIPC_LEASE_WRITING = 1u << 31;
 
 struct VisionIpcBufExtra {
   uint32_t frame_id;
   uint64_t timestamp_sof;
   uint64_t timestamp_eof;
+  uint64_t timestamp_processed; // producer finished writing the buffer, nanos since boot
+  uint64_t timestamp_sent; // set by VisionIpcServer::send
+  uint64_t seq; // set by VisionIpcServer::send, frames sent on the stream so far, 1 for the first
+  bool newer_available; // set by VisionIpcClient::recv, the server sent frames after this one
 };
 
 struct VisionIpcPacket {
@@ -16,3 +26,28 @@ struct VisionIpcPacket {
   size_t idx;
   struct VisionIpcBufExtra extra;
 };
+
+struct VisionIpcRingEntry {
+  std::atomic<uint64_t> seq; // frame number + 1, 0 while the entry is being written
+  size_t idx;
+  struct VisionIpcBufExtra extra;
+};
+
+// Frame ready notifications of one stream in shared memory, clients are woken through their eventfd.
+// This skips the msgq round trip, the msgq packet is still sent for clients that can't use the ring
+struct VisionIpcRing {
+  std::atomic<uint64_t> write_seq; // number of frames sent
+  uint64_t server_id;
+  int32_t server_pid;
+  VisionIpcRingEntry entries[VISIONIPC_RING_SIZE];
+
+  // Optional buffer leases. A client that leases its buffer sets its bit in leases[idx], the server
+  // doesn't hand out a leased buffer for writing and sets VISIONIPC_LEASE_WRITING while it fills one.
+  // buf_frames[idx] is the frame number + 1 the buffer holds, a lease is only good for that frame
+  std::atomic<uint32_t> leases[VISIONIPC_MAX_FDS];
+  std::atomic<uint64_t> buf_frames[VISIONIPC_MAX_FDS];
+  std::atomic<int32_t> lease_pids[VISIONIPC_MAX_CLIENTS]; // owner of each lease bit
+
+  std::atomic<uint64_t> skipped_buffers; // leased buffers get_buffer went past
+  std::atomic<uint64_t> overwritten_leases; // all buffers were leased and one was overwritten anyway
+};
@@ -13,12 +13,20 @@ cdef extern from "visionbuf.h":
   cdef cppclass VisionBuf:
     void * addr
     size_t len
+    bool rgb
+    size_t width
+    size_t height
+    size_t stride
 
 cdef extern from "visionipc.h":
   struct VisionIpcBufExtra:
     uint32_t frame_id
     uint64_t timestamp_sof
     uint64_t timestamp_eof
+    uint64_t timestamp_processed
+    uint64_t timestamp_sent
+    uint64_t seq
+    bool newer_available
 
 cdef extern from "visionipc_server.h":
   cdef cppclass VisionIpcServer:
@@ -27,3 +35,9 @@ cdef extern from "visionipc_server.h":
     VisionBuf * get_buffer(VisionStreamType)
     void send(VisionBuf *, VisionIpcBufExtra *, bool)
     void start_listener()
+
+cdef extern from "visionipc_client.h":
+  cdef cppclass VisionIpcClient:
+    VisionIpcClient(string, VisionStreamType, bool)
+    VisionBuf * recv(VisionIpcBufExtra *, int)
+    bool connect(bool)
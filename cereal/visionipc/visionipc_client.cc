@@ -1,21 +1,74 @@
 #include <chrono>
 #include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <thread>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 #include "visionipc/ipc.h"
 #include "visionipc/visionipc_client.h"
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
 
-VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx) {
+VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx), conflate(conflate) {
   msg_ctx = Context::create();
-  sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
+  init_msgq();
+}
+
+// The type of a named stream is only known once connected
+VisionIpcClient::VisionIpcClient(std::string name, std::string stream_name, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(VISION_STREAM_MAX), stream_name(stream_name), device_id(device_id), ctx(ctx), conflate(conflate) {
+  msg_ctx = Context::create();
+}
+
+void VisionIpcClient::init_msgq(){
+  delete poller;
+  delete sock;
 
+  sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
   poller = Poller::create();
   poller->registerSocket(sock);
 }
 
+std::vector<VisionStreamInfo> VisionIpcClient::list_streams(std::string name){
+  std::string path = get_ipc_path(name);
+  int socket_fd = ipc_connect(path.c_str());
+  if (socket_fd < 0) return {};
+
+  VisionIpcRequest req = {VISIONIPC_REQUEST_STREAMS, VISION_STREAM_MAX, getpid()};
+  int r = ipc_sendrecv_with_fds(true, socket_fd, &req, sizeof(req), nullptr, 0, nullptr);
+  assert(r == sizeof(req));
+
+  VisionStreamInfo infos[VISIONIPC_MAX_STREAMS];
+  r = ipc_sendrecv_with_fds(false, socket_fd, infos, sizeof(infos), nullptr, 0, nullptr);
+  close(socket_fd);
+
+  if (r <= 0) return {};
+  assert(r % sizeof(VisionStreamInfo) == 0);
+  return std::vector<VisionStreamInfo>(infos, infos + r / sizeof(VisionStreamInfo));
+}
+
+bool VisionIpcClient::find_stream(){
+  for (auto &info : list_streams(name)) {
+    if (stream_name == info.name) {
+      // A restarted server can give the stream a different type
+      if (info.type != type || sock == nullptr) {
+        type = info.type;
+        init_msgq();
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
 // Connect is not thread safe. Do not use the buffers while calling connect
 bool VisionIpcClient::connect(bool blocking){
   connected = false;
@@ -28,9 +81,23 @@ bool VisionIpcClient::connect(bool blocking){
   }
 
   num_buffers = 0;
+  close_ring();
+  if (server_fd >= 0) {
+    close(server_fd);
+    server_fd = -1;
+  }
+
+  while (!stream_name.empty() && !find_stream()) {
+    if (blocking){
+      std::cout << "VisionIpcClient waiting for stream " << stream_name << std::endl;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    } else {
+      return false;
+    }
+  }
 
   // Connect to server socket and ask for all FDs of type
-  std::string path = "/tmp/visionipc_" + name;
+  std::string path = get_ipc_path(name);
 
   int socket_fd = -1;
   while (socket_fd < 0) {
@@ -46,17 +113,42 @@ bool VisionIpcClient::connect(bool blocking){
     }
   }
 
-  // Send stream type to server to request FDs
-  int r = ipc_sendrecv_with_fds(true, socket_fd, &type, sizeof(type), nullptr, 0, nullptr);
-  assert(r == sizeof(type));
+  // Send stream type to server to request FDs, with the eventfd the server should notify.
+  // Set VISIONIPC_NO_RING to receive frames over msgq instead
+#ifdef __linux__
+  if (!std::getenv("VISIONIPC_NO_RING")) {
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+#endif
+  VisionIpcRequest req = {VISIONIPC_REQUEST_BUFFERS, type, getpid()};
+  int r = ipc_sendrecv_with_fds(true, socket_fd, &req, sizeof(req), notify_fd >= 0 ? &notify_fd : nullptr, notify_fd >= 0 ? 1 : 0, nullptr);
+  assert(r == sizeof(req));
 
-  // Get FDs
-  int fds[VISIONIPC_MAX_FDS];
+  // Get FDs, the ring comes after the buffers
+  int fds[VISIONIPC_MAX_FDS + 1];
+  int num_fds = 0;
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS + 1, &num_fds);
+
+  // Kept open, the server counts the clients of a stream by their connections. Not for the children we start
+  fcntl(socket_fd, F_SETFD, FD_CLOEXEC);
+  server_fd = socket_fd;
 
+  assert(r > 0 && r % sizeof(VisionBuf) == 0);
+  num_buffers = r / sizeof(VisionBuf);
   assert(num_buffers > 0);
-  assert(r == sizeof(VisionBuf) * num_buffers);
+  assert(num_fds == num_buffers || num_fds == num_buffers + 1);
+
+  if (num_fds > num_buffers) {
+    ring_fd = fds[num_buffers];
+    if (notify_fd >= 0) {
+      void *addr = mmap(NULL, sizeof(VisionIpcRing), PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+      assert(addr != MAP_FAILED);
+      ring = (VisionIpcRing *)addr;
+      read_seq = ring->write_seq.load(std::memory_order_acquire);
+      if (lease_buffers) claim_lease_slot();
+    }
+  }
 
   // Import buffers
   for (size_t i = 0; i < num_buffers; i++){
@@ -65,6 +157,8 @@ bool VisionIpcClient::connect(bool blocking){
     buffers[i].import();
     if (buffers[i].rgb) {
       buffers[i].init_rgb(buffers[i].width, buffers[i].height, buffers[i].stride);
+    } else if (buffers[i].nv12) {
+      buffers[i].init_nv12(buffers[i].width, buffers[i].height, buffers[i].stride, buffers[i].uv_offset);
     } else {
       buffers[i].init_yuv(buffers[i].width, buffers[i].height);
     }
@@ -76,7 +170,124 @@ bool VisionIpcClient::connect(bool blocking){
   return true;
 }
 
+void VisionIpcClient::claim_lease_slot(){
+  // Take a free slot, or the one of a client that exited without giving it back
+  for (int i = 0; i < VISIONIPC_MAX_CLIENTS; i++) {
+    int32_t pid = ring->lease_pids[i].load(std::memory_order_relaxed);
+    if (pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH)) continue;
+    if (!ring->lease_pids[i].compare_exchange_strong(pid, getpid())) continue;
+
+    lease_slot = i;
+    for (size_t idx = 0; idx < VISIONIPC_MAX_FDS; idx++) {
+      ring->leases[idx].fetch_and(~(1u << i), std::memory_order_relaxed);
+    }
+    return;
+  }
+  LOGW("No free lease slot, receiving without leases");
+}
+
+void VisionIpcClient::release(){
+  if (leased_idx >= 0) {
+    ring->leases[leased_idx].fetch_and(~(1u << lease_slot), std::memory_order_release);
+    leased_idx = -1;
+  }
+}
+
+void VisionIpcClient::close_ring(){
+  release();
+  if (lease_slot >= 0) {
+    ring->lease_pids[lease_slot].store(0);
+    lease_slot = -1;
+  }
+  if (ring != nullptr) {
+    munmap(ring, sizeof(VisionIpcRing));
+    ring = nullptr;
+  }
+  if (ring_fd >= 0) {
+    close(ring_fd);
+    ring_fd = -1;
+  }
+  if (notify_fd >= 0) {
+    close(notify_fd);
+    notify_fd = -1;
+  }
+}
+
+VisionBuf * VisionIpcClient::recv_ring(VisionIpcBufExtra * extra, const int timeout_ms, bool latest){
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  release();
+
+  while (true) {
+    uint64_t write_seq = ring->write_seq.load(std::memory_order_acquire);
+
+    if (write_seq == read_seq) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (remaining <= 0) {
+        // Nothing from the server, the ring doesn't tell us it restarted like a new server_id on msgq does
+        if (kill(ring->server_pid, 0) != 0 && errno == ESRCH) connected = false;
+        return nullptr;
+      }
+
+      // The server writes the eventfd after publishing, so a frame sent after the check above wakes us up
+      struct pollfd pfd = {.fd = notify_fd, .events = POLLIN};
+      if (poll(&pfd, 1, remaining) > 0) {
+        uint64_t count;
+        if (read(notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+          LOGE("Failed to read eventfd");
+        }
+      }
+      continue;
+    }
+
+    // Conflate takes the newest frame, a client that fell behind by more than the ring skips ahead
+    uint64_t seq = conflate || latest ? write_seq - 1 : std::max(read_seq, write_seq - std::min(write_seq, (uint64_t)VISIONIPC_RING_SIZE - 1));
+    VisionIpcRingEntry &entry = ring->entries[seq % VISIONIPC_RING_SIZE];
+
+    if (entry.seq.load(std::memory_order_acquire) != seq + 1) continue;
+    size_t idx = entry.idx;
+    VisionIpcBufExtra entry_extra = entry.extra;
+
+    // Overwritten while we were reading it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != seq + 1) continue;
+
+    read_seq = seq + 1;
+
+    assert(idx < num_buffers);
+    if (lease_slot >= 0) {
+      // The server may have taken the buffer for a newer frame before our lease landed, that frame is lost
+      uint32_t bit = 1u << lease_slot;
+      uint32_t leases = ring->leases[idx].fetch_or(bit, std::memory_order_acq_rel);
+      if ((leases & VISIONIPC_LEASE_WRITING) || ring->buf_frames[idx].load(std::memory_order_acquire) != seq + 1) {
+        ring->leases[idx].fetch_and(~bit, std::memory_order_release);
+        continue;
+      }
+      leased_idx = idx;
+    }
+    VisionBuf * buf = &buffers[idx];
+    if (extra) {
+      *extra = entry_extra;
+      extra->newer_available = ring->write_seq.load(std::memory_order_acquire) > read_seq;
+    }
+
+    if (sync_on_recv && buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
+      LOGE("Failed to sync buffer");
+    }
+    return buf;
+  }
+}
+
 VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
+  return ring != nullptr ? recv_ring(extra, timeout_ms, false) : recv_msgq(extra, timeout_ms, false);
+}
+
+VisionBuf * VisionIpcClient::recv_latest(VisionIpcBufExtra * extra, const int timeout_ms){
+  return ring != nullptr ? recv_ring(extra, timeout_ms, true) : recv_msgq(extra, timeout_ms, true);
+}
+
+VisionBuf * VisionIpcClient::recv_msgq(VisionIpcBufExtra * extra, const int timeout_ms, bool latest){
+  if (poller == nullptr) return nullptr; // named stream that was never found
+
   auto p = poller->poll(timeout_ms);
 
   if (!p.size()){
@@ -88,6 +299,14 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  // Drop the packets queued before the newest one
+  while (latest) {
+    Message * next = sock->receive(true);
+    if (next == nullptr) break;
+    delete r;
+    r = next;
+  }
+
   // Get buffer
   assert(r->getSize() == sizeof(VisionIpcPacket));
   VisionIpcPacket *packet = (VisionIpcPacket*)r->getData();
@@ -103,9 +322,10 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
 
   if (extra) {
     *extra = packet->extra;
+    extra->newer_available = poller->poll(0).size() > 0;
   }
 
-  if (buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
+  if (sync_on_recv && buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
     LOGE("Failed to sync buffer");
   }
 
@@ -121,6 +341,8 @@ VisionIpcClient::~VisionIpcClient(){
       LOGE("Failed to free buffer %zu", i);
     }
   }
+  close_ring();
+  if (server_fd >= 0) close(server_fd);
 
   delete sock;
   delete poller;
@@ -11,22 +11,51 @@ class VisionIpcClient {
 private:
   std::string name;
   Context * msg_ctx;
-  SubSocket * sock;
-  Poller * poller;
+  SubSocket * sock = nullptr;
+  Poller * poller = nullptr;
 
   VisionStreamType type;
+  std::string stream_name; // looked up on connect when set
 
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
-  void init_msgq(bool conflate);
+  // Frame notifications straight from the server, msgq is used when these aren't available
+  bool conflate;
+  VisionIpcRing *ring = nullptr;
+  int ring_fd = -1;
+  int notify_fd = -1;
+  // the connection to the server, open for as long as we're its client
+  int server_fd = -1;
+  uint64_t read_seq = 0;
+  int lease_slot = -1;
+  int leased_idx = -1;
+
+  void init_msgq();
+  bool find_stream();
+  void claim_lease_slot();
+  void close_ring();
+  VisionBuf * recv_ring(VisionIpcBufExtra * extra, const int timeout_ms, bool latest);
+  VisionBuf * recv_msgq(VisionIpcBufExtra * extra, const int timeout_ms, bool latest);
 
 public:
   bool connected = false;
+  // Lease the last received buffer so the server doesn't write into it until the next recv or release.
+  // Set before connect, only works when frames come through the ring
+  bool lease_buffers = false;
+  // Off for consumers that read only part of the frame, they sync_rows or sync_range what they read
+  bool sync_on_recv = true;
   int num_buffers = 0;
   VisionBuf buffers[VISIONIPC_MAX_FDS];
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
+  VisionIpcClient(std::string name, std::string stream_name, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  // The newest frame, the ones sent before it are skipped. For clients that fell behind, without conflate
+  VisionBuf * recv_latest(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
   bool connect(bool blocking=true);
+  void release();
+
+  // Streams the server `name` has, empty if it isn't running
+  static std::vector<VisionStreamInfo> list_streams(std::string name);
 };
@@ -2,12 +2,14 @@
 # cython: c_string_encoding=ascii, language_level=3
 
 import sys
+import numpy as np
 from libcpp.string cimport string
 from libcpp cimport bool
 from libc.string cimport memcpy
 from libc.stdint cimport uint32_t, uint64_t
 
 from .visionipc cimport VisionIpcServer as cppVisionIpcServer
+from .visionipc cimport VisionIpcClient as cppVisionIpcClient
 from .visionipc cimport VisionBuf as cppVisionBuf
 from .visionipc cimport VisionIpcBufExtra
 
@@ -39,6 +41,7 @@ cdef class VisionIpcServer:
     extra.frame_id = frame_id
     extra.timestamp_sof = timestamp_sof
     extra.timestamp_eof = timestamp_eof
+    extra.timestamp_processed = 0
 
     self.server.send(buf, &extra, False)
 
@@ -47,3 +50,55 @@ cdef class VisionIpcServer:
 
   def __dealloc__(self):
     del self.server
+
+
+# For the debug tools that look at the frames of a server, the pixels come straight out of its
+# buffers and never go through the messaging. Only every decimation-th frame is returned, and recv
+# copies out only the rows of the crop
+cdef class VisionIpcClient:
+  cdef cppVisionIpcClient * client
+  cdef VisionIpcBufExtra extra
+  cdef int decimation
+  cdef public size_t width, height, stride
+  cdef public bool rgb
+
+  def __init__(self, string name, VisionStreamType stream, bool conflate, int decimation=1):
+    self.client = new cppVisionIpcClient(name, stream, conflate)
+    self.decimation = max(decimation, 1)
+
+  def connect(self, bool blocking=True):
+    return self.client.connect(blocking)
+
+  @property
+  def frame_id(self):
+    return self.extra.frame_id
+
+  @property
+  def timestamp_eof(self):
+    return self.extra.timestamp_eof
+
+  def recv(self, int timeout_ms=100, crop=None, int scale=1):
+    """The next frame, None on a timeout. RGB buffers are (h, w, 3) in the BGR order of camerad,
+    YUV ones the planes as they are in the buffer. crop is (x_min, y_min, x_max, y_max) inclusive,
+    scale keeps every scale-th pixel of it, both only for RGB"""
+    cdef cppVisionBuf * buf
+    while True:
+      buf = self.client.recv(&self.extra, timeout_ms)
+      if buf == NULL:
+        return None
+      if self.extra.frame_id % self.decimation == 0:
+        break
+
+    self.width, self.height, self.stride, self.rgb = buf.width, buf.height, buf.stride, buf.rgb
+    if not buf.rgb:
+      return np.frombuffer((<char*>buf.addr)[:buf.len], dtype=np.uint8)
+
+    x_min, y_min, x_max, y_max = crop if crop is not None else (0, 0, buf.width - 1, buf.height - 1)
+    assert 0 <= x_min <= x_max < buf.width and 0 <= y_min <= y_max < buf.height
+    rows = (<char*>buf.addr)[y_min * buf.stride:(y_max + 1) * buf.stride]
+    img = np.frombuffer(rows, dtype=np.uint8).reshape(y_max - y_min + 1, buf.stride)
+    img = img[:, :buf.width * 3].reshape(y_max - y_min + 1, buf.width, 3)
+    return np.ascontiguousarray(img[::scale, x_min:x_max + 1:scale])
+
+  def __dealloc__(self):
+    del self.client
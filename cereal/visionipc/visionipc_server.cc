@@ -1,9 +1,19 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <random>
+#include <ctime>
 
+#include <fcntl.h>
 #include <poll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -21,6 +31,34 @@ std::string get_endpoint_name(std::string name, VisionStreamType type){
   }
 }
 
+std::string get_ipc_path(const std::string &name) {
+  const char *prefix = std::getenv("OPENPILOT_PREFIX");
+  return std::string("/tmp/visionipc_") + (prefix ? std::string(prefix) + "_" : "") + name;
+}
+
+static VisionIpcRing *ring_create(int *fd){
+  static std::atomic<int> offset = 0;
+  char full_path[0x100];
+
+#ifdef __APPLE__
+  snprintf(full_path, sizeof(full_path)-1, "/tmp/visionipc_ring_%d_%d", getpid(), offset++);
+#else
+  snprintf(full_path, sizeof(full_path)-1, "/dev/shm/visionipc_ring_%d_%d", getpid(), offset++);
+#endif
+
+  *fd = open(full_path, O_RDWR | O_CREAT, 0777);
+  assert(*fd >= 0);
+  unlink(full_path);
+
+  int err = ftruncate(*fd, sizeof(VisionIpcRing));
+  assert(err == 0);
+  void *addr = mmap(NULL, sizeof(VisionIpcRing), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  assert(addr != MAP_FAILED);
+
+  // The file is zero filled, all entries start out empty
+  return (VisionIpcRing *)addr;
+}
+
 VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_context ctx) : name(name), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
 
@@ -32,6 +70,7 @@ VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_co
 void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height){
   // TODO: assert that this type is not created yet
   assert(num_buffers < VISIONIPC_MAX_FDS);
+  assert(buffers.size() < VISIONIPC_MAX_STREAMS);
   int aligned_w = 0, aligned_h = 0;
 
   size_t size = 0;
@@ -45,6 +84,14 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
     size = width * height * 3 / 2;
   }
 
+  allocate_buffers(type, num_buffers, size, [&](VisionBuf *buf) {
+    rgb ? buf->init_rgb(width, height, stride) : buf->init_yuv(width, height);
+  });
+}
+
+void VisionIpcServer::allocate_buffers(VisionStreamType type, size_t num_buffers, size_t size, const std::function<void(VisionBuf *)> &init){
+  assert(num_buffers < VISIONIPC_MAX_FDS);
+  assert(buffers.size() < VISIONIPC_MAX_STREAMS);
 
   // Create map + alloc requested buffers
   for (size_t i = 0; i < num_buffers; i++){
@@ -55,18 +102,51 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
 
     if (device_id) buf->init_cl(device_id, ctx);
 
-    rgb ? buf->init_rgb(width, height, stride) : buf->init_yuv(width, height);
+    init(buf);
 
     buffers[type].push_back(buf);
   }
 
   cur_idx[type] = 0;
+  consumers[type] = 0;
+
+  VisionIpcRing *ring = ring_create(&ring_fds[type]);
+  ring->server_id = server_id;
+  ring->server_pid = getpid();
+  rings[type] = ring;
 
   // Create msgq publisher for each of the `name` + type combos
   // TODO: compute port number directly if using zmq
   sockets[type] = PubSocket::create(msg_ctx, get_endpoint_name(name, type), false);
 }
 
+VisionStreamType VisionIpcServer::create_buffers(const std::string &stream_name, size_t num_buffers, bool rgb, size_t width, size_t height){
+  assert(!stream_name.empty() && stream_name.size() < VISIONIPC_MAX_NAME_LEN);
+  for (auto const& [type, n] : stream_names) {
+    assert(n != stream_name);
+  }
+
+  VisionStreamType type = static_cast<VisionStreamType>(next_named_type++);
+  create_buffers(type, num_buffers, rgb, width, height);
+  stream_names[type] = stream_name;
+  return type;
+}
+
+VisionStreamType VisionIpcServer::create_buffers_nv12(const std::string &stream_name, size_t num_buffers, size_t width, size_t height,
+                                                      size_t stride, size_t uv_offset, size_t size){
+  assert(!stream_name.empty() && stream_name.size() < VISIONIPC_MAX_NAME_LEN);
+  for (auto const& [type, n] : stream_names) {
+    assert(n != stream_name);
+  }
+  assert(stride >= width && uv_offset >= stride * height && size >= uv_offset + stride * height / 2);
+
+  VisionStreamType type = static_cast<VisionStreamType>(next_named_type++);
+  allocate_buffers(type, num_buffers, size, [&](VisionBuf *buf) {
+    buf->init_nv12(width, height, stride, uv_offset);
+  });
+  stream_names[type] = stream_name;
+  return type;
+}
 
 void VisionIpcServer::start_listener(){
   listener_thread = std::thread(&VisionIpcServer::listener, this);
@@ -76,17 +156,22 @@ void VisionIpcServer::start_listener(){
 void VisionIpcServer::listener(){
   std::cout << "Starting listener for: " << name << std::endl;
 
-  std::string path = "/tmp/visionipc_" + name;
+  std::string path = get_ipc_path(name);
   int sock = ipc_bind(path.c_str());
   assert(sock >= 0);
 
+  std::vector<struct pollfd> polls;
   while (!should_exit){
-    // Wait for incoming connection
-    struct pollfd polls[1] = {{0}};
+    // Wait for incoming connections, and for the clients to close theirs
+    polls.assign(connections.size() + 1, {0});
     polls[0].fd = sock;
     polls[0].events = POLLIN;
+    for (size_t i = 0; i < connections.size(); i++) {
+      polls[i + 1].fd = connections[i].first;
+      polls[i + 1].events = POLLIN;
+    }
 
-    int ret = poll(polls, 1, 100);
+    int ret = poll(polls.data(), polls.size(), 100);
     if (ret < 0) {
       if (errno == EINTR || errno == EAGAIN) continue;
       std::cout << "poll failed, stopping listener" << std::endl;
@@ -94,6 +179,16 @@ void VisionIpcServer::listener(){
     }
 
     if (should_exit) break;
+
+    // A client doesn't send anything after its request, the connection is readable once it's closed
+    for (size_t i = connections.size(); i-- > 0;) {
+      if (polls[i + 1].revents) {
+        close(connections[i].first);
+        update_consumers(connections[i].second, -1);
+        connections.erase(connections.begin() + i);
+      }
+    }
+
     if (!polls[0].revents) {
       continue;
     }
@@ -102,16 +197,27 @@ void VisionIpcServer::listener(){
     int fd = accept(sock, NULL, NULL);
     assert(fd >= 0);
 
-    VisionStreamType type = VisionStreamType::VISION_STREAM_MAX;
-    int r = ipc_sendrecv_with_fds(false, fd, &type, sizeof(type), nullptr, 0, nullptr);
-    assert(r == sizeof(type));
+    VisionIpcRequest req = {VISIONIPC_REQUEST_BUFFERS, VisionStreamType::VISION_STREAM_MAX, 0};
+    int notify_fd = -1, num_notify_fds = 0;
+    int r = ipc_sendrecv_with_fds(false, fd, &req, sizeof(req), &notify_fd, 1, &num_notify_fds);
+    assert(r == sizeof(req));
+
+    if (req.kind == VISIONIPC_REQUEST_STREAMS) {
+      if (num_notify_fds > 0) close(notify_fd);
+      send_stream_infos(fd);
+      close(fd);
+      continue;
+    }
+
+    VisionStreamType type = req.type;
     if (buffers.count(type) <= 0) {
       std::cout << "got request for invalid buffer type: " << type << std::endl;
+      if (num_notify_fds > 0) close(notify_fd);
       close(fd);
       continue;
     }
 
-    int fds[VISIONIPC_MAX_FDS];
+    int fds[VISIONIPC_MAX_FDS + 1];
     int num_fds = buffers[type].size();
     VisionBuf bufs[VISIONIPC_MAX_FDS];
 
@@ -127,22 +233,147 @@ void VisionIpcServer::listener(){
       bufs[i].server_id = server_id;
     }
 
-    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds, nullptr);
+    // The ring goes after the buffers
+    fds[num_fds] = ring_fds[type];
+    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds + 1, nullptr);
 
-    close(fd);
+    if (num_notify_fds > 0) {
+      add_client(type, req.pid, notify_fd);
+    }
+
+    if (r < 0) {
+      close(fd);
+    } else {
+      connections.push_back({fd, type});
+      update_consumers(type, 1);
+    }
   }
 
+  for (auto &[fd, type] : connections) close(fd);
+  connections.clear();
+
   std::cout << "Stopping listener for: " << name << std::endl;
   close(sock);
 }
 
+void VisionIpcServer::update_consumers(VisionStreamType type, int delta){
+  int n = consumers[type] += delta;
+  if (consumers_callback) consumers_callback(type, n);
+}
+
+int VisionIpcServer::num_consumers(VisionStreamType type){
+  assert(consumers.count(type));
+  return consumers.find(type)->second.load(std::memory_order_relaxed);
+}
+
+void VisionIpcServer::set_consumers_callback(std::function<void(VisionStreamType type, int consumers)> callback){
+  consumers_callback = callback;
+}
+
+
+void VisionIpcServer::send_stream_infos(int fd){
+  std::vector<VisionStreamInfo> infos;
+  for (auto const& [type, buf] : buffers) {
+    VisionStreamInfo info = {};
+    info.type = type;
+    if (stream_names.count(type)) {
+      strncpy(info.name, stream_names[type].c_str(), sizeof(info.name) - 1);
+    }
+    info.rgb = buf[0]->rgb;
+    info.nv12 = buf[0]->nv12;
+    info.width = buf[0]->width;
+    info.height = buf[0]->height;
+    info.stride = buf[0]->stride;
+    info.num_buffers = buf.size();
+    infos.push_back(info);
+  }
+
+  // No streams is an empty reply, the client sees the connection close
+  if (!infos.empty()) {
+    ipc_sendrecv_with_fds(true, fd, infos.data(), sizeof(VisionStreamInfo) * infos.size(), nullptr, 0, nullptr);
+  }
+}
 
+void VisionIpcServer::add_client(VisionStreamType type, int32_t pid, int notify_fd){
+  std::lock_guard<std::mutex> lk(clients_lock);
+  auto &c = clients[type];
+
+  // Forget clients that exited, and make room by dropping the oldest one
+  c.erase(std::remove_if(c.begin(), c.end(), [](auto &client) {
+    bool dead = kill(client.first, 0) != 0 && errno == ESRCH;
+    if (dead) close(client.second);
+    return dead;
+  }), c.end());
+
+  if (c.size() >= VISIONIPC_MAX_CLIENTS) {
+    close(c.front().second);
+    c.erase(c.begin());
+  }
+
+  c.push_back({pid, notify_fd});
+}
+
+// Take a buffer for writing, fails if a client holds a lease on it. Buffers that we took
+// before but never sent are still marked writing and can be taken again
+static bool ring_lease_for_writing(VisionIpcRing *ring, size_t idx){
+  uint32_t leases = ring->leases[idx].load(std::memory_order_relaxed);
+  if ((leases & ~VISIONIPC_LEASE_WRITING) != 0) return false;
+  return ring->leases[idx].compare_exchange_strong(leases, VISIONIPC_LEASE_WRITING, std::memory_order_acq_rel);
+}
+
+// Drop the leases of clients that exited without releasing them
+static void ring_reclaim_leases(VisionIpcRing *ring, size_t num_buffers){
+  for (int i = 0; i < VISIONIPC_MAX_CLIENTS; i++) {
+    int32_t pid = ring->lease_pids[i].load(std::memory_order_relaxed);
+    if (pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH)) continue;
+
+    for (size_t idx = 0; idx < num_buffers; idx++) {
+      ring->leases[idx].fetch_and(~(1u << i), std::memory_order_relaxed);
+    }
+  }
+}
 
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  return b[cur_idx[type]++ % b.size()];
+  auto &b = buffers[type];
+  VisionIpcRing *ring = rings[type];
+
+  // Go past the buffers clients are still reading from
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < b.size(); i++) {
+      VisionBuf *buf = b[cur_idx[type]++ % b.size()];
+      if (ring_lease_for_writing(ring, buf->idx)) return buf;
+      ring->skipped_buffers.fetch_add(1, std::memory_order_relaxed);
+    }
+    ring_reclaim_leases(ring, b.size());
+  }
+
+  // Everything is leased, overwrite the next buffer rather than stall the producer
+  ring->overwritten_leases.fetch_add(1, std::memory_order_relaxed);
+  VisionBuf *buf = b[cur_idx[type]++ % b.size()];
+  ring->leases[buf->idx].fetch_or(VISIONIPC_LEASE_WRITING, std::memory_order_acq_rel);
+  return buf;
+}
+
+uint64_t VisionIpcServer::get_skipped_buffers(VisionStreamType type){
+  assert(rings.count(type));
+  return rings[type]->skipped_buffers.load(std::memory_order_relaxed);
+}
+
+uint64_t VisionIpcServer::get_overwritten_leases(VisionStreamType type){
+  assert(rings.count(type));
+  return rings[type]->overwritten_leases.load(std::memory_order_relaxed);
+}
+
+// Same clock as nanos_since_boot() and logMonoTime, so stamps can be compared across processes
+static uint64_t send_timestamp() {
+  struct timespec t;
+#ifdef __APPLE__
+  clock_gettime(CLOCK_MONOTONIC, &t);
+#else
+  clock_gettime(CLOCK_BOOTTIME, &t);
+#endif
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
@@ -153,6 +384,35 @@ void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync
   }
   assert(buffers.count(buf->type));
   assert(buf->idx < buffers[buf->type].size());
+  extra->timestamp_sent = send_timestamp();
+
+  // Publish in the ring, the entry is marked empty while it's being written
+  VisionIpcRing *ring = rings[buf->type];
+  uint64_t seq = ring->write_seq.load(std::memory_order_relaxed);
+  extra->seq = seq + 1;
+  extra->newer_available = false;
+
+  // Tag the buffer with the frame it holds before clients can lease it again
+  ring->buf_frames[buf->idx].store(seq + 1, std::memory_order_relaxed);
+  ring->leases[buf->idx].fetch_and(~VISIONIPC_LEASE_WRITING, std::memory_order_release);
+
+  VisionIpcRingEntry &entry = ring->entries[seq % VISIONIPC_RING_SIZE];
+  entry.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entry.idx = buf->idx;
+  entry.extra = *extra;
+  entry.seq.store(seq + 1, std::memory_order_release);
+  ring->write_seq.store(seq + 1, std::memory_order_release);
+
+  {
+    std::lock_guard<std::mutex> lk(clients_lock);
+    uint64_t one = 1;
+    for (auto &client : clients[buf->type]) {
+      if (write(client.second, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOGE("Failed to notify client %d", client.first);
+      }
+    }
+  }
 
   // Send over correct msgq socket
   VisionIpcPacket packet = {0};
@@ -177,6 +437,14 @@ VisionIpcServer::~VisionIpcServer(){
     }
   }
 
+  for( auto const& [type, ring] : rings ) {
+    munmap(ring, sizeof(VisionIpcRing));
+    close(ring_fds[type]);
+  }
+  for( auto const& [type, c] : clients ) {
+    for (auto &client : c) close(client.second);
+  }
+
   // Messaging cleanup
   for( auto const& [type, sock] : sockets ) {
     delete sock;
@@ -3,13 +3,29 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
 
 #include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
 #include "visionipc/visionbuf.h"
 
 std::string get_endpoint_name(std::string name, VisionStreamType type);
+// unix socket of the server, with OPENPILOT_PREFIX like the msgq queues
+std::string get_ipc_path(const std::string &name);
+
+enum VisionIpcRequestKind {
+  VISIONIPC_REQUEST_BUFFERS, // buffers and ring of one stream
+  VISIONIPC_REQUEST_STREAMS, // VisionStreamInfo of all streams
+};
+
+// Sent by the client on the listener socket, together with its eventfd if it has one
+struct VisionIpcRequest {
+  VisionIpcRequestKind kind;
+  VisionStreamType type;
+  int32_t pid;
+};
 
 class VisionIpcServer {
  private:
@@ -23,20 +39,50 @@ class VisionIpcServer {
 
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
+  std::map<VisionStreamType, std::string> stream_names;
+  int next_named_type = VISION_STREAM_MAX;
   std::map<VisionStreamType, std::map<VisionBuf*, size_t> > idxs;
 
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
+  std::map<VisionStreamType, VisionIpcRing*> rings;
+  std::map<VisionStreamType, int> ring_fds;
+  std::mutex clients_lock;
+  std::map<VisionStreamType, std::vector<std::pair<int32_t, int> > > clients; // pid and eventfd
+
+  // The connections of the clients, they keep theirs open while connected. Of the listener thread
+  std::vector<std::pair<int, VisionStreamType> > connections;
+  std::map<VisionStreamType, std::atomic<int> > consumers;
+  std::function<void(VisionStreamType, int)> consumers_callback;
+  void update_consumers(VisionStreamType type, int delta);
+
+  void allocate_buffers(VisionStreamType type, size_t num_buffers, size_t size, const std::function<void(VisionBuf *)> &init);
+  void add_client(VisionStreamType type, int32_t pid, int notify_fd);
+  void send_stream_infos(int fd);
+
   void listener(void);
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcServer();
 
+  // Skips buffers leased by a client, see VisionIpcClient::lease_buffers. Not safe to call concurrently
+  // with send, a producer sending from another thread has to serialize the two
   VisionBuf * get_buffer(VisionStreamType type);
+  uint64_t get_skipped_buffers(VisionStreamType type);
+  uint64_t get_overwritten_leases(VisionStreamType type);
+  // The clients connected to the stream, a producer can skip the streams nobody reads
+  int num_consumers(VisionStreamType type);
+  // Called on the listener thread with the new number of clients of a stream, set before start_listener
+  void set_consumers_callback(std::function<void(VisionStreamType type, int consumers)> callback);
 
   void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
+  // Streams beyond the fixed types, clients find them by name. Returns the type to use with the server
+  VisionStreamType create_buffers(const std::string &stream_name, size_t num_buffers, bool rgb, size_t width, size_t height);
+  // NV12 in the layout of a hardware encoder, with its plane alignment and the padding it needs in size
+  VisionStreamType create_buffers_nv12(const std::string &stream_name, size_t num_buffers, size_t width, size_t height,
+                                       size_t stride, size_t uv_offset, size_t size);
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
   void start_listener();
 };
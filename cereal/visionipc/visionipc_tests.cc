@@ -1,5 +1,8 @@
 #include <thread>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 #include "catch2/catch.hpp"
 #include "visionipc_server.h"
@@ -133,3 +136,265 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Slow client skips ahead"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 4, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  const uint32_t num_frames = 3 * VISIONIPC_RING_SIZE;
+  for (uint32_t i = 1; i <= num_frames; i++) {
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = i;
+    server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  }
+
+  // Frames can be dropped when the client falls behind, but they stay in order
+  uint32_t last_frame_id = 0;
+  VisionIpcBufExtra extra_recv = {0};
+  while (client.recv(&extra_recv, 10) != nullptr) {
+    REQUIRE(extra_recv.frame_id > last_frame_id);
+    last_frame_id = extra_recv.frame_id;
+  }
+  REQUIRE(last_frame_id == num_frames);
+}
+
+TEST_CASE("Receive the latest frame"){
+  const bool use_ring = GENERATE(true, false);
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 4, false, 100, 100);
+  server.start_listener();
+
+  if (!use_ring) setenv("VISIONIPC_NO_RING", "1", 1);
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  unsetenv("VISIONIPC_NO_RING");
+  zmq_sleep();
+
+  for (uint32_t i = 1; i <= 3; i++) {
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = i;
+    server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  }
+
+  // A client that is behind sees it, and skips to the newest frame
+  VisionIpcBufExtra extra_recv = {0};
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 1);
+  REQUIRE(extra_recv.seq == 1);
+  REQUIRE(extra_recv.newer_available);
+
+  REQUIRE(client.recv_latest(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 3);
+  REQUIRE(extra_recv.seq == 3);
+  REQUIRE(!extra_recv.newer_available);
+
+  REQUIRE(client.recv_latest(&extra_recv, 10) == nullptr);
+}
+
+TEST_CASE("Receive over msgq fallback"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 100, 100);
+  server.start_listener();
+
+  setenv("VISIONIPC_NO_RING", "1", 1);
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  unsetenv("VISIONIPC_NO_RING");
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  extra.frame_id = 42;
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+
+  VisionIpcBufExtra extra_recv = {0};
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 42);
+}
+
+TEST_CASE("Leased buffer is not overwritten"){
+  if (std::getenv("VISIONIPC_NO_RING")) return; // leases need the ring
+
+  const size_t num_buffers = 3;
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, num_buffers, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  client.lease_buffers = true;
+  REQUIRE(client.connect());
+
+  VisionIpcBufExtra extra = {0};
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  VisionBuf *leased = client.recv(&extra);
+  REQUIRE(leased != nullptr);
+
+  for (size_t i = 0; i < 2 * num_buffers; i++) {
+    VisionBuf *buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+    REQUIRE(buf->idx != leased->idx);
+    server.send(buf, &extra);
+  }
+  REQUIRE(server.get_skipped_buffers(VISION_STREAM_YUV_BACK) > 0);
+  REQUIRE(server.get_overwritten_leases(VISION_STREAM_YUV_BACK) == 0);
+
+  // Released buffers are handed out again
+  client.release();
+  bool reused = false;
+  for (size_t i = 0; i < num_buffers; i++) {
+    VisionBuf *buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+    reused |= buf->idx == leased->idx;
+    server.send(buf, &extra);
+  }
+  REQUIRE(reused);
+}
+
+TEST_CASE("Named streams"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 100, 100);
+  VisionStreamType half = server.create_buffers("yuv_back_half", 2, false, 50, 50);
+  VisionStreamType crop = server.create_buffers("rgb_front_face", 2, true, 64, 32);
+  server.start_listener();
+
+  REQUIRE(half >= VISION_STREAM_MAX);
+  REQUIRE(crop != half);
+
+  VisionIpcClient client = VisionIpcClient("camerad", "yuv_back_half", false);
+  REQUIRE(client.connect());
+  REQUIRE(client.buffers[0].width == 50);
+  REQUIRE(client.num_buffers == 2);
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  extra.frame_id = 7;
+  server.send(server.get_buffer(half), &extra);
+
+  VisionIpcBufExtra extra_recv = {0};
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 7);
+
+  auto streams = VisionIpcClient::list_streams("camerad");
+  REQUIRE(streams.size() == 3);
+  bool found = false;
+  for (auto &info : streams) {
+    if (info.type != crop) continue;
+    found = true;
+    REQUIRE(std::string(info.name) == "rgb_front_face");
+    REQUIRE(info.rgb);
+    REQUIRE(info.width == 64);
+    REQUIRE(info.height == 32);
+    REQUIRE(info.num_buffers == 2);
+  }
+  REQUIRE(found);
+
+  VisionIpcClient missing = VisionIpcClient("camerad", "does_not_exist", false);
+  REQUIRE(!missing.connect(false));
+}
+
+TEST_CASE("NV12 stream"){
+  VisionIpcServer server("camerad");
+  VisionStreamType type = server.create_buffers_nv12("yuv_back_encoder", 2, 100, 50, 128, 128 * 64, 128 * 96);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", "yuv_back_encoder", false);
+  REQUIRE(client.connect());
+  VisionBuf *buf = &client.buffers[0];
+  REQUIRE(buf->nv12);
+  REQUIRE(buf->stride == 128);
+  REQUIRE(buf->len >= 128 * 96);
+  REQUIRE(buf->u == buf->y + 128 * 64);
+  REQUIRE(buf->v == buf->u + 1);
+
+  auto streams = VisionIpcClient::list_streams("camerad");
+  REQUIRE(streams.size() == 1);
+  REQUIRE(streams[0].type == type);
+  REQUIRE(streams[0].nv12);
+  REQUIRE(!streams[0].rgb);
+}
+
+TEST_CASE("Sync cl buffers"){
+  cl_platform_id platform;
+  cl_device_id device_id;
+  if (clGetPlatformIDs(1, &platform, NULL) != CL_SUCCESS ||
+      clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device_id, NULL) != CL_SUCCESS) {
+    WARN("no OpenCL device");
+    return;
+  }
+  cl_int err;
+  cl_context ctx = clCreateContext(NULL, 1, &device_id, NULL, NULL, &err);
+  REQUIRE(err == CL_SUCCESS);
+  cl_command_queue q = clCreateCommandQueue(ctx, device_id, 0, &err);
+  REQUIRE(err == CL_SUCCESS);
+
+  {
+    VisionIpcServer server("camerad", device_id, ctx);
+    server.create_buffers(VISION_STREAM_RGB_BACK, 1, true, 1164, 874);
+    VisionBuf *buf = server.get_buffer(VISION_STREAM_RGB_BACK);
+    uint8_t *host = (uint8_t *)buf->addr;
+
+    // written by the device, read by the host
+    const uint8_t pattern = 0x5a;
+    REQUIRE(clEnqueueFillBuffer(q, buf->buf_cl, &pattern, 1, 0, buf->len, 0, NULL, NULL) == CL_SUCCESS);
+    REQUIRE(clFinish(q) == CL_SUCCESS);
+    REQUIRE(buf->sync(VISIONBUF_SYNC_FROM_DEVICE) == 0);
+    REQUIRE(host[0] == pattern);
+    REQUIRE(host[buf->len - 1] == pattern);
+
+    // written by the host, read by the device
+    memset(host, 0x33, buf->len);
+    REQUIRE(buf->sync(VISIONBUF_SYNC_TO_DEVICE) == 0);
+    std::vector<uint8_t> out(buf->len);
+    REQUIRE(clEnqueueReadBuffer(q, buf->buf_cl, CL_TRUE, 0, buf->len, out.data(), 0, NULL, NULL) == CL_SUCCESS);
+    REQUIRE(out[0] == 0x33);
+    REQUIRE(out[buf->len - 1] == 0x33);
+
+    const int n = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+      buf->sync(VISIONBUF_SYNC_FROM_DEVICE);
+      buf->sync(VISIONBUF_SYNC_TO_DEVICE);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / n;
+    WARN("sync of " << buf->len << " bytes from and to the device: " << us << " us");
+  }
+
+  clReleaseCommandQueue(q);
+  clReleaseContext(ctx);
+}
+
+static bool wait_consumers(VisionIpcServer &server, VisionStreamType type, int n){
+  // the listener sees a closed connection on its next poll
+  for (int i = 0; i < 100 && server.num_consumers(type) != n; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return server.num_consumers(type) == n;
+}
+
+TEST_CASE("Count consumers"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 100, 100);
+  server.create_buffers(VISION_STREAM_RGB_BACK, 1, true, 100, 100);
+  std::atomic<int> callbacks = 0;
+  server.set_consumers_callback([&](VisionStreamType type, int consumers) { callbacks++; });
+  server.start_listener();
+  REQUIRE(server.num_consumers(VISION_STREAM_YUV_BACK) == 0);
+
+  {
+    VisionIpcClient client1 = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+    VisionIpcClient client2 = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+    REQUIRE(client1.connect());
+    REQUIRE(client2.connect());
+    REQUIRE(wait_consumers(server, VISION_STREAM_YUV_BACK, 2));
+    REQUIRE(server.num_consumers(VISION_STREAM_RGB_BACK) == 0);
+
+    // a reconnect is still one client
+    REQUIRE(client1.connect());
+    REQUIRE(wait_consumers(server, VISION_STREAM_YUV_BACK, 2));
+  }
+
+  REQUIRE(wait_consumers(server, VISION_STREAM_YUV_BACK, 0));
+  REQUIRE(callbacks == 6);
+}
@@ -1,3 +1,5 @@
 # pylint: skip-file
 from common.kalman.simple_kalman_impl import KF1D as KF1D
+from common.kalman.simple_kalman_impl import KF1DBank as KF1DBank
 assert KF1D
+assert KF1DBank
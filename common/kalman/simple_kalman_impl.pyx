@@ -35,3 +35,35 @@ cdef class KF1D:
   def x(self, x):
     self.x0_0 = x[0][0]
     self.x1_0 = x[1][0]
+
+
+cdef extern from "selfdrive/common/filter_bank.h":
+  cdef cppclass cpp_KF1DBank "KF1DBank":
+    cpp_KF1DBank(const double*, const double*, const double*)
+    void update(size_t, double*, double*, const double*, const int*)
+
+
+cdef class KF1DBank:
+  """KF1D of n objects, the states are arrays updated in place, see selfdrive/common/filter_bank.h"""
+  cdef cpp_KF1DBank *kf
+
+  def __init__(self, A, C, K):
+    cdef double a[4]
+    cdef double c[2]
+    cdef double k[2]
+    a[0], a[1], a[2], a[3] = A[0][0], A[0][1], A[1][0], A[1][1]
+    c[0], c[1] = C[0], C[1]
+    k[0], k[1] = K[0][0], K[1][0]
+    self.kf = new cpp_KF1DBank(a, c, k)
+
+  def __dealloc__(self):
+    del self.kf
+
+  def update(self, double[::1] x0, double[::1] x1, const double[::1] meas, const int[::1] active=None):
+    """x0, x1 and meas of the filters, active[i] != 0 for the ones to update, all of them without it"""
+    cdef size_t n = meas.shape[0]
+    if x0.shape[0] != n or x1.shape[0] != n or (active is not None and active.shape[0] != n):
+      raise ValueError("the arrays of the filters differ in size")
+    if n == 0:
+      return
+    self.kf.update(n, &x0[0], &x1[0], &meas[0], &active[0] if active is not None else NULL)
@@ -3,7 +3,7 @@ import random
 import timeit
 import numpy as np
 
-from common.kalman.simple_kalman import KF1D
+from common.kalman.simple_kalman import KF1D, KF1DBank
 from common.kalman.simple_kalman_old import KF1D as KF1D_old
 
 
@@ -50,6 +50,26 @@ class TestSimpleKalman(unittest.TestCase):
       np.testing.assert_almost_equal(x_old[0], x[0])
       np.testing.assert_almost_equal(x_old[1], x[1])
 
+  def test_bank_equal_kf(self):
+    A = [[1.0, 0.01], [0.0, 1.0]]
+    C = [1.0, 0.0]
+    K = [[0.12287673], [0.29666309]]
+    n = 8
+    kfs = [KF1D(x0=[[float(i)], [0.0]], A=A, C=C, K=K) for i in range(n)]
+    bank = KF1DBank(A, C, K)
+    x0 = np.arange(n, dtype=np.float64)
+    x1 = np.zeros(n)
+    active = np.array([i % 3 != 0 for i in range(n)], dtype=np.int32)
+
+    for _ in range(100):
+      meas = np.random.uniform(0, 200, n)
+      bank.update(x0, x1, meas, active)
+      for i, kf in enumerate(kfs):
+        if active[i]:
+          kf.update(meas[i])
+        np.testing.assert_almost_equal(x0[i], kf.x[0][0])
+        np.testing.assert_almost_equal(x1[i], kf.x[1][0])
+
   def test_new_is_faster(self):
     setup = """
 import numpy as np
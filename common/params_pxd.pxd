@@ -1,9 +1,13 @@
+from libcpp.map cimport map
 from libcpp.string cimport string
 from libcpp cimport bool
 
 cdef extern from "selfdrive/common/params.cc":
   pass
 
+cdef extern from "selfdrive/common/params_shm.cc":
+  pass
+
 cdef extern from "selfdrive/common/util.cc":
   pass
 
@@ -14,6 +18,8 @@ cdef extern from "selfdrive/common/params.h":
     CLEAR_ON_PANDA_DISCONNECT
     CLEAR_ON_IGNITION_ON
     CLEAR_ON_IGNITION_OFF
+    VOLATILE
+    LAZY
     ALL
 
   cdef cppclass Params:
@@ -24,5 +30,6 @@ cdef extern from "selfdrive/common/params.h":
     int remove(string) nogil
     int put(string, string) nogil
     int putBool(string, bool) nogil
+    int putBatch(map[string, string]) nogil
     bool checkKey(string) nogil
     void clearAll(ParamKeyType)
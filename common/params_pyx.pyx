@@ -1,6 +1,7 @@
 # distutils: language = c++
 # cython: language_level = 3
 from libcpp cimport bool
+from libcpp.map cimport map
 from libcpp.string cimport string
 from common.params_pxd cimport Params as c_Params, ParamKeyType as c_ParamKeyType
 
@@ -15,6 +16,8 @@ cdef class ParamKeyType:
   CLEAR_ON_PANDA_DISCONNECT = c_ParamKeyType.CLEAR_ON_PANDA_DISCONNECT
   CLEAR_ON_IGNITION_ON = c_ParamKeyType.CLEAR_ON_IGNITION_ON
   CLEAR_ON_IGNITION_OFF = c_ParamKeyType.CLEAR_ON_IGNITION_OFF
+  VOLATILE = c_ParamKeyType.VOLATILE
+  LAZY = c_ParamKeyType.LAZY
   ALL = c_ParamKeyType.ALL
 
 def ensure_bytes(v):
@@ -86,7 +89,7 @@ cdef class Params:
 
   def put(self, key, dat):
     """
-    Warning: This function blocks until the param is written to disk!
+    Warning: For the PERSISTENT keys that aren't LAZY, this function blocks until the param is written to disk!
     In very rare cases this can take over a second, and your code will hang.
     Use the put_nonblocking helper function in time sensitive code, but
     in general try to avoid writing params as much as possible.
@@ -101,6 +104,16 @@ cdef class Params:
     with nogil:
       self.p.putBool(k, val)
 
+  def put_batch(self, values):
+    """
+    Puts a dict of params, the ones that are written to disk share one fsync of the directory
+    """
+    cdef map[string, string] vals
+    for key, dat in values.items():
+      vals[self.check_key(key)] = ensure_bytes(dat)
+    with nogil:
+      self.p.putBatch(vals)
+
   def delete(self, key):
     cdef string k = self.check_key(key)
     with nogil:
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <vector>
 #include <eigen3/Eigen/Dense>
 
 #include "coordinates.hpp"
@@ -14,12 +15,6 @@ double esq = 6.69437999014 * 0.001; // lgtm [cpp/short-global-name]
 double e1sq = 6.73949674228 * 0.001;
 
 
-static Geodetic to_degrees(Geodetic geodetic){
-  geodetic.lat = RAD2DEG(geodetic.lat);
-  geodetic.lon = RAD2DEG(geodetic.lon);
-  return geodetic;
-}
-
 static Geodetic to_radians(Geodetic geodetic){
   geodetic.lat = DEG2RAD(geodetic.lat);
   geodetic.lon = DEG2RAD(geodetic.lon);
@@ -28,39 +23,62 @@ static Geodetic to_radians(Geodetic geodetic){
 
 
 ECEF geodetic2ecef(Geodetic g){
-  g = to_radians(g);
-  double xi = sqrt(1.0 - esq * pow(sin(g.lat), 2));
-  double x = (a / xi + g.alt) * cos(g.lat) * cos(g.lon);
-  double y = (a / xi + g.alt) * cos(g.lat) * sin(g.lon);
-  double z = (a / xi * (1.0 - esq) + g.alt) * sin(g.lat);
-  return {x, y, z};
+  double geodetic[3] = {g.lat, g.lon, g.alt}, ecef[3];
+  geodetic2ecef(geodetic, ecef, 1);
+  return {ecef[0], ecef[1], ecef[2]};
 }
 
 Geodetic ecef2geodetic(ECEF e){
+  double ecef[3] = {e.x, e.y, e.z}, geodetic[3];
+  ecef2geodetic(ecef, geodetic, 1);
+  return {geodetic[0], geodetic[1], geodetic[2]};
+}
+
+// The batch versions have no branches and only local constants in their loops, so the compiler
+// can vectorize them with its vector math library
+void geodetic2ecef(const double *geodetic, double *ecef, size_t n){
+  const double a_ = a, esq_ = esq;
+  for (size_t i = 0; i < n; i++) {
+    double lat = DEG2RAD(geodetic[3*i]);
+    double lon = DEG2RAD(geodetic[3*i + 1]);
+    double alt = geodetic[3*i + 2];
+
+    double sin_lat = sin(lat);
+    double cos_lat = cos(lat);
+    double xi = sqrt(1.0 - esq_ * sin_lat * sin_lat);
+    ecef[3*i] = (a_ / xi + alt) * cos_lat * cos(lon);
+    ecef[3*i + 1] = (a_ / xi + alt) * cos_lat * sin(lon);
+    ecef[3*i + 2] = (a_ / xi * (1.0 - esq_) + alt) * sin_lat;
+  }
+}
+
+void ecef2geodetic(const double *ecef, double *geodetic, size_t n){
   // Convert from ECEF to geodetic using Ferrari's methods
   // https://en.wikipedia.org/wiki/Geographic_coordinate_conversion#Ferrari.27s_solution
-  double x = e.x;
-  double y = e.y;
-  double z = e.z;
-
-  double r = sqrt(x * x + y * y);
-  double Esq = a * a - b * b;
-  double F = 54 * b * b * z * z;
-  double G = r * r + (1 - esq) * z * z - esq * Esq;
-  double C = (esq * esq * F * r * r) / (pow(G, 3));
-  double S = cbrt(1 + C + sqrt(C * C + 2 * C));
-  double P = F / (3 * pow((S + 1 / S + 1), 2) * G * G);
-  double Q = sqrt(1 + 2 * esq * esq * P);
-  double r_0 = -(P * esq * r) / (1 + Q) + sqrt(0.5 * a * a*(1 + 1.0 / Q) - P * (1 - esq) * z * z / (Q * (1 + Q)) - 0.5 * P * r * r);
-  double U = sqrt(pow((r - esq * r_0), 2) + z * z);
-  double V = sqrt(pow((r - esq * r_0), 2) + (1 - esq) * z * z);
-  double Z_0 = b * b * z / (a * V);
-  double h = U * (1 - b * b / (a * V));
-
-  double lat = atan((z + e1sq * Z_0) / r);
-  double lon = atan2(y, x);
-
-  return to_degrees({lat, lon, h});
+  const double a_ = a, b_ = b, esq_ = esq, e1sq_ = e1sq;
+  const double Esq = a_ * a_ - b_ * b_;
+  for (size_t i = 0; i < n; i++) {
+    double x = ecef[3*i];
+    double y = ecef[3*i + 1];
+    double z = ecef[3*i + 2];
+
+    double r = sqrt(x * x + y * y);
+    double F = 54 * b_ * b_ * z * z;
+    double G = r * r + (1 - esq_) * z * z - esq_ * Esq;
+    double C = (esq_ * esq_ * F * r * r) / (G * G * G);
+    double S = cbrt(1 + C + sqrt(C * C + 2 * C));
+    double P = F / (3 * (S + 1 / S + 1) * (S + 1 / S + 1) * G * G);
+    double Q = sqrt(1 + 2 * esq_ * esq_ * P);
+    double r_0 = -(P * esq_ * r) / (1 + Q) + sqrt(0.5 * a_ * a_*(1 + 1.0 / Q) - P * (1 - esq_) * z * z / (Q * (1 + Q)) - 0.5 * P * r * r);
+    double U = sqrt((r - esq_ * r_0) * (r - esq_ * r_0) + z * z);
+    double V = sqrt((r - esq_ * r_0) * (r - esq_ * r_0) + (1 - esq_) * z * z);
+    double Z_0 = b_ * b_ * z / (a_ * V);
+    double h = U * (1 - b_ * b_ / (a_ * V));
+
+    geodetic[3*i] = RAD2DEG(atan((z + e1sq_ * Z_0) / r));
+    geodetic[3*i + 1] = RAD2DEG(atan2(y, x));
+    geodetic[3*i + 2] = h;
+  }
 }
 
 LocalCoord::LocalCoord(Geodetic g, ECEF e){
@@ -100,3 +118,27 @@ Geodetic LocalCoord::ned2geodetic(NED n){
   ECEF e = ned2ecef(n);
   return ::ecef2geodetic(e);
 }
+
+typedef Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor> Points;
+
+void LocalCoord::ecef2ned(const double *ecef, double *ned, size_t n) {
+  Eigen::Map<Points>(ned, n, 3).noalias() = (Eigen::Map<const Points>(ecef, n, 3).rowwise() - init_ecef.transpose()) * ecef2ned_matrix.transpose();
+}
+
+void LocalCoord::ned2ecef(const double *ned, double *ecef, size_t n) {
+  Eigen::Map<Points> out(ecef, n, 3);
+  out.noalias() = Eigen::Map<const Points>(ned, n, 3) * ned2ecef_matrix.transpose();
+  out.rowwise() += init_ecef.transpose();
+}
+
+void LocalCoord::geodetic2ned(const double *geodetic, double *ned, size_t n) {
+  std::vector<double> ecef(3 * n);
+  ::geodetic2ecef(geodetic, ecef.data(), n);
+  ecef2ned(ecef.data(), ned, n);
+}
+
+void LocalCoord::ned2geodetic(const double *ned, double *geodetic, size_t n) {
+  std::vector<double> ecef(3 * n);
+  ned2ecef(ned, ecef.data(), n);
+  ::ecef2geodetic(ecef.data(), geodetic, n);
+}
@@ -25,6 +25,10 @@ struct Geodetic {
 ECEF geodetic2ecef(Geodetic g);
 Geodetic ecef2geodetic(ECEF e);
 
+// n points at once, contiguous x, y, z and lat, lon (degrees), alt
+void geodetic2ecef(const double *geodetic, double *ecef, size_t n);
+void ecef2geodetic(const double *ecef, double *geodetic, size_t n);
+
 class LocalCoord {
 public:
   Eigen::Matrix3d ned2ecef_matrix;
@@ -38,4 +42,9 @@ public:
   ECEF ned2ecef(NED n);
   NED geodetic2ned(Geodetic g);
   Geodetic ned2geodetic(NED n);
+
+  void ecef2ned(const double *ecef, double *ned, size_t n);
+  void ned2ecef(const double *ned, double *ecef, size_t n);
+  void geodetic2ned(const double *geodetic, double *ned, size_t n);
+  void ned2geodetic(const double *ned, double *geodetic, size_t n);
 };
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <vector>
 #include <eigen3/Eigen/Dense>
 
 #include "orientation.hpp"
@@ -62,6 +63,72 @@ Eigen::Matrix3d rot(Eigen::Vector3d axis, double angle){
   return q.toRotationMatrix();
 }
 
+// The batch versions write out the products of euler2quat and quat2rot, without branches, so the
+// compiler can vectorize their loops
+void euler2quat(const double *euler, double *quat, size_t n){
+  for (size_t i = 0; i < n; i++) {
+    double cr = cos(euler[3*i] / 2), sr = sin(euler[3*i] / 2);
+    double cp = cos(euler[3*i + 1] / 2), sp = sin(euler[3*i + 1] / 2);
+    double cy = cos(euler[3*i + 2] / 2), sy = sin(euler[3*i + 2] / 2);
+
+    double w = cr * cp * cy + sr * sp * sy;
+    // ensure_unique
+    double sign = w > 0 ? 1.0 : -1.0;
+    quat[4*i] = sign * w;
+    quat[4*i + 1] = sign * (sr * cp * cy - cr * sp * sy);
+    quat[4*i + 2] = sign * (cr * sp * cy + sr * cp * sy);
+    quat[4*i + 3] = sign * (cr * cp * sy - sr * sp * cy);
+  }
+}
+
+void quat2euler(const double *quat, double *euler, size_t n){
+  for (size_t i = 0; i < n; i++) {
+    double w = quat[4*i], x = quat[4*i + 1], y = quat[4*i + 2], z = quat[4*i + 3];
+    euler[3*i] = atan2(2 * (w * x + y * z), 1 - 2 * (x * x + y * y));
+    euler[3*i + 1] = asin(std::clamp(2 * (w * y - z * x), -1.0, 1.0));
+    euler[3*i + 2] = atan2(2 * (w * z + x * y), 1 - 2 * (y * y + z * z));
+  }
+}
+
+void quat2rot(const double *quat, double *rot, size_t n){
+  for (size_t i = 0; i < n; i++) {
+    double w = quat[4*i], x = quat[4*i + 1], y = quat[4*i + 2], z = quat[4*i + 3];
+    double *r = &rot[9*i];
+    r[0] = 1 - 2 * (y * y + z * z);
+    r[1] = 2 * (x * y - w * z);
+    r[2] = 2 * (x * z + w * y);
+    r[3] = 2 * (x * y + w * z);
+    r[4] = 1 - 2 * (x * x + z * z);
+    r[5] = 2 * (y * z - w * x);
+    r[6] = 2 * (x * z - w * y);
+    r[7] = 2 * (y * z + w * x);
+    r[8] = 1 - 2 * (x * x + y * y);
+  }
+}
+
+void rot2quat(const double *rot, double *quat, size_t n){
+  // the conversion of Eigen picks the largest of w, x, y, z first, it branches either way
+  for (size_t i = 0; i < n; i++) {
+    Eigen::Quaterniond q = rot2quat(Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(&rot[9*i]));
+    quat[4*i] = q.w();
+    quat[4*i + 1] = q.x();
+    quat[4*i + 2] = q.y();
+    quat[4*i + 3] = q.z();
+  }
+}
+
+void euler2rot(const double *euler, double *rot, size_t n){
+  std::vector<double> quat(4 * n);
+  euler2quat(euler, quat.data(), n);
+  quat2rot(quat.data(), rot, n);
+}
+
+void rot2euler(const double *rot, double *euler, size_t n){
+  std::vector<double> quat(4 * n);
+  rot2quat(rot, quat.data(), n);
+  quat2euler(quat.data(), euler, n);
+}
+
 
 Eigen::Vector3d ecef_euler_from_ned(ECEF ecef_init, Eigen::Vector3d ned_pose) {
   /*
@@ -15,3 +15,11 @@ Eigen::Matrix3d rot_matrix(double roll, double pitch, double yaw);
 Eigen::Matrix3d rot(Eigen::Vector3d axis, double angle);
 Eigen::Vector3d ecef_euler_from_ned(ECEF ecef_init, Eigen::Vector3d ned_pose);
 Eigen::Vector3d ned_euler_from_ecef(ECEF ecef_init, Eigen::Vector3d ecef_pose);
+
+// n orientations at once, contiguous roll, pitch, yaw, w, x, y, z quaternions and row major rotations
+void euler2quat(const double *euler, double *quat, size_t n);
+void quat2euler(const double *quat, double *euler, size_t n);
+void quat2rot(const double *quat, double *rot, size_t n);
+void rot2quat(const double *rot, double *quat, size_t n);
+void euler2rot(const double *euler, double *rot, size_t n);
+void rot2euler(const double *rot, double *euler, size_t n);
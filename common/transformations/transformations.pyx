@@ -15,6 +15,14 @@ from common.transformations.transformations cimport ned_euler_from_ecef as ned_e
 from common.transformations.transformations cimport geodetic2ecef as geodetic2ecef_c
 from common.transformations.transformations cimport ecef2geodetic as ecef2geodetic_c
 from common.transformations.transformations cimport LocalCoord_c
+from common.transformations.transformations cimport euler2quat_batch as euler2quat_batch_c
+from common.transformations.transformations cimport quat2euler_batch as quat2euler_batch_c
+from common.transformations.transformations cimport quat2rot_batch as quat2rot_batch_c
+from common.transformations.transformations cimport rot2quat_batch as rot2quat_batch_c
+from common.transformations.transformations cimport euler2rot_batch as euler2rot_batch_c
+from common.transformations.transformations cimport rot2euler_batch as rot2euler_batch_c
+from common.transformations.transformations cimport geodetic2ecef_batch as geodetic2ecef_batch_c
+from common.transformations.transformations cimport ecef2geodetic_batch as ecef2geodetic_batch_c
 
 
 import cython
@@ -54,6 +62,15 @@ cdef Geodetic list2geodetic(geodetic):
     g.alt = geodetic[2]
     return g
 
+ctypedef void (*batch_t)(const double*, double*, size_t)
+
+cdef np.ndarray batch(batch_t f, inp, input_shape, output_shape):
+    cdef np.ndarray i = np.ascontiguousarray(inp, dtype=np.double).reshape((-1,) + input_shape)
+    cdef size_t n = i.shape[0]
+    cdef np.ndarray o = np.empty((n,) + output_shape, dtype=np.double)
+    f(<double*>i.data, <double*>o.data, n)
+    return o
+
 def euler2quat_single(euler):
     cdef Vector3 e = Vector3(euler[0], euler[1], euler[2])
     cdef Quaternion q = euler2quat_c(e)
@@ -84,6 +101,24 @@ def rot2euler_single(rot):
     cdef Vector3 e = rot2euler_c(r)
     return [e(0), e(1), e(2)]
 
+def euler2quat_batch(euler):
+    return batch(euler2quat_batch_c, euler, (3,), (4,))
+
+def quat2euler_batch(quat):
+    return batch(quat2euler_batch_c, quat, (4,), (3,))
+
+def quat2rot_batch(quat):
+    return batch(quat2rot_batch_c, quat, (4,), (3, 3))
+
+def rot2quat_batch(rot):
+    return batch(rot2quat_batch_c, rot, (3, 3), (4,))
+
+def euler2rot_batch(euler):
+    return batch(euler2rot_batch_c, euler, (3,), (3, 3))
+
+def rot2euler_batch(rot):
+    return batch(rot2euler_batch_c, rot, (3, 3), (3,))
+
 def rot_matrix(roll, pitch, yaw):
     return matrix2numpy(rot_matrix_c(roll, pitch, yaw))
 
@@ -111,6 +146,12 @@ def ecef2geodetic_single(ecef):
     cdef Geodetic g = ecef2geodetic_c(e)
     return [g.lat, g.lon, g.alt]
 
+def geodetic2ecef_batch(geodetic):
+    return batch(geodetic2ecef_batch_c, geodetic, (3,), (3,))
+
+def ecef2geodetic_batch(ecef):
+    return batch(ecef2geodetic_batch_c, ecef, (3,), (3,))
+
 
 cdef class LocalCoord:
     cdef LocalCoord_c * lc
@@ -170,5 +211,33 @@ cdef class LocalCoord:
         cdef Geodetic g = self.lc.ned2geodetic(n)
         return [g.lat, g.lon, g.alt]
 
+    def ecef2ned_batch(self, ecef):
+        assert self.lc
+        cdef np.ndarray e = np.ascontiguousarray(ecef, dtype=np.double).reshape(-1, 3)
+        cdef np.ndarray n = np.empty_like(e)
+        self.lc.ecef2ned_batch(<double*>e.data, <double*>n.data, e.shape[0])
+        return n
+
+    def ned2ecef_batch(self, ned):
+        assert self.lc
+        cdef np.ndarray n = np.ascontiguousarray(ned, dtype=np.double).reshape(-1, 3)
+        cdef np.ndarray e = np.empty_like(n)
+        self.lc.ned2ecef_batch(<double*>n.data, <double*>e.data, n.shape[0])
+        return e
+
+    def geodetic2ned_batch(self, geodetic):
+        assert self.lc
+        cdef np.ndarray g = np.ascontiguousarray(geodetic, dtype=np.double).reshape(-1, 3)
+        cdef np.ndarray n = np.empty_like(g)
+        self.lc.geodetic2ned_batch(<double*>g.data, <double*>n.data, g.shape[0])
+        return n
+
+    def ned2geodetic_batch(self, ned):
+        assert self.lc
+        cdef np.ndarray n = np.ascontiguousarray(ned, dtype=np.double).reshape(-1, 3)
+        cdef np.ndarray g = np.empty_like(n)
+        self.lc.ned2geodetic_batch(<double*>n.data, <double*>g.data, n.shape[0])
+        return g
+
     def __dealloc__(self):
         del self.lc
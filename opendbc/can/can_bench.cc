@@ -0,0 +1,200 @@
+#include <bzlib.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Replays the can events of an rlog through a CANParser of every DBC (or the ones given), then
+// packs each DBC's messages from the parsed values. Reports ns per frame, heap allocations, and
+// cache misses when perf counters are available.
+// usage: can_bench <rlog or rlog.bz2> [bus] [dbc...]
+
+static size_t num_allocs = 0;
+static volatile uint64_t packed_sink;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+
+extern "C" void *malloc(size_t size) {
+  num_allocs++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  num_allocs++;
+  return __libc_calloc(n, size);
+}
+
+// hardware cache misses of this thread, -1 if perf isn't available
+class CacheMisses {
+public:
+  CacheMisses() {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~CacheMisses() { if (fd >= 0) close(fd); }
+  void start() {
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  int64_t stop() {
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    int64_t count = 0;
+    return read(fd, &count, sizeof(count)) == sizeof(count) ? count : -1;
+  }
+
+private:
+  int fd = -1;
+};
+
+static std::string read_log(const char *fn) {
+  std::ifstream f(fn, std::ios::binary);
+  std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  if (raw.size() < 3 || raw.compare(0, 3, "BZh") != 0) return raw;
+
+  std::string out;
+  bz_stream strm = {};
+  BZ2_bzDecompressInit(&strm, 0, 0);
+  strm.next_in = raw.data();
+  strm.avail_in = raw.size();
+  int ret = BZ_OK;
+  char buf[1 << 16];
+  while (ret == BZ_OK) {
+    strm.next_out = buf;
+    strm.avail_out = sizeof(buf);
+    ret = BZ2_bzDecompress(&strm);
+    out.append(buf, sizeof(buf) - strm.avail_out);
+    // concatenated streams, rlogs are written in parallel blocks
+    if (ret == BZ_STREAM_END && strm.avail_in > 0) {
+      BZ2_bzDecompressEnd(&strm);
+      char *next = strm.next_in;
+      unsigned int avail = strm.avail_in;
+      strm = {};
+      BZ2_bzDecompressInit(&strm, 0, 0);
+      strm.next_in = next;
+      strm.avail_in = avail;
+      ret = BZ_OK;
+    }
+  }
+  BZ2_bzDecompressEnd(&strm);
+  if (ret != BZ_STREAM_END) fprintf(stderr, "%s: bz2 error %d, using what decompressed\n", fn, ret);
+  return out;
+}
+
+static void print_misses(int64_t misses, double n) {
+  if (misses >= 0) {
+    printf(" %9.2f", misses / n);
+  } else {
+    printf(" %9s", "n/a");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <rlog or rlog.bz2> [bus] [dbc...]\n", argv[0]);
+    return 1;
+  }
+  const int bus = argc > 2 ? atoi(argv[2]) : 0;
+  std::vector<std::string> dbc_names;
+  for (int i = 3; i < argc; i++) dbc_names.push_back(argv[i]);
+  if (dbc_names.empty()) dbc_names = get_dbc_names();
+
+  std::string log = read_log(argv[1]);
+  std::vector<capnp::word> words(log.size() / sizeof(capnp::word));
+  memcpy(words.data(), log.data(), words.size() * sizeof(capnp::word));
+
+  std::vector<std::string> events;
+  size_t frames = 0;
+  kj::ArrayPtr<const capnp::word> remaining(words.data(), words.size());
+  while (remaining.size() > 0) {
+    capnp::FlatArrayMessageReader msg(remaining);
+    auto event = msg.getRoot<cereal::Event>();
+    if (event.isCan()) {
+      events.emplace_back((const char *)remaining.begin(), (const char *)msg.getEnd());
+      frames += event.getCan().size();
+    }
+    remaining = kj::arrayPtr(msg.getEnd(), remaining.end());
+  }
+  if (events.empty()) {
+    fprintf(stderr, "no can events in %s\n", argv[1]);
+    return 1;
+  }
+  printf("%zu can events, %zu frames\n", events.size(), frames);
+  printf("%-40s %9s %9s %9s | %9s %9s %9s\n", "dbc", "ns/frame", "alloc/ev", "miss/fr", "ns/pack", "alloc/pk", "miss/pk");
+
+  CacheMisses perf;
+  for (const auto &name : dbc_names) {
+    const DBC *dbc = dbc_lookup(name);
+    if (!dbc) {
+      fprintf(stderr, "no DBC %s\n", name.c_str());
+      continue;
+    }
+
+    CANParser parser(bus, name, true, true);
+    parser.update_string(events[0], false);  // first touch of the arena out of the timing
+
+    size_t allocs_start = num_allocs;
+    perf.start();
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &e : events) {
+      parser.update_string(e, false);
+    }
+    auto end = std::chrono::steady_clock::now();
+    int64_t misses = perf.stop();
+    size_t allocs = num_allocs - allocs_start;
+    printf("%-40s %9.1f %9.2f", name.c_str(), std::chrono::duration<double, std::nano>(end - start).count() / frames,
+           (double)allocs / events.size());
+    print_misses(misses, frames);
+
+    // pack every message from the values the replay left, with the handle API
+    CANPacker packer(name);
+    struct Packed { int msg; std::vector<int> handles; std::vector<double> values; };
+    std::vector<Packed> packs;
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &msg = dbc->msgs[i];
+      Packed &p = packs.emplace_back((Packed){.msg = packer.message_handle(msg.address)});
+      for (int j = 0; j < msg.num_sigs; j++) {
+        int slot = parser.signal_slot(msg.address, msg.sigs[j].name);
+        p.handles.push_back(packer.signal_handle(msg.address, msg.sigs[j].name));
+        p.values.push_back(slot >= 0 ? parser.values()[slot] : 0);
+      }
+    }
+
+    const int rounds = 100;
+    uint64_t sink = 0;
+    allocs_start = num_allocs;
+    perf.start();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      for (const auto &p : packs) sink += packer.pack(p.msg, p.handles.data(), p.values.data(), p.values.size(), -1);
+    }
+    end = std::chrono::steady_clock::now();
+    misses = perf.stop();
+    allocs = num_allocs - allocs_start;
+    const double n = (double)packs.size() * rounds;
+    printf(" | %9.1f %9.2f", std::chrono::duration<double, std::nano>(end - start).count() / n, allocs / n);
+    print_misses(misses, n);
+    printf("\n");
+    packed_sink = sink;
+  }
+  return 0;
+}
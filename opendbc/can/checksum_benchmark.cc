@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "common.h"
+
+// Checks every checksum of every message of all DBCs against the plain per bit and
+// per byte implementations on random data, then times both
+// usage: checksum_benchmark [samples per message]
+
+static unsigned int ref_nibble_sum(uint64_t v) {
+  unsigned int s = 0;
+  while (v) { s += v & 0xF; v >>= 4; }
+  return s;
+}
+
+static unsigned int ref_byte_sum(uint64_t v) {
+  unsigned int s = 0;
+  while (v) { s += v & 0xFF; v >>= 8; }
+  return s;
+}
+
+static uint8_t ref_crc8(uint8_t poly, uint8_t crc, uint64_t d, int n) {
+  for (int i = 0; i < n; i++) {
+    crc ^= (d >> (i*8)) & 0xFF;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ poly) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static unsigned int ref_checksum(SignalType type, uint32_t address, uint64_t dat_le, uint64_t dat_be, int l) {
+  uint64_t d = dat_be >> ((8-l)*8);
+  switch (type) {
+    case HONDA_CHECKSUM: {
+      int s = 8 - (int)(ref_nibble_sum(address) + ref_nibble_sum(d >> 4));
+      if (address > 0x7FF) s += 3;
+      return s & 0xF;
+    }
+    case TOYOTA_CHECKSUM:
+      return (l + ref_byte_sum(address) + ref_byte_sum(d >> 8)) & 0xFF;
+    case SUBARU_CHECKSUM:
+      return (ref_byte_sum(address) + ref_byte_sum(d & ((1ULL << ((l-1)*8)) - 1))) & 0xFF;
+    case CHRYSLER_CHECKSUM:
+      return ~ref_crc8(0x1D, 0xFF, dat_le, l - 1) & 0xFF;
+    case PEDAL_CHECKSUM:
+      return ref_crc8(0xD5, 0xFF, d >> 8, l - 1);
+    case VOLKSWAGEN_CHECKSUM: {
+      // the final padding byte is per address, every message is checked with the one of ESP_21
+      static const uint8_t esp_21_pad[16] = {0xB4,0xEF,0xF8,0x49,0x1E,0xE5,0xC2,0xC0,0x97,0x19,0x3C,0xC9,0xF1,0x98,0xD6,0x61};
+      uint8_t crc = ref_crc8(0x2F, 0xFF, dat_le >> 8, l - 1) ^ esp_21_pad[(dat_le >> 8) & 0xF];
+      return ref_crc8(0x2F, crc, 0, 1) ^ 0xFF;
+    }
+    default:
+      return 0;
+  }
+}
+
+// volkswagen_crc is only defined for the addresses it has a padding byte for
+static const uint32_t VW_CHECK_ADDRESS = 0xFD;
+
+static unsigned int checksum(SignalType type, uint32_t address, uint64_t dat_le, uint64_t dat_be, int l) {
+  switch (type) {
+    case HONDA_CHECKSUM: return honda_checksum(address, dat_be, l);
+    case TOYOTA_CHECKSUM: return toyota_checksum(address, dat_be, l);
+    case SUBARU_CHECKSUM: return subaru_checksum(address, dat_be, l);
+    case CHRYSLER_CHECKSUM: return chrysler_checksum(address, dat_le, l);
+    case PEDAL_CHECKSUM: return pedal_checksum(dat_be, l);
+    case VOLKSWAGEN_CHECKSUM: return volkswagen_crc(VW_CHECK_ADDRESS, dat_le, l);
+    default: return 0;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const int samples = argc > 1 ? atoi(argv[1]) : 10000;
+  init_crc_lookup_tables();
+
+  struct Case { const char *dbc, *msg; SignalType type; uint32_t address; int size; };
+  std::vector<Case> cases;
+  for (const auto &name : get_dbc_names()) {
+    const DBC *dbc = dbc_lookup(name);
+    if (!dbc) continue;
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &msg = dbc->msgs[i];
+      for (int j = 0; j < msg.num_sigs; j++) {
+        SignalType t = msg.sigs[j].type;
+        if (t == HONDA_CHECKSUM || t == TOYOTA_CHECKSUM || t == SUBARU_CHECKSUM || t == CHRYSLER_CHECKSUM ||
+            t == PEDAL_CHECKSUM || t == VOLKSWAGEN_CHECKSUM) {
+          cases.push_back({dbc->name, msg.name, t, msg.address, (int)msg.size});
+        }
+      }
+    }
+  }
+
+  std::mt19937_64 rng(0);
+  std::vector<uint8_t> dats(samples * 8);
+  for (auto &b : dats) b = rng();
+
+  int failures = 0;
+  double ref_s = 0, fast_s = 0;
+  unsigned int sink = 0;
+  for (const auto &c : cases) {
+    for (int i = 0; i < samples; i++) {
+      uint64_t dat_le = read_u64_le(&dats[i*8]), dat_be = read_u64_be(&dats[i*8]);
+      if (checksum(c.type, c.address, dat_le, dat_be, c.size) != ref_checksum(c.type, c.address, dat_le, dat_be, c.size)) {
+        printf("%s %s 0x%X: mismatch\n", c.dbc, c.msg, c.address);
+        failures++;
+        break;
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++) {
+      sink += ref_checksum(c.type, c.address, read_u64_le(&dats[i*8]), read_u64_be(&dats[i*8]), c.size);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++) {
+      sink += checksum(c.type, c.address, read_u64_le(&dats[i*8]), read_u64_be(&dats[i*8]), c.size);
+    }
+    auto end = std::chrono::steady_clock::now();
+    ref_s += std::chrono::duration<double>(mid - start).count();
+    fast_s += std::chrono::duration<double>(end - mid).count();
+  }
+
+  printf("%zu checksummed messages, %d failed (sink %u)\n", cases.size(), failures, sink);
+  printf("reference %.1fns per frame, table driven %.1fns per frame\n",
+         ref_s / (cases.size() * (double)samples) * 1e9, fast_s / (cases.size() * (double)samples) * 1e9);
+  return failures ? 1 : 0;
+}
@@ -1,13 +1,42 @@
 #include "common.h"
 
+// sums of the bytes and nibbles of a word, a few adds and a multiply instead of a loop
+static inline unsigned int sum_bytes(uint64_t d) {
+  d = (d & 0x00FF00FF00FF00FFULL) + ((d >> 8) & 0x00FF00FF00FF00FFULL);
+  return (d * 0x0001000100010001ULL) >> 48;
+}
+
+static inline unsigned int sum_nibbles(uint64_t d) {
+  return sum_bytes((d & 0x0F0F0F0F0F0F0F0FULL) + ((d >> 4) & 0x0F0F0F0F0F0F0F0FULL));
+}
+
+// Slice-by-8 tables of a CRC8: lut[k][b] is the CRC of byte b followed by k zero bytes.
+// The CRC is linear, so the bytes of a frame are looked up independently and XORed
+struct Crc8Tables {
+  uint8_t lut[8][256];
+};
+
+static Crc8Tables crc8_8h2f;  // poly 0x2F, aka 8H2F/AUTOSAR for Volkswagen
+static Crc8Tables crc8_1d;    // poly 0x1D, SAE J1850 for Chrysler
+static Crc8Tables crc8_d5;    // poly 0xD5 for the comma pedal
+
+// crc of the n low bytes of d, least significant first
+static inline uint8_t crc8_slice8(const Crc8Tables &t, uint8_t crc, uint64_t d, int n) {
+  if (n <= 0) return crc;
+
+  uint8_t r = t.lut[n - 1][(crc ^ d) & 0xFF];
+  for (int i = 1; i < n; i++) {
+    r ^= t.lut[n - 1 - i][(d >> (i*8)) & 0xFF];
+  }
+  return r;
+}
+
 unsigned int honda_checksum(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
   d >>= 4; // remove checksum
 
-  int s = 0;
   bool extended = address > 0x7FF; // extended can
-  while (address) { s += (address & 0xF); address >>= 4; }
-  while (d) { s += (d & 0xF); d >>= 4; }
+  int s = sum_nibbles(address) + sum_nibbles(d);
   s = 8-s;
   if (extended) s += 3;
   s &= 0xF;
@@ -19,59 +48,27 @@ unsigned int toyota_checksum(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
   d >>= 8; // remove checksum
 
-  unsigned int s = l;
-  while (address) { s += address & 0xFF; address >>= 8; }
-  while (d) { s += d & 0xFF; d >>= 8; }
+  unsigned int s = l + sum_bytes(address) + sum_bytes(d);
 
   return s & 0xFF;
 }
 
 unsigned int subaru_checksum(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
+  d &= (1ULL << ((l-1)*8)) - 1; // checksum is first byte
 
-  unsigned int s = 0;
-  while (address) { s += address & 0xFF; address >>= 8; }
-  l -= 1; // checksum is first byte
-  while (l) { s += d & 0xFF; d >>= 8; l -= 1; }
+  unsigned int s = sum_bytes(address) + sum_bytes(d);
 
   return s & 0xFF;
 }
 
 unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l) {
   /* This function does not want the checksum byte in the input data.
-  jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf */
-  uint8_t checksum = 0xFF;
-  for (int j = 0; j < (l - 1); j++) {
-    uint8_t shift = 0x80;
-    uint8_t curr = (d >> 8*j) & 0xFF;
-    for (int i=0; i<8; i++) {
-      uint8_t bit_sum = curr & shift;
-      uint8_t temp_chk = checksum & 0x80U;
-      if (bit_sum != 0U) {
-        bit_sum = 0x1C;
-        if (temp_chk != 0U) {
-          bit_sum = 1;
-        }
-        checksum = checksum << 1;
-        temp_chk = checksum | 1U;
-        bit_sum ^= temp_chk;
-      } else {
-        if (temp_chk != 0U) {
-          bit_sum = 0x1D;
-        }
-        checksum = checksum << 1;
-        bit_sum ^= checksum;
-      }
-      checksum = bit_sum;
-      shift = shift >> 1;
-    }
-  }
-  return ~checksum & 0xFF;
+  jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf
+  it is a CRC8 of poly 0x1D with init 0xFF, inverted */
+  return ~crc8_slice8(crc8_1d, 0xFF, d, l - 1) & 0xFF;
 }
 
-// Static lookup table for fast computation of CRC8 poly 0x2F, aka 8H2F/AUTOSAR
-uint8_t crc8_lut_8h2f[256];
-
 void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   uint8_t crc;
   int i, j;
@@ -88,10 +85,21 @@ void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   }
 }
 
+static void gen_crc_slice8_tables(uint8_t poly, Crc8Tables &t) {
+  gen_crc_lookup_table(poly, t.lut[0]);
+  for (int k = 1; k < 8; k++) {
+    for (int i = 0; i < 256; i++) {
+      t.lut[k][i] = t.lut[0][t.lut[k - 1][i]];
+    }
+  }
+}
+
 void init_crc_lookup_tables() {
   // At init time, set up static lookup tables for fast CRC computation.
 
-  gen_crc_lookup_table(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+  gen_crc_slice8_tables(0x2F, crc8_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+  gen_crc_slice8_tables(0x1D, crc8_1d);      // CRC-8 SAE J1850 for Chrysler
+  gen_crc_slice8_tables(0xD5, crc8_d5);      // standard CRC-8 for the pedal
 }
 
 unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
@@ -102,10 +110,7 @@ unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
   uint8_t crc = 0xFF; // Standard init value for CRC8 8H2F/AUTOSAR
 
   // CRC the payload first, skipping over the first byte where the CRC lives.
-  for (int i = 1; i < l; i++) {
-    crc ^= (d >> (i*8)) & 0xFF;
-    crc = crc8_lut_8h2f[crc];
-  }
+  crc = crc8_slice8(crc8_8h2f, crc, d >> 8, l - 1);
 
   // Look up and apply the magic final CRC padding byte, which permutes by CAN
   // address, and additionally (for SOME addresses) by the message counter.
@@ -167,32 +172,17 @@ unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
       crc ^= (uint8_t[]){0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}[counter];
       break;
   }
-  crc = crc8_lut_8h2f[crc];
+  crc = crc8_8h2f.lut[0][crc];
 
   return crc ^ 0xFF; // Return after standard final XOR for CRC8 8H2F/AUTOSAR
 }
 
 
 unsigned int pedal_checksum(uint64_t d, int l) {
-  uint8_t crc = 0xFF;
-  uint8_t poly = 0xD5; // standard crc8
-
   d >>= ((8-l)*8); // remove padding
   d >>= 8; // remove checksum
 
-  int i, j;
-  for (i = 0; i < l - 1; i++) {
-    crc ^= (d >> (i*8)) & 0xFF;
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0) {
-        crc = (uint8_t)((crc << 1) ^ poly);
-      }
-      else {
-        crc <<= 1;
-      }
-    }
-  }
-  return crc;
+  return crc8_slice8(crc8_d5, 0xFF, d, l - 1); // standard crc8
 }
 
 
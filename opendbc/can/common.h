@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -14,6 +15,13 @@
 
 #define MAX_BAD_COUNTER 5
 
+#ifndef DYNAMIC_CAPNP
+// the frames of a canPacked event, they are word aligned in the message
+inline kj::ArrayPtr<const CanFrame> can_packed_frames(capnp::Data::Reader data) {
+  return kj::arrayPtr(reinterpret_cast<const CanFrame *>(data.begin()), data.size() / sizeof(CanFrame));
+}
+#endif
+
 // Helper functions
 unsigned int honda_checksum(unsigned int address, uint64_t d, int l);
 unsigned int toyota_checksum(unsigned int address, uint64_t d, int l);
@@ -30,11 +38,18 @@ public:
   uint32_t address;
   unsigned int size;
 
-  std::vector<Signal> parse_sigs;
-  std::vector<double> vals;
+  // parsed signals and their values, slices of the parser's arena. with a generated decoder,
+  // sig_idx is the index of each signal in the message
+  size_t sig_start = 0, num_sigs = 0;
+  const Signal *parse_sigs = nullptr;
+  const int *sig_idx = nullptr;
+  double *vals = nullptr;
+  DecodeFn decode = nullptr;
 
   uint16_t ts;
   uint64_t seen;
+  // CLOCK_BOOTTIME ns the panda received the last parsed frame, or the update's time if it's unknown
+  uint64_t host_time = 0;
   uint64_t check_threshold;
 
   uint8_t counter;
@@ -42,18 +57,77 @@ public:
 
   bool ignore_checksum = false;
   bool ignore_counter = false;
+  // timed out or never received, only for messages with a check_threshold
+  bool stale = false;
 
-  bool parse(uint64_t sec, uint16_t ts_, uint8_t * dat);
+  bool parse(uint64_t sec, uint16_t ts_, const uint8_t * dat, uint64_t host_time_ = 0);
   bool update_counter_generic(int64_t v, int cnt_size);
 };
 
+// A field of a CarState that is a signal, signal * a + b or the signal compared with a (1 or 0).
+// Tables of them are resolved to slots once (FieldMap in parser_pyx.pyx) and filled every update
+enum FieldOp { FIELD_SCALE, FIELD_EQ, FIELD_NE };
+
+struct FieldMapping {
+  int slot;
+  FieldOp op;
+  double a, b;
+};
+
 class CANParser {
 private:
+  friend class CANParserGroup;
+
   const int bus;
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+
+  // states sorted by address. standard ids index direct_lookup (index + 1, 0 if not parsed),
+  // extended ids are binary searched in addresses
+  static constexpr uint32_t DIRECT_LOOKUP_SIZE = 0x800;
+  std::vector<MessageState> message_states;
+  std::vector<uint32_t> addresses;
+  std::vector<uint16_t> direct_lookup;
+
+  // signals, decoder indices and values of all messages, contiguous per message
+  std::vector<Signal> sig_arena;
+  std::vector<int> sig_idx_arena;
+  std::vector<double> val_arena;
+  // slot -> index of its message state, and a bit per slot set when its message was parsed
+  std::vector<uint16_t> slot_state;
+  std::vector<uint64_t> updated_mask;
+
+  // Timeouts. A min heap of (deadline, state index) with one entry per checked message that
+  // isn't stale. An entry whose message was seen since it was pushed is pushed again with the
+  // new deadline when it comes up, so UpdateValid only touches messages that are due
+  typedef std::pair<uint64_t, uint16_t> Deadline;
+  std::vector<Deadline> deadlines;
+  size_t num_stale = 0;
+  std::vector<uint32_t> newly_stale;
+
+  void push_deadline(uint16_t idx);
+
+  void add_sig(MessageState &state, const Msg *msg, int idx, double default_value);
+  void build_lookup();
+  void mark_updated(MessageState &state);
+  void begin_update(uint64_t sec);
+
+  inline void parse_frame(uint64_t sec, const CanFrame &frame) {
+    MessageState *state = lookup(frame.address);
+    if (state && frame.len <= 8 && state->parse(sec, frame.busTime, frame.dat, frame.host_time)) {
+      mark_updated(*state);
+    }
+  }
+
+  inline MessageState *lookup(uint32_t address) {
+    if (address < DIRECT_LOOKUP_SIZE) {
+      uint16_t i = direct_lookup[address];
+      return i ? &message_states[i - 1] : nullptr;
+    }
+    auto it = std::lower_bound(addresses.begin(), addresses.end(), address);
+    return (it != addresses.end() && *it == address) ? &message_states[it - addresses.begin()] : nullptr;
+  }
 
 public:
   bool can_valid = false;
@@ -63,23 +137,95 @@ public:
             const std::vector<MessageParseOptions> &options,
             const std::vector<SignalParseOptions> &sigoptions);
   CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter);
+  // states point into the arena
+  CANParser(const CANParser&) = delete;
+  CANParser &operator=(const CANParser&) = delete;
   #ifndef DYNAMIC_CAPNP
-  void update_string(const std::string &data, bool sendcan);
+  void update_string(const std::string &data, bool sendcan) { update_buffer(data.data(), data.size(), sendcan); }
+  // a serialized can or sendcan event
+  void update_buffer(const char *data, size_t len, bool sendcan);
   void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
   #endif
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
+  void UpdateCans(uint64_t sec, kj::ArrayPtr<const CanFrame> frames);
   void UpdateValid(uint64_t sec);
+  // update_string for raw frames, e.g. straight from the panda's USB buffer
+  void update_frames(uint64_t sec, kj::ArrayPtr<const CanFrame> frames);
   std::vector<SignalValue> query_latest();
+
+  // messages that are stale now, and the ones that went stale in the last UpdateValid
+  std::vector<uint32_t> stale_messages() const;
+  const std::vector<uint32_t> &went_stale() const { return newly_stale; }
+
+  // Columnar queries. Every parsed signal has a slot fixed at construction, values()[slot] is its
+  // latest value. Bit slot of updated() is set when update_string parsed its message, it starts out
+  // set for every slot like query_latest before the first update
+  int signal_slot(uint32_t address, const char *name) const;
+  size_t num_slots() const { return val_arena.size(); }
+  const double *values() const { return val_arena.data(); }
+  const uint64_t *updated() const { return updated_mask.data(); }
+  uint32_t slot_address(size_t slot) const { return message_states[slot_state[slot]].address; }
+  const char *slot_name(size_t slot) const { return sig_arena[slot].name; }
+  uint16_t slot_ts(size_t slot) const { return message_states[slot_state[slot]].ts; }
+  uint64_t slot_host_time(size_t slot) const { return message_states[slot_state[slot]].host_time; }
+  // out[i] is the value of fields[i]
+  void fill_fields(const FieldMapping *fields, size_t n, double *out) const;
+};
+
+// Parsers of several buses, e.g. pt, cam and radar, updated with one pass over the frames.
+// Every frame is handed only to the parsers of its bus
+class CANParserGroup {
+private:
+  std::vector<CANParser *> parsers;
+  kj::Array<capnp::word> aligned_buf;
+
+  void begin_update(uint64_t sec);
+  void end_update(uint64_t sec);
+  inline void dispatch(uint64_t sec, const CanFrame &frame) {
+    for (auto p : parsers) {
+      if (p->bus == frame.src) p->parse_frame(sec, frame);
+    }
+  }
+
+public:
+  CANParserGroup(const std::vector<CANParser *> &parsers);
+  #ifndef DYNAMIC_CAPNP
+  void update_string(const std::string &data, bool sendcan) { update_buffer(data.data(), data.size(), sendcan); }
+  void update_buffer(const char *data, size_t len, bool sendcan);
+  #endif
+  void update_frames(uint64_t sec, kj::ArrayPtr<const CanFrame> frames);
 };
 
 class CANPacker {
 private:
+  // counter and checksum of a message, found once so packing doesn't look them up by name
+  struct PackMessage {
+    uint32_t address;
+    unsigned int size;
+    const Signal *counter = nullptr;
+    const Signal *checksum = nullptr;
+  };
+
   const DBC *dbc = NULL;
   std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
   std::map<uint32_t, Msg> message_lookup;
+  std::vector<PackMessage> pack_messages;
+  std::unordered_map<uint32_t, int> message_handles;
+  // signal handle -> signal, the signals of all messages in DBC order
+  std::vector<const Signal *> handle_signals;
+
+  uint64_t finish(const PackMessage *msg, uint32_t address, uint64_t ret, int counter);
 
 public:
   CANPacker(const std::string& dbc_name);
   uint64_t pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
   Msg* lookup_message(uint32_t address);
+
+  // Handle based packing, for callers that pack the same signals every frame. Handles are
+  // resolved once and stay valid for the life of the packer, -1 if there is no such message or signal
+  int message_handle(uint32_t address) const;
+  int signal_handle(uint32_t address, const char *name) const;
+  // packs n values into the message, sets the counter if counter >= 0 and then the checksum.
+  // handles must be signals of the message, negative ones are skipped
+  uint64_t pack(int msg_handle, const int *sig_handles, const double *values, size_t n, int counter);
 };
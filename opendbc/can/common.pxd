@@ -73,12 +73,41 @@ cdef extern from "common_dbc.h":
 cdef extern from "common.h":
   cdef const DBC* dbc_lookup(const string);
 
+  ctypedef enum FieldOp:
+    FIELD_SCALE,
+    FIELD_EQ,
+    FIELD_NE
+
+  cdef struct FieldMapping:
+    int slot
+    FieldOp op
+    double a, b
+
   cdef cppclass CANParser:
     bool can_valid
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
     void update_string(string, bool)
+    void update_buffer(const char*, size_t, bool)
     vector[SignalValue] query_latest()
+    vector[uint32_t] stale_messages()
+    int signal_slot(uint32_t, const char*)
+    size_t num_slots()
+    const double *values()
+    const uint64_t *updated()
+    uint32_t slot_address(size_t)
+    const char *slot_name(size_t)
+    uint16_t slot_ts(size_t)
+    uint64_t slot_host_time(size_t)
+    void fill_fields(const FieldMapping*, size_t, double*)
+
+  cdef cppclass CANParserGroup:
+    CANParserGroup(vector[CANParser*])
+    void update_string(string, bool)
+    void update_buffer(const char*, size_t, bool)
 
   cdef cppclass CANPacker:
    CANPacker(string)
    uint64_t pack(uint32_t, vector[SignalPackValue], int counter)
+   int message_handle(uint32_t)
+   int signal_handle(uint32_t, const char*)
+   uint64_t pack(int, const int*, const double*, size_t, int counter)
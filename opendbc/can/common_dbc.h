@@ -30,6 +30,19 @@ struct SignalValue {
   double value;
 };
 
+// a received CAN frame, what boardd decodes the panda's USB records into. dat is zero padded to 8 bytes.
+// host_time is the CLOCK_BOOTTIME ns the panda received it, 0 if boardd couldn't map the panda's timer.
+// Also the record of canPacked events, boardd copies its frames into them as they are
+struct CanFrame {
+  uint32_t address;
+  uint16_t busTime;
+  uint8_t src;
+  uint8_t len;
+  uint8_t dat[8];
+  uint64_t host_time;
+};
+static_assert(sizeof(CanFrame) == 24, "CanFrame is the canPacked record");
+
 enum SignalType {
   DEFAULT,
   HONDA_CHECKSUM,
@@ -52,12 +65,19 @@ struct Signal {
   SignalType type;
 };
 
+// most signals a message can have, a bit each
+#define DBC_MAX_SIGS 64
+
+// decodes all signals of a message at once, see dbc_template.cc. raw and vals are indexed like Msg::sigs
+typedef void (*DecodeFn)(uint64_t dat_le, uint64_t dat_be, int64_t *raw, double *vals);
+
 struct Msg {
   const char* name;
   uint32_t address;
   unsigned int size;
   size_t num_sigs;
   const Signal *sigs;
+  DecodeFn decode;  // nullptr if the signals are only decoded one by one
 };
 
 struct Val {
@@ -75,12 +95,24 @@ struct DBC {
   size_t num_vals;
 };
 
+// the DBCs registered so far
 std::vector<const DBC*>& get_dbcs();
+// registered DBCs and the ones that can be loaded
+std::vector<std::string> get_dbc_names();
 const DBC* dbc_lookup(const std::string& dbc_name);
 
 void dbc_register(const DBC* dbc);
 
+// Every generated DBC is built into its own dbc_out/<name>.so, which dbc_lookup loads the first
+// time the DBC is asked for. Tables linked into a binary with DBC_STATIC register themselves at startup
+#ifdef DBC_STATIC
 #define dbc_init(dbc) \
 static void __attribute__((constructor)) do_dbc_init_ ## dbc(void) { \
   dbc_register(&dbc); \
 }
+#else
+#define dbc_init(dbc) \
+extern "C" const DBC* dbc_table() { \
+  return &dbc; \
+}
+#endif
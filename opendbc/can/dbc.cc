@@ -1,23 +1,91 @@
+#include <dirent.h>
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "common_dbc.h"
 
+namespace {
+
+std::mutex registry_lock;
+
+std::unordered_map<std::string, const DBC*>& get_registry() {
+  static std::unordered_map<std::string, const DBC*> registry;
+  return registry;
+}
+
+// dbc_out next to libdbc
+std::string dbc_dir() {
+  Dl_info info;
+  if (dladdr((void*)&dbc_register, &info) && info.dli_fname) {
+    std::string path = info.dli_fname;
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos ? "." : path.substr(0, slash)) + "/dbc_out/";
+  }
+  return "dbc_out/";
+}
+
+const DBC* load_dbc(const std::string& dbc_name) {
+  if (dbc_name.empty() || dbc_name.find('/') != std::string::npos) return NULL;
+
+  // never closed, the table is used for the life of the process
+  void *handle = dlopen((dbc_dir() + dbc_name + ".so").c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) return NULL;
+
+  auto table = (const DBC* (*)())dlsym(handle, "dbc_table");
+  return table ? table() : NULL;
+}
+
+}  // namespace
+
 std::vector<const DBC*>& get_dbcs() {
   static std::vector<const DBC*> vec;
   return vec;
 }
 
 const DBC* dbc_lookup(const std::string& dbc_name) {
-  for (const auto& dbci : get_dbcs()) {
-    if (dbc_name == dbci->name) {
-      return dbci;
-    }
+  {
+    std::lock_guard lk(registry_lock);
+    auto it = get_registry().find(dbc_name);
+    if (it != get_registry().end()) return it->second;
+  }
+
+  const DBC* dbc = load_dbc(dbc_name);
+  if (dbc) {
+    dbc_register(dbc);
   }
-  return NULL;
+  return dbc;
 }
 
 void dbc_register(const DBC* dbc) {
-  get_dbcs().push_back(dbc);
+  std::lock_guard lk(registry_lock);
+  if (get_registry().emplace(dbc->name, dbc).second) {
+    get_dbcs().push_back(dbc);
+  }
+}
+
+std::vector<std::string> get_dbc_names() {
+  std::vector<std::string> names;
+  {
+    std::lock_guard lk(registry_lock);
+    for (auto dbc : get_dbcs()) names.push_back(dbc->name);
+  }
+
+  if (DIR *dir = opendir(dbc_dir().c_str())) {
+    while (struct dirent *entry = readdir(dir)) {
+      std::string fn = entry->d_name;
+      if (fn.size() > 3 && fn.compare(fn.size() - 3, 3, ".so") == 0) {
+        std::string name = fn.substr(0, fn.size() - 3);
+        if (std::find(names.begin(), names.end(), name) == names.end()) names.push_back(name);
+      }
+    }
+    closedir(dir);
+  }
+  return names;
 }
 
 extern "C" {
@@ -43,6 +43,30 @@ const Signal sigs_{{address}}[] = {
     },
   {% endfor %}
 };
+
+{% if address in decodable %}
+// every signal of the message in the order of sigs_{{address}}, with its shift, mask and scale as constants
+void decode_{{address}}(uint64_t dat_le, uint64_t dat_be, int64_t *raw, double *vals) {
+  {% for sig in sigs %}
+  {% if sig.is_little_endian %}
+    {% set shift = sig.start_bit %}
+  {% else %}
+    {% set shift = 64 - ((sig.start_bit//8)*8 + (-sig.start_bit-1) % 8 + sig.size) %}
+  {% endif %}
+  {% set value = "((%s >> %d) & 0x%XULL)" % ("dat_le" if sig.is_little_endian else "dat_be", shift, 2**sig.size - 1) %}
+  {% if sig.is_signed and sig.size < 64 %}
+  raw[{{loop.index0}}] = (int64_t)({{value}} << {{64 - sig.size}}) >> {{64 - sig.size}};
+  {% else %}
+  raw[{{loop.index0}}] = {{value}};
+  {% endif %}
+  {% if sig.factor == 1 and sig.offset == 0 %}
+  vals[{{loop.index0}}] = raw[{{loop.index0}}];
+  {% else %}
+  vals[{{loop.index0}}] = raw[{{loop.index0}}] * {{sig.factor}} + {{sig.offset}};
+  {% endif %}
+  {% endfor %}
+}
+{% endif %}
 {% endfor %}
 
 const Msg msgs[] = {
@@ -54,6 +78,7 @@ const Msg msgs[] = {
     .size = {{msg_size}},
     .num_sigs = ARRAYSIZE(sigs_{{address}}),
     .sigs = sigs_{{address}},
+    .decode = {{"decode_%d" % address if address in decodable else "nullptr"}},
   },
 {% endfor %}
 };
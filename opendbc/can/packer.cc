@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <map>
 #include <cmath>
+#include <cstring>
 
 #include "common.h"
 
@@ -33,6 +34,14 @@ static uint64_t set_value(uint64_t ret, const Signal& sig, int64_t ival) {
   return ret;
 }
 
+static int64_t scale_value(const Signal& sig, double value) {
+  int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
+  if (ival < 0) {
+    ival = (1ULL << sig.b2) + ival;
+  }
+  return ival;
+}
+
 CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
@@ -40,14 +49,57 @@ CANPacker::CANPacker(const std::string& dbc_name) {
   for (int i=0; i<dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
     message_lookup[msg->address] = *msg;
+
+    message_handles[msg->address] = pack_messages.size();
+    PackMessage &pm = pack_messages.emplace_back((PackMessage){.address = msg->address, .size = msg->size});
     for (int j=0; j<msg->num_sigs; j++) {
       const Signal* sig = &msg->sigs[j];
       signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = *sig;
+      handle_signals.push_back(sig);
+
+      if (strcmp(sig->name, "COUNTER") == 0) {
+        pm.counter = sig;
+      } else if (strcmp(sig->name, "CHECKSUM") == 0) {
+        pm.checksum = sig;
+      }
     }
   }
   init_crc_lookup_tables();
 }
 
+int CANPacker::message_handle(uint32_t address) const {
+  auto it = message_handles.find(address);
+  return it != message_handles.end() ? it->second : -1;
+}
+
+int CANPacker::signal_handle(uint32_t address, const char *name) const {
+  int handle = 0;
+  for (int i = 0; i < dbc->num_msgs; i++) {
+    const Msg &msg = dbc->msgs[i];
+    if (msg.address == address) {
+      for (int j = 0; j < msg.num_sigs; j++) {
+        if (strcmp(msg.sigs[j].name, name) == 0) return handle + j;
+      }
+      return -1;
+    }
+    handle += msg.num_sigs;
+  }
+  return -1;
+}
+
+uint64_t CANPacker::pack(int msg_handle, const int *sig_handles, const double *values, size_t n, int counter) {
+  assert(msg_handle >= 0 && msg_handle < pack_messages.size());
+  const PackMessage &msg = pack_messages[msg_handle];
+
+  uint64_t ret = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (sig_handles[i] < 0) continue;
+    const Signal &sig = *handle_signals[sig_handles[i]];
+    ret = set_value(ret, sig, scale_value(sig, values[i]));
+  }
+  return finish(&msg, msg.address, ret, counter);
+}
+
 uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
   uint64_t ret = 0;
   for (const auto& sigval : signals) {
@@ -61,21 +113,20 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
     }
     const auto& sig = sig_it->second;
 
-    int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
-    if (ival < 0) {
-      ival = (1ULL << sig.b2) + ival;
-    }
-
-    ret = set_value(ret, sig, ival);
+    ret = set_value(ret, sig, scale_value(sig, value));
   }
 
+  int msg_handle = message_handle(address);
+  return finish(msg_handle >= 0 ? &pack_messages[msg_handle] : nullptr, address, ret, counter);
+}
+
+uint64_t CANPacker::finish(const PackMessage *msg, uint32_t address, uint64_t ret, int counter) {
   if (counter >= 0){
-    auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
-    if (sig_it == signal_lookup.end()) {
+    if (!msg || !msg->counter) {
       WARN("COUNTER not defined\n");
       return ret;
     }
-    const auto& sig = sig_it->second;
+    const auto& sig = *msg->counter;
 
     if ((sig.type != SignalType::HONDA_COUNTER) && (sig.type != SignalType::VOLKSWAGEN_COUNTER)) {
       WARN("COUNTER signal type not valid\n");
@@ -84,26 +135,26 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
     ret = set_value(ret, sig, counter);
   }
 
-  auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
-    const auto& sig = sig_it_checksum->second;
+  if (msg && msg->checksum) {
+    const auto& sig = *msg->checksum;
+    const unsigned int size = msg->size;
     if (sig.type == SignalType::HONDA_CHECKSUM) {
-      unsigned int chksm = honda_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = honda_checksum(address, ret, size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-      unsigned int chksm = toyota_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = toyota_checksum(address, ret, size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
       // FIXME: Hackish fix for an endianness issue. The message is in reverse byte order
       // until later in the pack process. Checksums can be run backwards, CRCs not so much.
       // The correct fix is unclear but this works for the moment.
-      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), message_lookup[address].size);
+      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-      unsigned int chksm = subaru_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = subaru_checksum(address, ret, size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), message_lookup[address].size);
+      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), size);
       ret = set_value(ret, sig, chksm);
     } else {
       //WARN("CHECKSUM signal type not valid\n");
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Packs the LKAS and SCC frame set of a Hyundai carcontroller step with the name based and the
+// handle based CANPacker::pack, checks they agree and times both
+// usage: packer_benchmark [count] [dbc]
+
+static const char *FRAME_SET[] = {"LKAS11", "CLU11", "LFAHDA_MFC", "SCC11", "SCC12", "SCC13", "SCC14", "MDPS12"};
+
+struct Frame {
+  uint32_t address;
+  int msg_handle;
+  std::vector<SignalPackValue> named;
+  std::vector<int> handles;
+  std::vector<double> values;
+};
+
+int main(int argc, char *argv[]) {
+  const int count = argc > 1 ? atoi(argv[1]) : 100000;
+  const std::string dbc_name = argc > 2 ? argv[2] : "hyundai_kia_generic";
+
+  const DBC *dbc = dbc_lookup(dbc_name);
+  if (!dbc) {
+    fprintf(stderr, "no DBC %s\n", dbc_name.c_str());
+    return 1;
+  }
+  CANPacker packer(dbc_name);
+
+  // every signal of every message, set to a value inside its range
+  std::vector<Frame> frames;
+  size_t num_signals = 0;
+  for (auto name : FRAME_SET) {
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &msg = dbc->msgs[i];
+      if (strcmp(msg.name, name) != 0) continue;
+
+      Frame &f = frames.emplace_back();
+      f.address = msg.address;
+      f.msg_handle = packer.message_handle(msg.address);
+      for (int j = 0; j < msg.num_sigs; j++) {
+        const Signal &sig = msg.sigs[j];
+        double value = ((j * 7) % (1 << std::min(sig.b2, 16))) * sig.factor + sig.offset;
+        f.named.push_back({sig.name, value});
+        f.handles.push_back(packer.signal_handle(msg.address, sig.name));
+        f.values.push_back(value);
+      }
+      num_signals += msg.num_sigs;
+    }
+  }
+  if (frames.empty()) {
+    fprintf(stderr, "none of the frame set is in %s\n", dbc_name.c_str());
+    return 1;
+  }
+
+  for (auto &f : frames) {
+    if (packer.pack(f.address, f.named, -1) != packer.pack(f.msg_handle, f.handles.data(), f.values.data(), f.values.size(), -1)) {
+      printf("0x%X: packs differ\n", f.address);
+      return 1;
+    }
+  }
+
+  uint64_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    for (auto &f : frames) sink += packer.pack(f.address, f.named, -1);
+  }
+  auto mid = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    for (auto &f : frames) sink += packer.pack(f.msg_handle, f.handles.data(), f.values.data(), f.values.size(), -1);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  const double by_name = std::chrono::duration<double>(mid - start).count() / count * 1e6;
+  const double by_handle = std::chrono::duration<double>(end - mid).count() / count * 1e6;
+  printf("%zu frames, %zu signals (sink %llu)\n", frames.size(), num_signals, (unsigned long long)sink);
+  printf("by name %.2fus per frame set, by handle %.2fus per frame set\n", by_name, by_handle);
+  return 0;
+}
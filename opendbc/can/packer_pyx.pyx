@@ -18,6 +18,8 @@ cdef class CANPacker:
     const DBC *dbc
     map[string, (int, int)] name_to_address_and_size
     map[int, int] address_to_size
+    dict signal_handles
+    map[int, int] message_handles
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -25,13 +27,39 @@ cdef class CANPacker:
       raise RuntimeError(f"Can't lookup {dbc_name}")
 
     self.packer = new cpp_CANPacker(dbc_name)
+    self.signal_handles = {}
     num_msgs = self.dbc[0].num_msgs
     for i in range(num_msgs):
       msg = self.dbc[0].msgs[i]
       self.name_to_address_and_size[string(msg.name)] = (msg.address, msg.size)
       self.address_to_size[msg.address] = msg.size
 
+      # resolve every signal once, packing then doesn't compare names in C++
+      self.message_handles[msg.address] = self.packer.message_handle(msg.address)
+      handles = {}
+      for j in range(msg.num_sigs):
+        handles[msg.sigs[j].name.decode('utf8')] = self.packer.signal_handle(msg.address, msg.sigs[j].name)
+      self.signal_handles[msg.address] = handles
+
   cdef uint64_t pack(self, addr, values, counter):
+    cdef vector[int] handles
+    cdef vector[double] vals
+
+    if self.message_handles.count(addr) == 0:
+      return self.pack_by_name(addr, values, counter)
+
+    sig_handles = self.signal_handles[addr]
+    for name, value in values.items():
+      h = sig_handles.get(name)
+      if h is None:
+        print(f"undefined signal {name} - {addr}")
+        continue
+      handles.push_back(h)
+      vals.push_back(value)
+
+    return self.packer.pack(self.message_handles[addr], handles.data(), vals.data(), handles.size(), counter)
+
+  cdef uint64_t pack_by_name(self, addr, values, counter):
     cdef vector[SignalPackValue] values_thing
     cdef SignalPackValue spv
 
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <algorithm>
+#include <functional>
 
 #include "common.h"
 
@@ -13,26 +14,39 @@
 // #define DEBUG printf
 #define INFO printf
 
-bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
+bool MessageState::parse(uint64_t sec, uint16_t ts_, const uint8_t * dat, uint64_t host_time_) {
   uint64_t dat_le = read_u64_le(dat);
   uint64_t dat_be = read_u64_be(dat);
 
-  for (int i=0; i < parse_sigs.size(); i++) {
+  int64_t decoded_raw[DBC_MAX_SIGS];
+  double decoded[DBC_MAX_SIGS];
+  if (decode) {
+    decode(dat_le, dat_be, decoded_raw, decoded);
+  }
+
+  for (int i=0; i < num_sigs; i++) {
     auto& sig = parse_sigs[i];
     int64_t tmp;
 
-    if (sig.is_little_endian){
+    if (decode) {
+      tmp = decoded_raw[sig_idx[i]];
+    } else if (sig.is_little_endian){
       tmp = (dat_le >> sig.b1) & ((1ULL << sig.b2)-1);
     } else {
       tmp = (dat_be >> sig.bo) & ((1ULL << sig.b2)-1);
     }
 
-    if (sig.is_signed) {
+    if (!decode && sig.is_signed) {
       tmp -= (tmp >> (sig.b2-1)) ? (1ULL << sig.b2) : 0; //signed
     }
 
     DEBUG("parse 0x%X %s -> %lld\n", address, sig.name, tmp);
 
+    if (sig.type == SignalType::DEFAULT) {
+      vals[i] = decode ? decoded[sig_idx[i]] : tmp * sig.factor + sig.offset;
+      continue;
+    }
+
     if (!ignore_checksum) {
       if (sig.type == SignalType::HONDA_CHECKSUM) {
         if (honda_checksum(address, dat_be, size) != tmp) {
@@ -86,11 +100,11 @@ bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
   }
   ts = ts_;
   seen = sec;
+  host_time = host_time_ ? host_time_ : sec;
 
   return true;
 }
 
-
 bool MessageState::update_counter_generic(int64_t v, int cnt_size) {
   uint8_t old_counter = counter;
   counter = v;
@@ -119,8 +133,9 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
   init_crc_lookup_tables();
 
   for (const auto& op : options) {
-    MessageState &state = message_states[op.address];
+    MessageState &state = message_states.emplace_back();
     state.address = op.address;
+    state.sig_start = sig_arena.size();
     // state.check_frequency = op.check_frequency,
 
     // msg is not valid if a message isn't received for 10 consecutive steps
@@ -141,13 +156,13 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
     }
 
     state.size = msg->size;
+    state.decode = msg->decode;
 
     // track checksums and counters for this message
     for (int i = 0; i < msg->num_sigs; i++) {
       const Signal *sig = &msg->sigs[i];
       if (sig->type != SignalType::DEFAULT) {
-        state.parse_sigs.push_back(*sig);
-        state.vals.push_back(0);
+        add_sig(state, msg, i, 0);
       }
     }
 
@@ -159,13 +174,13 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
         const Signal *sig = &msg->sigs[i];
         if (strcmp(sig->name, sigop.name) == 0
             && sig->type == SignalType::DEFAULT) {
-          state.parse_sigs.push_back(*sig);
-          state.vals.push_back(sigop.default_value);
+          add_sig(state, msg, i, sigop.default_value);
           break;
         }
       }
     }
   }
+  build_lookup();
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -178,40 +193,121 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
 
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
-    MessageState state = {
+    MessageState &state = message_states.emplace_back((MessageState){
       .address = msg->address,
       .size = msg->size,
+      .sig_start = sig_arena.size(),
+      .decode = msg->decode,
       .ignore_checksum = ignore_checksum,
       .ignore_counter = ignore_counter,
-    };
+    });
 
     for (int j = 0; j < msg->num_sigs; j++) {
-      const Signal *sig = &msg->sigs[j];
-      state.parse_sigs.push_back(*sig);
-      state.vals.push_back(0);
+      add_sig(state, msg, j, 0);
     }
+  }
+  build_lookup();
+}
+
+void CANParser::add_sig(MessageState &state, const Msg *msg, int idx, double default_value) {
+  sig_arena.push_back(msg->sigs[idx]);
+  sig_idx_arena.push_back(idx);
+  val_arena.push_back(default_value);
+  state.num_sigs++;
+}
+
+void CANParser::build_lookup() {
+  std::sort(message_states.begin(), message_states.end(),
+            [](const MessageState &a, const MessageState &b) { return a.address < b.address; });
+  assert(message_states.size() < UINT16_MAX);
+
+  direct_lookup.assign(DIRECT_LOOKUP_SIZE, 0);
+  slot_state.resize(sig_arena.size());
+  updated_mask.assign((sig_arena.size() + 63) / 64, ~0ULL);
+  for (size_t i = 0; i < message_states.size(); i++) {
+    MessageState &state = message_states[i];
+    assert(i == 0 || message_states[i - 1].address != state.address);
+    addresses.push_back(state.address);
+    if (state.address < DIRECT_LOOKUP_SIZE) {
+      direct_lookup[state.address] = i + 1;
+    }
+
+    // the arena is complete, it doesn't move anymore
+    state.parse_sigs = &sig_arena[state.sig_start];
+    state.sig_idx = &sig_idx_arena[state.sig_start];
+    state.vals = &val_arena[state.sig_start];
+    for (size_t j = 0; j < state.num_sigs; j++) {
+      slot_state[state.sig_start + j] = i;
+    }
+    if (state.check_threshold > 0) {
+      push_deadline(i);
+    }
+  }
+}
+
+void CANParser::push_deadline(uint16_t idx) {
+  const MessageState &state = message_states[idx];
+  deadlines.push_back({state.seen + state.check_threshold, idx});
+  std::push_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>());
+}
+
+void CANParser::mark_updated(MessageState &state) {
+  if (state.stale) {
+    DEBUG("0x%X BACK\n", state.address);
+    state.stale = false;
+    num_stale--;
+    push_deadline(&state - message_states.data());
+  }
+  for (size_t slot = state.sig_start; slot < state.sig_start + state.num_sigs; slot++) {
+    updated_mask[slot / 64] |= 1ULL << (slot % 64);
+  }
+}
 
-    message_states[state.address] = state;
+int CANParser::signal_slot(uint32_t address, const char *name) const {
+  auto it = std::lower_bound(addresses.begin(), addresses.end(), address);
+  if (it == addresses.end() || *it != address) return -1;
+
+  const MessageState &state = message_states[it - addresses.begin()];
+  for (size_t i = 0; i < state.num_sigs; i++) {
+    if (strcmp(state.parse_sigs[i].name, name) == 0) return state.sig_start + i;
+  }
+  return -1;
+}
+
+void CANParser::fill_fields(const FieldMapping *fields, size_t n, double *out) const {
+  const double *values = val_arena.data();
+  for (size_t i = 0; i < n; i++) {
+    const FieldMapping &f = fields[i];
+    double v = values[f.slot];
+    switch (f.op) {
+      case FIELD_SCALE: out[i] = v * f.a + f.b; break;
+      case FIELD_EQ: out[i] = v == f.a; break;
+      case FIELD_NE: out[i] = v != f.a; break;
+    }
   }
 }
 
 #ifndef DYNAMIC_CAPNP
-void CANParser::update_string(const std::string &data, bool sendcan) {
+void CANParser::update_buffer(const char *data, size_t len, bool sendcan) {
   // format for board, make copy due to alignment issues.
-  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  const size_t buf_size = (len / sizeof(capnp::word)) + 1;
   if (aligned_buf.size() < buf_size) {
     aligned_buf = kj::heapArray<capnp::word>(buf_size);
   }
-  memcpy(aligned_buf.begin(), data.data(), data.length());
+  memcpy(aligned_buf.begin(), data, len);
 
   // extract the messages
   capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
   cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
 
-  last_sec = event.getLogMonoTime();
+  begin_update(event.getLogMonoTime());
 
-  auto cans = sendcan? event.getSendcan() : event.getCan();
-  UpdateCans(last_sec, cans);
+  if (event.isCanPacked()) {
+    UpdateCans(last_sec, can_packed_frames(event.getCanPacked()));
+  } else {
+    auto cans = sendcan? event.getSendcan() : event.getCan();
+    UpdateCans(last_sec, cans);
+  }
 
   UpdateValid(last_sec);
 }
@@ -228,8 +324,8 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
       // DEBUG("skip %d: wrong bus\n", cmsg.getAddress());
       continue;
     }
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
+    MessageState *state = lookup(cmsg.getAddress());
+    if (!state) {
       // DEBUG("skip %d: not specified\n", cmsg.getAddress());
       continue;
     }
@@ -238,7 +334,9 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
     uint8_t dat[8] = {0};
     memcpy(dat, cmsg.getDat().begin(), cmsg.getDat().size());
 
-    state_it->second.parse(sec, cmsg.getBusTime(), dat);
+    if (state->parse(sec, cmsg.getBusTime(), dat, cmsg.getHostTime())) {
+      mark_updated(*state);
+    }
   }
 }
 #endif
@@ -252,8 +350,8 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
+  MessageState *state = lookup(cmsg.get("address").as<uint32_t>());
+  if (!state) {
     DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
     return;
   }
@@ -262,32 +360,71 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
   if (dat.size() > 8) return; //shouldn't ever happen
   uint8_t data[8] = {0};
   memcpy(data, dat.begin(), dat.size());
-  state_it->second.parse(sec, cmsg.get("busTime").as<uint16_t>(), data);
+  if (state->parse(sec, cmsg.get("busTime").as<uint16_t>(), data, cmsg.get("hostTime").as<uint64_t>())) {
+    mark_updated(*state);
+  }
+}
+
+void CANParser::UpdateCans(uint64_t sec, kj::ArrayPtr<const CanFrame> frames) {
+  for (const auto &frame : frames) {
+    if (frame.src == bus) {
+      parse_frame(sec, frame);
+    }
+  }
+}
+
+void CANParser::begin_update(uint64_t sec) {
+  last_sec = sec;
+  std::fill(updated_mask.begin(), updated_mask.end(), 0);
+}
+
+void CANParser::update_frames(uint64_t sec, kj::ArrayPtr<const CanFrame> frames) {
+  begin_update(sec);
+  UpdateCans(sec, frames);
+  UpdateValid(sec);
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
-  can_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
-    if (state.check_threshold > 0 && (sec - state.seen) > state.check_threshold) {
-      if (state.seen > 0) {
-        DEBUG("0x%X TIMEOUT\n", state.address);
-      } else {
-        DEBUG("0x%X MISSING\n", state.address);
-      }
-      can_valid = false;
+  newly_stale.clear();
+  while (!deadlines.empty() && sec > deadlines.front().first) {
+    std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>());
+    const uint16_t idx = deadlines.back().second;
+    deadlines.pop_back();
+
+    MessageState &state = message_states[idx];
+    if ((sec - state.seen) <= state.check_threshold) {
+      // seen since the entry was pushed
+      push_deadline(idx);
+      continue;
+    }
+
+    if (state.seen > 0) {
+      DEBUG("0x%X TIMEOUT\n", state.address);
+    } else {
+      DEBUG("0x%X MISSING\n", state.address);
     }
+    state.stale = true;
+    num_stale++;
+    newly_stale.push_back(state.address);
   }
+  can_valid = num_stale == 0;
+}
+
+std::vector<uint32_t> CANParser::stale_messages() const {
+  std::vector<uint32_t> ret;
+  for (const auto& state : message_states) {
+    if (state.stale) ret.push_back(state.address);
+  }
+  return ret;
 }
 
 std::vector<SignalValue> CANParser::query_latest() {
   std::vector<SignalValue> ret;
 
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
+  for (const auto& state : message_states) {
     if (last_sec != 0 && state.seen != last_sec) continue;
 
-    for (int i=0; i<state.parse_sigs.size(); i++) {
+    for (int i=0; i<state.num_sigs; i++) {
       const Signal &sig = state.parse_sigs[i];
       ret.push_back((SignalValue){
         .address = state.address,
@@ -300,3 +437,63 @@ std::vector<SignalValue> CANParser::query_latest() {
 
   return ret;
 }
+
+CANParserGroup::CANParserGroup(const std::vector<CANParser *> &parsers)
+  : parsers(parsers), aligned_buf(kj::heapArray<capnp::word>(1024)) {
+}
+
+void CANParserGroup::begin_update(uint64_t sec) {
+  for (auto p : parsers) {
+    p->begin_update(sec);
+  }
+}
+
+void CANParserGroup::end_update(uint64_t sec) {
+  for (auto p : parsers) {
+    p->UpdateValid(sec);
+  }
+}
+
+#ifndef DYNAMIC_CAPNP
+void CANParserGroup::update_buffer(const char *data, size_t len, bool sendcan) {
+  const size_t buf_size = (len / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data, len);
+
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+  const uint64_t sec = event.getLogMonoTime();
+  if (event.isCanPacked()) {
+    update_frames(sec, can_packed_frames(event.getCanPacked()));
+    return;
+  }
+  begin_update(sec);
+
+  for (auto c : sendcan ? event.getSendcan() : event.getCan()) {
+    auto dat = c.getDat();
+    if (dat.size() > 8) continue; //shouldn't ever happen
+
+    CanFrame frame = {
+      .address = c.getAddress(),
+      .busTime = c.getBusTime(),
+      .src = (uint8_t)c.getSrc(),
+      .len = (uint8_t)dat.size(),
+      .host_time = c.getHostTime(),
+    };
+    memcpy(frame.dat, dat.begin(), dat.size());
+    dispatch(sec, frame);
+  }
+
+  end_update(sec);
+}
+#endif
+
+void CANParserGroup::update_frames(uint64_t sec, kj::ArrayPtr<const CanFrame> frames) {
+  begin_update(sec);
+  for (const auto &frame : frames) {
+    dispatch(sec, frame);
+  }
+  end_update(sec);
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Parses the can events of a recorded log with every message of a DBC, the way carstate does.
+// Then the same frames in canPacked events, and parsers of buses 0-2 updated one by one against a CANParserGroup
+// usage: parser_benchmark <decompressed rlog> <dbc> [bus] [repeat]
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <decompressed rlog> <dbc> [bus] [repeat]\n", argv[0]);
+    return 1;
+  }
+  const int bus = argc > 3 ? atoi(argv[3]) : 0;
+  const int repeat = argc > 4 ? atoi(argv[4]) : 10;
+
+  std::ifstream f(argv[1], std::ios::binary);
+  std::string log((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  std::vector<capnp::word> words(log.size() / sizeof(capnp::word));
+  memcpy(words.data(), log.data(), words.size() * sizeof(capnp::word));
+
+  // keep the serialized can events, that is what update_string gets from the socket
+  std::vector<std::string> events;
+  size_t frames = 0;
+  kj::ArrayPtr<const capnp::word> remaining(words.data(), words.size());
+  while (remaining.size() > 0) {
+    capnp::FlatArrayMessageReader msg(remaining);
+    auto event = msg.getRoot<cereal::Event>();
+    if (event.isCan()) {
+      events.emplace_back((const char *)remaining.begin(), (const char *)msg.getEnd());
+      frames += event.getCan().size();
+    }
+    remaining = kj::arrayPtr(msg.getEnd(), remaining.end());
+  }
+  if (events.empty()) {
+    fprintf(stderr, "no can events in %s\n", argv[1]);
+    return 1;
+  }
+
+  CANParser parser(bus, argv[2], true, true);
+
+  size_t num_values = 0;
+  double update_s = 0, query_s = 0, columnar_s = 0;
+  double sum = 0;
+  for (int r = 0; r < repeat; r++) {
+    for (const auto &e : events) {
+      auto start = std::chrono::steady_clock::now();
+      parser.update_string(e, false);
+      auto mid = std::chrono::steady_clock::now();
+      num_values += parser.query_latest().size();
+      auto end = std::chrono::steady_clock::now();
+      for (size_t w = 0; w < (parser.num_slots() + 63) / 64; w++) {
+        for (uint64_t mask = parser.updated()[w]; mask; mask &= mask - 1) {
+          sum += parser.values()[w * 64 + __builtin_ctzll(mask)];
+        }
+      }
+      auto columnar_end = std::chrono::steady_clock::now();
+      update_s += std::chrono::duration<double>(mid - start).count();
+      query_s += std::chrono::duration<double>(end - mid).count();
+      columnar_s += std::chrono::duration<double>(columnar_end - end).count();
+    }
+  }
+
+  const double n = (double)events.size() * repeat;
+  printf("%zu events, %zu frames, %.1f values per event\n", events.size(), frames, num_values / n);
+  printf("update_string %.2fus per event, %.1fns per frame\n", update_s / n * 1e6, update_s / (frames * repeat) * 1e9);
+  printf("query_latest  %.2fus per event\n", query_s / n * 1e6);
+  printf("updated slots %.2fus per event (sum %g)\n", columnar_s / n * 1e6, sum);
+
+  std::vector<std::string> packed_events;
+  for (const auto &e : events) {
+    std::vector<capnp::word> aligned(e.size() / sizeof(capnp::word));
+    memcpy(aligned.data(), e.data(), aligned.size() * sizeof(capnp::word));
+    capnp::FlatArrayMessageReader msg(kj::arrayPtr(aligned.data(), aligned.size()));
+    auto event = msg.getRoot<cereal::Event>();
+
+    std::vector<CanFrame> can_frames;
+    for (auto c : event.getCan()) {
+      CanFrame frame = {.address = c.getAddress(), .busTime = c.getBusTime(), .src = (uint8_t)c.getSrc(),
+                        .len = (uint8_t)std::min<size_t>(c.getDat().size(), 8), .host_time = c.getHostTime()};
+      memcpy(frame.dat, c.getDat().begin(), frame.len);
+      can_frames.push_back(frame);
+    }
+    capnp::MallocMessageBuilder packed;
+    auto packed_event = packed.initRoot<cereal::Event>();
+    packed_event.setLogMonoTime(event.getLogMonoTime());
+    packed_event.setCanPacked(kj::arrayPtr((const capnp::byte *)can_frames.data(), can_frames.size() * sizeof(CanFrame)));
+    auto bytes = capnp::messageToFlatArray(packed).asBytes();
+    packed_events.emplace_back((const char *)bytes.begin(), bytes.size());
+  }
+
+  size_t list_bytes = 0, packed_bytes = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    list_bytes += events[i].size();
+    packed_bytes += packed_events[i].size();
+  }
+  CANParser packed_parser(bus, argv[2], true, true);
+  auto packed_start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++) {
+    for (const auto &e : packed_events) {
+      packed_parser.update_string(e, false);
+    }
+  }
+  const double packed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - packed_start).count();
+  printf("canPacked     %.2fus per event, %.1fns per frame, %.0f%% of the can event size\n", packed_s / n * 1e6,
+         packed_s / (frames * repeat) * 1e9, 100.0 * packed_bytes / list_bytes);
+
+  std::vector<std::unique_ptr<CANParser>> bus_parsers;
+  std::vector<CANParser *> group_parsers;
+  for (int b = 0; b < 3; b++) {
+    group_parsers.push_back(bus_parsers.emplace_back(new CANParser(b, argv[2], true, true)).get());
+  }
+  CANParserGroup group(group_parsers);
+
+  auto time_events = [&](auto update) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) {
+      for (const auto &e : events) update(e);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / n * 1e6;
+  };
+  const double separate_us = time_events([&](const std::string &e) {
+    for (auto p : group_parsers) p->update_string(e, false);
+  });
+  const double group_us = time_events([&](const std::string &e) { group.update_string(e, false); });
+  printf("buses 0-2, one parser each %.2fus per event, CANParserGroup %.2fus per event\n", separate_us, group_us);
+  return 0;
+}
@@ -9,7 +9,9 @@ from libcpp.map cimport map
 from libcpp cimport bool
 
 from .common cimport CANParser as cpp_CANParser
+from .common cimport CANParserGroup as cpp_CANParserGroup
 from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport FieldMapping, FIELD_SCALE, FIELD_EQ, FIELD_NE
 
 import os
 import numbers
@@ -17,32 +19,53 @@ from collections import defaultdict
 
 cdef int CAN_INVALID_CNT = 5
 
+cdef extern from *:
+  int __builtin_ctzll(unsigned long long)
+
 cdef class CANParser:
+  """Parser of the signals of one bus.
+
+  values is a view of the latest values indexed by signal_id(message, signal), updated has the bit
+  of every signal whose message was parsed in the last update_string(s) call (64 per word). The
+  vl, ts and host_time dicts are written from them only when they are read.
+  """
   cdef:
     cpp_CANParser *can
     const DBC *dbc
     map[string, uint32_t] msg_name_to_address
     map[uint32_t, string] address_to_msg_name
-    vector[SignalValue] can_values
     bool test_mode_enabled
+    list slots
+    dict _vl
+    dict _ts
+    dict _host_time
+    # updated bits of this update_strings call, and the ones not in the dicts yet
+    vector[uint64_t] updated_bits
+    vector[uint64_t] pending
 
   cdef readonly:
     string dbc_name
-    dict vl
-    dict ts
+    int bus
+    # of the messages the signals and checks are in
+    list addresses
     bool can_valid
     int can_invalid_cnt
+    double[::1] values
+    uint64_t[::1] updated
 
   def __init__(self, dbc_name, signals, checks=None, bus=0, enforce_checks=True):
     if checks is None:
       checks = []
     self.can_valid = True
     self.dbc_name = dbc_name
+    self.bus = bus
     self.dbc = dbc_lookup(dbc_name)
     if not self.dbc:
       raise RuntimeError(f"Can't find DBC: {dbc_name}")
-    self.vl = {}
-    self.ts = {}
+    self._vl = {}
+    self._ts = {}
+    # per message, CLOCK_BOOTTIME ns the panda received the last frame, the update's time for old logs
+    self._host_time = {}
 
     self.can_invalid_cnt = CAN_INVALID_CNT
 
@@ -54,10 +77,10 @@ cdef class CANParser:
 
       self.msg_name_to_address[name] = msg.address
       self.address_to_msg_name[msg.address] = name
-      self.vl[msg.address] = {}
-      self.vl[name] = {}
-      self.ts[msg.address] = {}
-      self.ts[name] = {}
+      self._vl[msg.address] = {}
+      self._vl[name] = {}
+      self._ts[msg.address] = {}
+      self._ts[name] = {}
 
     # Convert message names into addresses
     for i in range(len(signals)):
@@ -92,6 +115,7 @@ cdef class CANParser:
 
     message_options = dict((address, 0) for _, address, _ in signals)
     message_options.update(dict(checks))
+    self.addresses = list(message_options.keys())
 
     cdef vector[MessageParseOptions] message_options_v
     cdef MessageParseOptions mpo
@@ -101,13 +125,78 @@ cdef class CANParser:
       message_options_v.push_back(mpo)
 
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
+
+    # dicts every slot is written to, so updates don't look anything up by name
+    cdef size_t slot
+    cdef size_t num_slots = self.can.num_slots()
+    self.slots = []
+    for slot in range(num_slots):
+      address = self.can.slot_address(slot)
+      msg_name = <unicode>self.address_to_msg_name[address].c_str()
+      sig_name = <unicode>self.can.slot_name(slot)
+      self.slots.append((address, msg_name, sig_name, self._vl[address], self._vl[msg_name], self._ts[address], self._ts[msg_name]))
+
+    # the parser's arrays aren't resized after construction
+    self.updated_bits.resize((num_slots + 63) // 64)
+    self.pending.resize(self.updated_bits.size())
+    if num_slots:
+      self.values = <double[:num_slots]><double *>self.can.values()
+      self.updated = <uint64_t[:self.updated_bits.size()]>self.updated_bits.data()
+
     self.update_vl()
 
+  def signal_id(self, msg, sig):
+    """The index of a parsed signal in values and updated, msg is a name or address."""
+    address = msg if isinstance(msg, numbers.Number) else self.msg_name_to_address[msg.encode('utf8')]
+    slot = self.can.signal_slot(address, sig.encode('utf8'))
+    if slot < 0:
+      raise KeyError(f"{msg} {sig} isn't parsed")
+    return slot
+
+  @property
+  def vl(self):
+    self.sync_dicts()
+    return self._vl
+
+  @property
+  def ts(self):
+    self.sync_dicts()
+    return self._ts
+
+  @property
+  def host_time(self):
+    self.sync_dicts()
+    return self._host_time
+
+  cdef void sync_dicts(self):
+    cdef const double *values = self.can.values()
+    cdef size_t w, slot
+    cdef uint64_t mask
+
+    for w in range(self.pending.size()):
+      mask = self.pending[w]
+      self.pending[w] = 0
+      while mask:
+        slot = w * 64 + __builtin_ctzll(mask)
+        mask &= mask - 1
+
+        address, msg_name, sig_name, vl_addr, vl_name, ts_addr, ts_name = self.slots[slot]
+        value = values[slot]
+        ts = self.can.slot_ts(slot)
+        vl_addr[sig_name] = value
+        vl_name[sig_name] = value
+        ts_addr[sig_name] = ts
+        ts_name[sig_name] = ts
+        host_ns = self.can.slot_host_time(slot)
+        self._host_time[address] = host_ns
+        self._host_time[msg_name] = host_ns
+
   cdef unordered_set[uint32_t] update_vl(self):
-    cdef string sig_name
     cdef unordered_set[uint32_t] updated_val
+    cdef const uint64_t *updated = self.can.updated()
+    cdef size_t w, slot
+    cdef uint64_t mask
 
-    can_values = self.can.query_latest()
     valid = self.can.can_valid
 
     # Update invalid flag
@@ -116,31 +205,120 @@ cdef class CANParser:
         self.can_invalid_cnt = 0
     self.can_valid = self.can_invalid_cnt < CAN_INVALID_CNT
 
-    for cv in can_values:
-      # Cast char * directly to unicode
-      name = <unicode>self.address_to_msg_name[cv.address].c_str()
-      cv_name = <unicode>cv.name
-
-      self.vl[cv.address][cv_name] = cv.value
-      self.ts[cv.address][cv_name] = cv.ts
+    for w in range(self.pending.size()):
+      mask = updated[w]
+      self.updated_bits[w] |= mask
+      self.pending[w] |= mask
+      while mask:
+        slot = w * 64 + __builtin_ctzll(mask)
+        mask &= mask - 1
+        updated_val.insert(self.can.slot_address(slot))
 
-      self.vl[name][cv_name] = cv.value
-      self.ts[name][cv_name] = cv.ts
+    return updated_val
 
-      updated_val.insert(cv.address)
+  cdef void clear_updated(self):
+    cdef size_t w
+    for w in range(self.updated_bits.size()):
+      self.updated_bits[w] = 0
 
-    return updated_val
+  def stale_messages(self):
+    """Names of the checked messages that timed out or were never received."""
+    return [<unicode>self.address_to_msg_name[a].c_str() for a in self.can.stale_messages()]
 
-  def update_string(self, dat, sendcan=False):
-    self.can.update_string(dat, sendcan)
+  def update_string(self, bytes dat, sendcan=False):
+    self.clear_updated()
+    self.can.update_buffer(dat, len(dat), sendcan)
     return self.update_vl()
 
   def update_strings(self, strings, sendcan=False):
     updated_vals = set()
+    self.clear_updated()
+
+    for s in strings:
+      self.can.update_buffer(s, len(s), sendcan)
+      updated_vals.update(self.update_vl())
+
+    return updated_vals
+
+  def field_map(self, fields):
+    return FieldMap(self, fields)
+
+cdef class FieldMap:
+  """CarState fields that are a signal of the parser, scaled or compared, set from the value slots.
+
+  fields are (field, message, signal, op, arg) with op
+    '*': signal * arg, or (signal * arg[0] + arg[1]) for a pair
+    '==', '!=': the signal compared with arg, a Bool field
+  field is the attribute path in the CarState, e.g. "wheelSpeeds.fl".
+  """
+  cdef:
+    CANParser parser
+    vector[FieldMapping] fields
+    vector[double] out
+    list groups
+
+  def __init__(self, CANParser parser, fields):
+    self.parser = parser
+    groups = {}
+    cdef FieldMapping f
+    for field, msg, sig, op, arg in fields:
+      address = msg if isinstance(msg, numbers.Number) else parser.msg_name_to_address[msg.encode('utf8')]
+      f.slot = parser.can.signal_slot(address, sig.encode('utf8'))
+      if f.slot < 0:
+        raise RuntimeError(f"{field}: {msg} {sig} isn't parsed")
+
+      if op == '*':
+        f.op = FIELD_SCALE
+        f.a, f.b = arg if isinstance(arg, tuple) else (arg, 0.)
+        kind = float
+      elif op in ('==', '!='):
+        f.op = FIELD_EQ if op == '==' else FIELD_NE
+        f.a, f.b = arg, 0.
+        kind = bool
+      else:
+        raise RuntimeError(f"{field}: unknown op {op}")
+
+      *path, attr = field.split('.')
+      groups.setdefault(tuple(path), []).append((self.fields.size(), attr, kind))
+      self.fields.push_back(f)
+
+    self.out.resize(self.fields.size())
+    self.groups = list(groups.items())
+
+  def fill(self, ret):
+    self.parser.can.fill_fields(self.fields.data(), self.fields.size(), self.out.data())
+    for path, attrs in self.groups:
+      obj = ret
+      for p in path:
+        obj = getattr(obj, p)
+      for i, attr, kind in attrs:
+        setattr(obj, attr, kind(self.out[i]))
+
+cdef class CANParserGroup:
+  """Updates the parsers of several buses with one pass over every can event."""
+  cdef:
+    cpp_CANParserGroup *group
+    list parsers
+
+  def __init__(self, parsers):
+    cdef vector[cpp_CANParser*] parsers_v
+    for p in parsers:
+      parsers_v.push_back((<CANParser?>p).can)
+    self.parsers = list(parsers)
+    self.group = new cpp_CANParserGroup(parsers_v)
+
+  def __dealloc__(self):
+    del self.group
+
+  def update_strings(self, strings, sendcan=False):
+    updated_vals = [set() for _ in self.parsers]
 
+    for p in self.parsers:
+      (<CANParser>p).clear_updated()
     for s in strings:
-      updated_val = self.update_string(s, sendcan)
-      updated_vals.update(updated_val)
+      self.group.update_buffer(s, len(s), sendcan)
+      for i, p in enumerate(self.parsers):
+        updated_vals[i].update((<CANParser>p).update_vl())
 
     return updated_vals
 
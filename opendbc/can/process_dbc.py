@@ -98,13 +98,23 @@ def process(in_fn, out_fn):
         if sig.name == "CHECKSUM_PEDAL" and sig.size != 8:
           sys.exit("%s: PEDAL CHECKSUM is not 8 bits long" % dbc_msg_name)
 
+  # the generated decoders write all signals of a message into fixed size arrays
+  for address, msg_name, _, sigs in msgs:
+    if len(sigs) > 64:
+      sys.exit("%s: %s has more than 64 signals" % (dbc_name, msg_name))
+
+  # messages with a signal past the first 8 bytes are decoded one signal at a time
+  def msb(sig):
+    return sig.start_bit + sig.size if sig.is_little_endian else (sig.start_bit//8)*8 + (-sig.start_bit-1) % 8 + sig.size
+  decodable = {address for address, _, _, sigs in msgs if all(msb(sig) <= 64 for sig in sigs)}
+
   # Fail on duplicate message names
   c = Counter([msg_name for address, msg_name, msg_size, sigs in msgs])
   for name, count in c.items():
     if count > 1:
       sys.exit("%s: Duplicate message name in DBC file %s" % (dbc_name, name))
 
-  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals, len=len)
+  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals, decodable=decodable, len=len)
 
   with open(out_fn, "a+") as out_f:
     out_f.seek(0)
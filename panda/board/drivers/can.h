@@ -15,6 +15,7 @@ typedef struct {
 #define BUS_MAX 4U
 
 uint32_t can_rx_errs = 0;
+uint32_t can_rx_overflow = 0;
 uint32_t can_send_errs = 0;
 uint32_t can_fwd_errs = 0;
 uint32_t gmlan_send_errs = 0;
@@ -28,6 +29,10 @@ extern int can_silent;
 extern uint32_t can_speed[4];
 
 void can_set_forwarding(int from, int to);
+// off passes everything, on also drops all the standard ids until they are allowed
+void can_rx_filter_clear(uint8_t bus_number, bool enabled);
+// allows the standard ids chunk * 16 to chunk * 16 + 15 with a bit set in bits
+void can_rx_filter_allow(uint8_t bus_number, uint8_t chunk, uint16_t bits);
 
 bool can_init(uint8_t can_number);
 void can_init_all(void);
@@ -64,6 +69,39 @@ can_buffer(txgmlan_q, 0x100)
 // cppcheck-suppress misra-c2012-9.3
 can_ring *can_queues[] = {&can_tx1_q, &can_tx2_q, &can_tx3_q, &can_txgmlan_q};
 
+// RX filter: of a bus with it on only the allowed standard ids go to USB, a bit per id. Dropped frames
+// still reach forwarding, safety and the ignition hook. Extended ids and the returned TX frames pass
+#define CAN_RX_FILTER_WORDS (0x800U / 32U)
+uint32_t can_rx_filter[BUS_MAX][CAN_RX_FILTER_WORDS];
+bool can_rx_filter_enabled[BUS_MAX] = {false, false, false, false};
+uint32_t can_rx_filtered_cnt = 0U;
+
+void can_rx_filter_clear(uint8_t bus_number, bool enabled) {
+  if (bus_number < BUS_MAX) {
+    can_rx_filter_enabled[bus_number] = false;
+    for (uint8_t i = 0U; i < CAN_RX_FILTER_WORDS; i++) {
+      can_rx_filter[bus_number][i] = 0U;
+    }
+    can_rx_filter_enabled[bus_number] = enabled;
+  }
+}
+
+void can_rx_filter_allow(uint8_t bus_number, uint8_t chunk, uint16_t bits) {
+  if ((bus_number < BUS_MAX) && (chunk < (CAN_RX_FILTER_WORDS * 2U))) {
+    uint8_t shift = (chunk & 1U) * 16U;
+    can_rx_filter[bus_number][chunk / 2U] |= ((uint32_t)bits) << shift;
+  }
+}
+
+bool can_rx_filter_pass(uint8_t bus_number, CAN_FIFOMailBox_TypeDef *msg) {
+  bool pass = true;
+  if ((bus_number < BUS_MAX) && can_rx_filter_enabled[bus_number] && ((msg->RIR & 4U) == 0U)) {
+    uint32_t addr = msg->RIR >> 21;
+    pass = ((can_rx_filter[bus_number][addr / 32U] >> (addr % 32U)) & 1U) != 0U;
+  }
+  return pass;
+}
+
 // global CAN stats
 int can_rx_cnt = 0;
 int can_tx_cnt = 0;
@@ -71,6 +109,12 @@ int can_txd_cnt = 0;
 int can_err_cnt = 0;
 int can_overflow_cnt = 0;
 
+// the top half of RDTR, the bus' own time stamp counts bit times. Ours is the low 16 bits of the
+// microsecond timer, the same on every bus, and boardd maps it to its own clock
+uint32_t can_timestamp(void) {
+  return (microsecond_timer_get() & 0xFFFFU) << 16;
+}
+
 // ********************* interrupt safe queue *********************
 bool can_pop(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
   bool ret = 0;
@@ -108,6 +152,9 @@ bool can_push(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
   EXIT_CRITICAL();
   if (!ret) {
     can_overflow_cnt++;
+    if (q == &can_rx_q) {
+      can_rx_overflow++;
+    }
     #ifdef DEBUG
       puts("can_push failed!\n");
     #endif
@@ -282,7 +329,7 @@ void process_can(uint8_t can_number) {
         if ((CAN->TSR & CAN_TSR_TXOK0) == CAN_TSR_TXOK0) {
           CAN_FIFOMailBox_TypeDef to_push;
           to_push.RIR = CAN->sTxMailBox[0].TIR;
-          to_push.RDTR = (CAN->sTxMailBox[0].TDTR & 0xFFFF000FU) | ((CAN_BUS_RET_FLAG | bus_number) << 4);
+          to_push.RDTR = (CAN->sTxMailBox[0].TDTR & 0x0000000FU) | ((CAN_BUS_RET_FLAG | bus_number) << 4) | can_timestamp();
           to_push.RDLR = CAN->sTxMailBox[0].TDLR;
           to_push.RDHR = CAN->sTxMailBox[0].TDHR;
           can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
@@ -370,7 +417,7 @@ void can_rx(uint8_t can_number) {
     to_push.RDHR = CAN->sFIFOMailBox[0].RDHR;
 
     // modify RDTR for our API
-    to_push.RDTR = (to_push.RDTR & 0xFFFF000F) | (bus_number << 4);
+    to_push.RDTR = (to_push.RDTR & 0x0000000FU) | (bus_number << 4) | can_timestamp();
 
     // forwarding (panda only)
     int bus_fwd_num = (can_forwarding[bus_number] != -1) ? can_forwarding[bus_number] : safety_fwd_hook(bus_number, &to_push);
@@ -391,8 +438,12 @@ void can_rx(uint8_t can_number) {
     can_rx_errs += safety_rx_hook(&to_push) ? 0U : 1U;
     ignition_can_hook(&to_push);
 
-    current_board->set_led(LED_BLUE, true);
-    can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    if (can_rx_filter_pass(bus_number, &to_push)) {
+      current_board->set_led(LED_BLUE, true);
+      can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    } else {
+      can_rx_filtered_cnt += 1U;
+    }
 
     // next
     CAN->RF0R |= CAN_RF0R_RFOM0;
@@ -89,6 +89,24 @@ bool getc(uart_ring *q, char *elem) {
   return ret;
 }
 
+// Copies up to len bytes of the RX buffer to dst, the ring's part up to its end and then the part from
+// its start. The bytes of a DMA ring are copied straight out of the buffer the DMA writes
+uint32_t uart_read(uart_ring *q, uint8_t *dst, uint32_t len) {
+  uint32_t n = 0U;
+
+  ENTER_CRITICAL();
+  while ((n < len) && (q->w_ptr_rx != q->r_ptr_rx)) {
+    uint32_t end = (q->w_ptr_rx > q->r_ptr_rx) ? q->w_ptr_rx : q->rx_fifo_size;
+    uint32_t chunk = MIN(end - q->r_ptr_rx, len - n);
+    (void)memcpy(&dst[n], &q->elems_rx[q->r_ptr_rx], chunk);
+    n += chunk;
+    q->r_ptr_rx = (q->r_ptr_rx + chunk) % q->rx_fifo_size;
+  }
+  EXIT_CRITICAL();
+
+  return n;
+}
+
 bool injectc(uart_ring *q, char elem) {
   int ret = false;
   uint16_t next_w_ptr;
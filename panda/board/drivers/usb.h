@@ -874,7 +874,11 @@ void usb_irqhandler(void) {
           puts("  IN PACKET QUEUE\n");
           #endif
           // TODO: always assuming max len, can we get the length?
-          USB_WritePacket((void *)resp, usb_cb_ep1_in(resp, 0x40, 1), 1);
+          int len = usb_cb_ep1_in(resp, 0x40, 1);
+          // negative while batching, the IN request is NAKed and comes again
+          if (len >= 0) {
+            USB_WritePacket((void *)resp, len, 1);
+          }
         }
         break;
 
@@ -39,6 +39,7 @@ struct __attribute__((packed)) health_t {
   uint8_t fault_status_pkt;
   uint8_t power_save_enabled_pkt;
   uint8_t heartbeat_lost_pkt;
+  uint32_t can_rx_overflow_pkt;
 };
 
 
@@ -138,6 +139,10 @@ void set_safety_mode(uint16_t mode, int16_t param) {
       can_silent = ALL_CAN_LIVE;
       break;
   }
+  // a filter is for the messages of a car, it's set again after the car's safety mode
+  for (uint8_t i = 0U; i < BUS_MAX; i++) {
+    can_rx_filter_clear(i, false);
+  }
   can_init_all();
 }
 
@@ -173,6 +178,7 @@ int get_health_pkt(void *dat) {
   health->safety_param_pkt = current_safety_param;
   health->power_save_enabled_pkt = (uint8_t)(power_save_status == POWER_SAVE_STATUS_ENABLED);
   health->heartbeat_lost_pkt = (uint8_t)(heartbeat_lost);
+  health->can_rx_overflow_pkt = can_rx_overflow;
 
   health->fault_status_pkt = fault_status;
   health->faults_pkt = faults;
@@ -186,14 +192,40 @@ int get_rtc_pkt(void *dat) {
   return sizeof(t);
 }
 
+// CAN RX batching: a packet that isn't full is held back for up to can_rx_batch_us after the
+// first IN request that could have sent it, so the host gets full packets instead of a short
+// transfer per frame. 0 sends right away
+uint32_t can_rx_batch_us = 0U;
+uint32_t can_rx_hold_start = 0U;
+bool can_rx_holding = false;
+
+// returns -1 to NAK the IN request, the host asks again
 int usb_cb_ep1_in(void *usbdata, int len, bool hardwired) {
   UNUSED(hardwired);
   CAN_FIFOMailBox_TypeDef *reply = (CAN_FIFOMailBox_TypeDef *)usbdata;
+  int max_frames = MIN(len/0x10, 4);
   int ilen = 0;
-  while (ilen < MIN(len/0x10, 4) && can_pop(&can_rx_q, &reply[ilen])) {
-    ilen++;
+  bool hold = false;
+
+  if (can_rx_batch_us != 0U) {
+    uint32_t queued = can_rx_q.fifo_size - 1U - can_slots_empty(&can_rx_q);
+    if ((queued > 0U) && (queued < (uint32_t)max_frames)) {
+      uint32_t ts = microsecond_timer_get();
+      if (!can_rx_holding) {
+        can_rx_holding = true;
+        can_rx_hold_start = ts;
+      }
+      hold = get_ts_elapsed(ts, can_rx_hold_start) < can_rx_batch_us;
+    }
+  }
+
+  if (!hold) {
+    can_rx_holding = false;
+    while ((ilen < max_frames) && can_pop(&can_rx_q, &reply[ilen])) {
+      ilen++;
+    }
   }
-  return ilen*0x10;
+  return hold ? -1 : (ilen*0x10);
 }
 
 // send on serial, first byte to select the ring
@@ -489,10 +521,7 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
       }
 
       // read
-      while ((resp_len < MIN(setup->b.wLength.w, MAX_RESP_LEN)) &&
-                         getc(ur, (char*)&resp[resp_len])) {
-        ++resp_len;
-      }
+      resp_len = uart_read(ur, resp, MIN(setup->b.wLength.w, MAX_RESP_LEN));
       break;
     // **** 0xe1: uart set baud rate
     case 0xe1:
@@ -611,6 +640,29 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
     case 0xf7:
       green_led_enabled = (setup->b.wValue.w != 0U);
       break;
+    // **** 0xf9: set CAN RX batching timeout in us, 0 disables
+    case 0xf9:
+      can_rx_batch_us = setup->b.wValue.w;
+      can_rx_holding = false;
+      break;
+    // **** 0xfa: get microsecond timer, for boardd's clock sync
+    case 0xfa:
+      {
+        uint32_t ts = microsecond_timer_get();
+        (void)memcpy(resp, &ts, sizeof(ts));
+        resp_len = sizeof(ts);
+        break;
+      }
+    // **** 0xfb: set the CAN RX filter of a bus, see can_rx_filter
+    // wValue = bus, wIndex = 0 to pass everything, 1 to drop all the standard ids until they are allowed
+    case 0xfb:
+      can_rx_filter_clear((uint8_t)setup->b.wValue.w, setup->b.wIndex.w != 0U);
+      break;
+    // **** 0xfc: allow standard ids through the CAN RX filter
+    // wValue = bus | (chunk << 8), wIndex = bits of the ids chunk * 16 to chunk * 16 + 15
+    case 0xfc:
+      can_rx_filter_allow((uint8_t)(setup->b.wValue.w & 0xFFU), (uint8_t)(setup->b.wValue.w >> 8), setup->b.wIndex.w);
+      break;
 #ifdef ALLOW_DEBUG
     // **** 0xf8: disable heartbeat checks
     case 0xf8:
@@ -76,16 +76,117 @@ void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   }
 }
 
+// ********************* address lookup *********************
+// The TX whitelist and RX check lists are hashed by (address, bus), so the per frame checks don't
+// scan them. The RX table is built by set_safety_hooks and rebuilt if a hook checks against
+// another list. Hooks pick their TX list at runtime, there is a table for each of the last
+// SAFETY_TX_LOOKUPS lists. Entries with the same key keep the list order along their probe chain,
+// lookups find the same entry the scan would. Lists that fill more than half the table, or have
+// buses above 3, are scanned like before
+SafetyLookup tx_lookups[SAFETY_TX_LOOKUPS];
+uint32_t tx_lookup_next = 0U;
+SafetyLookup rx_lookup = {.list = NULL, .list_len = 0, .usable = false};
+
+uint32_t safety_lookup_key(int addr, int bus) {
+  return ((uint32_t)addr << 2) | ((uint32_t)bus & 3U);
+}
+
+uint32_t safety_lookup_slot(uint32_t key) {
+  // Fibonacci hashing, the top 6 bits for 64 slots
+  return (key * 2654435761U) >> 26;
+}
+
+void safety_lookup_clear(SafetyLookup *lookup, const void *list, int list_len) {
+  lookup->list = list;
+  lookup->list_len = list_len;
+  lookup->usable = true;
+  for (uint32_t i = 0U; i < SAFETY_LOOKUP_SIZE; i++) {
+    lookup->entries[i].key = SAFETY_LOOKUP_EMPTY;
+  }
+}
+
+void safety_lookup_insert(SafetyLookup *lookup, int count, int addr, int bus, int index, int msg, int len) {
+  if ((count >= (int)(SAFETY_LOOKUP_SIZE / 2U)) || (bus < 0) || (bus > 3) || (addr < 0)) {
+    lookup->usable = false;
+  } else {
+    uint32_t key = safety_lookup_key(addr, bus);
+    uint32_t slot = safety_lookup_slot(key);
+    while (lookup->entries[slot].key != SAFETY_LOOKUP_EMPTY) {
+      slot = (slot + 1U) & (SAFETY_LOOKUP_SIZE - 1U);
+    }
+    lookup->entries[slot].key = key;
+    lookup->entries[slot].index = (uint8_t)index;
+    lookup->entries[slot].msg = (uint8_t)msg;
+    lookup->entries[slot].len = (uint8_t)len;
+  }
+}
+
+void safety_lookup_build_tx(SafetyLookup *lookup, const CanMsg msg_list[], int len) {
+  ENTER_CRITICAL();
+  safety_lookup_clear(lookup, msg_list, len);
+  for (int i = 0; i < len; i++) {
+    safety_lookup_insert(lookup, i, msg_list[i].addr, msg_list[i].bus, i, 0, msg_list[i].len);
+  }
+  EXIT_CRITICAL();
+}
+
+// the table of msg_list, built in place of the oldest one the first time the list is checked
+const SafetyLookup *safety_lookup_tx(const CanMsg msg_list[], int len) {
+  const SafetyLookup *found = NULL;
+  for (uint32_t i = 0U; i < SAFETY_TX_LOOKUPS; i++) {
+    if ((tx_lookups[i].list == (const void *)msg_list) && (tx_lookups[i].list_len == len)) {
+      found = &tx_lookups[i];
+      break;
+    }
+  }
+  if (found == NULL) {
+    SafetyLookup *lookup = &tx_lookups[tx_lookup_next];
+    tx_lookup_next = (tx_lookup_next + 1U) % SAFETY_TX_LOOKUPS;
+    safety_lookup_build_tx(lookup, msg_list, len);
+    found = lookup;
+  }
+  return found;
+}
+
+void safety_lookup_build_rx(AddrCheckStruct addr_list[], int len) {
+  ENTER_CRITICAL();
+  safety_lookup_clear(&rx_lookup, addr_list, len);
+  int count = 0;
+  for (int i = 0; i < len; i++) {
+    for (int j = 0; addr_list[i].msg[j].addr != 0; j++) {
+      safety_lookup_insert(&rx_lookup, count, addr_list[i].msg[j].addr, addr_list[i].msg[j].bus, i, j, addr_list[i].msg[j].len);
+      count++;
+    }
+  }
+  EXIT_CRITICAL();
+}
+
 bool msg_allowed(CAN_FIFOMailBox_TypeDef *to_send, const CanMsg msg_list[], int len) {
   int addr = GET_ADDR(to_send);
   int bus = GET_BUS(to_send);
   int length = GET_LEN(to_send);
 
+  const SafetyLookup *tx_lookup = safety_lookup_tx(msg_list, len);
+
   bool allowed = false;
-  for (int i = 0; i < len; i++) {
-    if ((addr == msg_list[i].addr) && (bus == msg_list[i].bus) && (length == msg_list[i].len)) {
-      allowed = true;
-      break;
+  if (tx_lookup->usable) {
+    if (bus <= 3) {
+      uint32_t key = safety_lookup_key(addr, bus);
+      uint32_t slot = safety_lookup_slot(key);
+      while (tx_lookup->entries[slot].key != SAFETY_LOOKUP_EMPTY) {
+        if ((tx_lookup->entries[slot].key == key) && (tx_lookup->entries[slot].len == (uint8_t)length)) {
+          allowed = true;
+          break;
+        }
+        slot = (slot + 1U) & (SAFETY_LOOKUP_SIZE - 1U);
+      }
+    }
+  } else {
+    for (int i = 0; i < len; i++) {
+      if ((addr == msg_list[i].addr) && (bus == msg_list[i].bus) && (length == msg_list[i].len)) {
+        allowed = true;
+        break;
+      }
     }
   }
   return allowed;
@@ -102,25 +203,54 @@ int get_addr_check_index(CAN_FIFOMailBox_TypeDef *to_push, AddrCheckStruct addr_
   int addr = GET_ADDR(to_push);
   int length = GET_LEN(to_push);
 
+  if ((rx_lookup.list != (const void *)addr_list) || (rx_lookup.list_len != len)) {
+    safety_lookup_build_rx(addr_list, len);
+  }
+
   int index = -1;
-  for (int i = 0; i < len; i++) {
-    // if multiple msgs are allowed, determine which one is present on the bus
-    if (!addr_list[i].msg_seen) {
-      for (uint8_t j = 0U; addr_list[i].msg[j].addr != 0; j++) {
-        if ((addr == addr_list[i].msg[j].addr) && (bus == addr_list[i].msg[j].bus) &&
-              (length == addr_list[i].msg[j].len)) {
-          addr_list[i].index = j;
-          addr_list[i].msg_seen = true;
-          break;
+  if (rx_lookup.usable) {
+    if (bus <= 3) {
+      uint32_t key = safety_lookup_key(addr, bus);
+      uint32_t slot = safety_lookup_slot(key);
+      while (rx_lookup.entries[slot].key != SAFETY_LOOKUP_EMPTY) {
+        const SafetyLookupEntry *e = &rx_lookup.entries[slot];
+        if ((e->key == key) && (e->len == (uint8_t)length)) {
+          // the first of the entry's messages seen on the bus is the one it checks from then on
+          if (!addr_list[e->index].msg_seen) {
+            addr_list[e->index].index = e->msg;
+            addr_list[e->index].msg_seen = true;
+            index = e->index;
+            break;
+          } else if (addr_list[e->index].index == (int)e->msg) {
+            index = e->index;
+            break;
+          } else {
+            // another of the entry's messages was seen first
+          }
         }
+        slot = (slot + 1U) & (SAFETY_LOOKUP_SIZE - 1U);
       }
     }
+  } else {
+    for (int i = 0; i < len; i++) {
+      // if multiple msgs are allowed, determine which one is present on the bus
+      if (!addr_list[i].msg_seen) {
+        for (uint8_t j = 0U; addr_list[i].msg[j].addr != 0; j++) {
+          if ((addr == addr_list[i].msg[j].addr) && (bus == addr_list[i].msg[j].bus) &&
+                (length == addr_list[i].msg[j].len)) {
+            addr_list[i].index = j;
+            addr_list[i].msg_seen = true;
+            break;
+          }
+        }
+      }
 
-    int idx = addr_list[i].index;
-    if ((addr == addr_list[i].msg[idx].addr) && (bus == addr_list[i].msg[idx].bus) &&
-        (length == addr_list[i].msg[idx].len)) {
-      index = i;
-      break;
+      int idx = addr_list[i].index;
+      if ((addr == addr_list[i].msg[idx].addr) && (bus == addr_list[i].msg[idx].bus) &&
+          (length == addr_list[i].msg[idx].len)) {
+        index = i;
+        break;
+      }
     }
   }
   return index;
@@ -305,6 +435,13 @@ int set_safety_hooks(uint16_t mode, int16_t param) {
       safety_hook_registry[i].hooks->addr_check[j].msg_seen = false;
     }
   }
+  for (uint32_t i = 0U; i < SAFETY_TX_LOOKUPS; i++) {
+    tx_lookups[i].list = NULL;
+  }
+  tx_lookup_next = 0U;
+  if ((set_status == 0) && (current_hooks->addr_check != NULL)) {
+    safety_lookup_build_rx(current_hooks->addr_check, current_hooks->addr_check_len);
+  }
   if ((set_status == 0) && (current_hooks->init != NULL)) {
     current_hooks->init(param);
   }
@@ -43,6 +43,26 @@ typedef struct {
   bool lagging;                      // true if and only if the time between updates is excessive
 } AddrCheckStruct;
 
+// open addressed hash table from (address, bus) to the entries of a TX whitelist or RX check list
+#define SAFETY_LOOKUP_SIZE 64U
+#define SAFETY_LOOKUP_EMPTY 0xFFFFFFFFU
+// TX whitelists with a table of their own, hooks switch between up to 5 of them
+#define SAFETY_TX_LOOKUPS 5U
+
+typedef struct {
+  uint32_t key;                      // address << 2 | bus
+  uint8_t index;                     // entry of the list
+  uint8_t msg;                       // RX checks: which of the entry's messages
+  uint8_t len;
+} SafetyLookupEntry;
+
+typedef struct {
+  const void *list;                  // the list the table was built for
+  int list_len;
+  bool usable;                       // false if the list doesn't fit, it's scanned instead
+  SafetyLookupEntry entries[SAFETY_LOOKUP_SIZE];
+} SafetyLookup;
+
 int safety_rx_hook(CAN_FIFOMailBox_TypeDef *to_push);
 int safety_tx_hook(CAN_FIFOMailBox_TypeDef *to_send);
 int safety_tx_lin_hook(int lin_num, uint8_t *data, int len);
@@ -58,6 +78,9 @@ bool driver_limit_check(int val, int val_last, struct sample_t *val_driver,
 bool rt_rate_limit_check(int val, int val_last, const int MAX_RT_DELTA);
 float interpolate(struct lookup_t xy, float x);
 void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]);
+void safety_lookup_build_tx(SafetyLookup *lookup, const CanMsg msg_list[], int len);
+const SafetyLookup *safety_lookup_tx(const CanMsg msg_list[], int len);
+void safety_lookup_build_rx(AddrCheckStruct addr_list[], int len);
 bool msg_allowed(CAN_FIFOMailBox_TypeDef *to_send, const CanMsg msg_list[], int len);
 int get_addr_check_index(CAN_FIFOMailBox_TypeDef *to_push, AddrCheckStruct addr_list[], const int len);
 void update_counter(AddrCheckStruct addr_list[], int index, uint8_t counter);
@@ -335,8 +335,10 @@ class Panda(object):
   # ******************* health *******************
 
   def health(self):
-    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, 44)
-    a = struct.unpack("<IIIIIIIIBBBBBBBHBBB", dat)
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, 48)
+    # firmware from before can_rx_overflow sends 44 bytes
+    dat = bytes(dat).ljust(48, b"\x00")
+    a = struct.unpack("<IIIIIIIIBBBBBBBHBBBI", dat)
     return {
       "uptime": a[0],
       "voltage": a[1],
@@ -357,6 +359,7 @@ class Panda(object):
       "fault_status": a[16],
       "power_save_enabled": a[17],
       "heartbeat_lost": a[18],
+      "can_rx_overflow": a[19],
     }
 
   # ******************* control *******************
@@ -460,6 +463,19 @@ class Panda(object):
   def set_can_speed_kbps(self, bus, speed):
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xde, bus, int(speed * 10), b'')
 
+  def set_can_rx_filter(self, bus, addresses=None):
+    # only the standard ids in addresses reach USB from bus, extended ids always do. None passes all
+    if addresses is None:
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xfb, bus, 0, b'')
+      return
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xfb, bus, 1, b'')
+    chunks = {}
+    for addr in addresses:
+      if addr < 0x800:
+        chunks[addr // 16] = chunks.get(addr // 16, 0) | (1 << (addr % 16))
+    for chunk, bits in chunks.items():
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xfc, bus | (chunk << 8), bits, b'')
+
   def set_uart_baud(self, uart, rate):
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xe4, uart, int(rate / 300), b'')
 
@@ -630,6 +646,10 @@ class Panda(object):
   def send_heartbeat(self):
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xf3, 0, 0, b'')
 
+  # hold back CAN RX packets that aren't full for up to us microseconds, 0 disables
+  def set_can_rx_batch(self, us):
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xf9, int(us), 0, b'')
+
   # disable heartbeat checks for use outside of openpilot
   # sending a heartbeat will reenable the checks
   def set_heartbeat_disabled(self):
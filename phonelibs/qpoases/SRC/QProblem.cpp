@@ -842,11 +842,11 @@ returnValue QProblem::solveInitialQP(	const real_t* const xOpt, const real_t* co
 
 	/* 3) Obtain linear independent working set for auxiliary QP. */
 
-	static Bounds auxiliaryBounds;
+	static thread_local Bounds auxiliaryBounds;
 
 	auxiliaryBounds.init( nV );
 
-	static Constraints auxiliaryConstraints;
+	static thread_local Constraints auxiliaryConstraints;
 
 	auxiliaryConstraints.init( nC );
 
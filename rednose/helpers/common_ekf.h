@@ -30,6 +30,10 @@ struct EKF {
   std::unordered_map<int, void (*)(double *, double *, double *)> Hes = {};
   std::unordered_map<std::string, void (*)(double)> sets = {};
   std::unordered_map<std::string, extra_routine_t> extra_routines = {};
+
+  // f with F and h with H in one routine sharing their subexpressions, only generated with cse
+  void (*fF_fun)(double *, double, double *, double *) = NULL;
+  std::unordered_map<int, void (*)(double *, double *, double *, double *)> hHs = {};
 };
 
 std::vector<const EKF*>& get_ekfs();
@@ -39,6 +39,7 @@ EKFSym::EKFSym(std::string name, Map<MatrixXdr> Q, Map<VectorXd> x_initial, Map<
   this->Q = Q;
 
   this->max_rewind_age = max_rewind_age;
+  this->rewound.resize(REWIND_TO_KEEP);
   this->init_state(x_initial, P_initial, NAN);
 }
 
@@ -85,9 +86,9 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
 {
   // TODO handle rewinding at this level
 
-  std::deque<Observation> rewound;
+  Span<Observation> rewound = {this->rewound.data(), 0};
   if (!std::isnan(this->filter_time) && t < this->filter_time) {
-    if (this->rewind_t.empty() || t < this->rewind_t.front() || t < this->rewind_t.back() - this->max_rewind_age) {
+    if (this->rewind_buf.empty() || t < this->rewind_buf.front().t || t < this->rewind_buf.back().t - this->max_rewind_age) {
       std::cout << "observation too old at " << t << " with filter at " << this->filter_time << ", ignoring" << std::endl;
       return std::nullopt;
     }
@@ -108,51 +109,45 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
   std::optional<Estimate> res = std::make_optional(this->predict_and_update_batch(obs, augment));
 
   // optional fast forward
-  while (!rewound.empty()) {
-    this->predict_and_update_batch(rewound.front(), false);
-    rewound.pop_front();
+  for (Observation& o : rewound) {
+    this->predict_and_update_batch(o, false);
   }
 
   return res;
 }
 
 void EKFSym::reset_rewind() {
-  this->rewind_obscache.clear();
-  this->rewind_t.clear();
-  this->rewind_states.clear();
+  this->rewind_buf.clear();
 }
 
-std::deque<Observation> EKFSym::rewind(double t) {
-  std::deque<Observation> rewound;
-
+Span<Observation> EKFSym::rewind(double t) {
   // rewind observations until t is after previous observation
-  while (this->rewind_t.back() > t) {
-    rewound.push_front(this->rewind_obscache.back());
-    this->rewind_t.pop_back();
-    this->rewind_states.pop_back();
-    this->rewind_obscache.pop_back();
+  int n = 0;
+  while (this->rewind_buf.back().t > t) {
+    this->rewind_buf.pop_back();
+    n++;
+  }
+
+  // their slots get reused by the checkpoints of the fast forward, so they are copied out
+  for (int i = 0; i < n; i++) {
+    this->rewound[i] = this->rewind_buf[this->rewind_buf.size() + i].obs;
   }
 
   // set the state to the time right before that
-  this->filter_time = this->rewind_t.back();
-  this->x = this->rewind_states.back().first;
-  this->P = this->rewind_states.back().second;
+  this->filter_time = this->rewind_buf.back().t;
+  this->x = this->rewind_buf.back().x;
+  this->P = this->rewind_buf.back().P;
 
-  return rewound;
+  return {this->rewound.data(), n};
 }
 
 void EKFSym::checkpoint(Observation& obs) {
-  // push to rewinder
-  this->rewind_t.push_back(this->filter_time);
-  this->rewind_states.push_back(std::make_pair(this->x, this->P));
-  this->rewind_obscache.push_back(obs);
-
-  // only keep a certain number around
-  if (this->rewind_t.size() > REWIND_TO_KEEP) {
-    this->rewind_t.pop_front();
-    this->rewind_states.pop_front();
-    this->rewind_obscache.pop_front();
-  }
+  // push to rewinder, only a certain number are kept around
+  Checkpoint& c = this->rewind_buf.push_back();
+  c.t = this->filter_time;
+  c.x = this->x;
+  c.P = this->P;
+  c.obs = obs;
 }
 
 Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment) {
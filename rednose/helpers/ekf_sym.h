@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <memory>
 #include <unordered_map>
 #include <map>
 #include <cmath>
@@ -20,6 +21,52 @@ namespace EKFS {
 
 typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixXdr;
 
+// ring of the last REWIND_TO_KEEP checkpoints. The slots are allocated once and reused, a push
+// overwrites the oldest slot when full, so a checkpoint copies into storage that already has
+// the right size instead of allocating
+template <typename T, typename Alloc = std::allocator<T>>
+class RewindBuffer {
+public:
+  RewindBuffer() : slots(REWIND_TO_KEEP) {}
+
+  int size() const { return this->count; }
+  bool empty() const { return this->count == 0; }
+  void clear() { this->start = this->count = 0; }
+
+  // i from the oldest to the newest
+  T& operator[](int i) { return this->slots[(this->start + i) % REWIND_TO_KEEP]; }
+  T& front() { return (*this)[0]; }
+  T& back() { return (*this)[this->count - 1]; }
+
+  // the slot for a new checkpoint, its old content is there to be overwritten
+  T& push_back() {
+    if (this->count == REWIND_TO_KEEP) {
+      this->start = (this->start + 1) % REWIND_TO_KEEP;
+      this->count--;
+    }
+    this->count++;
+    return this->back();
+  }
+  void pop_back() { this->count--; }
+
+private:
+  std::vector<T, Alloc> slots;
+  int start = 0;
+  int count = 0;
+};
+
+// view of contiguous elements owned by someone else
+template <typename T>
+struct Span {
+  T *first;
+  int n;
+
+  T *begin() const { return this->first; }
+  T *end() const { return this->first + this->n; }
+  int size() const { return this->n; }
+  bool empty() const { return this->n == 0; }
+};
+
 typedef struct Observation {
   double t;
   int kind;
@@ -65,7 +112,7 @@ public:
   extra_routine_t get_extra_routine(const std::string& routine);
 
 private:
-  std::deque<Observation> rewind(double t);
+  Span<Observation> rewind(double t);
   void checkpoint(Observation& obs);
 
   Estimate predict_and_update_batch(Observation& obs, bool augment);
@@ -100,9 +147,15 @@ private:
 
   // rewind stuff
   double max_rewind_age;
-  std::deque<double> rewind_t;
-  std::deque<std::pair<Eigen::VectorXd, MatrixXdr>> rewind_states;
-  std::deque<Observation> rewind_obscache;
+  struct Checkpoint {
+    double t;
+    Eigen::VectorXd x;
+    MatrixXdr P;
+    Observation obs;
+  };
+  RewindBuffer<Checkpoint> rewind_buf;
+  // the observations taken out by rewind, until they are fast forwarded
+  std::vector<Observation> rewound;
 
   Eigen::VectorXd augment_times;
 
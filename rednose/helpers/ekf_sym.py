@@ -27,7 +27,10 @@ def null(H, eps=1e-12):
 
 
 def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_params=None, msckf_params=None,  # pylint: disable=dangerous-default-value
-             maha_test_kinds=[], quaternion_idxs=[], global_vars=None, extra_routines=[]):
+             maha_test_kinds=[], quaternion_idxs=[], global_vars=None, extra_routines=[], cse=False):
+  # cse adds routines computing f with F, and h with H of every kind, with their
+  # common subexpressions eliminated, used by predict and update instead of the separate ones
+
   # optional state transition matrix, H modifier
   # and err_function if an error-state kalman filter (ESKF)
   # is desired. Best described in "Quaternion kinematics
@@ -112,8 +115,17 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
     if msckf and kind in feature_track_kinds:
       sympy_functions.append(('He_%d' % kind, He_sym, [x_sym, ea_sym]))
 
+  if cse:
+    out_f = sp.MatrixSymbol('out_f', *f_sym.shape)
+    out_F = sp.MatrixSymbol('out_F', *F_sym.shape)
+    sympy_functions.append(('fF_fun', [sp.Eq(out_f, f_sym), sp.Eq(out_F, F_sym)], [x_sym, dt_sym]))
+    for h_sym, kind, ea_sym, H_sym, He_sym in obs_eqs:
+      out_h = sp.MatrixSymbol('out_h', *h_sym.shape)
+      out_H = sp.MatrixSymbol('out_H', *H_sym.shape)
+      sympy_functions.append(('hH_%d' % kind, [sp.Eq(out_h, h_sym), sp.Eq(out_H, H_sym)], [x_sym, ea_sym]))
+
   # Generate and wrap all th c code
-  sympy_header, code = sympy_into_c(sympy_functions, global_vars)
+  sympy_header, code = sympy_into_c(sympy_functions, global_vars, cse)
 
   header = "#pragma once\n"
   header += "#include \"rednose/helpers/common_ekf.h\"\n"
@@ -125,6 +137,9 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
   pre_code += "#define EDIM %d\n" % dim_err
   pre_code += "#define MEDIM %d\n" % dim_main_err
   pre_code += "typedef void (*Hfun)(double *, double *, double *);\n"
+  pre_code += "typedef void (*HHfun)(double *, double *, double *, double *);\n"
+  if cse:
+    pre_code += "#define EKF_FUSED\n"
 
   if global_vars is not None:
     for var in global_vars:
@@ -146,9 +161,15 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
 
     pre_code += f"const static double MAHA_THRESH_{kind} = {maha_thresh};\n"
 
+    # the error state columns H * H_mod can have nonzero, most observations are of a few states
+    H_cols = [i for i in range(dim_x) if any(H_sym[r, i] != 0 for r in range(H_sym.shape[0]))]
+    H_err_cols = [j for j in range(dim_err) if any(H_mod_sym[i, j] != 0 for i in H_cols)] or list(range(dim_err))
+    pre_code += f"const static int H_COLS_{kind}[{len(H_err_cols)}] = {{{', '.join(map(str, H_err_cols))}}};\n"
+
     header += f"void {name}_update_{kind}(double *in_x, double *in_P, double *in_z, double *in_R, double *in_ea);\n"
     post_code += f"void {name}_update_{kind}(double *in_x, double *in_P, double *in_z, double *in_R, double *in_ea) {{\n"
-    post_code += f"  update<{h_sym.shape[0]}, 3, {int(maha_test)}>(in_x, in_P, h_{kind}, H_{kind}, {He_str}, in_z, in_R, in_ea, MAHA_THRESH_{kind});\n"
+    hH_str = f'hH_{kind}' if cse else 'NULL'
+    post_code += f"  update<{h_sym.shape[0]}, 3, {int(maha_test)}, {len(H_err_cols)}>(in_x, in_P, h_{kind}, H_{kind}, {He_str}, in_z, in_R, in_ea, MAHA_THRESH_{kind}, H_COLS_{kind}, {hH_str});\n"
     post_code += "}\n"
 
   # For ffi loading of specific functions
@@ -199,6 +220,12 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
   for f in func_extra:
     post_code += f"    {{ \"{f}\", {name}_{f} }},\n"
   post_code += "  },\n"
+  if cse:
+    post_code += f"  .fF_fun = {name}_fF_fun,\n"
+    post_code += "  .hHs = {\n"
+    for _, kind, _, _, _ in obs_eqs:
+      post_code += f"    {{ {kind}, {name}_hH_{kind} }},\n"
+    post_code += "  },\n"
   post_code += "};\n\n"
   post_code += f"ekf_init({name});\n"
 
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <optional>
+
+#include <eigen3/Eigen/Dense>
+
+#include "common_ekf.h"
+#include "ekf_sym.h"
+
+namespace EKFS {
+
+// EKFSym with the state and covariance dimensions known at compile time, for filters without
+// augmented states (msckf) or extra args, like the live filter of locationd. The state, the
+// covariance and the observations are fixed size or have a fixed max size, and the rewind buffer
+// is allocated once, so an update does no heap allocations.
+template <int DIM_X, int DIM_ERR, int MAX_Z = 6, int MAX_BATCH = 4>
+class EKFSymFixed {
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef Eigen::Matrix<double, DIM_X, 1> VectorX;
+  typedef Eigen::Matrix<double, DIM_ERR, DIM_ERR, Eigen::RowMajor> MatrixP;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, MAX_Z, 1> VectorZ;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor, MAX_Z, MAX_Z> MatrixR;
+
+  struct Observation {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    double t;
+    int kind;
+    int n;
+    VectorZ z[MAX_BATCH];
+    MatrixR R[MAX_BATCH];
+  };
+
+  struct Estimate {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    VectorX xk1;
+    VectorX xk;
+    MatrixP Pk1;
+    MatrixP Pk;
+    double t;
+    int kind;
+    int n;
+    VectorZ y[MAX_BATCH];
+    VectorZ z[MAX_BATCH];
+  };
+
+  EKFSymFixed(std::string name, Eigen::Map<MatrixXdr> Q, Eigen::Map<Eigen::VectorXd> x_initial,
+      Eigen::Map<MatrixXdr> P_initial, std::vector<int> quaternion_idxs = std::vector<int>(),
+      double max_rewind_age = 1.0) {
+    this->ekf = ekf_lookup(name);
+    assert(this->ekf);
+
+    assert(x_initial.rows() == DIM_X);
+    assert(P_initial.rows() == DIM_ERR && P_initial.cols() == DIM_ERR);
+    assert(Q.rows() == DIM_ERR && Q.cols() == DIM_ERR);
+
+    // quaternions need normalization
+    this->quaternion_idxs = quaternion_idxs;
+
+    // Process noise
+    this->Q = Q;
+
+    this->max_rewind_age = max_rewind_age;
+    this->rewound.resize(REWIND_TO_KEEP);
+    this->init_state(x_initial, P_initial, NAN);
+  }
+
+  void init_state(Eigen::Map<Eigen::VectorXd> state, Eigen::Map<MatrixXdr> covs, double filter_time) {
+    this->x = state;
+    this->P = covs;
+    this->filter_time = filter_time;
+    this->reset_rewind();
+  }
+
+  const VectorX& state() const { return this->x; }
+  const MatrixP& covs() const { return this->P; }
+  void set_filter_time(double t) { this->filter_time = t; }
+  double get_filter_time() const { return this->filter_time; }
+
+  void normalize_quaternions() {
+    for (int idx : this->quaternion_idxs) {
+      this->x.template segment<4>(idx).normalize();
+    }
+  }
+
+  void set_global(std::string global_var, double val) {
+    this->ekf->sets.at(global_var)(val);
+  }
+
+  void reset_rewind() {
+    this->rewind_buf.clear();
+  }
+
+  void predict(double t) {
+    // initialize time
+    if (std::isnan(this->filter_time)) {
+      this->filter_time = t;
+    }
+
+    // predict, observations at the time of the previous one need none
+    double dt = t - this->filter_time;
+    assert(dt >= 0.0);
+    if (dt == 0.0) {
+      return;
+    }
+
+    this->ekf->predict(this->x.data(), this->P.data(), this->Q.data(), dt);
+    this->normalize_quaternions();
+    this->filter_time = t;
+  }
+
+  // x and P predicted to t, the filter itself stays at its time
+  void predicted(double t, VectorX& x_out, MatrixP& P_out) {
+    x_out = this->x;
+    P_out = this->P;
+    double dt = t - this->filter_time;
+    if (std::isnan(dt) || dt <= 0.0) {
+      return;
+    }
+    this->ekf->predict(x_out.data(), P_out.data(), this->Q.data(), dt);
+    for (int idx : this->quaternion_idxs) {
+      x_out.template segment<4>(idx).normalize();
+    }
+  }
+
+  // z and R are any containers of Eigen vectors and matrices, like the std::vectors of EKFSym
+  template <typename ZList, typename RList>
+  std::optional<Estimate> predict_and_update_batch(double t, int kind, const ZList& z, const RList& R) {
+    assert(z.size() == R.size());
+    assert(z.size() <= MAX_BATCH);
+
+    Span<Observation> rewound = {this->rewound.data(), 0};
+    if (!std::isnan(this->filter_time) && t < this->filter_time) {
+      if (this->rewind_buf.empty() || t < this->rewind_buf.front().t || t < this->rewind_buf.back().t - this->max_rewind_age) {
+        std::cout << "observation too old at " << t << " with filter at " << this->filter_time << ", ignoring" << std::endl;
+        return std::nullopt;
+      }
+      rewound = this->rewind(t);
+    }
+
+    Observation obs;
+    obs.t = t;
+    obs.kind = kind;
+    obs.n = z.size();
+    int i = 0;
+    for (const auto& zi : z) obs.z[i++] = zi;
+    i = 0;
+    for (const auto& Ri : R) obs.R[i++] = Ri;
+
+    std::optional<Estimate> res = std::make_optional<Estimate>();
+    this->update_batch(obs, &(*res));
+
+    // optional fast forward
+    for (Observation& o : rewound) {
+      this->update_batch(o, NULL);
+    }
+
+    return res;
+  }
+
+  extra_routine_t get_extra_routine(const std::string& routine) {
+    return this->ekf->extra_routines.at(routine);
+  }
+
+private:
+  struct Checkpoint {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    double t;
+    VectorX x;
+    MatrixP P;
+    Observation obs;
+  };
+
+  // the observations after t, oldest first
+  Span<Observation> rewind(double t) {
+    // rewind observations until t is after previous observation
+    int n = 0;
+    while (this->rewind_buf.back().t > t) {
+      this->rewind_buf.pop_back();
+      n++;
+    }
+
+    // their slots get reused by the checkpoints of the fast forward, so they are copied out
+    for (int i = 0; i < n; i++) {
+      this->rewound[i] = this->rewind_buf[this->rewind_buf.size() + i].obs;
+    }
+
+    // set the state to the time right before that
+    this->filter_time = this->rewind_buf.back().t;
+    this->x = this->rewind_buf.back().x;
+    this->P = this->rewind_buf.back().P;
+
+    return {this->rewound.data(), n};
+  }
+
+  void checkpoint(const Observation& obs) {
+    // push to rewinder, only a certain number are kept around
+    Checkpoint& c = this->rewind_buf.push_back();
+    c.t = this->filter_time;
+    c.x = this->x;
+    c.P = this->P;
+    c.obs = obs;
+  }
+
+  void update_batch(Observation& obs, Estimate *res) {
+    this->predict(obs.t);
+
+    if (res) {
+      res->t = obs.t;
+      res->kind = obs.kind;
+      res->n = obs.n;
+      res->xk1 = this->x;
+      res->Pk1 = this->P;
+    }
+
+    // update batch
+    for (int i = 0; i < obs.n; i++) {
+      assert(obs.z[i].rows() == obs.R[i].rows());
+      assert(obs.z[i].rows() == obs.R[i].cols());
+
+      // update state
+      if (res) res->z[i] = obs.z[i];
+      this->ekf->updates.at(obs.kind)(this->x.data(), this->P.data(), obs.z[i].data(), obs.R[i].data(), NULL);
+      this->normalize_quaternions();
+      if (res) res->y[i] = obs.z[i];
+    }
+
+    if (res) {
+      res->xk = this->x;
+      res->Pk = this->P;
+    }
+
+    this->checkpoint(obs);
+  }
+
+  // stuct with linked sympy generated functions
+  const EKF *ekf = NULL;
+
+  VectorX x;  // state
+  MatrixP P;  // covs
+
+  double filter_time;
+
+  std::vector<int> quaternion_idxs;
+
+  // process noise
+  MatrixP Q;
+
+  // rewind stuff
+  double max_rewind_age;
+  RewindBuffer<Checkpoint, Eigen::aligned_allocator<Checkpoint>> rewind_buf;
+  std::vector<Observation, Eigen::aligned_allocator<Observation>> rewound;
+};
+
+}
@@ -112,11 +112,14 @@ def quat_matrix_r(p):
                     [p[3],  p[2], -p[1],  p[0]]])
 
 
-def sympy_into_c(sympy_functions, global_vars=None):
+def sympy_into_c(sympy_functions, global_vars=None, cse=False):
   from sympy.utilities import codegen
+  # with cse the common subexpressions of a routine are computed once into locals,
+  # a routine with a list of equalities shares them between all of its outputs
+  gen = codegen.C99CodeGen(project='ekf', cse=cse)
   routines = []
   for name, expr, args in sympy_functions:
-    r = codegen.make_routine(name, expr, language="C99", global_vars=global_vars)
+    r = gen.routine(name, expr, None, global_vars)
 
     # argument ordering input to sympy is broken with function with output arguments
     nargs = []
@@ -147,7 +150,7 @@ def sympy_into_c(sympy_functions, global_vars=None):
     # add routine to list
     routines.append(r)
 
-  [(_, c_code), (_, c_header)] = codegen.get_code_generator('C', 'ekf', 'C99').write(routines, "ekf")
+  [(_, c_code), (_, c_header)] = gen.write(routines, "ekf")
   c_header = '\n'.join(x for x in c_header.split("\n") if len(x) > 0 and x[0] != '#')
 
   c_code = '\n'.join(x for x in c_code.split("\n") if len(x) > 0 and x[0] != '#')
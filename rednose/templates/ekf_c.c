@@ -12,8 +12,12 @@ void predict(double *in_x, double *in_P, double *in_Q, double dt) {
   double in_F[EDIM*EDIM] = {0};
 
   // functions from sympy
+#ifdef EKF_FUSED
+  fF_fun(in_x, dt, nx, in_F);
+#else
   f_fun(in_x, dt, nx);
   F_fun(in_x, dt, in_F);
+#endif
 
 
   EEM F(in_F);
@@ -34,11 +38,15 @@ void predict(double *in_x, double *in_P, double *in_Q, double dt) {
 
 // note: extra_args dim only correct when null space projecting
 // otherwise 1
-template <int ZDIM, int EADIM, bool MAHA_TEST>
-void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, double *in_z, double *in_R, double *in_ea, double MAHA_THRESHOLD) {
+// cols are the NCOLS error state columns of H * H_mod that aren't zero, from gen_code. The
+// products with P are of the rows and columns of P they select, the rest of H contributes nothing
+template <int ZDIM, int EADIM, bool MAHA_TEST, int NCOLS>
+void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, double *in_z, double *in_R, double *in_ea, double MAHA_THRESHOLD,
+            const int *cols, HHfun hH_fun = NULL) {
   typedef Eigen::Matrix<double, ZDIM, ZDIM, Eigen::RowMajor> ZZM;
   typedef Eigen::Matrix<double, ZDIM, DIM, Eigen::RowMajor> ZDM;
   typedef Eigen::Matrix<double, Eigen::Dynamic, EDIM, Eigen::RowMajor> XEM;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, NCOLS> XCM;
   //typedef Eigen::Matrix<double, EDIM, ZDIM, Eigen::RowMajor> EZM;
   typedef Eigen::Matrix<double, Eigen::Dynamic, 1> X1M;
   typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> XXM;
@@ -56,8 +64,12 @@ void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, do
   ZZM pre_R(in_R);
 
   // functions from sympy
-  h_fun(in_x, in_ea, in_hx);
-  H_fun(in_x, in_ea, in_H);
+  if (hH_fun) {
+    hH_fun(in_x, in_ea, in_hx, in_H);
+  } else {
+    h_fun(in_x, in_ea, in_hx);
+    H_fun(in_x, in_ea, in_H);
+  }
   ZDM pre_H(in_H);
 
   // get y (y = z - hx)
@@ -79,14 +91,26 @@ void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, do
     H = pre_H;
     R = pre_R;
   }
-  // get modified H
+  // get modified H, of the columns that aren't zero
   H_mod_fun(in_x, in_H_mod);
   DEM H_mod(in_H_mod);
-  XEM H_err = H * H_mod;
+  Eigen::Matrix<double, DIM, NCOLS> H_mod_c;
+  for (int j = 0; j < NCOLS; j++) H_mod_c.col(j) = H_mod.col(cols[j]);
+  XCM H_err = H * H_mod_c;
+
+  // P(:, cols), P(cols, :) and P(cols, cols)
+  Eigen::Matrix<double, EDIM, NCOLS> P_c;
+  Eigen::Matrix<double, NCOLS, EDIM, Eigen::RowMajor> P_r;
+  Eigen::Matrix<double, NCOLS, NCOLS> P_cc;
+  for (int j = 0; j < NCOLS; j++) {
+    P_c.col(j) = P.col(cols[j]);
+    P_r.row(j) = P.row(cols[j]);
+  }
+  for (int i = 0; i < NCOLS; i++) P_cc.row(i) = P_c.row(cols[i]);
 
   // Do mahalobis distance test
   if (MAHA_TEST){
-    XXM a = (H_err * P * H_err.transpose() + R).inverse();
+    XXM a = (H_err * P_cc * H_err.transpose() + R).inverse();
     double maha_dist = y.transpose() * a * y;
     if (maha_dist > MAHA_THRESHOLD){
       R = 1.0e16 * R;
@@ -96,13 +120,9 @@ void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, do
   // Outlier resilient weighting
   double weight = 1;//(1.5)/(1 + y.squaredNorm()/R.sum());
 
-  // kalman gains and I_KH
-  XXM S = ((H_err * P) * H_err.transpose()) + R/weight;
-  XEM KT = S.fullPivLu().solve(H_err * P.transpose());
-  //EZM K = KT.transpose(); TODO: WHY DOES THIS NOT COMPILE?
-  //EZM K = S.fullPivLu().solve(H_err * P.transpose()).transpose();
-  //std::cout << "Here is the matrix rot:\n" << K << std::endl;
-  EEM I_KH = Eigen::Matrix<double, EDIM, EDIM>::Identity() - (KT.transpose() * H_err);
+  // kalman gains
+  XXM S = ((H_err * P_cc) * H_err.transpose()) + R/weight;
+  XEM KT = S.fullPivLu().solve(H_err * P_c.transpose());
 
   // update state by injecting dx
   Eigen::Matrix<double, EDIM, 1> dx(delta_x);
@@ -111,8 +131,11 @@ void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, do
   err_fun(in_x, delta_x, x_new);
   Eigen::Matrix<double, DIM, 1> x(x_new);
 
-  // update cov
-  P = ((I_KH * P) * I_KH.transpose()) + ((KT.transpose() * R) * KT);
+  // update cov, (I - KH) P (I - KH)^T + K R K^T with the columns of H that aren't zero
+  EEM A = P - KT.transpose() * (H_err * P_r);
+  Eigen::Matrix<double, EDIM, NCOLS> A_c;
+  for (int j = 0; j < NCOLS; j++) A_c.col(j) = A.col(cols[j]);
+  P = A - (A_c * H_err.transpose()) * KT + ((KT.transpose() * R) * KT);
 
   // copy out state
   memcpy(in_x, x.data(), DIM * sizeof(double));
@@ -12,20 +12,30 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <libusb-1.0/libusb.h>
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/alloc_tracker.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/sysfs.h"
 #include "selfdrive/common/timing.h"
+#include "selfdrive/common/trace.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/locationd/ublox_msg.h"
 
+#include "selfdrive/boardd/can_tx_scheduler.h"
 #include "selfdrive/boardd/panda.h"
 #include "selfdrive/boardd/pigeon.h"
 
@@ -35,7 +45,10 @@
 #define SATURATE_IL 1600
 #define NIBBLE_TO_HEX(n) ((n) < 10 ? (n) + '0' : ((n) - 10) + 'a')
 
+// panda is pandas[0], the one with the state, safety, hardware and GPS of boardd. The others
+// add their CAN buses, at bus_offset, to the same can and sendcan
 Panda * panda = nullptr;
+std::vector<Panda *> pandas;
 std::atomic<bool> safety_setter_thread_running(false);
 std::atomic<bool> ignition(false);
 
@@ -45,16 +58,37 @@ bool spoofing_started = false;
 bool fake_send = false;
 bool connected_once = false;
 
+// ms from a sendcan event to its frames written to the panda, reported in pandaState
+std::mutex send_latency_lock;
+std::vector<float> send_latencies;
+
+// one per panda, for its buses
+std::vector<std::unique_ptr<CanTxScheduler>> can_tx;
+
+// late 100hz cycles of can_recv_thread, reported in boarddStats
+std::atomic<uint32_t> missed_cycles(0);
+
+bool pandas_connected() {
+  for (Panda *p : pandas) {
+    if (!p->connected) return false;
+  }
+  return !pandas.empty();
+}
+
+void set_safety_model(cereal::CarParams::SafetyModel safety_model, int safety_param=0) {
+  for (Panda *p : pandas) p->set_safety_model(safety_model, safety_param);
+}
+
 void safety_setter_thread() {
   LOGD("Starting safety setter thread");
   // diagnostic only is the default, needed for VIN query
-  panda->set_safety_model(cereal::CarParams::SafetyModel::ELM327);
+  set_safety_model(cereal::CarParams::SafetyModel::ELM327);
 
   Params p = Params();
 
   // switch to SILENT when CarVin param is read
   while (true) {
-    if (do_exit || !panda->connected) {
+    if (do_exit || !pandas_connected()) {
       safety_setter_thread_running = false;
       return;
     };
@@ -70,12 +104,12 @@ void safety_setter_thread() {
   }
 
   // VIN query done, stop listening to OBDII
-  panda->set_safety_model(cereal::CarParams::SafetyModel::ELM327, 1);
+  set_safety_model(cereal::CarParams::SafetyModel::ELM327, 1);
 
   std::string params;
   LOGW("waiting for params to set safety model");
   while (true) {
-    if (do_exit || !panda->connected) {
+    if (do_exit || !pandas_connected()) {
       safety_setter_thread_running = false;
       return;
     };
@@ -98,7 +132,23 @@ void safety_setter_thread() {
   auto safety_param = car_params.getSafetyParam();
   LOGW("setting safety model: %d with param %d", (int)safety_model, safety_param);
 
-  panda->set_safety_model(safety_model, safety_param);
+  set_safety_model(safety_model, safety_param);
+
+  // the CAN of the car's parsers, controlsd writes it before CarParams. Without it all is passed
+  std::istringstream rx_filter(p.get("CanRxFilter"));
+  for (std::string line; std::getline(rx_filter, line);) {
+    std::istringstream ss(line);
+    uint32_t bus;
+    if (!(ss >> bus)) continue;
+    std::vector<uint32_t> addresses;
+    for (uint32_t addr; ss >> addr;) addresses.push_back(addr);
+    for (Panda *panda : pandas) {
+      if (bus >= panda->bus_offset && bus < panda->bus_offset + PANDA_BUS_CNT) {
+        LOGW("can rx filter of bus %u: %zu addresses", bus, addresses.size());
+        panda->set_can_rx_filter(bus - panda->bus_offset, addresses);
+      }
+    }
+  }
 
   safety_setter_thread_running = false;
 }
@@ -107,18 +157,38 @@ void safety_setter_thread() {
 bool usb_connect() {
   static bool connected_once = false;
 
-  std::unique_ptr<Panda> tmp_panda;
+  // the first panda (by USB serial, or in the order of BOARDD_PANDA_SERIALS) is the main one
+  std::vector<std::string> serials;
+  if (const char *order = getenv("BOARDD_PANDA_SERIALS")) {
+    std::stringstream ss(order);
+    for (std::string serial; std::getline(ss, serial, ',');) serials.push_back(serial);
+  } else {
+    serials = Panda::list();
+    std::sort(serials.begin(), serials.end());
+  }
+  if (serials.empty()) return false;
+
+  std::vector<std::unique_ptr<Panda>> tmp_pandas;
   try {
     assert(panda == nullptr);
-    tmp_panda = std::make_unique<Panda>();
+    for (int i = 0; i < serials.size(); i++) {
+      tmp_pandas.push_back(std::make_unique<Panda>(serials[i], i * PANDA_BUS_CNT));
+    }
   } catch (std::exception &e) {
     return false;
   }
+  Panda *tmp_panda = tmp_pandas[0].get();
 
   Params params = Params();
 
   if (getenv("BOARDD_LOOPBACK")) {
-    tmp_panda->set_loopback(true);
+    for (auto &p : tmp_pandas) p->set_loopback(true);
+  }
+
+  // full RX packets, traded for up to this much latency. Best with async receive, where the
+  // transfers stay queued on the panda anyway
+  if (const char *batch_us = getenv("BOARDD_CAN_RX_BATCH_US")) {
+    for (auto &p : tmp_pandas) p->set_can_rx_batch(atoi(batch_us));
   }
 
   if (auto fw_sig = tmp_panda->get_firmware_version(); fw_sig) {
@@ -169,8 +239,17 @@ bool usb_connect() {
     }
   }
 
+  if (serials.size() > 1) {
+    LOGW("%zu pandas, %s is the main one", serials.size(), serials[0].c_str());
+  }
+
   connected_once = true;
-  panda = tmp_panda.release();
+  can_tx.clear();
+  for (auto &p : tmp_pandas) {
+    can_tx.push_back(std::make_unique<CanTxScheduler>(getenv("BOARDD_CAN_TX_POLICY"), p->bus_offset, PANDA_BUS_CNT));
+    pandas.push_back(p.release());
+  }
+  panda = pandas[0];
   return true;
 }
 
@@ -182,24 +261,86 @@ void usb_retry_connect() {
 }
 
 void can_recv(PubMaster &pm) {
-  kj::Array<capnp::word> can_data;
-  panda->can_receive(can_data);
-  auto bytes = can_data.asBytes();
+  TRACE_SCOPE("can_recv");
+  kj::ArrayPtr<capnp::byte> bytes, packed;
+  if (pandas.size() == 1) {
+    panda->can_receive(bytes, packed);
+  } else {
+    // one can event for the frames of all pandas
+    static std::vector<CanFrame> frames, panda_frames;
+    frames.clear();
+    for (Panda *p : pandas) {
+      p->can_receive(panda_frames);
+      frames.insert(frames.end(), panda_frames.begin(), panda_frames.end());
+    }
+    bytes = panda->can_event(frames);
+    packed = panda->can_packed_event(frames);
+  }
   pm.send("can", bytes.begin(), bytes.size());
+  pm.send("canPacked", packed.begin(), packed.size());
 }
 
-void can_send_thread() {
-  LOGD("start send thread");
+// Writes the sendcan of openpilot to a panda, everything queued since the last write goes out in one transfer
+class CanSender {
+ public:
+  CanSender(Panda *p, CanTxScheduler *tx) : p(p), tx(tx) {
+    context = Context::create();
+    subscriber = SubSocket::create(context, "sendcan");
+    assert(subscriber != NULL);
+  }
+  ~CanSender() {
+    delete subscriber;
+    delete context;
+  }
 
+  // Sends msg and the messages queued behind it
+  void send(Message *msg);
+
+  Panda *p;
+  CanTxScheduler *tx;
+  Context *context;
+  SubSocket *subscriber;
+
+ private:
   AlignedBuffer aligned_buf;
-  Context * context = Context::create();
-  SubSocket * subscriber = SubSocket::create(context, "sendcan");
-  assert(subscriber != NULL);
-  subscriber->setTimeout(100);
+  std::vector<uint64_t> batch_times;
+};
+
+void CanSender::send(Message *msg) {
+  batch_times.clear();
+  for (; msg != nullptr; msg = subscriber->receive(true)) {
+    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg));
+    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+    tx->push(event.getSendcan(), event.getLogMonoTime());
+    batch_times.push_back(event.getLogMonoTime());
+    delete msg;
+  }
+
+  const std::vector<CanFrame> &frames = tx->pop(nanos_since_boot());
+  if (!fake_send && !frames.empty()) {
+    TRACE_SCOPE("can_send");
+    TRACE_COUNTER("can_send_frames", frames.size());
+    p->can_send(frames);
+
+    const uint64_t sent = nanos_since_boot();
+    std::lock_guard lk(send_latency_lock);
+    for (uint64_t t : batch_times) {
+      if (send_latencies.size() < 1000) {
+        send_latencies.push_back((sent - t) / 1e6);
+      }
+    }
+  }
+}
+
+void can_send_thread(Panda *p, CanTxScheduler *tx) {
+  LOGD("start send thread, buses from %u", p->bus_offset);
+
+  CanSender sender(p, tx);
+  sender.subscriber->setTimeout(100);
 
   // run as fast as messages come in
-  while (!do_exit && panda->connected) {
-    Message * msg = subscriber->receive();
+  while (!do_exit && pandas_connected()) {
+    Message * msg = sender.subscriber->receive();
 
     if (!msg) {
       if (errno == EINTR) {
@@ -207,36 +348,48 @@ void can_send_thread() {
       }
       continue;
     }
-
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg));
-    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
-
-    //Dont send if older than 1 second
-    if (nanos_since_boot() - event.getLogMonoTime() < 1e9) {
-      if (!fake_send) {
-        panda->can_send(event.getSendcan());
-      }
-    }
-
-    delete msg;
+    sender.send(msg);
   }
-
-  delete subscriber;
-  delete context;
 }
 
 void can_recv_thread() {
   LOGD("start recv thread");
 
   // can = 8006
-  PubMaster pm({"can"});
+  PubMaster pm({"can", "canPacked"});
+
+  // publish every bulk read as soon as it completes instead of polling at 100hz.
+  // Only with one panda, several are merged into one can event per poll
+  if (getenv("BOARDD_ASYNC_CAN") && pandas.size() == 1) {
+    static AllocStats async_allocs("can_recv_async");
+    bool started = panda->start_can_receive([&](const std::vector<CanFrame> &frames) {
+      TRACE_SCOPE("can_recv");
+      NoAllocRegion region(async_allocs);
+      kj::ArrayPtr<capnp::byte> bytes = panda->can_event(frames);
+      pm.send("can", bytes.begin(), bytes.size());
+      bytes = panda->can_packed_event(frames);
+      pm.send("canPacked", bytes.begin(), bytes.size());
+    });
+    if (started) {
+      while (!do_exit && pandas_connected()) {
+        util::sleep_for(100);
+      }
+      panda->stop_can_receive();
+      return;
+    }
+    LOGE("async can receive failed, polling");
+  }
 
   // run at 100hz
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
 
-  while (!do_exit && panda->connected) {
-    can_recv(pm);
+  static AllocStats allocs("can_recv");
+  while (!do_exit && pandas_connected()) {
+    {
+      NoAllocRegion region(allocs);
+      can_recv(pm);
+    }
 
     uint64_t cur_time = nanos_since_boot();
     int64_t remaining = next_frame_time - cur_time;
@@ -244,8 +397,9 @@ void can_recv_thread() {
       std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
     } else {
       if (ignition) {
-        LOGW("missed cycles (%d) %lld", (int)-1*remaining/dt, remaining);
+        LOGW_DEDUP("missed cycles (%d) %lld", (int)-1*remaining/dt, remaining);
       }
+      missed_cycles += std::max(1, (int)(-1*remaining/dt));
       next_frame_time = cur_time;
     }
 
@@ -253,15 +407,36 @@ void can_recv_thread() {
   }
 }
 
-void panda_state_thread() {
-  LOGD("start panda state thread");
-  PubMaster pm({"pandaState"});
+void send_boardd_stats(PubMaster &pm, uint32_t can_tx_queue_depth, double dt) {
+  UsbStats stats;
+  for (Panda *p : pandas) {
+    UsbStats s = p->take_usb_stats();
+    for (int i = 0; i < USB_LATENCY_BINS; i++) stats.latency[i] += s.latency[i];
+    for (int i = 0; i < std::size(s.rx_frames); i++) stats.rx_frames[i] += s.rx_frames[i];
+    stats.lock_held_ns += s.lock_held_ns;
+    stats.rx_buffer_full += s.rx_buffer_full;
+  }
 
-  uint32_t no_ignition_cnt = 0;
-  bool ignition_last = false;
-  Params params = Params();
+  MessageBuilder msg;
+  auto bs = msg.initEvent().initBoarddStats();
+  int num_buses = std::count_if(std::begin(stats.rx_frames), std::end(stats.rx_frames), [](uint32_t n) { return n > 0; });
+  auto rx_frames = bs.initRxFrames(num_buses);
+  for (int i = 0, j = 0; i < std::size(stats.rx_frames); i++) {
+    if (stats.rx_frames[i] == 0) continue;
+    rx_frames[j].setBus(i);
+    rx_frames[j].setFramesPerSecond(stats.rx_frames[i] / dt);
+    j++;
+  }
+  bs.setUsbLatency(kj::arrayPtr(stats.latency, USB_LATENCY_BINS));
+  bs.setUsbLockHeld(stats.lock_held_ns / 1e6 / dt);
+  bs.setRxBufferFull(stats.rx_buffer_full);
+  bs.setMissedCycles(missed_cycles.exchange(0));
+  bs.setCanTxQueueDepth(can_tx_queue_depth);
+  pm.send("boarddStats", msg);
+}
 
-  // Broadcast empty pandaState message when panda is not yet connected
+// Broadcasts an empty pandaState while no panda is connected
+void panda_state_wait(PubMaster &pm) {
   while (!panda) {
     MessageBuilder msg;
     auto pandaState  = msg.initEvent().initPandaState();
@@ -270,210 +445,289 @@ void panda_state_thread() {
     pm.send("pandaState", msg);
     util::sleep_for(500);
   }
+}
 
-  // run at 2hz
-  while (!do_exit && panda->connected) {
-    health_t pandaState = panda->get_state();
+// pandaState and boarddStats, and the safety and power saving that follow the ignition
+class PandaStateTask {
+ public:
+  explicit PandaStateTask(PubMaster &pm) : pm(pm), last_stats_time(nanos_since_boot()) {}
+  void step();
 
-    if (spoofing_started) {
-      pandaState.ignition_line = 1;
-    }
+ private:
+  PubMaster &pm;
+  uint32_t no_ignition_cnt = 0;
+  bool ignition_last = false;
+  Params params;
+  uint64_t last_stats_time;
+  // the tici's power monitor
+  SysfsReader voltage_reader{"/sys/class/hwmon/hwmon1/in1_input"};
+  SysfsReader current_reader{"/sys/class/hwmon/hwmon1/curr1_input"};
+};
+
+void PandaStateTask::step() {
+  for (Panda *p : pandas) p->sync_clock();
+  health_t pandaState = panda->get_state();
+
+  if (spoofing_started) {
+    pandaState.ignition_line = 1;
+  }
 
-    // Make sure CAN buses are live: safety_setter_thread does not work if Panda CAN are silent and there is only one other CAN node
-    if (pandaState.safety_model == (uint8_t)(cereal::CarParams::SafetyModel::SILENT)) {
-      panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
-    }
+  // Make sure CAN buses are live: safety_setter_thread does not work if Panda CAN are silent and there is only one other CAN node
+  if (pandaState.safety_model == (uint8_t)(cereal::CarParams::SafetyModel::SILENT)) {
+    set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+  }
 
-    bool ignition = ((pandaState.ignition_line != 0) || (pandaState.ignition_can != 0));
+  bool ignition = ((pandaState.ignition_line != 0) || (pandaState.ignition_can != 0));
 
-    if (ignition) {
-      no_ignition_cnt = 0;
-    } else {
-      no_ignition_cnt += 1;
-    }
+  if (ignition) {
+    no_ignition_cnt = 0;
+  } else {
+    no_ignition_cnt += 1;
+  }
 
 #ifndef __x86_64__
-    bool power_save_desired = !ignition;
-    if (pandaState.power_save_enabled != power_save_desired) {
-      panda->set_power_saving(power_save_desired);
-    }
+  bool power_save_desired = !ignition;
+  if (pandaState.power_save_enabled != power_save_desired) {
+    for (Panda *p : pandas) p->set_power_saving(power_save_desired);
+  }
 
-    // set safety mode to NO_OUTPUT when car is off. ELM327 is an alternative if we want to leverage athenad/connect
-    if (!ignition && (pandaState.safety_model != (uint8_t)(cereal::CarParams::SafetyModel::NO_OUTPUT))) {
-      panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
-    }
+  // set safety mode to NO_OUTPUT when car is off. ELM327 is an alternative if we want to leverage athenad/connect
+  if (!ignition && (pandaState.safety_model != (uint8_t)(cereal::CarParams::SafetyModel::NO_OUTPUT))) {
+    set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+  }
 #endif
 
-    // clear VIN, CarParams, and set new safety on car start
-    if (ignition && !ignition_last) {
-      params.clearAll(CLEAR_ON_IGNITION_ON);
+  // clear VIN, CarParams, and set new safety on car start
+  if (ignition && !ignition_last) {
+    params.clearAll(CLEAR_ON_IGNITION_ON);
 
-      if (!safety_setter_thread_running) {
-        safety_setter_thread_running = true;
-        std::thread(safety_setter_thread).detach();
-      } else {
-        LOGW("Safety setter thread already running");
-      }
-    } else if (!ignition && ignition_last) {
-      params.clearAll(CLEAR_ON_IGNITION_OFF);
+    if (!safety_setter_thread_running) {
+      safety_setter_thread_running = true;
+      std::thread(safety_setter_thread).detach();
+    } else {
+      LOGW("Safety setter thread already running");
     }
+  } else if (!ignition && ignition_last) {
+    params.clearAll(CLEAR_ON_IGNITION_OFF);
+  }
 
-    // Write to rtc once per minute when no ignition present
-    if ((panda->has_rtc) && !ignition && (no_ignition_cnt % 120 == 1)) {
-      // Write time to RTC if it looks reasonable
-      setenv("TZ","UTC",1);
-      struct tm sys_time = util::get_time();
-
-      if (util::time_valid(sys_time)) {
-        struct tm rtc_time = panda->get_rtc();
-        double seconds = difftime(mktime(&rtc_time), mktime(&sys_time));
-
-        if (std::abs(seconds) > 1.1) {
-          panda->set_rtc(sys_time);
-          LOGW("Updating panda RTC. dt = %.2f "
-               "System: %d-%02d-%02d %02d:%02d:%02d RTC: %d-%02d-%02d %02d:%02d:%02d",
-               seconds,
-               sys_time.tm_year + 1900, sys_time.tm_mon + 1, sys_time.tm_mday,
-               sys_time.tm_hour, sys_time.tm_min, sys_time.tm_sec,
-               rtc_time.tm_year + 1900, rtc_time.tm_mon + 1, rtc_time.tm_mday,
-               rtc_time.tm_hour, rtc_time.tm_min, rtc_time.tm_sec);
-        }
+  // Write to rtc once per minute when no ignition present
+  if ((panda->has_rtc) && !ignition && (no_ignition_cnt % 120 == 1)) {
+    // Write time to RTC if it looks reasonable
+    setenv("TZ","UTC",1);
+    struct tm sys_time = util::get_time();
+
+    if (util::time_valid(sys_time)) {
+      struct tm rtc_time = panda->get_rtc();
+      double seconds = difftime(mktime(&rtc_time), mktime(&sys_time));
+
+      if (std::abs(seconds) > 1.1) {
+        panda->set_rtc(sys_time);
+        LOGW("Updating panda RTC. dt = %.2f "
+             "System: %d-%02d-%02d %02d:%02d:%02d RTC: %d-%02d-%02d %02d:%02d:%02d",
+             seconds,
+             sys_time.tm_year + 1900, sys_time.tm_mon + 1, sys_time.tm_mday,
+             sys_time.tm_hour, sys_time.tm_min, sys_time.tm_sec,
+             rtc_time.tm_year + 1900, rtc_time.tm_mon + 1, rtc_time.tm_mday,
+             rtc_time.tm_hour, rtc_time.tm_min, rtc_time.tm_sec);
       }
     }
+  }
 
-    ignition_last = ignition;
-    uint16_t fan_speed_rpm = panda->get_fan_speed();
+  ignition_last = ignition;
+  uint16_t fan_speed_rpm = panda->get_fan_speed();
 
-    // build msg
-    MessageBuilder msg;
-    auto evt = msg.initEvent();
-    evt.setValid(panda->comms_healthy);
+  // build msg
+  MessageBuilder msg;
+  auto evt = msg.initEvent();
+  evt.setValid(panda->comms_healthy);
+
+  auto ps = evt.initPandaState();
+  ps.setUptime(pandaState.uptime);
+
+  if (Hardware::TICI()) {
+    double read_time = millis_since_boot();
+    int64_t voltage = 0, current = 0;
+    voltage_reader.read_int(voltage);
+    current_reader.read_int(current);
+    ps.setVoltage(voltage);
+    ps.setCurrent(current);
+    read_time = millis_since_boot() - read_time;
+    if (read_time > 50) {
+      LOGW("reading hwmon took %lfms", read_time);
+    }
+  } else {
+    ps.setVoltage(pandaState.voltage);
+    ps.setCurrent(pandaState.current);
+  }
+
+  ps.setIgnitionLine(pandaState.ignition_line);
+  ps.setIgnitionCan(pandaState.ignition_can);
+  ps.setControlsAllowed(pandaState.controls_allowed);
+  ps.setGasInterceptorDetected(pandaState.gas_interceptor_detected);
+  ps.setHasGps(panda->is_pigeon);
+  ps.setCanRxErrs(pandaState.can_rx_errs);
+  ps.setCanSendErrs(pandaState.can_send_errs);
+  ps.setCanFwdErrs(pandaState.can_fwd_errs);
+  ps.setGmlanSendErrs(pandaState.gmlan_send_errs);
+  ps.setPandaType(panda->hw_type);
+  ps.setUsbPowerMode(cereal::PandaState::UsbPowerMode(pandaState.usb_power_mode));
+  ps.setSafetyModel(cereal::CarParams::SafetyModel(pandaState.safety_model));
+  ps.setSafetyParam(pandaState.safety_param);
+  ps.setFanSpeedRpm(fan_speed_rpm);
+  ps.setFaultStatus(cereal::PandaState::FaultStatus(pandaState.fault_status));
+  ps.setPowerSaveEnabled((bool)(pandaState.power_save_enabled));
+  ps.setHeartbeatLost((bool)(pandaState.heartbeat_lost));
+  ps.setHarnessStatus(cereal::PandaState::HarnessStatus(pandaState.car_harness_status));
+  ps.setCanRxOverflow(pandaState.can_rx_overflow);
+
+  std::vector<float> latencies;
+  {
+    std::lock_guard lk(send_latency_lock);
+    latencies.swap(send_latencies);
+  }
+  if (!latencies.empty()) {
+    std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+    ps.setSendcanLatencyP50(latencies[latencies.size() / 2]);
+    ps.setSendcanLatencyMax(*std::max_element(latencies.begin(), latencies.end()));
+  }
 
-    auto ps = evt.initPandaState();
-    ps.setUptime(pandaState.uptime);
+  CanTxScheduler::Stats tx_stats;
+  for (auto &tx : can_tx) {
+    CanTxScheduler::Stats stats = tx->take_stats();
+    tx_stats.max_depth = std::max(tx_stats.max_depth, stats.max_depth);
+    for (auto &[address, count] : stats.late) tx_stats.late[address] += count;
+  }
+  ps.setCanTxQueueDepth(tx_stats.max_depth);
+  auto tx_late = ps.initCanTxLate(tx_stats.late.size());
+  int late_idx = 0;
+  for (auto &[address, count] : tx_stats.late) {
+    tx_late[late_idx].setAddress(address);
+    tx_late[late_idx].setCount(count);
+    late_idx++;
+  }
 
-    if (Hardware::TICI()) {
-      double read_time = millis_since_boot();
-      ps.setVoltage(std::stoi(util::read_file("/sys/class/hwmon/hwmon1/in1_input")));
-      ps.setCurrent(std::stoi(util::read_file("/sys/class/hwmon/hwmon1/curr1_input")));
-      read_time = millis_since_boot() - read_time;
-      if (read_time > 50) {
-        LOGW("reading hwmon took %lfms", read_time);
-      }
-    } else {
-      ps.setVoltage(pandaState.voltage);
-      ps.setCurrent(pandaState.current);
-    }
+  // Convert faults bitset to capnp list
+  std::bitset<sizeof(pandaState.faults) * 8> fault_bits(pandaState.faults);
+  auto faults = ps.initFaults(fault_bits.count());
 
-    ps.setIgnitionLine(pandaState.ignition_line);
-    ps.setIgnitionCan(pandaState.ignition_can);
-    ps.setControlsAllowed(pandaState.controls_allowed);
-    ps.setGasInterceptorDetected(pandaState.gas_interceptor_detected);
-    ps.setHasGps(panda->is_pigeon);
-    ps.setCanRxErrs(pandaState.can_rx_errs);
-    ps.setCanSendErrs(pandaState.can_send_errs);
-    ps.setCanFwdErrs(pandaState.can_fwd_errs);
-    ps.setGmlanSendErrs(pandaState.gmlan_send_errs);
-    ps.setPandaType(panda->hw_type);
-    ps.setUsbPowerMode(cereal::PandaState::UsbPowerMode(pandaState.usb_power_mode));
-    ps.setSafetyModel(cereal::CarParams::SafetyModel(pandaState.safety_model));
-    ps.setSafetyParam(pandaState.safety_param);
-    ps.setFanSpeedRpm(fan_speed_rpm);
-    ps.setFaultStatus(cereal::PandaState::FaultStatus(pandaState.fault_status));
-    ps.setPowerSaveEnabled((bool)(pandaState.power_save_enabled));
-    ps.setHeartbeatLost((bool)(pandaState.heartbeat_lost));
-    ps.setHarnessStatus(cereal::PandaState::HarnessStatus(pandaState.car_harness_status));
-
-    // Convert faults bitset to capnp list
-    std::bitset<sizeof(pandaState.faults) * 8> fault_bits(pandaState.faults);
-    auto faults = ps.initFaults(fault_bits.count());
-
-    size_t i = 0;
-    for (size_t f = size_t(cereal::PandaState::FaultType::RELAY_MALFUNCTION);
-        f <= size_t(cereal::PandaState::FaultType::INTERRUPT_RATE_TICK); f++) {
-      if (fault_bits.test(f)) {
-        faults.set(i, cereal::PandaState::FaultType(f));
-        i++;
-      }
+  size_t i = 0;
+  for (size_t f = size_t(cereal::PandaState::FaultType::RELAY_MALFUNCTION);
+      f <= size_t(cereal::PandaState::FaultType::INTERRUPT_RATE_TICK); f++) {
+    if (fault_bits.test(f)) {
+      faults.set(i, cereal::PandaState::FaultType(f));
+      i++;
     }
-    pm.send("pandaState", msg);
-    panda->send_heartbeat();
-    util::sleep_for(500);
   }
+  pm.send("pandaState", msg);
+
+  const uint64_t stats_time = nanos_since_boot();
+  send_boardd_stats(pm, tx_stats.max_depth, (stats_time - last_stats_time) / 1e9);
+  last_stats_time = stats_time;
+
+  for (Panda *p : pandas) p->send_heartbeat();
 }
 
-void hardware_control_thread() {
-  LOGD("start hardware control thread");
-  SubMaster sm({"deviceState", "driverCameraState"});
+void panda_state_thread() {
+  LOGD("start panda state thread");
+  PubMaster pm({"pandaState", "boarddStats"});
+  panda_state_wait(pm);
 
-  // Other pandas don't have hardware to control
-  if (panda->hw_type != cereal::PandaState::PandaType::UNO && panda->hw_type != cereal::PandaState::PandaType::DOS) return;
+  // run at 2hz
+  PandaStateTask task(pm);
+  while (!do_exit && pandas_connected()) {
+    task.step();
+    util::sleep_for(500);
+  }
+}
 
+// The fan, charging and IR power of the UNO and DOS, from deviceState and driverCameraState
+class HardwareControlTask {
+ public:
+  HardwareControlTask() : sm({"deviceState", "driverCameraState"}), integ_lines_filter(0, 30.0, 0.05) {}
+  // waits up to timeout ms for the messages
+  void step(int timeout);
+
+ private:
+  SubMaster sm;
   uint64_t last_front_frame_t = 0;
   uint16_t prev_fan_speed = 999;
   uint16_t ir_pwr = 0;
   uint16_t prev_ir_pwr = 999;
   bool prev_charging_disabled = false;
   unsigned int cnt = 0;
+  FirstOrderFilter integ_lines_filter;
+};
 
-  FirstOrderFilter integ_lines_filter(0, 30.0, 0.05);
+// Other pandas don't have hardware to control
+static bool has_hardware_control() {
+  return panda->hw_type == cereal::PandaState::PandaType::UNO || panda->hw_type == cereal::PandaState::PandaType::DOS;
+}
 
-  while (!do_exit && panda->connected) {
-    cnt++;
-    sm.update(1000); // TODO: what happens if EINTR is sent while in sm.update?
+void HardwareControlTask::step(int timeout) {
+  cnt++;
+  sm.update(timeout); // TODO: what happens if EINTR is sent while in sm.update?
 
 #if defined(QCOM) || defined(QCOM2)
-    if (sm.updated("deviceState")) {
-      // Fan speed
-      uint16_t fan_speed = sm["deviceState"].getDeviceState().getFanSpeedPercentDesired();
-      if (fan_speed != prev_fan_speed || cnt % 100 == 0){
-        panda->set_fan_speed(fan_speed);
-        prev_fan_speed = fan_speed;
-      }
-      // Charging mode
-      bool charging_disabled = sm["deviceState"].getDeviceState().getChargingDisabled();
-      if (charging_disabled != prev_charging_disabled) {
-        if (charging_disabled) {
-          panda->set_usb_power_mode(cereal::PandaState::UsbPowerMode::CLIENT);
-          LOGW("TURN OFF CHARGING!\n");
-        } else {
-          panda->set_usb_power_mode(cereal::PandaState::UsbPowerMode::CDP);
-          LOGW("TURN ON CHARGING!\n");
-        }
-        prev_charging_disabled = charging_disabled;
+  if (sm.updated("deviceState")) {
+    // Fan speed
+    uint16_t fan_speed = sm["deviceState"].getDeviceState().getFanSpeedPercentDesired();
+    if (fan_speed != prev_fan_speed || cnt % 100 == 0){
+      panda->set_fan_speed(fan_speed);
+      prev_fan_speed = fan_speed;
+    }
+    // Charging mode
+    bool charging_disabled = sm["deviceState"].getDeviceState().getChargingDisabled();
+    if (charging_disabled != prev_charging_disabled) {
+      if (charging_disabled) {
+        panda->set_usb_power_mode(cereal::PandaState::UsbPowerMode::CLIENT);
+        LOGW("TURN OFF CHARGING!\n");
+      } else {
+        panda->set_usb_power_mode(cereal::PandaState::UsbPowerMode::CDP);
+        LOGW("TURN ON CHARGING!\n");
       }
+      prev_charging_disabled = charging_disabled;
     }
+  }
 #endif
 
-    if (sm.updated("driverCameraState")) {
-      auto event = sm["driverCameraState"];
-      int cur_integ_lines = event.getDriverCameraState().getIntegLines();
-      float cur_gain = event.getDriverCameraState().getGain();
+  if (sm.updated("driverCameraState")) {
+    auto event = sm["driverCameraState"];
+    int cur_integ_lines = event.getDriverCameraState().getIntegLines();
+    float cur_gain = event.getDriverCameraState().getGain();
 
-      if (Hardware::TICI()) {
-        cur_integ_lines = integ_lines_filter.update(cur_integ_lines * cur_gain);
-      }
-      last_front_frame_t = event.getLogMonoTime();
-
-      if (cur_integ_lines <= CUTOFF_IL) {
-        ir_pwr = 100.0 * MIN_IR_POWER;
-      } else if (cur_integ_lines > SATURATE_IL) {
-        ir_pwr = 100.0 * MAX_IR_POWER;
-      } else {
-        ir_pwr = 100.0 * (MIN_IR_POWER + ((cur_integ_lines - CUTOFF_IL) * (MAX_IR_POWER - MIN_IR_POWER) / (SATURATE_IL - CUTOFF_IL)));
-      }
-    }
-    // Disable ir_pwr on front frame timeout
-    uint64_t cur_t = nanos_since_boot();
-    if (cur_t - last_front_frame_t > 1e9) {
-      ir_pwr = 0;
+    if (Hardware::TICI()) {
+      cur_integ_lines = integ_lines_filter.update(cur_integ_lines * cur_gain);
     }
+    last_front_frame_t = event.getLogMonoTime();
 
-    if (ir_pwr != prev_ir_pwr || cnt % 100 == 0 || ir_pwr >= 50.0) {
-      panda->set_ir_pwr(ir_pwr);
-      prev_ir_pwr = ir_pwr;
+    if (cur_integ_lines <= CUTOFF_IL) {
+      ir_pwr = 100.0 * MIN_IR_POWER;
+    } else if (cur_integ_lines > SATURATE_IL) {
+      ir_pwr = 100.0 * MAX_IR_POWER;
+    } else {
+      ir_pwr = 100.0 * (MIN_IR_POWER + ((cur_integ_lines - CUTOFF_IL) * (MAX_IR_POWER - MIN_IR_POWER) / (SATURATE_IL - CUTOFF_IL)));
     }
+  }
+  // Disable ir_pwr on front frame timeout
+  uint64_t cur_t = nanos_since_boot();
+  if (cur_t - last_front_frame_t > 1e9) {
+    ir_pwr = 0;
+  }
 
+  if (ir_pwr != prev_ir_pwr || cnt % 100 == 0 || ir_pwr >= 50.0) {
+    panda->set_ir_pwr(ir_pwr);
+    prev_ir_pwr = ir_pwr;
+  }
+}
+
+void hardware_control_thread() {
+  LOGD("start hardware control thread");
+  if (!has_hardware_control()) return;
+
+  HardwareControlTask task;
+  while (!do_exit && pandas_connected()) {
+    task.step(1000);
   }
 }
 
@@ -484,83 +738,184 @@ static void pigeon_publish_raw(PubMaster &pm, const std::string &dat) {
   pm.send("ubloxRaw", msg);
 }
 
-void pigeon_thread() {
-  if (!panda->is_pigeon) { return; };
+// ubloxRaw from the GPS of the panda, or the serial port of the tici
+class PigeonTask {
+ public:
+  PigeonTask() : pm({"ubloxRaw"}) {
+    pigeon = Hardware::TICI() ? Pigeon::connect("/dev/ttyHS0") : Pigeon::connect(panda);
+    pigeon->init();
+  }
+  ~PigeonTask() { delete pigeon; }
+  void step();
 
-  PubMaster pm({"ubloxRaw"});
+ private:
+  PubMaster pm;
+  Pigeon *pigeon;
   bool ignition_last = false;
 
-  Pigeon *pigeon = Hardware::TICI() ? Pigeon::connect("/dev/ttyHS0") : Pigeon::connect(panda);
-
   std::unordered_map<char, uint64_t> last_recv_time;
   std::unordered_map<char, int64_t> cls_max_dt = {
     {(char)ublox::CLASS_NAV, int64_t(900000000ULL)}, // 0.9s
     {(char)ublox::CLASS_RXM, int64_t(900000000ULL)}, // 0.9s
   };
 
-  pigeon->init();
+  // ubloxRaw is published per batch of whole frames, ubloxd never sees a frame split over messages
+  UbxFramer framer;
+  std::string frames;
+};
+
+void PigeonTask::step() {
+  bool need_reset = false;
+  std::string recv = pigeon->receive();
 
-  while (!do_exit && panda->connected) {
-    bool need_reset = false;
-    std::string recv = pigeon->receive();
+  // Check based on null bytes
+  if (ignition && recv.length() > 0 && recv[0] == (char)0x00) {
+    need_reset = true;
+    LOGW("received invalid ublox message while onroad, resetting panda GPS");
+  }
 
+  framer.push(recv.data(), recv.length());
+  frames.clear();
+  std::string_view frame;
+  while (framer.pop(frame)) {
     // Parse message header
-    if (ignition && recv.length() >= 3) {
-      if (recv[0] == (char)ublox::PREAMBLE1 && recv[1] == (char)ublox::PREAMBLE2) {
-        const char msg_cls = recv[2];
-        uint64_t t = nanos_since_boot();
-        if (t > last_recv_time[msg_cls]) {
-          last_recv_time[msg_cls] = t;
-        }
+    if (ignition) {
+      const char msg_cls = frame[2];
+      uint64_t t = nanos_since_boot();
+      if (t > last_recv_time[msg_cls]) {
+        last_recv_time[msg_cls] = t;
       }
     }
+    frames.append(frame);
+  }
 
-    // Check based on message frequency
-    for (const auto& [msg_cls, max_dt] : cls_max_dt) {
-      int64_t dt = (int64_t)nanos_since_boot() - (int64_t)last_recv_time[msg_cls];
-      if (ignition_last && ignition && dt > max_dt) {
-        LOG("ublox receive timeout, msg class: 0x%02x, dt %llu", msg_cls, dt);
-        // TODO: turn on reset after verification of logs
-        // need_reset = true;
-      }
+  // Check based on message frequency
+  for (const auto& [msg_cls, max_dt] : cls_max_dt) {
+    int64_t dt = (int64_t)nanos_since_boot() - (int64_t)last_recv_time[msg_cls];
+    if (ignition_last && ignition && dt > max_dt) {
+      LOG("ublox receive timeout, msg class: 0x%02x, dt %llu", msg_cls, dt);
+      // TODO: turn on reset after verification of logs
+      // need_reset = true;
     }
+  }
 
-    // Check based on null bytes
-    if (ignition && recv.length() > 0 && recv[0] == (char)0x00) {
-      need_reset = true;
-      LOGW("received invalid ublox message while onroad, resetting panda GPS");
-    }
+  if (frames.length() > 0) {
+    pigeon_publish_raw(pm, frames);
+  }
 
-    if (recv.length() > 0) {
-      pigeon_publish_raw(pm, recv);
+  // init pigeon on rising ignition edge
+  // since it was turned off in low power mode
+  if((ignition && !ignition_last) || need_reset) {
+    pigeon->init();
+
+    // Set receive times to current time
+    uint64_t t = nanos_since_boot() + 10000000000ULL; // Give ublox 10 seconds to start
+    for (const auto& [msg_cls, dt] : cls_max_dt) {
+      last_recv_time[msg_cls] = t;
     }
+  // } else if (!ignition && ignition_last) {
+  //   // power off on falling edge of ignition
+  //   LOGD("powering off pigeon\n");
+  //   pigeon->stop();
+  //   pigeon->set_power(false);
+  }
 
-    // init pigeon on rising ignition edge
-    // since it was turned off in low power mode
-    if((ignition && !ignition_last) || need_reset) {
-      pigeon->init();
+  ignition_last = ignition;
+}
 
-      // Set receive times to current time
-      uint64_t t = nanos_since_boot() + 10000000000ULL; // Give ublox 10 seconds to start
-      for (const auto& [msg_cls, dt] : cls_max_dt) {
-        last_recv_time[msg_cls] = t;
-      }
-    // } else if (!ignition && ignition_last) {
-    //   // power off on falling edge of ignition
-    //   LOGD("powering off pigeon\n");
-    //   pigeon->stop();
-    //   pigeon->set_power(false);
-    }
+void pigeon_thread() {
+  if (!panda->is_pigeon) { return; };
 
-    ignition_last = ignition;
+  PigeonTask task;
+  while (!do_exit && pandas_connected()) {
+    task.step();
 
     // 10ms - 100 Hz
     util::sleep_for(10);
   }
-
-  delete pigeon;
 }
 
+// The work of the threads above in one thread, BOARDD_EVENT_LOOP. It waits on the sendcan sockets of
+// every panda until the next timer is due, instead of each thread sleeping to its own cadence on
+// the usb lock. Of what is ready together, sendcan goes first and then one timer at a time in
+// priority order, the CAN receive before the pandaState, GPS and hardware, so a slow control
+// transfer delays the CAN by one task at most. BOARDD_EVENT_LOOP_CORE pins the thread to a core.
+// The sendcan readiness is msgq's futex, not a fd, so the wait is msgq's poller with the timeout of
+// the timers rather than an epoll with libusb's pollfds
+void event_loop(PubMaster &state_pm) {
+  LOGW("start event loop");
+  if (const char *core = getenv("BOARDD_EVENT_LOOP_CORE")) {
+    int err = set_core_affinity(atoi(core));
+    LOG("event loop affinity to core %s returns %d", core, err);
+  }
+
+  std::vector<std::unique_ptr<CanSender>> senders;
+  std::unique_ptr<Poller> poller(Poller::create());
+  for (int i = 0; i < pandas.size(); i++) {
+    senders.push_back(std::make_unique<CanSender>(pandas[i], can_tx[i].get()));
+    poller->registerSocket(senders.back()->subscriber);
+  }
+
+  PubMaster can_pm({"can", "canPacked"});
+  PandaStateTask panda_state(state_pm);
+  std::unique_ptr<HardwareControlTask> hardware;
+  if (has_hardware_control()) hardware = std::make_unique<HardwareControlTask>();
+  std::unique_ptr<PigeonTask> pigeon;
+  if (panda->is_pigeon && !Params().getBool("WhitePandaSupport")) pigeon = std::make_unique<PigeonTask>();
+
+  struct Timer {
+    uint64_t period;
+    std::function<void()> run;
+    uint64_t next = 0;
+  };
+  // in priority order
+  std::vector<Timer> timers;
+  timers.push_back({10000000ULL, [&]() { can_recv(can_pm); }});
+  timers.push_back({500000000ULL, [&]() { panda_state.step(); }});
+  if (pigeon) timers.push_back({10000000ULL, [&]() { pigeon->step(); }});
+  if (hardware) timers.push_back({50000000ULL, [&]() { hardware->step(0); }});
+  const uint64_t start = nanos_since_boot();
+  for (Timer &t : timers) t.next = start;
+
+  SubSocket *ready[16];
+  while (!do_exit && pandas_connected()) {
+    uint64_t now = nanos_since_boot();
+    uint64_t next = UINT64_MAX;
+    for (const Timer &t : timers) next = std::min(next, t.next);
+    // rounded up, a timer is late by up to a ms rather than the loop spinning on it
+    const int timeout = next > now ? (next - now + 999999ULL) / 1000000ULL : 0;
+
+    const size_t num_ready = poller->poll(timeout, ready, std::size(ready));
+    for (size_t i = 0; i < num_ready; i++) {
+      for (auto &sender : senders) {
+        if (sender->subscriber != ready[i]) continue;
+        Message *msg = sender->subscriber->receive(true);
+        if (msg) sender->send(msg);
+      }
+    }
+
+    now = nanos_since_boot();
+    for (int i = 0; i < timers.size(); i++) {
+      Timer &t = timers[i];
+      if (now < t.next) continue;
+
+      t.run();
+      if (now - t.next >= t.period) {
+        // late by a period or more, the ones missed are skipped
+        if (i == 0) {
+          if (ignition) {
+            LOGW_DEDUP("missed cycles (%d) %lld", (int)((now - t.next) / t.period), (long long)(now - t.next));
+          }
+          missed_cycles += (now - t.next) / t.period;
+        }
+        t.next = now + t.period;
+      } else {
+        t.next += t.period;
+      }
+      break;
+    }
+  }
+}
 
 int main() {
   int err;
@@ -582,21 +937,45 @@ int main() {
     fake_send = true;
   }
 
+  rt_memory_lock();
+
+  const bool use_event_loop = getenv("BOARDD_EVENT_LOOP") != nullptr;
+
   while (!do_exit) {
+    if (use_event_loop) {
+      PubMaster pm({"pandaState", "boarddStats"});
+      std::thread wait(panda_state_wait, std::ref(pm));
+      usb_retry_connect();
+      wait.join();
+
+      event_loop(pm);
+
+      for (Panda *p : pandas) delete p;
+      pandas.clear();
+      panda = nullptr;
+      continue;
+    }
+
     std::vector<std::thread> threads;
     threads.push_back(std::thread(panda_state_thread));
 
     // connect to the board
     usb_retry_connect();
 
-    threads.push_back(std::thread(can_send_thread));
+    for (int i = 0; i < pandas.size(); i++) {
+      threads.push_back(std::thread(can_send_thread, pandas[i], can_tx[i].get()));
+    }
     threads.push_back(std::thread(can_recv_thread));
     threads.push_back(std::thread(hardware_control_thread));
     if (!Params().getBool("WhitePandaSupport")) threads.push_back(std::thread(pigeon_thread));
 
     for (auto &t : threads) t.join();
 
-    delete panda;
+    for (Panda *p : pandas) delete p;
+    pandas.clear();
     panda = nullptr;
   }
+
+  std::string summary = alloc_summary();
+  if (!summary.empty()) LOGW("allocations:\n%s", summary.c_str());
 }
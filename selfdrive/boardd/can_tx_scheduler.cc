@@ -0,0 +1,84 @@
+#include "selfdrive/boardd/can_tx_scheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "selfdrive/common/swaglog.h"
+
+CanTxScheduler::CanTxScheduler(const char *policy, uint32_t bus_offset, uint32_t bus_cnt)
+    : bus_offset(bus_offset), bus_cnt(bus_cnt) {
+  if (policy == nullptr) return;
+
+  std::stringstream ss(policy);
+  std::string entry;
+  while (std::getline(ss, entry, ',')) {
+    char *end = nullptr;
+    uint32_t address = strtoul(entry.c_str(), &end, 0);
+    if (end == entry.c_str() || *end != ':') {
+      LOGE("bad can tx policy entry %s", entry.c_str());
+      continue;
+    }
+    uint64_t max_age_ms = strtoull(end + 1, &end, 10);
+    bool priority = strcmp(end, ":p") == 0;
+    if (*end != '\0' && !priority) {
+      LOGE("bad can tx policy entry %s", entry.c_str());
+      continue;
+    }
+    policies[address] = {max_age_ms * 1000000ULL, priority};
+  }
+}
+
+CanTxScheduler::Policy CanTxScheduler::policy(uint32_t address) const {
+  auto it = policies.find(address);
+  return it != policies.end() ? it->second : Policy{CAN_TX_DEFAULT_MAX_AGE_MS * 1000000ULL, false};
+}
+
+void CanTxScheduler::push(capnp::List<cereal::CanData>::Reader can_data_list, uint64_t log_mono_time) {
+  for (auto cmsg : can_data_list) {
+    if (cmsg.getSrc() < bus_offset || cmsg.getSrc() >= bus_offset + bus_cnt) continue;
+
+    auto dat = cmsg.getDat();
+    assert(dat.size() <= 8);
+
+    TxFrame &f = queue.emplace_back();
+    const Policy p = policy(cmsg.getAddress());
+    f.deadline = log_mono_time + p.max_age_ns;
+    f.priority = p.priority;
+    f.frame.address = cmsg.getAddress();
+    f.frame.busTime = 0;
+    f.frame.src = cmsg.getSrc() - bus_offset;
+    f.frame.len = dat.size();
+    memcpy(f.frame.dat, dat.begin(), dat.size());
+    memset(f.frame.dat + dat.size(), 0, 8 - dat.size());
+  }
+}
+
+const std::vector<CanFrame> &CanTxScheduler::pop(uint64_t now_nanos) {
+  out.clear();
+  {
+    std::lock_guard lk(stats_lock);
+    stats.max_depth = std::max<uint32_t>(stats.max_depth, queue.size());
+    for (const auto &f : queue) {
+      if (f.deadline < now_nanos) stats.late[f.frame.address]++;
+    }
+  }
+
+  queue.erase(std::remove_if(queue.begin(), queue.end(), [=](const TxFrame &f) { return f.deadline < now_nanos; }), queue.end());
+  // stable, the frames of one address keep the order they were sent in
+  std::stable_sort(queue.begin(), queue.end(), [](const TxFrame &a, const TxFrame &b) {
+    return a.priority != b.priority ? a.priority : a.deadline < b.deadline;
+  });
+  for (const auto &f : queue) out.push_back(f.frame);
+  queue.clear();
+  return out;
+}
+
+CanTxScheduler::Stats CanTxScheduler::take_stats() {
+  std::lock_guard lk(stats_lock);
+  return std::exchange(stats, {});
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "opendbc/can/common_dbc.h"
+
+// sendcan frames older than this are dropped, unless their address has its own bound
+#define CAN_TX_DEFAULT_MAX_AGE_MS 1000
+
+// Merges the frames of all pending sendcan events into one USB transfer. Priority addresses
+// (steering) go first, then everything else by deadline, the event's logMonoTime plus the
+// staleness bound of the address. Frames past their deadline are dropped and counted.
+class CanTxScheduler {
+public:
+  // policy is a comma separated list of address:max_age_ms[:p], p marks a priority address,
+  // e.g. "0x2e4:20:p,0x343:50". boardd reads it from BOARDD_CAN_TX_POLICY.
+  // Only frames on buses [bus_offset, bus_offset + bus_cnt) are queued, with bus_offset taken off
+  explicit CanTxScheduler(const char *policy = nullptr, uint32_t bus_offset = 0, uint32_t bus_cnt = 256);
+
+  void push(capnp::List<cereal::CanData>::Reader can_data_list, uint64_t log_mono_time);
+  // the queued frames still within their bound, in send order. Valid until the next call
+  const std::vector<CanFrame> &pop(uint64_t now_nanos);
+
+  // largest queue depth and frames dropped per address since the last call
+  struct Stats {
+    uint32_t max_depth = 0;
+    std::unordered_map<uint32_t, uint32_t> late;
+  };
+  Stats take_stats();
+
+private:
+  struct Policy {
+    uint64_t max_age_ns;
+    bool priority;
+  };
+  struct TxFrame {
+    uint64_t deadline;
+    bool priority;
+    CanFrame frame;
+  };
+
+  Policy policy(uint32_t address) const;
+
+  const uint32_t bus_offset, bus_cnt;
+  std::unordered_map<uint32_t, Policy> policies;
+  std::vector<TxFrame> queue;
+  std::vector<CanFrame> out;
+
+  std::mutex stats_lock;
+  Stats stats;
+};
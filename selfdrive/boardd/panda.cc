@@ -2,16 +2,121 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <map>
 #include <stdexcept>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/gpio.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
-Panda::Panda() {
+void PandaClock::add_sample(uint32_t panda_us, uint64_t host_ns, uint64_t rtt_ns) {
+  // the 32 bit timer wraps every 71 minutes
+  const uint64_t full_us = num_samples == 0 ? panda_us : last_panda_us + (uint32_t)(panda_us - (uint32_t)last_panda_us);
+  last_panda_us = full_us;
+  samples[next_sample] = {full_us, host_ns, rtt_ns};
+  next_sample = (next_sample + 1) % MAX_SAMPLES;
+  num_samples = std::min(num_samples + 1, MAX_SAMPLES);
+
+  // a slow transfer says little about when the timer was read, only the samples within twice the
+  // best round trip are used. The fit goes through the best one
+  const Sample *best = &samples[0];
+  for (int i = 1; i < num_samples; i++) {
+    if (samples[i].rtt_ns < best->rtt_ns) best = &samples[i];
+  }
+  double sxx = 0, sxy = 0;
+  for (int i = 0; i < num_samples; i++) {
+    const Sample &s = samples[i];
+    if (s.rtt_ns > 2 * best->rtt_ns) continue;
+    const double x = (int64_t)(s.panda_us - best->panda_us), y = (int64_t)(s.host_ns - best->host_ns);
+    sxx += x * x;
+    sxy += x * y;
+  }
+  base_panda_us = best->panda_us;
+  base_host_ns = best->host_ns;
+  if (sxx > 0) {
+    // crystals are good to well within 0.1%, anything else is a bad sample
+    rate = std::clamp(sxy / sxx, 999.0, 1001.0);
+  }
+}
+
+uint64_t PandaClock::frame_time(uint16_t timer_lo, uint64_t rx_ns) const {
+  if (!valid()) return 0;
+
+  // the timer when the host got the frame, and how long before that the panda did. Up to 2ms of
+  // sync error can make a frame look like it came after the transfer
+  const uint64_t now_us = base_panda_us + (int64_t)((int64_t)(rx_ns - base_host_ns) / rate);
+  int32_t age_us = (uint16_t)((uint16_t)now_us - timer_lo);
+  if (age_us > 0xFFFF - 2000) age_us -= 0x10000;
+
+  const uint64_t t = base_host_ns + (int64_t)((int64_t)(now_us - age_us - base_panda_us) * rate);
+  return std::min(t, rx_ns);
+}
+
+static bool is_panda(libusb_device *dev) {
+  libusb_device_descriptor desc;
+  return libusb_get_device_descriptor(dev, &desc) == 0 && desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc;
+}
+
+static std::string usb_serial(libusb_device *dev, libusb_device_handle *handle) {
+  libusb_device_descriptor desc;
+  unsigned char serial[64] = {};
+  if (libusb_get_device_descriptor(dev, &desc) != 0 ||
+      libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial) - 1) < 0) {
+    return "";
+  }
+  return (const char *)serial;
+}
+
+// the panda with the serial, or the first one if it's empty
+static libusb_device_handle *open_panda(libusb_context *ctx, const std::string &serial) {
+  if (serial.empty()) {
+    return libusb_open_device_with_vid_pid(ctx, 0xbbaa, 0xddcc);
+  }
+
+  libusb_device **devs = nullptr;
+  libusb_device_handle *found = nullptr;
+  ssize_t num_devices = libusb_get_device_list(ctx, &devs);
+  for (ssize_t i = 0; i < num_devices && !found; i++) {
+    libusb_device_handle *handle = nullptr;
+    if (!is_panda(devs[i]) || libusb_open(devs[i], &handle) != 0) continue;
+
+    if (usb_serial(devs[i], handle) == serial) {
+      found = handle;
+    } else {
+      libusb_close(handle);
+    }
+  }
+  libusb_free_device_list(devs, 1);
+  return found;
+}
+
+std::vector<std::string> Panda::list() {
+  std::vector<std::string> serials;
+  libusb_context *context = nullptr;
+  if (libusb_init(&context) != 0) return serials;
+
+  libusb_device **devs = nullptr;
+  ssize_t num_devices = libusb_get_device_list(context, &devs);
+  for (ssize_t i = 0; i < num_devices; i++) {
+    libusb_device_handle *handle = nullptr;
+    if (!is_panda(devs[i]) || libusb_open(devs[i], &handle) != 0) continue;
+
+    std::string serial = usb_serial(devs[i], handle);
+    if (!serial.empty()) serials.push_back(serial);
+    libusb_close(handle);
+  }
+  libusb_free_device_list(devs, 1);
+  libusb_exit(context);
+  return serials;
+}
+
+Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
   // init libusb
   int err = libusb_init(&ctx);
   if (err != 0) { goto fail; }
@@ -22,7 +127,7 @@ Panda::Panda() {
   libusb_set_debug(ctx, 3);
 #endif
 
-  dev_handle = libusb_open_device_with_vid_pid(ctx, 0xbbaa, 0xddcc);
+  dev_handle = open_panda(ctx, serial);
   if (dev_handle == NULL) { goto fail; }
 
   if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
@@ -58,7 +163,8 @@ fail:
 }
 
 Panda::~Panda() {
-  std::lock_guard lk(usb_lock);
+  stop_can_receive();
+  std::scoped_lock lk(ctrl_lock, bulk_locks[0], bulk_locks[1], bulk_locks[2], bulk_locks[3]);
   cleanup();
   connected = false;
 }
@@ -91,12 +197,15 @@ int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigne
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
-  std::lock_guard lk(usb_lock);
+  const uint64_t start = nanos_since_boot();
+  std::lock_guard lk(ctrl_lock);
+  const uint64_t locked = nanos_since_boot();
   do {
     err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
+  record_transfer(start, locked);
   return err;
 }
 
@@ -108,12 +217,15 @@ int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
-  std::lock_guard lk(usb_lock);
+  const uint64_t start = nanos_since_boot();
+  std::lock_guard lk(ctrl_lock);
+  const uint64_t locked = nanos_since_boot();
   do {
     err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
+  record_transfer(start, locked);
   return err;
 }
 
@@ -125,7 +237,9 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
     return 0;
   }
 
-  std::lock_guard lk(usb_lock);
+  const uint64_t start = nanos_since_boot();
+  std::lock_guard lk(bulk_locks[endpoint & 3]);
+  const uint64_t locked = nanos_since_boot();
   do {
     // Try sending can messages. If the receive buffer on the panda is full it will NAK
     // and libusb will try again. After 5ms, it will time out. We will drop the messages.
@@ -139,6 +253,7 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
     }
   } while(err != 0 && connected);
 
+  record_transfer(start, locked);
   return transferred;
 }
 
@@ -150,7 +265,9 @@ int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length
     return 0;
   }
 
-  std::lock_guard lk(usb_lock);
+  const uint64_t start = nanos_since_boot();
+  std::lock_guard lk(bulk_locks[endpoint & 3]);
+  const uint64_t locked = nanos_since_boot();
 
   do {
     err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
@@ -166,9 +283,38 @@ int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length
 
   } while(err != 0 && connected);
 
+  record_transfer(start, locked);
   return transferred;
 }
 
+void UsbStats::add_transfer(uint64_t start_ns, uint64_t locked_ns, uint64_t end_ns) {
+  const uint64_t us = (end_ns - start_ns) / 1000;
+  int bin = 0;
+  while (bin < USB_LATENCY_BINS - 1 && (us >> (bin + 1)) != 0) bin++;
+  latency[bin]++;
+  lock_held_ns += end_ns - locked_ns;
+}
+
+void Panda::record_transfer(uint64_t start_ns, uint64_t locked_ns) {
+  const uint64_t end = nanos_since_boot();
+  std::lock_guard lk(stats_lock);
+  stats.add_transfer(start_ns, locked_ns, end);
+}
+
+void Panda::count_rx_frames(const std::vector<CanFrame>& frames) {
+  std::lock_guard lk(stats_lock);
+  for (const CanFrame &frame : frames) {
+    if (frame.src < 128) stats.rx_frames[frame.src]++;
+  }
+}
+
+UsbStats Panda::take_usb_stats() {
+  std::lock_guard lk(stats_lock);
+  UsbStats ret = stats;
+  stats = UsbStats();
+  return ret;
+}
+
 void Panda::set_safety_model(cereal::CarParams::SafetyModel safety_model, int safety_param) {
   usb_write(0xdc, (uint16_t)safety_model, safety_param);
 }
@@ -243,6 +389,41 @@ void Panda::set_loopback(bool loopback) {
   usb_write(0xe5, loopback, 0);
 }
 
+void Panda::set_can_rx_batch(uint16_t us) {
+  usb_write(0xf9, us, 0);
+}
+
+void Panda::set_can_rx_filter(uint8_t bus, const std::vector<uint32_t> &addresses) {
+  // the bits of 16 ids at a time
+  std::map<uint16_t, uint16_t> chunks;
+  for (uint32_t addr : addresses) {
+    if (addr < 0x800) chunks[addr / 16] |= 1 << (addr % 16);
+  }
+  usb_write(0xfb, bus, 1);
+  for (auto [chunk, bits] : chunks) {
+    usb_write(0xfc, bus | (chunk << 8), bits);
+  }
+}
+
+void Panda::sync_clock() {
+  uint32_t panda_us = 0;
+  const uint64_t start = nanos_since_boot();
+  int err = usb_read(0xfa, 0, 0, (unsigned char*)&panda_us, sizeof(panda_us));
+  const uint64_t end = nanos_since_boot();
+  // older firmware doesn't have the request
+  if (err != sizeof(panda_us)) return;
+
+  std::lock_guard lk(clock_lock);
+  clock.add_sample(panda_us, start + (end - start) / 2, end - start);
+}
+
+void Panda::stamp_frames(std::vector<CanFrame>& frames, uint64_t rx_ns) {
+  std::lock_guard lk(clock_lock);
+  for (CanFrame &frame : frames) {
+    frame.host_time = clock.frame_time(frame.busTime, rx_ns);
+  }
+}
+
 std::optional<std::vector<uint8_t>> Panda::get_firmware_version() {
   std::vector<uint8_t> fw_sig_buf(128);
   int read_1 = usb_read(0xd3, 0, 0, &fw_sig_buf[0], 64);
@@ -269,7 +450,7 @@ void Panda::send_heartbeat() {
 }
 
 void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
-  static std::vector<uint32_t> send;
+  std::vector<uint32_t> &send = send_buf;
   const int msg_count = can_data_list.size();
 
   send.resize(msg_count*0x10);
@@ -290,38 +471,235 @@ void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
   usb_bulk_write(3, (unsigned char*)send.data(), send.size(), 5);
 }
 
-int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
-  uint32_t data[RECV_SIZE/4];
+void Panda::can_send(const std::vector<CanFrame>& frames) {
+  std::vector<uint32_t> &send = send_buf;
+  send.resize(frames.size()*4);
+
+  for (int i = 0; i < frames.size(); i++) {
+    const CanFrame &frame = frames[i];
+    if (frame.address >= 0x800) { // extended
+      send[i*4] = (frame.address << 3) | 5;
+    } else { // normal
+      send[i*4] = (frame.address << 21) | 1;
+    }
+    send[i*4+1] = frame.len | (frame.src << 4);
+    memcpy(&send[i*4+2], frame.dat, 8);
+  }
+
+  usb_bulk_write(3, (unsigned char*)send.data(), send.size()*4, 5);
+}
+
+static inline void decode_can_record(const uint32_t *rec, CanFrame &frame, uint32_t bus_offset) {
+  if (rec[0] & 4) {
+    // extended
+    frame.address = rec[0] >> 3;
+    //printf("got extended: %x\n", rec[0] >> 3);
+  } else {
+    // normal
+    frame.address = rec[0] >> 21;
+  }
+  frame.busTime = rec[1] >> 16;
+  // a record holds at most 8 data bytes
+  frame.len = std::min<uint8_t>(rec[1]&0xF, 8);
+  frame.src = ((rec[1] >> 4) & 0xff) + bus_offset;
+  memcpy(frame.dat, &rec[2], 8);
+  memset(frame.dat + frame.len, 0, 8 - frame.len);
+  frame.host_time = 0;
+}
+
+void Panda::decode_can_records(const uint32_t *data, int len, std::vector<CanFrame>& out_frames, uint32_t bus_offset) {
+  size_t num_msg = len / 0x10;
+  out_frames.resize(num_msg);
+  for (int i = 0; i < num_msg; i++) {
+    decode_can_record(&data[i*4], out_frames[i], bus_offset);
+  }
+}
+
+int Panda::can_read(uint32_t *data) {
   int recv = usb_bulk_read(0x81, (unsigned char*)data, RECV_SIZE);
 
   // Not sure if this can happen
   if (recv < 0) recv = 0;
 
   if (recv == RECV_SIZE) {
-    LOGW("Receive buffer full");
+    LOGW_DEDUP("Receive buffer full");
+    std::lock_guard lk(stats_lock);
+    stats.rx_buffer_full++;
   }
+  return recv;
+}
+
+int Panda::can_receive(std::vector<CanFrame>& out_frames) {
+  uint32_t data[RECV_SIZE/4];
+  int recv = can_read(data);
+  decode_can_records(data, recv, out_frames, bus_offset);
+  stamp_frames(out_frames, nanos_since_boot());
+  count_rx_frames(out_frames);
+  return recv;
+}
 
-  size_t num_msg = recv / 0x10;
-  MessageBuilder msg;
+kj::ArrayPtr<capnp::byte> Panda::can_event(const std::vector<CanFrame>& frames) {
+  MessageBuilder msg(can_arena);
   auto evt = msg.initEvent();
   evt.setValid(comms_healthy);
 
   // populate message
+  auto canData = evt.initCan(frames.size());
+  for (int i = 0; i < frames.size(); i++) {
+    const CanFrame &frame = frames[i];
+    canData[i].setAddress(frame.address);
+    canData[i].setBusTime(frame.busTime);
+    canData[i].setDat(kj::arrayPtr(frame.dat, frame.len));
+    canData[i].setSrc(frame.src);
+    canData[i].setHostTime(frame.host_time);
+  }
+  return msg.toBytes();
+}
+
+kj::ArrayPtr<capnp::byte> Panda::can_event(const uint32_t *data, int len, uint64_t rx_ns) {
+  MessageBuilder msg(can_arena);
+  auto evt = msg.initEvent();
+  evt.setValid(comms_healthy);
+
+  // the list is sized from the read, every record goes straight into its CanData
+  const int num_msg = len / 0x10;
   auto canData = evt.initCan(num_msg);
+  event_frames.resize(num_msg);
+  std::lock_guard lk(clock_lock);
+  std::lock_guard stats_lk(stats_lock);
   for (int i = 0; i < num_msg; i++) {
-    if (data[i*4] & 4) {
-      // extended
-      canData[i].setAddress(data[i*4] >> 3);
-      //printf("got extended: %x\n", data[i*4] >> 3);
-    } else {
-      // normal
-      canData[i].setAddress(data[i*4] >> 21);
-    }
-    canData[i].setBusTime(data[i*4+1] >> 16);
-    int len = data[i*4+1]&0xF;
-    canData[i].setDat(kj::arrayPtr((uint8_t*)&data[i*4+2], len));
-    canData[i].setSrc((data[i*4+1] >> 4) & 0xff);
+    CanFrame &frame = event_frames[i];
+    decode_can_record(&data[i*4], frame, bus_offset);
+    frame.host_time = clock.frame_time(frame.busTime, rx_ns);
+    if (frame.src < 128) stats.rx_frames[frame.src]++;
+    canData[i].setAddress(frame.address);
+    canData[i].setBusTime(frame.busTime);
+    canData[i].setDat(kj::arrayPtr(frame.dat, frame.len));
+    canData[i].setSrc(frame.src);
+    canData[i].setHostTime(frame.host_time);
   }
-  out_buf = capnp::messageToFlatArray(msg);
+  return msg.toBytes();
+}
+
+kj::ArrayPtr<capnp::byte> Panda::can_packed_event(const std::vector<CanFrame>& frames) {
+  MessageBuilder msg(can_packed_arena);
+  auto evt = msg.initEvent();
+  evt.setValid(comms_healthy);
+  evt.setCanPacked(kj::arrayPtr((const capnp::byte *)frames.data(), frames.size() * sizeof(CanFrame)));
+  return msg.toBytes();
+}
+
+int Panda::can_receive(kj::ArrayPtr<capnp::byte>& out_buf, kj::ArrayPtr<capnp::byte>& out_packed) {
+  uint32_t data[RECV_SIZE/4];
+  int recv = can_read(data);
+  out_buf = can_event(data, recv, nanos_since_boot());
+  out_packed = can_packed_event(event_frames);
   return recv;
 }
+
+bool Panda::start_can_receive(std::function<void(const std::vector<CanFrame>&)> callback) {
+  assert(!rx_running);
+  rx_callback = callback;
+  rx_transfers = std::vector<RxTransfer>(NUM_RX_TRANSFERS);
+  rx_running = true;
+
+  for (auto &t : rx_transfers) {
+    t.xfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(t.xfer, dev_handle, 0x81, (unsigned char*)t.data, RECV_SIZE, rx_transfer_done, this, 0);
+    int err = libusb_submit_transfer(t.xfer);
+    if (err != 0) {
+      handle_usb_issue(err, __func__);
+      break;
+    }
+    rx_inflight++;
+  }
+
+  if (rx_inflight == 0) {
+    rx_running = false;
+    for (auto &t : rx_transfers) libusb_free_transfer(t.xfer);
+    rx_transfers.clear();
+    return false;
+  }
+  rx_thread = std::thread(&Panda::rx_event_loop, this);
+  return true;
+}
+
+void Panda::stop_can_receive() {
+  if (!rx_thread.joinable()) return;
+
+  rx_running = false;
+  rx_thread.join();
+  for (auto &t : rx_transfers) libusb_free_transfer(t.xfer);
+  rx_transfers.clear();
+}
+
+void Panda::rx_event_loop() {
+  bool cancelled = false;
+  while (rx_inflight > 0) {
+    if (!rx_running && !cancelled) {
+      for (auto &t : rx_transfers) {
+        if (!t.idle) libusb_cancel_transfer(t.xfer);
+      }
+      cancelled = true;
+    }
+
+    // the reads that came back empty, the callbacks run on this thread as well
+    const uint64_t now = nanos_since_boot();
+    uint64_t wait_ns = 100 * 1000000ULL;
+    for (auto &t : rx_transfers) {
+      if (!t.idle) continue;
+      if (!rx_running || now >= t.resubmit_ns) {
+        t.idle = false;
+        if (!rx_running || !connected || libusb_submit_transfer(t.xfer) != 0) rx_inflight--;
+      } else {
+        wait_ns = std::min(wait_ns, t.resubmit_ns - now);
+      }
+    }
+    if (rx_inflight == 0) break;
+
+    struct timeval tv = {.tv_sec = 0, .tv_usec = (suseconds_t)(wait_ns / 1000)};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+}
+
+void LIBUSB_CALL Panda::rx_transfer_done(libusb_transfer *xfer) {
+  Panda *panda = (Panda*)xfer->user_data;
+
+  bool empty = false;
+  if (xfer->status == LIBUSB_TRANSFER_COMPLETED && (xfer->actual_length == 0 || xfer->actual_length % 0x10 != 0)) {
+    // the panda answers with a zero length packet when it has nothing, so no callback for it
+    if (xfer->actual_length != 0) LOGE_100("usb rx of 0x%x bytes, not whole records", xfer->actual_length);
+    empty = true;
+  } else if (xfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    if (xfer->actual_length == RECV_SIZE) {
+      LOGW_DEDUP("Receive buffer full");
+      std::lock_guard lk(panda->stats_lock);
+      panda->stats.rx_buffer_full++;
+    }
+    decode_can_records((const uint32_t*)xfer->buffer, xfer->actual_length, panda->can_frames, panda->bus_offset);
+    panda->stamp_frames(panda->can_frames, nanos_since_boot());
+    panda->count_rx_frames(panda->can_frames);
+    panda->rx_callback(panda->can_frames);
+  } else if (xfer->status == LIBUSB_TRANSFER_OVERFLOW) {
+    panda->comms_healthy = false;
+    LOGE_100("overflow got 0x%x", xfer->actual_length);
+  } else if (xfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+    LOGE("lost connection");
+    panda->connected = false;
+  } else if (xfer->status != LIBUSB_TRANSFER_CANCELLED && xfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+    LOGE_100("usb rx transfer status %d", xfer->status);
+  }
+
+  if (empty && panda->rx_running) {
+    // not right away, that would be a busy loop on the bus while it's quiet
+    for (auto &t : panda->rx_transfers) {
+      if (t.xfer == xfer) {
+        t.idle = true;
+        t.resubmit_ns = nanos_since_boot() + RX_IDLE_RESUBMIT_NS;
+      }
+    }
+    return;
+  }
+  if (panda->rx_running && panda->connected && libusb_submit_transfer(xfer) == 0) return;
+  panda->rx_inflight--;
+}
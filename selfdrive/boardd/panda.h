@@ -3,18 +3,32 @@
 #include <atomic>
 #include <cstdint>
 #include <ctime>
+#include <functional>
 #include <mutex>
 #include <optional>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <libusb-1.0/libusb.h>
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
+#include "cereal/messaging/messaging.h"
+#include "opendbc/can/common_dbc.h"
 
 // double the FIFO size
 #define RECV_SIZE (0x1000)
 #define TIMEOUT 0
+// bulk reads kept in flight by the async receive
+#define NUM_RX_TRANSFERS 3
+// a read that came back without records is submitted again after the poll interval of can_recv_thread
+#define RX_IDLE_RESUBMIT_NS (10 * 1000000ULL)
+// buses of one panda, with several the buses of the panda at bus_offset are bus_offset + bus
+// in can and sendcan
+#define PANDA_BUS_CNT 4
+// transfer latency histogram of UsbStats, bins of powers of two us
+#define USB_LATENCY_BINS 16
 
 // copied from panda/board/main.c
 struct __attribute__((packed)) health_t {
@@ -37,26 +51,102 @@ struct __attribute__((packed)) health_t {
   uint8_t fault_status;
   uint8_t power_save_enabled;
   uint8_t heartbeat_lost;
+  uint32_t can_rx_overflow;
 };
 
+// USB and CAN receive counters of a panda, since the last take_usb_stats
+struct UsbStats {
+  uint32_t latency[USB_LATENCY_BINS] = {};  // transfers by us from the call to completion, log2 bins
+  uint64_t lock_held_ns = 0;                // time the transfers held ctrl_lock or a bulk lock
+  uint32_t rx_buffer_full = 0;              // reads that returned RECV_SIZE, the panda may have more
+  uint32_t rx_frames[128] = {};             // received frames by src, TX echoes aren't counted
+
+  void add_transfer(uint64_t start_ns, uint64_t locked_ns, uint64_t end_ns);
+};
+
+// Maps the panda's microsecond timer to CLOCK_BOOTTIME. Each sample pairs a timer read with the host
+// time halfway through its control transfer, the mapping is a line fit through the recent samples
+// with the shortest round trips
+class PandaClock {
+ public:
+  void add_sample(uint32_t panda_us, uint64_t host_ns, uint64_t rtt_ns);
+  bool valid() const { return num_samples >= 2; }
+  // host time of a frame with the low 16 bits of the timer, received by the host at rx_ns. Frames
+  // are at most one timer wrap, 65ms, older than their USB transfer
+  uint64_t frame_time(uint16_t timer_lo, uint64_t rx_ns) const;
+
+ private:
+  struct Sample {
+    uint64_t panda_us, host_ns, rtt_ns;
+  };
+  static const int MAX_SAMPLES = 16;
+  Sample samples[MAX_SAMPLES];
+  int num_samples = 0, next_sample = 0;
+  uint64_t last_panda_us = 0;
+
+  // host_ns = base_host_ns + rate * (panda_us - base_panda_us)
+  uint64_t base_panda_us = 0, base_host_ns = 0;
+  double rate = 1000.0;
+};
 
 class Panda {
  private:
   libusb_context *ctx = NULL;
   libusb_device_handle *dev_handle = NULL;
-  std::mutex usb_lock;
+  // control transfers (state, fan, IR, RTC) and each bulk endpoint (CAN RX, CAN TX, pigeon) lock
+  // on their own, libusb allows concurrent transfers, so CAN is never stuck behind housekeeping
+  std::mutex ctrl_lock;
+  std::mutex bulk_locks[4];
+  MessageArena can_arena, can_packed_arena;
+  std::vector<CanFrame> can_frames;
+  // the records of can_send, of the one thread that sends to this panda
+  std::vector<uint32_t> send_buf;
+  // of the last can_event from the panda's records, for its canPacked event
+  std::vector<CanFrame> event_frames;
+  std::mutex clock_lock;
+  PandaClock clock;
+  std::mutex stats_lock;
+  UsbStats stats;
+  // a transfer called at start_ns, holding its lock from locked_ns until now
+  void record_transfer(uint64_t start_ns, uint64_t locked_ns);
+  void count_rx_frames(const std::vector<CanFrame>& frames);
+  // host_time of every frame, from the clock at the time they were received
+  void stamp_frames(std::vector<CanFrame>& frames, uint64_t rx_ns);
   void handle_usb_issue(int err, const char func[]);
   void cleanup();
+  int can_read(uint32_t *data);
+
+  // async receive, the transfers are resubmitted from their callback on rx_thread,
+  // the empty ones by rx_event_loop after RX_IDLE_RESUBMIT_NS
+  struct RxTransfer {
+    libusb_transfer *xfer = nullptr;
+    // empty, waiting for resubmit_ns on rx_thread
+    bool idle = false;
+    uint64_t resubmit_ns = 0;
+    uint32_t data[RECV_SIZE/4];
+  };
+  std::vector<RxTransfer> rx_transfers;
+  std::function<void(const std::vector<CanFrame>&)> rx_callback;
+  std::atomic<bool> rx_running = false;
+  std::atomic<int> rx_inflight = 0;
+  std::thread rx_thread;
+  void rx_event_loop();
+  static void LIBUSB_CALL rx_transfer_done(libusb_transfer *xfer);
 
  public:
-  Panda();
+  // opens the panda with the USB serial, any panda if it's empty
+  Panda(std::string serial = "", uint32_t bus_offset = 0);
   ~Panda();
 
+  // USB serials of the connected pandas
+  static std::vector<std::string> list();
+
   std::atomic<bool> connected = true;
   std::atomic<bool> comms_healthy = true;
   cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::UNKNOWN;
   bool is_pigeon = false;
   bool has_rtc = false;
+  const uint32_t bus_offset;
 
   // HW communication
   int usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout=TIMEOUT);
@@ -75,11 +165,39 @@ class Panda {
   void set_ir_pwr(uint16_t ir_pwr);
   health_t get_state();
   void set_loopback(bool loopback);
+  // the panda holds back RX packets that aren't full for up to us, 0 sends every frame right away
+  void set_can_rx_batch(uint16_t us);
+  // only the standard ids in addresses come from bus, of this panda. Extended ids always do. The panda
+  // clears its filters when the safety model changes, so this goes after set_safety_model
+  void set_can_rx_filter(uint8_t bus, const std::vector<uint32_t> &addresses);
+  // reads the panda's timer for the frame timestamps, boardd calls it at 2hz
+  void sync_clock();
+  // counters since the last call, for boarddStats
+  UsbStats take_usb_stats();
   std::optional<std::vector<uint8_t>> get_firmware_version();
   std::optional<std::string> get_serial();
   void set_power_saving(bool power_saving);
   void set_usb_power_mode(cereal::PandaState::UsbPowerMode power_mode);
   void send_heartbeat();
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  int can_receive(kj::Array<capnp::word>& out_buf);
+  // one bulk write of all frames, src is the bus of this panda, without bus_offset
+  void can_send(const std::vector<CanFrame>& frames);
+  // out_buf and out_packed, the can and canPacked events, point into buffers owned by the panda,
+  // valid until the next call
+  int can_receive(kj::ArrayPtr<capnp::byte>& out_buf, kj::ArrayPtr<capnp::byte>& out_packed);
+  // decoded frames for in-process parsers, without building a can event. returns the bytes read
+  int can_receive(std::vector<CanFrame>& out_frames);
+  // can event of the frames, points into a buffer owned by the panda valid until the next call
+  kj::ArrayPtr<capnp::byte> can_event(const std::vector<CanFrame>& frames);
+  // same, straight from the panda's records read at rx_ns
+  kj::ArrayPtr<capnp::byte> can_event(const uint32_t *data, int len, uint64_t rx_ns);
+  // canPacked event of the frames, one copy of them. In a buffer of its own, valid until the next call
+  kj::ArrayPtr<capnp::byte> can_packed_event(const std::vector<CanFrame>& frames);
+
+  // Async receive: NUM_RX_TRANSFERS bulk reads stay in flight, callback gets the frames of each
+  // one as soon as it completes, on the panda's USB event thread. Replaces calling can_receive
+  bool start_can_receive(std::function<void(const std::vector<CanFrame>&)> callback);
+  void stop_can_receive();
+
+  static void decode_can_records(const uint32_t *data, int len, std::vector<CanFrame>& out_frames, uint32_t bus_offset = 0);
 };
@@ -6,6 +6,7 @@
 
 #include <cassert>
 #include <cerrno>
+#include <cstring>
 #include <optional>
 
 #include "selfdrive/common/gpio.h"
@@ -295,3 +296,51 @@ void TTYPigeon::set_power(bool power) {
 TTYPigeon::~TTYPigeon() {
   close(pigeon_tty_fd);
 }
+
+void UbxFramer::push(const char *data, size_t len) {
+  // drop what was popped already, a frame is never moved more than once
+  if (start > 0 && start >= buf.size() / 2) {
+    buf.erase(buf.begin(), buf.begin() + start);
+    start = 0;
+  }
+  buf.insert(buf.end(), data, data + len);
+}
+
+bool UbxFramer::pop(std::string_view &frame) {
+  const size_t header_size = ublox::UBLOX_HEADER_SIZE, checksum_size = ublox::UBLOX_CHECKSUM_SIZE;
+  while (pending() >= 2) {
+    const uint8_t *d = (const uint8_t *)&buf[start];
+    if (d[0] != ublox::PREAMBLE1 || d[1] != ublox::PREAMBLE2) {
+      // resync on the next preamble
+      const void *next = memchr(d + 1, ublox::PREAMBLE1, pending() - 1);
+      start = next ? (const char *)next - buf.data() : buf.size();
+      continue;
+    }
+    if (pending() < header_size) return false;
+
+    // a truncated frame reads its length from whatever follows, don't wait for up to 64k of it
+    const size_t payload_size = d[4] | (d[5] << 8);
+    if (payload_size > UBX_MAX_PAYLOAD) {
+      start += 1;
+      continue;
+    }
+    const size_t frame_size = header_size + payload_size + checksum_size;
+    if (pending() < frame_size) return false;
+
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < frame_size - checksum_size; i++) {
+      ck_a += d[i];
+      ck_b += ck_a;
+    }
+    if (ck_a != d[frame_size - 2] || ck_b != d[frame_size - 1]) {
+      LOGD("ubx checksum mismatch, class %02X id %02X", d[2], d[3]);
+      start += 1;
+      continue;
+    }
+
+    frame = std::string_view(&buf[start], frame_size);
+    start += frame_size;
+    return true;
+  }
+  return false;
+}
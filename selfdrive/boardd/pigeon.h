@@ -4,6 +4,8 @@
 
 #include <atomic>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "selfdrive/boardd/panda.h"
 
@@ -47,3 +49,20 @@ public:
   std::string receive();
   void set_power(bool power);
 };
+
+// larger than any message the pigeon is configured to send, RXM-RAWX of 255 measurements is 8176
+#define UBX_MAX_PAYLOAD 8192
+
+// Reassembles the pigeon byte stream into whole, checksummed UBX frames. Bytes that aren't part
+// of a frame (NMEA, noise after a reset) are skipped
+class UbxFramer {
+public:
+  void push(const char *data, size_t len);
+  // next complete frame, valid until the next push. false if there's none yet
+  bool pop(std::string_view &frame);
+  size_t pending() const { return buf.size() - start; }
+
+private:
+  std::vector<char> buf;
+  size_t start = 0;
+};
@@ -0,0 +1,118 @@
+// The safety hooks of the panda firmware built for the host, to replay the CAN of logs through them.
+// They run as in the firmware, the registers and board they use are stand ins here
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "selfdrive/boardd/safety_replay.h"
+
+typedef struct {
+  uint32_t RIR;
+  uint32_t RDTR;
+  uint32_t RDLR;
+  uint32_t RDHR;
+} CAN_FIFOMailBox_TypeDef;
+
+// as in panda/board/stm32fx/llcan.h
+#define GET_BUS(msg) (((msg)->RDTR >> 4) & 0xFF)
+#define GET_LEN(msg) ((msg)->RDTR & 0xF)
+#define GET_ADDR(msg) ((((msg)->RIR & 4) != 0) ? ((msg)->RIR >> 3) : ((msg)->RIR >> 21))
+#define GET_BYTE(msg, b) (((int)(b) > 3) ? (((msg)->RDHR >> (8U * ((unsigned int)(b) % 4U))) & 0xFFU) : (((msg)->RDLR >> (8U * (unsigned int)(b))) & 0xFFU))
+#define GET_BYTES_04(msg) ((msg)->RDLR)
+#define GET_BYTES_48(msg) ((msg)->RDHR)
+#define GET_FLAG(value, mask) (((__typeof__(mask))(value) & (mask)) == (mask))
+
+// as in panda/board/config.h
+#define MIN(a,b) \
+ ({ __typeof__ (a) _a = (a); \
+     __typeof__ (b) _b = (b); \
+   (_a < _b) ? _a : _b; })
+
+#define MAX(a,b) \
+ ({ __typeof__ (a) _a = (a); \
+     __typeof__ (b) _b = (b); \
+   (_a > _b) ? _a : _b; })
+
+#define ABS(a) \
+ ({ __typeof__ (a) _a = (a); \
+   (_a > 0) ? _a : (-_a); })
+
+#define UNUSED(x) (void)(x)
+#define ENTER_CRITICAL()
+#define EXIT_CRITICAL()
+
+#define CAN_MODE_NORMAL 0U
+#define CAN_MODE_OBD_CAN2 3U
+
+// the time of the frame the hooks are on
+uint32_t replay_timer = 0U;
+uint32_t microsecond_timer_get(void) {
+  return replay_timer;
+}
+
+static bool verbose = false;
+static void replay_puts(const char *a) {
+  if (verbose) printf("%s", a);
+}
+static void replay_puth(unsigned int i) {
+  if (verbose) printf("%x", i);
+}
+#define puts replay_puts
+#define puth replay_puth
+
+// the hooks switch the CAN mode of boards with OBD-II CAN, which the replay doesn't have
+struct board {
+  const bool has_obd;
+  void (*set_can_mode)(uint8_t mode);
+};
+static void replay_set_can_mode(uint8_t mode) {
+  UNUSED(mode);
+}
+const struct board replay_board = {.has_obd = false, .set_can_mode = replay_set_can_mode};
+const struct board *current_board = &replay_board;
+
+#include "panda/board/faults.h"
+#include "panda/board/safety.h"
+
+static uint64_t next_tick_us = 0U;
+
+int safety_replay_set_mode(uint16_t mode, int16_t param) {
+  next_tick_us = 0U;
+  return set_safety_hooks(mode, param);
+}
+
+int safety_replay_run(const safety_replay_frame *frames, int n, safety_replay_result *results) {
+  int blocked = 0;
+  for (int i = 0; i < n; i++) {
+    const safety_replay_frame *f = &frames[i];
+    if (next_tick_us == 0U) {
+      next_tick_us = f->ts_us + 1000000U;
+    }
+    while (f->ts_us >= next_tick_us) {
+      replay_timer = (uint32_t)next_tick_us;
+      safety_tick(current_hooks);
+      next_tick_us += 1000000U;
+    }
+    replay_timer = (uint32_t)f->ts_us;
+
+    CAN_FIFOMailBox_TypeDef msg = {0};
+    msg.RIR = (f->addr > 0x7FFU) ? ((f->addr << 3) | 4U) : (f->addr << 21);
+    msg.RDTR = (MIN(f->len, 8U) & 0xFU) | ((uint32_t)f->bus << 4);
+    memcpy(&msg.RDLR, &f->data[0], 4);
+    memcpy(&msg.RDHR, &f->data[4], 4);
+
+    int ret = f->tx ? safety_tx_hook(&msg) : safety_rx_hook(&msg);
+    if (f->tx && (ret == 0)) {
+      blocked++;
+    }
+    results[i].ret = (int8_t)ret;
+    results[i].controls_allowed = controls_allowed;
+    results[i].relay_malfunction = relay_malfunction;
+  }
+  return blocked;
+}
+
+void safety_replay_set_verbose(int v) {
+  verbose = (v != 0);
+}
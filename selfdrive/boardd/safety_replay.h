@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A frame of a log for the panda safety hooks, one the car sent or one openpilot sent it
+typedef struct {
+  uint64_t ts_us;          // the low 32 bits are the panda's microsecond timer for the hooks
+  uint32_t addr;
+  uint8_t bus;
+  uint8_t len;
+  uint8_t tx;              // 1 for the tx hook, 0 for the rx hook
+  uint8_t data[8];
+} safety_replay_frame;
+
+typedef struct {
+  int8_t ret;              // of the hook, for a tx 1 if the panda sends it
+  uint8_t controls_allowed;
+  uint8_t relay_malfunction;
+} safety_replay_result;
+
+// The safety mode and its param, as set_safety_hooks of the firmware, 0 if the mode exists
+int safety_replay_set_mode(uint16_t mode, int16_t param);
+
+// Runs the hooks on n frames in the order of the array, with the state after each one in results.
+// safety_tick runs every second of the frames' time, like the firmware's 1Hz tick. The state is kept
+// from the call before, until the next safety_replay_set_mode. Returns the tx frames blocked
+int safety_replay_run(const safety_replay_frame *frames, int n, safety_replay_result *results);
+
+// The hooks' debug prints on stdout, off by default
+void safety_replay_set_verbose(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "selfdrive/boardd/safety_replay.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/loggerd/logreader.h"
+
+// Replays the CAN of logs through the safety hooks of the panda firmware: what the car sent through the
+// rx hook and openpilot's sendcan through the tx hook, with the safety model of the log's carParams.
+// The frames of a log are gathered and run in one safety_replay_run call. Every log starts from a new
+// safety state, and the state is the process', so runs over many routes go one process per core:
+//   ls /data/media/0/realdata/*/rlog.bz2 | xargs -P 8 -n 16 ./safety_replay
+// Prints the tx frames blocked by address, exits 1 if there are any
+// usage: ./safety_replay [--mode N] [--param N] [--verbose] rlog...
+int main(int argc, char *argv[]) {
+  int mode = -1, param = 0;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+      mode = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--param") == 0 && i + 1 < argc) {
+      param = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      safety_replay_set_verbose(1);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s [--mode N] [--param N] [--verbose] rlog...\n", argv[0]);
+    return 1;
+  }
+
+  int total_blocked = 0;
+  std::vector<safety_replay_frame> frames;
+  std::vector<safety_replay_result> results;
+  for (const std::string &path : paths) {
+    LogReader log;
+    if (!log.load(path)) {
+      printf("%s: can't be read\n", path.c_str());
+      continue;
+    }
+
+    // the safety model of the log, carParams is only in some of the segments of a route
+    int log_mode = mode, log_param = param;
+    frames.clear();
+    for (const LogReader::Event &e : log.events()) {
+      if (e.which != cereal::Event::CAN && e.which != cereal::Event::SENDCAN && e.which != cereal::Event::CAR_PARAMS) {
+        continue;
+      }
+      capnp::FlatArrayMessageReader msg(e.words);
+      cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+      if (e.which == cereal::Event::CAR_PARAMS) {
+        if (log_mode == -1) {
+          log_mode = (int)event.getCarParams().getSafetyModel();
+          log_param = event.getCarParams().getSafetyParam();
+        }
+        continue;
+      }
+
+      const bool tx = e.which == cereal::Event::SENDCAN;
+      for (auto c : tx ? event.getSendcan() : event.getCan()) {
+        // the frames the pandas sent, echoed back, are in can too
+        if (c.getSrc() >= 128) continue;
+        safety_replay_frame f = {.ts_us = e.mono_time / 1000, .addr = c.getAddress(), .bus = c.getSrc(),
+                                 .len = (uint8_t)std::min<size_t>(c.getDat().size(), 8), .tx = tx};
+        memcpy(f.data, c.getDat().begin(), f.len);
+        frames.push_back(f);
+      }
+    }
+    if (log_mode == -1) {
+      printf("%s: no carParams, skipped\n", path.c_str());
+      continue;
+    }
+    if (safety_replay_set_mode(log_mode, log_param) != 0) {
+      printf("%s: safety model %d doesn't exist\n", path.c_str(), log_mode);
+      continue;
+    }
+
+    results.resize(frames.size());
+    const double t1 = millis_since_boot();
+    const int blocked = safety_replay_run(frames.data(), frames.size(), results.data());
+    const double t2 = millis_since_boot();
+    total_blocked += blocked;
+
+    size_t tx = 0, tx_allowed = 0;
+    std::map<std::pair<uint8_t, uint32_t>, int> blocked_by_addr;
+    for (size_t i = 0; i < frames.size(); i++) {
+      if (!frames[i].tx) continue;
+      tx++;
+      tx_allowed += results[i].controls_allowed;
+      if (results[i].ret == 0) blocked_by_addr[{frames[i].bus, frames[i].addr}]++;
+    }
+    printf("%s: safety model %d param %d, %zu frames in %.1fms, %zu tx, %d blocked, controls allowed for %zu of them\n",
+           path.c_str(), log_mode, log_param, frames.size(), t2 - t1, tx, blocked, tx_allowed);
+    for (auto &[bus_addr, count] : blocked_by_addr) {
+      printf("  blocked bus %d 0x%X: %d\n", bus_addr.first, bus_addr.second, count);
+    }
+  }
+  return total_blocked > 0 ? 1 : 0;
+}
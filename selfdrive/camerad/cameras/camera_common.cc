@@ -1,22 +1,31 @@
 #include "selfdrive/camerad/cameras/camera_common.h"
 
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <cstdio>
 #include <chrono>
 #include <thread>
+#include <vector>
 
-#include "libyuv.h"
 #include <jpeglib.h>
 
+#include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/camerad/imgproc/utils.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/trace.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/loggerd/include/msm_media_info.h"
 
 #ifdef QCOM
 #include "selfdrive/camerad/cameras/camera_qcom.h"
@@ -29,6 +38,20 @@
 #endif
 
 const int YUV_COUNT = 100;
+const int THUMBNAIL_FRAMES = 100;
+const int THUMBNAIL_NICE = 10;
+
+// real_debayer.cl writes the yuv frame too, instead of a separate rgb_to_yuv pass (scons --fused-debayer)
+#ifdef DEBAYER_FUSED_YUV
+constexpr bool fused_yuv = true;
+#else
+constexpr bool fused_yuv = false;
+#endif
+
+// the halves of [0, 1] of the tone curve lut of real_debayer.cl
+const size_t TONE_LUT_SIZE = 0x3C01;
+const int DEBAYER_PROFILE_FRAMES = 100;
+static const bool profile_gpu = getenv("CAMERAD_GPU_PROFILE") != nullptr;
 
 static cl_program build_debayer_program(cl_device_id device_id, cl_context context, const CameraInfo *ci, const CameraBuf *b, const CameraState *s) {
   char args[4096];
@@ -36,14 +59,24 @@ static cl_program build_debayer_program(cl_device_id device_id, cl_context conte
            "-cl-fast-relaxed-math -cl-denorms-are-zero "
            "-DFRAME_WIDTH=%d -DFRAME_HEIGHT=%d -DFRAME_STRIDE=%d "
            "-DRGB_WIDTH=%d -DRGB_HEIGHT=%d -DRGB_STRIDE=%d "
-           "-DBAYER_FLIP=%d -DHDR=%d -DCAM_NUM=%d",
+           "-DBAYER_FLIP=%d -DHDR=%d -DCAM_NUM=%d%s",
            ci->frame_width, ci->frame_height, ci->frame_stride,
            b->rgb_width, b->rgb_height, b->rgb_stride,
-           ci->bayer_flip, ci->hdr, s->camera_num);
+           ci->bayer_flip, ci->hdr, s->camera_num, fused_yuv ? " -DFUSED_YUV" : "");
   const char *cl_file = Hardware::TICI() ? "cameras/real_debayer.cl" : "cameras/debayer.cl";
   return cl_program_from_file(context, device_id, cl_file, args);
 }
 
+// Named VisionIpc streams with the quarter size frames
+static const char *preview_stream_name(VisionStreamType yuv_type) {
+  switch (yuv_type) {
+    case VISION_STREAM_YUV_BACK: return "yuv_back_preview";
+    case VISION_STREAM_YUV_FRONT: return "yuv_front_preview";
+    case VISION_STREAM_YUV_WIDE: return "yuv_wide_preview";
+    default: assert(0); return nullptr;
+  }
+}
+
 void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s, VisionIpcServer * v, int frame_cnt, VisionStreamType rgb_type, VisionStreamType yuv_type, release_cb release_callback) {
   vipc_server = v;
   this->rgb_type = rgb_type;
@@ -83,50 +116,147 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   if (ci->bayer) {
     cl_program prg_debayer = build_debayer_program(device_id, context, ci, this, s);
     krnl_debayer = CL_CHECK_ERR(clCreateKernel(prg_debayer, "debayer10", &err));
+    if (Hardware::TICI()) {
+      tone_lut_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, TONE_LUT_SIZE, NULL, &err));
+      cl_kernel krnl_tone_lut = CL_CHECK_ERR(clCreateKernel(prg_debayer, "tone_lut", &err));
+      CL_CHECK(clSetKernelArg(krnl_tone_lut, 0, sizeof(cl_mem), &tone_lut_cl));
+      cl_command_queue lut_q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+      CL_CHECK(clEnqueueNDRangeKernel(lut_q, krnl_tone_lut, 1, NULL, &TONE_LUT_SIZE, NULL, 0, NULL, NULL));
+      CL_CHECK(clFinish(lut_q));
+      CL_CHECK(clReleaseCommandQueue(lut_q));
+      CL_CHECK(clReleaseKernel(krnl_tone_lut));
+    }
     CL_CHECK(clReleaseProgram(prg_debayer));
   }
 
-  rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
+  if (fused_yuv) {
+    assert(ci->bayer);
+  } else {
+    rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
+  }
+
+  downscale_yuv = std::make_unique<DownscaleYuv>(context, device_id, rgb_width, rgb_height);
+  preview_width = downscale_yuv->out_width;
+  preview_height = downscale_yuv->out_height;
+  preview_type = vipc_server->create_buffers(preview_stream_name(yuv_type), UI_BUF_COUNT, false, preview_width, preview_height);
+
+#if defined(QCOM) || defined(QCOM2)
+  // The encoder takes the ion buffers of this stream as its input buffers, one gpu pass saves it a copy on the cpu
+  const int enc_stride = VENUS_Y_STRIDE(COLOR_FMT_NV12, rgb_width);
+  const int enc_uv_offset = enc_stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, rgb_height);
+  yuv_to_nv12 = std::make_unique<YuvToNv12>(context, device_id, rgb_width, rgb_height, enc_stride, enc_uv_offset);
+  encoder_type = vipc_server->create_buffers_nv12(encoder_stream_name(yuv_type), ENCODER_BUF_COUNT, rgb_width, rgb_height,
+                                                  enc_stride, enc_uv_offset, VENUS_BUFFER_SIZE(COLOR_FMT_NV12, rgb_width, rgb_height));
+
+  if (yuv_type == VISION_STREAM_YUV_BACK) {
+    // scaled on the gpu as well, the qcamera encoder doesn't run libyuv per frame
+    const int qcam_stride = VENUS_Y_STRIDE(COLOR_FMT_NV12, QCAMERA_WIDTH);
+    const int qcam_uv_offset = qcam_stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, QCAMERA_HEIGHT);
+    yuv_to_qcam = std::make_unique<YuvToNv12>(context, device_id, rgb_width, rgb_height, QCAMERA_WIDTH, QCAMERA_HEIGHT,
+                                              qcam_stride, qcam_uv_offset);
+    qcam_type = vipc_server->create_buffers_nv12(QCAMERA_STREAM_NAME, ENCODER_BUF_COUNT, QCAMERA_WIDTH, QCAMERA_HEIGHT, qcam_stride,
+                                                 qcam_uv_offset, VENUS_BUFFER_SIZE(COLOR_FMT_NV12, QCAMERA_WIDTH, QCAMERA_HEIGHT));
+  }
+#endif
+
+  if (yuv_type == VISION_STREAM_YUV_FRONT) {
+    // the input of the driver monitoring model, dmonitoringmodeld skips the crop and the scaling
+    const bool is_rhd = Params().getBool("IsRHD");
+    const DMonitoringCrop crop = get_dmonitoring_crop(rgb_width, rgb_height, is_rhd);
+    dm_crop = std::make_unique<CropScaleYuv>(context, device_id, rgb_width, rgb_height, DM_INPUT_WIDTH, DM_INPUT_HEIGHT);
+    dm_crop->set_rect(crop.x, crop.y, crop.w, crop.h, is_rhd);
+    dm_type = vipc_server->create_buffers(DM_INPUT_STREAM_NAME, UI_BUF_COUNT, false, DM_INPUT_WIDTH, DM_INPUT_HEIGHT);
+  }
+
+  lum_histogram = std::make_unique<LumHistogram>(device_id, context, rgb_width);
 
 #ifdef __APPLE__
-  q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+  q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, profile_gpu ? CL_QUEUE_PROFILING_ENABLE : 0, &err));
 #else
-  const cl_queue_properties props[] = {0};  //CL_QUEUE_PRIORITY_KHR, CL_QUEUE_PRIORITY_HIGH_KHR, 0};
+  const cl_queue_properties props[] = {CL_QUEUE_PROPERTIES, profile_gpu ? CL_QUEUE_PROFILING_ENABLE : 0, 0};  //CL_QUEUE_PRIORITY_KHR, CL_QUEUE_PRIORITY_HIGH_KHR, 0};
   q = CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
 #endif
 }
 
 CameraBuf::~CameraBuf() {
+  // Let the last frames finish, their callbacks still use the buffers
+  if (q) CL_CHECK(clFinish(q));
+  if (queued_event) CL_CHECK(clReleaseEvent(queued_event));
+  while (frames_in_flight > 0) {
+    util::sleep_for(1);
+  }
+
   for (int i = 0; i < frame_buf_count; i++) {
     camera_bufs[i].free();
   }
 
   if (krnl_debayer) CL_CHECK(clReleaseKernel(krnl_debayer));
+  if (tone_lut_cl) CL_CHECK(clReleaseMemObject(tone_lut_cl));
   if (q) CL_CHECK(clReleaseCommandQueue(q));
 }
 
-bool CameraBuf::acquire() {
-  if (!safe_queue.try_pop(cur_buf_idx, 1)) return false;
+// Runs on an OpenCL thread once all kernels of a frame finished
+void CL_CALLBACK CameraBuf::frame_done(cl_event event, cl_int status, void *user_data) {
+  QueuedFrame *f = (QueuedFrame *)user_data;
+  CameraBuf *b = f->buf;
+  TRACE_SCOPE("frame_done");
+
+  if (status == CL_COMPLETE) {
+    VisionIpcBufExtra extra = {
+                          f->frame_data.frame_id,
+                          f->frame_data.timestamp_sof,
+                          f->frame_data.timestamp_eof,
+                          nanos_since_boot(),
+    };
+    std::lock_guard<std::mutex> lk(b->send_lock);
+    // rgb and yuv are always made, the other passes read them. A client connects from the next frame then
+    if (b->vipc_server->num_consumers(b->rgb_type)) b->vipc_server->send(f->rgb, &extra);
+    if (b->vipc_server->num_consumers(b->yuv_type)) b->vipc_server->send(f->yuv, &extra);
+    if (f->preview) b->vipc_server->send(f->preview, &extra);
+    if (f->encoder) b->vipc_server->send(f->encoder, &extra);
+    if (f->qcam) b->vipc_server->send(f->qcam, &extra);
+    if (f->dm) b->vipc_server->send(f->dm, &extra);
+  } else {
+    LOGE_DEDUP("frame %d failed on the gpu: %d", f->frame_data.frame_id, status);
+  }
 
-  if (camera_bufs_metadata[cur_buf_idx].frame_id == -1) {
-    LOGE("no frame data? wtf");
-    release();
-    return false;
+  delete f;
+  b->frames_in_flight--;
+}
+
+void CL_CALLBACK CameraBuf::debayer_done(cl_event event, cl_int status, void *user_data) {
+  CameraBuf *b = (CameraBuf *)user_data;
+  cl_ulong start = 0, end = 0;
+  if (status != CL_COMPLETE ||
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS) {
+    return;
   }
 
-  cur_frame_data = camera_bufs_metadata[cur_buf_idx];
-  cur_rgb_buf = vipc_server->get_buffer(rgb_type);
+  const uint64_t ns = b->debayer_ns += end - start;
+  if (++b->debayer_frames == DEBAYER_PROFILE_FRAMES) {
+    LOG("camera %d debayer: %.3f ms per frame on the gpu", b->camera_state->camera_num, ns * 1e-6 / DEBAYER_PROFILE_FRAMES);
+    b->debayer_ns = 0;
+    b->debayer_frames = 0;
+  }
+}
 
+cl_event CameraBuf::queue_frame(const QueuedFrame &f) {
   cl_event debayer_event;
-  cl_mem camrabuf_cl = camera_bufs[cur_buf_idx].buf_cl;
+  cl_mem camrabuf_cl = camera_bufs[f.buf_idx].buf_cl;
   if (camera_state->ci.bayer) {
     CL_CHECK(clSetKernelArg(krnl_debayer, 0, sizeof(cl_mem), &camrabuf_cl));
-    CL_CHECK(clSetKernelArg(krnl_debayer, 1, sizeof(cl_mem), &cur_rgb_buf->buf_cl));
+    CL_CHECK(clSetKernelArg(krnl_debayer, 1, sizeof(cl_mem), &f.rgb->buf_cl));
 #ifdef QCOM2
     constexpr int localMemSize = (DEBAYER_LOCAL_WORKSIZE + 2 * (3 / 2)) * (DEBAYER_LOCAL_WORKSIZE + 2 * (3 / 2)) * sizeof(short int);
     const size_t globalWorkSize[] = {size_t(camera_state->ci.frame_width), size_t(camera_state->ci.frame_height)};
     const size_t localWorkSize[] = {DEBAYER_LOCAL_WORKSIZE, DEBAYER_LOCAL_WORKSIZE};
     CL_CHECK(clSetKernelArg(krnl_debayer, 2, localMemSize, 0));
+    CL_CHECK(clSetKernelArg(krnl_debayer, 3, sizeof(cl_mem), &tone_lut_cl));
+    if (fused_yuv) {
+      CL_CHECK(clSetKernelArg(krnl_debayer, 4, sizeof(cl_mem), &f.yuv->buf_cl));
+      CL_CHECK(clSetKernelArg(krnl_debayer, 5, DEBAYER_LOCAL_WORKSIZE * DEBAYER_LOCAL_WORKSIZE * 3, 0));
+    }
     CL_CHECK(clEnqueueNDRangeKernel(q, krnl_debayer, 2, NULL, globalWorkSize, localWorkSize,
                                     0, 0, &debayer_event));
 #else
@@ -141,24 +271,142 @@ bool CameraBuf::acquire() {
 #endif
   } else {
     assert(rgb_stride == camera_state->ci.frame_stride);
-    CL_CHECK(clEnqueueCopyBuffer(q, camrabuf_cl, cur_rgb_buf->buf_cl, 0, 0,
-                               cur_rgb_buf->len, 0, 0, &debayer_event));
+    CL_CHECK(clEnqueueCopyBuffer(q, camrabuf_cl, f.rgb->buf_cl, 0, 0,
+                               f.rgb->len, 0, 0, &debayer_event));
+  }
+
+  if (profile_gpu && camera_state->ci.bayer) {
+    CL_CHECK(clSetEventCallback(debayer_event, CL_COMPLETE, debayer_done, this));
+  }
+
+  // Each pass waits on the previous one on the gpu, the cpu only waits for the last
+  cl_event yuv_event = debayer_event;
+  if (!fused_yuv) {
+    rgb2yuv->queue(q, f.rgb->buf_cl, f.yuv->buf_cl, 1, &debayer_event, &yuv_event);
+    CL_CHECK(clReleaseEvent(debayer_event));
+  }
+
+  if (f.encoder) {
+    cl_event nv12_event;
+    yuv_to_nv12->queue(q, f.yuv->buf_cl, f.encoder->buf_cl, 1, &yuv_event, &nv12_event);
+    CL_CHECK(clReleaseEvent(yuv_event));
+    yuv_event = nv12_event;
+  }
+  if (f.qcam) {
+    cl_event qcam_event;
+    yuv_to_qcam->queue(q, f.yuv->buf_cl, f.qcam->buf_cl, 1, &yuv_event, &qcam_event);
+    CL_CHECK(clReleaseEvent(yuv_event));
+    yuv_event = qcam_event;
+  }
+  if (f.dm) {
+    cl_event dm_event;
+    dm_crop->queue(q, f.yuv->buf_cl, f.dm->buf_cl, 1, &yuv_event, &dm_event);
+    CL_CHECK(clReleaseEvent(yuv_event));
+    yuv_event = dm_event;
+  }
+
+  if (f.preview) {
+    cl_event preview_event;
+    downscale_yuv->queue(q, f.yuv->buf_cl, f.preview->buf_cl, 1, &yuv_event, &preview_event);
+    CL_CHECK(clReleaseEvent(yuv_event));
+    yuv_event = preview_event;
+  }
+  CL_CHECK(clSetEventCallback(yuv_event, CL_COMPLETE, frame_done, new QueuedFrame(f)));
+
+  // Auto exposure only needs the histogram, it's done after the frame is sent
+  cl_event done_event = yuv_event;
+  if (f.lum_hist) {
+    const ExposureRect &r = f.exposure;
+    lum_histogram->queue(q, f.yuv->buf_cl, r.x_start, r.x_end, r.x_skip, r.y_start, r.y_end, r.y_skip,
+                         f.lum_hist, 1, &yuv_event, &done_event);
+    CL_CHECK(clReleaseEvent(yuv_event));
+  }
+  CL_CHECK(clFlush(q));
+  return done_event;
+}
+
+void CameraBuf::set_exposure_rect(const ExposureRect &rect) {
+  std::lock_guard lk(exposure_lock);
+  exposure_rect = rect;
+}
+
+bool CameraBuf::acquire() {
+  // Hand the queued frame to the processing thread as soon as the gpu is done with it
+  if (queued_event) {
+    cl_int status;
+    CL_CHECK(clGetEventInfo(queued_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL));
+    if (status <= CL_COMPLETE) {
+      return set_current_frame();
+    }
+  }
+
+  int buf_idx;
+  if (!safe_queue.try_pop(buf_idx, 1)) return false;
+
+  if (camera_bufs_metadata[buf_idx].frame_id == -1) {
+    LOGE("no frame data? wtf");
+    if (release_callback) {
+      release_callback((void*)camera_state, buf_idx);
+    }
+    return false;
+  }
+
+  // The streams nobody is connected to aren't made, no encoder while not recording and no dm input
+  // while dmonitoringmodeld isn't running
+  auto consumed = [this](VisionStreamType type) { return vipc_server->num_consumers(type) > 0; };
+  ExposureRect rect;
+  {
+    std::lock_guard lk(exposure_lock);
+    rect = exposure_rect;
+  }
+  bool hist = rect.x_end > rect.x_start && rect.y_end > rect.y_start && rect.x_skip > 0 && rect.y_skip > 0;
+  QueuedFrame f;
+  {
+    // frame_done sends the previous frame from the OpenCL thread, it updates the same leases and cursors
+    std::lock_guard<std::mutex> lk(send_lock);
+    f = {this, buf_idx, camera_bufs_metadata[buf_idx],
+         vipc_server->get_buffer(rgb_type), vipc_server->get_buffer(yuv_type),
+         consumed(preview_type) ? vipc_server->get_buffer(preview_type) : nullptr,
+         yuv_to_nv12 && consumed(encoder_type) ? vipc_server->get_buffer(encoder_type) : nullptr,
+         yuv_to_qcam && consumed(qcam_type) ? vipc_server->get_buffer(qcam_type) : nullptr,
+         dm_crop && consumed(dm_type) ? vipc_server->get_buffer(dm_type) : nullptr,
+         hist ? lum_hists[lum_hist_idx] : nullptr, rect};
   }
+  lum_hist_idx = (lum_hist_idx + 1) % 2;
 
-  clWaitForEvents(1, &debayer_event);
-  CL_CHECK(clReleaseEvent(debayer_event));
+  // The previous frame is queued ahead of this one, it's done soon
+  bool ready = queued_event != nullptr;
+  if (ready) {
+    ready = set_current_frame();
+  }
 
-  cur_yuv_buf = vipc_server->get_buffer(yuv_type);
-  rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
+  frames_in_flight++;
+  TRACE_COUNTER("frames_in_flight", frames_in_flight);
+  {
+    TRACE_SCOPE("queue_frame");
+    queued_event = queue_frame(f);
+  }
+  queued = f;
+  return ready;
+}
 
-  VisionIpcBufExtra extra = {
-                        cur_frame_data.frame_id,
-                        cur_frame_data.timestamp_sof,
-                        cur_frame_data.timestamp_eof,
-  };
-  vipc_server->send(cur_rgb_buf, &extra);
-  vipc_server->send(cur_yuv_buf, &extra);
+bool CameraBuf::set_current_frame() {
+  cl_int err = clWaitForEvents(1, &queued_event);
+  CL_CHECK(clReleaseEvent(queued_event));
+  queued_event = nullptr;
+  if (err != CL_SUCCESS) {
+    if (release_callback) {
+      release_callback((void*)camera_state, queued.buf_idx);
+    }
+    return false;
+  }
 
+  cur_buf_idx = queued.buf_idx;
+  cur_frame_data = queued.frame_data;
+  cur_rgb_buf = queued.rgb;
+  cur_yuv_buf = queued.yuv;
+  cur_preview_buf = queued.preview;
+  cur_lum_hist = queued.lum_hist;
   return true;
 }
 
@@ -169,7 +417,13 @@ void CameraBuf::release() {
 }
 
 void CameraBuf::queue(size_t buf_idx) {
-  safe_queue.push(buf_idx);
+  if (!safe_queue.push(buf_idx)) {
+    LOGE_DEDUP("processing queue full, dropping frame %d", camera_bufs_metadata[buf_idx].frame_id);
+    // the processing thread never sees it, the buffer is free again
+    if (release_callback) {
+      release_callback((void*)camera_state, buf_idx);
+    }
+  }
 }
 
 // common functions
@@ -190,38 +444,13 @@ void fill_frame_data(cereal::FrameData::Builder &framed, const FrameMetadata &fr
   framed.setLensTruePos(frame_data.lens_true_pos);
 }
 
-kj::Array<uint8_t> get_frame_image(const CameraBuf *b) {
-  static const int x_min = util::getenv("XMIN", 0);
-  static const int y_min = util::getenv("YMIN", 0);
-  static const int env_xmax = util::getenv("XMAX", -1);
-  static const int env_ymax = util::getenv("YMAX", -1);
-  static const int scale = util::getenv("SCALE", 1);
-
-  assert(b->cur_rgb_buf);
-
-  const int x_max = env_xmax != -1 ? env_xmax : b->rgb_width - 1;
-  const int y_max = env_ymax != -1 ? env_ymax : b->rgb_height - 1;
-  const int new_width = (x_max - x_min + 1) / scale;
-  const int new_height = (y_max - y_min + 1) / scale;
-  const uint8_t *dat = (const uint8_t *)b->cur_rgb_buf->addr;
-
-  kj::Array<uint8_t> frame_image = kj::heapArray<uint8_t>(new_width*new_height*3);
-  uint8_t *resized_dat = frame_image.begin();
-  int goff = x_min*3 + y_min*b->rgb_stride;
-  for (int r=0;r<new_height;r++) {
-    for (int c=0;c<new_width;c++) {
-      memcpy(&resized_dat[(r*new_width+c)*3], &dat[goff+r*b->rgb_stride*scale+c*3*scale], 3*sizeof(uint8_t));
-    }
-  }
-  return kj::mv(frame_image);
-}
-
-static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
+// The jpeg straight from the I420 planes of a preview frame, with no RGB in between. The fast DCT and
+// the huffman coding are the SIMD ones of libjpeg-turbo
+static void publish_thumbnail(PubMaster *pm, const uint8_t *y, const uint8_t *u, const uint8_t *v, int width, int height,
+                              uint32_t frame_id, uint64_t timestamp_eof) {
   uint8_t* thumbnail_buffer = NULL;
   unsigned long thumbnail_len = 0;
 
-  unsigned char *row = (unsigned char *)malloc(b->rgb_width/4*3);
-
   struct jpeg_compress_struct cinfo;
   struct jpeg_error_mgr jerr;
 
@@ -229,12 +458,19 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   jpeg_create_compress(&cinfo);
   jpeg_mem_dest(&cinfo, &thumbnail_buffer, &thumbnail_len);
 
-  cinfo.image_width = b->rgb_width / 4;
-  cinfo.image_height = b->rgb_height / 4;
+  cinfo.image_width = width;
+  cinfo.image_height = height;
   cinfo.input_components = 3;
-  cinfo.in_color_space = JCS_RGB;
+  cinfo.in_color_space = JCS_YCbCr;
 
   jpeg_set_defaults(&cinfo);
+  jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+  // 4:2:0, as the planes are
+  cinfo.raw_data_in = TRUE;
+  cinfo.comp_info[0].h_samp_factor = cinfo.comp_info[0].v_samp_factor = 2;
+  cinfo.comp_info[1].h_samp_factor = cinfo.comp_info[1].v_samp_factor = 1;
+  cinfo.comp_info[2].h_samp_factor = cinfo.comp_info[2].v_samp_factor = 1;
+  cinfo.dct_method = JDCT_IFAST;
 #ifndef __APPLE__
   jpeg_set_quality(&cinfo, 50, true);
   jpeg_start_compress(&cinfo, true);
@@ -243,52 +479,55 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   jpeg_start_compress(&cinfo, static_cast<boolean>(true) );
 #endif
 
-  JSAMPROW row_pointer[1];
-  const uint8_t *bgr_ptr = (const uint8_t *)b->cur_rgb_buf->addr;
-  for (int ii = 0; ii < b->rgb_height/4; ii+=1) {
-    for (int j = 0; j < b->rgb_width*3; j+=12) {
-      for (int k = 0; k < 3; k++) {
-        uint16_t dat = 0;
-        int i = ii * 4;
-        dat += bgr_ptr[b->rgb_stride*i + j + k];
-        dat += bgr_ptr[b->rgb_stride*i + j+3 + k];
-        dat += bgr_ptr[b->rgb_stride*(i+1) + j + k];
-        dat += bgr_ptr[b->rgb_stride*(i+1) + j+3 + k];
-        dat += bgr_ptr[b->rgb_stride*(i+2) + j + k];
-        dat += bgr_ptr[b->rgb_stride*(i+2) + j+3 + k];
-        dat += bgr_ptr[b->rgb_stride*(i+3) + j + k];
-        dat += bgr_ptr[b->rgb_stride*(i+3) + j+3 + k];
-        row[(j/4) + (2-k)] = dat/8;
-      }
+  // an MCU row at a time, 16 rows of y and 8 of u and v, the last rows repeated past the end of the frame
+  JSAMPROW y_rows[16], u_rows[8], v_rows[8];
+  JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+  const int uv_width = width / 2, uv_height = height / 2;
+  for (int row = 0; row < height; row += 16) {
+    for (int i = 0; i < 16; i++) {
+      y_rows[i] = (JSAMPROW)&y[std::min(row + i, height - 1) * width];
+    }
+    for (int i = 0; i < 8; i++) {
+      const int uv_row = std::min(row / 2 + i, uv_height - 1);
+      u_rows[i] = (JSAMPROW)&u[uv_row * uv_width];
+      v_rows[i] = (JSAMPROW)&v[uv_row * uv_width];
     }
-    row_pointer[0] = row;
-    jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    jpeg_write_raw_data(&cinfo, planes, 16);
   }
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
-  free(row);
 
   MessageBuilder msg;
   auto thumbnaild = msg.initEvent().initThumbnail();
-  thumbnaild.setFrameId(b->cur_frame_data.frame_id);
-  thumbnaild.setTimestampEof(b->cur_frame_data.timestamp_eof);
+  thumbnaild.setFrameId(frame_id);
+  thumbnaild.setTimestampEof(timestamp_eof);
   thumbnaild.setThumbnail(kj::arrayPtr((const uint8_t*)thumbnail_buffer, thumbnail_len));
 
   pm->send("thumbnail", msg);
   free(thumbnail_buffer);
 }
 
-float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
+float set_exposure_target(CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
   int lum_med;
   uint32_t lum_binning[256] = {0};
-  const uint8_t *pix_ptr = b->cur_yuv_buf->y;
-
   unsigned int lum_total = 0;
-  for (int y = y_start; y < y_end; y += y_skip) {
-    for (int x = x_start; x < x_end; x += x_skip) {
-      uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
-      lum_binning[lum]++;
-      lum_total += 1;
+
+  // The gpu computes the histogram for the following frames, the rect can lag behind by a frame
+  b->set_exposure_rect({x_start, x_end, x_skip, y_start, y_end, y_skip});
+
+  if (b->cur_lum_hist) {
+    for (int i = 0; i < HIST_BINS; i++) {
+      lum_binning[i] = b->cur_lum_hist[i];
+      lum_total += lum_binning[i];
+    }
+  } else {
+    const uint8_t *pix_ptr = b->cur_yuv_buf->y;
+    for (int y = y_start; y < y_end; y += y_skip) {
+      for (int x = x_start; x < x_end; x += x_skip) {
+        uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
+        lum_binning[lum]++;
+        lum_total += 1;
+      }
     }
   }
 
@@ -308,7 +547,42 @@ float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip
 
 extern ExitHandler do_exit;
 
-void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback) {
+// The thumbnails of the road camera, from the preview stream the gpu already downscaled, every
+// THUMBNAIL_FRAMES frames. On a thread of its own below the processing threads, so they never wait
+// for the compression, it only gets the cpu the cameras leave
+static void thumbnail_thread(PubMaster *pm) {
+  set_thread_name("thumbnail");
+  // not the realtime priority of the processing thread that started it
+  struct sched_param sa = {};
+  pthread_setschedparam(pthread_self(), SCHED_OTHER, &sa);
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), THUMBNAIL_NICE);
+
+  VisionIpcClient client("camerad", preview_stream_name(VISION_STREAM_YUV_BACK), false);
+  std::vector<uint8_t> frame;
+  uint32_t next_frame_id = 0;
+  while (!do_exit) {
+    if (!client.connected) {
+      if (!client.connect(false)) {
+        util::sleep_for(100);
+        continue;
+      }
+      next_frame_id = 0;
+    }
+
+    VisionIpcBufExtra extra = {};
+    VisionBuf *buf = client.recv(&extra);
+    if (buf == nullptr || extra.frame_id < next_frame_id) continue;
+    next_frame_id = extra.frame_id + THUMBNAIL_FRAMES;
+
+    // the server writes the buffer again a few frames later, the compression may take longer than those
+    const uint8_t *addr = (const uint8_t *)buf->addr;
+    frame.assign(addr, addr + buf->len);
+    publish_thumbnail(pm, &frame[buf->y - addr], &frame[buf->u - addr], &frame[buf->v - addr], buf->width, buf->height,
+                      extra.frame_id, extra.timestamp_eof);
+  }
+}
+
+void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback, ProcessThreadConfig config) {
   const char *thread_name = nullptr;
   if (cs == &cameras->road_cam) {
     thread_name = "RoadCamera";
@@ -319,30 +593,63 @@ void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thre
   }
   set_thread_name(thread_name);
 
+  std::string name = thread_name;
+  std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+  const int core = util::getenv((name + "_CORE").c_str(), config.core);
+  const int priority = util::getenv((name + "_PRIO").c_str(), config.priority);
+  if (core >= 0 && set_core_affinity(core) != 0) {
+    LOGE("%s: failed to set the affinity to core %d", thread_name, core);
+  }
+  if (priority >= 0 && set_realtime_priority(priority) != 0) {
+    LOGE("%s: failed to set the priority to %d", thread_name, priority);
+  }
+
+  std::thread thumbnails;
+  if (cs == &cameras->road_cam && cameras->pm) {
+    thumbnails = std::thread(thumbnail_thread, cameras->pm);
+  }
+
   uint32_t cnt = 0;
+  int overruns = 0, budget_frames = 0;
+  double max_ms = 0;
   while (!do_exit) {
     if (!cs->buf.acquire()) continue;
 
-    callback(cameras, cs, cnt);
-
-    if (cs == &(cameras->road_cam) && cameras->pm && cnt % 100 == 3) {
-      // this takes 10ms???
-      publish_thumbnail(cameras->pm, &(cs->buf));
+    const double start_ms = millis_since_boot();
+    {
+      TRACE_SCOPE(thread_name);
+      callback(cameras, cs, cnt);
     }
     cs->buf.release();
     ++cnt;
+
+    if (config.budget_ms > 0) {
+      const double dt = millis_since_boot() - start_ms;
+      max_ms = std::max(max_ms, dt);
+      overruns += dt > config.budget_ms;
+      if (++budget_frames == PROCESS_BUDGET_FRAMES) {
+        if (overruns > 0) {
+          LOGW("%s: %d of %d frames over the budget of %.1f ms, max %.1f ms", thread_name, overruns, budget_frames,
+               config.budget_ms, max_ms);
+        }
+        overruns = budget_frames = 0;
+        max_ms = 0;
+      }
+    }
   }
+  if (thumbnails.joinable()) thumbnails.join();
   return NULL;
 }
 
-std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback) {
-  return std::thread(processing_thread, cameras, cs, callback);
+std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback,
+                                 const ProcessThreadConfig &config) {
+  return std::thread(processing_thread, cameras, cs, callback, config);
 }
 
 static void driver_cam_auto_exposure(CameraState *c, SubMaster &sm) {
   static const bool is_rhd = Params().getBool("IsRHD");
   struct ExpRect {int x1, x2, x_skip, y1, y2, y_skip;};
-  const CameraBuf *b = &c->buf;
+  CameraBuf *b = &c->buf;
 
   int x_offset = 0, y_offset = 0;
   int frame_width = b->rgb_width, frame_height = b->rgb_height;
@@ -384,8 +691,5 @@ void common_process_driver_camera(SubMaster *sm, PubMaster *pm, CameraState *c,
   auto framed = msg.initEvent().initDriverCameraState();
   framed.setFrameType(cereal::FrameData::FrameType::FRONT);
   fill_frame_data(framed, c->buf.cur_frame_data);
-  if (env_send_driver) {
-    framed.setImage(get_frame_image(&c->buf));
-  }
   pm->send("driverCameraState", msg);
 }
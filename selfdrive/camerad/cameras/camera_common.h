@@ -1,19 +1,27 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include "cereal/messaging/messaging.h"
 #include "cereal/visionipc/visionbuf.h"
 #include "cereal/visionipc/visionipc.h"
 #include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/camerad/imgproc/utils.h"
+#include "selfdrive/camerad/transforms/crop_scale_yuv.h"
+#include "selfdrive/camerad/transforms/downscale_yuv.h"
 #include "selfdrive/camerad/transforms/rgb_to_yuv.h"
+#include "selfdrive/camerad/transforms/yuv_to_nv12.h"
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/queue.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/visionimg.h"
+#include "selfdrive/hardware/hw.h"
 
 #define CAMERA_ID_IMX298 0
 #define CAMERA_ID_IMX179 1
@@ -27,6 +35,10 @@
 #define CAMERA_ID_MAX 9
 
 #define UI_BUF_COUNT 4
+// NV12 copies of the yuv frames for the encoder, it leases each one until it's encoded
+#define ENCODER_BUF_COUNT 8
+// frames handed to the processing thread, more than any camera has buffers
+#define CAMERA_QUEUE_SIZE 64
 
 #define LOG_CAMERA_ID_FCAMERA 0
 #define LOG_CAMERA_ID_DCAMERA 1
@@ -34,10 +46,6 @@
 #define LOG_CAMERA_ID_QCAMERA 3
 #define LOG_CAMERA_ID_MAX 4
 
-const bool env_send_driver = getenv("SEND_DRIVER") != NULL;
-const bool env_send_road = getenv("SEND_ROAD") != NULL;
-const bool env_send_wide_road = getenv("SEND_WIDE_ROAD") != NULL;
-
 typedef void (*release_cb)(void *cookie, int buf_idx);
 
 typedef struct CameraInfo {
@@ -52,6 +60,7 @@ typedef struct LogCameraInfo {
   const char* filename;
   const char* frame_packet_name;
   const char* encode_idx_name;
+  const char* encode_data_name;  // service the encoded frames are published on
   VisionStreamType stream_type;
   int frame_width, frame_height;
   int fps;
@@ -62,6 +71,21 @@ typedef struct LogCameraInfo {
   bool trigger_rotate;
 } LogCameraInfo;
 
+// Stream with the frames of a yuv stream in the input layout of the venus encoder, loggerd encodes them in place
+inline const char *encoder_stream_name(VisionStreamType yuv_type) {
+  switch (yuv_type) {
+    case VISION_STREAM_YUV_BACK: return "yuv_back_encoder";
+    case VISION_STREAM_YUV_FRONT: return "yuv_front_encoder";
+    case VISION_STREAM_YUV_WIDE: return "yuv_wide_encoder";
+    default: assert(0); return nullptr;
+  }
+}
+
+// qcamera is encoded from camerad's downscale of the road camera, in the same layout as the encoder streams
+#define QCAMERA_STREAM_NAME "yuv_back_qcamera"
+const int QCAMERA_WIDTH = Hardware::TICI() ? 526 : 480;
+const int QCAMERA_HEIGHT = Hardware::TICI() ? 330 : 360; // keep pixel count the same?
+
 typedef struct FrameMetadata {
   uint32_t frame_id;
   unsigned int frame_length;
@@ -89,6 +113,11 @@ typedef struct CameraExpInfo {
   float grey_frac;
 } CameraExpInfo;
 
+// Pixels sampled for auto exposure, every skip-th pixel in [start, end)
+struct ExposureRect {
+  int x_start, x_end, x_skip, y_start, y_end, y_skip;
+};
+
 struct MultiCameraState;
 struct CameraState;
 
@@ -97,43 +126,94 @@ private:
   VisionIpcServer *vipc_server;
   CameraState *camera_state;
   cl_kernel krnl_debayer;
+  cl_mem tone_lut_cl = nullptr; // real_debayer.cl only
+
+  // CAMERAD_GPU_PROFILE logs the gpu time of the debayering
+  std::atomic<uint64_t> debayer_ns = 0;
+  std::atomic<int> debayer_frames = 0;
 
   std::unique_ptr<Rgb2Yuv> rgb2yuv;
+  std::unique_ptr<DownscaleYuv> downscale_yuv;
+  std::unique_ptr<YuvToNv12> yuv_to_nv12; // only with a venus encoder
+  std::unique_ptr<YuvToNv12> yuv_to_qcam; // only for the road camera
+  std::unique_ptr<CropScaleYuv> dm_crop; // only for the driver camera
+  std::unique_ptr<LumHistogram> lum_histogram;
 
-  VisionStreamType rgb_type, yuv_type;
+  VisionStreamType rgb_type, yuv_type, preview_type, encoder_type, qcam_type, dm_type;
 
   int cur_buf_idx;
 
-  SafeQueue<int> safe_queue;
+  SpscQueue<int, CAMERA_QUEUE_SIZE> safe_queue;
 
   int frame_buf_count;
   release_cb release_callback;
 
+  // A frame whose kernels are queued, it's sent from frame_done once they finish
+  struct QueuedFrame {
+    CameraBuf *buf;
+    int buf_idx;
+    FrameMetadata frame_data;
+    VisionBuf *rgb, *yuv, *preview; // preview is nullptr without clients
+    VisionBuf *encoder, *qcam, *dm; // nullptr without those streams, or without their clients
+    uint32_t *lum_hist; // nullptr without an exposure rect
+    ExposureRect exposure; // the rect lum_hist is computed over
+  };
+  QueuedFrame queued;
+  uint32_t lum_hists[2][HIST_BINS]; // for the current and the queued frame
+  int lum_hist_idx = 0;
+  cl_event queued_event = nullptr;
+  std::atomic<int> frames_in_flight = 0;
+  std::mutex send_lock; // held for the vipc_server get_buffer and send calls, they run on two threads
+  // set from the processing thread, copied into each frame as it's queued
+  std::mutex exposure_lock;
+  ExposureRect exposure_rect = {};
+
+  cl_event queue_frame(const QueuedFrame &f);
+  bool set_current_frame();
+  static void CL_CALLBACK frame_done(cl_event event, cl_int status, void *user_data);
+  static void CL_CALLBACK debayer_done(cl_event event, cl_int status, void *user_data);
+
 public:
   cl_command_queue q;
   FrameMetadata cur_frame_data;
   VisionBuf *cur_rgb_buf;
   VisionBuf *cur_yuv_buf;
+  VisionBuf *cur_preview_buf; // quarter size yuv, nullptr while nobody reads the preview stream
+  const uint32_t *cur_lum_hist = nullptr;
   std::unique_ptr<VisionBuf[]> camera_bufs;
   std::unique_ptr<FrameMetadata[]> camera_bufs_metadata;
   int rgb_width, rgb_height, rgb_stride;
+  int preview_width, preview_height;
 
   mat3 yuv_transform;
 
   CameraBuf() = default;
   ~CameraBuf();
+  void set_exposure_rect(const ExposureRect &rect); // histogram computed for the frames queued from now on
   void init(cl_device_id device_id, cl_context context, CameraState *s, VisionIpcServer * v, int frame_cnt, VisionStreamType rgb_type, VisionStreamType yuv_type, release_cb release_callback=nullptr);
   bool acquire();
   void release();
   void queue(size_t buf_idx);
+  // frames waiting for the processing thread or on the gpu
+  int queued_frames() const { return safe_queue.size() + frames_in_flight; }
 };
 
 typedef void (*process_thread_cb)(MultiCameraState *s, CameraState *c, int cnt);
 
+// Scheduling of a processing thread, -1 keeps the core or the priority of camerad. They can be set
+// with <thread name>_CORE and <thread name>_PRIO, e.g. DRIVERCAMERA_CORE=5 DRIVERCAMERA_PRIO=1
+struct ProcessThreadConfig {
+  int core = -1;
+  int priority = -1;
+  // frames processed in more than this are overruns, reported every PROCESS_BUDGET_FRAMES frames
+  float budget_ms = 0;
+};
+#define PROCESS_BUDGET_FRAMES 200
+
 void fill_frame_data(cereal::FrameData::Builder &framed, const FrameMetadata &frame_data);
-kj::Array<uint8_t> get_frame_image(const CameraBuf *b);
-float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip);
-std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback);
+float set_exposure_target(CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip);
+std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback,
+                                 const ProcessThreadConfig &config = {});
 void common_process_driver_camera(SubMaster *sm, PubMaster *pm, CameraState *c, int cnt);
 
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx);
@@ -2,14 +2,19 @@
 
 #include <unistd.h>
 #include <cassert>
+#include <sstream>
+#include <thread>
 
 #include <capnp/dynamic.h>
 
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
 #define FRAME_WIDTH 1164
 #define FRAME_HEIGHT 874
+#define REPLAY_FPS 20
 
 extern ExitHandler do_exit;
 
@@ -34,14 +39,54 @@ CameraInfo cameras_supported[CAMERA_ID_MAX] = {
   },
 };
 
+// CAMERAD_REPLAY is a segment directory, a route prefix, segments are <route>--0, <route>--1, ..., or
+// segment directories separated by commas
+const std::string replay_path = util::getenv("CAMERAD_REPLAY");
+// playback speed, 0 sends the next road frame once CAMERAD_REPLAY_SYNC has seen the previous one
+const float replay_speed = util::getenv("CAMERAD_REPLAY_SPEED", 1.0f);
+const std::string replay_sync = util::getenv("CAMERAD_REPLAY_SYNC", "modelV2");
+
+std::vector<std::string> replay_files(const std::string &fn) {
+  std::vector<std::string> files;
+  if (replay_path.find(',') != std::string::npos) {
+    std::stringstream ss(replay_path);
+    for (std::string dir; std::getline(ss, dir, ',');) {
+      if (util::file_exists(dir + "/" + fn)) files.push_back(dir + "/" + fn);
+    }
+  } else if (util::file_exists(replay_path + "/" + fn)) {
+    files.push_back(replay_path + "/" + fn);
+  } else {
+    for (int seg = 0; util::file_exists(replay_path + "--" + std::to_string(seg) + "/" + fn); seg++) {
+      files.push_back(replay_path + "--" + std::to_string(seg) + "/" + fn);
+    }
+  }
+  return files;
+}
+
+void replay_release(void *cookie, int buf_idx) {
+  CameraState *s = (CameraState *)cookie;
+  {
+    std::lock_guard lk(s->replay_lock);
+    s->replay_busy[buf_idx] = false;
+  }
+  s->replay_cv.notify_all();
+}
+
 void camera_init(VisionIpcServer * v, CameraState *s, int camera_id, unsigned int fps, cl_device_id device_id, cl_context ctx, VisionStreamType rgb_type, VisionStreamType yuv_type) {
   assert(camera_id < std::size(cameras_supported));
   s->ci = cameras_supported[camera_id];
   assert(s->ci.frame_width != 0);
 
+  if (s->reader) {
+    // the recorded frames are already rgb, only their size is taken from the video
+    s->ci.frame_width = s->reader->width;
+    s->ci.frame_height = s->reader->height;
+    s->ci.frame_stride = s->reader->width * 3;
+  }
+
   s->camera_num = camera_id;
   s->fps = fps;
-  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type);
+  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type, s->reader ? replay_release : nullptr);
 }
 
 void run_frame_stream(CameraState &camera, const char* frame_pkt) {
@@ -70,23 +115,159 @@ void run_frame_stream(CameraState &camera, const char* frame_pkt) {
   }
 }
 
+bool open_replay(CameraState *s, const char *fn) {
+  std::vector<std::string> files = replay_files(fn);
+  if (files.empty()) return false;
+
+  s->reader = std::make_unique<FrameReader>(files);
+  if (!s->reader->open()) {
+    s->reader.reset();
+    return false;
+  }
+  LOGW("replaying %zu %s files, %dx%d", files.size(), fn, s->reader->width, s->reader->height);
+  return true;
+}
+
+// Decodes the next frame of a camera into a free camera buffer and hands it to the processing thread.
+// Faster than real time the ring wraps around before the processing thread is done, so this waits
+// for the buffer to be released
+bool replay_frame(CameraState *s, size_t buf_idx) {
+  {
+    std::unique_lock lk(s->replay_lock);
+    while (s->replay_busy[buf_idx] && !do_exit) {
+      s->replay_cv.wait_for(lk, std::chrono::milliseconds(100));
+    }
+    if (do_exit) return true;
+  }
+
+  CameraBuf *b = &s->buf;
+  VisionBuf &camera_buf = b->camera_bufs[buf_idx];
+  if (!s->reader->next((uint8_t *)camera_buf.addr, s->ci.frame_stride)) return false;
+
+  const uint64_t ts = nanos_since_boot();
+  b->camera_bufs_metadata[buf_idx] = {
+    .frame_id = s->frame_id++,
+    .timestamp_sof = ts,
+    .timestamp_eof = ts,
+  };
+  CL_CHECK(clEnqueueWriteBuffer(camera_buf.copy_q, camera_buf.buf_cl, CL_TRUE, 0, camera_buf.len, camera_buf.addr, 0, NULL, NULL));
+  {
+    std::lock_guard lk(s->replay_lock);
+    s->replay_busy[buf_idx] = true;
+  }
+  b->queue(buf_idx);
+  return true;
+}
+
+// Waits until the consumer processed road frame frame_id, false if it didn't within a second
+bool wait_for_consumer(SubMaster &sm, uint32_t frame_id) {
+  const double start = millis_since_boot();
+  while (!do_exit && millis_since_boot() - start < 1000) {
+    if (sm.rcv_frame(replay_sync.c_str()) > 0) {
+      auto msg = static_cast<capnp::DynamicStruct::Reader>(sm[replay_sync.c_str()]);
+      if (msg.get(replay_sync.c_str()).as<capnp::DynamicStruct>().get("frameId").as<uint32_t>() >= frame_id) {
+        return true;
+      }
+    }
+    sm.update(100);
+  }
+  return false;
+}
+
+void run_replay(MultiCameraState *s) {
+  SubMaster sm({replay_sync.c_str()});
+  CameraState *cams[] = {&s->road_cam, &s->driver_cam, &s->wide_road_cam};
+
+  // the ring of camera buffers is shared with the processing thread, frames are written in order
+  size_t buf_idx = 0;
+  float speed = replay_speed;
+  uint64_t start = nanos_since_boot();
+  for (uint64_t cnt = 0; !do_exit; cnt++) {
+    if (speed > 0) {
+      const uint64_t target = start + cnt * (1e9 / REPLAY_FPS) / speed;
+      const uint64_t now = nanos_since_boot();
+      if (target > now) std::this_thread::sleep_for(std::chrono::nanoseconds(target - now));
+    } else if (cnt > 0 && !wait_for_consumer(sm, s->road_cam.frame_id - 1)) {
+      if (sm.rcv_frame(replay_sync.c_str()) == 0) {
+        // nothing to wait for, don't stall a second on every frame
+        LOGW("no %s received, replaying at real time", replay_sync.c_str());
+        speed = 1.0;
+        start = nanos_since_boot() - cnt * (1e9 / REPLAY_FPS);
+      } else {
+        LOGW_100("%s missed road frame %d", replay_sync.c_str(), s->road_cam.frame_id - 1);
+      }
+    }
+
+    for (CameraState *c : cams) {
+      if (c->reader && !replay_frame(c, buf_idx)) {
+        LOGW("%s replay done", c == &s->road_cam ? "road" : c == &s->driver_cam ? "driver" : "wide road");
+        c->reader.reset();
+      }
+    }
+    if (!s->road_cam.reader) break;
+    buf_idx = (buf_idx + 1) % FRAME_BUF_COUNT;
+  }
+
+  // camerad exits at the end of the route, so benchmarks can wait for it
+  do_exit = true;
+}
+
 }  // namespace
 
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx) {
+  if (!replay_path.empty()) {
+    if (!open_replay(&s->road_cam, "fcamera.hevc")) {
+      LOGE("no road camera video in %s", replay_path.c_str());
+      assert(0);
+    }
+    open_replay(&s->driver_cam, "dcamera.hevc");
+    open_replay(&s->wide_road_cam, "ecamera.hevc");
+    s->pm = new PubMaster({"roadCameraState", "driverCameraState", "wideRoadCameraState", "thumbnail"});
+  }
+
   camera_init(v, &s->road_cam, CAMERA_ID_IMX298, 20, device_id, ctx,
               VISION_STREAM_RGB_BACK, VISION_STREAM_YUV_BACK);
   camera_init(v, &s->driver_cam, CAMERA_ID_OV8865, 10, device_id, ctx,
               VISION_STREAM_RGB_FRONT, VISION_STREAM_YUV_FRONT);
+  if (s->wide_road_cam.reader) {
+    camera_init(v, &s->wide_road_cam, CAMERA_ID_IMX298, 20, device_id, ctx,
+                VISION_STREAM_RGB_WIDE, VISION_STREAM_YUV_WIDE);
+  }
 }
 
 void cameras_open(MultiCameraState *s) {}
-void cameras_close(MultiCameraState *s) {}
+void cameras_close(MultiCameraState *s) {
+  delete s->pm;
+}
 void camera_autoexposure(CameraState *s, float grey_frac) {}
-void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {}
+
+void process_camera(MultiCameraState *s, CameraState *c, int cnt) {
+  // frames pushed over roadCameraState are already published, replayed ones aren't
+  if (!s->pm) return;
+
+  const char *service = c == &s->road_cam ? "roadCameraState" : c == &s->driver_cam ? "driverCameraState" : "wideRoadCameraState";
+  MessageBuilder msg;
+  auto framed = c == &s->road_cam ? msg.initEvent().initRoadCameraState() :
+                c == &s->driver_cam ? msg.initEvent().initDriverCameraState() : msg.initEvent().initWideRoadCameraState();
+  fill_frame_data(framed, c->buf.cur_frame_data);
+  if (c == &s->road_cam) {
+    framed.setTransform(c->buf.yuv_transform.v);
+  }
+  s->pm->send(service, msg);
+}
 
 void cameras_run(MultiCameraState *s) {
-  std::thread t = start_process_thread(s, &s->road_cam, process_road_camera);
-  set_thread_name("frame_streaming");
-  run_frame_stream(s->road_cam, "roadCameraState");
-  t.join();
+  std::vector<std::thread> threads;
+  threads.push_back(start_process_thread(s, &s->road_cam, process_camera));
+  if (replay_path.empty()) {
+    set_thread_name("frame_streaming");
+    run_frame_stream(s->road_cam, "roadCameraState");
+  } else {
+    if (s->driver_cam.reader) threads.push_back(start_process_thread(s, &s->driver_cam, process_camera));
+    if (s->wide_road_cam.reader) threads.push_back(start_process_thread(s, &s->wide_road_cam, process_camera));
+    set_thread_name("frame_replay");
+    run_replay(s);
+  }
+  for (auto &t : threads) t.join();
+  cameras_close(s);
 }
@@ -7,7 +7,12 @@
 #include <CL/cl.h>
 #endif
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 #include "camera_common.h"
+#include "frame_reader.h"
 
 #define FRAME_BUF_COUNT 16
 
@@ -19,11 +24,20 @@ typedef struct CameraState {
   float digital_gain;
 
   CameraBuf buf;
+
+  // set when replaying a route (CAMERAD_REPLAY)
+  std::unique_ptr<FrameReader> reader;
+  uint32_t frame_id;
+  // replayed camera buffers the processing thread hasn't released yet
+  std::mutex replay_lock;
+  std::condition_variable replay_cv;
+  bool replay_busy[FRAME_BUF_COUNT] = {};
 } CameraState;
 
 typedef struct MultiCameraState {
   CameraState road_cam;
   CameraState driver_cam;
+  CameraState wide_road_cam;
 
   SubMaster *sm;
   PubMaster *pm;
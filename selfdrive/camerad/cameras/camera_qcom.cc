@@ -227,7 +227,7 @@ void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_i
     s->stats_bufs[i].allocate(0xb80);
   }
   std::fill_n(s->lapres, std::size(s->lapres), 16160);
-  s->lap_conv = new LapConv(device_id, ctx, s->road_cam.buf.rgb_width, s->road_cam.buf.rgb_height, 3);
+  s->lap_conv = new LapConv(device_id, ctx, s->road_cam.buf.rgb_width, s->road_cam.buf.rgb_height);
 }
 
 static void set_exposure(CameraState *s, float exposure_frac, float gain_frac) {
@@ -1092,17 +1092,14 @@ void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
 
 // called by processing_thread
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
-  const CameraBuf *b = &c->buf;
+  CameraBuf *b = &c->buf;
   const int roi_id = cnt % std::size(s->lapres);  // rolling roi
-  s->lapres[roi_id] = s->lap_conv->Update(b->q, (uint8_t *)b->cur_rgb_buf->addr, roi_id);
+  s->lapres[roi_id] = s->lap_conv->Update(b->q, b->cur_yuv_buf->buf_cl, roi_id);
   setup_self_recover(c, &s->lapres[0], std::size(s->lapres));
 
   MessageBuilder msg;
   auto framed = msg.initEvent().initRoadCameraState();
   fill_frame_data(framed, b->cur_frame_data);
-  if (env_send_road) {
-    framed.setImage(get_frame_image(b));
-  }
   framed.setFocusVal(s->road_cam.focus);
   framed.setFocusConf(s->road_cam.confidence);
   framed.setRecoverState(s->road_cam.self_recover);
@@ -1120,8 +1117,9 @@ void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
 void cameras_run(MultiCameraState *s) {
   std::vector<std::thread> threads;
   threads.push_back(std::thread(ops_thread, s));
-  threads.push_back(start_process_thread(s, &s->road_cam, process_road_camera));
-  threads.push_back(start_process_thread(s, &s->driver_cam, process_driver_camera));
+  // the road camera is the input of modeld, the driver camera runs below it
+  threads.push_back(start_process_thread(s, &s->road_cam, process_road_camera, {-1, 53, 1000.f / s->road_cam.fps}));
+  threads.push_back(start_process_thread(s, &s->driver_cam, process_driver_camera, {-1, 51, 1000.f / s->driver_cam.fps}));
 
   CameraState* cameras[2] = {&s->road_cam, &s->driver_cam};
 
@@ -1180,7 +1178,7 @@ void cameras_run(MultiCameraState *s) {
         c->frame_metadata_idx = (c->frame_metadata_idx + 1) % METADATA_BUF_COUNT;
 
       } else if (ev.type == ISP_EVENT_ERROR) {
-        LOGE("ISP_EVENT_ERROR! err type: 0x%08x", isp_event_data->u.error_info.err_type);
+        LOGE_DEDUP("ISP_EVENT_ERROR! err type: 0x%08x", isp_event_data->u.error_info.err_type);
       }
     }
   }
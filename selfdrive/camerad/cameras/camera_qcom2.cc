@@ -460,11 +460,31 @@ void enqueue_buffer(struct CameraState *s, int i, bool dp) {
     struct cam_sync_wait sync_wait = {0};
     sync_wait.sync_obj = s->sync_objs[i];
     sync_wait.timeout_ms = 50; // max dt tolerance, typical should be 23
+    const uint64_t wait_start = nanos_since_boot();
     ret = cam_control(s->multi_cam_state->video1_fd, CAM_SYNC_WAIT, &sync_wait, sizeof(sync_wait));
     // LOGD("fence wait: %d %d", ret, sync_wait.sync_obj);
 
-    s->buf.camera_bufs_metadata[i].timestamp_eof = (uint64_t)nanos_since_boot(); // set true eof
-    if (dp) s->buf.queue(i);
+    auto &meta_data = s->buf.camera_bufs_metadata[i];
+    meta_data.timestamp_eof = (uint64_t)nanos_since_boot(); // set true eof
+    if (dp) {
+      IspStats &stats = s->isp_stats;
+      const double wait_ms = (meta_data.timestamp_eof - wait_start) * 1e-6;
+      stats.fence_wait_sum += wait_ms;
+      stats.fence_wait_max = std::max(stats.fence_wait_max, wait_ms);
+      if (ret != 0) {
+        stats.fence_timeouts++;
+      } else if (meta_data.timestamp_sof != 0 && meta_data.timestamp_eof > meta_data.timestamp_sof) {
+        const double latency_ms = (meta_data.timestamp_eof - meta_data.timestamp_sof) * 1e-6;
+        stats.latency_sum += latency_ms;
+        stats.latency_max = std::max(stats.latency_max, latency_ms);
+      }
+      const int occupancy = s->buf.queued_frames();
+      stats.occupancy_sum += occupancy;
+      stats.occupancy_max = std::max(stats.occupancy_max, occupancy);
+      stats.frames++;
+
+      s->buf.queue(i);
+    }
 
     // destroy old output fence
     struct cam_sync_info sync_destroy = {0};
@@ -509,11 +529,22 @@ void enqueue_buffer(struct CameraState *s, int i, bool dp) {
 
 void enqueue_req_multi(struct CameraState *s, int start, int n, bool dp) {
    for (int i=start;i<start+n;++i) {
-     s->request_ids[(i - 1) % FRAME_BUF_COUNT] = i;
-     enqueue_buffer(s, (i - 1) % FRAME_BUF_COUNT, dp);
+     s->request_ids[(i - 1) % s->buf_count] = i;
+     enqueue_buffer(s, (i - 1) % s->buf_count, dp);
    }
 }
 
+static void isp_stats_log(CameraState *s) {
+  IspStats &stats = s->isp_stats;
+  const int n = std::max(stats.frames, 1);
+  LOG("camera %d isp: %d frames, latency %.1f/%.1f ms, fence wait %.1f/%.1f ms, %d fence timeouts, "
+      "%d skipped frames, %d dropped and %d duplicate requests, occupancy %.2f/%d of %d buffers",
+      s->camera_num, stats.frames, stats.latency_sum / n, stats.latency_max, stats.fence_wait_sum / n, stats.fence_wait_max,
+      stats.fence_timeouts, stats.skipped_frames, stats.dropped_requests, stats.duplicate_requests,
+      (double)stats.occupancy_sum / n, stats.occupancy_max, s->buf_count);
+  stats = {};
+}
+
 // ******************* camera *******************
 
 static void camera_init(MultiCameraState *multi_cam_state, VisionIpcServer * v, CameraState *s, int camera_id, int camera_num, unsigned int fps, cl_device_id device_id, cl_context ctx, VisionStreamType rgb_type, VisionStreamType yuv_type) {
@@ -527,6 +558,8 @@ static void camera_init(MultiCameraState *multi_cam_state, VisionIpcServer * v,
 
   s->request_id_last = 0;
   s->skipped = true;
+  s->isp_stats = {};
+  s->buf_count = std::clamp(util::getenv("CAMERA_QUEUE_DEPTH", FRAME_BUF_COUNT), 2, FRAME_BUF_COUNT_MAX);
 
   s->min_ev = EXPOSURE_TIME_MIN * sensor_analog_gains[ANALOG_GAIN_MIN_IDX];
   s->max_ev = EXPOSURE_TIME_MAX * sensor_analog_gains[ANALOG_GAIN_MAX_IDX] * DC_GAIN;
@@ -537,7 +570,7 @@ static void camera_init(MultiCameraState *multi_cam_state, VisionIpcServer * v,
   s->exposure_time = 5;
   s->cur_ev[0] = s->cur_ev[1] = s->cur_ev[2] = (s->dc_gain_enabled ? DC_GAIN : 1) * sensor_analog_gains[s->gain_idx] * s->exposure_time;
 
-  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type);
+  s->buf.init(device_id, ctx, s, v, s->buf_count, rgb_type, yuv_type);
 }
 
 // TODO: refactor this to somewhere nicer, perhaps use in camera_qcom as well
@@ -758,7 +791,8 @@ static void camera_open(CameraState *s) {
   LOGD("start sensor: %d", ret);
   ret = device_control(s->sensor_fd, CAM_START_DEV, s->session_handle, s->sensor_dev_handle);
 
-  enqueue_req_multi(s, 1, FRAME_BUF_COUNT, 0);
+  LOG("-- Request queue depth %d", s->buf_count);
+  enqueue_req_multi(s, 1, s->buf_count, 0);
 }
 
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx) {
@@ -887,21 +921,25 @@ void handle_camera_event(CameraState *s, void *evdat) {
 
   if (real_id != 0) { // next ready
     if (real_id == 1) {s->idx_offset = main_id;}
-    int buf_idx = (real_id - 1) % FRAME_BUF_COUNT;
+    int buf_idx = (real_id - 1) % s->buf_count;
 
     // check for skipped frames
     if (main_id > s->frame_id_last + 1 && !s->skipped) {
+      s->isp_stats.skipped_frames += main_id - (s->frame_id_last + 1);
       // realign
       clear_req_queue(s->multi_cam_state->video0_fd, event_data->session_hdl, event_data->u.frame_msg.link_hdl);
-      enqueue_req_multi(s, real_id + 1, FRAME_BUF_COUNT - 1, 0);
+      enqueue_req_multi(s, real_id + 1, s->buf_count - 1, 0);
       s->skipped = true;
     } else if (main_id == s->frame_id_last + 1) {
       s->skipped = false;
     }
 
-    // check for dropped requests
+    // check for dropped and repeated requests
     if (real_id > s->request_id_last + 1) {
-      enqueue_req_multi(s, s->request_id_last + 1 + FRAME_BUF_COUNT, real_id - (s->request_id_last + 1), 0);
+      s->isp_stats.dropped_requests += real_id - (s->request_id_last + 1);
+      enqueue_req_multi(s, s->request_id_last + 1 + s->buf_count, real_id - (s->request_id_last + 1), 0);
+    } else if (real_id <= s->request_id_last) {
+      s->isp_stats.duplicate_requests++;
     }
 
     // metas
@@ -920,12 +958,15 @@ void handle_camera_event(CameraState *s, void *evdat) {
     s->exp_lock.unlock();
 
     // dispatch
-    enqueue_req_multi(s, real_id + FRAME_BUF_COUNT, 1, 1);
+    enqueue_req_multi(s, real_id + s->buf_count, 1, 1);
+    if (s->isp_stats.frames >= ISP_STATS_FRAMES) {
+      isp_stats_log(s);
+    }
   } else { // not ready
     // reset after half second of no response
     if (main_id > s->frame_id_last + 10) {
       clear_req_queue(s->multi_cam_state->video0_fd, event_data->session_hdl, event_data->u.frame_msg.link_hdl);
-      enqueue_req_multi(s, s->request_id_last + 1, FRAME_BUF_COUNT, 0);
+      enqueue_req_multi(s, s->request_id_last + 1, s->buf_count, 0);
       s->frame_id_last = main_id;
       s->skipped = true;
     }
@@ -1046,14 +1087,11 @@ void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
 
 // called by processing_thread
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
-  const CameraBuf *b = &c->buf;
+  CameraBuf *b = &c->buf;
 
   MessageBuilder msg;
   auto framed = c == &s->road_cam ? msg.initEvent().initRoadCameraState() : msg.initEvent().initWideRoadCameraState();
   fill_frame_data(framed, b->cur_frame_data);
-  if ((c == &s->road_cam && env_send_road) || (c == &s->wide_road_cam && env_send_wide_road)) {
-    framed.setImage(get_frame_image(b));
-  }
   if (c == &s->road_cam) {
     framed.setTransform(b->yuv_transform.v);
   }
@@ -1067,9 +1105,10 @@ void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
 void cameras_run(MultiCameraState *s) {
   LOG("-- Starting threads");
   std::vector<std::thread> threads;
-  threads.push_back(start_process_thread(s, &s->road_cam, process_road_camera));
-  threads.push_back(start_process_thread(s, &s->driver_cam, process_driver_camera));
-  threads.push_back(start_process_thread(s, &s->wide_road_cam, process_road_camera));
+  // the road camera is the input of modeld, the driver and the wide cameras run below it. a frame every 50 ms
+  threads.push_back(start_process_thread(s, &s->road_cam, process_road_camera, {-1, 53, 50}));
+  threads.push_back(start_process_thread(s, &s->driver_cam, process_driver_camera, {-1, 51, 50}));
+  threads.push_back(start_process_thread(s, &s->wide_road_cam, process_road_camera, {-1, 52, 50}));
 
   // start devices
   LOG("-- Starting devices");
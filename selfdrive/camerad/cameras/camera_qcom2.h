@@ -10,7 +10,25 @@
 #include "selfdrive/common/util.h"
 
 #define FRAME_BUF_COUNT 4
+// the request queue depth can be set from 2 to FRAME_BUF_COUNT_MAX with CAMERA_QUEUE_DEPTH, deeper
+// survives longer stalls of the processing threads, shallower has the frames wait less
+#define FRAME_BUF_COUNT_MAX 8
 #define DEBAYER_LOCAL_WORKSIZE 16
+
+// the isp stats of a camera are logged every ISP_STATS_FRAMES frames
+#define ISP_STATS_FRAMES 1200
+
+typedef struct IspStats {
+  int frames;
+  // sof to the signal of the output fence, and the wait for it, in ms
+  double latency_sum, latency_max;
+  double fence_wait_sum, fence_wait_max;
+  int fence_timeouts;
+  int skipped_frames, dropped_requests, duplicate_requests;
+  // frames queued to the processing thread or on the gpu when a buffer is done
+  int occupancy_sum, occupancy_max;
+} IspStats;
+
 typedef struct CameraState {
   MultiCameraState *multi_cam_state;
   CameraInfo ci;
@@ -42,13 +60,15 @@ typedef struct CameraState {
   int32_t link_handle;
 
   int buf0_handle;
-  int buf_handle[FRAME_BUF_COUNT];
-  int sync_objs[FRAME_BUF_COUNT];
-  int request_ids[FRAME_BUF_COUNT];
+  int buf_count;
+  int buf_handle[FRAME_BUF_COUNT_MAX];
+  int sync_objs[FRAME_BUF_COUNT_MAX];
+  int request_ids[FRAME_BUF_COUNT_MAX];
   int request_id_last;
   int frame_id_last;
   int idx_offset;
   bool skipped;
+  IspStats isp_stats;
 
   struct cam_req_mgr_session_info req_mgr_session_info;
 
@@ -0,0 +1,145 @@
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+
+#include "selfdrive/camerad/cameras/frame_reader.h"
+
+#include <cassert>
+
+#include "libyuv.h"
+
+#include "selfdrive/common/swaglog.h"
+
+FrameReader::FrameReader(const std::vector<std::string> &files) : files(files) {
+  av_register_all();
+  frame = av_frame_alloc();
+  pkt = av_packet_alloc();
+  assert(frame && pkt);
+}
+
+FrameReader::~FrameReader() {
+  close_file();
+  av_packet_free(&pkt);
+  av_frame_free(&frame);
+}
+
+bool FrameReader::open() {
+  return !files.empty() && open_file(files[0]);
+}
+
+bool FrameReader::open_file(const std::string &fn) {
+  // hevc files from loggerd are raw annex b streams, no container
+  AVInputFormat *fmt = av_find_input_format("hevc");
+  if (avformat_open_input(&format_ctx, fn.c_str(), fmt, NULL) != 0) {
+    LOGE("failed to open %s", fn.c_str());
+    return false;
+  }
+  frame_idx = 0;
+  if (avformat_find_stream_info(format_ctx, NULL) < 0 || format_ctx->nb_streams < 1) {
+    LOGE("no video stream in %s", fn.c_str());
+    close_file();
+    return false;
+  }
+
+  AVCodecParameters *par = format_ctx->streams[0]->codecpar;
+  AVCodec *codec = avcodec_find_decoder(par->codec_id);
+  assert(codec);
+  codec_ctx = avcodec_alloc_context3(codec);
+  assert(codec_ctx);
+  avcodec_parameters_to_context(codec_ctx, par);
+  codec_ctx->thread_count = 0;  // auto
+  if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    LOGE("failed to open decoder for %s", fn.c_str());
+    close_file();
+    return false;
+  }
+
+  // every file of a camera has to have the size of the first one, the buffers are allocated for it
+  if (width == 0) {
+    width = codec_ctx->width;
+    height = codec_ctx->height;
+  } else if (codec_ctx->width != width || codec_ctx->height != height) {
+    LOGE("%s is %dx%d, expected %dx%d", fn.c_str(), codec_ctx->width, codec_ctx->height, width, height);
+    close_file();
+    return false;
+  }
+  LOGD("decoding %s", fn.c_str());
+  return true;
+}
+
+void FrameReader::close_file() {
+  if (codec_ctx) avcodec_free_context(&codec_ctx);
+  if (format_ctx) avformat_close_input(&format_ctx);
+}
+
+void FrameReader::next_file() {
+  close_file();
+  while (++file_idx < files.size()) {
+    if (open_file(files[file_idx])) break;
+  }
+}
+
+bool FrameReader::next(uint8_t *rgb, int stride) {
+  if (!decode()) return false;
+
+  libyuv::I420ToRGB24(frame->data[0], frame->linesize[0],
+                      frame->data[1], frame->linesize[1],
+                      frame->data[2], frame->linesize[2],
+                      rgb, stride, width, height);
+  av_frame_unref(frame);
+  return true;
+}
+
+bool FrameReader::next_yuv(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *rgb, int stride) {
+  if (!decode()) return false;
+
+  libyuv::I420Copy(frame->data[0], frame->linesize[0],
+                   frame->data[1], frame->linesize[1],
+                   frame->data[2], frame->linesize[2],
+                   y, width, u, width / 2, v, width / 2, width, height);
+  if (rgb) {
+    libyuv::I420ToRGB24(y, width, u, width / 2, v, width / 2, rgb, stride, width, height);
+  }
+  av_frame_unref(frame);
+  return true;
+}
+
+bool FrameReader::seek(size_t file, size_t frame_in_file) {
+  if (file >= files.size()) return false;
+
+  if (file != file_idx || frame_in_file < frame_idx || !codec_ctx) {
+    close_file();
+    file_idx = file;
+    if (!open_file(files[file_idx])) return false;
+  }
+  while (frame_idx < frame_in_file) {
+    if (!decode() || last_file != file) return false;
+    av_frame_unref(frame);
+  }
+  return true;
+}
+
+// The next frame into frame
+bool FrameReader::decode() {
+  while (codec_ctx) {
+    int ret = avcodec_receive_frame(codec_ctx, frame);
+    if (ret == 0) {
+      assert(frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P);
+      last_file = file_idx;
+      last_frame = frame_idx++;
+      return true;
+    } else if (ret == AVERROR_EOF) {
+      // decoder is drained, continue with the next segment
+      next_file();
+    } else if (ret == AVERROR(EAGAIN)) {
+      if (av_read_frame(format_ctx, pkt) == 0) {
+        avcodec_send_packet(codec_ctx, pkt);
+        av_packet_unref(pkt);
+      } else {
+        avcodec_send_packet(codec_ctx, NULL);
+      }
+    } else {
+      LOGE("failed to decode %s: %d", files[file_idx].c_str(), ret);
+      next_file();
+    }
+  }
+  return false;
+}
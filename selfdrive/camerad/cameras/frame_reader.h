@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Decodes the hevc files of a camera one after another, e.g. fcamera.hevc of every segment of a route
+class FrameReader {
+public:
+  FrameReader(const std::vector<std::string> &files);
+  ~FrameReader();
+  // Opens the first file, false if it can't be decoded
+  bool open();
+  // Decodes the next frame as rgb (bgr in memory, like the debayer output), false after the last file
+  bool next(uint8_t *rgb, int stride);
+  // The next frame as I420, the planes of a yuv VisionBuf, and as rgb too unless rgb is NULL
+  bool next_yuv(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *rgb = NULL, int stride = 0);
+  // Continues with frame frame_in_file of file, in presentation order. The frames of the file before
+  // it are decoded again unless the reader is already there
+  bool seek(size_t file, size_t frame_in_file);
+
+  // file and frame in it of the last frame returned
+  size_t last_file = 0, last_frame = 0;
+  int width = 0, height = 0;
+
+private:
+  bool open_file(const std::string &fn);
+  void close_file();
+  void next_file();
+  bool decode();
+
+  std::vector<std::string> files;
+  size_t file_idx = 0;
+  size_t frame_idx = 0;  // of the next frame in the file
+  AVFormatContext *format_ctx = NULL;
+  AVCodecContext *codec_ctx = NULL;
+  AVFrame *frame = NULL;
+  AVPacket *pkt = NULL;
+};
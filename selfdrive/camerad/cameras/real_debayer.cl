@@ -26,17 +26,30 @@ half mf(half x, half cp) {
   }
 }
 
-half3 color_correct(half3 rgb) {
+// the tone curve of a color corrected channel, as the uchar it's written as
+uchar tone_curve(half x) {
+  const half cpx = 0.01;
+  return (uchar)(clamp(0.0h, 255.0h, mf(x, cpx)*255.0h));
+}
+
+// tone_curve of every half of [0, 1], at its bits. Run once, debayer10 reads it instead of evaluating the curve
+__kernel void tone_lut(__global uchar * lut) {
+  const int i = get_global_id(0);
+  lut[i] = tone_curve(as_half((ushort)i));
+}
+
+inline uchar tone_map(half x, __constant uchar * tone_lut) {
+  // out of [0, 1] are only the saturated colors
+  const ushort bits = as_ushort(x);
+  return bits <= 0x3C00 ? tone_lut[bits] : tone_curve(x);
+}
+
+uchar3 color_correct(half3 rgb, __constant uchar * tone_lut) {
   half3 ret = (0,0,0);
-  half cpx = 0.01;
   ret += (half)rgb.x * color_correction[0];
   ret += (half)rgb.y * color_correction[1];
   ret += (half)rgb.z * color_correction[2];
-  ret.x = mf(ret.x, cpx);
-  ret.y = mf(ret.y, cpx);
-  ret.z = mf(ret.z, cpx);
-  ret = clamp(0.0h, 255.0h, ret*255.0h);
-  return ret;
+  return (uchar3)(tone_map(ret.x, tone_lut), tone_map(ret.y, tone_lut), tone_map(ret.z, tone_lut));
 }
 
 half val_from_10(const uchar * source, int gx, int gy) {
@@ -87,9 +100,22 @@ half phi(half x) {
   // }
 }
 
+#ifdef FUSED_YUV
+// same conversion as transforms/rgb_to_yuv.cl
+#define RGB_TO_Y(r, g, b) ((((mul24(b, 13) + mul24(g, 65) + mul24(r, 33)) + 64) >> 7) + 16)
+#define RGB_TO_U(r, g, b) ((mul24(b, 56) - mul24(g, 37) - mul24(r, 19) + 0x8080) >> 8)
+#define RGB_TO_V(r, g, b) ((mul24(r, 56) - mul24(g, 47) - mul24(b, 9) + 0x8080) >> 8)
+#define AVERAGE(x, y, z, w) ((convert_ushort(x) + convert_ushort(y) + convert_ushort(z) + convert_ushort(w) + 1) >> 1)
+#endif
+
 __kernel void debayer10(const __global uchar * in,
                         __global uchar * out,
-                        __local half * cached
+                        __local half * cached,
+                        __constant uchar * tone_lut
+#ifdef FUSED_YUV
+                        , __global uchar * out_yuv,
+                        __local uchar * rgb_cached
+#endif
                        )
 {
   const int x_global = get_global_id(0);
@@ -105,103 +131,129 @@ __kernel void debayer10(const __global uchar * in,
   half pv = val_from_10(in, x_global, y_global);
   cached[localOffset] = pv;
 
-  // don't care
-  if (x_global < 1 || x_global >= RGB_WIDTH - 1 || y_global < 1 || y_global >= RGB_HEIGHT - 1) {
-    return;
-  }
+  // don't care, but every work item has to reach the barriers
+  const bool border = x_global < 1 || x_global >= RGB_WIDTH - 1 || y_global < 1 || y_global >= RGB_HEIGHT - 1;
 
-  // cache padding
-  int localColOffset = -1;
-  int globalColOffset = -1;
-
-  // cache padding
-  if (x_local < 1) {
-    localColOffset = x_local;
-    globalColOffset = -1;
-    cached[(y_local + 1) * localRowLen + x_local] = val_from_10(in, x_global-1, y_global);
-  } else if (x_local >= get_local_size(0) - 1) {
-    localColOffset = x_local + 2;
-    globalColOffset = 1;
-    cached[localOffset + 1] = val_from_10(in, x_global+1, y_global);
-  }
+  if (!border) {
+    // cache padding
+    int localColOffset = -1;
+    int globalColOffset = -1;
 
-  if (y_local < 1) {
-    cached[y_local * localRowLen + x_local + 1] = val_from_10(in, x_global, y_global-1);
-    if (localColOffset != -1) {
-      cached[y_local * localRowLen + localColOffset] = val_from_10(in, x_global+globalColOffset, y_global-1);
+    // cache padding
+    if (x_local < 1) {
+      localColOffset = x_local;
+      globalColOffset = -1;
+      cached[(y_local + 1) * localRowLen + x_local] = val_from_10(in, x_global-1, y_global);
+    } else if (x_local >= get_local_size(0) - 1) {
+      localColOffset = x_local + 2;
+      globalColOffset = 1;
+      cached[localOffset + 1] = val_from_10(in, x_global+1, y_global);
     }
-  } else if (y_local >= get_local_size(1) - 1) {
-    cached[(y_local + 2) * localRowLen + x_local + 1] = val_from_10(in, x_global, y_global+1);
-    if (localColOffset != -1) {
-      cached[(y_local + 2) * localRowLen + localColOffset] = val_from_10(in, x_global+globalColOffset, y_global+1);
+
+    if (y_local < 1) {
+      cached[y_local * localRowLen + x_local + 1] = val_from_10(in, x_global, y_global-1);
+      if (localColOffset != -1) {
+        cached[y_local * localRowLen + localColOffset] = val_from_10(in, x_global+globalColOffset, y_global-1);
+      }
+    } else if (y_local >= get_local_size(1) - 1) {
+      cached[(y_local + 2) * localRowLen + x_local + 1] = val_from_10(in, x_global, y_global+1);
+      if (localColOffset != -1) {
+        cached[(y_local + 2) * localRowLen + localColOffset] = val_from_10(in, x_global+globalColOffset, y_global+1);
+      }
     }
   }
 
   // sync
   barrier(CLK_LOCAL_MEM_FENCE);
 
-  half d1 = cached[localOffset - localRowLen - 1];
-  half d2 = cached[localOffset - localRowLen + 1];
-  half d3 = cached[localOffset + localRowLen - 1];
-  half d4 = cached[localOffset + localRowLen + 1];
-  half n1 = cached[localOffset - localRowLen];
-  half n2 = cached[localOffset + 1];
-  half n3 = cached[localOffset + localRowLen];
-  half n4 = cached[localOffset - 1];
-
-  half3 rgb;
-
-  // a simplified version of https://opensignalprocessingjournal.com/contents/volumes/V6/TOSIGPJ-6-1/TOSIGPJ-6-1.pdf
-  if (x_global % 2 == 0) {
-    if (y_global % 2 == 0) {
-      rgb.y = pv; // G1(R)
-      half k1 = phi(fabs_diff(d1, pv) + fabs_diff(d2, pv));
-      half k2 = phi(fabs_diff(d2, pv) + fabs_diff(d4, pv));
-      half k3 = phi(fabs_diff(d3, pv) + fabs_diff(d4, pv));
-      half k4 = phi(fabs_diff(d1, pv) + fabs_diff(d3, pv));
-      // R_G1
-      rgb.x = (k2*n2+k4*n4)/(k2+k4);
-      // B_G1
-      rgb.z = (k1*n1+k3*n3)/(k1+k3);
-    } else {
-      rgb.z = pv; // B
-      half k1 = phi(fabs_diff(d1, d3) + fabs_diff(d2, d4));
-      half k2 = phi(fabs_diff(n1, n4) + fabs_diff(n2, n3));
-      half k3 = phi(fabs_diff(d1, d2) + fabs_diff(d3, d4));
-      half k4 = phi(fabs_diff(n1, n2) + fabs_diff(n3, n4));
-      // G_B
-      rgb.y = (k1*(n1+n3)*0.5+k3*(n2+n4)*0.5)/(k1+k3);
-      // R_B
-      rgb.x = (k2*(d2+d3)*0.5+k4*(d1+d4)*0.5)/(k2+k4);
-    }
-  } else {
-    if (y_global % 2 == 0) {
-      rgb.x = pv; // R
-      half k1 = phi(fabs_diff(d1, d3) + fabs_diff(d2, d4));
-      half k2 = phi(fabs_diff(n1, n4) + fabs_diff(n2, n3));
-      half k3 = phi(fabs_diff(d1, d2) + fabs_diff(d3, d4));
-      half k4 = phi(fabs_diff(n1, n2) + fabs_diff(n3, n4));
-      // G_R
-      rgb.y = (k1*(n1+n3)*0.5+k3*(n2+n4)*0.5)/(k1+k3);
-      // B_R
-      rgb.z = (k2*(d2+d3)*0.5+k4*(d1+d4)*0.5)/(k2+k4);
+  uchar3 bgr = (uchar3)(0, 0, 0);
+  if (!border) {
+    half d1 = cached[localOffset - localRowLen - 1];
+    half d2 = cached[localOffset - localRowLen + 1];
+    half d3 = cached[localOffset + localRowLen - 1];
+    half d4 = cached[localOffset + localRowLen + 1];
+    half n1 = cached[localOffset - localRowLen];
+    half n2 = cached[localOffset + 1];
+    half n3 = cached[localOffset + localRowLen];
+    half n4 = cached[localOffset - 1];
+
+    half3 rgb;
+
+    // a simplified version of https://opensignalprocessingjournal.com/contents/volumes/V6/TOSIGPJ-6-1/TOSIGPJ-6-1.pdf
+    if (x_global % 2 == 0) {
+      if (y_global % 2 == 0) {
+        rgb.y = pv; // G1(R)
+        half k1 = phi(fabs_diff(d1, pv) + fabs_diff(d2, pv));
+        half k2 = phi(fabs_diff(d2, pv) + fabs_diff(d4, pv));
+        half k3 = phi(fabs_diff(d3, pv) + fabs_diff(d4, pv));
+        half k4 = phi(fabs_diff(d1, pv) + fabs_diff(d3, pv));
+        // R_G1
+        rgb.x = (k2*n2+k4*n4)/(k2+k4);
+        // B_G1
+        rgb.z = (k1*n1+k3*n3)/(k1+k3);
+      } else {
+        rgb.z = pv; // B
+        half k1 = phi(fabs_diff(d1, d3) + fabs_diff(d2, d4));
+        half k2 = phi(fabs_diff(n1, n4) + fabs_diff(n2, n3));
+        half k3 = phi(fabs_diff(d1, d2) + fabs_diff(d3, d4));
+        half k4 = phi(fabs_diff(n1, n2) + fabs_diff(n3, n4));
+        // G_B
+        rgb.y = (k1*(n1+n3)*0.5+k3*(n2+n4)*0.5)/(k1+k3);
+        // R_B
+        rgb.x = (k2*(d2+d3)*0.5+k4*(d1+d4)*0.5)/(k2+k4);
+      }
     } else {
-      rgb.y = pv; // G2(B)
-      half k1 = phi(fabs_diff(d1, pv) + fabs_diff(d2, pv));
-      half k2 = phi(fabs_diff(d2, pv) + fabs_diff(d4, pv));
-      half k3 = phi(fabs_diff(d3, pv) + fabs_diff(d4, pv));
-      half k4 = phi(fabs_diff(d1, pv) + fabs_diff(d3, pv));
-      // R_G2
-      rgb.x = (k1*n1+k3*n3)/(k1+k3);
-      // B_G2
-      rgb.z = (k2*n2+k4*n4)/(k2+k4);
+      if (y_global % 2 == 0) {
+        rgb.x = pv; // R
+        half k1 = phi(fabs_diff(d1, d3) + fabs_diff(d2, d4));
+        half k2 = phi(fabs_diff(n1, n4) + fabs_diff(n2, n3));
+        half k3 = phi(fabs_diff(d1, d2) + fabs_diff(d3, d4));
+        half k4 = phi(fabs_diff(n1, n2) + fabs_diff(n3, n4));
+        // G_R
+        rgb.y = (k1*(n1+n3)*0.5+k3*(n2+n4)*0.5)/(k1+k3);
+        // B_R
+        rgb.z = (k2*(d2+d3)*0.5+k4*(d1+d4)*0.5)/(k2+k4);
+      } else {
+        rgb.y = pv; // G2(B)
+        half k1 = phi(fabs_diff(d1, pv) + fabs_diff(d2, pv));
+        half k2 = phi(fabs_diff(d2, pv) + fabs_diff(d4, pv));
+        half k3 = phi(fabs_diff(d3, pv) + fabs_diff(d4, pv));
+        half k4 = phi(fabs_diff(d1, pv) + fabs_diff(d3, pv));
+        // R_G2
+        rgb.x = (k1*n1+k3*n3)/(k1+k3);
+        // B_G2
+        rgb.z = (k2*n2+k4*n4)/(k2+k4);
+      }
     }
+
+    rgb = clamp(0.0h, 1.0h, rgb);
+    bgr = color_correct(rgb, tone_lut).zyx;
+    out[out_idx + 0] = bgr.x;
+    out[out_idx + 1] = bgr.y;
+    out[out_idx + 2] = bgr.z;
   }
 
-  rgb = clamp(0.0h, 1.0h, rgb);
-  rgb = color_correct(rgb);
+#ifdef FUSED_YUV
+  // Y per pixel, U and V from the 2x2 block once the work group wrote all its pixels
+  out_yuv[y_global * RGB_WIDTH + x_global] = RGB_TO_Y(bgr.z, bgr.y, bgr.x);
+
+  const int rgbOffset = 3 * (y_local * get_local_size(0) + x_local);
+  vstore3(bgr, 0, rgb_cached + rgbOffset);
+  barrier(CLK_LOCAL_MEM_FENCE);
 
-  out[out_idx + 0] = (uchar)(rgb.z);
-  out[out_idx + 1] = (uchar)(rgb.y);
-  out[out_idx + 2] = (uchar)(rgb.x);
+  if (x_local % 2 == 0 && y_local % 2 == 0) {
+    const int rgbRowLen = 3 * get_local_size(0);
+    const uchar3 p0 = vload3(0, rgb_cached + rgbOffset);
+    const uchar3 p1 = vload3(0, rgb_cached + rgbOffset + 3);
+    const uchar3 p2 = vload3(0, rgb_cached + rgbOffset + rgbRowLen);
+    const uchar3 p3 = vload3(0, rgb_cached + rgbOffset + rgbRowLen + 3);
+    const short ab = AVERAGE(p0.x, p1.x, p2.x, p3.x);
+    const short ag = AVERAGE(p0.y, p1.y, p2.y, p3.y);
+    const short ar = AVERAGE(p0.z, p1.z, p2.z, p3.z);
+
+    const int uv_idx = (y_global / 2) * (RGB_WIDTH / 2) + x_global / 2;
+    out_yuv[RGB_WIDTH * RGB_HEIGHT + uv_idx] = RGB_TO_U(ar, ag, ab);
+    out_yuv[RGB_WIDTH * RGB_HEIGHT * 5 / 4 + uv_idx] = RGB_TO_V(ar, ag, ab);
+  }
+#endif
 }
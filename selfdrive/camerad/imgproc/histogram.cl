@@ -0,0 +1,31 @@
+// luminance histogram of a subsampled region of the y plane
+__kernel void lum_histogram(
+  const __global uchar * y_plane,
+  __global uint * output, // 256 bins, zeroed before
+  const int x_start, const int x_skip, const int num_x,
+  const int y_start, const int y_skip, const int num_y
+)
+{
+  __local uint hist[256];
+
+  const int lid = get_local_id(0) + get_local_id(1) * get_local_size(0);
+  const int local_size = get_local_size(0) * get_local_size(1);
+
+  for (int i = lid; i < 256; i += local_size) {
+    hist[i] = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int xi = get_global_id(0);
+  const int yi = get_global_id(1);
+  if (xi < num_x && yi < num_y) {
+    const int x = x_start + xi * x_skip;
+    const int y = y_start + yi * y_skip;
+    atomic_inc(&hist[y_plane[y * WIDTH + x]]);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int i = lid; i < 256; i += local_size) {
+    if (hist[i]) atomic_add(&output[i], hist[i]);
+  }
+}
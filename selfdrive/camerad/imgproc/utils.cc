@@ -6,34 +6,6 @@
 #include <cmath>
 #include <cstring>
 
-const int16_t lapl_conv_krnl[9] = {0, 1, 0,
-                                   1, -4, 1,
-                                   0, 1, 0};
-
-// calculate score based on laplacians in one area
-uint16_t get_lapmap_one(const int16_t *lap, int x_pitch, int y_pitch) {
-  const int size = x_pitch * y_pitch;
-  // avg and max of roi
-  int16_t max = 0;
-  int sum = 0;
-  for (int i = 0; i < size; ++i) {
-    const int16_t v = lap[i];
-    sum += v;
-    if (v > max) max = v;
-  }
-
-  const int16_t mean = sum / size;
-
-  // var of roi
-  int var = 0;
-  for (int i = 0; i < size; ++i) {
-    var += std::pow(lap[i] - mean, 2);
-  }
-
-  const float fvar = (float)var / size;
-  return std::min(5 * fvar + max, (float)65535);
-}
-
 bool is_blur(const uint16_t *lapmap, const size_t size) {
   float bad_sum = 0;
   for (int i = 0; i < size; i++) {
@@ -44,63 +16,85 @@ bool is_blur(const uint16_t *lapmap, const size_t size) {
   return (bad_sum > LM_PREC_THRESH);
 }
 
-static cl_program build_conv_program(cl_device_id device_id, cl_context context, int image_w, int image_h, int filter_size) {
+LapConv::LapConv(cl_device_id device_id, cl_context ctx, int frame_width, int frame_height)
+    : width(frame_width / NUM_SEGMENTS_X), height(frame_height / NUM_SEGMENTS_Y), stride(frame_width) {
   char args[4096];
-  snprintf(args, sizeof(args),
-          "-cl-fast-relaxed-math -cl-denorms-are-zero "
-          "-DIMAGE_W=%d -DIMAGE_H=%d -DFLIP_RB=%d "
-          "-DFILTER_SIZE=%d -DHALF_FILTER_SIZE=%d -DTWICE_HALF_FILTER_SIZE=%d -DHALF_FILTER_SIZE_IMAGE_W=%d",
-          image_w, image_h, 1,
-          filter_size, filter_size/2, (filter_size/2)*2, (filter_size/2)*image_w);
-  return cl_program_from_file(context, device_id, "imgproc/conv.cl", args);
-}
-
-LapConv::LapConv(cl_device_id device_id, cl_context ctx, int rgb_width, int rgb_height, int filter_size)
-    : width(rgb_width / NUM_SEGMENTS_X), height(rgb_height / NUM_SEGMENTS_Y), 
-      roi_buf(width * height * 3), result_buf(width * height) {
-
-  prg = build_conv_program(device_id, ctx, width, height, filter_size);
-  krnl = CL_CHECK_ERR(clCreateKernel(prg, "rgb2gray_conv2d", &err));
-  // TODO: Removed CL_MEM_SVM_FINE_GRAIN_BUFFER, confirm it doesn't matter
-  roi_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_WRITE, roi_buf.size() * sizeof(roi_buf[0]), NULL, &err));
-  result_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_WRITE, result_buf.size() * sizeof(result_buf[0]), NULL, &err));
-  filter_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                          9 * sizeof(int16_t), (void *)&lapl_conv_krnl, &err));
+  snprintf(args, sizeof(args), "-cl-fast-relaxed-math -cl-denorms-are-zero -DIMAGE_W=%d -DIMAGE_H=%d", width, height);
+  cl_program prg = cl_program_from_file(ctx, device_id, "imgproc/conv.cl", args);
+  krnl = CL_CHECK_ERR(clCreateKernel(prg, "lap_score_y", &err));
+  CL_CHECK(clReleaseProgram(prg));
+  score_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, sizeof(uint16_t), NULL, &err));
 }
 
 LapConv::~LapConv() {
-  CL_CHECK(clReleaseMemObject(roi_cl));
-  CL_CHECK(clReleaseMemObject(result_cl));
-  CL_CHECK(clReleaseMemObject(filter_cl));
+  CL_CHECK(clReleaseMemObject(score_cl));
   CL_CHECK(clReleaseKernel(krnl));
-  CL_CHECK(clReleaseProgram(prg));
 }
 
-uint16_t LapConv::Update(cl_command_queue q, const uint8_t *rgb_buf, const int roi_id) {
+uint16_t LapConv::Update(cl_command_queue q, cl_mem yuv_cl, const int roi_id) {
   // sharpness scores
   const int x_offset = ROI_X_MIN + roi_id % (ROI_X_MAX - ROI_X_MIN + 1);
   const int y_offset = ROI_Y_MIN + roi_id / (ROI_X_MAX - ROI_X_MIN + 1);
+  const int x0 = x_offset * width, y0 = y_offset * height;
+
+  const size_t work_size[] = {LAP_LOCAL_WORKSIZE};
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), (void *)&yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(int), &stride));
+  CL_CHECK(clSetKernelArg(krnl, 2, sizeof(int), &x0));
+  CL_CHECK(clSetKernelArg(krnl, 3, sizeof(int), &y0));
+  CL_CHECK(clSetKernelArg(krnl, 4, sizeof(cl_mem), (void *)&score_cl));
+  CL_CHECK(clSetKernelArg(krnl, 5, LAP_LOCAL_WORKSIZE * sizeof(cl_int), NULL));
+  CL_CHECK(clSetKernelArg(krnl, 6, LAP_LOCAL_WORKSIZE * sizeof(cl_long), NULL));
+  CL_CHECK(clSetKernelArg(krnl, 7, LAP_LOCAL_WORKSIZE * sizeof(cl_int), NULL));
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 1, NULL, work_size, work_size, 0, NULL, NULL));
+
+  // only the score comes back to the cpu
+  uint16_t score = 0;
+  CL_CHECK(clEnqueueReadBuffer(q, score_cl, CL_TRUE, 0, sizeof(score), &score, 0, NULL, NULL));
+  return score;
+}
 
-  const uint8_t *rgb_offset = rgb_buf + y_offset * height * FULL_STRIDE_X * 3 + x_offset * width * 3;
-  for (int i = 0; i < height; ++i) {
-    memcpy(&roi_buf[i * width * 3], &rgb_offset[i * FULL_STRIDE_X * 3], width * 3);
-  }
-
-  constexpr int local_mem_size = (CONV_LOCAL_WORKSIZE + 2 * (3 / 2)) * (CONV_LOCAL_WORKSIZE + 2 * (3 / 2)) * (3 * sizeof(uint8_t));
-  const size_t global_work_size[] = {(size_t)width, (size_t)height};
-  const size_t local_work_size[] = {CONV_LOCAL_WORKSIZE, CONV_LOCAL_WORKSIZE};
+LumHistogram::LumHistogram(cl_device_id device_id, cl_context ctx, int width) {
+  char args[4096];
+  snprintf(args, sizeof(args), "-cl-fast-relaxed-math -cl-denorms-are-zero -DWIDTH=%d", width);
+  cl_program prg = cl_program_from_file(ctx, device_id, "imgproc/histogram.cl", args);
+  krnl = CL_CHECK_ERR(clCreateKernel(prg, "lum_histogram", &err));
+  CL_CHECK(clReleaseProgram(prg));
+  hist_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_WRITE, HIST_BINS * sizeof(uint32_t), NULL, &err));
+}
 
-  CL_CHECK(clEnqueueWriteBuffer(q, roi_cl, CL_TRUE, 0, roi_buf.size() * sizeof(roi_buf[0]), roi_buf.data(), 0, 0, 0));
-  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), (void *)&roi_cl));
-  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), (void *)&result_cl));
-  CL_CHECK(clSetKernelArg(krnl, 2, sizeof(cl_mem), (void *)&filter_cl));
-  CL_CHECK(clSetKernelArg(krnl, 3, local_mem_size, 0));
-  cl_event conv_event;
-  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, global_work_size, local_work_size, 0, 0, &conv_event));
-  CL_CHECK(clWaitForEvents(1, &conv_event));
-  CL_CHECK(clReleaseEvent(conv_event));
-  CL_CHECK(clEnqueueReadBuffer(q, result_cl, CL_TRUE, 0,
-                               result_buf.size() * sizeof(result_buf[0]), result_buf.data(), 0, 0, 0));
+LumHistogram::~LumHistogram() {
+  CL_CHECK(clReleaseMemObject(hist_cl));
+  CL_CHECK(clReleaseKernel(krnl));
+}
 
-  return get_lapmap_one(result_buf.data(), width, height);
+void LumHistogram::queue(cl_command_queue q, cl_mem yuv_cl, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip,
+                         uint32_t *out, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event) {
+  assert(x_skip > 0 && y_skip > 0);
+  const int num_x = (x_end - x_start + x_skip - 1) / x_skip;
+  const int num_y = (y_end - y_start + y_skip - 1) / y_skip;
+  const size_t local_work_size[] = {HIST_LOCAL_WORKSIZE, HIST_LOCAL_WORKSIZE};
+  const size_t global_work_size[] = {
+    (size_t)(num_x + HIST_LOCAL_WORKSIZE - 1) / HIST_LOCAL_WORKSIZE * HIST_LOCAL_WORKSIZE,
+    (size_t)(num_y + HIST_LOCAL_WORKSIZE - 1) / HIST_LOCAL_WORKSIZE * HIST_LOCAL_WORKSIZE,
+  };
+
+  const cl_uint zero = 0;
+  cl_event fill_event, hist_event;
+  CL_CHECK(clEnqueueFillBuffer(q, hist_cl, &zero, sizeof(zero), 0, HIST_BINS * sizeof(uint32_t), num_wait_events, wait_events, &fill_event));
+
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), (void *)&yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), (void *)&hist_cl));
+  CL_CHECK(clSetKernelArg(krnl, 2, sizeof(int), &x_start));
+  CL_CHECK(clSetKernelArg(krnl, 3, sizeof(int), &x_skip));
+  CL_CHECK(clSetKernelArg(krnl, 4, sizeof(int), &num_x));
+  CL_CHECK(clSetKernelArg(krnl, 5, sizeof(int), &y_start));
+  CL_CHECK(clSetKernelArg(krnl, 6, sizeof(int), &y_skip));
+  CL_CHECK(clSetKernelArg(krnl, 7, sizeof(int), &num_y));
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, global_work_size, local_work_size, 1, &fill_event, &hist_event));
+
+  // Only the 1kB histogram comes back to the cpu
+  CL_CHECK(clEnqueueReadBuffer(q, hist_cl, CL_FALSE, 0, HIST_BINS * sizeof(uint32_t), out, 1, &hist_event, event));
+  CL_CHECK(clReleaseEvent(fill_event));
+  CL_CHECK(clReleaseEvent(hist_event));
 }
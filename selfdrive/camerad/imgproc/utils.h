@@ -21,21 +21,35 @@
 #define FULL_STRIDE_X 1280
 #define FULL_STRIDE_Y 896
 
-#define CONV_LOCAL_WORKSIZE 16
+#define LAP_LOCAL_WORKSIZE 256
+#define HIST_LOCAL_WORKSIZE 16
+#define HIST_BINS 256
 
+// Sharpness score of the rois of a yuv frame, computed on the gpu from its y plane
 class LapConv {
 public:
-  LapConv(cl_device_id device_id, cl_context ctx, int rgb_width, int rgb_height, int filter_size);
+  LapConv(cl_device_id device_id, cl_context ctx, int frame_width, int frame_height);
   ~LapConv();
-  uint16_t Update(cl_command_queue q, const uint8_t *rgb_buf, const int roi_id);
+  uint16_t Update(cl_command_queue q, cl_mem yuv_cl, const int roi_id);
 
 private:
-  cl_mem roi_cl, result_cl, filter_cl;
-  cl_program prg;
+  cl_mem score_cl;
   cl_kernel krnl;
-  const int width, height;
-  std::vector<uint8_t> roi_buf;
-  std::vector<int16_t> result_buf;
+  const int width, height, stride;
 };
 
 bool is_blur(const uint16_t *lapmap, const size_t size);
+
+// Luminance histogram of a region of a yuv frame, computed on the gpu
+class LumHistogram {
+public:
+  LumHistogram(cl_device_id device_id, cl_context ctx, int width);
+  ~LumHistogram();
+  // Reads the histogram into out once event is set, samples every skip-th pixel like set_exposure_target
+  void queue(cl_command_queue q, cl_mem yuv_cl, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip,
+             uint32_t *out, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event);
+
+private:
+  cl_mem hist_cl;
+  cl_kernel krnl;
+};
@@ -34,6 +34,10 @@ void party(cl_device_id device_id, cl_context context) {
   cameras_init(&vipc_server, &cameras, device_id, context);
   cameras_open(&cameras);
 
+  // the streams with no clients aren't made, see CameraBuf::acquire
+  vipc_server.set_consumers_callback([](VisionStreamType type, int consumers) {
+    LOGD("vipc stream %d: %d clients", type, consumers);
+  });
   vipc_server.start_listener();
 
   cameras_run(&cameras);
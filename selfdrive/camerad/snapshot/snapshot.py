@@ -1,5 +1,4 @@
 #!/usr/bin/env python3
-import os
 import subprocess
 import time
 
@@ -8,9 +7,9 @@ from PIL import Image
 from typing import List
 
 import cereal.messaging as messaging
+from cereal.visionipc.visionipc_pyx import VisionIpcClient, VisionStreamType  # pylint: disable=no-name-in-module, import-error
 from common.params import Params
 from common.realtime import DT_MDL
-from common.transformations.camera import eon_f_frame_size, eon_d_frame_size, tici_f_frame_size
 from selfdrive.hardware import TICI
 from selfdrive.controls.lib.alertmanager import set_offroad_alert
 from selfdrive.manager.process_config import managed_processes
@@ -23,13 +22,17 @@ def jpeg_write(fn, dat):
   img.save(fn, "JPEG")
 
 
-def extract_image(dat, frame_sizes):
-  img = np.frombuffer(dat, dtype=np.uint8)
-  w, h = frame_sizes[len(img) // 3]
-  b = img[::3].reshape(h, w)
-  g = img[1::3].reshape(h, w)
-  r = img[2::3].reshape(h, w)
-  return np.dstack([r, g, b])
+STREAMS = {
+  "roadCameraState": VisionStreamType.VISION_STREAM_RGB_BACK,
+  "wideRoadCameraState": VisionStreamType.VISION_STREAM_RGB_WIDE,
+  "driverCameraState": VisionStreamType.VISION_STREAM_RGB_FRONT,
+}
+
+
+def extract_image(client):
+  # the buffers are BGR
+  img = client.recv(timeout_ms=1000)
+  return np.ascontiguousarray(img[:, :, ::-1]) if img is not None else None
 
 
 def rois_in_focus(lapres: List[float]) -> float:
@@ -39,9 +42,6 @@ def rois_in_focus(lapres: List[float]) -> float:
 
 
 def get_snapshots(frame="roadCameraState", front_frame="driverCameraState", focus_perc_threshold=0.):
-  frame_sizes = [eon_f_frame_size, eon_d_frame_size, tici_f_frame_size]
-  frame_sizes = {w * h: (w, h) for (w, h) in frame_sizes}
-
   sockets = []
   if frame is not None:
     sockets.append(frame)
@@ -59,8 +59,13 @@ def get_snapshots(frame="roadCameraState", front_frame="driverCameraState", focu
     if min(sm.rcv_frame.values()) > 1 and rois_in_focus(sm[frame].sharpnessScore) >= focus_perc_threshold:
       break
 
-  rear = extract_image(sm[frame].image, frame_sizes) if frame is not None else None
-  front = extract_image(sm[front_frame].image, frame_sizes) if front_frame is not None else None
+  # the frames of the cameras straight from the buffers of camerad
+  clients = {}
+  for s in sockets:
+    clients[s] = VisionIpcClient("camerad", STREAMS[s], True)
+    clients[s].connect(True)
+  rear = extract_image(clients[frame]) if frame is not None else None
+  front = extract_image(clients[front_frame]) if front_frame is not None else None
   return rear, front
 
 
@@ -86,12 +91,6 @@ def snapshot():
   except subprocess.CalledProcessError:
     pass
 
-  os.environ["SEND_ROAD"] = "1"
-  os.environ["SEND_WIDE_ROAD"] = "1"
-
-  if front_camera_allowed:
-    os.environ["SEND_DRIVER"] = "1"
-
   managed_processes['camerad'].start()
   frame = "wideRoadCameraState" if TICI else "roadCameraState"
   front_frame = "driverCameraState" if front_camera_allowed else None
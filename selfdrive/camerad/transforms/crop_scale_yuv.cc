@@ -0,0 +1,41 @@
+#include "selfdrive/camerad/transforms/crop_scale_yuv.h"
+
+#include <cassert>
+#include <cstdio>
+
+CropScaleYuv::CropScaleYuv(cl_context ctx, cl_device_id device_id, int width, int height, int out_width, int out_height)
+    : out_width(out_width), out_height(out_height), width(width), height(height) {
+  assert(width % 2 == 0 && height % 2 == 0 && out_width % 2 == 0 && out_height % 2 == 0);
+  char args[1024];
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero "
+           "-DIN_WIDTH=%d -DIN_HEIGHT=%d -DOUT_WIDTH=%d -DOUT_HEIGHT=%d",
+           width, height, out_width, out_height);
+
+  cl_program prg = cl_program_from_file(ctx, device_id, "transforms/crop_scale_yuv.cl", args);
+  krnl = CL_CHECK_ERR(clCreateKernel(prg, "crop_scale_yuv", &err));
+  CL_CHECK(clReleaseProgram(prg));
+
+  // every work item writes a 2x2 block of Y and one U and V
+  work_size[0] = out_width / 2;
+  work_size[1] = out_height / 2;
+  set_rect(0, 0, width, height, false);
+}
+
+CropScaleYuv::~CropScaleYuv() {
+  CL_CHECK(clReleaseKernel(krnl));
+}
+
+void CropScaleYuv::set_rect(int x, int y, int w, int h, bool mirror) {
+  assert(x >= 0 && y >= 0 && w > 0 && h > 0 && x + w <= width && y + h <= height);
+  rect = {{x, y, w, h}};
+  this->mirror = mirror;
+}
+
+void CropScaleYuv::queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_yuv_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event) {
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), &yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), &out_yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 2, sizeof(cl_int4), &rect));
+  CL_CHECK(clSetKernelArg(krnl, 3, sizeof(cl_int), &mirror));
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, &work_size[0], NULL, num_wait_events, wait_events, event));
+}
@@ -0,0 +1,50 @@
+#define IN_UV_WIDTH (IN_WIDTH / 2)
+#define OUT_UV_WIDTH (OUT_WIDTH / 2)
+#define IN_Y_SIZE (IN_WIDTH * IN_HEIGHT)
+#define OUT_Y_SIZE (OUT_WIDTH * OUT_HEIGHT)
+
+// Bilinear sample of a plane at x, y of the rect r, clamped to its edges
+inline uchar sample(__global uchar const * const p, int stride, int4 r, float x, float y) {
+  x = clamp(x, 0.f, (float)(r.s2 - 1));
+  y = clamp(y, 0.f, (float)(r.s3 - 1));
+  const int x0 = (int)x, y0 = (int)y;
+  const int x1 = min(x0 + 1, r.s2 - 1), y1 = min(y0 + 1, r.s3 - 1);
+  const float fx = x - x0, fy = y - y0;
+
+  __global uchar const * const row0 = p + mad24(r.s1 + y0, stride, r.s0);
+  __global uchar const * const row1 = p + mad24(r.s1 + y1, stride, r.s0);
+  const float top = mix((float)row0[x0], (float)row0[x1], fx);
+  const float bottom = mix((float)row1[x0], (float)row1[x1], fx);
+  return convert_uchar_sat_rte(mix(top, bottom, fy));
+}
+
+// The rect x, y, w, h of the input scaled to the output, sampled at the pixel centers, the output mirrored
+// horizontally with mirror. Each work item writes a 2x2 block of Y and one U and V
+__kernel void crop_scale_yuv(__global uchar const * const in_yuv,
+                             __global uchar * out_yuv,
+                             const int4 rect,
+                             const int mirror)
+{
+  const int ox = mul24((int)get_global_id(0), 2);
+  const int oy = mul24((int)get_global_id(1), 2);
+  const float sx = (float)rect.s2 / OUT_WIDTH;
+  const float sy = (float)rect.s3 / OUT_HEIGHT;
+
+  for (int dy = 0; dy < 2; dy++) {
+    const float y = (oy + dy + 0.5f) * sy - 0.5f;
+    for (int dx = 0; dx < 2; dx++) {
+      float x = (ox + dx + 0.5f) * sx - 0.5f;
+      if (mirror) x = rect.s2 - 1 - x;
+      out_yuv[mad24(oy + dy, OUT_WIDTH, ox + dx)] = sample(in_yuv, IN_WIDTH, rect, x, y);
+    }
+  }
+
+  // the chroma planes are half size, so is the rect
+  const int4 uv_rect = rect / 2;
+  float x = (ox / 2 + 0.5f) * ((float)uv_rect.s2 / OUT_UV_WIDTH) - 0.5f;
+  if (mirror) x = uv_rect.s2 - 1 - x;
+  const float y = (oy / 2 + 0.5f) * ((float)uv_rect.s3 / (OUT_HEIGHT / 2)) - 0.5f;
+  const int out_uv = mad24(oy / 2, OUT_UV_WIDTH, ox / 2);
+  out_yuv[OUT_Y_SIZE + out_uv] = sample(in_yuv + IN_Y_SIZE, IN_UV_WIDTH, uv_rect, x, y);
+  out_yuv[OUT_Y_SIZE + OUT_Y_SIZE / 4 + out_uv] = sample(in_yuv + IN_Y_SIZE + IN_Y_SIZE / 4, IN_UV_WIDTH, uv_rect, x, y);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "selfdrive/common/clutil.h"
+
+// A rect of a yuv frame scaled to a small yuv frame, bilinear like libyuv::I420Scale, e.g. the
+// input of the driver monitoring model
+class CropScaleYuv {
+public:
+  CropScaleYuv(cl_context ctx, cl_device_id device_id, int width, int height, int out_width, int out_height);
+  ~CropScaleYuv();
+  // the chroma rect is the rect halved, mirror flips the output horizontally. Used by the frames queued from now on
+  void set_rect(int x, int y, int w, int h, bool mirror);
+  // Returns without waiting, event is set when the kernel finished
+  void queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_yuv_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event);
+
+  const int out_width, out_height;
+private:
+  const int width, height;
+  cl_int4 rect;
+  cl_int mirror = 0;
+  size_t work_size[2];
+  cl_kernel krnl;
+};
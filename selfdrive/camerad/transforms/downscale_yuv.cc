@@ -0,0 +1,41 @@
+#include "selfdrive/camerad/transforms/downscale_yuv.h"
+
+#include <cassert>
+#include <cstdio>
+
+DownscaleYuv::DownscaleYuv(cl_context ctx, cl_device_id device_id, int width, int height) {
+  assert(width % 2 == 0 && height % 2 == 0);
+  // Every work item writes a 2x2 block, the last few input rows and columns are dropped
+  out_width = (width / 4) & ~1;
+  out_height = (height / 4) & ~1;
+
+  char args[1024];
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero "
+           "-DIN_WIDTH=%d -DIN_HEIGHT=%d -DOUT_WIDTH=%d -DOUT_HEIGHT=%d",
+           width, height, out_width, out_height);
+
+  cl_program prg = cl_program_from_file(ctx, device_id, "transforms/downscale_yuv.cl", args);
+  krnl = CL_CHECK_ERR(clCreateKernel(prg, "downscale_yuv", &err));
+  CL_CHECK(clReleaseProgram(prg));
+
+  work_size[0] = out_width / 2;
+  work_size[1] = out_height / 2;
+}
+
+DownscaleYuv::~DownscaleYuv() {
+  CL_CHECK(clReleaseKernel(krnl));
+}
+
+void DownscaleYuv::queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_yuv_cl) {
+  cl_event event;
+  queue(q, yuv_cl, out_yuv_cl, 0, nullptr, &event);
+  CL_CHECK(clWaitForEvents(1, &event));
+  CL_CHECK(clReleaseEvent(event));
+}
+
+void DownscaleYuv::queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_yuv_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event) {
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), &yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), &out_yuv_cl));
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, &work_size[0], NULL, num_wait_events, wait_events, event));
+}
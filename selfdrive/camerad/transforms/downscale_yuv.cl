@@ -0,0 +1,35 @@
+#define IN_UV_WIDTH (IN_WIDTH / 2)
+#define OUT_UV_WIDTH (OUT_WIDTH / 2)
+#define IN_Y_SIZE (IN_WIDTH * IN_HEIGHT)
+#define OUT_Y_SIZE (OUT_WIDTH * OUT_HEIGHT)
+
+// Average of a 4x4 block starting at p
+inline uchar average_4x4(__global uchar const * const p, int stride) {
+  ushort4 sum = convert_ushort4(vload4(0, p));
+  sum += convert_ushort4(vload4(0, p + stride));
+  sum += convert_ushort4(vload4(0, p + stride * 2));
+  sum += convert_ushort4(vload4(0, p + stride * 3));
+  return convert_uchar((sum.s0 + sum.s1 + sum.s2 + sum.s3 + 8) >> 4);
+}
+
+// Quarter size yuv from a full size one, each work item writes a 2x2 block of Y and one U and V
+__kernel void downscale_yuv(__global uchar const * const in_yuv,
+                            __global uchar * out_yuv)
+{
+  const int ox = mul24((int)get_global_id(0), 2);
+  const int oy = mul24((int)get_global_id(1), 2);
+
+  for (int dy = 0; dy < 2; dy++) {
+    const int in_row = mul24(oy + dy, 4 * IN_WIDTH);
+    uchar2 yy = (uchar2)(
+      average_4x4(in_yuv + in_row + (ox * 4), IN_WIDTH),
+      average_4x4(in_yuv + in_row + (ox + 1) * 4, IN_WIDTH)
+    );
+    vstore2(yy, 0, out_yuv + mad24(oy + dy, OUT_WIDTH, ox));
+  }
+
+  const int in_uv = mad24(oy * 2, IN_UV_WIDTH, ox * 2);
+  const int out_uv = mad24(oy / 2, OUT_UV_WIDTH, ox / 2);
+  out_yuv[OUT_Y_SIZE + out_uv] = average_4x4(in_yuv + IN_Y_SIZE + in_uv, IN_UV_WIDTH);
+  out_yuv[OUT_Y_SIZE + OUT_Y_SIZE / 4 + out_uv] = average_4x4(in_yuv + IN_Y_SIZE + IN_Y_SIZE / 4 + in_uv, IN_UV_WIDTH);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "selfdrive/common/clutil.h"
+
+// Quarter size copy of a yuv frame, for previews and thumbnails
+class DownscaleYuv {
+public:
+  DownscaleYuv(cl_context ctx, cl_device_id device_id, int width, int height);
+  ~DownscaleYuv();
+  void queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_yuv_cl);
+  // Returns without waiting, event is set when the kernel finished
+  void queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_yuv_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event);
+
+  int out_width, out_height;
+private:
+  size_t work_size[2];
+  cl_kernel krnl;
+};
@@ -7,6 +7,8 @@ public:
   Rgb2Yuv(cl_context ctx, cl_device_id device_id, int width, int height, int rgb_stride);
   ~Rgb2Yuv();
   void queue(cl_command_queue q, cl_mem rgb_cl, cl_mem yuv_cl);
+  // Returns without waiting, event is set when the kernel finished
+  void queue(cl_command_queue q, cl_mem rgb_cl, cl_mem yuv_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event);
 private:
   size_t work_size[2];
   cl_kernel krnl;
@@ -0,0 +1,41 @@
+#include "selfdrive/camerad/transforms/yuv_to_nv12.h"
+
+#include <cassert>
+#include <cstdio>
+
+YuvToNv12::YuvToNv12(cl_context ctx, cl_device_id device_id, int in_width, int in_height, int out_width, int out_height, int stride, int uv_offset) {
+  const bool scale = in_width != out_width || in_height != out_height;
+  // Every work item converts a 4x2 block, or scales into a 2x2 one
+  assert(in_width % 2 == 0 && in_height % 2 == 0 && out_width % (scale ? 2 : 4) == 0 && out_height % 2 == 0);
+  assert(stride >= out_width && uv_offset >= stride * out_height);
+
+  char args[1024];
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero "
+           "-DIN_WIDTH=%d -DIN_HEIGHT=%d -DOUT_WIDTH=%d -DOUT_HEIGHT=%d -DSTRIDE=%d -DUV_OFFSET=%d",
+           in_width, in_height, out_width, out_height, stride, uv_offset);
+
+  cl_program prg = cl_program_from_file(ctx, device_id, "transforms/yuv_to_nv12.cl", args);
+  krnl = CL_CHECK_ERR(clCreateKernel(prg, scale ? "scale_yuv_to_nv12" : "yuv_to_nv12", &err));
+  CL_CHECK(clReleaseProgram(prg));
+
+  work_size[0] = out_width / (scale ? 2 : 4);
+  work_size[1] = out_height / 2;
+}
+
+YuvToNv12::~YuvToNv12() {
+  CL_CHECK(clReleaseKernel(krnl));
+}
+
+void YuvToNv12::queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_nv12_cl) {
+  cl_event event;
+  queue(q, yuv_cl, out_nv12_cl, 0, nullptr, &event);
+  CL_CHECK(clWaitForEvents(1, &event));
+  CL_CHECK(clReleaseEvent(event));
+}
+
+void YuvToNv12::queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_nv12_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event) {
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), &yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), &out_nv12_cl));
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, &work_size[0], NULL, num_wait_events, wait_events, event));
+}
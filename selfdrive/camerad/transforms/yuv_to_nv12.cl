@@ -0,0 +1,51 @@
+#define IN_UV_WIDTH (IN_WIDTH / 2)
+#define IN_Y_SIZE (IN_WIDTH * IN_HEIGHT)
+
+// NV12 from I420, each work item copies a 4x2 block of Y and interleaves the two U and V samples below it
+__kernel void yuv_to_nv12(__global uchar const * const in_yuv,
+                          __global uchar * out_nv12)
+{
+  const int x = mul24((int)get_global_id(0), 4);
+  const int y = mul24((int)get_global_id(1), 2);
+
+  vstore4(vload4(0, in_yuv + mad24(y, IN_WIDTH, x)), 0, out_nv12 + mad24(y, STRIDE, x));
+  vstore4(vload4(0, in_yuv + mad24(y + 1, IN_WIDTH, x)), 0, out_nv12 + mad24(y + 1, STRIDE, x));
+
+  const int in_uv = mad24(y / 2, IN_UV_WIDTH, x / 2);
+  const uchar2 u = vload2(0, in_yuv + IN_Y_SIZE + in_uv);
+  const uchar2 v = vload2(0, in_yuv + IN_Y_SIZE + IN_Y_SIZE / 4 + in_uv);
+  vstore4((uchar4)(u.s0, v.s0, u.s1, v.s1), 0, out_nv12 + UV_OFFSET + mad24(y / 2, STRIDE, x));
+}
+
+#define X_SCALE ((float)IN_WIDTH / OUT_WIDTH)
+#define Y_SCALE ((float)IN_HEIGHT / OUT_HEIGHT)
+
+// Bilinear sample of a w x h plane at the center of output pixel (x, y)
+inline uchar sample(__global uchar const * const p, int w, int h, int x, int y) {
+  const float sx = clamp((x + 0.5f) * X_SCALE - 0.5f, 0.0f, w - 1.0f);
+  const float sy = clamp((y + 0.5f) * Y_SCALE - 0.5f, 0.0f, h - 1.0f);
+  const int x0 = (int)sx, y0 = (int)sy;
+  const int x1 = min(x0 + 1, w - 1), y1 = min(y0 + 1, h - 1);
+  const float top = mix((float)p[mad24(y0, w, x0)], (float)p[mad24(y0, w, x1)], sx - x0);
+  const float bottom = mix((float)p[mad24(y1, w, x0)], (float)p[mad24(y1, w, x1)], sx - x0);
+  return convert_uchar_sat_rte(mix(top, bottom, sy - y0));
+}
+
+// Scaled NV12 from I420, each work item writes a 2x2 block of Y and the uv pair below it
+__kernel void scale_yuv_to_nv12(__global uchar const * const in_yuv,
+                                __global uchar * out_nv12)
+{
+  const int x = mul24((int)get_global_id(0), 2);
+  const int y = mul24((int)get_global_id(1), 2);
+
+  for (int dy = 0; dy < 2; dy++) {
+    uchar2 yy = (uchar2)(sample(in_yuv, IN_WIDTH, IN_HEIGHT, x, y + dy),
+                         sample(in_yuv, IN_WIDTH, IN_HEIGHT, x + 1, y + dy));
+    vstore2(yy, 0, out_nv12 + mad24(y + dy, STRIDE, x));
+  }
+
+  // the chroma planes scale by the same factors
+  const uchar u = sample(in_yuv + IN_Y_SIZE, IN_WIDTH / 2, IN_HEIGHT / 2, x / 2, y / 2);
+  const uchar v = sample(in_yuv + IN_Y_SIZE + IN_Y_SIZE / 4, IN_WIDTH / 2, IN_HEIGHT / 2, x / 2, y / 2);
+  vstore2((uchar2)(u, v), 0, out_nv12 + UV_OFFSET + mad24(y / 2, STRIDE, x));
+}
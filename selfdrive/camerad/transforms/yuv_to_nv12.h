@@ -0,0 +1,20 @@
+#pragma once
+
+#include "selfdrive/common/clutil.h"
+
+// Copy of a yuv frame in the NV12 layout of a hardware encoder, with padded rows and the uv plane at uv_offset.
+// Scaled bilinearly when the output size differs
+class YuvToNv12 {
+public:
+  YuvToNv12(cl_context ctx, cl_device_id device_id, int width, int height, int stride, int uv_offset)
+    : YuvToNv12(ctx, device_id, width, height, width, height, stride, uv_offset) {}
+  YuvToNv12(cl_context ctx, cl_device_id device_id, int in_width, int in_height, int out_width, int out_height, int stride, int uv_offset);
+  ~YuvToNv12();
+  void queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_nv12_cl);
+  // Returns without waiting, event is set when the kernel finished
+  void queue(cl_command_queue q, cl_mem yuv_cl, cl_mem out_nv12_cl, cl_uint num_wait_events, const cl_event *wait_events, cl_event *event);
+
+private:
+  size_t work_size[2];
+  cl_kernel krnl;
+};
@@ -1,4 +1,6 @@
+import importlib
 import os
+from collections import defaultdict
 from common.params import Params
 from common.basedir import BASEDIR
 from selfdrive.version import comma_remote, tested_branch
@@ -176,6 +178,26 @@ def fingerprint(logcan, sendcan):
   return car_fingerprint, finger, vin, car_fw, source, exact_match
 
 
+def can_rx_filter(CI, CP):
+  """The CanRxFilter param of boardd: a line per bus the CANParsers of the car and radar interfaces
+  read, the bus and the standard ids on it. The pandas only send those of these buses, None if the
+  parsers can't be found and nothing is filtered"""
+  from opendbc.can.parser import CANParser
+  try:
+    RadarInterface = importlib.import_module(f'selfdrive.car.{CP.carName}.radar_interface').RadarInterface
+    objs = [CI, getattr(CI, 'CS', None), RadarInterface(CP)]
+  except Exception:
+    cloudlog.exception("can rx filter: no radar interface")
+    return None
+
+  addresses = defaultdict(set)
+  for obj in objs:
+    for v in vars(obj).values() if obj is not None else []:
+      if isinstance(v, CANParser):
+        addresses[v.bus].update(a for a in v.addresses if a < 0x800)
+  return "\n".join(f"{bus} " + " ".join(str(a) for a in sorted(addrs)) for bus, addrs in sorted(addresses.items()))
+
+
 def get_car(logcan, sendcan):
   candidate, fingerprints, vin, car_fw, source, exact_match = fingerprint(logcan, sendcan)
 
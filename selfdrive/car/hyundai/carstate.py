@@ -11,6 +11,29 @@ from common.params import Params
 
 GearShifter = car.CarState.GearShifter
 
+# CarState fields that are just a signal, filled by the parsers (FieldMap in opendbc/can/parser_pyx.pyx)
+# field, message, signal, op, arg
+PT_FIELDS = [
+  ("seatbeltUnlatched", "CGW1", "CF_Gway_DrvSeatBeltSw", "==", 0),
+  ("wheelSpeeds.fl", "WHL_SPD11", "WHL_SPD_FL", "*", CV.KPH_TO_MS),
+  ("wheelSpeeds.fr", "WHL_SPD11", "WHL_SPD_FR", "*", CV.KPH_TO_MS),
+  ("wheelSpeeds.rl", "WHL_SPD11", "WHL_SPD_RL", "*", CV.KPH_TO_MS),
+  ("wheelSpeeds.rr", "WHL_SPD11", "WHL_SPD_RR", "*", CV.KPH_TO_MS),
+  ("yawRate", "ESP12", "YAW_RATE", "*", 1.),
+  ("isMph", "CLU11", "CF_Clu_SPEED_UNIT", "!=", 0),
+  ("cruiseButtons", "CLU11", "CF_Clu_CruiseSwState", "*", 1.),
+  ("brakePressed", "TCS13", "DriverBraking", "!=", 0),
+  ("espDisabled", "TCS15", "ESC_Off_Step", "!=", 0),
+  ("brakeHold", "TCS15", "AVH_LAMP", "==", 2),  # 0 OFF, 1 ERROR, 2 ACTIVE, 3 READY
+]
+SAS_FIELDS = [
+  ("steeringRateDeg", "SAS11", "SAS_Speed", "*", 1.),
+]
+MDPS_FIELDS = [
+  ("steeringTorque", "MDPS12", "CR_Mdps_StrColTq", "*", 1.),
+  ("steeringTorqueEps", "MDPS12", "CR_Mdps_OutTq", "*", 1.),
+]
+
 
 class CarState(CarStateBase):
   def __init__(self, CP):
@@ -56,6 +79,7 @@ class CarState(CarStateBase):
     self.is_highway = False
     self.on_speed_control = False
     self.safetycam_decel_dist_gain = int(Params().get("SafetyCamDecelDistGain", encoding="utf8"))
+    self.field_maps = None
 
   def update(self, cp, cp2, cp_cam):
     cp_mdps = cp2 if self.CP.mdpsBus == 1 else cp
@@ -69,15 +93,14 @@ class CarState(CarStateBase):
 
     ret = car.CarState.new_message()
 
+    if self.field_maps is None:
+      self.field_maps = [cp.field_map(PT_FIELDS), cp_sas.field_map(SAS_FIELDS), cp_mdps.field_map(MDPS_FIELDS)]
+    for field_map in self.field_maps:
+      field_map.fill(ret)
+
     ret.doorOpen = any([cp.vl["CGW1"]["CF_Gway_DrvDrSw"], cp.vl["CGW1"]["CF_Gway_AstDrSw"],
                         cp.vl["CGW2"]["CF_Gway_RLDrSw"], cp.vl["CGW2"]["CF_Gway_RRDrSw"]])
 
-    ret.seatbeltUnlatched = cp.vl["CGW1"]["CF_Gway_DrvSeatBeltSw"] == 0
-
-    ret.wheelSpeeds.fl = cp.vl["WHL_SPD11"]["WHL_SPD_FL"] * CV.KPH_TO_MS
-    ret.wheelSpeeds.fr = cp.vl["WHL_SPD11"]["WHL_SPD_FR"] * CV.KPH_TO_MS
-    ret.wheelSpeeds.rl = cp.vl["WHL_SPD11"]["WHL_SPD_RL"] * CV.KPH_TO_MS
-    ret.wheelSpeeds.rr = cp.vl["WHL_SPD11"]["WHL_SPD_RR"] * CV.KPH_TO_MS
     ret.vEgoRaw = (ret.wheelSpeeds.fl + ret.wheelSpeeds.fr + ret.wheelSpeeds.rl + ret.wheelSpeeds.rr) / 4.
     ret.vEgo, ret.aEgo = self.update_speed_kf(ret.vEgoRaw)
     ret.vEgoOP = ret.vEgo
@@ -88,12 +111,8 @@ class CarState(CarStateBase):
     ret.standStill = self.CP.standStill
 
     ret.steeringAngleDeg = cp_sas.vl["SAS11"]["SAS_Angle"] - self.steer_anglecorrection
-    ret.steeringRateDeg = cp_sas.vl["SAS11"]["SAS_Speed"]
-    ret.yawRate = cp.vl["ESP12"]["YAW_RATE"]
     ret.leftBlinker, ret.rightBlinker = self.update_blinker_from_lamp(
       50, cp.vl["CGW1"]["CF_Gway_TurnSigLh"], cp.vl["CGW1"]["CF_Gway_TurnSigRh"])
-    ret.steeringTorque = cp_mdps.vl["MDPS12"]["CR_Mdps_StrColTq"]
-    ret.steeringTorqueEps = cp_mdps.vl["MDPS12"]["CR_Mdps_OutTq"]
     ret.steeringPressed = abs(ret.steeringTorque) > STEER_THRESHOLD
 
     if self.steer_wind_down:
@@ -123,8 +142,7 @@ class CarState(CarStateBase):
 
     ret.cruiseState.standstill = cp_scc.vl["SCC11"]["SCCInfoDisplay"] == 4. if not self.no_radar else False
     self.cruiseState_standstill = ret.cruiseState.standstill
-    self.is_set_speed_in_mph = bool(cp.vl["CLU11"]["CF_Clu_SPEED_UNIT"])
-    ret.isMph = self.is_set_speed_in_mph
+    self.is_set_speed_in_mph = ret.isMph
     
     self.acc_active = ret.cruiseState.enabled
     if self.acc_active:
@@ -143,11 +161,9 @@ class CarState(CarStateBase):
 
     self.cruise_main_button = cp.vl["CLU11"]["CF_Clu_CruiseSwMain"]
     self.cruise_buttons = cp.vl["CLU11"]["CF_Clu_CruiseSwState"]
-    ret.cruiseButtons = self.cruise_buttons
 
     # TODO: Find brake pressure
     ret.brake = 0
-    ret.brakePressed = cp.vl["TCS13"]["DriverBraking"] != 0
     self.brakeUnavailable = cp.vl["TCS13"]["ACCEnable"] == 3
     if ret.brakePressed:
       self.brake_check = True
@@ -167,8 +183,6 @@ class CarState(CarStateBase):
       ret.gas = cp.vl["EMS12"]["PV_AV_CAN"] / 100.
       ret.gasPressed = bool(cp.vl["EMS16"]["CF_Ems_AclAct"])
 
-    ret.espDisabled = (cp.vl["TCS15"]["ESC_Off_Step"] != 0)
-
     self.parkBrake = cp.vl["TCS13"]["PBRAKE_ACT"] == 1
 
     # TPMS code added from OPKR
@@ -292,7 +306,6 @@ class CarState(CarStateBase):
     self.scc11init = copy.copy(cp.vl["SCC11"])
     self.scc12init = copy.copy(cp.vl["SCC12"])
 
-    ret.brakeHold = cp.vl["TCS15"]["AVH_LAMP"] == 2 # 0 OFF, 1 ERROR, 2 ACTIVE, 3 READY
     self.brakeHold = ret.brakeHold
     self.brake_error = cp.vl["TCS13"]["ACCEnable"] != 0 # 0 ACC CONTROL ENABLED, 1-3 ACC CONTROL DISABLED
     self.steer_state = cp_mdps.vl["MDPS12"]["CF_Mdps_ToiActive"] #0 NOT ACTIVE, 1 ACTIVE
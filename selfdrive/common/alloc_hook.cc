@@ -0,0 +1,49 @@
+// The malloc, calloc, realloc and free of the process, counting for alloc_tracker.h and forwarding to
+// those of glibc. An object and not in libcommon, so a program only gets them when it links this in.
+// The aligned allocations (posix_memalign, aligned_alloc) aren't counted
+#include <cstddef>
+
+#include "selfdrive/common/alloc_tracker.h"
+
+#ifdef __GLIBC__
+
+// constant initialized and initial exec, so a count is a plain access of the thread pointer that
+// doesn't itself allocate, even in the malloc of a thread's first TLS access
+static thread_local AllocCounts counts __attribute__((tls_model("initial-exec")));
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+extern "C" void *malloc(size_t size) {
+  counts.allocs++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  counts.allocs++;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  counts.allocs++;
+  if (ptr != nullptr && size == 0) counts.frees++;
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr) {
+  if (ptr != nullptr) counts.frees++;
+  __libc_free(ptr);
+}
+
+AllocCounts alloc_counts() { return counts; }
+bool alloc_hooked() { return true; }
+
+#else
+
+// bionic doesn't have the __libc_ allocators to forward to
+AllocCounts alloc_counts() { return {}; }
+bool alloc_hooked() { return false; }
+
+#endif
@@ -0,0 +1,112 @@
+#include "selfdrive/common/alloc_tracker.h"
+
+#include <alloca.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// taken by the daemons that link alloc_hook.cc
+__attribute__((weak)) AllocCounts alloc_counts() { return {}; }
+__attribute__((weak)) bool alloc_hooked() { return false; }
+
+enum class AllocGuard {
+  COUNT,
+  REPORT,
+  ABORT,
+};
+
+static AllocGuard guard_mode() {
+  const char *mode = getenv("ALLOC_GUARD");
+  if (mode == nullptr) return AllocGuard::COUNT;
+  if (strcmp(mode, "abort") == 0) return AllocGuard::ABORT;
+  return AllocGuard::REPORT;
+}
+
+static const AllocGuard guard = guard_mode();
+
+static std::mutex regions_lock;
+static AllocStats *regions = nullptr;
+
+AllocStats::AllocStats(const char *name) : name(name) {
+  std::lock_guard lk(regions_lock);
+  next = regions;
+  regions = this;
+}
+
+static std::string stats_line(const AllocStats &s) {
+  const unsigned long long iterations = s.iterations, allocating = s.allocating, allocs = s.allocs, max_allocs = s.max_allocs;
+  return util::string_format("%s: %llu of %llu iterations allocated, %llu allocations, %.2f per iteration, %llu at most",
+                             s.name, allocating, iterations, allocs, iterations ? (double)allocs / iterations : 0.0, max_allocs);
+}
+
+NoAllocRegion::~NoAllocRegion() {
+  const unsigned long long n = alloc_counts().allocs - start;
+  stats.iterations.fetch_add(1, std::memory_order_relaxed);
+  if (n == 0) return;
+
+  stats.allocating.fetch_add(1, std::memory_order_relaxed);
+  stats.allocs.fetch_add(n, std::memory_order_relaxed);
+  // regions of the same stats can end on several threads at once
+  uint64_t max = stats.max_allocs.load(std::memory_order_relaxed);
+  while (n > max && !stats.max_allocs.compare_exchange_weak(max, n, std::memory_order_relaxed)) {}
+
+  if (guard == AllocGuard::ABORT) {
+    LOGE("%s: %llu allocations in a NoAllocRegion", stats.name, n);
+    abort();
+  } else if (guard == AllocGuard::REPORT) {
+    LOGW_100("%s: %llu allocations in an iteration", stats.name, n);
+    const uint64_t ts = nanos_since_boot();
+    if (ts >= stats.next_report) {
+      if (stats.next_report != 0) LOGW("%s", stats_line(stats).c_str());
+      stats.next_report = ts + 60 * 1000000000ULL;
+    }
+  }
+}
+
+std::string alloc_summary() {
+  if (!alloc_hooked()) return "";
+
+  std::string ret;
+  std::lock_guard lk(regions_lock);
+  for (AllocStats *s = regions; s != nullptr; s = s->next) {
+    if (!ret.empty()) ret += "\n";
+    ret += stats_line(*s);
+  }
+  return ret;
+}
+
+bool rt_memory_lock(size_t stack_bytes, size_t heap_bytes) {
+  if (getenv("RT_MLOCK") == nullptr) return false;
+
+  // the arenas keep what's freed, a malloc after the prefault doesn't get new pages
+#ifdef M_TRIM_THRESHOLD
+  mallopt(M_TRIM_THRESHOLD, -1);
+#endif
+#ifdef M_MMAP_MAX
+  mallopt(M_MMAP_MAX, 0);
+#endif
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    LOGE("mlockall failed: %s", strerror(errno));
+    return false;
+  }
+
+  volatile char *stack = (volatile char *)alloca(stack_bytes);
+  for (size_t i = 0; i < stack_bytes; i += 4096) stack[i] = 0;
+
+  char *heap = (char *)malloc(heap_bytes);
+  if (heap != nullptr) {
+    memset(heap, 0, heap_bytes);
+    free(heap);
+  }
+  LOGW("memory locked, %zu bytes of stack and %zu bytes of heap prefaulted", stack_bytes, heap_bytes);
+  return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The heap allocations of the loops of the real time daemons, counted per iteration. The counts are
+// of the malloc, calloc, realloc and free of alloc_hook.cc, an object a daemon links to replace the
+// ones of libc for the whole process. Without it the counts stay 0 and the regions count nothing.
+
+struct AllocCounts {
+  uint64_t allocs = 0;
+  uint64_t frees = 0;
+};
+
+// of the calling thread
+AllocCounts alloc_counts();
+bool alloc_hooked();
+
+// The iterations of one loop and the allocations in them. Written by the thread of the loop only,
+// read by alloc_summary from any thread
+struct AllocStats {
+  explicit AllocStats(const char *name);
+
+  const char *name;
+  std::atomic<uint64_t> iterations = 0;
+  // the iterations that allocated, and their allocations
+  std::atomic<uint64_t> allocating = 0;
+  std::atomic<uint64_t> allocs = 0;
+  std::atomic<uint64_t> max_allocs = 0;
+  uint64_t next_report = 0;
+  AllocStats *next = nullptr;
+};
+
+// One iteration of a loop that shouldn't allocate:
+//   static AllocStats stats("can_recv");
+//   while (!do_exit) {
+//     NoAllocRegion region(stats);
+//     ...
+//   }
+// ALLOC_GUARD is what an iteration that allocated does: nothing but the count when it's unset,
+// "report" logs it (rate limited) and the summary of the region every minute, "abort" aborts, for
+// the stack of the allocation in a core
+class NoAllocRegion {
+public:
+  explicit NoAllocRegion(AllocStats &stats) : stats(stats), start(alloc_counts().allocs) {}
+  ~NoAllocRegion();
+  NoAllocRegion(const NoAllocRegion &) = delete;
+  NoAllocRegion &operator=(const NoAllocRegion &) = delete;
+
+private:
+  AllocStats &stats;
+  const uint64_t start;
+};
+
+// of all the regions of the process, a line each, empty without alloc_hook.cc
+std::string alloc_summary();
+
+// For the real time daemons: keeps glibc from giving freed memory back to the kernel, locks the pages
+// of the process, those of now and those to come, and faults in stack_bytes of the stack of the calling
+// thread and heap_bytes of its arena, so a loop doesn't page fault once it's running. Only when
+// RT_MLOCK is set, false when it isn't or mlockall failed
+bool rt_memory_lock(size_t stack_bytes = 256 * 1024, size_t heap_bytes = 8 * 1024 * 1024);
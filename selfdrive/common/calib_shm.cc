@@ -0,0 +1,95 @@
+#include "selfdrive/common/calib_shm.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+
+const char *CALIB_SHM_PATH = "/dev/shm/calib_transform";
+const uint32_t CALIB_SHM_VERSION = 1;
+
+struct CalibShm::Block {
+  uint32_t version;  // layout of the block, readers ignore one they don't know
+  std::atomic<uint32_t> seq;  // odd while a write is in progress, 0 until the first one and after the writer exits
+  CalibTransform transform;
+};
+
+CalibShm::CalibShm(bool writer) : writer(writer) {
+  if (writer) {
+    int fd = open(CALIB_SHM_PATH, O_RDWR | O_CREAT, 0664);
+    assert(fd >= 0);
+    int ret = ftruncate(fd, sizeof(Block));
+    assert(ret == 0);
+    block = (Block *)mmap(NULL, sizeof(Block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(block != MAP_FAILED);
+    close(fd);
+
+    block->seq.store(0);
+    block->version = CALIB_SHM_VERSION;
+  }
+}
+
+CalibShm::~CalibShm() {
+  if (writer) {
+    // readers drop their mapping, and open the block of the next writer
+    block->seq.store(0, std::memory_order_release);
+    unlink(CALIB_SHM_PATH);
+  }
+  if (block) {
+    munmap(block, sizeof(Block));
+  }
+}
+
+bool CalibShm::open_block() {
+  int fd = open(CALIB_SHM_PATH, O_RDONLY);
+  if (fd < 0) return false;
+
+  void *p = MAP_FAILED;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Block)) {
+    p = mmap(NULL, sizeof(Block), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) return false;
+
+  block = (Block *)p;
+  return true;
+}
+
+void CalibShm::write(const CalibTransform &t) {
+  assert(writer);
+  uint32_t seq = block->seq.load(std::memory_order_relaxed);
+  block->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&block->transform, &t, sizeof(t));
+  block->seq.store(seq + 2, std::memory_order_release);
+}
+
+bool CalibShm::read(CalibTransform &t, uint32_t *seq_out) {
+  if (!block && !open_block()) return false;
+  if (block->version != CALIB_SHM_VERSION) {
+    munmap(block, sizeof(Block));
+    block = nullptr;
+    return false;
+  }
+
+  uint32_t seq;
+  while (true) {
+    seq = block->seq.load(std::memory_order_acquire);
+    if (seq == 0) {
+      munmap(block, sizeof(Block));
+      block = nullptr;
+      return false;
+    }
+    if (seq & 1) continue;
+
+    memcpy(&t, (const void *)&block->transform, sizeof(t));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (block->seq.load(std::memory_order_relaxed) == seq) break;
+  }
+  if (seq_out) *seq_out = seq;
+  return true;
+}
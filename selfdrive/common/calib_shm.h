@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "selfdrive/common/mat.h"
+
+// The transforms derived from liveCalibration, computed once by modeld and shared through a
+// block in /dev/shm. Readers poll it lock free, a seqlock makes them retry a copy that raced
+// with a write, so they don't decode liveCalibration and redo the math themselves.
+
+struct CalibTransform {
+  float rpy[3];            // rpyCalib of liveCalibration
+  mat3 view_from_calib;    // calibrated frame to the view frame of the camera
+  mat3 model_transform;    // model input to the camera frame modeld runs on, in its yuv space
+  bool wide_camera;        // which camera model_transform is for
+};
+
+class CalibShm {
+public:
+  // the writer creates the block and removes it when it's done, readers fail to open until then
+  explicit CalibShm(bool writer = false);
+  ~CalibShm();
+
+  void write(const CalibTransform &t);
+  // the newest transform and its sequence number, which changes with every write.
+  // false if no writer has published one yet
+  bool read(CalibTransform &t, uint32_t *seq = nullptr);
+
+private:
+  struct Block;
+  bool open_block();
+
+  bool writer;
+  Block *block = nullptr;
+};
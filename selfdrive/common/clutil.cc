@@ -1,14 +1,19 @@
 #include "selfdrive/common/clutil.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <cassert>
+#include <cstdio>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <vector>
 
 #include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
 
 namespace {  // helper functions
 
@@ -56,6 +61,73 @@ void cl_print_build_errors(cl_program program, cl_device_id device) {
   std::cout << "build failed; status=" << status << ", log:" << std::endl << log << std::endl; 
 }
 
+// The program binary cache. A program is a file named by the hash of its key: the platform, device
+// and driver versions, the build arguments and the source. The file starts with the whole key, so a
+// hash collision or an update of the driver is a miss, and a binary the driver rejects is rebuilt.
+std::string program_key(cl_device_id device_id, const char* src, const char* args) {
+  cl_platform_id platform;
+  CL_CHECK(clGetDeviceInfo(device_id, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL));
+  return get_platform_info(platform, CL_PLATFORM_VERSION) + '\n' +
+         get_device_info(device_id, CL_DEVICE_NAME) + '\n' +
+         get_device_info(device_id, CL_DEVICE_VERSION) + '\n' +
+         get_device_info(device_id, CL_DRIVER_VERSION) + '\n' +
+         args + '\n' + src;
+}
+
+std::string program_cache_path(const std::string &key) {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016zx.bin", std::hash<std::string>{}(key));
+  return Path::cl_cache() + name;
+}
+
+cl_program program_from_cache(cl_context ctx, cl_device_id device_id, const std::string &path, const std::string &key, const char* args) {
+  // key size, key, binary
+  std::string data = util::read_file(path);
+  uint64_t key_size = 0;
+  if (data.size() <= sizeof(key_size)) return NULL;
+  memcpy(&key_size, data.data(), sizeof(key_size));
+  if (key_size != key.size() || data.size() <= sizeof(key_size) + key.size() || data.compare(sizeof(key_size), key.size(), key) != 0) {
+    return NULL;
+  }
+
+  const unsigned char *binary = (const unsigned char *)data.data() + sizeof(key_size) + key.size();
+  const size_t binary_size = data.size() - sizeof(key_size) - key.size();
+  cl_int status = CL_INVALID_BINARY, err = CL_INVALID_VALUE;
+  cl_program prg = clCreateProgramWithBinary(ctx, 1, &device_id, &binary_size, &binary, &status, &err);
+  if (err != CL_SUCCESS || status != CL_SUCCESS) {
+    if (prg) clReleaseProgram(prg);
+    return NULL;
+  }
+  if (clBuildProgram(prg, 1, &device_id, args, NULL, NULL) != CL_SUCCESS) {
+    clReleaseProgram(prg);
+    return NULL;
+  }
+  return prg;
+}
+
+void program_to_cache(cl_program prg, const std::string &path, const std::string &key) {
+  size_t binary_size = 0;
+  if (clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL) != CL_SUCCESS || binary_size == 0) {
+    return;
+  }
+  const uint64_t key_size = key.size();
+  std::string data(sizeof(key_size) + key.size() + binary_size, '\0');
+  memcpy(&data[0], &key_size, sizeof(key_size));
+  memcpy(&data[sizeof(key_size)], key.data(), key.size());
+  unsigned char *binary = (unsigned char *)&data[sizeof(key_size) + key.size()];
+  if (clGetProgramInfo(prg, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) != CL_SUCCESS) {
+    return;
+  }
+
+  // written next to it and renamed, the daemons starting at once never read a partial file
+  mkdir(Path::cl_cache().c_str(), 0775);
+  std::string tmp = path + "." + std::to_string(getpid());
+  if (util::write_file(tmp.c_str(), data.data(), data.size(), O_WRONLY | O_CREAT | O_TRUNC, 0664) != 0 ||
+      rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+  }
+}
+
 }  // namespace
 
 cl_device_id cl_get_device_id(cl_device_type device_type) {
@@ -77,17 +149,29 @@ cl_device_id cl_get_device_id(cl_device_type device_type) {
   return nullptr;
 }
 
-cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const char* path, const char* args) {
-  std::string src = util::read_file(path);
-  assert(src.length() > 0);
-  cl_program prg = CL_CHECK_ERR(clCreateProgramWithSource(ctx, 1, (const char*[]){src.c_str()}, NULL, &err));
+cl_program cl_program_from_source(cl_context ctx, cl_device_id device_id, const char* src, const char* args) {
+  args = args ? args : "";
+  const std::string key = program_key(device_id, src, args);
+  const std::string path = program_cache_path(key);
+  if (cl_program prg = program_from_cache(ctx, device_id, path, key, args)) {
+    return prg;
+  }
+
+  cl_program prg = CL_CHECK_ERR(clCreateProgramWithSource(ctx, 1, (const char*[]){src}, NULL, &err));
   if (int err = clBuildProgram(prg, 1, &device_id, args, NULL, NULL); err != 0) {
     cl_print_build_errors(prg, device_id);
     assert(0);
   }
+  program_to_cache(prg, path, key);
   return prg;
 }
 
+cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const char* path, const char* args) {
+  std::string src = util::read_file(path);
+  assert(src.length() > 0);
+  return cl_program_from_source(ctx, device_id, src.c_str(), args);
+}
+
 // Given a cl code and return a string representation
 #define CL_ERR_TO_STR(err) case err: return #err
 const char* cl_get_error_string(int err) {
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+// The constant gain kalman filter of common/kalman/simple_kalman.py (KF1D) for many objects, e.g.
+// the radar tracks: one call updates the filters of all of them on arrays of their two states.
+// x <- (A - K C) x + K meas
+class KF1DBank {
+public:
+  // A row major, C the 1x2 measurement matrix, K the 2x1 gain
+  KF1DBank(const double A[4], const double C[2], const double K[2])
+      : k0_(K[0]), k1_(K[1]),
+        ak0_(A[0] - K[0] * C[0]), ak1_(A[1] - K[0] * C[1]), ak2_(A[2] - K[1] * C[0]), ak3_(A[3] - K[1] * C[1]) {}
+
+  // x0, x1 and meas of n filters, without active all of them are updated, else the ones with active[i] != 0
+  inline void update(size_t n, double *x0, double *x1, const double *meas, const int *active = nullptr) const {
+    for (size_t i = 0; i < n; i++) {
+      const double s0 = x0[i], s1 = x1[i];
+      const bool a = active == nullptr || active[i] != 0;
+      x0[i] = a ? ak0_ * s0 + ak1_ * s1 + k0_ * meas[i] : s0;
+      x1[i] = a ? ak2_ * s0 + ak3_ * s1 + k1_ * meas[i] : s1;
+    }
+  }
+
+private:
+  const double k0_, k1_, ak0_, ak1_, ak2_, ak3_;
+};
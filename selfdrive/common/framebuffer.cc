@@ -37,6 +37,18 @@ void FrameBuffer::swap() {
   assert(glGetError() == GL_NO_ERROR);
 }
 
+void FrameBuffer::make_current() {
+  int success = eglMakeCurrent(s->display, s->surface, s->surface, s->context);
+  assert(success);
+}
+
+void FrameBuffer::set_visible(bool visible) {
+  SurfaceComposerClient::openGlobalTransaction();
+  status_t status = visible ? s->control->show() : s->control->hide();
+  SurfaceComposerClient::closeGlobalTransaction();
+  assert(status == 0);
+}
+
 bool set_brightness(int brightness) {
   char bright[64];
   snprintf(bright, sizeof(bright), "%d", brightness);
@@ -47,7 +59,7 @@ void FrameBuffer::set_power(int mode) {
   SurfaceComposerClient::setDisplayPowerMode(s->dtoken, mode);
 }
 
-FrameBuffer::FrameBuffer(const char *name, uint32_t layer, int alpha, int *out_w, int *out_h) {
+FrameBuffer::FrameBuffer(const char *name, uint32_t layer, int alpha, int *out_w, int *out_h, int buffer_count) {
   s = new FramebufferState;
 
   s->session = new SurfaceComposerClient();
@@ -84,6 +96,11 @@ FrameBuffer::FrameBuffer(const char *name, uint32_t layer, int alpha, int *out_w
 
   s->s = s->control->getSurface();
   assert(s->s != NULL);
+  if (buffer_count > 0) {
+    // before EGL connects to it
+    status = native_window_set_buffer_count(s->s.get(), buffer_count);
+    assert(status == 0);
+  }
 
   // init opengl and egl
   const EGLint attribs[] = {
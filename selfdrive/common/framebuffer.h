@@ -9,9 +9,13 @@ bool set_brightness(int brightness);
 struct FramebufferState;
 class FrameBuffer {
  public:
-  FrameBuffer(const char *name, uint32_t layer, int alpha, int *out_w, int *out_h);
+  // buffer_count of the surface, 0 for the default of SurfaceFlinger
+  FrameBuffer(const char *name, uint32_t layer, int alpha, int *out_w, int *out_h, int buffer_count = 0);
   ~FrameBuffer();
   void set_power(int mode);
+  void set_visible(bool visible);
+  // the context of the surface, on the thread that draws
+  void make_current();
   void swap();
 private:
   FramebufferState *s;
@@ -3,6 +3,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifndef __APPLE__
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <cstdio>
 #include <cstring>
 
 #include "selfdrive/common/util.h"
@@ -30,3 +36,25 @@ int gpio_set(int pin_nr, bool high) {
   }
   return util::write_file(pin_val_path, (void*)(high ? "1" : "0"), 1);
 }
+
+int gpiochip_get_ro_value_fd(const char *consumer_label, int gpiochip_id, int pin_nr) {
+#ifndef __APPLE__
+  char gpiochip_path[50];
+  snprintf(gpiochip_path, sizeof(gpiochip_path), "/dev/gpiochip%d", gpiochip_id);
+  int fd = open(gpiochip_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct gpioevent_request rq = {};
+  rq.lineoffset = pin_nr;
+  rq.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  rq.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+  strncpy(rq.consumer_label, consumer_label, sizeof(rq.consumer_label) - 1);
+  int ret = ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &rq);
+  close(fd);
+  return ret < 0 ? -1 : rq.fd;
+#else
+  return -1;
+#endif
+}
@@ -8,6 +8,8 @@
   #define GPIO_UBLOX_PWR_EN     34
   #define GPIO_STM_RST_N        124
   #define GPIO_STM_BOOT0        134
+  #define GPIO_LSM_INT          84
+  #define GPIOCHIP_INT          0
 #else
   #define GPIO_HUB_RST_N        0
   #define GPIO_UBLOX_RST_N      0
@@ -15,7 +17,12 @@
   #define GPIO_UBLOX_PWR_EN     0
   #define GPIO_STM_RST_N        0
   #define GPIO_STM_BOOT0        0
+  #define GPIO_LSM_INT          0
+  #define GPIOCHIP_INT          0
 #endif
 
 int gpio_init(int pin_nr, bool output);
 int gpio_set(int pin_nr, bool high);
+
+// An fd of the rising edges of a line of a gpiochip, each read returns a struct gpioevent_data
+int gpiochip_get_ro_value_fd(const char *consumer_label, int gpiochip_id, int pin_nr);
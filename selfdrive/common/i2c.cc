@@ -15,6 +15,7 @@
 #ifdef QCOM2
 // TODO: decide if we want to isntall libi2c-dev everywhere
 extern "C" {
+  #include <linux/i2c.h>
   #include <linux/i2c-dev.h>
   #include <i2c/smbus.h>
 }
@@ -33,10 +34,18 @@ I2CBus::~I2CBus() {
   if(i2c_fd >= 0) { close(i2c_fd); }
 }
 
+int I2CBus::set_slave(uint8_t device_address) {
+  if (slave_address == device_address) return 0;
+
+  int ret = ioctl(i2c_fd, I2C_SLAVE, device_address);
+  slave_address = ret < 0 ? -1 : device_address;
+  return ret;
+}
+
 int I2CBus::read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) {
   int ret = 0;
 
-  ret = ioctl(i2c_fd, I2C_SLAVE, device_address);
+  ret = set_slave(device_address);
   if(ret < 0) { goto fail; }
 
   ret = i2c_smbus_read_i2c_block_data(i2c_fd, register_address, len, buffer);
@@ -46,10 +55,37 @@ fail:
   return ret;
 }
 
+int I2CBus::read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, uint16_t len) {
+  uint8_t reg = register_address;
+  struct i2c_msg msgs[2] = {
+    {.addr = device_address, .flags = 0, .len = 1, .buf = &reg},
+    {.addr = device_address, .flags = I2C_M_RD, .len = len, .buf = buffer},
+  };
+  struct i2c_rdwr_ioctl_data data = {.msgs = msgs, .nmsgs = 2};
+
+  int ret = ioctl(i2c_fd, I2C_RDWR, &data);
+  return ret < 0 ? ret : len;
+}
+
+int I2CBus::read_registers(I2CRead *reads, int num) {
+  // a write of the register and a read of it for each
+  struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+  if (num * 2 > I2C_RDWR_IOCTL_MAX_MSGS) return -1;
+
+  for (int i = 0; i < num; i++) {
+    msgs[2 * i] = {.addr = reads[i].device_address, .flags = 0, .len = 1, .buf = &reads[i].register_address};
+    msgs[2 * i + 1] = {.addr = reads[i].device_address, .flags = I2C_M_RD, .len = reads[i].len, .buf = reads[i].buffer};
+  }
+  struct i2c_rdwr_ioctl_data data = {.msgs = msgs, .nmsgs = (uint32_t)num * 2};
+
+  int ret = ioctl(i2c_fd, I2C_RDWR, &data);
+  return ret < 0 ? ret : 0;
+}
+
 int I2CBus::set_register(uint8_t device_address, uint register_address, uint8_t data) {
   int ret = 0;
 
-  ret = ioctl(i2c_fd, I2C_SLAVE, device_address);
+  ret = set_slave(device_address);
   if(ret < 0) { goto fail; }
 
   ret = i2c_smbus_write_byte_data(i2c_fd, register_address, data);
@@ -76,6 +112,20 @@ int I2CBus::read_register(uint8_t device_address, uint register_address, uint8_t
   return -1;
 }
 
+int I2CBus::read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, uint16_t len) {
+  UNUSED(device_address);
+  UNUSED(register_address);
+  UNUSED(buffer);
+  UNUSED(len);
+  return -1;
+}
+
+int I2CBus::read_registers(I2CRead *reads, int num) {
+  UNUSED(reads);
+  UNUSED(num);
+  return -1;
+}
+
 int I2CBus::set_register(uint8_t device_address, uint register_address, uint8_t data) {
   UNUSED(device_address);
   UNUSED(register_address);
@@ -4,14 +4,29 @@
 
 #include <sys/types.h>
 
+// a register read of a transaction
+struct I2CRead {
+  uint8_t device_address;
+  uint8_t register_address;
+  uint8_t *buffer;
+  uint16_t len;
+};
+
 class I2CBus {
   private:
     int i2c_fd;
+    // the I2C_SLAVE of the fd, it is set again only for another device
+    int slave_address = -1;
+    int set_slave(uint8_t device_address);
 
   public:
     I2CBus(uint8_t bus_id);
     ~I2CBus();
 
     int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len);
+    // one transfer of any length, unlike the 32 bytes of an smbus block read
+    int read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, uint16_t len);
+    // the reads, of any devices on the bus, in one I2C_RDWR. 0 if all of them completed
+    int read_registers(I2CRead *reads, int num);
     int set_register(uint8_t device_address, uint register_address, uint8_t data);
 };
@@ -64,6 +64,31 @@ static inline vec4 matvecmul(const mat4 &a, const vec4 &b) {
   return ret;
 }
 
+// Transforms the n points (x[i], y[i], z[i]) by a and divides by the third coordinate of each
+// result, the projection of a camera matrix. The coordinates are in arrays of their own and the
+// loop has no branches, so it's vectorized for NEON and SSE four points at a time
+static inline void matvecmul3_project(const mat3 &a, const float *__restrict x, const float *__restrict y,
+                                      const float *__restrict z, int n, float *__restrict out_x, float *__restrict out_y) {
+  for (int i = 0; i < n; i++) {
+    const float px = a.v[0] * x[i] + a.v[1] * y[i] + a.v[2] * z[i];
+    const float py = a.v[3] * x[i] + a.v[4] * y[i] + a.v[5] * z[i];
+    const float pw = a.v[6] * x[i] + a.v[7] * y[i] + a.v[8] * z[i];
+    out_x[i] = px / pw;
+    out_y[i] = py / pw;
+  }
+}
+
+// Transforms the n points, x, y and z in arrays of their own, by a
+static inline void matvecmul3_batch(const mat3 &a, const float *__restrict x, const float *__restrict y,
+                                    const float *__restrict z, int n,
+                                    float *__restrict out_x, float *__restrict out_y, float *__restrict out_z) {
+  for (int i = 0; i < n; i++) {
+    out_x[i] = a.v[0] * x[i] + a.v[1] * y[i] + a.v[2] * z[i];
+    out_y[i] = a.v[3] * x[i] + a.v[4] * y[i] + a.v[5] * z[i];
+    out_z[i] = a.v[6] * x[i] + a.v[7] * y[i] + a.v[8] * z[i];
+  }
+}
+
 // scales the input and output space of a transformation matrix
 // that assumes pixel-center origin.
 static inline mat3 transform_scale_buffer(const mat3 &in, float s) {
@@ -42,6 +42,38 @@ const mat3 ecam_intrinsic_matrix =
                                0., 0., 0.,
                                0., 0., 0.}};
 
+// The driver monitoring model sees this rect of the driver camera yuv frame, scaled to
+// DM_INPUT_WIDTH x DM_INPUT_HEIGHT and mirrored for RHD. camerad sends it cropped on the gpu, in
+// the yuv frames of DM_INPUT_STREAM_NAME
+const int DM_INPUT_WIDTH = 320;
+const int DM_INPUT_HEIGHT = 640;
+#define DM_INPUT_STREAM_NAME "yuv_front_dmonitoring"
+
+struct DMonitoringCrop {int x, y, w, h;};
+
+static inline DMonitoringCrop get_dmonitoring_crop(int width, int height, bool is_rhd) {
+  DMonitoringCrop crop_rect;
+  if (Hardware::TICI()) {
+    const int full_width_tici = 1928;
+    const int full_height_tici = 1208;
+    const int adapt_width_tici = 668;
+    const int cropped_height = adapt_width_tici / 1.33;
+    crop_rect = {full_width_tici / 2 - adapt_width_tici / 2,
+                 full_height_tici / 2 - cropped_height / 2 - 196,
+                 cropped_height / 2,
+                 cropped_height};
+    if (!is_rhd) {
+      crop_rect.x += adapt_width_tici - crop_rect.w + 32;
+    }
+  } else {
+    crop_rect = {0, 0, height / 2, height};
+    if (!is_rhd) {
+      crop_rect.x += width - crop_rect.w;
+    }
+  }
+  return crop_rect;
+}
+
 static inline mat3 get_model_yuv_transform(bool bayer = true) {
   float db_s = Hardware::TICI() ? 1.0 : 0.5; // debayering does a 2x downscale on EON
   const mat3 transform = (mat3){{
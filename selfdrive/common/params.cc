@@ -9,14 +9,21 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <condition_variable>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
 #include <mutex>
+#include <set>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "selfdrive/common/params_shm.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
@@ -34,8 +41,12 @@
 namespace {
 
 volatile sig_atomic_t params_do_exit = 0;
+// the slot a blocking get waits on, for the handler to wake it
+ParamsShm *volatile params_wait_shm = nullptr;
+volatile int params_wait_slot = -1;
 void params_sig_handler(int signal) {
   params_do_exit = 1;
+  if (params_wait_shm) params_wait_shm->wake(params_wait_slot);
 }
 
 int fsync_dir(const char* path) {
@@ -149,12 +160,14 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"ApiCache_NavDestinations", PERSISTENT},
     {"AthenadPid", PERSISTENT},
     {"CalibrationParams", PERSISTENT},
-    {"CarBatteryCapacity", PERSISTENT},
+    {"CarBatteryCapacity", PERSISTENT | LAZY},
     {"CarParams", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
     {"CarParamsCache", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT},
     {"CarVin", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
     {"CommunityFeaturesToggle", PERSISTENT},
     {"ControlsReady", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
+    {"CanLogAll", PERSISTENT},
+    {"CanRxFilter", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
     {"CurrentRoute", CLEAR_ON_MANAGER_START | CLEAR_ON_IGNITION_ON},
     {"DisableRadar", PERSISTENT}, // WARNING: THIS DISABLES AEB
     {"EndToEndToggle", PERSISTENT},
@@ -182,11 +195,11 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"IsTakingSnapshot", CLEAR_ON_MANAGER_START},
     {"IsUpdateAvailable", CLEAR_ON_MANAGER_START},
     {"UploadRaw", PERSISTENT},
-    {"LastAthenaPingTime", CLEAR_ON_MANAGER_START},
-    {"LastGPSPosition", PERSISTENT},
+    {"LastAthenaPingTime", CLEAR_ON_MANAGER_START | VOLATILE},
+    {"LastGPSPosition", PERSISTENT | LAZY},
     {"LastUpdateException", PERSISTENT},
     {"LastUpdateTime", PERSISTENT},
-    {"LiveParameters", PERSISTENT},
+    {"LiveParameters", PERSISTENT | LAZY},
     {"MapboxToken", PERSISTENT | DONT_LOG},
     {"NavDestination", CLEAR_ON_MANAGER_START | CLEAR_ON_IGNITION_OFF},
     {"NavSettingTime24h", PERSISTENT},
@@ -278,6 +291,9 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"RightCurvOffsetAdj", PERSISTENT},
     {"DebugUi1", PERSISTENT},
     {"DebugUi2", PERSISTENT},
+    {"ShowUIProfiler", PERSISTENT},
+    {"UIProfilerTrace", CLEAR_ON_MANAGER_START},
+    {"UIDirectRender", PERSISTENT},
     {"LongLogDisplay", PERSISTENT},
     {"OpkrBlindSpotDetect", PERSISTENT},
     {"OpkrMaxAngleLimit", PERSISTENT},
@@ -348,6 +364,201 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"StoppingDistAdj", PERSISTENT},
 };
 
+// Information about safely and atomically writing a file: https://lwn.net/Articles/457667/
+// 1) Create temp file
+// 2) Write data to temp file
+// 3) fsync() the temp file
+// 4) rename the temp file to the real name
+// 5) fsync() the containing directory
+// The values of a batch are renamed together and share the fsync of the directory. With a slot of
+// the shm, a value goes there once it's in place. For a pending value that's already there, the
+// slot learns its file before the rename, so the watcher knows it's ours
+enum class SlotUpdate {
+  NONE,
+  VALUE,
+  WRITTEN,
+};
+
+struct ParamWrite {
+  std::string key;
+  std::string value;
+  ParamsShm *shm = nullptr;
+  int slot = -1;
+  SlotUpdate update = SlotUpdate::NONE;
+};
+
+int write_param_files(const std::string &params_path, const std::vector<ParamWrite> &writes) {
+  struct Temp {
+    std::string path;
+    int fd;
+    struct stat st;
+  };
+  std::vector<Temp> temps;
+  int result = 0;
+  for (const ParamWrite &w : writes) {
+    Temp &t = temps.emplace_back(Temp{params_path + "/.tmp_value_XXXXXX", -1, {}});
+    t.fd = mkstemp((char*)t.path.c_str());
+    if (t.fd < 0) {
+      result = -1;
+      break;
+    }
+
+    // Write value to temp.
+    ssize_t bytes_written = HANDLE_EINTR(write(t.fd, w.value.data(), w.value.size()));
+    if (bytes_written < 0 || (size_t)bytes_written != w.value.size()) {
+      result = -20;
+      break;
+    }
+
+    // change permissions to 0666 for apks
+    if ((result = fchmod(t.fd, 0666)) < 0) break;
+    // fsync to force persist the changes.
+    if ((result = fsync(t.fd)) < 0) break;
+    if ((result = fstat(t.fd, &t.st)) < 0) break;
+  }
+
+  if (result == 0) {
+    FileLock file_lock(params_path + "/.lock", LOCK_EX);
+    std::lock_guard<FileLock> lk(file_lock);
+
+    for (int i = 0; i < writes.size() && result == 0; i++) {
+      const ParamWrite &w = writes[i];
+      const ParamsShm::FileStat file_stat = ParamsShm::fileStat(temps[i].st);
+      if (w.update == SlotUpdate::WRITTEN) w.shm->written(w.slot, file_stat);
+
+      // Move temp into place.
+      std::string path = params_path + "/d/" + w.key;
+      if ((result = rename(temps[i].path.c_str(), path.c_str())) < 0) break;
+      if (w.update == SlotUpdate::VALUE) w.shm->write(w.slot, w.value.data(), w.value.size(), &file_stat);
+    }
+
+    // fsync parent directory, also for the values of a batch that failed later
+    std::string path = params_path + "/d";
+    int result_sync = fsync_dir(path.c_str());
+    if (result == 0) result = result_sync;
+  }
+
+  for (const Temp &t : temps) {
+    if (t.fd >= 0) close(t.fd);
+    remove(t.path.c_str());
+  }
+  return result;
+}
+
+// a LAZY value is written within this, with whatever else is written by then
+const int PARAMS_LAZY_FLUSH_MS = 5000;
+
+// The values of the keys that aren't PERSISTENT are in the shm right away, and written to their
+// files by a thread of the process, in batches that share one fsync of the directory. A LAZY value
+// waits for up to PARAMS_LAZY_FLUSH_MS for others to join its batch. A newer value of a key replaces
+// the one that waits, and what's left is written when the process exits
+class ParamsJournal {
+public:
+  static ParamsJournal &instance() {
+    static ParamsJournal *journal = new ParamsJournal();
+    return *journal;
+  }
+
+  // the keys of the default params path, shm is nullptr for a LAZY key without the table
+  void put(ParamsShm *shm, int slot, const std::string &key, const std::string &value, bool lazy) {
+    std::lock_guard lk(lock);
+    if (!started) {
+      started = true;
+      std::thread(&ParamsJournal::run, this).detach();
+    }
+    // with the lock, the slot is marked as pending in the order of the journal
+    if (shm) shm->write(slot, value.data(), value.size(), nullptr, true);
+
+    const double deadline = millis_since_boot() + (lazy ? PARAMS_LAZY_FLUSH_MS : 0);
+    auto [it, inserted] = pending.try_emplace(key);
+    Entry &e = it->second;
+    e = {shm, slot, value, inserted ? deadline : std::min(e.deadline, deadline)};
+    cv.notify_all();
+  }
+
+  // a removed key shouldn't come back from a write that's waiting
+  void cancel(const std::string &key) {
+    std::unique_lock lk(lock);
+    pending.erase(key);
+    cv.wait(lk, [&] { return writing.count(key) == 0; });
+  }
+
+  void flush() {
+    std::unique_lock lk(lock);
+    cv.wait(lk, [&] { return writing.empty(); });
+    std::vector<ParamWrite> batch = take_pending();
+    writing.clear();
+    if (!batch.empty()) write_param_files(Path::params(), batch);
+  }
+
+private:
+  struct Entry {
+    ParamsShm *shm;
+    int slot;
+    std::string value;
+    double deadline;
+  };
+
+  ParamsJournal() {
+    std::atexit([] { instance().flush(); });
+    // a forked child writes nothing of the parent, and starts a thread of its own
+    pthread_atfork([] { instance().lock.lock(); }, [] { instance().lock.unlock(); }, [] {
+      ParamsJournal &j = instance();
+      j.pending.clear();
+      j.writing.clear();
+      j.started = false;
+      j.lock.unlock();
+    });
+  }
+
+  // all of them, the ones that have time join the batch of the first
+  std::vector<ParamWrite> take_pending() {
+    std::vector<ParamWrite> batch;
+    for (auto &[key, e] : pending) {
+      batch.push_back({key, std::move(e.value), e.shm, e.slot, e.shm ? SlotUpdate::WRITTEN : SlotUpdate::NONE});
+      writing.insert(key);
+    }
+    pending.clear();
+    return batch;
+  }
+
+  void run() {
+    std::unique_lock lk(lock);
+    while (true) {
+      cv.wait(lk, [&] { return !pending.empty(); });
+      double deadline = pending.begin()->second.deadline;
+      for (auto &[key, e] : pending) deadline = std::min(deadline, e.deadline);
+      if (double now = millis_since_boot(); deadline > now) {
+        cv.wait_for(lk, std::chrono::milliseconds((int)(deadline - now) + 1));
+        continue;
+      }
+
+      std::vector<ParamWrite> batch = take_pending();
+      lk.unlock();
+      int ret = write_param_files(Path::params(), batch);
+      if (ret != 0) LOGE("Failed to write %zu params, ret=%d", batch.size(), ret);
+
+      lk.lock();
+      writing.clear();
+      cv.notify_all();
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::map<std::string, Entry> pending;
+  std::set<std::string> writing;
+  bool started = false;
+};
+
+std::vector<std::string> key_names(uint32_t type = ALL) {
+  std::vector<std::string> names;
+  for (auto &[key, key_type] : keys) {
+    if (key_type & type) names.push_back(key);
+  }
+  return names;
+}
+
 } // namespace
 
 Params::Params(bool persistent_param) : Params(persistent_param ? Path::persistent_params() : Path::params()) {}
@@ -356,6 +567,7 @@ std::once_flag default_params_path_ensured;
 Params::Params(const std::string &path) : params_path(path) {
   if (path == Path::params()) {
     std::call_once(default_params_path_ensured, ensure_params_path, path);
+    shm = ParamsShm::instance(path, key_names(), key_names(VOLATILE));
   } else {
     ensure_params_path(path);
   }
@@ -370,53 +582,50 @@ ParamKeyType Params::getKeyType(const std::string &key) {
 }
 
 int Params::put(const char* key, const char* value, size_t value_size) {
-  // Information about safely and atomically writing a file: https://lwn.net/Articles/457667/
-  // 1) Create temp file
-  // 2) Write data to temp file
-  // 3) fsync() the temp file
-  // 4) rename the temp file to the real name
-  // 5) fsync() the containing directory
-  std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
-  int tmp_fd = mkstemp((char*)tmp_path.c_str());
-  if (tmp_fd < 0) return -1;
-
-  int result = -1;
-  do {
-    // Write value to temp.
-    ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, value_size));
-    if (bytes_written < 0 || (size_t)bytes_written != value_size) {
-      result = -20;
-      break;
-    }
-
-    // change permissions to 0666 for apks
-    if ((result = fchmod(tmp_fd, 0666)) < 0) break;
-    // fsync to force persist the changes.
-    if ((result = fsync(tmp_fd)) < 0) break;
-
-    FileLock file_lock(params_path + "/.lock", LOCK_EX);
-    std::lock_guard<FileLock> lk(file_lock);
-
-    // Move temp into place.
-    std::string path = params_path + "/d/" + std::string(key);
-    if ((result = rename(tmp_path.c_str(), path.c_str())) < 0) break;
-
-    // fsync parent directory
-    path = params_path + "/d";
-    result = fsync_dir(path.c_str());
-  } while (false);
+  return putBatch({{key, std::string(value, value_size)}});
+}
 
-  close(tmp_fd);
-  remove(tmp_path.c_str());
-  return result;
+int Params::putBatch(const std::map<std::string, std::string> &values) {
+  const bool journaled = params_path == Path::params();
+  std::vector<ParamWrite> durable;
+  for (auto &[key, value] : values) {
+    auto it = keys.find(key);
+    const uint32_t type = it != keys.end() ? it->second : 0;
+    const int slot = shm ? shm->index(key) : -1;
+    const bool fits = slot >= 0 && value.size() <= ParamsShm::MAX_VALUE_SIZE;
+
+    if (fits && (type & VOLATILE)) {
+      shm->write(slot, value.data(), value.size(), nullptr);
+    } else if (journaled && (type & LAZY) && (fits || slot < 0)) {
+      ParamsJournal::instance().put(fits ? shm : nullptr, slot, key, value, true);
+    } else if (fits && !(type & PERSISTENT)) {
+      ParamsJournal::instance().put(shm, slot, key, value, false);
+    } else {
+      // the PERSISTENT keys have to survive a power loss right after the put
+      durable.push_back({key, value, slot >= 0 ? shm : nullptr, slot, slot >= 0 ? SlotUpdate::VALUE : SlotUpdate::NONE});
+    }
+  }
+  return durable.empty() ? 0 : write_param_files(params_path, durable);
 }
 
 int Params::remove(const char *key) {
+  const int slot = shm ? shm->index(key) : -1;
+  if (params_path == Path::params()) {
+    ParamsJournal::instance().cancel(key);
+  }
+
   FileLock file_lock(params_path + "/.lock", LOCK_EX);
   std::lock_guard<FileLock> lk(file_lock);
   // Delete value.
   std::string path = params_path + "/d/" + key;
   int result = ::remove(path.c_str());
+  if (slot >= 0) {
+    // also a value that was only in the shm, its write was cancelled
+    std::string value;
+    const bool in_shm = shm->read(slot, value) != ParamsShm::MISSING;
+    shm->clear(slot);
+    if (result != 0 && in_shm) return 0;
+  }
   if (result != 0) {
     result = ERR_NO_VALUE;
     return result;
@@ -428,8 +637,18 @@ int Params::remove(const char *key) {
 
 std::string Params::get(const char *key, bool block) {
   std::string path = params_path + "/d/" + key;
+  const int slot = shm ? shm->index(key) : -1;
+  auto read_value = [&](uint32_t *seq) {
+    if (slot < 0) return util::read_file(path);
+    std::string value;
+    if (shm->read(slot, value, seq) == ParamsShm::ON_DISK) {
+      value = util::read_file(path);
+    }
+    return value;
+  };
+
   if (!block) {
-    return util::read_file(path);
+    return read_value(nullptr);
   } else {
     // blocking read until successful
     params_do_exit = 0;
@@ -438,10 +657,19 @@ std::string Params::get(const char *key, bool block) {
 
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(path); !value.empty()) {
+      uint32_t seq = 0;
+      if (value = read_value(&seq); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      if (slot >= 0) {
+        // the writers wake it, and the signal handler
+        params_wait_slot = slot;
+        params_wait_shm = shm;
+        if (!params_do_exit) shm->wait(slot, seq, 1000);
+        params_wait_shm = nullptr;
+      } else {
+        util::sleep_for(100);  // 0.1 s
+      }
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -455,7 +683,15 @@ std::map<std::string, std::string> Params::readAll() {
   std::lock_guard<FileLock> lk(file_lock);
 
   std::string key_path = params_path + "/d";
-  return util::read_files_in_dir(key_path);
+  std::map<std::string, std::string> values = util::read_files_in_dir(key_path);
+  // the VOLATILE ones, and the ones that aren't written yet
+  if (shm) {
+    std::string value;
+    for (auto &[key, type] : keys) {
+      if (shm->read(shm->index(key), value) == ParamsShm::IN_SHM) values[key] = value;
+    }
+  }
+  return values;
 }
 
 void Params::clearAll(ParamKeyType key_type) {
@@ -6,6 +6,8 @@
 
 #define ERR_NO_VALUE -33
 
+class ParamsShm;
+
 enum ParamKeyType {
   PERSISTENT = 0x02,
   CLEAR_ON_MANAGER_START = 0x04,
@@ -13,12 +15,19 @@ enum ParamKeyType {
   CLEAR_ON_IGNITION_ON = 0x10,
   CLEAR_ON_IGNITION_OFF = 0x20,
   DONT_LOG = 0x40,
-  ALL = 0x02 | 0x04 | 0x08 | 0x10 | 0x20 | 0x40
+  // How a put persists. By default the PERSISTENT keys are written to disk before put returns, and the
+  // others right after it by a thread of the process. VOLATILE ones are only kept in /dev/shm, and
+  // LAZY ones are written within a few seconds, in a batch with others
+  VOLATILE = 0x80,
+  LAZY = 0x100,
+  ALL = 0x02 | 0x04 | 0x08 | 0x10 | 0x20 | 0x40 | 0x80 | 0x100
 };
 
 class Params {
 private:
   std::string params_path;
+  // the values of the default params path, nullptr for the others
+  ParamsShm *shm = nullptr;
 
 public:
   Params(bool persistent_param = false);
@@ -78,4 +87,7 @@ public:
   inline int putBool(const std::string &key, bool val) {
     return putBool(key.c_str(), val);
   }
+
+  // the durable ones of values share the fsync of the directory
+  int putBatch(const std::map<std::string, std::string> &values);
 };
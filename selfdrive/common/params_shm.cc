@@ -0,0 +1,445 @@
+#include "selfdrive/common/params_shm.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "selfdrive/common/swaglog.h"
+
+const uint32_t PARAMS_SHM_VERSION = 2;
+const size_t PARAMS_SLOTS_OFFSET = 4096;
+
+const uint32_t SLOT_PRESENT = 0x1;
+const uint32_t SLOT_ON_DISK = 0x2;
+const uint32_t SLOT_PENDING = 0x4;
+
+// the tries of a spin on a slot before looking at whether its writer is still there
+const int SLOT_SPIN_TRIES = 1000;
+
+struct ParamsShm::Header {
+  uint32_t version;
+  uint32_t num_slots;
+  std::atomic<uint32_t> ready;  // 1 once the first process loaded the slots from the files
+};
+
+struct ParamsShm::Slot {
+  std::atomic<uint32_t> seq;  // odd while a write is in progress
+  std::atomic<uint32_t> waiters;
+  uint32_t flags;
+  uint32_t size;
+  FileStat file_stat;
+  int32_t pending_pid;  // the process that writes the pending value to its file
+  std::atomic<int32_t> writer_pid;  // of the write in progress, 0 without one
+  char value[MAX_VALUE_SIZE];
+};
+
+namespace {
+
+ParamsShm *params_shm = nullptr;
+
+// the table of other keys, of another build or of another params path, gets a name of its own
+uint64_t layout_hash(const std::string &key_path, const std::vector<std::string> &keys, const std::vector<bool> &no_file) {
+  uint64_t h = 14695981039346656037ULL;
+  auto add = [&h](const void *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      h = (h ^ ((const uint8_t *)p)[i]) * 1099511628211ULL;
+    }
+  };
+  add(&PARAMS_SHM_VERSION, sizeof(PARAMS_SHM_VERSION));
+  add(key_path.c_str(), key_path.size() + 1);
+  for (int i = 0; i < keys.size(); i++) {
+    add(keys[i].c_str(), keys[i].size() + 1);
+    const uint8_t file = !no_file[i];
+    add(&file, 1);
+  }
+  return h;
+}
+
+int flock_eintr(int fd, int op) {
+  int ret;
+  while ((ret = flock(fd, op)) < 0 && errno == EINTR) {}
+  return ret;
+}
+
+bool process_alive(pid_t pid) {
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+} // namespace
+
+ParamsShm *ParamsShm::instance(const std::string &params_path, const std::vector<std::string> &keys,
+                               const std::vector<std::string> &volatile_keys) {
+  static ParamsShm *shm = [&]() -> ParamsShm * {
+#ifdef __linux__
+    if (std::getenv("PARAMS_NO_SHM")) return nullptr;
+
+    ParamsShm *p = new ParamsShm(params_path + "/d", keys, volatile_keys);
+    if (!p->open()) {
+      delete p;
+      return nullptr;
+    }
+    // a forked child has the slots mapped, but not the thread of the watcher and its lock
+    params_shm = p;
+    pthread_atfork(nullptr, nullptr, []() {
+      if (params_shm->watcher_lock_fd >= 0) close(params_shm->watcher_lock_fd);
+      if (params_shm->inotify_fd >= 0) close(params_shm->inotify_fd);
+      params_shm->watcher_lock_fd = params_shm->inotify_fd = -1;
+      params_shm->watcher_started = false;
+    });
+    return p;
+#else
+    return nullptr;
+#endif
+  }();
+
+  if (shm) shm->startWatcher();
+  return shm;
+}
+
+ParamsShm::ParamsShm(const std::string &key_path, const std::vector<std::string> &keys, const std::vector<std::string> &volatile_keys)
+    : key_path(key_path), keys(keys) {
+  std::sort(this->keys.begin(), this->keys.end());
+  for (int i = 0; i < this->keys.size(); i++) {
+    key_index[this->keys[i]] = i;
+    no_file.push_back(std::find(volatile_keys.begin(), volatile_keys.end(), this->keys[i]) != volatile_keys.end());
+  }
+}
+
+bool ParamsShm::open() {
+  // the same directory through another path is the same table
+  char *real_path = realpath(key_path.c_str(), nullptr);
+  const std::string resolved = real_path ? real_path : key_path;
+  free(real_path);
+
+  char name[64];
+  snprintf(name, sizeof(name), "/dev/shm/params_%016llx", (unsigned long long)layout_hash(resolved, keys, no_file));
+  shm_path = name;
+  watcher_lock_path = shm_path + ".watcher";
+
+  int fd = ::open(shm_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    LOGW("can't open %s for the params, errno=%d", shm_path.c_str(), errno);
+    return false;
+  }
+  // the other users of the params may not be root
+  fchmod(fd, 0666);
+  // the first process loads the slots, the others wait for it
+  flock_eintr(fd, LOCK_EX);
+
+  static_assert(sizeof(Slot) == 4096);
+  map_size = PARAMS_SLOTS_OFFSET + keys.size() * sizeof(Slot);
+  struct stat st = {};
+  bool ok = fstat(fd, &st) == 0;
+  if (ok && st.st_size != (off_t)map_size) {
+    ok = ftruncate(fd, 0) == 0 && ftruncate(fd, map_size) == 0;
+  }
+  void *mem = ok ? mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  if (mem == MAP_FAILED) {
+    LOGW("can't map %s for the params, errno=%d", shm_path.c_str(), errno);
+    close(fd);
+    return false;
+  }
+  header = (Header *)mem;
+  slots = (Slot *)((char *)mem + PARAMS_SLOTS_OFFSET);
+
+  // also after a process died while loading them
+  if (header->ready.load() != 1) {
+    header->version = PARAMS_SHM_VERSION;
+    header->num_slots = keys.size();
+    for (int i = 0; i < keys.size(); i++) {
+      sync(i);
+    }
+    header->ready.store(1);
+  }
+  // the mapping holds the file open, closing it wouldn't release the lock
+  flock_eintr(fd, LOCK_UN);
+  close(fd);
+  return true;
+}
+
+int ParamsShm::index(const std::string &key) const {
+  auto it = key_index.find(key);
+  return it == key_index.end() ? -1 : it->second;
+}
+
+ParamsShm::FileStat ParamsShm::fileStat(const struct stat &st) {
+  return {(uint64_t)st.st_ino, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec, (int64_t)st.st_size};
+}
+
+// Takes slot i for a write and returns its seq from before, to store with unlock. The slot of a
+// writer that was killed with it is taken over, a write it didn't finish leaves torn set and the
+// slot empty, for the caller to load it from the file again
+uint32_t ParamsShm::lock(int i, bool *torn) {
+  Slot &slot = slots[i];
+  const int32_t pid = getpid();
+  for (int tries = 1;; tries++) {
+    int32_t owner = 0;
+    if (slot.writer_pid.compare_exchange_weak(owner, pid, std::memory_order_acquire, std::memory_order_relaxed)) break;
+    if (owner != 0 && tries % SLOT_SPIN_TRIES == 0 && !process_alive(owner) &&
+        slot.writer_pid.compare_exchange_strong(owner, pid, std::memory_order_acquire, std::memory_order_relaxed)) {
+      LOGW("params: took over the slot of %s from pid %d", keys[i].c_str(), owner);
+      break;
+    }
+    if (tries > 100) std::this_thread::yield();
+  }
+
+  uint32_t s = slot.seq.load(std::memory_order_relaxed);
+  if (torn) *torn = s & 1;
+  if (s & 1) {
+    s += 1;
+    slot.size = 0;
+    slot.flags = 0;
+    slot.file_stat = {};
+  }
+  slot.seq.store(s + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return s;
+}
+
+void ParamsShm::unlock(int i, uint32_t seq) {
+  slots[i].seq.store(seq, std::memory_order_release);
+  slots[i].writer_pid.store(0, std::memory_order_release);
+}
+
+static void wake_slot(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters) {
+#ifdef __linux__
+  // Not FUTEX_PRIVATE_FLAG, the waiters live in other processes
+  if (waiters.load() > 0) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+  }
+#endif
+}
+
+// A slot left odd by a writer that was killed, it's emptied and loaded from the file again
+void ParamsShm::recover(int i) {
+  bool torn = false;
+  const uint32_t seq = lock(i, &torn);
+  unlock(i, torn ? seq + 2 : seq);
+  if (torn) {
+    wake_slot(slots[i].seq, slots[i].waiters);
+    sync(i);
+  }
+}
+
+ParamsShm::Value ParamsShm::read(int i, std::string &value, uint32_t *seq_out) {
+  Slot &slot = slots[i];
+  for (int tries = 1;; tries++) {
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      if (tries % SLOT_SPIN_TRIES == 0) {
+        const int32_t owner = slot.writer_pid.load(std::memory_order_relaxed);
+        if (owner != 0 && !process_alive(owner)) {
+          recover(i);
+        } else if (!no_file[i]) {
+          // a writer that takes its time, the file has the value as well
+          if (seq_out) *seq_out = seq;
+          return ON_DISK;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      continue;
+    }
+
+    const uint32_t flags = slot.flags;
+    if ((flags & SLOT_PRESENT) && !(flags & SLOT_ON_DISK)) {
+      value.assign(slot.value, std::min<size_t>(slot.size, MAX_VALUE_SIZE));
+    } else {
+      value.clear();
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) == seq) {
+      if (seq_out) *seq_out = seq;
+      return !(flags & SLOT_PRESENT) ? MISSING : (flags & SLOT_ON_DISK) ? ON_DISK : IN_SHM;
+    }
+  }
+}
+
+void ParamsShm::write(int i, const char *value, size_t size, const FileStat *st, bool pending) {
+  Slot &slot = slots[i];
+  const uint32_t seq = lock(i);
+  if (size <= MAX_VALUE_SIZE) {
+    memcpy(slot.value, value, size);
+    slot.size = size;
+    slot.flags = SLOT_PRESENT;
+  } else {
+    slot.size = 0;
+    slot.flags = SLOT_PRESENT | SLOT_ON_DISK;
+  }
+  if (pending) {
+    slot.flags |= SLOT_PENDING;
+    slot.pending_pid = getpid();
+  }
+  if (st) slot.file_stat = *st;
+  unlock(i, seq + 2);
+  wake_slot(slot.seq, slot.waiters);
+}
+
+void ParamsShm::clear(int i) {
+  Slot &slot = slots[i];
+  const uint32_t seq = lock(i);
+  slot.size = 0;
+  slot.flags = 0;
+  slot.file_stat = {};
+  unlock(i, seq + 2);
+  wake_slot(slot.seq, slot.waiters);
+}
+
+void ParamsShm::written(int i, const FileStat &st) {
+  Slot &slot = slots[i];
+  bool torn = false;
+  const uint32_t seq = lock(i, &torn);
+  slot.file_stat = st;
+  slot.flags &= ~SLOT_PENDING;
+  if (torn) {
+    // the value is in the file now
+    unlock(i, seq + 2);
+    wake_slot(slot.seq, slot.waiters);
+    sync(i);
+    return;
+  }
+  // the value is the same, the readers and waiters don't need to know
+  unlock(i, seq);
+}
+
+void ParamsShm::wait(int i, uint32_t seq, int timeout_ms) {
+#ifdef __linux__
+  Slot &slot = slots[i];
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  slot.waiters.fetch_add(1);
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&slot.seq), FUTEX_WAIT, seq, &ts, NULL, 0);
+  slot.waiters.fetch_sub(1);
+#endif
+}
+
+void ParamsShm::wake(int i) {
+  wake_slot(slots[i].seq, slots[i].waiters);
+}
+
+void ParamsShm::sync(int i) {
+  if (no_file[i]) return;
+
+  Slot &slot = slots[i];
+  if (slot.flags & SLOT_PENDING) {
+    // newer than the file, unless the process that was to write it is gone
+    const pid_t pid = slot.pending_pid;
+    if (kill(pid, 0) == 0 || errno == EPERM) return;
+  }
+  const std::string path = key_path + "/" + keys[i];
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st = {};
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    // removed, a value of ours that isn't written yet has no file stat
+    const uint32_t seq = lock(i);
+    const bool removed = (slot.flags & SLOT_PRESENT) && slot.file_stat.ino != 0;
+    if (removed) {
+      slot.size = 0;
+      slot.flags = 0;
+      slot.file_stat = {};
+    }
+    unlock(i, removed ? seq + 2 : seq);
+    if (removed) wake_slot(slot.seq, slot.waiters);
+    return;
+  }
+
+  const FileStat file_stat = fileStat(st);
+  std::string value;
+  if (st.st_size <= (off_t)MAX_VALUE_SIZE) {
+    value.resize(st.st_size);
+    size_t n = 0;
+    ssize_t ret;
+    while (n < value.size() && ((ret = ::read(fd, &value[n], value.size() - n)) > 0 || (ret < 0 && errno == EINTR))) {
+      if (ret > 0) n += ret;
+    }
+    value.resize(n);
+  }
+  close(fd);
+
+  // unless it's the file we wrote the value of the slot to
+  const uint32_t seq = lock(i);
+  const bool changed = !(slot.file_stat == file_stat) || (slot.flags & (SLOT_PRESENT | SLOT_PENDING)) != SLOT_PRESENT;
+  if (changed) {
+    if (st.st_size <= (off_t)MAX_VALUE_SIZE) {
+      memcpy(slot.value, value.data(), value.size());
+      slot.size = value.size();
+      slot.flags = SLOT_PRESENT;
+    } else {
+      slot.size = 0;
+      slot.flags = SLOT_PRESENT | SLOT_ON_DISK;
+    }
+    slot.file_stat = file_stat;
+  }
+  unlock(i, changed ? seq + 2 : seq);
+  if (changed) wake_slot(slot.seq, slot.waiters);
+}
+
+void ParamsShm::startWatcher() {
+  if (!watcher_started.exchange(true)) {
+    std::thread(&ParamsShm::watch, this).detach();
+  }
+}
+
+void ParamsShm::watch() {
+#ifdef __linux__
+  int lock_fd = ::open(watcher_lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (lock_fd < 0) {
+    LOGE("can't open %s, errno=%d", watcher_lock_path.c_str(), errno);
+    return;
+  }
+  fchmod(lock_fd, 0666);
+  watcher_lock_fd = lock_fd;
+  // until the watcher of another process exits
+  if (flock_eintr(lock_fd, LOCK_EX) < 0) return;
+
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, key_path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+    LOGE("can't watch %s, errno=%d", key_path.c_str(), errno);
+    if (fd >= 0) close(fd);
+    // for a watcher of another process
+    close(lock_fd);
+    watcher_lock_fd = -1;
+    return;
+  }
+  inotify_fd = fd;
+
+  // what changed while nobody watched
+  for (int i = 0; i < keys.size(); i++) {
+    sync(i);
+  }
+
+  alignas(struct inotify_event) char buf[4096];
+  while (true) {
+    ssize_t len = ::read(fd, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR) continue;
+    if (len <= 0) break;
+
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if (event->mask & IN_Q_OVERFLOW) {
+        for (int i = 0; i < keys.size(); i++) sync(i);
+      } else if (event->len > 0) {
+        if (int i = index(event->name); i >= 0) sync(i);
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  LOGE("stopped watching %s, errno=%d", key_path.c_str(), errno);
+#endif
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The values of the params of the default params path, in a table in /dev/shm shared by all the
+// processes that use them. Every key of the key table has a slot, readers copy its value lock free
+// and retry a copy that raced with a write, like CalibShm. The files in <params>/d stay where the
+// values live: the first process loads the table from them, and one process at a time watches them
+// with inotify to pick up the writes that don't go through Params, like the scripts. The VOLATILE
+// keys only live here, their files are neither loaded nor watched. Waiters for a value sleep on a
+// futex of its slot that the writers wake. A writer killed in the middle of a write is found by its
+// pid after a bounded spin, its slot is taken over and loaded from the file again.
+class ParamsShm {
+public:
+  // a page per key with the fields of the slot, a larger value is read from its file
+  static constexpr size_t MAX_VALUE_SIZE = 4096 - 48;
+
+  enum Value {
+    MISSING,
+    IN_SHM,
+    // too large for a slot, it has to be read from the file
+    ON_DISK,
+  };
+
+  // of the file a slot was loaded from or written to, to tell the writes of others from ours
+  struct FileStat {
+    uint64_t ino = 0;
+    int64_t mtime_ns = 0;
+    int64_t size = 0;
+    bool operator==(const FileStat &s) const { return ino == s.ino && mtime_ns == s.mtime_ns && size == s.size; }
+  };
+
+  // nullptr where /dev/shm can't be used, or with PARAMS_NO_SHM set
+  static ParamsShm *instance(const std::string &params_path, const std::vector<std::string> &keys,
+                             const std::vector<std::string> &volatile_keys);
+
+  // the slot of a key, -1 for a key that isn't in the key table
+  int index(const std::string &key) const;
+  Value read(int i, std::string &value, uint32_t *seq = nullptr);
+  // A value larger than a slot is marked to be on disk, st is kept as it is without one. A pending
+  // value is newer than its file, the watcher leaves it alone until written() or the writer exits
+  void write(int i, const char *value, size_t size, const FileStat *st, bool pending = false);
+  // the pending value of slot i is in its file now, with st
+  void written(int i, const FileStat &st);
+  void clear(int i);
+  // until the value of slot i changes from seq, wake(i) or the timeout
+  void wait(int i, uint32_t seq, int timeout_ms);
+  void wake(int i);
+
+  static FileStat fileStat(const struct stat &st);
+
+private:
+  struct Header;
+  struct Slot;
+
+  ParamsShm(const std::string &key_path, const std::vector<std::string> &keys, const std::vector<std::string> &volatile_keys);
+  bool open();
+  uint32_t lock(int i, bool *torn = nullptr);
+  void unlock(int i, uint32_t seq);
+  void recover(int i);
+  // loads slot i from its file if the file changed
+  void sync(int i);
+  void watch();
+  void startWatcher();
+
+  std::string key_path;
+  std::vector<std::string> keys;
+  std::vector<bool> no_file;
+  std::unordered_map<std::string, int> key_index;
+  std::string shm_path, watcher_lock_path;
+  Header *header = nullptr;
+  Slot *slots = nullptr;
+  size_t map_size = 0;
+
+  std::atomic<bool> watcher_started = false;
+  int watcher_lock_fd = -1, inotify_fd = -1;
+};
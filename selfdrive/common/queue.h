@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <mutex>
 #include <queue>
+#include <thread>
 
 template <class T>
 class SafeQueue {
@@ -50,3 +55,225 @@ private:
   std::condition_variable cv;
   std::queue<T> q;
 };
+
+// Consumers spin this many times before parking, a frame hand-off usually arrives within that.
+// On a single core spinning only delays the producer
+static inline int queue_spin_count() {
+  static const int spin_count = std::thread::hardware_concurrency() > 1 ? 256 : 0;
+  return spin_count;
+}
+
+static inline void queue_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Parks consumers of the lock free queues below. Producers only take the mutex when a consumer is waiting
+class QueueWaiter {
+public:
+  void notify() {
+    // pairs with the fence in wait_until, either the producer sees the waiter or the waiter sees the element
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) > 0) {
+      { std::scoped_lock lk(m); }
+      cv.notify_all();
+    }
+  }
+
+  template <class Pred>
+  bool wait_until(std::chrono::steady_clock::time_point deadline, Pred ready) {
+    std::unique_lock lk(m);
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ret = cv.wait_until(lk, deadline, ready);
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return ret;
+  }
+
+  template <class Pred>
+  void wait(Pred ready) {
+    std::unique_lock lk(m);
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv.wait(lk, ready);
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int> waiters = 0;
+  std::mutex m;
+  std::condition_variable cv;
+};
+
+// Bounded lock free queue for one producer and one consumer thread, push doesn't allocate.
+// Same blocking pop and try_pop as SafeQueue, push returns false when the queue is full
+template <class T, size_t N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity has to be a power of 2");
+
+public:
+  bool push(const T &v) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head_cache == N) {
+      head_cache = head.load(std::memory_order_acquire);
+      if (t - head_cache == N) return false;
+    }
+    buf[t & (N - 1)] = v;
+    tail.store(t + 1, std::memory_order_release);
+    waiter.notify();
+    return true;
+  }
+
+  T pop() {
+    T v;
+    while (!spin_pop(v)) {
+      waiter.wait([this] { return !empty(); });
+    }
+    return v;
+  }
+
+  bool try_pop(T &v, int timeout_ms = 0) {
+    if (timeout_ms <= 0) return pop_now(v);
+    if (spin_pop(v)) return true;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    return waiter.wait_until(deadline, [this] { return !empty(); }) && pop_now(v);
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+
+private:
+  bool pop_now(T &v) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail_cache) {
+      tail_cache = tail.load(std::memory_order_acquire);
+      if (h == tail_cache) return false;
+    }
+    v = buf[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool spin_pop(T &v) {
+    for (int i = 0; i < queue_spin_count(); i++) {
+      if (pop_now(v)) return true;
+      queue_cpu_relax();
+    }
+    return pop_now(v);
+  }
+
+  // producer and consumer side on their own cache lines
+  alignas(64) std::atomic<size_t> tail = 0;
+  size_t head_cache = 0;
+  alignas(64) std::atomic<size_t> head = 0;
+  size_t tail_cache = 0;
+  alignas(64) T buf[N];
+  QueueWaiter waiter;
+};
+
+// Bounded lock free queue for any number of producers and consumers, each slot carries a sequence
+// number telling whether it's free for the push or ready for the pop of a given position
+template <class T, size_t N>
+class MpmcQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity has to be a power of 2");
+
+public:
+  MpmcQueue() {
+    for (size_t i = 0; i < N; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool push(const T &v) {
+    size_t pos = push_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & (N - 1)];
+      const intptr_t diff = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (diff == 0) {
+        if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = push_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->v = v;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    waiter.notify();
+    return true;
+  }
+
+  T pop() {
+    T v;
+    while (!spin_pop(v)) {
+      waiter.wait([this] { return ready(); });
+    }
+    return v;
+  }
+
+  bool try_pop(T &v, int timeout_ms = 0) {
+    if (timeout_ms <= 0) return pop_now(v);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!spin_pop(v)) {
+      if (!waiter.wait_until(deadline, [this] { return ready(); })) return false;
+    }
+    return true;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t size() const {
+    const size_t pop = pop_pos.load(std::memory_order_acquire);
+    const size_t push = push_pos.load(std::memory_order_acquire);
+    return push > pop ? push - pop : 0;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T v;
+  };
+
+  // the next element to pop is written, it might still be taken by another consumer
+  bool ready() const {
+    const size_t pos = pop_pos.load(std::memory_order_relaxed);
+    return cells[pos & (N - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+  }
+
+  bool pop_now(T &v) {
+    size_t pos = pop_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & (N - 1)];
+      const intptr_t diff = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // empty
+      } else {
+        pos = pop_pos.load(std::memory_order_relaxed);
+      }
+    }
+    v = cell->v;
+    cell->seq.store(pos + N, std::memory_order_release);
+    return true;
+  }
+
+  bool spin_pop(T &v) {
+    for (int i = 0; i < queue_spin_count(); i++) {
+      if (pop_now(v)) return true;
+      queue_cpu_relax();
+    }
+    return pop_now(v);
+  }
+
+  alignas(64) std::atomic<size_t> push_pos = 0;
+  alignas(64) std::atomic<size_t> pop_pos = 0;
+  alignas(64) Cell cells[N];
+  QueueWaiter waiter;
+};
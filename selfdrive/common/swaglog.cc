@@ -4,10 +4,21 @@
 
 #include "selfdrive/common/swaglog.h"
 
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include "json11.hpp"
@@ -16,6 +27,35 @@
 #include "selfdrive/common/version.h"
 #include "selfdrive/hardware/hw.h"
 
+// A log call below CLOUDLOG_ERROR copies its level, location, format and args into a ring of its
+// thread, and a thread of the process formats them into json and sends them to logmessaged. The
+// caller doesn't format, allocate, lock or send, a full ring drops the record and counts it. Errors
+// are sent right away, after what's in the rings, as they are often the last words before an abort.
+// So is a record that doesn't fit a slot, and every record with SWAGLOG_SYNC set.
+
+const int LOG_RING_SLOTS = 128;
+const int LOG_RECORD_SIZE = 512;
+// the longest a record waits for the thread when its wakeup was missed
+const int LOG_THREAD_WAIT_MS = 100;
+
+struct LogRecord {
+  double created;
+  int levelnum;
+  int lineno;
+  // the filename, func and fmt strings, then the args of fmt
+  uint16_t size;
+  char data[LOG_RECORD_SIZE - 24];
+};
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE);
+
+// written by its thread, read by the log thread
+struct LogRing {
+  LogRecord records[LOG_RING_SLOTS];
+  std::atomic<uint32_t> head = 0;
+  std::atomic<uint32_t> tail = 0;
+  std::atomic<uint32_t> dropped = 0;
+};
+
 class LogState {
  public:
   LogState() = default;
@@ -26,15 +66,39 @@ class LogState {
   void *zctx;
   void *sock;
   int print_level;
+
+  // the rings of the threads, the ones of threads that exited until they are drained
+  std::mutex rings_lock;
+  std::vector<std::shared_ptr<LogRing>> rings;
+  bool thread_started;
+  // bumped in a forked child, the rings of the parent's threads are the parent's to drain
+  std::atomic<uint32_t> fork_gen;
+  std::mutex wake_lock;
+  std::condition_variable wake_cv;
+  std::atomic<bool> pending;
+  bool exiting, thread_done;
 };
 
+static LogState s = {};
+
+static void log_drain();
+
 LogState::~LogState() {
+  {
+    // what the thread didn't get to
+    std::unique_lock lk(wake_lock);
+    exiting = true;
+    wake_cv.notify_all();
+    if (thread_started) wake_cv.wait_for(lk, std::chrono::milliseconds(LOG_THREAD_WAIT_MS), [this] { return thread_done; });
+  }
+  {
+    std::lock_guard lk(lock);
+    if (inited) log_drain();
+  }
   zmq_close(sock);
   zmq_ctx_destroy(zctx);
 }
 
-static LogState s = {};
-
 static void cloudlog_bind_locked(const char* k, const char* v) {
   s.ctx_j[k] = v;
 }
@@ -82,37 +146,335 @@ static void cloudlog_init() {
   s.inited = true;
 }
 
-void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
-  std::lock_guard lk(s.lock);
+// with s.lock
+static void log_send(int levelnum, double created, const char* filename, int lineno, const char* func, const char* msg) {
   cloudlog_init();
   if (levelnum >= s.print_level) {
     printf("%s: %s\n", filename, msg);
   }
+
+  json11::Json log_j = json11::Json::object {
+    {"msg", msg},
+    {"ctx", s.ctx_j},
+    {"levelnum", levelnum},
+    {"filename", filename},
+    {"lineno", lineno},
+    {"funcname", func},
+    {"created", created}
+  };
+  std::string log_s = log_j.dump();
   char levelnum_c = levelnum;
   zmq_send(s.sock, (levelnum_c + log_s).c_str(), log_s.length() + 1, ZMQ_NOBLOCK);
 }
 
+// the args of printf conversions, as the record keeps them
+enum LogArg {
+  ARG_NONE,
+  ARG_INT,
+  ARG_LONG,
+  ARG_LONGLONG,
+  ARG_DOUBLE,
+  ARG_LONGDOUBLE,
+  ARG_PTR,
+  ARG_STR,
+  ARG_INVALID,
+};
+
+// The conversion that starts after the % at p, returns where it ends. stars counts the * of its width
+// and precision, precision is -1 without one and -2 for a *
+static const char *parse_conversion(const char *p, LogArg *type, int *stars, int *precision) {
+  *stars = 0;
+  *precision = -1;
+  while (*p && strchr("-+ #0'", *p)) p++;
+  if (*p == '*') {
+    (*stars)++;
+    p++;
+  } else {
+    while (isdigit(*p)) p++;
+  }
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      (*stars)++;
+      *precision = -2;
+      p++;
+    } else {
+      *precision = atoi(p);
+      while (isdigit(*p)) p++;
+    }
+  }
+
+  int longs = 0;
+  bool long_double = false;
+  for (; *p && strchr("hlLqjzt", *p); p++) {
+    if (*p == 'l') longs++;
+    if (*p == 'q' || *p == 'j') longs = 2;
+    if (*p == 'z' || *p == 't') longs = std::max(longs, 1);
+    if (*p == 'L') long_double = true;
+  }
+
+  switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+      *type = longs == 0 ? ARG_INT : longs == 1 ? ARG_LONG : ARG_LONGLONG;
+      break;
+    case 'c':
+      *type = longs == 0 ? ARG_INT : ARG_INVALID;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      *type = long_double ? ARG_LONGDOUBLE : ARG_DOUBLE;
+      break;
+    case 's':
+      *type = longs == 0 ? ARG_STR : ARG_INVALID;
+      break;
+    case 'p':
+      *type = ARG_PTR;
+      break;
+    case '%':
+      *type = ARG_NONE;
+      break;
+    default:
+      // %n, wide chars and the end of fmt
+      *type = ARG_INVALID;
+      return p;
+  }
+  return p + 1;
+}
+
+// false if fmt has a conversion the record can't keep, or it doesn't fit
+static bool log_capture(LogRecord &r, const char* filename, const char* func, const char* fmt, va_list args) {
+  char *p = r.data;
+  char *const end = r.data + sizeof(r.data);
+  auto put = [&](const void *v, size_t n) {
+    if (n > (size_t)(end - p)) return false;
+    memcpy(p, v, n);
+    p += n;
+    return true;
+  };
+  auto put_str = [&](const char *str, size_t max_len) {
+    const size_t n = strnlen(str, max_len);
+    if (n + 1 > (size_t)(end - p)) return false;
+    memcpy(p, str, n);
+    p[n] = '\0';
+    p += n + 1;
+    return true;
+  };
+  if (!put_str(filename, SIZE_MAX) || !put_str(func, SIZE_MAX) || !put_str(fmt, SIZE_MAX)) return false;
+
+  for (const char *f = fmt; (f = strchr(f, '%'));) {
+    LogArg type;
+    int stars, precision;
+    f = parse_conversion(f + 1, &type, &stars, &precision);
+    if (type == ARG_INVALID) return false;
+
+    bool ok = true;
+    for (int i = 0; i < stars && ok; i++) {
+      int star = va_arg(args, int);
+      // the string of a %.*s may not end within its precision
+      if (i == stars - 1 && precision == -2) precision = std::max(star, -1);
+      ok = put(&star, sizeof(star));
+    }
+    switch (type) {
+      case ARG_INT: { int v = va_arg(args, int); ok = ok && put(&v, sizeof(v)); break; }
+      case ARG_LONG: { long v = va_arg(args, long); ok = ok && put(&v, sizeof(v)); break; }
+      case ARG_LONGLONG: { long long v = va_arg(args, long long); ok = ok && put(&v, sizeof(v)); break; }
+      case ARG_DOUBLE: { double v = va_arg(args, double); ok = ok && put(&v, sizeof(v)); break; }
+      case ARG_LONGDOUBLE: { long double v = va_arg(args, long double); ok = ok && put(&v, sizeof(v)); break; }
+      case ARG_PTR: { void *v = va_arg(args, void *); ok = ok && put(&v, sizeof(v)); break; }
+      case ARG_STR: {
+        const char *v = va_arg(args, const char *);
+        ok = ok && put_str(v ? v : "(null)", precision >= 0 ? precision : SIZE_MAX);
+        break;
+      }
+      default: break;
+    }
+    if (!ok) return false;
+  }
+  r.size = p - r.data;
+  return true;
+}
+
+template <class T>
+static void append_conversion(std::string &msg, const char *spec, int stars, const int *star, T v) {
+  char buf[1024];
+  int n = stars == 0 ? snprintf(buf, sizeof(buf), spec, v)
+        : stars == 1 ? snprintf(buf, sizeof(buf), spec, star[0], v)
+                     : snprintf(buf, sizeof(buf), spec, star[0], star[1], v);
+  if (n > 0) msg.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+// the message of a record, like vasprintf would have formatted it
+static std::string log_format(const LogRecord &r, const char **filename, const char **func) {
+  const char *p = r.data;
+  *filename = p;
+  p += strlen(p) + 1;
+  *func = p;
+  p += strlen(p) + 1;
+  const char *fmt = p;
+  p += strlen(p) + 1;
+  auto get = [&p](auto &v) {
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+  };
+
+  std::string msg;
+  for (const char *f = fmt; *f;) {
+    const char *pct = strchr(f, '%');
+    if (!pct) {
+      msg += f;
+      break;
+    }
+    msg.append(f, pct - f);
+
+    LogArg type;
+    int stars, precision;
+    const char *next = parse_conversion(pct + 1, &type, &stars, &precision);
+    char spec[32];
+    const size_t spec_len = std::min<size_t>(next - pct, sizeof(spec) - 1);
+    memcpy(spec, pct, spec_len);
+    spec[spec_len] = '\0';
+    int star[2] = {};
+    for (int i = 0; i < stars; i++) get(star[i]);
+
+    switch (type) {
+      case ARG_NONE: msg += '%'; break;
+      case ARG_INT: { int v; get(v); append_conversion(msg, spec, stars, star, v); break; }
+      case ARG_LONG: { long v; get(v); append_conversion(msg, spec, stars, star, v); break; }
+      case ARG_LONGLONG: { long long v; get(v); append_conversion(msg, spec, stars, star, v); break; }
+      case ARG_DOUBLE: { double v; get(v); append_conversion(msg, spec, stars, star, v); break; }
+      case ARG_LONGDOUBLE: { long double v; get(v); append_conversion(msg, spec, stars, star, v); break; }
+      case ARG_PTR: { void *v; get(v); append_conversion(msg, spec, stars, star, v); break; }
+      case ARG_STR: {
+        const char *v = p;
+        p += strlen(p) + 1;
+        append_conversion(msg, spec, stars, star, v);
+        break;
+      }
+      default: break;
+    }
+    f = next;
+  }
+  return msg;
+}
+
+// with s.lock, sends what the rings have
+static void log_drain() {
+  std::vector<std::shared_ptr<LogRing>> rings;
+  {
+    std::lock_guard lk(s.rings_lock);
+    rings = s.rings;
+  }
+
+  for (auto &ring : rings) {
+    const uint32_t head = ring->head.load(std::memory_order_acquire);
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    for (; tail != head; tail++) {
+      const LogRecord &r = ring->records[tail % LOG_RING_SLOTS];
+      const char *filename, *func;
+      std::string msg = log_format(r, &filename, &func);
+      log_send(r.levelnum, r.created, filename, r.lineno, func, msg.c_str());
+    }
+    ring->tail.store(tail, std::memory_order_release);
+
+    if (uint32_t dropped = ring->dropped.exchange(0)) {
+      std::string msg = util::string_format("swaglog: %u messages dropped, the ring of a thread was full", dropped);
+      log_send(CLOUDLOG_WARNING, seconds_since_epoch(), __FILE__, __LINE__, __func__, msg.c_str());
+    }
+  }
+  rings.clear();
+
+  // the ones of the threads that exited
+  std::lock_guard lk(s.rings_lock);
+  s.rings.erase(std::remove_if(s.rings.begin(), s.rings.end(), [](auto &ring) {
+    return ring.use_count() == 1 && ring->head.load() == ring->tail.load();
+  }), s.rings.end());
+}
+
+static void log_thread() {
+  while (true) {
+    {
+      std::unique_lock lk(s.wake_lock);
+      s.wake_cv.wait_for(lk, std::chrono::milliseconds(LOG_THREAD_WAIT_MS), [] { return s.pending.load() || s.exiting; });
+      s.pending = false;
+      if (s.exiting) {
+        s.thread_done = true;
+        s.wake_cv.notify_all();
+        return;
+      }
+    }
+    std::lock_guard lk(s.lock);
+    log_drain();
+  }
+}
+
+static LogRing *log_ring() {
+  thread_local std::shared_ptr<LogRing> ring;
+  thread_local uint32_t ring_gen = 0;
+  // the thread that forked keeps its ring in the child, a new one registers it there and starts the thread
+  if (!ring || ring_gen != s.fork_gen.load()) {
+    ring = std::make_shared<LogRing>();
+    ring_gen = s.fork_gen.load();
+    std::lock_guard lk(s.rings_lock);
+    s.rings.push_back(ring);
+    if (!s.thread_started) {
+      s.thread_started = true;
+      std::thread(log_thread).detach();
+      // a forked child starts a thread of its own
+      static std::once_flag atfork_registered;
+      std::call_once(atfork_registered, [] {
+        pthread_atfork([] { s.rings_lock.lock(); }, [] { s.rings_lock.unlock(); }, [] {
+          s.rings.clear();
+          s.thread_started = false;
+          s.fork_gen++;
+          s.rings_lock.unlock();
+        });
+      });
+    }
+  }
+  return ring.get();
+}
+
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
-  char* msg_buf = nullptr;
+  static const bool sync = getenv("SWAGLOG_SYNC") != nullptr;
   va_list args;
   va_start(args, fmt);
+
+  if (levelnum < CLOUDLOG_ERROR && !sync) {
+    LogRing *ring = log_ring();
+    const uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS) {
+      ring->dropped++;
+      va_end(args);
+      return;
+    }
+
+    LogRecord &r = ring->records[head % LOG_RING_SLOTS];
+    va_list args_copy;
+    va_copy(args_copy, args);
+    const bool captured = log_capture(r, filename, func, fmt, args_copy);
+    va_end(args_copy);
+    if (captured) {
+      r.created = seconds_since_epoch();
+      r.levelnum = levelnum;
+      r.lineno = lineno;
+      ring->head.store(head + 1, std::memory_order_release);
+      // the thread may miss it while it's about to wait, it then waits for LOG_THREAD_WAIT_MS
+      if (!s.pending.exchange(true)) s.wake_cv.notify_one();
+      va_end(args);
+      return;
+    }
+  }
+
+  char* msg_buf = nullptr;
   vasprintf(&msg_buf, fmt, args);
   va_end(args);
 
   if (!msg_buf) return;
 
-  json11::Json log_j = json11::Json::object {
-    {"msg", msg_buf},
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  std::string log_s = log_j.dump();
-  log(levelnum, filename, lineno, func, msg_buf, log_s);
+  std::lock_guard lk(s.lock);
+  // what this thread logged before goes first
+  log_drain();
+  log_send(levelnum, seconds_since_epoch(), filename, lineno, func, msg_buf);
   free(msg_buf);
 }
 
@@ -25,7 +25,7 @@ void cloudlog_bind(const char* k, const char* v);
                                                     \
   int __burst = (burst);                            \
   int __millis = (millis);                          \
-  uint64_t __ts = nanos_since_boot();               \
+  uint64_t __ts = nanos_monotonic_coarse();         \
                                                     \
   if (!__begin) __begin = __ts;                     \
                                                     \
@@ -46,6 +46,27 @@ void cloudlog_bind(const char* k, const char* v);
   }                                                 \
 }
 
+// Logs a callsite at most once per millis. The calls in between are counted, and the next call that
+// is logged says how many times it repeated. fmt has to be a string literal.
+#define cloudlog_dedup(millis, lvl, fmt, ...)                             \
+{                                                                         \
+  static uint64_t __next = 0;                                             \
+  static int __repeated = 0;                                              \
+                                                                          \
+  uint64_t __ts = nanos_monotonic_coarse();                               \
+  if (__ts < __next) {                                                    \
+    __repeated++;                                                         \
+  } else {                                                                \
+    if (__repeated) {                                                     \
+      cloudlog(lvl, fmt " (repeated %d times)", ## __VA_ARGS__, __repeated); \
+    } else {                                                              \
+      cloudlog(lvl, fmt, ## __VA_ARGS__);                                 \
+    }                                                                     \
+    __repeated = 0;                                                       \
+    __next = __ts + (millis)*1000000ULL;                                  \
+  }                                                                       \
+}
+
 #define LOGD(fmt, ...) cloudlog(CLOUDLOG_DEBUG, fmt, ## __VA_ARGS__)
 #define LOG(fmt, ...) cloudlog(CLOUDLOG_INFO, fmt, ## __VA_ARGS__)
 #define LOGW(fmt, ...) cloudlog(CLOUDLOG_WARNING, fmt, ## __VA_ARGS__)
@@ -55,3 +76,8 @@ void cloudlog_bind(const char* k, const char* v);
 #define LOG_100(fmt, ...) cloudlog_rl(2, 100, CLOUDLOG_INFO, fmt, ## __VA_ARGS__)
 #define LOGW_100(fmt, ...) cloudlog_rl(2, 100, CLOUDLOG_WARNING, fmt, ## __VA_ARGS__)
 #define LOGE_100(fmt, ...) cloudlog_rl(2, 100, CLOUDLOG_ERROR, fmt, ## __VA_ARGS__)
+
+#define LOGD_DEDUP(fmt, ...) cloudlog_dedup(1000, CLOUDLOG_DEBUG, fmt, ## __VA_ARGS__)
+#define LOG_DEDUP(fmt, ...) cloudlog_dedup(1000, CLOUDLOG_INFO, fmt, ## __VA_ARGS__)
+#define LOGW_DEDUP(fmt, ...) cloudlog_dedup(1000, CLOUDLOG_WARNING, fmt, ## __VA_ARGS__)
+#define LOGE_DEDUP(fmt, ...) cloudlog_dedup(1000, CLOUDLOG_ERROR, fmt, ## __VA_ARGS__)
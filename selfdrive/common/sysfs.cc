@@ -0,0 +1,46 @@
+#include "selfdrive/common/sysfs.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+SysfsReader::SysfsReader(const std::string &path) {
+  fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+SysfsReader::~SysfsReader() {
+  if (fd >= 0) close(fd);
+}
+
+int SysfsReader::read_buf() {
+  if (fd < 0) return -1;
+  ssize_t n;
+  do {
+    n = pread(fd, buf, sizeof(buf), 0);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+std::string SysfsReader::read() {
+  int n = read_buf();
+  if (n <= 0) return "";
+  if (buf[n - 1] == '\n') n--;
+  return std::string(buf, n);
+}
+
+bool SysfsReader::read_int(int64_t &value) {
+  const int n = read_buf();
+  int i = 0;
+  while (i < n && (buf[i] == ' ' || buf[i] == '\t')) i++;
+  const bool negative = i < n && buf[i] == '-';
+  if (negative) i++;
+  if (i >= n || buf[i] < '0' || buf[i] > '9') return false;
+
+  int64_t v = 0;
+  for (; i < n && buf[i] >= '0' && buf[i] <= '9'; i++) {
+    v = v * 10 + (buf[i] - '0');
+  }
+  value = negative ? -v : v;
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Reads a sysfs value without opening the file for every sample: the fd stays open and each read is
+// a pread from offset 0 into a fixed buffer, which sysfs answers with the current value
+class SysfsReader {
+ public:
+  explicit SysfsReader(const std::string &path);
+  ~SysfsReader();
+  SysfsReader(const SysfsReader &) = delete;
+  SysfsReader &operator=(const SysfsReader &) = delete;
+
+  bool is_open() const { return fd >= 0; }
+  // The value without its trailing newline, empty if it can't be read
+  std::string read();
+  // The integer the value starts with, false if it can't be read or doesn't start with one
+  bool read_int(int64_t &value);
+
+ private:
+  // the bytes read into buf, -1 on an error
+  int read_buf();
+
+  int fd = -1;
+  char buf[64];
+};
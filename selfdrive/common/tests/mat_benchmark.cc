@@ -0,0 +1,58 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "selfdrive/common/mat.h"
+#include "selfdrive/common/timing.h"
+
+// mat_benchmark [iterations]
+//   the projection of the 66 points of a UI line, a point at a time with matvecmul3 and a divide,
+//   then all of them with matvecmul3_project
+
+constexpr int N = 66;
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+  const mat3 m = {{
+    910.0f, 0.0f, 582.0f,
+    0.0f, 910.0f, 437.0f,
+    0.001f, 0.002f, 1.0f,
+  }};
+  float x[N], y[N], z[N];
+  for (int i = 0; i < N; i++) {
+    x[i] = 1.0f + i * 1.5f;
+    y[i] = (i % 2 ? 1.8f : -1.8f) + 0.01f * i;
+    z[i] = 1.22f;
+  }
+
+  float sx[N], sy[N], bx[N], by[N];
+  float sink = 0;
+  double t1 = millis_since_boot();
+  // z[0] changes so the loops aren't hoisted out of the iterations
+  for (int it = 0; it < iterations; it++) {
+    z[0] = 1.22f + it * 1e-9f;
+    for (int i = 0; i < N; i++) {
+      const vec3 p = matvecmul3(m, vec3{{x[i], y[i], z[i]}});
+      sx[i] = p.v[0] / p.v[2];
+      sy[i] = p.v[1] / p.v[2];
+    }
+    sink += sx[it % N];
+  }
+  double t2 = millis_since_boot();
+  for (int it = 0; it < iterations; it++) {
+    z[0] = 1.22f + it * 1e-9f;
+    matvecmul3_project(m, x, y, z, N, bx, by);
+    sink += bx[it % N];
+  }
+  double t3 = millis_since_boot();
+
+  float max_diff = 0;
+  for (int i = 0; i < N; i++) {
+    max_diff = std::fmax(max_diff, std::fmax(std::fabs(sx[i] - bx[i]), std::fabs(sy[i] - by[i])));
+  }
+  printf("matvecmul3 per point: %.1f ns a point\n", (t2 - t1) * 1e6 / iterations / N);
+  printf("matvecmul3_project:   %.1f ns a point\n", (t3 - t2) * 1e6 / iterations / N);
+  printf("max difference %g px (%g)\n", max_diff, sink);
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/common/timing.h"
+
+// queue_benchmark [count] [period_us]
+//   throughput of one producer and one consumer thread, then push to pop latency with the
+//   consumer blocked in pop, for SafeQueue, SpscQueue and MpmcQueue
+
+constexpr size_t CAPACITY = 64;
+
+static void print_stats(const char *name, std::vector<uint64_t> &samples) {
+  std::sort(samples.begin(), samples.end());
+  uint64_t sum = 0;
+  for (auto s : samples) sum += s;
+
+  auto pct = [&](double p) { return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))] / 1000.0; };
+  printf("%-24s n=%zu mean=%.1fus p50=%.1fus p99=%.1fus max=%.1fus\n", name, samples.size(),
+         sum / 1000.0 / samples.size(), pct(0.5), pct(0.99), samples.back() / 1000.0);
+}
+
+// SafeQueue is unbounded, the lock free ones return false when full
+template <class Q>
+static bool push(Q &q, uint64_t v) { return q.push(v); }
+static bool push(SafeQueue<uint64_t> &q, uint64_t v) { q.push(v); return true; }
+
+template <class Q>
+static void benchmark_throughput(const char *name, int count) {
+  Q q;
+  uint64_t sum = 0;
+  const uint64_t start = nanos_since_boot();
+  std::thread consumer([&]() {
+    for (int i = 0; i < count; i++) sum += q.pop();
+  });
+  for (int i = 0; i < count; i++) {
+    while (!push(q, i)) std::this_thread::yield();
+  }
+  consumer.join();
+  const double secs = (nanos_since_boot() - start) / 1e9;
+  printf("%-24s %.2fM elements/s\n", name, count / secs / 1e6);
+  if (sum != (uint64_t)count * (count - 1) / 2) {
+    printf("%s lost elements\n", name);
+    exit(1);
+  }
+}
+
+template <class Q>
+static void benchmark_latency(const char *name, int count, int period_us) {
+  Q q;
+  std::vector<uint64_t> latencies;
+  latencies.reserve(count);
+  std::thread consumer([&]() {
+    for (int i = 0; i < count; i++) {
+      uint64_t sent = q.pop();
+      latencies.push_back(nanos_since_boot() - sent);
+    }
+  });
+  for (int i = 0; i < count; i++) {
+    // give the consumer time to block, we want the wakeup cost not the throughput
+    std::this_thread::sleep_for(std::chrono::microseconds(period_us));
+    push(q, nanos_since_boot());
+  }
+  consumer.join();
+  print_stats(name, latencies);
+}
+
+int main(int argc, char *argv[]) {
+  const int count = argc > 1 ? atoi(argv[1]) : 10000;
+  const int period_us = argc > 2 ? atoi(argv[2]) : 200;
+
+  benchmark_throughput<SafeQueue<uint64_t>>("SafeQueue", count * 100);
+  benchmark_throughput<SpscQueue<uint64_t, CAPACITY>>("SpscQueue", count * 100);
+  benchmark_throughput<MpmcQueue<uint64_t, CAPACITY>>("MpmcQueue", count * 100);
+
+  benchmark_latency<SafeQueue<uint64_t>>("SafeQueue wakeup", count, period_us);
+  benchmark_latency<SpscQueue<uint64_t, CAPACITY>>("SpscQueue wakeup", count, period_us);
+  benchmark_latency<MpmcQueue<uint64_t, CAPACITY>>("MpmcQueue wakeup", count, period_us);
+  return 0;
+}
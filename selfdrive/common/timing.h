@@ -5,6 +5,7 @@
 
 #ifdef __APPLE__
 #define CLOCK_BOOTTIME CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
 #endif
 
 static inline uint64_t nanos_since_boot() {
@@ -37,6 +38,13 @@ static inline double seconds_since_epoch() {
   return (double)t.tv_sec + t.tv_nsec * 1e-9;
 }
 
+// cpu time of the calling thread, what a loop costs without the time it sleeps or waits
+static inline double millis_thread_cpu() {
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec * 1e-6;
+}
+
 // you probably should use nanos_since_boot instead
 static inline uint64_t nanos_monotonic() {
   struct timespec t;
@@ -44,6 +52,13 @@ static inline uint64_t nanos_monotonic() {
   return t.tv_sec * 1000000000ULL + t.tv_nsec;
 }
 
+// a few ns instead of the tens of the other clocks, with the resolution of a scheduler tick
+static inline uint64_t nanos_monotonic_coarse() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
 static inline uint64_t nanos_monotonic_raw() {
   struct timespec t;
   clock_gettime(CLOCK_MONOTONIC_RAW, &t);
@@ -0,0 +1,140 @@
+#include "selfdrive/common/trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// The ring is a header and TRACE_RING_RECORDS records of 64 bytes, the layout trace_collect.py reads.
+// Writers claim an index with a fetch_add on head and publish the record with its index + 1 in seq,
+// so the collector skips a record that's being written or was overwritten while it copied it.
+
+const uint32_t TRACE_MAGIC = 0x45435254;  // "TRCE"
+const uint32_t TRACE_RING_RECORDS = 1 << 16;
+
+enum TraceType : uint8_t {
+  TRACE_BEGIN = 1,
+  TRACE_END,
+  TRACE_COUNTER,
+  TRACE_INSTANT,
+  // the name of the thread, before its first record
+  TRACE_THREAD_NAME,
+};
+
+struct TraceHeader {
+  uint32_t magic;
+  uint32_t capacity;
+  int32_t pid;
+  uint32_t reserved;
+  std::atomic<uint64_t> head;
+  char process_name[16];
+  char padding[24];
+};
+
+struct TraceRecord {
+  std::atomic<uint64_t> seq;
+  uint64_t ts;  // nanos_monotonic_raw
+  double value;
+  uint32_t tid;
+  uint8_t type;
+  char name[TRACE_NAME_SIZE];
+};
+static_assert(sizeof(TraceHeader) == 64 && sizeof(TraceRecord) == 64);
+
+namespace trace {
+
+const bool enabled = getenv("OPENPILOT_TRACE") != nullptr;
+
+static std::atomic<TraceHeader *> ring = nullptr;
+
+static TraceHeader *open_ring() {
+  static std::mutex lock;
+  std::lock_guard lk(lock);
+  if (TraceHeader *r = ring.load()) return r;
+
+  const std::string path = "/dev/shm/trace_" + std::to_string(getpid());
+  const size_t size = sizeof(TraceHeader) + TRACE_RING_RECORDS * sizeof(TraceRecord);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) return nullptr;
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) return nullptr;
+
+  TraceHeader *r = (TraceHeader *)p;
+  r->capacity = TRACE_RING_RECORDS;
+  r->pid = getpid();
+  std::string comm = util::read_file("/proc/self/comm");
+  strncpy(r->process_name, comm.substr(0, comm.find('\n')).c_str(), sizeof(r->process_name) - 1);
+  std::atomic_thread_fence(std::memory_order_release);
+  r->magic = TRACE_MAGIC;
+
+  static std::once_flag atfork_registered;
+  std::call_once(atfork_registered, [] {
+    // a forked child writes a ring of its own
+    pthread_atfork(nullptr, nullptr, [] { ring = nullptr; });
+  });
+  ring = r;
+  return r;
+}
+
+static void put_record(TraceHeader *r, TraceType type, uint32_t tid, const char *name, double value) {
+  const uint64_t i = r->head.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord &rec = ((TraceRecord *)(r + 1))[i % r->capacity];
+  rec.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  rec.ts = nanos_monotonic_raw();
+  rec.value = value;
+  rec.tid = tid;
+  rec.type = type;
+  strncpy(rec.name, name, sizeof(rec.name) - 1);
+  rec.name[sizeof(rec.name) - 1] = '\0';
+  rec.seq.store(i + 1, std::memory_order_release);
+}
+
+static void write_record(TraceType type, const char *name, double value) {
+  TraceHeader *r = ring.load(std::memory_order_acquire);
+  if (!r && !(r = open_ring())) return;
+
+  thread_local uint32_t tid = 0;
+  thread_local TraceHeader *named_in = nullptr;
+  if (named_in != r) {
+    tid = syscall(SYS_gettid);
+    named_in = r;
+    char thread_name[16] = {};
+    pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
+    put_record(r, TRACE_THREAD_NAME, tid, thread_name, 0);
+  }
+  put_record(r, type, tid, name, value);
+}
+
+void begin(const char *name) {
+  write_record(TRACE_BEGIN, name, 0);
+}
+
+void end() {
+  write_record(TRACE_END, "", 0);
+}
+
+void counter(const char *name, double value) {
+  write_record(TRACE_COUNTER, name, value);
+}
+
+void instant(const char *name) {
+  write_record(TRACE_INSTANT, name, 0);
+}
+
+}  // namespace trace
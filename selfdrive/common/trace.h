@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// Spans and counters of the threads of a process, written into a ring in /dev/shm/trace_<pid> with
+// CLOCK_MONOTONIC_RAW timestamps, which selfdrive/debug/trace_collect.py merges into a Chrome/Perfetto
+// trace. Tracing is off unless OPENPILOT_TRACE is set, then a span or a counter is a branch on
+// trace::enabled. A name is copied into the record, truncated to TRACE_NAME_SIZE - 1 chars.
+
+#define TRACE_NAME_SIZE 35
+
+namespace trace {
+
+extern const bool enabled;
+
+void begin(const char *name);
+// of the innermost span of the thread
+void end();
+void counter(const char *name, double value);
+void instant(const char *name);
+
+class Scope {
+public:
+  explicit Scope(const char *name) : active(enabled) {
+    if (active) begin(name);
+  }
+  ~Scope() {
+    if (active) end();
+  }
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  const bool active;
+};
+
+}  // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// a span until the end of the enclosing scope
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(__trace_scope_, __LINE__)(name)
+#define TRACE_COUNTER(name, value) do { if (trace::enabled) trace::counter(name, value); } while (0)
+#define TRACE_INSTANT(name) do { if (trace::enabled) trace::instant(name); } while (0)
@@ -1,6 +1,7 @@
 #include "selfdrive/common/visionimg.h"
 
 #include <cassert>
+#include <cstring>
 
 #ifdef QCOM
 #include <gralloc_priv.h>
@@ -48,6 +49,52 @@ EGLImageTexture::~EGLImageTexture() {
   delete (private_handle_t*)private_handle;
 }
 
+YUVImageTexture::YUVImageTexture(const VisionBuf *buf) {
+  // the encoder streams of camerad, in the venus layout
+  assert(buf->nv12);
+  assert(buf->uv_offset % buf->stride == 0);
+
+  const int format = HAL_PIXEL_FORMAT_YCbCr_420_SP_VENUS;
+  private_handle = new private_handle_t(buf->fd, buf->len,
+                             private_handle_t::PRIV_FLAGS_USES_ION,
+                             0, format,
+                             buf->stride, buf->uv_offset/buf->stride,
+                             buf->width, buf->height);
+
+  GraphicBuffer* gb = new GraphicBuffer(buf->width, buf->height, (PixelFormat)format,
+                                        GraphicBuffer::USAGE_HW_TEXTURE, buf->stride, (private_handle_t*)private_handle, false);
+
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  assert(display != EGL_NO_DISPLAY);
+
+  EGLint img_attrs[] = {EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE};
+  img_khr = eglCreateImageKHR(display, EGL_NO_CONTEXT,
+                              EGL_NATIVE_BUFFER_ANDROID, gb->getNativeBuffer(), img_attrs);
+  assert(img_khr != EGL_NO_IMAGE_KHR);
+
+  glGenTextures(1, &frame_tex);
+  glBindTexture(GL_TEXTURE_EXTERNAL_OES, frame_tex);
+  glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, img_khr);
+  glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+}
+
+YUVImageTexture::~YUVImageTexture() {
+  glDeleteTextures(1, &frame_tex);
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  assert(display != EGL_NO_DISPLAY);
+  eglDestroyImageKHR(display, img_khr);
+  delete (private_handle_t*)private_handle;
+}
+
+void YUVImageTexture::upload(const VisionBuf *buf) {}
+
+void YUVImageTexture::bind() {
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_EXTERNAL_OES, frame_tex);
+}
+
 #else // ifdef QCOM
 
 EGLImageTexture::EGLImageTexture(const VisionBuf *buf) {
@@ -60,4 +107,82 @@ EGLImageTexture::EGLImageTexture(const VisionBuf *buf) {
 EGLImageTexture::~EGLImageTexture() {
   glDeleteTextures(1, &frame_tex);
 }
+
+static GLuint create_plane(GLenum internal_format, GLenum format, int width, int height) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return tex;
+}
+
+YUVImageTexture::YUVImageTexture(const VisionBuf *buf) {
+  y_tex = create_plane(GL_R8, GL_RED, buf->width, buf->height);
+  if (buf->nv12) {
+    u_tex = create_plane(GL_RG8, GL_RG, buf->width / 2, buf->height / 2);
+  } else {
+    u_tex = create_plane(GL_R8, GL_RED, buf->width / 2, buf->height / 2);
+    v_tex = create_plane(GL_R8, GL_RED, buf->width / 2, buf->height / 2);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  pbo_len = buf->len;
+  glGenBuffers(1, &pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo_len, nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+YUVImageTexture::~YUVImageTexture() {
+  glDeleteTextures(1, &y_tex);
+  glDeleteTextures(1, &u_tex);
+  if (v_tex) glDeleteTextures(1, &v_tex);
+  glDeleteBuffers(1, &pbo);
+}
+
+void YUVImageTexture::upload(const VisionBuf *buf) {
+  assert(buf->len == pbo_len);
+
+  // orphaned first, so the copy doesn't wait for the GPU to finish reading the previous frame
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo_len, nullptr, GL_STREAM_DRAW);
+  void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, pbo_len, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  assert(dst != nullptr);
+  memcpy(dst, buf->addr, pbo_len);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  // offsets into the pixel buffer, row lengths in pixels of the format
+  auto sub_image = [&](GLuint tex, GLenum format, int width, int height, int row_length, const uint8_t *plane) {
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE,
+                    (const void *)(plane - (const uint8_t *)buf->addr));
+  };
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (buf->nv12) {
+    sub_image(y_tex, GL_RED, buf->width, buf->height, buf->stride, buf->y);
+    sub_image(u_tex, GL_RG, buf->width / 2, buf->height / 2, buf->stride / 2, buf->u);
+  } else {
+    sub_image(y_tex, GL_RED, buf->width, buf->height, buf->width, buf->y);
+    sub_image(u_tex, GL_RED, buf->width / 2, buf->height / 2, buf->width / 2, buf->u);
+    sub_image(v_tex, GL_RED, buf->width / 2, buf->height / 2, buf->width / 2, buf->v);
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void YUVImageTexture::bind() {
+  GLuint planes[] = {y_tex, u_tex, v_tex};
+  for (int i = 0; i < 3 && planes[i]; i++) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, planes[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
 #endif // ifdef QCOM
@@ -25,3 +25,25 @@ class EGLImageTexture {
   EGLImageKHR img_khr = 0;
 #endif
 };
+
+// An I420 or NV12 buffer for sampling with a yuv fragment shader. On QCOM the NV12 buffer is imported
+// as one external image, the GPU converts it to rgb when sampling. Elsewhere the planes are R8 textures,
+// the uv plane of NV12 an RG8 one, and upload() copies a frame into them through a pixel buffer.
+class YUVImageTexture {
+ public:
+  YUVImageTexture(const VisionBuf *buf);
+  ~YUVImageTexture();
+  // nothing to do for an imported buffer
+  void upload(const VisionBuf *buf);
+  // to GL_TEXTURE0 and up, y, u and v or y and uv
+  void bind();
+#ifdef QCOM
+  GLuint frame_tex = 0;  // GL_TEXTURE_EXTERNAL_OES
+  void *private_handle = nullptr;
+  EGLImageKHR img_khr = 0;
+#else
+  GLuint y_tex = 0, u_tex = 0, v_tex = 0;  // u_tex has the uv plane of NV12, no v_tex
+  GLuint pbo = 0;
+  size_t pbo_len = 0;
+#endif
+};
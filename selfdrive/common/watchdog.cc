@@ -1,19 +1,73 @@
 #include "selfdrive/common/watchdog.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <cerrno>
 #include <cstdint>
-#include <string>
+#include <mutex>
 
 #include "selfdrive/common/timing.h"
-#include "selfdrive/common/util.h"
 
-const std::string watchdog_fn_prefix = "/dev/shm/wd_";  // + <pid>
+// The kicks go to a table in /dev/shm, a slot per process that manager reads in one pass. A
+// process claims a free slot, or the one of a process that exited, on its first kick, and every
+// kick after that is a store of the time to it.
+
+const char *watchdog_table_path = "/dev/shm/watchdog";
+const int WATCHDOG_SLOTS = 64;
+
+struct WatchdogSlot {
+  std::atomic<int32_t> pid;
+  uint32_t reserved;
+  std::atomic<uint64_t> kick_time;  // nanos_since_boot
+};
+static_assert(sizeof(WatchdogSlot) == 16 && std::atomic<uint64_t>::is_always_lock_free);
+
+static std::atomic<WatchdogSlot *> watchdog_slot = nullptr;
+
+static WatchdogSlot *claim_slot() {
+  static std::mutex lock;
+  static WatchdogSlot *table = nullptr;
+  std::lock_guard lk(lock);
+  if (WatchdogSlot *slot = watchdog_slot.load()) return slot;
+
+  if (!table) {
+    int fd = open(watchdog_table_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) return nullptr;
+    const size_t size = WATCHDOG_SLOTS * sizeof(WatchdogSlot);
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+      p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    table = (WatchdogSlot *)p;
+
+    // a forked child claims a slot of its own
+    pthread_atfork(nullptr, nullptr, [] { watchdog_slot = nullptr; });
+  }
+
+  const int32_t pid = getpid();
+  for (int i = 0; i < WATCHDOG_SLOTS; i++) {
+    WatchdogSlot &slot = table[i];
+    int32_t owner = slot.pid.load();
+    const bool free = owner == 0 || owner == pid || (kill(owner, 0) != 0 && errno == ESRCH);
+    if (free && (owner == pid || slot.pid.compare_exchange_strong(owner, pid))) {
+      watchdog_slot = &slot;
+      return &slot;
+    }
+  }
+  return nullptr;
+}
 
 bool watchdog_kick() {
-  std::string fn = watchdog_fn_prefix + std::to_string(getpid());
-  std::string cur_t = std::to_string(nanos_since_boot());
+  WatchdogSlot *slot = watchdog_slot.load(std::memory_order_relaxed);
+  if (!slot && !(slot = claim_slot())) return false;
 
-  int r = util::write_file(fn.c_str(), cur_t.data(), cur_t.length(), O_WRONLY | O_CREAT);
-  return r == 0;
+  slot->kick_time.store(nanos_since_boot(), std::memory_order_relaxed);
+  return true;
 }
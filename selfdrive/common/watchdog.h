@@ -1,3 +1,4 @@
 #pragma once
 
+// a few ns after the first kick of a process, false if there's no slot for it
 bool watchdog_kick();
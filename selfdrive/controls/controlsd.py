@@ -10,7 +10,7 @@ import cereal.messaging as messaging
 from selfdrive.config import Conversions as CV
 from selfdrive.swaglog import cloudlog
 from selfdrive.boardd.boardd import can_list_to_can_capnp
-from selfdrive.car.car_helpers import get_car, get_startup_event, get_one_can
+from selfdrive.car.car_helpers import get_car, get_startup_event, get_one_can, can_rx_filter
 from selfdrive.controls.lib.lane_planner import CAMERA_OFFSET, CAMERA_OFFSET_A
 from selfdrive.controls.lib.drive_helpers import update_v_cruise, initialize_v_cruise
 from selfdrive.controls.lib.drive_helpers import get_lag_adjusted_curvature
@@ -84,7 +84,7 @@ class Controls:
       self.can_sock = messaging.sub_sock('can', timeout=can_timeout)
 
     if TICI:
-      self.log_sock = messaging.sub_sock('androidLog')
+      self.log_sock = messaging.sub_sock('androidLogs')
 
     # wait for one pandaState and one CAN packet
     print("Waiting for CAN messages...")
@@ -116,6 +116,13 @@ class Controls:
     if self.read_only:
       self.CP.safetyModel = car.CarParams.SafetyModel.noOutput
 
+    # the CAN boardd passes on, before CarParams for it. CanLogAll keeps all of it, e.g. for the rlogs
+    rx_filter = None if params.get_bool("CanLogAll") else can_rx_filter(self.CI, self.CP)
+    if rx_filter:
+      params.put("CanRxFilter", rx_filter)
+    else:
+      params.delete("CanRxFilter")
+
     # Write CarParams for radard
     cp_bytes = self.CP.to_bytes()
     params.put("CarParams", cp_bytes)
@@ -328,10 +335,11 @@ class Controls:
       logs = messaging.drain_sock(self.log_sock, wait_for_one=False)
       messages = []
       for m in logs:
-        try:
-          messages.append(m.androidLog.message)
-        except UnicodeDecodeError:
-          pass
+        for entry in m.androidLogs:
+          try:
+            messages.append(entry.message)
+          except UnicodeDecodeError:
+            pass
 
       for err in ["ERROR_CRC", "ERROR_ECC", "ERROR_STREAM_UNDERFLOW", "APPLY FAILED"]:
         for m in messages:
@@ -0,0 +1,62 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "fastcluster.h"
+#include "grid_cluster.h"
+}
+
+// Time per frame of cluster_points_centroid and of the grid clustering, on radar like frames
+// of tracks around a few objects that move a bit from frame to frame
+int main(int argc, const char* argv[]) {
+  const int m = 3, frames = 2000;
+  printf("tracks  centroid us  grid us\n");
+  for (int ntracks : {4, 8, 16, 32, 48, 64}) {
+    std::mt19937 gen(ntracks);
+    std::normal_distribution<double> noise(0., 1.);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+
+    // the frames up front, the same for both
+    std::vector<double> objects, pts(frames * ntracks * m);
+    for (int o = 0; o < ntracks / 3 + 1; o++) {
+      objects.insert(objects.end(), {5. + 150. * uniform(gen), 20. * (uniform(gen) - 0.5), 20. * (uniform(gen) - 0.5)});
+    }
+    std::vector<int> object_of(ntracks);
+    for (int i = 0; i < ntracks; i++) object_of[i] = gen() % (objects.size() / m);
+    std::vector<double> offset(ntracks * m);
+    for (double &o : offset) o = 1.5 * noise(gen);
+    for (int f = 0; f < frames; f++) {
+      for (int o = 0; o < objects.size(); o += m) objects[o] += 0.05 * objects[o + 2];
+      for (int i = 0; i < ntracks; i++) {
+        for (int k = 0; k < m; k++) {
+          offset[i * m + k] += 0.02 * noise(gen);
+          pts[(f * ntracks + i) * m + k] = objects[object_of[i] * m + k] + offset[i * m + k];
+        }
+      }
+    }
+    std::vector<int64_t> ids(ntracks);
+    for (int i = 0; i < ntracks; i++) ids[i] = i;
+    std::vector<int> idx(ntracks);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) {
+      cluster_points_centroid(ntracks, m, &pts[f * ntracks * m], 2.5 * 2.5, idx.data());
+    }
+    auto centroid = std::chrono::steady_clock::now() - start;
+
+    void *gc = grid_cluster_create(2.5);
+    start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) {
+      grid_cluster_points(gc, ntracks, m, &pts[f * ntracks * m], ids.data(), idx.data());
+    }
+    auto grid = std::chrono::steady_clock::now() - start;
+    grid_cluster_destroy(gc);
+
+    printf("%6d  %11.2f  %7.2f\n", ntracks,
+           std::chrono::duration<double, std::micro>(centroid).count() / frames,
+           std::chrono::duration<double, std::micro>(grid).count() / frames);
+  }
+}
@@ -13,6 +13,9 @@ int hclust_fast(int n, double* distmat, int method, int* merge, double* height);
 void cutree_cdist(int n, const int* merge, double* height, double cdist, int* labels);
 void hclust_pdist(int n, int m, double* pts, double* out);
 void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx);
+void *grid_cluster_create(double dist);
+void grid_cluster_destroy(void *c);
+void grid_cluster_points(void *c, int n, int m, const double *pts, const int64_t *ids, int *idx);
 """)
 
 hclust = ffi.dlopen(cluster_fn)
@@ -26,3 +29,20 @@ def cluster_points_centroid(pts, dist):
   labels_ptr = ffi.new("int[]", n)
   hclust.cluster_points_centroid(n, m, pts_ptr, dist**2, labels_ptr)
   return list(labels_ptr)
+
+
+class GridCluster():
+  """The labels of cluster_points_centroid, reusing the clusters of the points of the last call
+  that kept their ids. Also fine with a single point."""
+  def __init__(self, dist):
+    self.c = ffi.gc(hclust.grid_cluster_create(dist), hclust.grid_cluster_destroy)
+
+  def cluster(self, pts, ids):
+    pts = np.ascontiguousarray(pts, dtype=np.float64)
+    ids = np.ascontiguousarray(ids, dtype=np.int64)
+    n, m = pts.shape
+
+    labels_ptr = ffi.new("int[]", n)
+    hclust.grid_cluster_points(self.c, n, m, ffi.cast("double *", pts.ctypes.data),
+                               ffi.cast("int64_t *", ids.ctypes.data), labels_ptr)
+    return list(labels_ptr)
@@ -0,0 +1,367 @@
+//
+// Threshold centroid clustering over a grid, see grid_cluster.h
+//
+// cluster_points_centroid merges the closest pair of clusters while their centroids are closer
+// than the cut. The components of the points closer than the cut are clustered on their own with
+// the same merges, as long as no cluster formed in one component is closer than the cut to a cluster
+// of another one: then the closest pair is always in a component, and the merges are the ones of
+// the whole set. Every centroid moves at most as far as the farthest of its points, so the merges of
+// a component stay the same while the points move less than half of the margin of its merges, the
+// gap to the next closest pair and the distance of the pairs to the cut, apart from their mean move.
+// Components with clusters closer than the cut across them are joined and linked again.
+//
+// The grid is along the first dim, the distance for the radar: the points are sorted by their cells
+// and only the points of the same and the next cell are compared.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <vector>
+
+extern "C" {
+#include "grid_cluster.h"
+}
+
+namespace {
+
+// the cross check is a bit wider than the cut, the merge heights of hclust come from its updates of the distances
+const double CROSS_CHECK_SCALE = 1.0 + 1e-9;
+
+double dist2_of(const double *a, const double *b, int m) {
+  double d = 0;
+  for (int k = 0; k < m; k++) {
+    const double error = a[k] - b[k];
+    d += error * error;
+  }
+  return d;
+}
+
+class GridCluster {
+public:
+  GridCluster(double dist) : dist(dist), dist2(dist * dist) {}
+  void cluster(int n, int m, const double *pts, const int64_t *ids, int *idx);
+
+  int reused = 0, linked = 0, joined = 0;
+
+private:
+  struct Component {
+    int begin, size;            // of the members
+    int nodes_begin, nodes_end;
+    double margin;
+  };
+
+  // The components of a call, with their members in the order of the ids. Flat and kept
+  // from call to call, the two states of the last and the current call are swapped
+  struct State {
+    std::vector<Component> comps;
+    std::vector<int64_t> ids;
+    std::vector<double> pts;     // of the members, when their component was linked
+    std::vector<int> labels;     // of the members, the cluster as the slot of a member
+    std::vector<int> index;      // of the members, in the points of the call
+    std::vector<std::pair<int, int>> nodes;  // the clusters formed by the merges, in node_members
+    std::vector<int> node_members;           // slots of the members
+    std::vector<std::pair<int64_t, int>> by_id;  // the smallest id of the components, sorted
+
+    void clear() {
+      comps.clear(); ids.clear(); pts.clear(); labels.clear(); index.clear();
+      nodes.clear(); node_members.clear(); by_id.clear();
+    }
+  };
+
+  // calls f(i, j) for the pairs of the points closer than d
+  template <class F>
+  void near_pairs(int n, int m, const double *pts, double d, F f);
+  void link(Component &c, int m);
+  bool reuse(Component &c, int m);
+  void build(int n, int m, const double *pts, const int64_t *ids, bool first);
+  bool join_crossed(int m, const double *pts);
+  int find(int i) {
+    while (parent[i] != i) i = parent[i] = parent[parent[i]];
+    return i;
+  }
+
+  const double dist, dist2;
+  State cur, prev;
+  std::vector<std::pair<double, int>> cells;
+  std::vector<int> parent, order, label;
+  std::vector<double> dm, centroids, shift;
+  std::vector<int> sizes, active, owner;
+  std::vector<std::tuple<double, double, int>> extents;
+  std::vector<bool> near;
+};
+
+template <class F>
+void GridCluster::near_pairs(int n, int m, const double *pts, double d, F f) {
+  cells.resize(n);
+  for (int i = 0; i < n; i++) cells[i] = {std::floor(pts[i * m] / d), i};
+  std::sort(cells.begin(), cells.end());
+
+  const double d2 = d * d;
+  for (int a = 0; a < n; a++) {
+    const int i = cells[a].second;
+    for (int b = a + 1; b < n && cells[b].first <= cells[a].first + 1; b++) {
+      const int j = cells[b].second;
+      if (dist2_of(&pts[i * m], &pts[j * m], m) < d2) f(i, j);
+    }
+  }
+}
+
+// Centroid linkage of the members of a component, the merges of hclust_fast with HCLUST_METHOD_CENTROID
+// until the first one at the cut, as in cutree_cdist
+void GridCluster::link(Component &c, int m) {
+  const int k = c.size;
+  const double *pts = &cur.pts[c.begin * m];
+  int *labels = &cur.labels[c.begin];
+
+  // the squared distances of the clusters, updated as in hclust
+  dm.resize(k * k);
+  for (int a = 0; a < k; a++) {
+    for (int b = a + 1; b < k; b++) dm[a * k + b] = dm[b * k + a] = dist2_of(&pts[a * m], &pts[b * m], m);
+  }
+  sizes.assign(k, 1);
+  active.resize(k);
+  std::iota(active.begin(), active.end(), 0);
+  std::iota(labels, labels + k, 0);
+  c.nodes_begin = cur.nodes.size();
+  c.margin = std::numeric_limits<double>::infinity();
+
+  while (active.size() > 1) {
+    double best = std::numeric_limits<double>::infinity(), second = best;
+    int ba = 0, bb = 0;
+    for (int a = 0; a < active.size(); a++) {
+      for (int b = a + 1; b < active.size(); b++) {
+        const double d = dm[active[a] * k + active[b]];
+        if (d < best) {
+          second = best;
+          best = d;
+          ba = a;
+          bb = b;
+        } else if (d < second) {
+          second = d;
+        }
+      }
+    }
+
+    const double best_dist = std::sqrt(best);
+    c.margin = std::min(c.margin, std::abs(best_dist - dist));
+    if (best >= dist2) break;
+    c.margin = std::min(c.margin, (std::sqrt(second) - best_dist) / 2);
+
+    const int x = active[ba], y = active[bb];
+    const double nx = sizes[x], ny = sizes[y], nxy = nx + ny;
+    for (int z : active) {
+      if (z == x || z == y) continue;
+      dm[x * k + z] = dm[z * k + x] = (nx * dm[x * k + z] + ny * dm[y * k + z]) / nxy - nx * ny * best / (nxy * nxy);
+    }
+    sizes[x] += sizes[y];
+    active.erase(active.begin() + bb);
+
+    const int node_begin = cur.node_members.size();
+    for (int l = 0; l < k; l++) {
+      if (labels[l] == y) labels[l] = x;
+      if (labels[l] == x) cur.node_members.push_back(l);
+    }
+    cur.nodes.push_back({node_begin, (int)cur.node_members.size() - node_begin});
+  }
+  c.nodes_end = cur.nodes.size();
+}
+
+// Takes the clusters of the component from the last state, if the same ids moved less than the margin
+bool GridCluster::reuse(Component &c, int m) {
+  auto it = std::lower_bound(prev.by_id.begin(), prev.by_id.end(), std::make_pair(cur.ids[c.begin], -1));
+  if (it == prev.by_id.end() || it->first != cur.ids[c.begin]) return false;
+  const Component &p = prev.comps[it->second];
+  if (p.size != c.size || !std::equal(&cur.ids[c.begin], &cur.ids[c.begin] + c.size, &prev.ids[p.begin])) return false;
+
+  // the distances of the clusters don't change with the mean move of the members, as for an object of the radar
+  shift.assign(m, 0.);
+  for (int l = 0; l < c.size; l++) {
+    for (int k = 0; k < m; k++) shift[k] += (cur.pts[(c.begin + l) * m + k] - prev.pts[(p.begin + l) * m + k]) / c.size;
+  }
+  double moved = 0;
+  for (int l = 0; l < c.size; l++) {
+    double d = 0;
+    for (int k = 0; k < m; k++) {
+      const double error = cur.pts[(c.begin + l) * m + k] - prev.pts[(p.begin + l) * m + k] - shift[k];
+      d += error * error;
+    }
+    moved = std::max(moved, d);
+  }
+  if (!(2 * std::sqrt(moved) < p.margin)) return false;
+
+  // the points of the linkage stay, the margin is from them
+  std::copy(&prev.pts[p.begin * m], &prev.pts[(p.begin + p.size) * m], &cur.pts[c.begin * m]);
+  std::copy(&prev.labels[p.begin], &prev.labels[p.begin + p.size], &cur.labels[c.begin]);
+  c.nodes_begin = cur.nodes.size();
+  for (int i = p.nodes_begin; i < p.nodes_end; i++) {
+    const auto [begin, size] = prev.nodes[i];
+    cur.nodes.push_back({(int)cur.node_members.size(), size});
+    cur.node_members.insert(cur.node_members.end(), &prev.node_members[begin], &prev.node_members[begin + size]);
+  }
+  c.nodes_end = cur.nodes.size();
+  c.margin = p.margin;
+  return true;
+}
+
+// The components of the union find of parent, linked or reused from the last state
+void GridCluster::build(int n, int m, const double *pts, const int64_t *ids, bool first) {
+  order.resize(n);
+  std::iota(order.begin(), order.end(), 0);
+  for (int i = 0; i < n; i++) find(i);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return parent[a] != parent[b] ? parent[a] < parent[b] : ids[a] < ids[b];
+  });
+
+  cur.clear();
+  for (int i : order) {
+    cur.index.push_back(i);
+    cur.ids.push_back(ids[i]);
+    cur.pts.insert(cur.pts.end(), &pts[i * m], &pts[(i + 1) * m]);
+  }
+  cur.labels.resize(n);
+
+  for (int a = 0; a < n;) {
+    int b = a;
+    while (b < n && parent[order[b]] == parent[order[a]]) b++;
+
+    Component c = {a, b - a};
+    if (c.size == 1) {
+      cur.labels[a] = 0;
+      c.nodes_begin = c.nodes_end = cur.nodes.size();
+      c.margin = std::numeric_limits<double>::infinity();
+    } else if (reuse(c, m)) {
+      reused += first;
+    } else {
+      link(c, m);
+      linked++;
+    }
+    cur.by_id.push_back({cur.ids[a], (int)cur.comps.size()});
+    cur.comps.push_back(c);
+    a = b;
+  }
+  std::sort(cur.by_id.begin(), cur.by_id.end());
+}
+
+// Joins the components with clusters closer than the cut across them, singletons and merged
+bool GridCluster::join_crossed(int m, const double *pts) {
+  if (cur.comps.size() < 2) return false;
+
+  // the centroids are within the extent of their members, only the components with extents
+  // closer than the cut along the first dim are checked
+  extents.clear();
+  for (int ci = 0; ci < cur.comps.size(); ci++) {
+    const Component &c = cur.comps[ci];
+    double lo = std::numeric_limits<double>::infinity(), hi = -lo;
+    for (int l = c.begin; l < c.begin + c.size; l++) {
+      lo = std::min(lo, pts[cur.index[l] * m]);
+      hi = std::max(hi, pts[cur.index[l] * m]);
+    }
+    extents.push_back({lo, hi, ci});
+  }
+  std::sort(extents.begin(), extents.end());
+
+  // groups of extents that overlap, a group of singletons has no clusters closer than the cut
+  near.assign(cur.comps.size(), false);
+  for (int a = 0; a < extents.size();) {
+    double reach = std::get<1>(extents[a]);
+    bool merged = false;
+    int b = a;
+    for (; b < extents.size() && (b == a || std::get<0>(extents[b]) - reach < dist * CROSS_CHECK_SCALE); b++) {
+      reach = std::max(reach, std::get<1>(extents[b]));
+      merged = merged || cur.comps[std::get<2>(extents[b])].size > 1;
+    }
+    for (int l = a; l < b && merged && b - a > 1; l++) near[std::get<2>(extents[l])] = true;
+    a = b;
+  }
+
+  centroids.clear();
+  owner.clear();
+  for (int ci = 0; ci < cur.comps.size(); ci++) {
+    if (!near[ci]) continue;
+    const Component &c = cur.comps[ci];
+    for (int l = 0; l < c.size; l++) {
+      centroids.insert(centroids.end(), &pts[cur.index[c.begin + l] * m], &pts[(cur.index[c.begin + l] + 1) * m]);
+      owner.push_back(ci);
+    }
+    for (int i = c.nodes_begin; i < c.nodes_end; i++) {
+      const auto [begin, size] = cur.nodes[i];
+      const size_t base = centroids.size();
+      centroids.resize(base + m, 0.);
+      for (int l = begin; l < begin + size; l++) {
+        const double *p = &pts[cur.index[c.begin + cur.node_members[l]] * m];
+        for (int k = 0; k < m; k++) centroids[base + k] += p[k];
+      }
+      for (int k = 0; k < m; k++) centroids[base + k] /= size;
+      owner.push_back(ci);
+    }
+  }
+
+  bool crossed = false;
+  near_pairs(owner.size(), m, centroids.data(), dist * CROSS_CHECK_SCALE, [&](int i, int j) {
+    if (owner[i] != owner[j]) {
+      parent[find(cur.index[cur.comps[owner[i]].begin])] = find(cur.index[cur.comps[owner[j]].begin]);
+      crossed = true;
+    }
+  });
+  return crossed;
+}
+
+void GridCluster::cluster(int n, int m, const double *pts, const int64_t *ids, int *idx) {
+  if (n <= 0) return;
+
+  parent.resize(n);
+  std::iota(parent.begin(), parent.end(), 0);
+  near_pairs(n, m, pts, dist, [&](int i, int j) { parent[find(i)] = find(j); });
+
+  // every join makes fewer components, until there is a single one. The components of the
+  // calls before are in prev, the ones of a join are linked again from the current state
+  std::swap(prev, cur);
+  build(n, m, pts, ids, true);
+  while (join_crossed(m, pts)) {
+    joined++;
+    std::swap(prev, cur);
+    build(n, m, pts, ids, false);
+  }
+
+  // labels in the order of first appearance, as cutree_k
+  label.assign(n, -1);
+  for (const Component &c : cur.comps) {
+    for (int l = c.begin; l < c.begin + c.size; l++) {
+      idx[cur.index[l]] = c.begin + cur.labels[l];
+    }
+  }
+  int next_label = 0;
+  for (int i = 0; i < n; i++) {
+    int &l = label[idx[i]];
+    if (l < 0) l = next_label++;
+    idx[i] = l;
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+void *grid_cluster_create(double dist) {
+  return new GridCluster(dist);
+}
+
+void grid_cluster_destroy(void *c) {
+  delete (GridCluster *)c;
+}
+
+void grid_cluster_points(void *c, int n, int m, const double *pts, const int64_t *ids, int *idx) {
+  ((GridCluster *)c)->cluster(n, m, pts, ids, idx);
+}
+
+void grid_cluster_stats(void *c, int *reused, int *linked, int *joined) {
+  GridCluster *gc = (GridCluster *)c;
+  *reused = gc->reused;
+  *linked = gc->linked;
+  *joined = gc->joined;
+}
+
+}
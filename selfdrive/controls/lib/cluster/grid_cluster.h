@@ -0,0 +1,35 @@
+#ifndef grid_cluster_H
+#define grid_cluster_H
+
+#include <stdint.h>
+
+//
+// Threshold clustering with the result of cluster_points_centroid, for the radar tracks of every frame
+//
+// The points are bucketed in a grid of cells of size dist, the points closer than dist are joined
+// in components and the centroid linkage runs on every component on its own. A component with the
+// same ids as in the previous call, whose points moved less than the margin of its merges, reuses
+// the clusters of the previous call. Components with clusters that could merge across them are
+// joined, the labels are always the ones of cluster_points_centroid.
+//
+// Input arguments:
+//   dist   = cutoff cluster distance, not squared
+//   n      = number of observables
+//   m      = dimension of observable
+//   pts    = n*m array of the observables
+//   ids    = n ids of the observables, that identify them across calls
+// Output arguments:
+//   idx    = allocated integer array of size n for the labels (0, ..., nclust-1)
+//
+void *grid_cluster_create(double dist);
+void grid_cluster_destroy(void *c);
+void grid_cluster_points(void *c, int n, int m, const double *pts, const int64_t *ids, int *idx);
+
+//
+// Counts of the components of the calls: reused from the previous call, linked, and
+// joined for clusters closer than the cut across them
+//
+void grid_cluster_stats(void *c, int *reused, int *linked, int *joined);
+
+
+#endif
@@ -0,0 +1,298 @@
+//
+// The radar tracking of radard, see radar_tracker.h
+//
+// Follows radard.RadarD.update and radar_helpers: the tracks are the points of the last radarData,
+// their kalman filters are updated on the lead speed with the v_ego of the radar delay, the new tracks
+// take the accel of their cluster, and the leads are the clusters matched to the leads of the model.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <numeric>
+#include <vector>
+
+#include "selfdrive/common/filter_bank.h"
+
+extern "C" {
+#include "grid_cluster.h"
+#include "radar_tracker.h"
+}
+
+namespace {
+
+// of radar_helpers
+const double LEAD_ACCEL_TAU = 1.5;
+const double V_EGO_STATIONARY = 4.;
+// of radard
+const double CLUSTER_DIST = 2.5;
+
+// A = [[1, dt], [0, 1]] and C = [1, 0] of radard.KalmanParams
+KF1DBank lead_filter(double dt, double k0, double k1) {
+  const double A[4] = {1., dt, 0., 1.}, C[2] = {1., 0.}, K[2] = {k0, k1};
+  return KF1DBank(A, C, K);
+}
+
+double laplacian_cdf(double x, double mu, double b) {
+  b = std::max(b, 1e-4);
+  return std::exp(-std::abs(x - mu) / b);
+}
+
+class RadarTracker {
+public:
+  RadarTracker(double dt, double k0, double k1, int delay, double radar_to_camera);
+  ~RadarTracker() { grid_cluster_destroy(clusterer); }
+
+  void update_ego(double v);
+  int update(int n, const int64_t *ids, const double *d_rel, const double *y_rel, const double *v_rel, const int *measured);
+  void get_lead(const radar_vision_lead &lead, bool ready, bool low_speed_override, radar_lead &out) const;
+  int tracks(int max_tracks, int64_t *ids, double *d_rel, double *y_rel, double *v_rel) const;
+
+private:
+  // The tracks sorted by id, an array of every value. The state of the filters is the lead speed
+  // and accel, vLeadK and aLeadK of radar_helpers.Track
+  struct Tracks {
+    std::vector<int64_t> id;
+    std::vector<double> d_rel, y_rel, v_rel, v_lead, v_lead_k, a_lead_k, a_lead_tau;
+    std::vector<int> measured, cnt;
+
+    void resize(int n) {
+      id.resize(n); d_rel.resize(n); y_rel.resize(n); v_rel.resize(n); v_lead.resize(n);
+      v_lead_k.resize(n); a_lead_k.resize(n); a_lead_tau.resize(n); measured.resize(n); cnt.resize(n);
+    }
+  };
+
+  // The means of the tracks of a cluster, radar_helpers.Cluster
+  struct Cluster {
+    double d_rel, y_rel, v_rel, v_lead, v_lead_k, a_lead_k, a_lead_tau;
+    int size, filtered;  // the tracks, and the ones with two updates of their filters
+  };
+
+  const Cluster *match_vision(const radar_vision_lead &lead) const;
+  void cluster_lead(const Cluster &c, double model_prob, radar_lead &out) const;
+
+  const KF1DBank kf;
+  const int delay;
+  const double radar_to_camera;
+
+  double v_ego = 0;
+  std::deque<double> v_ego_hist = {0.};
+
+  Tracks cur, next;
+  std::vector<Cluster> clusters;
+  std::vector<int> order, labels;
+  std::vector<double> pts;
+  void *clusterer;
+};
+
+RadarTracker::RadarTracker(double dt, double k0, double k1, int delay, double radar_to_camera)
+    : kf(lead_filter(dt, k0, k1)), delay(delay), radar_to_camera(radar_to_camera) {
+  clusterer = grid_cluster_create(CLUSTER_DIST);
+}
+
+void RadarTracker::update_ego(double v) {
+  v_ego = v;
+  v_ego_hist.push_back(v);
+  if (v_ego_hist.size() > delay + 1) v_ego_hist.pop_front();
+}
+
+int RadarTracker::update(int n, const int64_t *ids, const double *d_rel, const double *y_rel, const double *v_rel, const int *measured) {
+  // the points by id, the last one of an id
+  order.resize(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return ids[a] < ids[b]; });
+  int unique = 0;
+  for (int a = 0; a < n; a++) {
+    if (a + 1 < n && ids[order[a + 1]] == ids[order[a]]) continue;
+    order[unique++] = order[a];
+  }
+
+  // the tracks of the points, the state of the filters from the tracks of the same ids
+  const double v_ego_delayed = v_ego_hist.front();
+  next.resize(unique);
+  for (int a = 0, t = 0; a < unique; a++) {
+    const int i = order[a];
+    while (t < cur.id.size() && cur.id[t] < ids[i]) t++;
+
+    next.id[a] = ids[i];
+    next.d_rel[a] = d_rel[i];
+    next.y_rel[a] = y_rel[i];
+    next.v_rel[a] = v_rel[i];
+    next.v_lead[a] = v_rel[i] + v_ego_delayed;
+    next.measured[a] = measured[i];
+    if (t < cur.id.size() && cur.id[t] == ids[i]) {
+      next.v_lead_k[a] = cur.v_lead_k[t];
+      next.a_lead_k[a] = cur.a_lead_k[t];
+      next.a_lead_tau[a] = cur.a_lead_tau[t];
+      next.cnt[a] = cur.cnt[t];
+    } else {
+      next.v_lead_k[a] = next.v_lead[a];
+      next.a_lead_k[a] = 0.;
+      next.a_lead_tau[a] = LEAD_ACCEL_TAU;
+      next.cnt[a] = 0;
+    }
+  }
+  std::swap(cur, next);
+
+  // the filters, from the second update of a track
+  kf.update(unique, cur.v_lead_k.data(), cur.a_lead_k.data(), cur.v_lead.data(), cur.cnt.data());
+  for (int a = 0; a < unique; a++) {
+    // learn if constant acceleration
+    cur.a_lead_tau[a] = std::abs(cur.a_lead_k[a]) < 0.5 ? LEAD_ACCEL_TAU : cur.a_lead_tau[a] * 0.9;
+    cur.cnt[a]++;
+  }
+
+  // weigh y higher since radar is inaccurate in this dimension
+  pts.resize(unique * 3);
+  labels.resize(unique);
+  for (int a = 0; a < unique; a++) {
+    pts[a * 3] = cur.d_rel[a];
+    pts[a * 3 + 1] = cur.y_rel[a] * 2;
+    pts[a * 3 + 2] = cur.v_rel[a];
+  }
+  grid_cluster_points(clusterer, unique, 3, pts.data(), cur.id.data(), labels.data());
+
+  const int nclusters = unique > 0 ? *std::max_element(labels.begin(), labels.end()) + 1 : 0;
+  clusters.assign(nclusters, Cluster{});
+  for (int a = 0; a < unique; a++) {
+    Cluster &c = clusters[labels[a]];
+    c.size++;
+    if (cur.cnt[a] > 1) {
+      c.filtered++;
+      c.a_lead_k += cur.a_lead_k[a];
+      c.a_lead_tau += cur.a_lead_tau[a];
+    }
+  }
+  for (Cluster &c : clusters) {
+    c.a_lead_k = c.filtered > 0 ? c.a_lead_k / c.filtered : 0.;
+    c.a_lead_tau = c.filtered > 0 ? c.a_lead_tau / c.filtered : LEAD_ACCEL_TAU;
+  }
+
+  // a new track takes the accel of its cluster
+  for (int a = 0; a < unique; a++) {
+    if (cur.cnt[a] <= 1) {
+      const Cluster &c = clusters[labels[a]];
+      cur.v_lead_k[a] = cur.v_lead[a];
+      cur.a_lead_k[a] = c.a_lead_k;
+      cur.a_lead_tau[a] = c.a_lead_tau;
+    }
+  }
+
+  for (int a = 0; a < unique; a++) {
+    Cluster &c = clusters[labels[a]];
+    c.d_rel += cur.d_rel[a] / c.size;
+    c.y_rel += cur.y_rel[a] / c.size;
+    c.v_rel += cur.v_rel[a] / c.size;
+    c.v_lead += cur.v_lead[a] / c.size;
+    c.v_lead_k += cur.v_lead_k[a] / c.size;
+  }
+  return nclusters;
+}
+
+// The cluster most likely the vision lead, if its distance and speed are sane
+const RadarTracker::Cluster *RadarTracker::match_vision(const radar_vision_lead &lead) const {
+  const double offset_vision_dist = lead.x - radar_to_camera;
+
+  const Cluster *best = nullptr;
+  double best_prob = 0;
+  for (const Cluster &c : clusters) {
+    // This is isn't exactly right, but good heuristic
+    const double prob = laplacian_cdf(c.d_rel, offset_vision_dist, lead.x_std) *
+                        laplacian_cdf(c.y_rel, -lead.y, lead.y_std) *
+                        laplacian_cdf(c.v_rel + v_ego, lead.v, lead.v_std);
+    if (best == nullptr || prob > best_prob) {
+      best = &c;
+      best_prob = prob;
+    }
+  }
+
+  // stationary radar points can be false positives
+  const bool dist_sane = std::abs(best->d_rel - offset_vision_dist) < std::max(offset_vision_dist * .25, 5.0);
+  const bool vel_sane = (std::abs(best->v_rel + v_ego - lead.v) < 10) || (v_ego + best->v_rel > 3);
+  return dist_sane && vel_sane ? best : nullptr;
+}
+
+void RadarTracker::cluster_lead(const Cluster &c, double model_prob, radar_lead &out) const {
+  out.status = 1;
+  out.fcw = model_prob > .9;
+  out.radar = 1;
+  out.d_rel = c.d_rel;
+  out.y_rel = c.y_rel;
+  out.v_rel = c.v_rel;
+  out.v_lead = c.v_lead;
+  out.v_lead_k = c.v_lead_k;
+  out.a_lead_k = c.a_lead_k;
+  out.a_lead_tau = c.a_lead_tau;
+  out.model_prob = model_prob;
+}
+
+void RadarTracker::get_lead(const radar_vision_lead &lead, bool ready, bool low_speed_override, radar_lead &out) const {
+  out = {};
+  const Cluster *c = !clusters.empty() && ready && lead.prob > .5 ? match_vision(lead) : nullptr;
+  if (c != nullptr) {
+    cluster_lead(*c, lead.prob, out);
+  } else if (ready && lead.prob > .5) {
+    out.status = 1;
+    out.d_rel = lead.x - radar_to_camera;
+    out.y_rel = -lead.y;
+    out.v_rel = lead.v - v_ego;
+    out.v_lead = lead.v;
+    out.v_lead_k = lead.v;
+    out.a_lead_tau = LEAD_ACCEL_TAU;
+    out.model_prob = lead.prob;
+  }
+
+  if (low_speed_override) {
+    // stop for stuff in front of you and low speed, even without model confirmation
+    const Cluster *closest = nullptr;
+    for (const Cluster &l : clusters) {
+      if (std::abs(l.y_rel) < 1.5 && v_ego < V_EGO_STATIONARY && l.d_rel < 25 && (closest == nullptr || l.d_rel < closest->d_rel)) {
+        closest = &l;
+      }
+    }
+    // only choose new cluster if it is actually closer than the previous one
+    if (closest != nullptr && (!out.status || closest->d_rel < out.d_rel)) {
+      cluster_lead(*closest, 0., out);
+    }
+  }
+}
+
+int RadarTracker::tracks(int max_tracks, int64_t *ids, double *d_rel, double *y_rel, double *v_rel) const {
+  const int n = std::min<int>(max_tracks, cur.id.size());
+  std::copy_n(cur.id.begin(), n, ids);
+  std::copy_n(cur.d_rel.begin(), n, d_rel);
+  std::copy_n(cur.y_rel.begin(), n, y_rel);
+  std::copy_n(cur.v_rel.begin(), n, v_rel);
+  return cur.id.size();
+}
+
+}  // namespace
+
+extern "C" {
+
+void *radar_tracker_create(double dt, double k0, double k1, int delay, double radar_to_camera) {
+  return new RadarTracker(dt, k0, k1, delay, radar_to_camera);
+}
+
+void radar_tracker_destroy(void *t) {
+  delete (RadarTracker *)t;
+}
+
+void radar_tracker_update_ego(void *t, double v_ego) {
+  ((RadarTracker *)t)->update_ego(v_ego);
+}
+
+int radar_tracker_update(void *t, int n, const int64_t *ids, const double *d_rel, const double *y_rel,
+                         const double *v_rel, const int *measured) {
+  return ((RadarTracker *)t)->update(n, ids, d_rel, y_rel, v_rel, measured);
+}
+
+void radar_tracker_get_lead(void *t, const radar_vision_lead *lead, int ready, int low_speed_override, radar_lead *out) {
+  ((RadarTracker *)t)->get_lead(*lead, ready, low_speed_override, *out);
+}
+
+int radar_tracker_tracks(void *t, int max_tracks, int64_t *ids, double *d_rel, double *y_rel, double *v_rel) {
+  return ((RadarTracker *)t)->tracks(max_tracks, ids, d_rel, y_rel, v_rel);
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef radar_tracker_H
+#define radar_tracker_H
+
+#include <stdint.h>
+
+//
+// The tracks, clusters and leads of radard, kept from frame to frame
+//
+// Every track has the lead speed and accel kalman filter of radar_helpers.Track, the filters of
+// all tracks are updated at once on arrays of the tracks sorted by id. The tracks are clustered
+// with grid_cluster and the leads are matched to the vision leads as in radard.get_lead.
+//
+
+typedef struct {
+  double x, y, v;
+  double x_std, y_std, v_std;
+  double prob;
+} radar_vision_lead;
+
+typedef struct {
+  int status, fcw, radar;
+  double d_rel, y_rel, v_rel, v_lead, v_lead_k, a_lead_k, a_lead_tau, model_prob;
+} radar_lead;
+
+//
+// Input arguments:
+//   dt              = radar time step, of the A of the kalman filter
+//   k0, k1          = kalman gain
+//   delay           = of the radar, in frames the v_ego of the leads lags
+//   radar_to_camera = distance of the radar ahead of the camera
+//
+void *radar_tracker_create(double dt, double k0, double k1, int delay, double radar_to_camera);
+void radar_tracker_destroy(void *t);
+
+// On every carState
+void radar_tracker_update_ego(void *t, double v_ego);
+
+//
+// The points of a radarData, the tracks of missing ids are dropped
+//
+// Input arguments:
+//   n        = number of points
+//   ids      = n track ids, of a repeated id the last point is taken
+//   d_rel, y_rel, v_rel, measured = n values of the points
+// Return:
+//   number of clusters
+//
+int radar_tracker_update(void *t, int n, const int64_t *ids, const double *d_rel, const double *y_rel,
+                         const double *v_rel, const int *measured);
+
+// The lead of the clusters for a lead of the model, ready once there was a model
+void radar_tracker_get_lead(void *t, const radar_vision_lead *lead, int ready, int low_speed_override, radar_lead *out);
+
+//
+// The tracks, sorted by id, for liveTracks
+//
+// Input arguments:
+//   max_tracks = size of the output arrays
+// Output arguments:
+//   ids, d_rel, y_rel, v_rel = max_tracks values
+// Return:
+//   number of tracks
+//
+int radar_tracker_tracks(void *t, int max_tracks, int64_t *ids, double *d_rel, double *y_rel, double *v_rel);
+
+
+#endif
@@ -0,0 +1,83 @@
+import os
+
+from cffi import FFI
+from common.ffi_wrapper import suffix
+
+cluster_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)))
+cluster_fn = os.path.join(cluster_dir, "libfastcluster"+suffix())
+
+ffi = FFI()
+ffi.cdef("""
+typedef struct {
+  double x, y, v;
+  double x_std, y_std, v_std;
+  double prob;
+} radar_vision_lead;
+
+typedef struct {
+  int status, fcw, radar;
+  double d_rel, y_rel, v_rel, v_lead, v_lead_k, a_lead_k, a_lead_tau, model_prob;
+} radar_lead;
+
+void *radar_tracker_create(double dt, double k0, double k1, int delay, double radar_to_camera);
+void radar_tracker_destroy(void *t);
+void radar_tracker_update_ego(void *t, double v_ego);
+int radar_tracker_update(void *t, int n, const int64_t *ids, const double *d_rel, const double *y_rel,
+                         const double *v_rel, const int *measured);
+void radar_tracker_get_lead(void *t, const radar_vision_lead *lead, int ready, int low_speed_override, radar_lead *out);
+int radar_tracker_tracks(void *t, int max_tracks, int64_t *ids, double *d_rel, double *y_rel, double *v_rel);
+""")
+
+tracker = ffi.dlopen(cluster_fn)
+
+
+class RadarTracker():
+  """The tracks, clusters and leads of radard.RadarD in C++, see radar_tracker.h"""
+  def __init__(self, kalman_params, delay, radar_to_camera):
+    self.t = ffi.gc(tracker.radar_tracker_create(kalman_params.A[0][1], kalman_params.K[0][0], kalman_params.K[1][0],
+                                                 delay, radar_to_camera), tracker.radar_tracker_destroy)
+    self.lead_in = ffi.new("radar_vision_lead *")
+    self.lead_out = ffi.new("radar_lead *")
+
+  def update_ego(self, v_ego):
+    tracker.radar_tracker_update_ego(self.t, v_ego)
+
+  def update(self, points):
+    n = len(points)
+    ids = ffi.new("int64_t[]", [pt.trackId for pt in points])
+    d_rel = ffi.new("double[]", [pt.dRel for pt in points])
+    y_rel = ffi.new("double[]", [pt.yRel for pt in points])
+    v_rel = ffi.new("double[]", [pt.vRel for pt in points])
+    measured = ffi.new("int[]", [pt.measured for pt in points])
+    return tracker.radar_tracker_update(self.t, n, ids, d_rel, y_rel, v_rel, measured)
+
+  def get_lead(self, ready, lead_msg, low_speed_override):
+    l = self.lead_in
+    l.x, l.y, l.v = lead_msg.x[0], lead_msg.y[0], lead_msg.v[0]
+    l.x_std, l.y_std, l.v_std = lead_msg.xStd[0], lead_msg.yStd[0], lead_msg.vStd[0]
+    l.prob = lead_msg.prob
+    tracker.radar_tracker_get_lead(self.t, l, ready, low_speed_override, self.lead_out)
+
+    out = self.lead_out
+    if not out.status:
+      return {'status': False}
+    return {
+      "dRel": out.d_rel,
+      "yRel": out.y_rel,
+      "vRel": out.v_rel,
+      "vLead": out.v_lead,
+      "vLeadK": out.v_lead_k,
+      "aLeadK": out.a_lead_k,
+      "status": True,
+      "fcw": bool(out.fcw),
+      "modelProb": out.model_prob,
+      "radar": bool(out.radar),
+      "aLeadTau": out.a_lead_tau
+    }
+
+  def tracks(self):
+    n = tracker.radar_tracker_tracks(self.t, 0, ffi.NULL, ffi.NULL, ffi.NULL, ffi.NULL)
+    ids = ffi.new("int64_t[]", n)
+    d_rel, y_rel, v_rel = ffi.new("double[]", n), ffi.new("double[]", n), ffi.new("double[]", n)
+    tracker.radar_tracker_tracks(self.t, n, ids, d_rel, y_rel, v_rel)
+    return [(ids[i], d_rel[i], y_rel[i], v_rel[i]) for i in range(n)]
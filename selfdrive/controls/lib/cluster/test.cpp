@@ -1,9 +1,63 @@
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
 
 extern "C" {
 #include "fastcluster.h"
+#include "grid_cluster.h"
 }
 
+// Radar like frames: tracks in groups around a few objects, drifting from frame to frame,
+// the grid clustering has the labels of cluster_points_centroid
+void test_grid_cluster(int ntracks, int frames) {
+  std::mt19937 gen(ntracks);
+  std::normal_distribution<double> noise(0., 1.);
+  std::uniform_real_distribution<double> uniform(0., 1.);
+
+  const int m = 3;
+  std::vector<double> objects, pts(ntracks * m);
+  std::vector<int64_t> ids(ntracks);
+  std::vector<int> object_of(ntracks);
+  for (int o = 0; o < ntracks / 3 + 1; o++) {
+    objects.insert(objects.end(), {5. + 150. * uniform(gen), 20. * (uniform(gen) - 0.5), 20. * (uniform(gen) - 0.5)});
+  }
+  for (int i = 0; i < ntracks; i++) {
+    ids[i] = i;
+    object_of[i] = gen() % (objects.size() / m);
+  }
+
+  void *gc = grid_cluster_create(2.5);
+  std::vector<int> idx(ntracks), correct_idx(ntracks);
+  for (int f = 0; f < frames; f++) {
+    for (int o = 0; o < objects.size(); o += m) {
+      objects[o] += 0.05 * objects[o + 2];
+      objects[o + 2] += 0.1 * noise(gen);
+    }
+    for (int i = 0; i < ntracks; i++) {
+      // a track lost now and then, and a new one with an other id
+      if (uniform(gen) < 0.01) {
+        ids[i] += ntracks;
+        object_of[i] = gen() % (objects.size() / m);
+      }
+      for (int k = 0; k < m; k++) {
+        pts[i * m + k] = objects[object_of[i] * m + k] + (f == 0 || uniform(gen) < 0.3 ? 1.5 * noise(gen) : 0.);
+      }
+    }
+
+    grid_cluster_points(gc, ntracks, m, pts.data(), ids.data(), idx.data());
+    cluster_points_centroid(ntracks, m, pts.data(), 2.5 * 2.5, correct_idx.data());
+    for (int i = 0; i < ntracks; i++) {
+      assert(idx[i] == correct_idx[i]);
+    }
+  }
+
+  int reused, linked, joined;
+  grid_cluster_stats(gc, &reused, &linked, &joined);
+  printf("%d tracks: %d components reused, %d linked, %d joined\n", ntracks, reused, linked, joined);
+  grid_cluster_destroy(gc);
+}
 
 int main(int argc, const char* argv[]) {
   const int n = 11;
@@ -29,6 +83,18 @@ int main(int argc, const char* argv[]) {
     assert(idx[i] == correct_idx[i]);
   }
 
+  int64_t ids[n] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  void *gc = grid_cluster_create(2.5);
+  grid_cluster_points(gc, n, m, pts, ids, idx);
+  for (int i = 0; i < n; i++) {
+    assert(idx[i] == correct_idx[i]);
+  }
+  grid_cluster_destroy(gc);
+
+  for (int ntracks : {2, 8, 16, 32, 64}) {
+    test_grid_cluster(ntracks, 2000);
+  }
+
   delete[] idx;
   delete[] correct_idx;
   delete[] pts;
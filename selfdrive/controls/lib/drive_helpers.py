@@ -19,6 +19,14 @@ CAR_ROTATION_RADIUS = 0.0
 MAX_CURVATURE_RATES = [0.03762194918267951, 0.003441203371932992]
 MAX_CURVATURE_RATE_SPEEDS = [0, 35]
 
+# the mpcs start from the last solution shifted by the time between the solves,
+# with at most these active set changes and time of the QP solve
+class MPC_SOLVER:
+  WARM_START_DT = DT_MDL
+  MAX_NWSR = 50
+  MAX_TIME = 0.005
+
+
 class MPC_COST_LAT:
   PATH = 1.0
   HEADING = 1.0
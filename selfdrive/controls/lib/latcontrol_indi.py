@@ -8,6 +8,10 @@ from common.realtime import DT_CTRL
 from selfdrive.car import apply_toyota_steer_torque_limits
 from selfdrive.car.toyota.values import CarControllerParams
 from selfdrive.controls.lib.drive_helpers import get_steer_max
+try:
+  from selfdrive.controls.lib.lateral_kernels.lateral_kernels import IndiKernel # pylint: disable=no-name-in-module, import-error
+except ImportError:
+  from selfdrive.controls.lib.lateral_kernels.reference import IndiKernel
 from common.params import Params
 from decimal import Decimal
 
@@ -35,7 +39,8 @@ class LatControlINDI():
 
     self.K = K
     self.A_K = A - np.dot(K, C)
-    self.x = np.array([[0.], [0.], [0.]])
+    self.observer = IndiKernel(self.A_K.flatten(), K.flatten())
+    self.x = self.observer.x
 
     self.enforce_rate_limit = CP.carName == "toyota"
 
@@ -110,8 +115,7 @@ class LatControlINDI():
       self.live_tune(CP)
 
     # Update Kalman filter
-    y = np.array([[math.radians(CS.steeringAngleDeg)], [math.radians(CS.steeringRateDeg)]])
-    self.x = np.dot(self.A_K, self.x) + np.dot(self.K, y)
+    self.x = self.observer.update(math.radians(CS.steeringAngleDeg), math.radians(CS.steeringRateDeg))
 
     indi_log = log.ControlsState.LateralINDIState.new_message()
     indi_log.steeringAngleDeg = math.degrees(self.x[0])
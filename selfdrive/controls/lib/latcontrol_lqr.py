@@ -5,6 +5,10 @@ from common.numpy_fast import clip
 from common.realtime import DT_CTRL
 from cereal import log
 from selfdrive.controls.lib.drive_helpers import get_steer_max
+try:
+  from selfdrive.controls.lib.lateral_kernels.lateral_kernels import LqrKernel # pylint: disable=no-name-in-module, import-error
+except ImportError:
+  from selfdrive.controls.lib.lateral_kernels.reference import LqrKernel
 from common.params import Params
 from decimal import Decimal
 
@@ -16,14 +20,11 @@ class LatControlLQR():
     self.scale = CP.lateralTuning.lqr.scale
     self.ki = CP.lateralTuning.lqr.ki
 
-    self.A = np.array(CP.lateralTuning.lqr.a).reshape((2, 2))
-    self.B = np.array(CP.lateralTuning.lqr.b).reshape((2, 1))
-    self.C = np.array(CP.lateralTuning.lqr.c).reshape((1, 2))
-    self.K = np.array(CP.lateralTuning.lqr.k).reshape((1, 2))
-    self.L = np.array(CP.lateralTuning.lqr.l).reshape((2, 1))
+    # the kalman filter of the angle and the gain K of the state, of A, B, C, K, L
+    self.lqr = LqrKernel(CP.lateralTuning.lqr.a, CP.lateralTuning.lqr.b, CP.lateralTuning.lqr.c,
+                         CP.lateralTuning.lqr.k, CP.lateralTuning.lqr.l)
     self.dc_gain = CP.lateralTuning.lqr.dcGain
 
-    self.x_hat = np.array([[0], [0]])
     self.i_unwind_rate = 0.3 * DT_CTRL
     self.i_rate = 1.0 * DT_CTRL
 
@@ -86,9 +87,7 @@ class LatControlLQR():
     desired_angle += instant_offset  # Only add offset that originates from vehicle model errors
 
     # Update Kalman filter
-    angle_steers_k = float(self.C.dot(self.x_hat))
-    e = steering_angle_no_offset - angle_steers_k
-    self.x_hat = self.A.dot(self.x_hat) + self.B.dot(CS.steeringTorqueEps / torque_scale) + self.L.dot(e)
+    angle_steers_k = self.lqr.update(steering_angle_no_offset, CS.steeringTorqueEps / torque_scale)
 
     if CS.vEgo < 0.3 or not active:
       lqr_log.active = False
@@ -99,7 +98,7 @@ class LatControlLQR():
       lqr_log.active = True
 
       # LQR
-      u_lqr = float(desired_angle / self.dc_gain - self.K.dot(self.x_hat))
+      u_lqr = self.lqr.output(desired_angle / self.dc_gain)
       lqr_output = torque_scale * u_lqr / self.scale
 
       # Integrator
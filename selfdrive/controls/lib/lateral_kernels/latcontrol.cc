@@ -0,0 +1,20 @@
+#include "latcontrol.hpp"
+
+LqrKernel::LqrKernel(const double *a, const double *b, const double *c, const double *k, const double *l)
+  : A(Eigen::Map<const Eigen::Matrix<double, 2, 2, Eigen::RowMajor>>(a)), B(b), C(c), K(k), L(l) {
+}
+
+double LqrKernel::update(double angle_steers, double torque) {
+  double angle_steers_k = C.dot(x_hat);
+  x_hat = A * x_hat + B * torque + L * (angle_steers - angle_steers_k);
+  return angle_steers_k;
+}
+
+IndiKernel::IndiKernel(const double *a_k, const double *k)
+  : A_K(Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(a_k)),
+    K(Eigen::Map<const Eigen::Matrix<double, 3, 2, Eigen::RowMajor>>(k)) {
+}
+
+void IndiKernel::update(double angle, double rate) {
+  x = A_K * x + K * Eigen::Vector2d(angle, rate);
+}
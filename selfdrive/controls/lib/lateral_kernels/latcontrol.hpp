@@ -0,0 +1,36 @@
+#pragma once
+#include <eigen3/Eigen/Dense>
+
+//
+// The matrix steps of latcontrol_lqr.py and latcontrol_indi.py, of fixed size
+//
+
+// The kalman filter of the steering angle and the state feedback of the LQR
+class LqrKernel {
+public:
+  // a, l row major 2x2 and 2x1, b, c, k of 2
+  LqrKernel(const double *a, const double *b, const double *c, const double *k, const double *l);
+
+  // The angle of the state before the update, the state updated with the angle and torque
+  double update(double angle_steers, double torque);
+  // u = r - K x
+  double output(double r) const { return r - K.dot(x_hat); }
+
+  Eigen::Matrix2d A;
+  Eigen::Vector2d B, C, K, L;
+  Eigen::Vector2d x_hat = Eigen::Vector2d::Zero();
+};
+
+// The observer of the steering angle, rate and accel of the INDI
+class IndiKernel {
+public:
+  // a_k row major 3x3, k row major 3x2
+  IndiKernel(const double *a_k, const double *k);
+
+  // x = (A - K C) x + K y of the measured angle and rate
+  void update(double angle, double rate);
+
+  Eigen::Matrix3d A_K;
+  Eigen::Matrix<double, 3, 2> K;
+  Eigen::Vector3d x = Eigen::Vector3d::Zero();
+};
@@ -0,0 +1,53 @@
+#cython: language_level=3
+
+cdef extern from "vehicle_model.cc":
+  pass
+
+cdef extern from "latcontrol.cc":
+  pass
+
+cdef extern from "vehicle_model.hpp":
+  cdef cppclass Vector2 "Eigen::Vector2d":
+    Vector2()
+    double operator()(int)
+
+  cdef cppclass Matrix2 "Eigen::Matrix2d":
+    Matrix2()
+    double operator()(int, int)
+
+  cdef cppclass VehicleModel_c "VehicleModel":
+    VehicleModel_c(double, double, double, double, double, double, double, double)
+
+    void update_params(double, double)
+    void state_matrices(double, Matrix2 *, Vector2 *)
+    Vector2 steady_state_sol(double, double)
+    double slip_factor()
+    double curvature_factor(double)
+    double calc_curvature(double, double)
+    double get_steer_from_curvature(double, double)
+    double get_steer_from_yaw_rate(double, double)
+    double yaw_rate(double, double)
+
+    double m, j, l, aF, aR, chi
+    double cF_orig, cR_orig
+    double cF, cR, sR
+
+cdef extern from "latcontrol.hpp":
+  cdef cppclass Vector3 "Eigen::Vector3d":
+    Vector3()
+    double operator()(int)
+
+  cdef cppclass LqrKernel_c "LqrKernel":
+    LqrKernel_c(const double *, const double *, const double *, const double *, const double *)
+
+    double update(double, double)
+    double output(double)
+
+    Vector2 x_hat
+
+  cdef cppclass IndiKernel_c "IndiKernel":
+    IndiKernel_c(const double *, const double *)
+
+    void update(double, double)
+
+    Vector3 x
@@ -0,0 +1,166 @@
+# distutils: language = c++
+# cython: language_level = 3
+from selfdrive.controls.lib.lateral_kernels.lateral_kernels cimport Matrix2, Vector2, Vector3
+from selfdrive.controls.lib.lateral_kernels.lateral_kernels cimport VehicleModel_c, LqrKernel_c, IndiKernel_c
+
+import numpy as np
+
+
+cdef class VehicleModel:
+  """The dynamic bicycle model of vehicle_model.py, see vehicle_model.hpp"""
+  cdef VehicleModel_c *vm
+
+  def __cinit__(self, CP):
+    self.vm = new VehicleModel_c(CP.mass, CP.rotationalInertia, CP.wheelbase, CP.centerToFront, CP.steerRatioRear,
+                                 CP.tireStiffnessFront, CP.tireStiffnessRear, CP.steerRatio)
+
+  def __dealloc__(self):
+    del self.vm
+
+  def update_params(self, double stiffness_factor, double steer_ratio):
+    """Update the vehicle model with a new stiffness factor and steer ratio"""
+    self.vm.update_params(stiffness_factor, steer_ratio)
+
+  def steady_state_sol(self, double sa, double u):
+    """2x1 matrix with the steady state solution (lateral speed, rotational speed), kinematic at low speed"""
+    cdef Vector2 x = self.vm.steady_state_sol(sa, u)
+    return np.array([[x(0)], [x(1)]])
+
+  def state_matrices(self, double u):
+    """The 2x2 A and 2x1 B of the dynamics at speed u"""
+    cdef Matrix2 A
+    cdef Vector2 B
+    self.vm.state_matrices(u, &A, &B)
+    return np.array([[A(0, 0), A(0, 1)], [A(1, 0), A(1, 1)]]), np.array([[B(0)], [B(1)]])
+
+  def slip_factor(self):
+    return self.vm.slip_factor()
+
+  def calc_curvature(self, double sa, double u):
+    """The curvature [1/m] of the steering wheel angle sa [rad] at speed u [m/s]"""
+    return self.vm.calc_curvature(sa, u)
+
+  def curvature_factor(self, double u):
+    """The curvature of the wheel angle, not the steering wheel angle"""
+    return self.vm.curvature_factor(u)
+
+  def get_steer_from_curvature(self, double curv, double u):
+    """The steering wheel angle [rad] of a curvature [1/m]"""
+    return self.vm.get_steer_from_curvature(curv, u)
+
+  def get_steer_from_yaw_rate(self, double yaw_rate, double u):
+    """The steering wheel angle [rad] of a yaw rate [rad/s]"""
+    return self.vm.get_steer_from_yaw_rate(yaw_rate, u)
+
+  def yaw_rate(self, double sa, double u):
+    """The yaw rate [rad/s] of the steering wheel angle sa [rad]"""
+    return self.vm.yaw_rate(sa, u)
+
+  @property
+  def m(self):
+    return self.vm.m
+
+  @property
+  def j(self):
+    return self.vm.j
+
+  @property
+  def l(self):
+    return self.vm.l
+
+  @property
+  def aF(self):
+    return self.vm.aF
+
+  @property
+  def aR(self):
+    return self.vm.aR
+
+  @property
+  def chi(self):
+    return self.vm.chi
+
+  @property
+  def cF_orig(self):
+    return self.vm.cF_orig
+
+  @property
+  def cR_orig(self):
+    return self.vm.cR_orig
+
+  @property
+  def cF(self):
+    return self.vm.cF
+
+  @property
+  def cR(self):
+    return self.vm.cR
+
+  @property
+  def sR(self):
+    return self.vm.sR
+
+
+cdef class LqrKernel:
+  """The kalman filter of the steering angle and the state feedback of latcontrol_lqr.py"""
+  cdef LqrKernel_c *k
+
+  def __cinit__(self, A, B, C, K, L):
+    assert len(A) == 4 and len(B) == 2 and len(C) == 2 and len(K) == 2 and len(L) == 2
+    cdef double a[4]
+    cdef double b[2]
+    cdef double c[2]
+    cdef double k[2]
+    cdef double l[2]
+    cdef int i
+    for i in range(4):
+      a[i] = A[i]
+    for i in range(2):
+      b[i] = B[i]
+      c[i] = C[i]
+      k[i] = K[i]
+      l[i] = L[i]
+    self.k = new LqrKernel_c(a, b, c, k, l)
+
+  def __dealloc__(self):
+    del self.k
+
+  def update(self, double angle_steers, double torque):
+    """The steering angle of the state, then the update with the measured angle and torque"""
+    return self.k.update(angle_steers, torque)
+
+  def output(self, double r):
+    """r - K x"""
+    return self.k.output(r)
+
+  @property
+  def x_hat(self):
+    return [[self.k.x_hat(0)], [self.k.x_hat(1)]]
+
+
+cdef class IndiKernel:
+  """The observer of the steering angle, rate and accel of latcontrol_indi.py"""
+  cdef IndiKernel_c *k
+
+  def __cinit__(self, A_K, K):
+    assert len(A_K) == 9 and len(K) == 6
+    cdef double a_k[9]
+    cdef double k[6]
+    cdef int i
+    for i in range(9):
+      a_k[i] = A_K[i]
+    for i in range(6):
+      k[i] = K[i]
+    self.k = new IndiKernel_c(a_k, k)
+
+  def __dealloc__(self):
+    del self.k
+
+  def update(self, double angle, double rate):
+    """The state updated with the measured angle and rate [rad, rad/s]"""
+    self.k.update(angle, rate)
+    return [self.k.x(0), self.k.x(1), self.k.x(2)]
+
+  @property
+  def x(self):
+    return [self.k.x(0), self.k.x(1), self.k.x(2)]
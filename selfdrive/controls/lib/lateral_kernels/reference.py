@@ -0,0 +1,38 @@
+"""The matrix steps of the LQR and the INDI in numpy, the reference of the kernels of
+lateral_kernels.pyx and what the controllers run where it isn't built"""
+import numpy as np
+
+
+class LqrKernel:
+  def __init__(self, A, B, C, K, L):
+    self.A = np.array(A).reshape((2, 2))
+    self.B = np.array(B).reshape((2, 1))
+    self.C = np.array(C).reshape((1, 2))
+    self.K = np.array(K).reshape((1, 2))
+    self.L = np.array(L).reshape((2, 1))
+    self.x_hat = np.array([[0.], [0.]])
+
+  def update(self, angle_steers, torque):
+    angle_steers_k = float(self.C.dot(self.x_hat))
+    e = angle_steers - angle_steers_k
+    self.x_hat = self.A.dot(self.x_hat) + self.B.dot(torque) + self.L.dot(e)
+    return angle_steers_k
+
+  def output(self, r):
+    return float(r - self.K.dot(self.x_hat))
+
+
+class IndiKernel:
+  def __init__(self, A_K, K):
+    self.A_K = np.array(A_K).reshape((3, 3))
+    self.K = np.array(K).reshape((3, 2))
+    self._x = np.array([[0.], [0.], [0.]])
+
+  def update(self, angle, rate):
+    y = np.array([[angle], [rate]])
+    self._x = np.dot(self.A_K, self._x) + np.dot(self.K, y)
+    return self.x
+
+  @property
+  def x(self):
+    return [float(v) for v in self._x[:, 0]]
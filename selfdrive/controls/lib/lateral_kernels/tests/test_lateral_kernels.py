@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+import math
+import unittest
+import numpy as np
+
+from cereal import car
+from common.realtime import DT_CTRL
+from selfdrive.controls.lib.vehicle_model import VehicleModelPy, create_dyn_state_matrices, dyn_ss_sol, calc_slip_factor
+from selfdrive.controls.lib.lateral_kernels.lateral_kernels import VehicleModel, LqrKernel, IndiKernel  # pylint: disable=no-name-in-module, import-error
+from selfdrive.controls.lib.lateral_kernels import reference
+
+SPEEDS = [0.0, 0.05, 0.1, 0.5, 2.0, 5.0, 10.0, 20.0, 30.0, 40.0]
+ANGLES = [math.radians(a) for a in (-90.0, -30.0, -5.0, -0.1, 0.0, 0.1, 5.0, 30.0, 90.0)]
+
+
+def car_params(mass, wheelbase, center_to_front, steer_ratio, steer_ratio_rear=0.0):
+  CP = car.CarParams.new_message()
+  CP.mass = mass
+  CP.wheelbase = wheelbase
+  CP.centerToFront = center_to_front
+  CP.steerRatio = steer_ratio
+  CP.steerRatioRear = steer_ratio_rear
+  CP.rotationalInertia = 2500 * mass / 1500 * (wheelbase / 2.7)**2
+  CP.tireStiffnessFront = 192150.
+  CP.tireStiffnessRear = 202500.
+  return CP
+
+
+class TestLateralKernels(unittest.TestCase):
+  def setUp(self):
+    self.cars = [
+      car_params(1500., 2.7, 1.2, 15.3),
+      car_params(2200., 3.0, 1.6, 17.8),
+      car_params(1100., 2.4, 0.9, 13.0, steer_ratio_rear=-0.1),
+    ]
+
+  def test_vehicle_model(self):
+    for CP in self.cars:
+      VM, VM_py = VehicleModel(CP), VehicleModelPy(CP)
+      for stiffness_factor, steer_ratio in [(1.0, CP.steerRatio), (0.7, 14.0), (1.4, 19.5)]:
+        VM.update_params(stiffness_factor, steer_ratio)
+        VM_py.update_params(stiffness_factor, steer_ratio)
+        for attr in ('m', 'j', 'l', 'aF', 'aR', 'chi', 'cF', 'cR', 'sR'):
+          self.assertEqual(getattr(VM, attr), getattr(VM_py, attr))
+        np.testing.assert_allclose(VM.slip_factor(), calc_slip_factor(VM_py), rtol=1e-12)
+
+        for u in SPEEDS:
+          for sa in ANGLES:
+            np.testing.assert_allclose(VM.steady_state_sol(sa, u), VM_py.steady_state_sol(sa, u), rtol=1e-12, atol=1e-15)
+            if u > 0.1:
+              np.testing.assert_allclose(VM.steady_state_sol(sa, u), dyn_ss_sol(sa, u, VM_py), rtol=1e-12, atol=1e-15)
+            np.testing.assert_allclose(VM.calc_curvature(sa, u), VM_py.calc_curvature(sa, u), rtol=1e-12, atol=1e-15)
+            np.testing.assert_allclose(VM.yaw_rate(sa, u), VM_py.yaw_rate(sa, u), rtol=1e-12, atol=1e-15)
+          if u > 0.:
+            for M, M_py in zip(VM.state_matrices(u), create_dyn_state_matrices(u, VM_py)):
+              np.testing.assert_allclose(M, M_py, rtol=1e-12)
+          curv = 0.01
+          np.testing.assert_allclose(VM.curvature_factor(u), VM_py.curvature_factor(u), rtol=1e-12)
+          np.testing.assert_allclose(VM.get_steer_from_curvature(curv, u), VM_py.get_steer_from_curvature(curv, u), rtol=1e-12)
+          if u > 0.:
+            np.testing.assert_allclose(VM.get_steer_from_yaw_rate(curv * u, u), VM_py.get_steer_from_yaw_rate(curv * u, u), rtol=1e-12)
+
+  def test_lqr(self):
+    # the tune of the corolla
+    A = [0., 1., -0.22619643, 1.21822268]
+    B = [-1.92006585e-04, 3.95603032e-05]
+    C = [1., 0.]
+    K = [-110.73572306, 451.22718255]
+    L = [0.3233671, 0.3185757]
+    lqr, lqr_py = LqrKernel(A, B, C, K, L), reference.LqrKernel(A, B, C, K, L)
+
+    np.random.seed(0)
+    for u in SPEEDS:
+      torque_scale = (0.45 + u / 60.0)**2
+      for angle in np.degrees(ANGLES):
+        for _ in range(20):
+          angle_steers = angle + np.random.uniform(-1., 1.)
+          torque = np.random.uniform(-1500., 1500.) / torque_scale
+          np.testing.assert_allclose(lqr.update(angle_steers, torque), lqr_py.update(angle_steers, torque), rtol=1e-9, atol=1e-9)
+          np.testing.assert_allclose(lqr.output(angle), lqr_py.output(angle), rtol=1e-9, atol=1e-9)
+          np.testing.assert_allclose(lqr.x_hat, lqr_py.x_hat, rtol=1e-9, atol=1e-9)
+
+  def test_indi(self):
+    A = np.array([[1.0, DT_CTRL, 0.0],
+                  [0.0, 1.0, DT_CTRL],
+                  [0.0, 0.0, 1.0]])
+    C = np.array([[1.0, 0.0, 0.0],
+                  [0.0, 1.0, 0.0]])
+    K = np.array([[7.30262179e-01, 2.07003658e-04],
+                  [7.29394177e+00, 1.39159419e-02],
+                  [1.71022442e+01, 3.38495381e-02]])
+    A_K = A - np.dot(K, C)
+    indi, indi_py = IndiKernel(A_K.flatten(), K.flatten()), reference.IndiKernel(A_K.flatten(), K.flatten())
+
+    np.random.seed(0)
+    for angle in ANGLES:
+      for _ in range(100):
+        meas = angle + np.random.uniform(-0.01, 0.01), np.random.uniform(-1., 1.)
+        np.testing.assert_allclose(indi.update(*meas), indi_py.update(*meas), rtol=1e-9, atol=1e-12)
+    np.testing.assert_allclose(indi.x, indi_py.x, rtol=1e-9, atol=1e-12)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,60 @@
+#include "vehicle_model.hpp"
+
+VehicleModel::VehicleModel(double mass, double rotational_inertia, double wheelbase, double center_to_front,
+                           double steer_ratio_rear, double tire_stiffness_front, double tire_stiffness_rear, double steer_ratio)
+  : m(mass), j(rotational_inertia), l(wheelbase), aF(center_to_front), aR(wheelbase - center_to_front),
+    chi(steer_ratio_rear), cF_orig(tire_stiffness_front), cR_orig(tire_stiffness_rear) {
+  update_params(1.0, steer_ratio);
+}
+
+void VehicleModel::update_params(double stiffness_factor, double steer_ratio) {
+  cF = stiffness_factor * cF_orig;
+  cR = stiffness_factor * cR_orig;
+  sR = steer_ratio;
+  sf = m * (cF * aF - cR * aR) / (l * l * cF * cR);
+}
+
+void VehicleModel::state_matrices(double u, Eigen::Matrix2d *A, Eigen::Vector2d *B) const {
+  (*A)(0, 0) = -(cF + cR) / (m * u);
+  (*A)(0, 1) = -(cF * aF - cR * aR) / (m * u) - u;
+  (*A)(1, 0) = -(cF * aF - cR * aR) / (j * u);
+  (*A)(1, 1) = -(cF * aF * aF + cR * aR * aR) / (j * u);
+  (*B)(0) = (cF + chi * cR) / m / sR;
+  (*B)(1) = (cF * aF - chi * cR * aR) / j / sR;
+}
+
+Eigen::Vector2d VehicleModel::steady_state_sol(double sa, double u) const {
+  // at low speed the tire slip is undefined, the kinematic model then
+  return u > 0.1 ? dyn_ss_sol(sa, u) : kin_ss_sol(sa, u);
+}
+
+Eigen::Vector2d VehicleModel::dyn_ss_sol(double sa, double u) const {
+  Eigen::Matrix2d A;
+  Eigen::Vector2d B;
+  state_matrices(u, &A, &B);
+  return -A.inverse() * B * sa;
+}
+
+Eigen::Vector2d VehicleModel::kin_ss_sol(double sa, double u) const {
+  return Eigen::Vector2d(aR / sR / l * u, 1. / sR / l * u) * sa;
+}
+
+double VehicleModel::curvature_factor(double u) const {
+  return (1. - chi) / (1. - sf * u * u) / l;
+}
+
+double VehicleModel::calc_curvature(double sa, double u) const {
+  return curvature_factor(u) * sa / sR;
+}
+
+double VehicleModel::get_steer_from_curvature(double curv, double u) const {
+  return curv * sR * 1.0 / curvature_factor(u);
+}
+
+double VehicleModel::get_steer_from_yaw_rate(double yaw_rate, double u) const {
+  return get_steer_from_curvature(yaw_rate / u, u);
+}
+
+double VehicleModel::yaw_rate(double sa, double u) const {
+  return calc_curvature(sa, u) * u;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <eigen3/Eigen/Dense>
+
+//
+// The dynamic bicycle model of vehicle_model.py, of fixed size
+//
+// The state is x = [v, r]^T, lateral speed and rotational speed, the input the steering wheel
+// angle. The slip factor only changes with the tire stiffness and is kept from update_params.
+//
+class VehicleModel {
+public:
+  VehicleModel(double mass, double rotational_inertia, double wheelbase, double center_to_front,
+               double steer_ratio_rear, double tire_stiffness_front, double tire_stiffness_rear, double steer_ratio);
+
+  void update_params(double stiffness_factor, double steer_ratio);
+
+  // x_dot = A x + B u at speed u
+  void state_matrices(double u, Eigen::Matrix2d *A, Eigen::Vector2d *B) const;
+  Eigen::Vector2d steady_state_sol(double sa, double u) const;
+  Eigen::Vector2d dyn_ss_sol(double sa, double u) const;
+  Eigen::Vector2d kin_ss_sol(double sa, double u) const;
+
+  double slip_factor() const { return sf; }
+  double curvature_factor(double u) const;
+  double calc_curvature(double sa, double u) const;
+  double get_steer_from_curvature(double curv, double u) const;
+  double get_steer_from_yaw_rate(double yaw_rate, double u) const;
+  double yaw_rate(double sa, double u) const;
+
+  double m, j, l, aF, aR, chi;
+  double cF_orig, cR_orig;
+  double cF, cR, sR;
+
+private:
+  double sf;
+};
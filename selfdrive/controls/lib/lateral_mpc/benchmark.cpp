@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <dlfcn.h>
+#include <vector>
+
+#include "common/modeldata.h"
+
+const int N = LAT_MPC_N;
+
+typedef struct {
+  double x, y, psi, tire_angle, tire_angle_rate;
+} state_t;
+
+typedef struct {
+  double x[N+1];
+  double y[N+1];
+  double psi[N+1];
+  double curvature[N+1];
+  double curvature_rate[N];
+  double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
+} log_t;
+
+struct Mpc {
+  void (*init)();
+  void (*set_weights)(double, double, double);
+  void (*set_solver_options)(double, int, double);
+  int (*run_mpc)(state_t *, log_t *, double, double, double *, double *);
+};
+
+static bool load(const char *fn, Mpc *mpc) {
+  void *lib = dlopen(fn, RTLD_NOW | RTLD_LOCAL);
+  if (lib == nullptr) {
+    printf("%s\n", dlerror());
+    return false;
+  }
+  mpc->init = (void (*)())dlsym(lib, "init");
+  mpc->set_weights = (void (*)(double, double, double))dlsym(lib, "set_weights");
+  mpc->set_solver_options = (void (*)(double, int, double))dlsym(lib, "set_solver_options");
+  mpc->run_mpc = (int (*)(state_t *, log_t *, double, double, double *, double *))dlsym(lib, "run_mpc");
+  return mpc->init && mpc->set_weights && mpc->set_solver_options && mpc->run_mpc;
+}
+
+// Solve latency of the mpc of the ACADO export and of condensed_mpc.cpp, in closed loop on paths
+// of changing curvature and speed, and the largest difference of the plans of both
+int main(int argc, const char* argv[]) {
+  Mpc mpcs[2];
+  const char *names[2] = {"acado", "condensed"};
+  if (!load("./libmpc.so", &mpcs[0]) || !load("./libmpc_condensed.so", &mpcs[1])) return 1;
+
+  const int frames = 2000;
+  const double dt = 0.05;
+  std::vector<log_t> plans[2];
+  printf("mpc        mean us  p50 us  p99 us  iterations\n");
+  for (int m = 0; m < 2; m++) {
+    Mpc &mpc = mpcs[m];
+    mpc.init();
+    mpc.set_weights(1.0, 1.0, 1.0);
+    mpc.set_solver_options(dt, 50, 0.005);
+
+    state_t s = {};
+    std::vector<double> times;
+    int iterations = 0;
+    for (int f = 0; f < frames; f++) {
+      double v = 5. + 12.5 * (1. + sin(0.01 * f));
+      double curvature = 0.01 * sin(0.03 * f) + (f % 400 > 150 && f % 400 < 200 ? 0.03 : 0.);
+      double offset = 0.5 * sin(0.05 * f);
+      double target_y[N+1], target_psi[N+1];
+      for (int i = 0; i <= N; i++) {
+        double d = v * T_IDXS[i];
+        target_y[i] = offset + 0.5 * curvature * d * d;
+        target_psi[i] = curvature * d;
+      }
+
+      log_t l;
+      auto start = std::chrono::steady_clock::now();
+      iterations += mpc.run_mpc(&s, &l, v, 0., target_y, target_psi);
+      times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+      plans[m].push_back(l);
+
+      s.tire_angle = l.curvature[0] + dt * l.curvature_rate[0];
+    }
+
+    double mean = 0.;
+    for (double t : times) mean += t / frames;
+    std::sort(times.begin(), times.end());
+    printf("%-9s  %7.1f  %6.1f  %6.1f  %10.2f\n", names[m], mean, times[frames / 2], times[frames * 99 / 100],
+           (double)iterations / frames);
+  }
+
+  double dy = 0., dcurvature = 0.;
+  for (int f = 0; f < frames; f++) {
+    for (int i = 0; i <= N; i++) {
+      dy = fmax(dy, fabs(plans[0][f].y[i] - plans[1][f].y[i]));
+      dcurvature = fmax(dcurvature, fabs(plans[0][f].curvature[i] - plans[1][f].curvature[i]));
+    }
+  }
+  printf("max difference y %.3g, curvature %.3g\n", dy, dcurvature);
+}
@@ -0,0 +1,359 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "INCLUDE/QProblem.hpp"
+
+#include "common/modeldata.h"
+
+#ifdef __aarch64__
+#include <arm_neon.h>
+#endif
+
+//
+// The lateral mpc of lateral_mpc.c, as a condensed QP of compile time size
+//
+// The OCP of generator.cpp: multiple shooting on the nodes of T_IDXS, Gauss-Newton Hessian of the
+// least squares costs and one QP per call. The states are eliminated for the controls, the QP in
+// the N controls is dense, with the bounds of psi and curvature of the nodes 1..N as constraints.
+// The intervals are integrated over the same times as in the export, with RK4 steps of up to
+// MAX_STEP instead of INTEGRATOR_STEP. The products of the condensing are on rows of the N
+// controls, with NEON on aarch64.
+//
+
+constexpr int NX = 4;
+constexpr int NU = 1;
+constexpr int N = LAT_MPC_N;
+constexpr int NV = NU * N;
+constexpr int NC = 2 * N;
+static_assert(NV % 2 == 0, "the kernels are on pairs of doubles");
+
+// Of the export, every interval is integrated over a multiple of its step
+constexpr double INTEGRATOR_STEP = 0.0025;
+constexpr double MAX_STEP = 0.05;
+constexpr int STEP_MULTIPLIER = 3;
+
+constexpr double PSI_MAX = 90. / 180. * M_PI;
+constexpr double CURVATURE_MAX = 50. / 180. * M_PI;
+
+extern "C" {
+
+typedef struct {
+  double x, y, psi, tire_angle, tire_angle_rate;
+} state_t;
+
+typedef struct {
+  double x[N+1];
+  double y[N+1];
+  double psi[N+1];
+  double curvature[N+1];
+  double curvature_rate[N];
+  double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
+} log_t;
+
+}
+
+// Diagonal weights, of set_weights
+static double w_path[N + 1], w_heading[N + 1], w_rate[N];
+
+// The solution, states and controls of the nodes
+static double xs[NX * (N + 1)];
+static double us[NU * N];
+
+// Solver options, of set_solver_options
+static double warm_start_dt = 0.0;
+static int nwsr_max = QPOASES_NWSRMAX;
+static double time_max = 0.0;
+
+// The linearization of the last solve, the solution when the QP solve fails
+static double warm_x[NX * (N + 1)];
+static double warm_u[NU * N];
+
+// Of the QP solves, as in acado_qpoases_interface.cpp
+static double iteration_time = 0.0;
+static int budget_exceeded = 0;
+static double duals[NV + NC], duals_solved[NV + NC];
+
+// The condensed QP
+static double G[N + 1][NX][NV];
+static double c[N + 1][NX];
+static double H[NV * NV], g[NV], A[NC * NV], lbA[NC], ubA[NC];
+
+static double seconds_since_boot() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+// y += s * x, of rows of NV values
+static inline void axpy(double *__restrict y, double s, const double *__restrict x) {
+#ifdef __aarch64__
+  const float64x2_t vs = vdupq_n_f64(s);
+  for (int i = 0; i < NV; i += 2) {
+    vst1q_f64(y + i, vfmaq_f64(vld1q_f64(y + i), vld1q_f64(x + i), vs));
+  }
+#else
+  for (int i = 0; i < NV; i++) y[i] += s * x[i];
+#endif
+}
+
+// H += w * a * a^T, of a row that is zero from n on
+static inline void rank1(double w, const double *a, int n) {
+  for (int i = 0; i < n; i++) {
+    if (a[i] != 0.) axpy(&H[i * NV], w * a[i], a);
+  }
+}
+
+// The state, the sensitivities to the state (NX x NX) and to the control, and their derivatives
+static void derivatives(double v, double u, const double *in, double *out) {
+  const double sin_psi = sin(in[2]), cos_psi = cos(in[2]);
+  out[0] = v * cos_psi;
+  out[1] = v * sin_psi;
+  out[2] = v * in[3];
+  out[3] = u;
+  // the columns of Phi then Gamma, the rows of the jacobian of the state are only on psi and curvature
+  for (int j = 0; j < NX + NU; j++) {
+    const double *m = &in[NX + j * NX];
+    double *dm = &out[NX + j * NX];
+    dm[0] = -v * sin_psi * m[2];
+    dm[1] = v * cos_psi * m[2];
+    dm[2] = v * m[3];
+    dm[3] = j == NX ? 1. : 0.;
+  }
+}
+
+// The end of an interval from x with u, with the jacobians to x and to u
+static void simulate(int k, double v, const double *x, double u, double *x_end, double (*Ax)[NX], double *Bu) {
+  constexpr int NZ = NX * (1 + NX + NU);
+  const double T = round((T_IDXS[k+1] - T_IDXS[k]) / INTEGRATOR_STEP) * INTEGRATOR_STEP;
+  const int steps = (int)ceil(T / MAX_STEP);
+  const double h = T / steps;
+
+  double z[NZ] = {}, k1[NZ], k2[NZ], k3[NZ], k4[NZ], tmp[NZ];
+  memcpy(z, x, NX * sizeof(double));
+  for (int i = 0; i < NX; i++) z[NX + i * NX + i] = 1.;
+
+  for (int s = 0; s < steps; s++) {
+    derivatives(v, u, z, k1);
+    for (int i = 0; i < NZ; i++) tmp[i] = z[i] + 0.5 * h * k1[i];
+    derivatives(v, u, tmp, k2);
+    for (int i = 0; i < NZ; i++) tmp[i] = z[i] + 0.5 * h * k2[i];
+    derivatives(v, u, tmp, k3);
+    for (int i = 0; i < NZ; i++) tmp[i] = z[i] + h * k3[i];
+    derivatives(v, u, tmp, k4);
+    for (int i = 0; i < NZ; i++) z[i] += h / 6. * (k1[i] + 2. * k2[i] + 2. * k3[i] + k4[i]);
+  }
+
+  memcpy(x_end, z, NX * sizeof(double));
+  for (int i = 0; i < NX; i++) {
+    for (int j = 0; j < NX; j++) Ax[i][j] = z[NX + j * NX + i];
+    Bu[i] = z[NX + NX * NX + i];
+  }
+}
+
+// 1/2 of the weighted squares of the residuals of the solution
+static double objective(double v, const double *target_y, const double *target_psi) {
+  double cost = 0.;
+  for (int k = 0; k <= N; k++) {
+    const double s = k < N ? v + 5.0 : 2.0 * v + 5.0;
+    const double ry = xs[k*NX+1] - target_y[k];
+    const double rpsi = s * (xs[k*NX+2] - target_psi[k]);
+    cost += w_path[k] * ry * ry + w_heading[k] * rpsi * rpsi;
+    if (k < N) {
+      const double ru = (v + 5.0) * 4.0 * us[k];
+      cost += w_rate[k] * ru * ru;
+    }
+  }
+  return 0.5 * cost;
+}
+
+/* The last solution at the node times dt later, the states are linear and the controls
+   constant in the intervals, past the horizon the last interval is extrapolated */
+static void shift_solution(const double *t_nodes, double dt) {
+  int k = 0;
+  for (int i = 0; i <= N; i++) {
+    double t = t_nodes[i] + dt;
+    while (k < N - 1 && t_nodes[k+1] <= t) k++;
+    double f = (t - t_nodes[k]) / (t_nodes[k+1] - t_nodes[k]);
+    for (int j = 0; j < NX; j++) {
+      warm_x[i*NX+j] = (1.0 - f) * xs[k*NX+j] + f * xs[(k+1)*NX+j];
+    }
+    if (i < N) {
+      for (int j = 0; j < NU; j++) {
+        warm_u[i*NU+j] = us[k*NU+j];
+      }
+    }
+  }
+}
+
+// The QP of the controls around xs, us, with the states from x0
+static void condense(double v, const double *x0, const double *target_y, const double *target_psi) {
+  memset(G, 0, sizeof(G));
+  for (int i = 0; i < NX; i++) c[0][i] = x0[i] - xs[i];
+
+  for (int k = 0; k < N; k++) {
+    double x_end[NX], Ax[NX][NX], Bu[NX];
+    simulate(k, v, &xs[k*NX], us[k], x_end, Ax, Bu);
+    for (int i = 0; i < NX; i++) {
+      c[k+1][i] = x_end[i] - xs[(k+1)*NX+i];
+      for (int j = 0; j < NX; j++) {
+        c[k+1][i] += Ax[i][j] * c[k][j];
+        if (k > 0) axpy(G[k+1][i], Ax[i][j], G[k][j]);
+      }
+      G[k+1][i][k] += Bu[i];
+    }
+  }
+
+  memset(H, 0, sizeof(H));
+  memset(g, 0, sizeof(g));
+  for (int k = 0; k <= N; k++) {
+    // the costs of y and psi, on the states of the controls before k
+    const double s = k < N ? v + 5.0 : 2.0 * v + 5.0;
+    const double ry = xs[k*NX+1] + c[k][1] - target_y[k];
+    const double rpsi = s * (xs[k*NX+2] + c[k][2] - target_psi[k]);
+    double psi_row[NV];
+    for (int j = 0; j < NV; j++) psi_row[j] = s * G[k][2][j];
+    rank1(w_path[k], G[k][1], k);
+    rank1(w_heading[k], psi_row, k);
+    axpy(g, w_path[k] * ry, G[k][1]);
+    axpy(g, w_heading[k] * rpsi, psi_row);
+
+    if (k < N) {
+      const double su = (v + 5.0) * 4.0;
+      H[k * NV + k] += w_rate[k] * su * su;
+      g[k] += w_rate[k] * su * su * us[k];
+    }
+  }
+
+  for (int k = 1; k <= N; k++) {
+    const int r = 2 * (k - 1);
+    memcpy(&A[r * NV], G[k][2], NV * sizeof(double));
+    memcpy(&A[(r + 1) * NV], G[k][3], NV * sizeof(double));
+    lbA[r] = -PSI_MAX - (xs[k*NX+2] + c[k][2]);
+    ubA[r] = PSI_MAX - (xs[k*NX+2] + c[k][2]);
+    lbA[r + 1] = -CURVATURE_MAX - (xs[k*NX+3] + c[k][3]);
+    ubA[r + 1] = CURVATURE_MAX - (xs[k*NX+3] + c[k][3]);
+  }
+}
+
+// The QP solve, with the budget of acado_solve, the steps of the controls in du
+static int solve(double *du, int *nwsr) {
+  // After a solve stopped by the budget the next one has no budget
+  *nwsr = budget_exceeded ? QPOASES_NWSRMAX : nwsr_max;
+  if (!budget_exceeded && time_max > 0. && iteration_time > 0. && time_max < (*nwsr + 1) * iteration_time) {
+    *nwsr = fmax((int)(time_max / iteration_time) - 1, 1);
+  }
+
+  QProblem qp(NV, NC);
+  double start = seconds_since_boot();
+  returnValue ret = qp.init(H, g, A, 0, 0, lbA, ubA, *nwsr, duals);
+  double t = seconds_since_boot() - start;
+  budget_exceeded = ret == RET_MAX_NWSR_REACHED;
+
+  double it = t / (*nwsr + 1);
+  iteration_time = iteration_time > 0. ? 0.9 * iteration_time + 0.1 * it : it;
+
+  qp.getPrimalSolution(du);
+  qp.getDualSolution(duals);
+
+  // The duals of an unfinished solve are no guess of the working set of the next one
+  if (ret == SUCCESSFUL_RETURN) {
+    memcpy(duals_solved, duals, sizeof(duals));
+  } else {
+    memcpy(duals, duals_solved, sizeof(duals));
+  }
+  return ret;
+}
+
+extern "C" {
+
+void set_weights(double pathCost, double headingCost, double steerRateCost) {
+  for (int i = 0; i < N; i++) {
+    double f = 20 * (T_IDXS[i+1] - T_IDXS[i]);
+    w_path[i] = pathCost * f;
+    w_heading[i] = headingCost * f;
+    w_rate[i] = steerRateCost * f;
+  }
+  w_path[N] = pathCost * STEP_MULTIPLIER;
+  w_heading[N] = headingCost * STEP_MULTIPLIER;
+}
+
+void init() {
+  memset(xs, 0, sizeof(xs));
+  memset(us, 0, sizeof(us));
+  memset(duals, 0, sizeof(duals));
+  memset(duals_solved, 0, sizeof(duals_solved));
+  budget_exceeded = 0;
+}
+
+/* dt        = time between the solves, the last solution shifted by it is the start of the next solve,
+               0 to start from the last solution as is
+   max_nwsr  = maximum number of active set changes of the QP solve, at most QPOASES_NWSRMAX
+   max_time  = time in seconds for the QP solve, no limit if 0 */
+void set_solver_options(double dt, int max_nwsr, double max_time) {
+  warm_start_dt = dt;
+  nwsr_max = max_nwsr > 0 && max_nwsr < QPOASES_NWSRMAX ? max_nwsr : QPOASES_NWSRMAX;
+  time_max = max_time;
+}
+
+int run_mpc(state_t *x0, log_t *solution, double v_ego,
+            double rotation_radius, double target_y[N+1], double target_psi[N+1]) {
+  // as in lateral_mpc.c the rotation radius is not in the model
+  (void)rotation_radius;
+
+  // The states of the last solve are in the frame of the car of then, at dt it is at the first node
+  shift_solution(T_IDXS, warm_start_dt);
+  double x_0 = warm_x[0], y_0 = warm_x[1], psi_0 = warm_x[2];
+  for (int i = 0; i <= N; i++) {
+    double dx = warm_x[i*NX] - x_0;
+    double dy = warm_x[i*NX+1] - y_0;
+    warm_x[i*NX] = cos(psi_0) * dx + sin(psi_0) * dy;
+    warm_x[i*NX+1] = -sin(psi_0) * dx + cos(psi_0) * dy;
+    warm_x[i*NX+2] -= psi_0;
+  }
+  memcpy(xs, warm_x, sizeof(warm_x));
+  memcpy(us, warm_u, sizeof(warm_u));
+
+  const double x_init[NX] = {x0->x, x0->y, x0->psi, x0->tire_angle};
+  double start = seconds_since_boot();
+  condense(v_ego, x_init, target_y, target_psi);
+  double du[NV];
+  int nwsr;
+  int status = solve(du, &nwsr);
+  solution->solve_time = seconds_since_boot() - start;
+
+  // Of a QP solve stopped by the budget or failed the start of the solve is kept
+  solution->budget_exceeded = budget_exceeded;
+  solution->fallback = status != SUCCESSFUL_RETURN;
+  if (!solution->fallback) {
+    for (int k = 0; k <= N; k++) {
+      for (int i = 0; i < NX; i++) {
+        double dx = c[k][i];
+        for (int j = 0; j < k; j++) dx += G[k][i][j] * du[j];
+        xs[k*NX+i] += dx;
+      }
+      if (k < N) us[k] += du[k];
+    }
+  }
+
+  for (int i = 0; i <= N; i++) {
+    solution->x[i] = xs[i*NX];
+    solution->y[i] = xs[i*NX+1];
+    solution->psi[i] = xs[i*NX+2];
+    solution->curvature[i] = xs[i*NX+3];
+    if (i < N) {
+      solution->curvature_rate[i] = us[i];
+    }
+  }
+  solution->cost = objective(v_ego, target_y, target_psi);
+  solution->iterations = nwsr;
+
+  // The states are shifted at the next solve, by the time the solution is for then
+  return solution->iterations;
+}
+
+}
@@ -2,6 +2,9 @@
 #include "acado_auxiliary_functions.h"
 #include "common/modeldata.h"
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
 
 #define NX          ACADO_NX  /* Number of differential state variables.  */
 #define NXA         ACADO_NXA /* Number of algebraic variables. */
@@ -27,8 +30,44 @@ typedef struct {
   double curvature[N+1];
   double curvature_rate[N];
   double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
 } log_t;
 
+// Solver options, of set_solver_options
+static double warm_start_dt = 0.0;
+
+// The linearization of the last solve, the solution when the QP solve fails
+static double warm_x[NX * (N + 1)];
+static double warm_u[NU * N];
+
+static double seconds_since_boot(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/* The last solution at the node times dt later, the states are linear and the controls
+   constant in the intervals, past the horizon the last interval is extrapolated */
+static void shift_solution(const double *t_nodes, double dt){
+  int i, j, k = 0;
+  for (i = 0; i <= N; i++){
+    double t = t_nodes[i] + dt;
+    while (k < N - 1 && t_nodes[k+1] <= t) k++;
+    double f = (t - t_nodes[k]) / (t_nodes[k+1] - t_nodes[k]);
+    for (j = 0; j < NX; j++){
+      warm_x[i*NX+j] = (1.0 - f) * acadoVariables.x[k*NX+j] + f * acadoVariables.x[(k+1)*NX+j];
+    }
+    if (i < N){
+      for (j = 0; j < NU; j++){
+        warm_u[i*NU+j] = acadoVariables.u[k*NU+j];
+      }
+    }
+  }
+}
+
 void set_weights(double pathCost, double headingCost, double steerRateCost){
   int    i;
   const int STEP_MULTIPLIER = 3.0;
@@ -60,6 +99,15 @@ void init(){
   for (i = 0; i < NX; ++i) acadoVariables.x0[ i ] = 0.0;
 }
 
+/* dt        = time between the solves, the last solution shifted by it is the start of the next solve,
+               0 to start from the last solution as is
+   max_nwsr  = maximum number of active set changes of the QP solve, at most QPOASES_NWSRMAX
+   max_time  = time in seconds for the QP solve, no limit if 0 */
+void set_solver_options(double dt, int max_nwsr, double max_time){
+  warm_start_dt = dt;
+  acado_setBudget(max_nwsr, max_time);
+}
+
 int run_mpc(state_t * x0, log_t * solution, double v_ego,
              double rotation_radius, double target_y[N+1], double target_psi[N+1]){
 
@@ -82,9 +130,31 @@ int run_mpc(state_t * x0, log_t * solution, double v_ego,
   acadoVariables.x0[2] = x0->psi;
   acadoVariables.x0[3] = x0->tire_angle;
 
+  // The states of the last solve are in the frame of the car of then, at dt it is at the first node
+  shift_solution(T_IDXS, warm_start_dt);
+  double x_0 = warm_x[0], y_0 = warm_x[1], psi_0 = warm_x[2];
+  for (i = 0; i <= N; i++){
+    double dx = warm_x[i*NX] - x_0;
+    double dy = warm_x[i*NX+1] - y_0;
+    warm_x[i*NX] = cos(psi_0) * dx + sin(psi_0) * dy;
+    warm_x[i*NX+1] = -sin(psi_0) * dx + cos(psi_0) * dy;
+    warm_x[i*NX+2] -= psi_0;
+  }
+  memcpy(acadoVariables.x, warm_x, sizeof(warm_x));
+  memcpy(acadoVariables.u, warm_u, sizeof(warm_u));
 
+  double start = seconds_since_boot();
   acado_preparationStep();
-  acado_feedbackStep();
+  int status = acado_feedbackStep();
+  solution->solve_time = seconds_since_boot() - start;
+
+  // Of a QP solve stopped by the budget or failed the start of the solve is kept
+  solution->budget_exceeded = acado_getBudgetExceeded();
+  solution->fallback = status != 0;
+  if (solution->fallback){
+    memcpy(acadoVariables.x, warm_x, sizeof(warm_x));
+    memcpy(acadoVariables.u, warm_u, sizeof(warm_u));
+  }
 
   /* printf("lat its: %d\n", acado_getNWSR());  // n iterations
   printf("Objective: %.6f\n", acado_getObjective());  // solution cost */
@@ -99,11 +169,8 @@ int run_mpc(state_t * x0, log_t * solution, double v_ego,
     }
   }
   solution->cost = acado_getObjective();
+  solution->iterations = acado_getNWSR();
 
-  // Dont shift states here. Current solution is closer to next timestep than if
-  // we use the old solution as a starting point
-  //acado_shiftStates(2, 0, 0);
-  //acado_shiftControls( 0 );
-
-  return acado_getNWSR();
+  // The states are shifted at the next solve, by the time the solution is for then
+  return solution->iterations;
 }
@@ -4,7 +4,8 @@ from cffi import FFI
 from common.ffi_wrapper import suffix
 
 mpc_dir = os.path.dirname(os.path.abspath(__file__))
-libmpc_fn = os.path.join(mpc_dir, "libmpc"+suffix())
+# The condensed QP of condensed_mpc.cpp instead of the ACADO export
+libmpc_fn = os.path.join(mpc_dir, ("libmpc_condensed" if os.getenv("LAT_MPC_CONDENSED") else "libmpc") + suffix())
 
 ffi = FFI()
 ffi.cdef("""
@@ -20,10 +21,15 @@ typedef struct {
     double curvature[N+1];
     double curvature_rate[N];
     double cost;
+    int iterations;
+    int budget_exceeded;
+    int fallback;
+    double solve_time;
 } log_t;
 
 void init();
 void set_weights(double pathCost, double headingCost, double steerRateCost);
+void set_solver_options(double dt, int max_nwsr, double max_time);
 int run_mpc(state_t * x0, log_t * solution,
              double v_ego, double rotation_radius,
              double target_y[N+1], double target_psi[N+1]);
@@ -6,7 +6,7 @@ from common.realtime import sec_since_boot, DT_MDL
 from common.numpy_fast import interp
 from selfdrive.swaglog import cloudlog
 from selfdrive.controls.lib.lateral_mpc import libmpc_py
-from selfdrive.controls.lib.drive_helpers import CONTROL_N, MPC_COST_LAT, LAT_MPC_N, CAR_ROTATION_RADIUS
+from selfdrive.controls.lib.drive_helpers import CONTROL_N, MPC_COST_LAT, MPC_SOLVER, LAT_MPC_N, CAR_ROTATION_RADIUS
 from selfdrive.controls.lib.lane_planner import LanePlanner, TRAJECTORY_SIZE
 from selfdrive.config import Conversions as CV
 import cereal.messaging as messaging
@@ -93,6 +93,7 @@ class LateralPlanner():
   def setup_mpc(self):
     self.libmpc = libmpc_py.libmpc
     self.libmpc.init()
+    self.libmpc.set_solver_options(MPC_SOLVER.WARM_START_DT, MPC_SOLVER.MAX_NWSR, MPC_SOLVER.MAX_TIME)
 
     self.mpc_solution = libmpc_py.ffi.new("log_t *")
     self.cur_state = libmpc_py.ffi.new("state_t *")
@@ -323,6 +324,10 @@ class LateralPlanner():
     plan_send.lateralPlan.vCurvature = float(sm['controlsState'].curvature)
     plan_send.lateralPlan.lanelessMode = bool(self.laneless_mode_status)
 
+    plan_send.lateralPlan.solverIterations = int(self.mpc_solution[0].iterations)
+    plan_send.lateralPlan.solverExecutionTime = float(self.mpc_solution[0].solve_time)
+    plan_send.lateralPlan.solverBudgetExceeded = bool(self.mpc_solution[0].budget_exceeded)
+
     if self.stand_still:
       self.standstill_elapsed_time += DT_MDL
     else:
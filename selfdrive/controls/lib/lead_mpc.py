@@ -5,7 +5,7 @@ from common.realtime import sec_since_boot
 from selfdrive.modeld.constants import T_IDXS
 from selfdrive.controls.lib.radar_helpers import _LEAD_ACCEL_TAU
 from selfdrive.controls.lib.lead_mpc_lib import libmpc_py
-from selfdrive.controls.lib.drive_helpers import MPC_COST_LONG, CONTROL_N
+from selfdrive.controls.lib.drive_helpers import MPC_COST_LONG, MPC_SOLVER, CONTROL_N
 from selfdrive.swaglog import cloudlog
 from common.params import Params
 from decimal import Decimal
@@ -36,6 +36,9 @@ class LeadMpc():
     self.cruise_gap3 = float(Decimal(Params().get("CruiseGap3", encoding="utf8")) * Decimal('0.1'))
     self.cruise_gap4 = float(Decimal(Params().get("CruiseGap4", encoding="utf8")) * Decimal('0.1'))
 
+    self.a_lead = 0.0
+    self.TR = 1.8
+
     self.dynamic_TR = 0
     self.dynamic_TR_mode = int(Params().get("DynamicTR", encoding="utf8"))
 
@@ -43,6 +46,7 @@ class LeadMpc():
     ffi, self.libmpc = libmpc_py.get_libmpc(self.lead_id)
     self.libmpc.init(MPC_COST_LONG.TTC, MPC_COST_LONG.DISTANCE,
                      MPC_COST_LONG.ACCELERATION, MPC_COST_LONG.JERK)
+    self.libmpc.set_solver_options(MPC_SOLVER.WARM_START_DT, MPC_SOLVER.MAX_NWSR, MPC_SOLVER.MAX_TIME)
 
     self.mpc_solution = ffi.new("log_t *")
     self.cur_state = ffi.new("state_t *")
@@ -57,6 +61,14 @@ class LeadMpc():
     self.cur_state[0].a_ego = a_safe
 
   def update(self, CS, radarstate, v_cruise):
+    self.setup(CS, radarstate)
+
+    # Calculate mpc
+    t = sec_since_boot()
+    self.n_its = self.libmpc.run_mpc(self.cur_state, self.mpc_solution, self.a_lead_tau, self.a_lead, self.TR)
+    self.finish(CS, t)
+
+  def setup(self, CS, radarstate):
     v_ego = CS.vEgo
     if self.lead_id == 0:
       lead = radarstate.leadOne
@@ -107,10 +119,11 @@ class LeadMpc():
     elif self.dynamic_TR_mode == 4:
       TR = interp(float(cruise_gap), [1., 2., 3., 4.], [self.cruise_gap1, self.cruise_gap2, self.cruise_gap3, self.dynamic_TR])
 
+    self.a_lead = a_lead
+    self.TR = TR
 
-    # Calculate mpc
-    t = sec_since_boot()
-    self.n_its = self.libmpc.run_mpc(self.cur_state, self.mpc_solution, self.a_lead_tau, a_lead, TR)
+  def finish(self, CS, t):
+    v_ego = CS.vEgo
     self.v_solution = interp(T_IDXS[:CONTROL_N], MPC_T, self.mpc_solution.v_ego)
     self.a_solution = interp(T_IDXS[:CONTROL_N], MPC_T, self.mpc_solution.a_ego)
     self.j_solution = interp(T_IDXS[:CONTROL_N], MPC_T[:-1], self.mpc_solution.j_ego)
@@ -133,3 +146,17 @@ class LeadMpc():
       self.cur_state[0].a_ego = 0.0
       self.a_mpc = CS.aEgo
       self.prev_lead_status = False
+
+
+def update_leads(mpcs, CS, radarstate):
+  """The update of the mpcs of the leads, solved at once"""
+  for mpc in mpcs:
+    mpc.setup(CS, radarstate)
+
+  t = sec_since_boot()
+  n_its = libmpc_py.run_mpc_batch([mpc.libmpc for mpc in mpcs], [mpc.cur_state for mpc in mpcs],
+                                  [mpc.mpc_solution for mpc in mpcs], [mpc.a_lead_tau for mpc in mpcs],
+                                  [mpc.a_lead for mpc in mpcs], [mpc.TR for mpc in mpcs])
+  for mpc, n in zip(mpcs, n_its):
+    mpc.n_its = n
+    mpc.finish(CS, t)
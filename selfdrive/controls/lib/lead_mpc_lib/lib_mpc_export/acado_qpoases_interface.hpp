@@ -59,6 +59,15 @@ EXTERNC int acado_solve( void );
 /** Get the number of active set changes */
 EXTERNC int acado_getNWSR( void );
 
+/** Set the maximum number of active set changes and the time of a QP solve, no time limit if cputime <= 0 */
+EXTERNC void acado_setBudget( int nWSR, real_t cputime );
+
+/** Get the time of the last QP solve in seconds */
+EXTERNC real_t acado_getCPUTime( void );
+
+/** Whether the last QP solve stopped at the maximum number of active set changes */
+EXTERNC int acado_getBudgetExceeded( void );
+
 /** Get the error string. */
 const char* acado_getErrorString( int error );
 
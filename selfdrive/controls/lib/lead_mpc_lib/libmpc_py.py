@@ -4,39 +4,75 @@ from cffi import FFI
 from common.ffi_wrapper import suffix
 
 mpc_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)))
+libmpc_fn = os.path.join(mpc_dir, "libmpc" + suffix())
 
-def _get_libmpc(mpc_id):
-    libmpc_fn = os.path.join(mpc_dir, "libmpc%d%s" % (mpc_id, suffix()))
+ffi = FFI()
+ffi.cdef("""
+typedef struct {
+double x_ego, v_ego, a_ego, x_l, v_l, a_l;
+} state_t;
 
-    ffi = FFI()
-    ffi.cdef("""
-    typedef struct {
-    double x_ego, v_ego, a_ego, x_l, v_l, a_l;
-    } state_t;
 
+typedef struct {
+double x_ego[21];
+double v_ego[21];
+double a_ego[21];
+double j_ego[20];
+double x_l[21];
+double v_l[21];
+double a_l[21];
+double t[21];
+double cost;
+int iterations;
+int budget_exceeded;
+int fallback;
+double solve_time;
+} log_t;
 
-    typedef struct {
-    double x_ego[21];
-    double v_ego[21];
-    double a_ego[21];
-    double j_ego[20];
-    double x_l[21];
-    double v_l[21];
-    double a_l[21];
-    double t[21];
-    double cost;
-    } log_t;
+void *lead_mpc_create();
+void lead_mpc_destroy(void *m);
+void lead_mpc_init(void *m, double ttcCost, double distanceCost, double accelerationCost, double jerkCost);
+void lead_mpc_init_with_simulation(void *m, double v_ego, double x_l, double v_l, double a_l, double l);
+void lead_mpc_change_costs(void *m, double ttcCost, double distanceCost, double accelerationCost, double jerkCost);
+void lead_mpc_set_solver_options(void *m, double dt, int max_nwsr, double max_time);
+int lead_mpc_run(void *m, state_t * x0, log_t * solution,
+                 double l, double a_l_0, double TR);
+void lead_mpc_run_batch(int n, void **m, state_t **x0, log_t **solution,
+                        const double *l, const double *a_l_0, const double *TR, int *nwsr);
+""")
 
-    void init(double ttcCost, double distanceCost, double accelerationCost, double jerkCost);
-    void init_with_simulation(double v_ego, double x_l, double v_l, double a_l, double l);
-    void change_costs(double ttcCost, double distanceCost, double accelerationCost, double jerkCost);
-    int run_mpc(state_t * x0, log_t * solution,
-                double l, double a_l_0, double TR);
-    """)
+libmpc = ffi.dlopen(libmpc_fn)
 
-    return (ffi, ffi.dlopen(libmpc_fn))
 
-mpcs = [_get_libmpc(0), _get_libmpc(1)]
+class LeadMpcSolver():
+  """The mpc of a lead, with the functions of a library of its own"""
+  def __init__(self):
+    self.m = ffi.gc(libmpc.lead_mpc_create(), libmpc.lead_mpc_destroy)
+
+  def init(self, ttcCost, distanceCost, accelerationCost, jerkCost):
+    libmpc.lead_mpc_init(self.m, ttcCost, distanceCost, accelerationCost, jerkCost)
+
+  def init_with_simulation(self, v_ego, x_l, v_l, a_l, l):
+    libmpc.lead_mpc_init_with_simulation(self.m, v_ego, x_l, v_l, a_l, l)
+
+  def change_costs(self, ttcCost, distanceCost, accelerationCost, jerkCost):
+    libmpc.lead_mpc_change_costs(self.m, ttcCost, distanceCost, accelerationCost, jerkCost)
+
+  def set_solver_options(self, dt, max_nwsr, max_time):
+    libmpc.lead_mpc_set_solver_options(self.m, dt, max_nwsr, max_time)
+
+  def run_mpc(self, x0, solution, l, a_l_0, TR):
+    return libmpc.lead_mpc_run(self.m, x0, solution, l, a_l_0, TR)
+
+
+def run_mpc_batch(solvers, x0s, solutions, ls, a_l_0s, TRs):
+  """The solves of the mpcs of several leads at once, in threads of the library"""
+  nwsr = ffi.new("int[]", len(solvers))
+  libmpc.lead_mpc_run_batch(len(solvers), [s.m for s in solvers], x0s, solutions, ls, a_l_0s, TRs, nwsr)
+  return list(nwsr)
+
+
+mpcs = [LeadMpcSolver(), LeadMpcSolver()]
 
 def get_libmpc(mpc_id):
-    return mpcs[mpc_id]
+    return (ffi, mpcs[mpc_id])
@@ -1,8 +1,12 @@
-#include "acado_common.h"
+#include "mpc_context.h"
 #include "acado_auxiliary_functions.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #define NX          ACADO_NX  /* Number of differential state variables.  */
 #define NXA         ACADO_NXA /* Number of algebraic variables. */
@@ -14,8 +18,8 @@
 
 #define N           ACADO_N   /* Number of intervals in the horizon. */
 
-ACADOvariables acadoVariables;
-ACADOworkspace acadoWorkspace;
+// The solver of the thread, see mpc_context.h
+__thread mpc_context *mpc_ctx;
 
 typedef struct {
   double x_ego, v_ego, a_ego, x_l, v_l, a_l;
@@ -32,9 +36,38 @@ typedef struct {
   double a_l[N+1];
   double t[N+1];
   double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
 } log_t;
 
-void init(double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
+static double seconds_since_boot(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/* The last solution at the node times dt later, the states are linear and the controls
+   constant in the intervals, past the horizon the last interval is extrapolated */
+static void shift_solution(const double *t_nodes, double dt){
+  int i, j, k = 0;
+  for (i = 0; i <= N; i++){
+    double t = t_nodes[i] + dt;
+    while (k < N - 1 && t_nodes[k+1] <= t) k++;
+    double f = (t - t_nodes[k]) / (t_nodes[k+1] - t_nodes[k]);
+    for (j = 0; j < NX; j++){
+      warm_x[i*NX+j] = (1.0 - f) * acadoVariables.x[k*NX+j] + f * acadoVariables.x[(k+1)*NX+j];
+    }
+    if (i < N){
+      for (j = 0; j < NU; j++){
+        warm_u[i*NU+j] = acadoVariables.u[k*NU+j];
+      }
+    }
+  }
+}
+
+static void init(double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
   acado_initializeSolver();
   int    i;
   const int STEP_MULTIPLIER = 3;
@@ -68,7 +101,16 @@ void init(double ttcCost, double distanceCost, double accelerationCost, double j
 
 }
 
-void change_costs(double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
+/* dt        = time between the solves, the last solution shifted by it is the start of the next solve,
+               0 to start from the last solution as is
+   max_nwsr  = maximum number of active set changes of the QP solve, at most QPOASES_NWSRMAX
+   max_time  = time in seconds for the QP solve, no limit if 0 */
+static void set_solver_options(double dt, int max_nwsr, double max_time){
+  warm_start_dt = dt;
+  acado_setBudget(max_nwsr, max_time);
+}
+
+static void change_costs(double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
   int    i;
   const int STEP_MULTIPLIER = 3;
 
@@ -87,7 +129,7 @@ void change_costs(double ttcCost, double distanceCost, double accelerationCost,
   acadoVariables.WN[8] = accelerationCost * STEP_MULTIPLIER; // acceleration
 }
 
-void init_with_simulation(double v_ego, double x_l_0, double v_l_0, double a_l_0, double l){
+static void init_with_simulation(double v_ego, double x_l_0, double v_l_0, double a_l_0, double l){
   int i;
 
   double x_l = x_l_0;
@@ -131,7 +173,7 @@ void init_with_simulation(double v_ego, double x_l_0, double v_l_0, double a_l_0
   for (i = 0; i < NYN; ++i)  acadoVariables.yN[ i ] = 0.0;
 }
 
-int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
+static int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
   // Calculate lead vehicle predictions
   int i;
   double t = 0.;
@@ -167,12 +209,34 @@ int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
     t += dt;
   }
 
-  acadoVariables.x[0] = acadoVariables.x0[0] = x0->x_ego;
-  acadoVariables.x[1] = acadoVariables.x0[1] = x0->v_ego;
-  acadoVariables.x[2] = acadoVariables.x0[2] = x0->a_ego;
+  // The positions of the last solve are from the ego position of then
+  shift_solution(solution->t, warm_start_dt);
+  double x_0 = warm_x[0];
+  for (i = 0; i <= N; i++){
+    warm_x[i*NX] -= x_0;
+  }
+  warm_x[0] = x0->x_ego;
+  warm_x[1] = x0->v_ego;
+  warm_x[2] = x0->a_ego;
+  memcpy(acadoVariables.x, warm_x, sizeof(warm_x));
+  memcpy(acadoVariables.u, warm_u, sizeof(warm_u));
+
+  acadoVariables.x0[0] = x0->x_ego;
+  acadoVariables.x0[1] = x0->v_ego;
+  acadoVariables.x0[2] = x0->a_ego;
 
+  double start = seconds_since_boot();
   acado_preparationStep(TR);
-  acado_feedbackStep();
+  int status = acado_feedbackStep();
+  solution->solve_time = seconds_since_boot() - start;
+
+  // Of a QP solve stopped by the budget or failed the start of the solve is kept
+  solution->budget_exceeded = acado_getBudgetExceeded();
+  solution->fallback = status != 0;
+  if (solution->fallback){
+    memcpy(acadoVariables.x, warm_x, sizeof(warm_x));
+    memcpy(acadoVariables.u, warm_u, sizeof(warm_u));
+  }
 
   for (i = 0; i <= N; i++){
     solution->x_ego[i] = acadoVariables.x[i*NX];
@@ -184,9 +248,135 @@ int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
     }
   }
   solution->cost = acado_getObjective(TR);
+  solution->iterations = acado_getNWSR();
+
+  // The states are shifted at the next solve, by the time the solution is for then
+  return solution->iterations;
+}
 
-  // Dont shift states here. Current solution is closer to next timestep than if
-  // we shift by 0.2 seconds.
+void *lead_mpc_create(){
+  mpc_context *ctx = (mpc_context *)calloc(1, sizeof(mpc_context));
+  ctx->nWSRMax = QPOASES_NWSRMAX;
+  return ctx;
+}
+
+void lead_mpc_destroy(void *m){
+  free(m);
+}
+
+void lead_mpc_init(void *m, double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
+  mpc_context_bind((mpc_context *)m);
+  init(ttcCost, distanceCost, accelerationCost, jerkCost);
+}
 
-  return acado_getNWSR();
+void lead_mpc_init_with_simulation(void *m, double v_ego, double x_l_0, double v_l_0, double a_l_0, double l){
+  mpc_context_bind((mpc_context *)m);
+  init_with_simulation(v_ego, x_l_0, v_l_0, a_l_0, l);
+}
+
+void lead_mpc_change_costs(void *m, double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
+  mpc_context_bind((mpc_context *)m);
+  change_costs(ttcCost, distanceCost, accelerationCost, jerkCost);
+}
+
+void lead_mpc_set_solver_options(void *m, double dt, int max_nwsr, double max_time){
+  mpc_context_bind((mpc_context *)m);
+  set_solver_options(dt, max_nwsr, max_time);
+}
+
+int lead_mpc_run(void *m, state_t * x0, log_t * solution, double l, double a_l_0, double TR){
+  mpc_context_bind((mpc_context *)m);
+  return run_mpc(x0, solution, l, a_l_0, TR);
+}
+
+// The solves of a batch but the first, each on a thread of its own
+#define MAX_BATCH 4
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int pending;
+
+  void *m;
+  state_t *x0;
+  log_t *solution;
+  double l, a_l_0, TR;
+  int nwsr;
+} worker_t;
+
+static worker_t workers[MAX_BATCH - 1];
+static int n_workers = 0;
+
+static void *worker_thread(void *arg){
+  worker_t *w = (worker_t *)arg;
+  pthread_mutex_lock(&w->lock);
+  while (1){
+    while (!w->pending) pthread_cond_wait(&w->cond, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+
+    int nwsr = lead_mpc_run(w->m, w->x0, w->solution, w->l, w->a_l_0, w->TR);
+
+    pthread_mutex_lock(&w->lock);
+    w->nwsr = nwsr;
+    w->pending = 0;
+    pthread_cond_broadcast(&w->cond);
+  }
+  return NULL;
+}
+
+/* The solves of n leads at once, the calls must be from one thread
+
+   Input arguments:
+     n              = number of mpcs
+     m              = n mpcs of lead_mpc_create
+     x0, solution   = n states and solutions, as of lead_mpc_run
+     l, a_l_0, TR   = n values of the leads
+   Output arguments:
+     nwsr           = n numbers of active set changes */
+void lead_mpc_run_batch(int n, void **m, state_t **x0, log_t **solution,
+                        const double *l, const double *a_l_0, const double *TR, int *nwsr){
+  int i, n_threads = n - 1 < MAX_BATCH - 1 ? n - 1 : MAX_BATCH - 1;
+
+  for (i = 0; i < n_threads; i++){
+    worker_t *w = &workers[i];
+    if (i == n_workers){
+      pthread_mutex_init(&w->lock, NULL);
+      pthread_cond_init(&w->cond, NULL);
+      if (pthread_create(&w->thread, NULL, worker_thread, w) != 0){
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        n_threads = i;
+        break;
+      }
+      n_workers++;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->m = m[i+1];
+    w->x0 = x0[i+1];
+    w->solution = solution[i+1];
+    w->l = l[i+1];
+    w->a_l_0 = a_l_0[i+1];
+    w->TR = TR[i+1];
+    w->pending = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  // the first and the ones without a thread here
+  if (n > 0){
+    nwsr[0] = lead_mpc_run(m[0], x0[0], solution[0], l[0], a_l_0[0], TR[0]);
+  }
+  for (i = n_threads + 1; i < n; i++){
+    nwsr[i] = lead_mpc_run(m[i], x0[i], solution[i], l[i], a_l_0[i], TR[i]);
+  }
+
+  for (i = 0; i < n_threads; i++){
+    worker_t *w = &workers[i];
+    pthread_mutex_lock(&w->lock);
+    while (w->pending) pthread_cond_wait(&w->cond, &w->lock);
+    nwsr[i+1] = w->nwsr;
+    pthread_mutex_unlock(&w->lock);
+  }
 }
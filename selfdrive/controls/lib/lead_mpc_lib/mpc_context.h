@@ -0,0 +1,62 @@
+#ifndef MPC_CONTEXT_H
+#define MPC_CONTEXT_H
+
+//
+// The state of a lead mpc, for solves of several leads at once in threads
+//
+// This header is included first in all sources of the mpc, the generated ones too. The globals
+// of the generated solver, of acado_qpoases_interface.cpp and of longitudinal_mpc.c are the
+// fields of the context of the thread, set with mpc_context_bind.
+//
+
+#include "acado_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  ACADOvariables variables;
+  ACADOworkspace workspace;
+
+  // longitudinal_mpc.c
+  double warm_start_dt;
+  double warm_x[ACADO_NX * (ACADO_N + 1)];
+  double warm_u[ACADO_NU * ACADO_N];
+
+  // acado_qpoases_interface.cpp
+  int nWSR;
+  int nWSRMax;
+  real_t cputimeMax;
+  real_t cputime;
+  real_t iterationTime;
+  int budgetExceeded;
+  real_t y[sizeof(((ACADOworkspace *)0)->y) / sizeof(real_t)];
+} mpc_context;
+
+extern __thread mpc_context *mpc_ctx;
+
+static inline void mpc_context_bind(mpc_context *ctx) {
+  mpc_ctx = ctx;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#define acadoVariables (mpc_ctx->variables)
+#define acadoWorkspace (mpc_ctx->workspace)
+
+#define warm_start_dt (mpc_ctx->warm_start_dt)
+#define warm_x (mpc_ctx->warm_x)
+#define warm_u (mpc_ctx->warm_u)
+
+#define acado_nWSR (mpc_ctx->nWSR)
+#define acado_nWSRMax (mpc_ctx->nWSRMax)
+#define acado_cputimeMax (mpc_ctx->cputimeMax)
+#define acado_cputime (mpc_ctx->cputime)
+#define acado_iterationTime (mpc_ctx->iterationTime)
+#define acado_budgetExceeded (mpc_ctx->budgetExceeded)
+#define acado_y (mpc_ctx->y)
+
+#endif
@@ -4,7 +4,7 @@ import math
 from selfdrive.swaglog import cloudlog
 from common.realtime import sec_since_boot
 from selfdrive.controls.lib.longitudinal_mpc_lib import libmpc_py
-from selfdrive.controls.lib.drive_helpers import LON_MPC_N
+from selfdrive.controls.lib.drive_helpers import LON_MPC_N, MPC_SOLVER
 from selfdrive.modeld.constants import T_IDXS
 
 
@@ -21,6 +21,7 @@ class LongitudinalMpc():
   def reset_mpc(self):
     self.libmpc = libmpc_py.libmpc
     self.libmpc.init(0.0, 1.0, 0.0, 50.0, 10000.0)
+    self.libmpc.set_solver_options(MPC_SOLVER.WARM_START_DT, MPC_SOLVER.MAX_NWSR, MPC_SOLVER.MAX_TIME)
 
     self.mpc_solution = libmpc_py.ffi.new("log_t *")
     self.cur_state = libmpc_py.ffi.new("state_t *")
@@ -24,11 +24,19 @@ extern "C"
 
 #include "INCLUDE/QProblem.hpp"
 
+#include <time.h>
+
 #if ACADO_COMPUTE_COVARIANCE_MATRIX == 1
 #include "INCLUDE/EXTRAS/SolutionAnalysis.hpp"
 #endif /* ACADO_COMPUTE_COVARIANCE_MATRIX */
 
 static int acado_nWSR;
+static int acado_nWSRMax = QPOASES_NWSRMAX;
+static real_t acado_cputimeMax = 0.0;
+static real_t acado_cputime;
+static real_t acado_iterationTime = 0.0;
+static int acado_budgetExceeded = 0;
+static real_t acado_y[sizeof(acadoWorkspace.y) / sizeof(real_t)];
 
 
 
@@ -36,16 +44,45 @@ static int acado_nWSR;
 static SolutionAnalysis acado_sa;
 #endif /* ACADO_COMPUTE_COVARIANCE_MATRIX */
 
+static real_t acado_time( void )
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
 int acado_solve( void )
 {
-	acado_nWSR = QPOASES_NWSRMAX;
+	/* After a solve stopped by the budget the next one has no budget, a solution is at most one solve late */
+	acado_nWSR = acado_budgetExceeded ? QPOASES_NWSRMAX : acado_nWSRMax;
+
+	/* With a time budget, at most the working set recalculations that fit in it at the time they took so far */
+	if (!acado_budgetExceeded && acado_cputimeMax > 0.0 && acado_iterationTime > 0.0 && acado_cputimeMax < (acado_nWSR + 1) * acado_iterationTime)
+	{
+		acado_nWSR = (int)(acado_cputimeMax / acado_iterationTime) - 1;
+		if (acado_nWSR < 1)
+			acado_nWSR = 1;
+	}
 
 	QProblem qp(68, 96);
 	
+	real_t start = acado_time();
 	returnValue retVal = qp.init(acadoWorkspace.H, acadoWorkspace.g, acadoWorkspace.A, acadoWorkspace.lb, acadoWorkspace.ub, acadoWorkspace.lbA, acadoWorkspace.ubA, acado_nWSR, acadoWorkspace.y);
+	acado_cputime = acado_time() - start;
+	acado_budgetExceeded = retVal == RET_MAX_NWSR_REACHED;
+
+	/* The setup of the QP counts as one recalculation */
+	real_t iterationTime = acado_cputime / (acado_nWSR + 1);
+	acado_iterationTime = acado_iterationTime > 0.0 ? 0.9 * acado_iterationTime + 0.1 * iterationTime : iterationTime;
 
     qp.getPrimalSolution( acadoWorkspace.x );
     qp.getDualSolution( acadoWorkspace.y );
+
+	/* The duals of an unfinished solve are no guess of the working set of the next one */
+	if (retVal == SUCCESSFUL_RETURN)
+		memcpy(acado_y, acadoWorkspace.y, sizeof(acado_y));
+	else
+		memcpy(acadoWorkspace.y, acado_y, sizeof(acado_y));
 	
 #if ACADO_COMPUTE_COVARIANCE_MATRIX == 1
 
@@ -64,6 +101,22 @@ int acado_getNWSR( void )
 	return acado_nWSR;
 }
 
+void acado_setBudget( int nWSR, real_t cputime )
+{
+	acado_nWSRMax = nWSR > 0 && nWSR < QPOASES_NWSRMAX ? nWSR : QPOASES_NWSRMAX;
+	acado_cputimeMax = cputime;
+}
+
+real_t acado_getCPUTime( void )
+{
+	return acado_cputime;
+}
+
+int acado_getBudgetExceeded( void )
+{
+	return acado_budgetExceeded;
+}
+
 const char* acado_getErrorString( int error )
 {
 	return MessageHandling::getErrorString( error );
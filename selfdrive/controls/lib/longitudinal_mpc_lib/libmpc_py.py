@@ -22,10 +22,15 @@ double a_ego[MPC_N+1];
 double t[MPC_N+1];
 double j_ego[MPC_N];
 double cost;
+int iterations;
+int budget_exceeded;
+int fallback;
+double solve_time;
 } log_t;
 
 
 void init(double xCost, double vCost, double aCost, double jerkCost, double constraintCost);
+void set_solver_options(double dt, int max_nwsr, double max_time);
 int run_mpc(state_t * x0, log_t * solution,
             double target_x[MPC_N+1], double target_v[MPC_N+1], double target_a[MPC_N+1],
             double min_a, double max_a);
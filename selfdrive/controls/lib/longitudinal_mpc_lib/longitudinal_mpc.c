@@ -4,6 +4,8 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
 
 #define NX          ACADO_NX  /* Number of differential state variables.  */
 #define NXA         ACADO_NXA /* Number of algebraic variables. */
@@ -30,8 +32,44 @@ typedef struct {
   double t[N+1];
   double j_ego[N];
   double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
 } log_t;
 
+// Solver options, of set_solver_options
+static double warm_start_dt = 0.0;
+
+// The linearization of the last solve, the solution when the QP solve fails
+static double warm_x[NX * (N + 1)];
+static double warm_u[NU * N];
+
+static double seconds_since_boot(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/* The last solution at the node times dt later, the states are linear and the controls
+   constant in the intervals, past the horizon the last interval is extrapolated */
+static void shift_solution(const double *t_nodes, double dt){
+  int i, j, k = 0;
+  for (i = 0; i <= N; i++){
+    double t = t_nodes[i] + dt;
+    while (k < N - 1 && t_nodes[k+1] <= t) k++;
+    double f = (t - t_nodes[k]) / (t_nodes[k+1] - t_nodes[k]);
+    for (j = 0; j < NX; j++){
+      warm_x[i*NX+j] = (1.0 - f) * acadoVariables.x[k*NX+j] + f * acadoVariables.x[(k+1)*NX+j];
+    }
+    if (i < N){
+      for (j = 0; j < NU; j++){
+        warm_u[i*NU+j] = acadoVariables.u[k*NU+j];
+      }
+    }
+  }
+}
+
 void init(double xCost, double vCost, double aCost, double jerkCost, double constraintCost){
   acado_initializeSolver();
   int    i;
@@ -64,6 +102,15 @@ void init(double xCost, double vCost, double aCost, double jerkCost, double cons
 
 }
 
+/* dt        = time between the solves, the last solution shifted by it is the start of the next solve,
+               0 to start from the last solution as is
+   max_nwsr  = maximum number of active set changes of the QP solve, at most QPOASES_NWSRMAX
+   max_time  = time in seconds for the QP solve, no limit if 0 */
+void set_solver_options(double dt, int max_nwsr, double max_time){
+  warm_start_dt = dt;
+  acado_setBudget(max_nwsr, max_time);
+}
+
 
 int run_mpc(state_t * x0, log_t * solution,
             double target_x[N+1], double target_v[N+1], double target_a[N+1],
@@ -88,8 +135,27 @@ int run_mpc(state_t * x0, log_t * solution,
   acadoVariables.x0[1] = x0->v_ego;
   acadoVariables.x0[2] = x0->a_ego;
 
+  // The positions of the last solve are from the ego position of then
+  shift_solution(T_IDXS, warm_start_dt);
+  double x_0 = warm_x[0];
+  for (i = 0; i <= N; i++){
+    warm_x[i*NX] -= x_0;
+  }
+  memcpy(acadoVariables.x, warm_x, sizeof(warm_x));
+  memcpy(acadoVariables.u, warm_u, sizeof(warm_u));
+
+  double start = seconds_since_boot();
   acado_preparationStep();
-  acado_feedbackStep();
+  int status = acado_feedbackStep();
+  solution->solve_time = seconds_since_boot() - start;
+
+  // Of a QP solve stopped by the budget or failed the start of the solve is kept
+  solution->budget_exceeded = acado_getBudgetExceeded();
+  solution->fallback = status != 0;
+  if (solution->fallback){
+    memcpy(acadoVariables.x, warm_x, sizeof(warm_x));
+    memcpy(acadoVariables.u, warm_u, sizeof(warm_u));
+  }
 
   for (i = 0; i <= N; i++) {
     solution->x_ego[i] = acadoVariables.x[i*NX];
@@ -101,8 +167,8 @@ int run_mpc(state_t * x0, log_t * solution,
     }
   }
   solution->cost = acado_getObjective();
+  solution->iterations = acado_getNWSR();
 
-  // Dont shift states here. Current solution is closer to next timestep than if
-  // we shift by 0.1 seconds.
-  return acado_getNWSR();
+  // The states are shifted at the next solve, by the time the solution is for then
+  return solution->iterations;
 }
@@ -12,7 +12,7 @@ from selfdrive.modeld.constants import T_IDXS
 from selfdrive.config import Conversions as CV
 from selfdrive.controls.lib.fcw import FCWChecker
 from selfdrive.controls.lib.longcontrol import LongCtrlState
-from selfdrive.controls.lib.lead_mpc import LeadMpc
+from selfdrive.controls.lib.lead_mpc import LeadMpc, update_leads
 from selfdrive.controls.lib.long_mpc import LongitudinalMpc
 from selfdrive.controls.lib.drive_helpers import V_CRUISE_MAX, CONTROL_N
 from selfdrive.swaglog import cloudlog
@@ -120,10 +120,13 @@ class Planner():
     accel_limits_turns[1] = max(accel_limits_turns[1], self.a_desired)
     self.mpcs['cruise'].set_accel_limits(accel_limits_turns[0], accel_limits_turns[1])
 
-    next_a = np.inf
     for key in self.mpcs:
       self.mpcs[key].set_cur_state(self.v_desired, self.a_desired)
-      self.mpcs[key].update(sm['carState'], sm['radarState'], v_cruise)
+    update_leads([self.mpcs['lead0'], self.mpcs['lead1']], sm['carState'], sm['radarState'])
+    self.mpcs['cruise'].update(sm['carState'], sm['radarState'], v_cruise)
+
+    next_a = np.inf
+    for key in self.mpcs:
       if self.mpcs[key].status and self.mpcs[key].a_solution[5] < next_a:  # picks slowest solution from accel in ~0.2 seconds
         self.longitudinalPlanSource = key
         self.v_desired_trajectory = self.mpcs[key].v_solution[:CONTROL_N]
@@ -197,6 +200,11 @@ class Planner():
     longitudinalPlan.dynamicTRMode = int(self.mpcs['lead0'].dynamic_TR_mode)
     longitudinalPlan.dynamicTRValue = float(self.mpcs['lead0'].dynamic_TR)
 
+    solutions = [mpc.mpc_solution[0] for mpc in self.mpcs.values()]
+    longitudinalPlan.solverIterations = sum(int(s.iterations) for s in solutions)
+    longitudinalPlan.solverExecutionTime = sum(float(s.solve_time) for s in solutions)
+    longitudinalPlan.solverBudgetExceeded = any(bool(s.budget_exceeded) for s in solutions)
+
     if self.map_enabled:
       longitudinalPlan.mapSign = float(self.map_sign)
       cam_distance_calc = 0
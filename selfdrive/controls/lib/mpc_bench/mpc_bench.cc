@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <libgen.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+//
+// Replay of the calls of the planners to the lateral, longitudinal and lead mpcs
+//
+// The trace is of selfdrive/debug/mpc_record.py, records of
+//   int32 mpc, int32 call, int32 n, double args[n]
+// in the order of the calls. All calls are made again on the libraries of the build, the time
+// budget of set_solver_options is left out for solutions that only depend on the inputs. The
+// solutions, the logs up to solve_time, can be saved as baseline and compared to one.
+//
+
+enum { LATERAL, LONGITUDINAL, LEAD0, LEAD1, MPC_COUNT };
+enum { CALL_INIT, CALL_SET_WEIGHTS, CALL_SET_SOLVER_OPTIONS, CALL_INIT_WITH_SIMULATION, CALL_RUN };
+
+static const char *mpc_names[MPC_COUNT] = {"lateral", "longitudinal", "lead0", "lead1"};
+
+namespace lateral {
+const int N = 16;
+
+typedef struct {
+  double x, y, psi, curvature, curvature_rate;
+} state_t;
+
+typedef struct {
+  double x[N+1];
+  double y[N+1];
+  double psi[N+1];
+  double curvature[N+1];
+  double curvature_rate[N];
+  double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
+} log_t;
+}
+
+namespace longitudinal {
+const int N = 32;
+
+typedef struct {
+  double x_ego, v_ego, a_ego;
+} state_t;
+
+typedef struct {
+  double x_ego[N+1];
+  double v_ego[N+1];
+  double a_ego[N+1];
+  double t[N+1];
+  double j_ego[N];
+  double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
+} log_t;
+}
+
+namespace lead {
+const int N = 20;
+
+typedef struct {
+  double x_ego, v_ego, a_ego, x_l, v_l, a_l;
+} state_t;
+
+typedef struct {
+  double x_ego[N+1];
+  double v_ego[N+1];
+  double a_ego[N+1];
+  double j_ego[N];
+  double x_l[N+1];
+  double v_l[N+1];
+  double a_l[N+1];
+  double t[N+1];
+  double cost;
+  int iterations;
+  int budget_exceeded;
+  int fallback;
+  double solve_time;
+} log_t;
+}
+
+struct Call {
+  int mpc, call;
+  std::vector<double> args;
+};
+
+struct Libs {
+  void (*lat_init)();
+  void (*lat_set_weights)(double, double, double);
+  void (*lat_set_solver_options)(double, int, double);
+  int (*lat_run)(lateral::state_t *, lateral::log_t *, double, double, double *, double *);
+
+  void (*long_init)(double, double, double, double, double);
+  void (*long_set_solver_options)(double, int, double);
+  int (*long_run)(longitudinal::state_t *, longitudinal::log_t *, double *, double *, double *, double, double);
+
+  void *(*lead_create)();
+  void (*lead_destroy)(void *);
+  void (*lead_init)(void *, double, double, double, double);
+  void (*lead_init_with_simulation)(void *, double, double, double, double, double);
+  void (*lead_change_costs)(void *, double, double, double, double);
+  void (*lead_set_solver_options)(void *, double, int, double);
+  int (*lead_run)(void *, lead::state_t *, lead::log_t *, double, double, double);
+};
+
+struct Stats {
+  std::vector<double> solve_times, call_times;
+  long iterations = 0;
+  int max_iterations = 0, fallbacks = 0, budget_exceeded = 0;
+};
+
+template <typename T>
+static bool sym(void *lib, const char *name, T *f) {
+  *f = (T)dlsym(lib, name);
+  if (*f == nullptr) fprintf(stderr, "%s\n", dlerror());
+  return *f != nullptr;
+}
+
+static void *open_lib(const std::string &fn) {
+  // local, the libraries have functions of the same name
+  void *lib = dlopen(fn.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (lib == nullptr) fprintf(stderr, "%s\n", dlerror());
+  return lib;
+}
+
+static bool load(const std::string &lat_fn, const std::string &long_fn, const std::string &lead_fn, Libs *l) {
+  void *lat = open_lib(lat_fn), *lon = open_lib(long_fn), *lead = open_lib(lead_fn);
+  if (lat == nullptr || lon == nullptr || lead == nullptr) return false;
+  return sym(lat, "init", &l->lat_init) && sym(lat, "set_weights", &l->lat_set_weights) &&
+         sym(lat, "set_solver_options", &l->lat_set_solver_options) && sym(lat, "run_mpc", &l->lat_run) &&
+         sym(lon, "init", &l->long_init) && sym(lon, "set_solver_options", &l->long_set_solver_options) &&
+         sym(lon, "run_mpc", &l->long_run) &&
+         sym(lead, "lead_mpc_create", &l->lead_create) && sym(lead, "lead_mpc_destroy", &l->lead_destroy) &&
+         sym(lead, "lead_mpc_init", &l->lead_init) && sym(lead, "lead_mpc_init_with_simulation", &l->lead_init_with_simulation) &&
+         sym(lead, "lead_mpc_change_costs", &l->lead_change_costs) &&
+         sym(lead, "lead_mpc_set_solver_options", &l->lead_set_solver_options) && sym(lead, "lead_mpc_run", &l->lead_run);
+}
+
+static bool read_trace(const char *fn, std::vector<Call> *calls) {
+  FILE *f = fopen(fn, "rb");
+  if (f == nullptr) {
+    perror(fn);
+    return false;
+  }
+  int32_t header[3];
+  while (fread(header, sizeof(header), 1, f) == 1) {
+    Call c = {header[0], header[1], std::vector<double>(std::max(header[2], 0))};
+    if (c.mpc < 0 || c.mpc >= MPC_COUNT || fread(c.args.data(), sizeof(double), c.args.size(), f) != c.args.size()) {
+      fprintf(stderr, "%s: bad record %zu\n", fn, calls->size());
+      fclose(f);
+      return false;
+    }
+    calls->push_back(std::move(c));
+  }
+  fclose(f);
+  return true;
+}
+
+// The number of arguments of the calls, -1 if the mpc has no such call
+static int n_args(int mpc, int call) {
+  static const int lateral_args[] = {0, 3, 3, -1, 7 + 2 * (lateral::N + 1)};
+  static const int long_args[] = {5, -1, 3, -1, 3 + 3 * (longitudinal::N + 1) + 2};
+  static const int lead_args[] = {4, 4, 3, 5, 9};
+  if (call < CALL_INIT || call > CALL_RUN) return -1;
+  return mpc == LATERAL ? lateral_args[call] : mpc == LONGITUDINAL ? long_args[call] : lead_args[call];
+}
+
+template <typename T>
+static void add_run(const T &log, double call_time, Stats *s, std::vector<std::string> *outputs) {
+  s->solve_times.push_back(log.solve_time);
+  s->call_times.push_back(call_time);
+  s->iterations += log.iterations;
+  s->max_iterations = std::max(s->max_iterations, log.iterations);
+  s->fallbacks += log.fallback;
+  s->budget_exceeded += log.budget_exceeded;
+  outputs->emplace_back((const char *)&log, offsetof(T, solve_time));
+}
+
+// All calls of the trace, the solutions of the runs in order
+static void replay(const Libs &l, const std::vector<Call> &calls, bool budget, Stats *stats, std::vector<std::string> *outputs) {
+  void *leads[2] = {l.lead_create(), l.lead_create()};
+  for (const Call &c : calls) {
+    const double *a = c.args.data();
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    double max_time = budget && c.call == CALL_SET_SOLVER_OPTIONS ? a[2] : 0.;
+
+    if (c.mpc == LATERAL) {
+      if (c.call == CALL_INIT) l.lat_init();
+      else if (c.call == CALL_SET_WEIGHTS) l.lat_set_weights(a[0], a[1], a[2]);
+      else if (c.call == CALL_SET_SOLVER_OPTIONS) l.lat_set_solver_options(a[0], (int)a[1], max_time);
+      else if (c.call == CALL_RUN) {
+        lateral::state_t x0 = {a[0], a[1], a[2], a[3], a[4]};
+        double target_y[lateral::N+1], target_psi[lateral::N+1];
+        memcpy(target_y, &a[7], sizeof(target_y));
+        memcpy(target_psi, &a[7 + lateral::N + 1], sizeof(target_psi));
+        lateral::log_t log;
+        memset(&log, 0, sizeof(log));
+        start = std::chrono::steady_clock::now();
+        l.lat_run(&x0, &log, a[5], a[6], target_y, target_psi);
+        add_run(log, elapsed(), &stats[c.mpc], outputs);
+      }
+    } else if (c.mpc == LONGITUDINAL) {
+      if (c.call == CALL_INIT) l.long_init(a[0], a[1], a[2], a[3], a[4]);
+      else if (c.call == CALL_SET_SOLVER_OPTIONS) l.long_set_solver_options(a[0], (int)a[1], max_time);
+      else if (c.call == CALL_RUN) {
+        const int n = longitudinal::N + 1;
+        longitudinal::state_t x0 = {a[0], a[1], a[2]};
+        double target_x[n], target_v[n], target_a[n];
+        memcpy(target_x, &a[3], sizeof(target_x));
+        memcpy(target_v, &a[3 + n], sizeof(target_v));
+        memcpy(target_a, &a[3 + 2 * n], sizeof(target_a));
+        longitudinal::log_t log;
+        memset(&log, 0, sizeof(log));
+        start = std::chrono::steady_clock::now();
+        l.long_run(&x0, &log, target_x, target_v, target_a, a[3 + 3 * n], a[4 + 3 * n]);
+        add_run(log, elapsed(), &stats[c.mpc], outputs);
+      }
+    } else {
+      void *m = leads[c.mpc - LEAD0];
+      if (c.call == CALL_INIT) l.lead_init(m, a[0], a[1], a[2], a[3]);
+      else if (c.call == CALL_SET_WEIGHTS) l.lead_change_costs(m, a[0], a[1], a[2], a[3]);
+      else if (c.call == CALL_SET_SOLVER_OPTIONS) l.lead_set_solver_options(m, a[0], (int)a[1], max_time);
+      else if (c.call == CALL_INIT_WITH_SIMULATION) l.lead_init_with_simulation(m, a[0], a[1], a[2], a[3], a[4]);
+      else if (c.call == CALL_RUN) {
+        lead::state_t x0 = {a[0], a[1], a[2], a[3], a[4], a[5]};
+        lead::log_t log;
+        memset(&log, 0, sizeof(log));
+        start = std::chrono::steady_clock::now();
+        l.lead_run(m, &x0, &log, a[6], a[7], a[8]);
+        add_run(log, elapsed(), &stats[c.mpc], outputs);
+      }
+    }
+  }
+  l.lead_destroy(leads[0]);
+  l.lead_destroy(leads[1]);
+}
+
+static bool write_outputs(const char *fn, const std::vector<std::string> &outputs) {
+  FILE *f = fopen(fn, "wb");
+  if (f == nullptr) {
+    perror(fn);
+    return false;
+  }
+  for (const std::string &o : outputs) {
+    int32_t size = o.size();
+    fwrite(&size, sizeof(size), 1, f);
+    fwrite(o.data(), 1, o.size(), f);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool read_outputs(const char *fn, std::vector<std::string> *outputs) {
+  FILE *f = fopen(fn, "rb");
+  if (f == nullptr) {
+    perror(fn);
+    return false;
+  }
+  int32_t size;
+  while (fread(&size, sizeof(size), 1, f) == 1) {
+    std::string o(std::max(size, 0), '\0');
+    if (fread(&o[0], 1, o.size(), f) != o.size()) break;
+    outputs->push_back(std::move(o));
+  }
+  fclose(f);
+  return true;
+}
+
+// The runs of every mpc that differ, of solutions in the order of the runs of the trace
+static int compare(const std::vector<Call> &calls, const std::vector<std::string> &a, const std::vector<std::string> &b,
+                   const char *what) {
+  int differ[MPC_COUNT] = {}, first[MPC_COUNT], total = 0;
+  std::fill(first, first + MPC_COUNT, -1);
+  size_t run = 0;
+  for (const Call &c : calls) {
+    if (c.call != CALL_RUN) continue;
+    if (run >= a.size() || run >= b.size() || a[run] != b[run]) {
+      if (first[c.mpc] < 0) first[c.mpc] = run;
+      differ[c.mpc]++;
+      total++;
+    }
+    run++;
+  }
+  for (int m = 0; m < MPC_COUNT; m++) {
+    if (differ[m]) printf("%s: %d %s solutions differ, first at run %d\n", mpc_names[m], differ[m], what, first[m]);
+  }
+  if (a.size() != b.size()) printf("%zu solutions against %zu %s\n", a.size(), b.size(), what);
+  return total + (a.size() != b.size());
+}
+
+static double percentile(std::vector<double> t, double p) {
+  std::sort(t.begin(), t.end());
+  return t[std::min((size_t)(t.size() * p), t.size() - 1)] * 1e6;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-n passes] [-b] [-s baseline] [-c baseline] [-l lateral lib] trace\n"
+                  "  -n  passes of the trace, all passes give the same solutions\n"
+                  "  -b  with the time budget of the trace, solutions then depend on timing\n"
+                  "  -s  save the solutions\n"
+                  "  -c  compare the solutions, bit for bit\n"
+                  "  -l  the lateral mpc library, e.g. libmpc_condensed.so\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  int passes = 1, opt;
+  bool budget = false;
+  const char *save_fn = nullptr, *compare_fn = nullptr;
+  std::string lat_lib = "libmpc.so";
+  while ((opt = getopt(argc, argv, "n:bs:c:l:")) != -1) {
+    switch (opt) {
+      case 'n': passes = std::max(atoi(optarg), 1); break;
+      case 'b': budget = true; break;
+      case 's': save_fn = optarg; break;
+      case 'c': compare_fn = optarg; break;
+      case 'l': lat_lib = optarg; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<Call> calls;
+  if (!read_trace(argv[optind], &calls)) return 1;
+  for (size_t i = 0; i < calls.size(); i++) {
+    if (n_args(calls[i].mpc, calls[i].call) != (int)calls[i].args.size()) {
+      fprintf(stderr, "record %zu: call %d of %s with %zu arguments\n", i, calls[i].call, mpc_names[calls[i].mpc], calls[i].args.size());
+      return 1;
+    }
+  }
+
+  // The libraries next to this one, in selfdrive/controls/lib
+  char exe[4096] = {};
+  if (readlink("/proc/self/exe", exe, sizeof(exe) - 1) < 0) {
+    perror("readlink");
+    return 1;
+  }
+  std::string lib_dir = std::string(dirname(exe)) + "/../";
+  Libs libs;
+  if (!load(lib_dir + "lateral_mpc/" + lat_lib, lib_dir + "longitudinal_mpc_lib/libmpc.so", lib_dir + "lead_mpc_lib/libmpc.so", &libs)) {
+    return 1;
+  }
+
+  Stats stats[MPC_COUNT];
+  std::vector<std::string> outputs;
+  int failures = 0;
+  for (int p = 0; p < passes; p++) {
+    std::vector<std::string> pass_outputs;
+    replay(libs, calls, budget, stats, &pass_outputs);
+    if (p == 0) {
+      outputs = std::move(pass_outputs);
+    } else if (!budget) {
+      failures += compare(calls, outputs, pass_outputs, "repeated");
+    }
+  }
+
+  printf("%zu calls, %d passes%s\n", calls.size(), passes, budget ? ", with the time budget" : "");
+  printf("mpc            runs  solve mean us  p50 us  p90 us  p99 us  max us  call mean us  iterations  max  fallbacks  budget exceeded\n");
+  for (int m = 0; m < MPC_COUNT; m++) {
+    const Stats &s = stats[m];
+    if (s.solve_times.empty()) continue;
+    double mean = 0., call_mean = 0.;
+    for (double t : s.solve_times) mean += t / s.solve_times.size();
+    for (double t : s.call_times) call_mean += t / s.call_times.size();
+    printf("%-12s  %6zu  %13.1f  %6.1f  %6.1f  %6.1f  %6.1f  %12.1f  %10.2f  %3d  %9d  %15d\n", mpc_names[m], s.solve_times.size(),
+           mean * 1e6, percentile(s.solve_times, 0.5), percentile(s.solve_times, 0.9), percentile(s.solve_times, 0.99),
+           percentile(s.solve_times, 1.), call_mean * 1e6, (double)s.iterations / s.solve_times.size(), s.max_iterations,
+           s.fallbacks, s.budget_exceeded);
+  }
+
+  if (save_fn != nullptr && !write_outputs(save_fn, outputs)) return 1;
+  if (compare_fn != nullptr) {
+    std::vector<std::string> baseline;
+    if (!read_outputs(compare_fn, &baseline)) return 1;
+    failures += compare(calls, outputs, baseline, "baseline");
+    if (failures == 0) printf("solutions match the baseline\n");
+  }
+  return failures ? 1 : 0;
+}
@@ -196,3 +196,11 @@ def calc_slip_factor(VM):
   it's positive for Oversteering vehicle, negative (usual case) otherwise.
   """
   return VM.m * (VM.cF * VM.aF - VM.cR * VM.aR) / (VM.l**2 * VM.cF * VM.cR)
+
+
+# The model of lateral_kernels/vehicle_model.cc where it's built, VehicleModelPy stays its reference
+VehicleModelPy = VehicleModel
+try:
+  from selfdrive.controls.lib.lateral_kernels.lateral_kernels import VehicleModel  # type: ignore  # pylint: disable=no-name-in-module, import-error
+except ImportError:
+  pass
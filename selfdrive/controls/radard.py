@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import importlib
 import math
+import os
 from collections import defaultdict, deque
 
 import cereal.messaging as messaging
@@ -9,7 +10,8 @@ from common.numpy_fast import interp
 from common.params import Params
 from common.realtime import Ratekeeper, Priority, config_realtime_process
 from selfdrive.config import RADAR_TO_CAMERA
-from selfdrive.controls.lib.cluster.fastcluster_py import cluster_points_centroid
+from selfdrive.controls.lib.cluster.fastcluster_py import GridCluster
+from selfdrive.controls.lib.cluster.radar_tracker_py import RadarTracker
 from selfdrive.controls.lib.radar_helpers import Cluster, Track
 from selfdrive.swaglog import cloudlog
 from selfdrive.hardware import TICI
@@ -85,11 +87,23 @@ def get_lead(v_ego, ready, clusters, lead_msg, low_speed_override=True):
   return lead_dict
 
 
+def new_radar_state(sm, rr):
+  dat = messaging.new_message('radarState')
+  dat.valid = sm.all_alive_and_valid() and len(rr.errors) == 0
+  radarState = dat.radarState
+  radarState.mdMonoTime = sm.logMonoTime['modelV2']
+  radarState.canMonoTimes = list(rr.canMonoTimes)
+  radarState.radarErrors = list(rr.errors)
+  radarState.carStateMonoTime = sm.logMonoTime['carState']
+  return dat
+
+
 class RadarD():
   def __init__(self, radar_ts, delay=0):
     self.current_time = 0
 
     self.tracks = defaultdict(dict)
+    self.clusterer = GridCluster(2.5)
     self.kalman_params = KalmanParams(radar_ts)
 
     # v_ego
@@ -133,7 +147,7 @@ class RadarD():
 
     # If we have multiple points, cluster them
     if len(track_pts) > 1:
-      cluster_idxs = cluster_points_centroid(track_pts, 2.5)
+      cluster_idxs = self.clusterer.cluster(track_pts, idens)
       clusters = [None] * (max(cluster_idxs) + 1)
 
       for idx in range(len(track_pts)):
@@ -157,13 +171,8 @@ class RadarD():
         self.tracks[idens[idx]].reset_a_lead(aLeadK, aLeadTau)
 
     # *** publish radarState ***
-    dat = messaging.new_message('radarState')
-    dat.valid = sm.all_alive_and_valid() and len(rr.errors) == 0
+    dat = new_radar_state(sm, rr)
     radarState = dat.radarState
-    radarState.mdMonoTime = sm.logMonoTime['modelV2']
-    radarState.canMonoTimes = list(rr.canMonoTimes)
-    radarState.radarErrors = list(rr.errors)
-    radarState.carStateMonoTime = sm.logMonoTime['carState']
 
     if enable_lead:
       if len(sm['modelV2'].leadsV3) > 1:
@@ -171,6 +180,37 @@ class RadarD():
         radarState.leadTwo = get_lead(self.v_ego, self.ready, clusters, sm['modelV2'].leadsV3[1], low_speed_override=False)
     return dat
 
+  def live_tracks(self):
+    return [(ids, t.dRel, t.yRel, t.vRel) for ids, t in sorted(self.tracks.items())]
+
+
+# RadarD with the tracks, clusters and leads in C++, radar_tracker.cpp
+class RadarDNative():
+  def __init__(self, radar_ts, delay=0):
+    self.tracker = RadarTracker(KalmanParams(radar_ts), delay, RADAR_TO_CAMERA)
+    self.ready = False
+
+  def update(self, sm, rr, enable_lead):
+    if sm.updated['carState']:
+      self.tracker.update_ego(sm['carState'].vEgo)
+    if sm.updated['modelV2']:
+      self.ready = True
+
+    self.tracker.update(rr.points)
+
+    # *** publish radarState ***
+    dat = new_radar_state(sm, rr)
+    radarState = dat.radarState
+
+    if enable_lead:
+      if len(sm['modelV2'].leadsV3) > 1:
+        radarState.leadOne = self.tracker.get_lead(self.ready, sm['modelV2'].leadsV3[0], low_speed_override=True)
+        radarState.leadTwo = self.tracker.get_lead(self.ready, sm['modelV2'].leadsV3[1], low_speed_override=False)
+    return dat
+
+  def live_tracks(self):
+    return self.tracker.tracks()
+
 
 # fuses camera and radar data for best lead detection
 def radard_thread(sm=None, pm=None, can_sock=None):
@@ -196,7 +236,8 @@ def radard_thread(sm=None, pm=None, can_sock=None):
   RI = RadarInterface(CP)
 
   rk = Ratekeeper(1.0 / CP.radarTimeStep, print_delay_threshold=None)
-  RD = RadarD(CP.radarTimeStep, RI.delay)
+  # RADARD_PYTHON runs the tracks in python, as a reference
+  RD = (RadarD if os.getenv("RADARD_PYTHON") else RadarDNative)(CP.radarTimeStep, RI.delay)
 
   # TODO: always log leads once we can hide them conditionally
   enable_lead = CP.openpilotLongitudinalControl or not CP.radarOffCan
@@ -216,15 +257,15 @@ def radard_thread(sm=None, pm=None, can_sock=None):
     pm.send('radarState', dat)
 
     # *** publish tracks for UI debugging (keep last) ***
-    tracks = RD.tracks
+    tracks = RD.live_tracks()
     dat = messaging.new_message('liveTracks', len(tracks))
 
-    for cnt, ids in enumerate(sorted(tracks.keys())):
+    for cnt, (ids, d_rel, y_rel, v_rel) in enumerate(tracks):
       dat.liveTracks[cnt] = {
         "trackId": ids,
-        "dRel": float(tracks[ids].dRel),
-        "yRel": float(tracks[ids].yRel),
-        "vRel": float(tracks[ids].vRel),
+        "dRel": float(d_rel),
+        "yRel": float(y_rel),
+        "vRel": float(v_rel),
       }
     pm.send('liveTracks', dat)
 
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# Runs camerad replay -> modeld -> locationd over many segments on all cores and writes their outputs
+# as new logs. Consecutive segments of a route are one job, so the daemons keep their state across
+# the segment boundaries, and the jobs run in parallel, each with its own OPENPILOT_PREFIX for the
+# msgq queues and visionipc.
+#   ./batch_replay.py --out /data/reprocessed /data/media/0/realdata/*--*
+# writes /data/reprocessed/<segment>/rlog.bz2 with modelV2, cameraOdometry and liveLocationKalman.
+import argparse
+import bz2
+import multiprocessing
+import os
+import re
+import shutil
+import subprocess
+import time
+from collections import defaultdict
+
+import cereal.messaging as messaging
+from common.basedir import BASEDIR
+from common.realtime import sec_since_boot
+from selfdrive.loggerd.logreader_pyx import LogReader
+
+# the log inputs of modeld and locationd, and what they publish
+INPUTS = ['liveCalibration', 'lateralPlan', 'carState', 'sensorEvents', 'gpsLocationExternal']
+OUTPUTS = ['modelV2', 'cameraOdometry', 'liveLocationKalman']
+PROCESSES = [
+  ("selfdrive/camerad", "./camerad"),
+  ("selfdrive/modeld", "./modeld"),
+  ("selfdrive/locationd", "./locationd"),
+]
+
+# a frame that takes longer than this is skipped, e.g. the first ones while modeld loads
+FRAME_TIMEOUT = 10.
+
+
+def segment_log(d):
+  for fn in ["rlog.bz2", "rlog.zst", "rlog"]:
+    if os.path.exists(os.path.join(d, fn)):
+      return os.path.join(d, fn)
+  return None
+
+
+def jobs_from_segments(segments):
+  """Runs of consecutive segments of a route, with a road camera video and a log"""
+  routes = defaultdict(list)
+  for d in segments:
+    m = re.match(r"(.*)--(\d+)$", os.path.normpath(d))
+    if m is None or segment_log(d) is None or not os.path.exists(os.path.join(d, "fcamera.hevc")):
+      print(f"skipping {d}, not a segment with a log and fcamera.hevc")
+      continue
+    routes[m.group(1)].append((int(m.group(2)), d))
+
+  jobs = []
+  for route in sorted(routes):
+    run = []
+    for num, d in sorted(routes[route]):
+      if run and num != run[-1][0] + 1:
+        jobs.append([d for _, d in run])
+        run = []
+      run.append((num, d))
+    jobs.append([d for _, d in run])
+  return jobs
+
+
+def run_job(args):
+  job_idx, segments, out_dir = args
+  # the queues of the job's sockets and daemons
+  os.environ["OPENPILOT_PREFIX"] = f"batch_replay_{os.getpid()}_{job_idx}"
+  pm = messaging.PubMaster(INPUTS)
+  poller = messaging.Poller()
+  socks = {s: messaging.sub_sock(s, poller=poller if s == 'modelV2' else None, conflate=False) for s in OUTPUTS}
+
+  # the inputs of each road frame, in log order, and the segment of the frame
+  frames = []
+  for seg_idx, d in enumerate(segments):
+    inputs = []
+    for m in LogReader(segment_log(d)):
+      w = m.which()
+      if w in INPUTS:
+        inputs.append(m)
+      elif w == 'roadEncodeIdx':
+        frames.append((seg_idx, inputs))
+        inputs = []
+
+  env = dict(os.environ, CAMERAD_REPLAY=",".join(segments), CAMERAD_REPLAY_SPEED="0", CAMERAD_REPLAY_SYNC="modelV2")
+  procs = [subprocess.Popen(cmd, cwd=os.path.join(BASEDIR, cwd), env=env) for cwd, cmd in PROCESSES]
+
+  outputs = [[] for _ in segments]
+  missed = 0
+  try:
+    for frame_id, (seg_idx, inputs) in enumerate(frames):
+      # the inputs up to the frame, stamped with the time they are sent again, the daemons compare
+      # them to the times of their own outputs
+      for m in inputs:
+        msg = m.as_builder()
+        msg.logMonoTime = int(sec_since_boot() * 1e9)
+        pm.send(m.which(), msg)
+
+      # camerad sends the frame once modeld is done with the one before it
+      deadline = time.monotonic() + FRAME_TIMEOUT
+      done = False
+      while not done and time.monotonic() < deadline:
+        for sock in poller.poll(100):
+          for dat in messaging.drain_sock_raw(sock):
+            outputs[seg_idx].append(dat)
+            done |= messaging.log_from_bytes(dat).modelV2.frameId >= frame_id
+        if any(p.poll() is not None for p in procs[1:]):
+          raise RuntimeError(f"a process exited on {segments[seg_idx]}")
+
+      for s in ['cameraOdometry', 'liveLocationKalman']:
+        outputs[seg_idx] += messaging.drain_sock_raw(socks[s])
+      if not done:
+        missed += 1
+        # camerad exits after its last frame
+        if procs[0].poll() is not None:
+          missed += len(frames) - frame_id - 1
+          break
+  finally:
+    for p in procs:
+      p.terminate()
+    for p in procs:
+      p.wait()
+    shutil.rmtree(os.path.join("/dev/shm", os.environ["OPENPILOT_PREFIX"]), ignore_errors=True)
+
+  for d, out in zip(segments, outputs):
+    path = os.path.join(out_dir, os.path.basename(os.path.normpath(d)))
+    os.makedirs(path, exist_ok=True)
+    with open(os.path.join(path, "rlog.bz2"), "wb") as f:
+      f.write(bz2.compress(b"".join(out)))
+  return segments, len(frames), missed
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Run camerad replay, modeld and locationd over segments in parallel")
+  parser.add_argument("segments", nargs="+", help="segment directories, <route>--<n>")
+  parser.add_argument("--out", required=True, help="the new logs go to <out>/<segment>/rlog.bz2")
+  parser.add_argument("--jobs", type=int, default=max(1, multiprocessing.cpu_count() // 4),
+                      help="jobs at once, each runs a modeld")
+  args = parser.parse_args()
+
+  jobs = jobs_from_segments(args.segments)
+  print(f"{sum(len(j) for j in jobs)} segments in {len(jobs)} jobs, {args.jobs} at once")
+  with multiprocessing.Pool(args.jobs) as pool:
+    for segments, frames, missed in pool.imap_unordered(run_job, [(i, j, args.out) for i, j in enumerate(jobs)]):
+      print(f"{segments[0]}: {len(segments)} segments, {frames} frames, {missed} missed")
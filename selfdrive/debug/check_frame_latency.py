@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+# type: ignore
+# Latency of road camera frames from the end of readout to controlsd, per stage.
+# All stamps are nanos since boot, the same clock as logMonoTime
+import numpy as np
+from collections import defaultdict, deque
+
+import cereal.messaging as messaging
+
+STAGES = ["processed", "sent", "recv", "executed", "published", "planned", "controlled"]
+N = 200
+
+if __name__ == "__main__":
+  sm = messaging.SubMaster(["modelV2", "lateralPlan", "controlsState"])
+  lat = defaultdict(lambda: deque(maxlen=N))
+
+  # modelV2 logMonoTime -> stage stamps of that frame, matched by the planner and controls
+  frames = {}
+  plans = {}
+
+  while True:
+    sm.update()
+
+    if sm.updated["modelV2"]:
+      m = sm["modelV2"]
+      if m.timestampProcessed > 0:
+        ts = {"eof": m.timestampEof, "processed": m.timestampProcessed, "sent": m.timestampSent, "recv": m.timestampRecv,
+              "executed": m.timestampExecuted, "published": m.timestampPublished}
+        frames[sm.logMonoTime["modelV2"]] = ts
+        prev = "eof"
+        for s in STAGES[:5]:
+          lat[s].append((ts[s] - ts[prev]) / 1e6)
+          prev = s
+
+    if sm.updated["lateralPlan"]:
+      ts = frames.pop(sm["lateralPlan"].modelMonoTime, None)
+      if ts is not None:
+        lat["planned"].append((sm.logMonoTime["lateralPlan"] - ts["published"]) / 1e6)
+        plans[sm.logMonoTime["lateralPlan"]] = ts
+
+    if sm.updated["controlsState"]:
+      ts = plans.pop(sm["controlsState"].lateralPlanMonoTime, None)
+      if ts is not None:
+        lat["controlled"].append((sm.logMonoTime["controlsState"] - sm["controlsState"].lateralPlanMonoTime) / 1e6)
+        lat["total"].append((sm.logMonoTime["controlsState"] - ts["eof"]) / 1e6)
+
+    # drop stamps of frames that were never consumed
+    for d in (frames, plans):
+      while len(d) > 20:
+        del d[min(d)]
+
+    if sm.frame % 100 == 0 and len(lat["total"]) > 0:
+      print()
+      print(f"{'stage (ms)':12} {'p50':>7} {'p90':>7} {'p99':>7} {'max':>7}")
+      for s in STAGES + ["total"]:
+        if len(lat[s]):
+          p50, p90, p99 = np.percentile(lat[s], [50, 90, 99])
+          print(f"{s:12} {p50:7.2f} {p90:7.2f} {p99:7.2f} {np.max(lat[s]):7.2f}")
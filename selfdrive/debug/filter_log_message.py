@@ -73,8 +73,11 @@ if __name__ == "__main__":
             print_logmessage(m.logMonoTime, m.logMessage, min_level)
           elif m.which() == 'androidLog':
             print_androidlog(m.logMonoTime, m.androidLog)
+          elif m.which() == 'androidLogs':
+            for entry in m.androidLogs:
+              print_androidlog(m.logMonoTime, entry)
   else:
-    sm = messaging.SubMaster(['logMessage', 'androidLog'], addr=args.addr)
+    sm = messaging.SubMaster(['logMessage', 'androidLog', 'androidLogs'], addr=args.addr)
     while True:
       sm.update()
 
@@ -83,3 +86,7 @@ if __name__ == "__main__":
 
       if sm.updated['androidLog']:
         print_androidlog(sm.logMonoTime['androidLog'], sm['androidLog'])
+
+      if sm.updated['androidLogs']:
+        for entry in sm['androidLogs']:
+          print_androidlog(sm.logMonoTime['androidLogs'], entry)
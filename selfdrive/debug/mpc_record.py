@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# Records the calls of the planners to the lateral, longitudinal and lead mpcs on a log,
+# for the replay of selfdrive/controls/lib/mpc_bench:
+#   ./mpc_record.py rlog.bz2 /tmp/mpc.trace
+#   selfdrive/controls/lib/mpc_bench/mpc_bench -s /tmp/mpc.baseline /tmp/mpc.trace
+#   (change the solvers)
+#   selfdrive/controls/lib/mpc_bench/mpc_bench -c /tmp/mpc.baseline /tmp/mpc.trace
+import argparse
+import struct
+
+import cereal.messaging as messaging
+from selfdrive.controls.lib.lateral_planner import LateralPlanner
+from selfdrive.controls.lib.longitudinal_planner import Planner
+from selfdrive.controls.lib.lateral_mpc import libmpc_py as lateral_libmpc_py
+from selfdrive.controls.lib.lead_mpc_lib import libmpc_py as lead_libmpc_py
+from selfdrive.controls.lib.longitudinal_mpc_lib import libmpc_py as longitudinal_libmpc_py
+from tools.lib.logreader import LogReader
+
+# as in mpc_bench.cc
+LATERAL, LONGITUDINAL, LEAD0, LEAD1 = range(4)
+CALL_INIT, CALL_SET_WEIGHTS, CALL_SET_SOLVER_OPTIONS, CALL_INIT_WITH_SIMULATION, CALL_RUN = range(5)
+
+
+class Trace():
+  def __init__(self, fn):
+    self.f = open(fn, "wb")
+    self.runs = [0] * 4
+
+  def write(self, mpc, call, args):
+    args = [float(a) for a in args]
+    self.f.write(struct.pack(f"<iii{len(args)}d", mpc, call, len(args), *args))
+    if call == CALL_RUN:
+      self.runs[mpc] += 1
+
+
+class LateralRecorder():
+  def __init__(self, lib, trace):
+    self.lib, self.trace = lib, trace
+
+  def init(self):
+    self.trace.write(LATERAL, CALL_INIT, [])
+    self.lib.init()
+
+  def set_weights(self, *args):
+    self.trace.write(LATERAL, CALL_SET_WEIGHTS, args)
+    self.lib.set_weights(*args)
+
+  def set_solver_options(self, *args):
+    self.trace.write(LATERAL, CALL_SET_SOLVER_OPTIONS, args)
+    self.lib.set_solver_options(*args)
+
+  def run_mpc(self, x0, solution, v_ego, rotation_radius, target_y, target_psi):
+    s = x0[0]
+    self.trace.write(LATERAL, CALL_RUN, [s.x, s.y, s.psi, s.curvature, s.curvature_rate, v_ego, rotation_radius] +
+                     list(target_y) + list(target_psi))
+    return self.lib.run_mpc(x0, solution, v_ego, rotation_radius, target_y, target_psi)
+
+
+class LongitudinalRecorder():
+  def __init__(self, lib, trace):
+    self.lib, self.trace = lib, trace
+
+  def init(self, *args):
+    self.trace.write(LONGITUDINAL, CALL_INIT, args)
+    self.lib.init(*args)
+
+  def set_solver_options(self, *args):
+    self.trace.write(LONGITUDINAL, CALL_SET_SOLVER_OPTIONS, args)
+    self.lib.set_solver_options(*args)
+
+  def run_mpc(self, x0, solution, target_x, target_v, target_a, min_a, max_a):
+    s = x0[0]
+    self.trace.write(LONGITUDINAL, CALL_RUN, [s.x_ego, s.v_ego, s.a_ego] + list(target_x) + list(target_v) +
+                     list(target_a) + [min_a, max_a])
+    return self.lib.run_mpc(x0, solution, target_x, target_v, target_a, min_a, max_a)
+
+
+class LeadRecorder():
+  """The lead library, the solvers of lead_mpc_lib.libmpc_py.mpcs are the mpcs of lead0 and lead1"""
+  def __init__(self, lib, trace, solvers):
+    self.lib, self.trace = lib, trace
+    self.ids = {self.key(s.m): LEAD0 + i for i, s in enumerate(solvers)}
+
+  @staticmethod
+  def key(m):
+    return int(lead_libmpc_py.ffi.cast("uintptr_t", m))
+
+  def write(self, m, call, args):
+    self.trace.write(self.ids[self.key(m)], call, args)
+
+  def lead_mpc_create(self):
+    return self.lib.lead_mpc_create()
+
+  def lead_mpc_destroy(self, m):
+    self.lib.lead_mpc_destroy(m)
+
+  def lead_mpc_init(self, m, *args):
+    self.write(m, CALL_INIT, args)
+    self.lib.lead_mpc_init(m, *args)
+
+  def lead_mpc_init_with_simulation(self, m, *args):
+    self.write(m, CALL_INIT_WITH_SIMULATION, args)
+    self.lib.lead_mpc_init_with_simulation(m, *args)
+
+  def lead_mpc_change_costs(self, m, *args):
+    self.write(m, CALL_SET_WEIGHTS, args)
+    self.lib.lead_mpc_change_costs(m, *args)
+
+  def lead_mpc_set_solver_options(self, m, *args):
+    self.write(m, CALL_SET_SOLVER_OPTIONS, args)
+    self.lib.lead_mpc_set_solver_options(m, *args)
+
+  def write_run(self, m, x0, l, a_l_0, TR):
+    s = x0[0]
+    self.write(m, CALL_RUN, [s.x_ego, s.v_ego, s.a_ego, s.x_l, s.v_l, s.a_l, l, a_l_0, TR])
+
+  def lead_mpc_run(self, m, x0, solution, l, a_l_0, TR):
+    self.write_run(m, x0, l, a_l_0, TR)
+    return self.lib.lead_mpc_run(m, x0, solution, l, a_l_0, TR)
+
+  def lead_mpc_run_batch(self, n, ms, x0s, solutions, ls, a_l_0s, TRs, nwsr):
+    for i in range(n):
+      self.write_run(ms[i], x0s[i], ls[i], a_l_0s[i], TRs[i])
+    self.lib.lead_mpc_run_batch(n, ms, x0s, solutions, ls, a_l_0s, TRs, nwsr)
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Record the mpc calls of the planners on a log, for mpc_bench")
+  parser.add_argument("log", help="rlog of a drive")
+  parser.add_argument("trace", help="output trace")
+  parser.add_argument("--no-lanelines", action="store_true", help="end to end lateral planning")
+  args = parser.parse_args()
+
+  # the planners take the libraries at construction
+  trace = Trace(args.trace)
+  lateral_libmpc_py.libmpc = LateralRecorder(lateral_libmpc_py.libmpc, trace)
+  longitudinal_libmpc_py.libmpc = LongitudinalRecorder(longitudinal_libmpc_py.libmpc, trace)
+  lead_libmpc_py.libmpc = LeadRecorder(lead_libmpc_py.libmpc, trace, lead_libmpc_py.mpcs)
+
+  msgs = list(LogReader(args.log))
+  CP = next(m.carParams for m in msgs if m.which() == "carParams")
+  lateral_planner = LateralPlanner(CP, use_lanelines=not args.no_lanelines)
+  longitudinal_planner = Planner(CP)
+
+  # as in plannerd_thread
+  sm = messaging.SubMaster(['carState', 'controlsState', 'radarState', 'modelV2', 'liveMapData'], addr=None)
+  for msg in msgs:
+    if msg.which() not in sm.data:
+      continue
+    sm.update_msgs(msg.logMonoTime * 1e-9, [msg])
+    if msg.which() == 'modelV2':
+      lateral_planner.update(sm, CP)
+    elif msg.which() == 'radarState':
+      longitudinal_planner.update(sm, CP)
+
+  trace.f.close()
+  print("runs: lateral %d, longitudinal %d, lead0 %d, lead1 %d" % tuple(trace.runs))
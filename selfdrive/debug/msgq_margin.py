@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# For each service on rlogs, the shortest time in which it wrote a whole msgq segment. A reader that
+# stalls for longer than that margin is lapped by the writer and loses messages, see segment_sizes
+# in cereal/services.py
+#   ./msgq_margin.py rlog.bz2 [rlog.bz2 ...]
+import argparse
+import math
+from collections import defaultdict
+
+from cereal.services import service_list
+from tools.lib.logreader import LogReader
+
+MSGQ_MSG_HEADER_SIZE = 16  # as in msgq.h
+
+
+def msgq_size(size):
+  # a message takes its header and is 8 byte aligned in the segment
+  return (size + MSGQ_MSG_HEADER_SIZE + 7) & ~7
+
+
+def lap_margin(msgs, segment_size):
+  """The shortest time span of msgs, (t, size) in send order, that filled segment_size"""
+  margin = math.inf
+  start, total = 0, 0
+  for end, (t, size) in enumerate(msgs):
+    total += size
+    while total - msgs[start][1] >= segment_size:
+      total -= msgs[start][1]
+      start += 1
+    if total >= segment_size:
+      margin = min(margin, t - msgs[start][0])
+  return margin
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Worst case msgq lap margin per service on rlogs")
+  parser.add_argument("logs", nargs="+", help="rlogs, in order")
+  parser.add_argument("--warn", type=float, default=5., help="seconds, services with less margin are marked")
+  args = parser.parse_args()
+
+  msgs = defaultdict(list)
+  for fn in args.logs:
+    for m in LogReader(fn):
+      which = m.which()
+      if which in service_list:
+        msgs[which].append((m.logMonoTime * 1e-9, msgq_size(len(m.as_builder().to_bytes()))))
+
+  print("%-24s %10s %10s %10s %10s" % ("service", "segment kB", "max msg kB", "kB/s", "margin s"))
+  rows = []
+  for name, ms in msgs.items():
+    segment_size = service_list[name].segment_size
+    duration = ms[-1][0] - ms[0][0]
+    rate = sum(s for _, s in ms) / duration if duration > 0 else 0.
+    rows.append((lap_margin(ms, segment_size), name, segment_size, max(s for _, s in ms), rate, duration))
+
+  for margin, name, segment_size, max_size, rate, duration in sorted(rows):
+    # never lapped within the logs, at least their duration
+    margin_str = "%.1f" % margin if margin != math.inf else ">%.0f" % duration
+    mark = " <" if margin < args.warn else ""
+    print("%-24s %10.0f %10.1f %10.1f %10s%s" % (name, segment_size / 1024, max_size / 1024, rate / 1024, margin_str, mark))
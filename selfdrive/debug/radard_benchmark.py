@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+# Times the radard loop on a log, the tracks in python against the ones of radar_tracker.cpp,
+# and checks that both give the same leads
+import argparse
+import importlib
+import time
+
+import cereal.messaging as messaging
+from selfdrive.controls.radard import RadarD, RadarDNative
+from tools.lib.logreader import LogReader
+
+LEAD_FIELDS = ["dRel", "yRel", "vRel", "vLead", "vLeadK", "aLeadK", "aLeadTau", "modelProb"]
+
+
+def percentile(times, p):
+  return sorted(times)[min(int(len(times) * p), len(times) - 1)] * 1e3
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Benchmark the radard loop on the radar CAN of a log")
+  parser.add_argument("log", help="rlog of a drive with radar")
+  args = parser.parse_args()
+
+  msgs = list(LogReader(args.log))
+  CP = next(m.carParams for m in msgs if m.which() == "carParams")
+  RI = importlib.import_module(f"selfdrive.car.{CP.carName}.radar_interface").RadarInterface(CP)
+
+  sm = messaging.SubMaster(["modelV2", "carState"], addr=None)
+  runs = {"python": RadarD(CP.radarTimeStep, RI.delay), "native": RadarDNative(CP.radarTimeStep, RI.delay)}
+  times = {k: [] for k in runs}
+  frames, mismatches = 0, 0
+  pending = []
+
+  for msg in msgs:
+    if msg.which() in sm.data:
+      pending.append(msg)
+      continue
+    if msg.which() != "can":
+      continue
+
+    # the raw CAN through the CANParser of the car, as in radard_thread
+    rr = RI.update([msg.as_builder().to_bytes()])
+    if rr is None:
+      continue
+    sm.update_msgs(msg.logMonoTime * 1e-9, pending)
+    pending = []
+
+    leads = {}
+    for name, RD in runs.items():
+      t = time.monotonic()
+      dat = RD.update(sm, rr, True)
+      RD.live_tracks()
+      times[name].append(time.monotonic() - t)
+      leads[name] = (dat.radarState.leadOne, dat.radarState.leadTwo)
+
+    frames += 1
+    for a, b in zip(leads["python"], leads["native"]):
+      if a.status != b.status or a.radar != b.radar or any(abs(getattr(a, f) - getattr(b, f)) > 1e-6 for f in LEAD_FIELDS):
+        mismatches += 1
+
+  print(f"{frames} radar frames, {mismatches} leads differ")
+  for name, t in times.items():
+    if len(t):
+      print(f"{name:>8}: mean {sum(t) / len(t) * 1e3:.3f} ms, p50 {percentile(t, 0.5):.3f} ms, p99 {percentile(t, 0.99):.3f} ms")
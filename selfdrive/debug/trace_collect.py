@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Merges the trace rings of the processes run with OPENPILOT_TRACE (selfdrive/common/trace.h) into a
+# Chrome trace, for chrome://tracing or ui.perfetto.dev
+import argparse
+import glob
+import json
+import mmap
+import os
+import struct
+
+TRACE_MAGIC = 0x45435254
+HEADER = struct.Struct("<IIiIQ16s24x")  # magic, capacity, pid, reserved, head, process name
+RECORD = struct.Struct("<QQdIB35s")  # seq, ts, value, tid, type, name
+TRACE_BEGIN, TRACE_END, TRACE_COUNTER, TRACE_INSTANT, TRACE_THREAD_NAME = range(1, 6)
+
+
+def cstr(b):
+  return b.split(b"\0", 1)[0].decode("utf-8", "replace")
+
+
+def read_ring(path):
+  with open(path, "rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+    magic, capacity, pid, _, head, process_name = HEADER.unpack_from(m, 0)
+    if magic != TRACE_MAGIC:
+      return None
+    records = []
+    for i in range(max(0, head - capacity), head):
+      off = HEADER.size + (i % capacity) * RECORD.size
+      rec = RECORD.unpack_from(m, off)
+      # being written, or overwritten since head was read
+      if rec[0] != i + 1:
+        continue
+      records.append(rec)
+  return pid, cstr(process_name), records
+
+
+def ring_events(pid, process_name, records):
+  events = [{"name": "process_name", "ph": "M", "pid": pid, "args": {"name": process_name}}]
+  # the thread names of a ring that wrapped, of the threads that still run
+  named = {r[3] for r in records if r[4] == TRACE_THREAD_NAME}
+  for tid in {r[3] for r in records} - named:
+    try:
+      with open(f"/proc/{pid}/task/{tid}/comm") as f:
+        events.append({"name": "thread_name", "ph": "M", "pid": pid, "tid": tid, "args": {"name": f.read().strip()}})
+    except OSError:
+      pass
+  depth = {}
+  for _, ts, value, tid, typ, name in sorted(records, key=lambda r: r[1]):
+    name = cstr(name)
+    ev = {"pid": pid, "tid": tid, "ts": ts / 1e3}
+    if typ == TRACE_THREAD_NAME:
+      events.append({"name": "thread_name", "ph": "M", "pid": pid, "tid": tid, "args": {"name": name}})
+    elif typ == TRACE_BEGIN:
+      depth[tid] = depth.get(tid, 0) + 1
+      events.append({**ev, "name": name, "ph": "B"})
+    elif typ == TRACE_END:
+      # the begin of a span can be overwritten before its end
+      if depth.get(tid, 0) > 0:
+        depth[tid] -= 1
+        events.append({**ev, "ph": "E"})
+    elif typ == TRACE_COUNTER:
+      events.append({**ev, "name": name, "ph": "C", "args": {name: value}})
+    elif typ == TRACE_INSTANT:
+      events.append({**ev, "name": name, "ph": "i", "s": "t"})
+  return events
+
+
+def pid_alive(pid):
+  try:
+    os.kill(pid, 0)
+  except ProcessLookupError:
+    return False
+  except PermissionError:
+    pass
+  return True
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="merge the trace rings in /dev/shm into a Chrome trace")
+  parser.add_argument("output", nargs="?", default="trace.json")
+  parser.add_argument("--clean", action="store_true", help="remove the rings of the processes that exited")
+  args = parser.parse_args()
+
+  events = []
+  for path in sorted(glob.glob("/dev/shm/trace_*")):
+    ring = read_ring(path)
+    if ring is None:
+      continue
+    pid, process_name, records = ring
+    events += ring_events(pid, process_name, records)
+    print(f"{process_name} ({pid}): {len(records)} records")
+    if args.clean and not pid_alive(pid):
+      os.unlink(path)
+
+  with open(args.output, "w") as f:
+    json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f)
+  print(f"wrote {len(events)} events to {args.output}")
@@ -35,4 +35,10 @@ inline std::string persistent_params() {
 inline std::string rsa_file() {
   return Hardware::PC() ? HOME + "/.comma/persist/comma/id_rsa" : "/persist/comma/id_rsa";
 }
+inline std::string cl_cache() {
+  if (const char *env = getenv("CL_CACHE_DIR")) {
+    return env;
+  }
+  return Hardware::PC() ? HOME + "/.comma/cl_cache" : "/data/cl_cache";
+}
 }  // namespace Path
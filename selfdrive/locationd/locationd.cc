@@ -1,10 +1,14 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 
 #include "locationd.h"
 
+#include "selfdrive/common/alloc_tracker.h"
+
 using namespace EKFS;
 using namespace Eigen;
 
@@ -54,6 +58,9 @@ static VectorXd rotate_std(const MatrixXdr& rot_matrix, const VectorXd& std_in)
 
 Localizer::Localizer() {
   this->kf = std::make_unique<LiveKalman>();
+  // seconds observations wait to be processed in time order, late GPS within it is not a rewind
+  const char *fixed_lag = getenv("LOCATIOND_FIXED_LAG");
+  this->kf->set_fixed_lag(fixed_lag ? atof(fixed_lag) : 0.0);
   this->reset_kalman();
 
   this->calib = Vector3d(0.0, 0.0, 0.0);
@@ -69,8 +76,9 @@ Localizer::Localizer() {
 }
 
 void Localizer::build_live_location(cereal::LiveLocationKalman::Builder& fix) {
-  VectorXd predicted_state = this->kf->get_x();
-  MatrixXdr predicted_cov = this->kf->get_P();
+  VectorXd predicted_state;
+  MatrixXdr predicted_cov;
+  this->kf->get_predicted(predicted_state, predicted_cov);
   VectorXd predicted_std = predicted_cov.diagonal().array().sqrt();
 
   VectorXd fix_ecef = predicted_state.segment<STATE_ECEF_POS_LEN>(STATE_ECEF_POS_START);
@@ -78,7 +86,8 @@ void Localizer::build_live_location(cereal::LiveLocationKalman::Builder& fix) {
   VectorXd fix_ecef_std = predicted_std.segment<STATE_ECEF_POS_ERR_LEN>(STATE_ECEF_POS_ERR_START);
   VectorXd vel_ecef = predicted_state.segment<STATE_ECEF_VELOCITY_LEN>(STATE_ECEF_VELOCITY_START);
   VectorXd vel_ecef_std = predicted_std.segment<STATE_ECEF_VELOCITY_ERR_LEN>(STATE_ECEF_VELOCITY_ERR_START);
-  VectorXd fix_pos_geo_vec = this->get_position_geodetic();
+  Geodetic fix_pos_geo = ecef2geodetic(fix_ecef_ecef);
+  VectorXd fix_pos_geo_vec = Vector3d(fix_pos_geo.lat, fix_pos_geo.lon, fix_pos_geo.alt);
   //fix_pos_geo_std = np.abs(coord.ecef2geodetic(fix_ecef + fix_ecef_std) - fix_pos_geo)
   VectorXd orientation_ecef = quat2euler(vector2quat(predicted_state.segment<STATE_ECEF_ORIENTATION_LEN>(STATE_ECEF_ORIENTATION_START)));
   VectorXd orientation_ecef_std = predicted_std.segment<STATE_ECEF_ORIENTATION_ERR_LEN>(STATE_ECEF_ORIENTATION_ERR_START);
@@ -189,6 +198,11 @@ VectorXd Localizer::get_position_geodetic() {
 
 void Localizer::handle_sensors(double current_time, const capnp::List<cereal::SensorEventData, capnp::Kind::STRUCT>::Reader& log) {
   // TODO does not yet account for double sensor readings in the log
+  // The gyro and accel samples of the message are preintegrated into their mean and observed together at the
+  // time of the newest sample, so the message costs one predict instead of one per sample
+  Vector3d gyro_sum = Vector3d::Zero(), accel_sum = Vector3d::Zero();
+  int gyro_n = 0, accel_n = 0;
+  double obs_time = NAN;
   for (int i = 0; i < log.size(); i++) {
     const cereal::SensorEventData::Reader& sensor_reading = log[i];
 
@@ -202,7 +216,7 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
     // sensor time and log time should be close
     if (std::abs(current_time - sensor_time) > 0.1) {
       LOGE("Sensor reading ignored, sensor timestamp more than 100ms off from log time");
-      return;
+      break;
     }
 
       // TODO: handle messages from two IMUs at the same time
@@ -215,7 +229,9 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
       auto v = sensor_reading.getGyroUncalibrated().getV();
       auto meas = Vector3d(-v[2], -v[1], -v[0]);
       if (meas.norm() < ROTATION_SANITY_CHECK) {
-        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_GYRO, { meas });
+        gyro_sum += meas;
+        gyro_n++;
+        obs_time = std::isnan(obs_time) ? sensor_time : std::max(obs_time, sensor_time);
       }
     }
 
@@ -229,10 +245,22 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
 
       auto meas = Vector3d(-v[2], -v[1], -v[0]);
       if (meas.norm() < ACCEL_SANITY_CHECK) {
-        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_ACCEL, { meas });
+        accel_sum += meas;
+        accel_n++;
+        obs_time = std::isnan(obs_time) ? sensor_time : std::max(obs_time, sensor_time);
       }
     }
   }
+
+  // the mean of n samples has 1/n of the noise variance of one
+  if (gyro_n > 0) {
+    this->kf->predict_and_observe(obs_time, OBSERVATION_PHONE_GYRO, { gyro_sum / gyro_n },
+                                  this->kf->get_R(OBSERVATION_PHONE_GYRO, 1, 1.0 / gyro_n));
+  }
+  if (accel_n > 0) {
+    this->kf->predict_and_observe(obs_time, OBSERVATION_PHONE_ACCEL, { accel_sum / accel_n },
+                                  this->kf->get_R(OBSERVATION_PHONE_ACCEL, 1, 1.0 / accel_n));
+  }
 }
 
 void Localizer::handle_gps(double current_time, const cereal::GpsLocationData::Reader& log) {
@@ -440,49 +468,77 @@ bool Localizer::isGpsOK() {
 }
 
 int Localizer::locationd_thread() {
-  const std::initializer_list<const char *> service_list =
-      { "gpsLocationExternal", "sensorEvents", "cameraOdometry", "liveCalibration", "carState" };
   PubMaster pm({ "liveLocationKalman" });
-  SubMaster sm(service_list, nullptr, { "gpsLocationExternal" });
+  SubMaster sm({ "gpsLocationExternal", "sensorEvents", "cameraOdometry", "liveCalibration", "carState" },
+               nullptr, { "gpsLocationExternal" });
+  const PubMaster::Handle live_location_h = pm.handle("liveLocationKalman");
+  const SubMaster::Handle sensors_h = sm.handle("sensorEvents");
+  const SubMaster::Handle cam_odo_h = sm.handle("cameraOdometry");
+
+  // one handler per service, in the order handle_msg had them
+  typedef void (*handler_t)(Localizer *l, double t, const cereal::Event::Reader &log);
+  const std::pair<SubMaster::Handle, handler_t> handlers[] = {
+    { sm.handle("gpsLocationExternal"), [](Localizer *l, double t, const cereal::Event::Reader &log) { l->handle_gps(t, log.getGpsLocationExternal()); } },
+    { sensors_h, [](Localizer *l, double t, const cereal::Event::Reader &log) { l->handle_sensors(t, log.getSensorEvents()); } },
+    { cam_odo_h, [](Localizer *l, double t, const cereal::Event::Reader &log) { l->handle_cam_odo(t, log.getCameraOdometry()); } },
+    { sm.handle("liveCalibration"), [](Localizer *l, double t, const cereal::Event::Reader &log) { l->handle_live_calib(t, log.getLiveCalibration()); } },
+    { sm.handle("carState"), [](Localizer *l, double t, const cereal::Event::Reader &log) { l->handle_car_state(t, log.getCarState()); } },
+  };
 
   Params params;
+  // the builders of liveLocationKalman reuse the first segment of the arena
+  MessageArena arena;
 
+  // cameraOdometry arrival to liveLocationKalman publish
+  double latency_sum_ms = 0, latency_max_ms = 0;
+  int latency_n = 0;
+
+  static AllocStats allocs("locationd");
   while (!do_exit) {
     sm.update();
-    for (const char* service : service_list) {
-      if (sm.updated(service) && sm.valid(service)) {
-        const cereal::Event::Reader log = sm[service];
-        this->handle_msg(log);
+    NoAllocRegion region(allocs);
+    for (auto &[h, handler] : handlers) {
+      if (sm.updated(h) && sm.valid(h)) {
+        const cereal::Event::Reader &log = sm[h];
+        double t = log.getLogMonoTime() * 1e-9;
+        this->time_check(t);
+        handler(this, t, log);
+        this->finite_check();
+        this->update_reset_tracker();
       }
     }
 
-    if (sm.updated("cameraOdometry")) {
-      uint64_t logMonoTime = sm["cameraOdometry"].getLogMonoTime();
+    if (sm.updated(cam_odo_h)) {
+      uint64_t logMonoTime = sm[cam_odo_h].getLogMonoTime();
       bool inputsOK = sm.allAliveAndValid();
-      bool sensorsOK = sm.alive("sensorEvents") && sm.valid("sensorEvents");
+      bool sensorsOK = sm.alive(sensors_h) && sm.valid(sensors_h);
       bool gpsOK = this->isGpsOK();
 
-      MessageBuilder msg_builder;
+      MessageBuilder msg_builder(arena);
       kj::ArrayPtr<capnp::byte> bytes = this->get_message_bytes(msg_builder, logMonoTime, inputsOK, sensorsOK, gpsOK);
-      pm.send("liveLocationKalman", bytes.begin(), bytes.size());
+      pm.send(live_location_h, bytes.begin(), bytes.size());
+
+      double latency_ms = (nanos_since_boot() - sm.rcv_time(cam_odo_h)) * 1e-6;
+      latency_sum_ms += latency_ms;
+      latency_max_ms = std::max(latency_max_ms, latency_ms);
+      if (++latency_n == 1200) {
+        LOGD("liveLocationKalman latency: mean %.3fms, max %.3fms", latency_sum_ms / latency_n, latency_max_ms);
+        latency_sum_ms = latency_max_ms = 0;
+        latency_n = 0;
+      }
 
       if (sm.frame % 1200 == 0 && gpsOK) {  // once a minute
         VectorXd posGeo = this->get_position_geodetic();
         std::string lastGPSPosJSON = util::string_format(
           "{\"latitude\": %.15f, \"longitude\": %.15f, \"altitude\": %.15f}", posGeo(0), posGeo(1), posGeo(2));
 
-        std::thread([&params] (const std::string gpsjson) {
-          params.put("LastGPSPosition", gpsjson);
-        }, lastGPSPosJSON).detach();
+        // LAZY, it's written with the next batch of the params
+        params.put("LastGPSPosition", lastGPSPosJSON);
       }
     }
   }
-  return 0;
-}
-
-int main() {
-  set_realtime_priority(5);
 
-  Localizer localizer;
-  return localizer.locationd_thread();
+  std::string summary = alloc_summary();
+  if (!summary.empty()) LOGW("allocations:\n%s", summary.c_str());
+  return 0;
 }
@@ -0,0 +1,227 @@
+#include <bzlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "selfdrive/locationd/locationd.h"
+
+// Replays the locationd inputs of an rlog through Localizer::handle_msg_bytes as fast as it goes,
+// and builds a liveLocationKalman after every cameraOdometry like locationd_thread. Reports events/s,
+// the p50 and p99 of the handle time and the heap allocations per service, and the largest difference
+// of the built liveLocationKalman to the one locationd published in real time when the rlog was recorded.
+// The replay is in log order, locationd_thread handles messages that arrive together in service order,
+// so small differences can come from that. Exits with 1 when a difference is above the tolerance
+// usage: locationd_bench <rlog or rlog.bz2> [tolerance]
+
+static size_t num_allocs = 0;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+
+extern "C" void *malloc(size_t size) {
+  num_allocs++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  num_allocs++;
+  return __libc_calloc(n, size);
+}
+
+static std::string read_log(const char *fn) {
+  std::ifstream f(fn, std::ios::binary);
+  std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  if (raw.size() < 3 || raw.compare(0, 3, "BZh") != 0) return raw;
+
+  std::string out;
+  bz_stream strm = {};
+  BZ2_bzDecompressInit(&strm, 0, 0);
+  strm.next_in = raw.data();
+  strm.avail_in = raw.size();
+  int ret = BZ_OK;
+  char buf[1 << 16];
+  while (ret == BZ_OK) {
+    strm.next_out = buf;
+    strm.avail_out = sizeof(buf);
+    ret = BZ2_bzDecompress(&strm);
+    out.append(buf, sizeof(buf) - strm.avail_out);
+    // concatenated streams, rlogs are written in parallel blocks
+    if (ret == BZ_STREAM_END && strm.avail_in > 0) {
+      BZ2_bzDecompressEnd(&strm);
+      char *next = strm.next_in;
+      unsigned int avail = strm.avail_in;
+      strm = {};
+      BZ2_bzDecompressInit(&strm, 0, 0);
+      strm.next_in = next;
+      strm.avail_in = avail;
+      ret = BZ_OK;
+    }
+  }
+  BZ2_bzDecompressEnd(&strm);
+  if (ret != BZ_STREAM_END) fprintf(stderr, "%s: bz2 error %d, using what decompressed\n", fn, ret);
+  return out;
+}
+
+struct Service {
+  const char *name;
+  cereal::Event::Which which;
+  std::vector<double> us;
+  size_t allocs = 0;
+};
+
+typedef cereal::LiveLocationKalman::Measurement::Reader (*field_t)(const cereal::LiveLocationKalman::Reader &l);
+static const std::pair<const char *, field_t> fields[] = {
+  {"positionECEF", [](const cereal::LiveLocationKalman::Reader &l) { return l.getPositionECEF(); }},
+  {"velocityECEF", [](const cereal::LiveLocationKalman::Reader &l) { return l.getVelocityECEF(); }},
+  {"orientationECEF", [](const cereal::LiveLocationKalman::Reader &l) { return l.getOrientationECEF(); }},
+  {"orientationNED", [](const cereal::LiveLocationKalman::Reader &l) { return l.getOrientationNED(); }},
+  {"angularVelocityCalibrated", [](const cereal::LiveLocationKalman::Reader &l) { return l.getAngularVelocityCalibrated(); }},
+  {"accelerationCalibrated", [](const cereal::LiveLocationKalman::Reader &l) { return l.getAccelerationCalibrated(); }},
+};
+const int NUM_FIELDS = std::size(fields);
+
+// the values and stds of the fields, 3 each
+static std::vector<double> flatten(const cereal::LiveLocationKalman::Reader &l) {
+  std::vector<double> v;
+  for (auto &[name, field] : fields) {
+    auto m = field(l);
+    for (int i = 0; i < 3; i++) v.push_back(i < m.getValue().size() ? m.getValue()[i] : NAN);
+    for (int i = 0; i < 3; i++) v.push_back(i < m.getStd().size() ? m.getStd()[i] : NAN);
+  }
+  return v;
+}
+
+static double percentile(std::vector<double> v, double p) {
+  auto it = v.begin() + (v.size() - 1) * p;
+  std::nth_element(v.begin(), it, v.end());
+  return *it;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <rlog or rlog.bz2> [tolerance]\n", argv[0]);
+    return 1;
+  }
+  const double tolerance = argc > 2 ? atof(argv[2]) : 1e-6;
+
+  std::string log = read_log(argv[1]);
+  std::vector<capnp::word> words(log.size() / sizeof(capnp::word));
+  memcpy(words.data(), log.data(), words.size() * sizeof(capnp::word));
+
+  Service services[] = {
+    {"sensorEvents", cereal::Event::SENSOR_EVENTS},
+    {"gpsLocationExternal", cereal::Event::GPS_LOCATION_EXTERNAL},
+    {"carState", cereal::Event::CAR_STATE},
+    {"cameraOdometry", cereal::Event::CAMERA_ODOMETRY},
+    {"liveCalibration", cereal::Event::LIVE_CALIBRATION},
+  };
+  Service build = {"liveLocationKalman", cereal::Event::LIVE_LOCATION_KALMAN};
+
+  // the inputs as locationd_thread gets them, and what it published
+  struct Input {
+    kj::ArrayPtr<const capnp::word> bytes;
+    Service *service;
+    uint64_t logMonoTime;
+  };
+  std::vector<Input> inputs;
+  std::vector<std::vector<double>> recorded;
+  kj::ArrayPtr<const capnp::word> remaining(words.data(), words.size());
+  while (remaining.size() > 0) {
+    capnp::FlatArrayMessageReader msg(remaining);
+    auto event = msg.getRoot<cereal::Event>();
+    kj::ArrayPtr<const capnp::word> bytes(remaining.begin(), msg.getEnd());
+    if (event.isLiveLocationKalman()) {
+      recorded.push_back(flatten(event.getLiveLocationKalman()));
+    } else if (event.getValid()) {
+      for (Service &s : services) {
+        if (event.which() == s.which) inputs.push_back({bytes, &s, event.getLogMonoTime()});
+      }
+    }
+    remaining = kj::arrayPtr(msg.getEnd(), remaining.end());
+  }
+  if (inputs.empty()) {
+    fprintf(stderr, "no locationd inputs in %s\n", argv[1]);
+    return 1;
+  }
+
+  Localizer localizer;
+  MessageArena arena;
+  std::vector<std::vector<double>> outputs;
+  for (const Input &in : inputs) {
+    size_t allocs = num_allocs;
+    auto t1 = std::chrono::steady_clock::now();
+    localizer.handle_msg_bytes((const char *)in.bytes.begin(), in.bytes.asBytes().size());
+    auto t2 = std::chrono::steady_clock::now();
+    in.service->allocs += num_allocs - allocs;
+    in.service->us.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+
+    if (in.service->which == cereal::Event::CAMERA_ODOMETRY) {
+      allocs = num_allocs;
+      t1 = std::chrono::steady_clock::now();
+      MessageBuilder msg_builder(arena);
+      kj::ArrayPtr<capnp::byte> bytes = localizer.get_message_bytes(msg_builder, in.logMonoTime, true, true, localizer.isGpsOK());
+      t2 = std::chrono::steady_clock::now();
+      build.allocs += num_allocs - allocs;
+      build.us.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+
+      // out of the timing, the arena is reused by the next one
+      capnp::FlatArrayMessageReader cmsg(kj::arrayPtr((const capnp::word *)bytes.begin(), bytes.size() / sizeof(capnp::word)));
+      outputs.push_back(flatten(cmsg.getRoot<cereal::Event>().getLiveLocationKalman()));
+    }
+  }
+  // of the timed calls only, without the copies for the comparison
+  double total_s = 0;
+  size_t total_allocs = 0;
+  for (const Service *s : {&services[0], &services[1], &services[2], &services[3], &services[4], &build}) {
+    for (double us : s->us) total_s += us * 1e-6;
+    total_allocs += s->allocs;
+  }
+
+  printf("%zu events in %.3fs, %.0f events/s, %.2f allocs/event\n", inputs.size(), total_s, inputs.size() / total_s,
+         (double)total_allocs / inputs.size());
+  printf("%-22s %8s %9s %9s %9s\n", "service", "events", "p50 us", "p99 us", "alloc/ev");
+  for (const Service *s : {&services[0], &services[1], &services[2], &services[3], &services[4], &build}) {
+    if (s->us.empty()) continue;
+    printf("%-22s %8zu %9.2f %9.2f %9.2f\n", s->name, s->us.size(), percentile(s->us, 0.5), percentile(s->us, 0.99),
+           (double)s->allocs / s->us.size());
+  }
+
+  if (recorded.empty()) {
+    printf("no liveLocationKalman in %s, nothing to compare\n", argv[1]);
+    return 0;
+  }
+  if (recorded.size() != outputs.size()) {
+    printf("%zu liveLocationKalman built, %zu recorded, comparing the first ones\n", outputs.size(), recorded.size());
+  }
+
+  // largest absolute difference of the values and stds of each field
+  bool ok = true;
+  const size_t n = std::min(recorded.size(), outputs.size());
+  printf("%-26s %12s %12s\n", "field", "max diff", "max std diff");
+  for (int f = 0; f < NUM_FIELDS; f++) {
+    double diff = 0, std_diff = 0;
+    for (size_t i = 0; i < n; i++) {
+      for (int j = 0; j < 3; j++) {
+        double a = outputs[i][f * 6 + j], b = recorded[i][f * 6 + j];
+        double sa = outputs[i][f * 6 + 3 + j], sb = recorded[i][f * 6 + 3 + j];
+        // nan where both have nan, like the uncalibrated fields
+        if (std::isnan(a) != std::isnan(b)) diff = INFINITY;
+        if (!std::isnan(a) && !std::isnan(b)) diff = std::max(diff, std::abs(a - b));
+        if (std::isnan(sa) != std::isnan(sb)) std_diff = INFINITY;
+        if (!std::isnan(sa) && !std::isnan(sb)) std_diff = std::max(std_diff, std::abs(sa - sb));
+      }
+    }
+    printf("%-26s %12.3g %12.3g\n", fields[f].first, diff, std_diff);
+    ok = ok && diff <= tolerance && std_diff <= tolerance;
+  }
+  printf("%s at tolerance %g\n", ok ? "equal" : "NOT equal", tolerance);
+  return ok ? 0 : 1;
+}
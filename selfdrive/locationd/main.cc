@@ -0,0 +1,10 @@
+#include "selfdrive/common/alloc_tracker.h"
+#include "selfdrive/locationd/locationd.h"
+
+int main() {
+  set_realtime_priority(5);
+  rt_memory_lock();
+
+  Localizer localizer;
+  return localizer.locationd_thread();
+}
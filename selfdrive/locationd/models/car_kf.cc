@@ -0,0 +1,49 @@
+#include "car_kf.h"
+
+#include <array>
+#include <cassert>
+
+using namespace EKFS;
+using namespace Eigen;
+
+CarKalman::CarKalman(double steer_ratio, double stiffness_factor, double angle_offset) {
+  this->initial_x = car_initial_x;
+  this->initial_x(CAR_STATE_STEER_RATIO_START) = steer_ratio;
+  this->initial_x(CAR_STATE_STIFFNESS_START) = stiffness_factor;
+  this->initial_x(CAR_STATE_ANGLE_OFFSET_START) = angle_offset;
+
+  this->Q = car_Q_diag.asDiagonal();
+  this->initial_P = this->Q;
+  for (auto& pair : car_obs_noise_diag) {
+    this->obs_noise[pair.first] = pair.second.asDiagonal();
+  }
+
+  // init filter
+  this->filter = std::make_unique<CarEKF>(this->name, Map<MatrixXdr>(this->Q.data(), this->Q.rows(), this->Q.cols()),
+    Map<VectorXd>(this->initial_x.data(), this->initial_x.rows()),
+    Map<MatrixXdr>(this->initial_P.data(), this->initial_P.rows(), this->initial_P.cols()));
+}
+
+void CarKalman::set_global(const std::string &var, double val) {
+  this->filter->set_global(var, val);
+}
+
+const CarEKF::VectorX &CarKalman::get_x() const {
+  return this->filter->state();
+}
+
+double CarKalman::get_filter_time() const {
+  return this->filter->get_filter_time();
+}
+
+void CarKalman::reset_time(double t) {
+  this->filter->set_filter_time(t);
+  this->filter->reset_rewind();
+}
+
+void CarKalman::predict_and_observe(double t, int kind, const VectorXd &meas, const MatrixXdr &R) {
+  assert(R.size() > 0 || this->obs_noise.count(kind));
+  const std::array<VectorXd, 1> z = {meas};
+  const std::array<MatrixXdr, 1> Rs = {R.size() > 0 ? R : this->obs_noise.at(kind)};
+  this->filter->predict_and_update_batch(t, kind, z, Rs);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Dense>
+
+#include "generated/car_kf_constants.h"
+#include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
+
+using namespace EKFS;
+
+// the generated car filter, its observations are of one value or two, one at a time
+typedef EKFSymFixed<CAR_DIM_STATE, CAR_DIM_STATE, 2, 1> CarEKF;
+
+// The car parameters filter of car_kf.py, stiffness, steer ratio and angle offsets, for paramsd
+class CarKalman {
+public:
+  CarKalman(double steer_ratio = 15.0, double stiffness_factor = 1.0, double angle_offset = 0.0);
+
+  void set_global(const std::string &var, double val);
+
+  const CarEKF::VectorX &get_x() const;
+  double get_filter_time() const;
+  // the time of the filter moved to t with no predict, and the rewind dropped
+  void reset_time(double t);
+
+  // one measurement of kind, R the noise of the kind when not given
+  void predict_and_observe(double t, int kind, const Eigen::VectorXd &meas, const MatrixXdr &R = MatrixXdr());
+
+private:
+  std::string name = "car";
+
+  std::unique_ptr<CarEKF> filter;
+
+  Eigen::VectorXd initial_x;
+  MatrixXdr initial_P;
+  MatrixXdr Q;  // process noise
+  std::unordered_map<int, MatrixXdr> obs_noise;
+};
@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
+import inspect
 import math
+import os
 import sys
 from typing import Any, Dict
 
@@ -147,7 +149,32 @@ class CarKalman(KalmanFilter):
       [sp.Matrix([x]), ObservationKind.STIFFNESS, None],
     ]
 
-    gen_code(generated_dir, name, f_sym, dt, state_sym, obs_eqs, dim_state, dim_state, global_vars=global_vars)
+    gen_code(generated_dir, name, f_sym, dt, state_sym, obs_eqs, dim_state, dim_state, global_vars=global_vars, cse=True)
+
+    # write constants to extra header file for use in cpp, for paramsd
+    from selfdrive.locationd.models.live_kf import numpy2eigenstring
+    car_kf_header = "#pragma once\n\n"
+    car_kf_header += "#include <unordered_map>\n"
+    car_kf_header += "#include <eigen3/Eigen/Dense>\n\n"
+    car_kf_header += f'#define CAR_DIM_STATE {dim_state}\n\n'
+    for state, slc in inspect.getmembers(States, lambda x: type(x) == slice):
+      assert(slc.step is None)  # unsupported
+      car_kf_header += f'#define CAR_STATE_{state}_START {slc.start}\n'
+      car_kf_header += f'#define CAR_STATE_{state}_LEN {slc.stop - slc.start}\n'
+    car_kf_header += "\n"
+
+    for kind, val in inspect.getmembers(ObservationKind, lambda x: type(x) == int):
+      car_kf_header += f'#define OBSERVATION_{kind} {val}\n'
+    car_kf_header += "\n"
+
+    car_kf_header += f"static const Eigen::VectorXd car_initial_x = {numpy2eigenstring(CarKalman.initial_x)};\n"
+    car_kf_header += f"static const Eigen::VectorXd car_Q_diag = {numpy2eigenstring(np.diag(CarKalman.Q))};\n"
+    car_kf_header += "static const std::unordered_map<int, Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> car_obs_noise_diag = {\n"
+    for kind, noise in CarKalman.obs_noise.items():
+      car_kf_header += f"  {{ {kind}, {numpy2eigenstring(np.diag(noise))} }},\n"
+    car_kf_header += "};\n\n"
+
+    open(os.path.join(generated_dir, "car_kf_constants.h"), 'w').write(car_kf_header)
 
   def __init__(self, generated_dir, steer_ratio=15, stiffness_factor=1, angle_offset=0):  # pylint: disable=super-init-not-called
     dim_state = self.initial_x.shape[0]
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "rednose/helpers/common_ekf.h"
+
+// Times the sympy generated functions of the live and car filters, f and F as separate routines
+// against fF_fun, and per observation kind h and H against hH, which share their subexpressions.
+// The fused routines only exist when the filter was generated with cse
+// usage: kf_sym_benchmark [iterations]
+
+// larger than the state and error state of any filter
+const int MAX_DIM = 64;
+
+template <typename F>
+static double time_us(int iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) f();
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void bench(const char *name, int iterations) {
+  const EKF *ekf = ekf_lookup(name);
+  if (!ekf) {
+    printf("%s: not in libkf\n", name);
+    return;
+  }
+
+  // values around 1 keep the trigonometry and divisions of the models finite
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> dist(0.5, 1.5);
+  std::vector<double> x(MAX_DIM), ea(MAX_DIM), out1(MAX_DIM), out2(MAX_DIM * MAX_DIM);
+  for (double &v : x) v = dist(rng);
+  for (double &v : ea) v = dist(rng);
+  const double dt = 0.01;
+
+  // like the car parameters of paramsd
+  for (auto &[var, set] : ekf->sets) set(1.0);
+
+  double separate = time_us(iterations, [&] {
+    ekf->f_fun(x.data(), dt, out1.data());
+    ekf->F_fun(x.data(), dt, out2.data());
+  });
+  printf("%s f, F   %8.3f us", name, separate);
+  if (ekf->fF_fun) {
+    double fused = time_us(iterations, [&] { ekf->fF_fun(x.data(), dt, out1.data(), out2.data()); });
+    printf("  fF %8.3f us", fused);
+  }
+  printf("\n");
+
+  for (int kind : ekf->kinds) {
+    separate = time_us(iterations, [&] {
+      ekf->hs.at(kind)(x.data(), ea.data(), out1.data());
+      ekf->Hs.at(kind)(x.data(), ea.data(), out2.data());
+    });
+    printf("%s h, H %2d %8.3f us", name, kind, separate);
+    auto hH = ekf->hHs.find(kind);
+    if (hH != ekf->hHs.end()) {
+      double fused = time_us(iterations, [&] { hH->second(x.data(), ea.data(), out1.data(), out2.data()); });
+      printf("  hH %8.3f us", fused);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  bench("live", iterations);
+  bench("car", iterations);
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "live_kf.h"
 
+#include <algorithm>
+
 using namespace EKFS;
 using namespace Eigen;
 
@@ -28,8 +30,8 @@ std::vector<Eigen::Map<MatrixXdr>> get_vec_mapmat(std::vector<MatrixXdr>& mat_ve
 }
 
 LiveKalman::LiveKalman() {
-  this->dim_state = 23;
-  this->dim_state_err = 22;
+  this->dim_state = LIVE_DIM_STATE;
+  this->dim_state_err = LIVE_DIM_STATE_ERR;
 
   this->initial_x = live_initial_x;
   this->initial_P = live_initial_P_diag.asDiagonal();
@@ -39,23 +41,24 @@ LiveKalman::LiveKalman() {
   }
 
   // init filter
-  this->filter = std::make_shared<EKFSym>(this->name, get_mapmat(this->Q), get_mapvec(this->initial_x),
-    get_mapmat(initial_P),  this->dim_state, this->dim_state_err, 0, 0, 0, std::vector<int>(),
-    std::vector<int>{3}, std::vector<std::string>(), 0.2);
+  this->filter = std::unique_ptr<LiveEKF>(new LiveEKF(this->name, get_mapmat(this->Q), get_mapvec(this->initial_x),
+    get_mapmat(initial_P), std::vector<int>{3}, 0.2));
 }
 
 void LiveKalman::init_state(VectorXd& state, VectorXd& covs_diag, double filter_time) {
   MatrixXdr covs = covs_diag.asDiagonal();
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  this->init_state(state, covs, filter_time);
 }
 
 void LiveKalman::init_state(VectorXd& state, MatrixXdr& covs, double filter_time) {
   this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  this->queue.clear();
+  this->newest_time = filter_time;
 }
 
 void LiveKalman::init_state(VectorXd& state, double filter_time) {
   MatrixXdr covs = this->filter->covs();
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  this->init_state(state, covs, filter_time);
 }
 
 VectorXd LiveKalman::get_x() {
@@ -70,16 +73,48 @@ double LiveKalman::get_filter_time() {
   return this->filter->get_filter_time();
 }
 
-std::vector<MatrixXdr> LiveKalman::get_R(int kind, int n) {
+std::vector<MatrixXdr> LiveKalman::get_R(int kind, int n, double scale) {
   std::vector<MatrixXdr> R;
   for (int i = 0; i < n; i++) {
-    R.push_back(this->obs_noise[kind]);
+    R.push_back(this->obs_noise[kind] * scale);
   }
   return R;
 }
 
-std::optional<Estimate> LiveKalman::predict_and_observe(double t, int kind, std::vector<VectorXd> meas, std::vector<MatrixXdr> R) {
-  std::optional<Estimate> r;
+void LiveKalman::set_fixed_lag(double lag) {
+  this->fixed_lag = lag;
+}
+
+std::optional<LiveEKF::Estimate> LiveKalman::predict_and_observe(double t, int kind, const std::vector<VectorXd>& meas, std::vector<MatrixXdr> R) {
+  if (!(t <= this->newest_time)) {
+    this->newest_time = t;
+  }
+  if (this->fixed_lag <= 0.0) {
+    return this->process_observation(t, kind, meas, R);
+  }
+
+  // equal times keep their order of arrival
+  auto it = std::upper_bound(this->queue.begin(), this->queue.end(), t,
+                             [](double t, const QueuedObservation& o) { return t < o.t; });
+  this->queue.insert(it, {t, kind, meas, R});
+  while (!this->queue.empty() && this->queue.front().t <= this->newest_time - this->fixed_lag) {
+    QueuedObservation& o = this->queue.front();
+    this->process_observation(o.t, o.kind, o.meas, o.R);
+    this->queue.pop_front();
+  }
+  return std::nullopt;
+}
+
+void LiveKalman::get_predicted(VectorXd& x, MatrixXdr& P) {
+  LiveEKF::VectorX x_pred;
+  LiveEKF::MatrixP P_pred;
+  this->filter->predicted(this->newest_time, x_pred, P_pred);
+  x = x_pred;
+  P = P_pred;
+}
+
+std::optional<LiveEKF::Estimate> LiveKalman::process_observation(double t, int kind, const std::vector<VectorXd>& meas, std::vector<MatrixXdr> R) {
+  std::optional<LiveEKF::Estimate> r;
   switch (kind) {
   case OBSERVATION_CAMERA_ODO_TRANSLATION:
     r = this->predict_and_update_odo_trans(meas, t, kind);
@@ -94,38 +129,38 @@ std::optional<Estimate> LiveKalman::predict_and_observe(double t, int kind, std:
     if (R.size() == 0) {
       R = this->get_R(kind, meas.size());
     }
-    r = this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(meas), get_vec_mapmat(R));
+    r = this->filter->predict_and_update_batch(t, kind, meas, R);
     break;
   }
   return r;
 }
 
-std::optional<Estimate> LiveKalman::predict_and_update_odo_speed(std::vector<VectorXd> speed, double t, int kind) {
+std::optional<LiveEKF::Estimate> LiveKalman::predict_and_update_odo_speed(const std::vector<VectorXd>& speed, double t, int kind) {
   std::vector<MatrixXdr> R;
   R.assign(speed.size(), (MatrixXdr(1, 1) << std::pow(0.2, 2)).finished().asDiagonal());
-  return this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(speed), get_vec_mapmat(R));
+  return this->filter->predict_and_update_batch(t, kind, speed, R);
 }
 
-std::optional<Estimate> LiveKalman::predict_and_update_odo_trans(std::vector<VectorXd> trans, double t, int kind) {
+std::optional<LiveEKF::Estimate> LiveKalman::predict_and_update_odo_trans(const std::vector<VectorXd>& trans, double t, int kind) {
   std::vector<VectorXd> z;
   std::vector<MatrixXdr> R;
-  for (VectorXd& trns : trans) {
+  for (const VectorXd& trns : trans) {
     assert(trns.size() == 6); // TODO remove
     z.push_back(trns.head(3));
     R.push_back(trns.segment<3>(3).array().square().matrix().asDiagonal());
   }
-  return this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(z), get_vec_mapmat(R));
+  return this->filter->predict_and_update_batch(t, kind, z, R);
 }
 
-std::optional<Estimate> LiveKalman::predict_and_update_odo_rot(std::vector<VectorXd> rot, double t, int kind) {
+std::optional<LiveEKF::Estimate> LiveKalman::predict_and_update_odo_rot(const std::vector<VectorXd>& rot, double t, int kind) {
   std::vector<VectorXd> z;
   std::vector<MatrixXdr> R;
-  for (VectorXd& rt : rot) {
+  for (const VectorXd& rt : rot) {
     assert(rt.size() == 6); // TODO remove
     z.push_back(rt.head(3));
     R.push_back(rt.segment<3>(3).array().square().matrix().asDiagonal());
   }
-  return this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(z), get_vec_mapmat(R));
+  return this->filter->predict_and_update_batch(t, kind, z, R);
 }
 
 Eigen::VectorXd LiveKalman::get_initial_x() {
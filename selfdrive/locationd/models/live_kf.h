@@ -2,6 +2,7 @@
 
 #include <string>
 #include <cmath>
+#include <deque>
 #include <memory>
 
 #include <eigen3/Eigen/Core>
@@ -9,11 +10,15 @@
 
 #include "generated/live_kf_constants.h"
 #include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
 
 #define EARTH_GM 3.986005e14  // m^3/s^2 (gravitational constant * mass of earth)
 
 using namespace EKFS;
 
+// the generated live filter, with its dimensions fixed at compile time
+typedef EKFSymFixed<LIVE_DIM_STATE, LIVE_DIM_STATE_ERR> LiveEKF;
+
 Eigen::Map<Eigen::VectorXd> get_mapvec(Eigen::VectorXd& vec);
 Eigen::Map<MatrixXdr> get_mapmat(MatrixXdr& mat);
 std::vector<Eigen::Map<Eigen::VectorXd>> get_vec_mapvec(std::vector<Eigen::VectorXd>& vec_vec);
@@ -30,12 +35,17 @@ public:
   Eigen::VectorXd get_x();
   MatrixXdr get_P();
   double get_filter_time();
-  std::vector<MatrixXdr> get_R(int kind, int n);
-
-  std::optional<Estimate> predict_and_observe(double t, int kind, std::vector<Eigen::VectorXd> meas, std::vector<MatrixXdr> R = {});
-  std::optional<Estimate> predict_and_update_odo_speed(std::vector<Eigen::VectorXd> speed, double t, int kind);
-  std::optional<Estimate> predict_and_update_odo_trans(std::vector<Eigen::VectorXd> trans, double t, int kind);
-  std::optional<Estimate> predict_and_update_odo_rot(std::vector<Eigen::VectorXd> rot, double t, int kind);
+  std::vector<MatrixXdr> get_R(int kind, int n, double scale = 1.0);
+
+  // With a fixed lag the observations are queued and processed in time order once they are that much older than
+  // the newest one, so late ones within the lag need no rewind of the filter. Those return no estimate.
+  void set_fixed_lag(double lag);
+  std::optional<LiveEKF::Estimate> predict_and_observe(double t, int kind, const std::vector<Eigen::VectorXd>& meas, std::vector<MatrixXdr> R = {});
+  // the state predicted to the newest observation, ahead of the filter by up to the fixed lag
+  void get_predicted(Eigen::VectorXd& x, MatrixXdr& P);
+  std::optional<LiveEKF::Estimate> predict_and_update_odo_speed(const std::vector<Eigen::VectorXd>& speed, double t, int kind);
+  std::optional<LiveEKF::Estimate> predict_and_update_odo_trans(const std::vector<Eigen::VectorXd>& trans, double t, int kind);
+  std::optional<LiveEKF::Estimate> predict_and_update_odo_rot(const std::vector<Eigen::VectorXd>& rot, double t, int kind);
 
   Eigen::VectorXd get_initial_x();
   MatrixXdr get_initial_P();
@@ -43,9 +53,11 @@ public:
   MatrixXdr H(Eigen::VectorXd in);
 
 private:
+  std::optional<LiveEKF::Estimate> process_observation(double t, int kind, const std::vector<Eigen::VectorXd>& meas, std::vector<MatrixXdr> R);
+
   std::string name = "live";
 
-  std::shared_ptr<EKFSym> filter;
+  std::unique_ptr<LiveEKF> filter;
 
   int dim_state;
   int dim_state_err;
@@ -54,4 +66,14 @@ private:
   MatrixXdr initial_P;
   MatrixXdr Q;  // process noise
   std::unordered_map<int, MatrixXdr> obs_noise;
+
+  struct QueuedObservation {
+    double t;
+    int kind;
+    std::vector<Eigen::VectorXd> meas;
+    std::vector<MatrixXdr> R;
+  };
+  double fixed_lag = 0.0;
+  double newest_time = NAN;
+  std::deque<QueuedObservation> queue;  // ordered by t
 };
@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "selfdrive/locationd/models/live_kf.h"
+
+// Runs the same stream of gyro, accel and camera odometry observations through the live filter
+// as EKFSym and as LiveEKF, checks that both end in the same state and times predict_and_update_batch.
+// Every 20th camera observation is late by 50ms so the rewind is part of the numbers
+// usage: live_kf_benchmark [seconds of observations]
+
+struct Obs {
+  double t;
+  int kind;
+  std::vector<Eigen::VectorXd> z;
+  std::vector<MatrixXdr> R;
+};
+
+static std::vector<Obs> make_observations(int seconds) {
+  std::mt19937 rng(0);
+  std::normal_distribution<double> noise(0.0, 0.01);
+  auto vec3 = [&](double x, double y, double z) {
+    return (Eigen::VectorXd(3) << x + noise(rng), y + noise(rng), z + noise(rng)).finished();
+  };
+
+  std::vector<Obs> obs;
+  for (int i = 0; i < seconds * 100; i++) {
+    double t = i * 0.01;
+    obs.push_back({t, OBSERVATION_PHONE_GYRO, {vec3(0.0, 0.0, 0.0)}, {live_obs_noise_diag.at(OBSERVATION_PHONE_GYRO).asDiagonal()}});
+    obs.push_back({t, OBSERVATION_PHONE_ACCEL, {vec3(0.0, 0.0, 9.81)}, {live_obs_noise_diag.at(OBSERVATION_PHONE_ACCEL).asDiagonal()}});
+    if (i % 5 == 0) {
+      double t_cam = (i % 100 == 0 && i > 0) ? t - 0.05 : t;
+      MatrixXdr R = Eigen::Vector3d(0.01, 0.01, 0.01).asDiagonal();
+      obs.push_back({t_cam, OBSERVATION_CAMERA_ODO_ROTATION, {vec3(0.0, 0.0, 0.0)}, {R}});
+      obs.push_back({t_cam, OBSERVATION_CAMERA_ODO_TRANSLATION, {vec3(10.0, 0.0, 0.0)}, {R}});
+    }
+  }
+  return obs;
+}
+
+int main(int argc, char *argv[]) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  std::vector<Obs> obs = make_observations(seconds);
+
+  Eigen::VectorXd x = live_initial_x;
+  MatrixXdr P = live_initial_P_diag.asDiagonal();
+  MatrixXdr Q = live_Q_diag.asDiagonal();
+
+  EKFSym dynamic("live", get_mapmat(Q), get_mapvec(x), get_mapmat(P), LIVE_DIM_STATE, LIVE_DIM_STATE_ERR,
+    0, 0, 0, std::vector<int>(), std::vector<int>{3}, std::vector<std::string>(), 0.2);
+  std::unique_ptr<LiveEKF> fixed(new LiveEKF("live", get_mapmat(Q), get_mapvec(x), get_mapmat(P), std::vector<int>{3}, 0.2));
+
+  auto start = std::chrono::steady_clock::now();
+  for (Obs &o : obs) {
+    dynamic.predict_and_update_batch(o.t, o.kind, get_vec_mapvec(o.z), get_vec_mapmat(o.R));
+  }
+  double dynamic_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (Obs &o : obs) {
+    fixed->predict_and_update_batch(o.t, o.kind, o.z, o.R);
+  }
+  double fixed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  double err = (dynamic.state() - Eigen::VectorXd(fixed->state())).cwiseAbs().maxCoeff();
+  printf("%zu observations, max state difference %g\n", obs.size(), err);
+  printf("EKFSym   %8.3f us per observation\n", dynamic_us / obs.size());
+  printf("LiveEKF  %8.3f us per observation\n", fixed_us / obs.size());
+  return err < 1e-6 ? 0 : 1;
+}
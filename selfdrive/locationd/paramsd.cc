@@ -0,0 +1,211 @@
+#include "selfdrive/locationd/paramsd.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "json11.hpp"
+
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+using namespace Eigen;
+
+ExitHandler do_exit;
+const double DT_MDL = 0.05;
+const double MAX_ANGLE_OFFSET_DELTA = 20 * DT_MDL;  // Max 20 deg/s
+
+// as math.radians and math.degrees, so the values are those of paramsd.py to the bit
+static double radians(double deg) { return deg * (M_PI / 180.0); }
+static double degrees(double rad) { return rad * (180.0 / M_PI); }
+
+static VectorXd scalar(double v) {
+  return (VectorXd(1) << v).finished();
+}
+
+ParamsLearner::ParamsLearner(const cereal::CarParams::Reader &CP, double steer_ratio, double stiffness_factor, double angle_offset) {
+  this->kf = std::make_unique<CarKalman>(steer_ratio, stiffness_factor, angle_offset);
+
+  this->kf->set_global("mass", CP.getMass());
+  this->kf->set_global("rotational_inertia", CP.getRotationalInertia());
+  this->kf->set_global("center_to_front", CP.getCenterToFront());
+  this->kf->set_global("center_to_rear", CP.getWheelbase() - CP.getCenterToFront());
+  this->kf->set_global("stiffness_front", CP.getTireStiffnessFront());
+  this->kf->set_global("stiffness_rear", CP.getTireStiffnessRear());
+}
+
+void ParamsLearner::handle_log(double t, const cereal::Event::Reader &log) {
+  if (log.isLiveLocationKalman()) {
+    this->handle_live_location(t, log.getLiveLocationKalman());
+  } else if (log.isCarState()) {
+    this->handle_car_state(t, log.getCarState());
+  }
+
+  if (!this->active) {
+    // Reset time when stopped so uncertainty doesn't grow
+    this->kf->reset_time(t);
+  }
+}
+
+void ParamsLearner::handle_live_location(double t, const cereal::LiveLocationKalman::Reader &msg) {
+  auto angular_velocity = msg.getAngularVelocityCalibrated();
+  if (angular_velocity.getValue().size() < 3 || angular_velocity.getStd().size() < 3) return;
+  double yaw_rate = angular_velocity.getValue()[2];
+  double yaw_rate_std = angular_velocity.getStd()[2];
+
+  bool yaw_rate_valid = angular_velocity.getValid();
+  yaw_rate_valid = yaw_rate_valid && 0 < yaw_rate_std && yaw_rate_std < 10;  // rad/s
+  yaw_rate_valid = yaw_rate_valid && std::abs(yaw_rate) < 1;  // rad/s
+
+  if (this->active) {
+    if (msg.getInputsOK() && msg.getPosenetOK() && yaw_rate_valid) {
+      this->kf->predict_and_observe(t, OBSERVATION_ROAD_FRAME_YAW_RATE, scalar(-yaw_rate),
+                                    (MatrixXdr(1, 1) << yaw_rate_std * yaw_rate_std).finished());
+    }
+    this->kf->predict_and_observe(t, OBSERVATION_ANGLE_OFFSET_FAST, scalar(0));
+  }
+}
+
+void ParamsLearner::handle_car_state(double t, const cereal::CarState::Reader &msg) {
+  this->steering_angle = msg.getSteeringAngleDeg();
+  this->steering_pressed = msg.getSteeringPressed();
+  this->speed = msg.getVEgo();
+
+  bool in_linear_region = std::abs(this->steering_angle) < 45 || !this->steering_pressed;
+  this->active = this->speed > 5 && in_linear_region;
+
+  if (this->active) {
+    this->kf->predict_and_observe(t, OBSERVATION_STEER_ANGLE, scalar(radians(msg.getSteeringAngleDeg())));
+    this->kf->predict_and_observe(t, OBSERVATION_ROAD_FRAME_X_SPEED, scalar(this->speed));
+  }
+}
+
+Paramsd::Paramsd(const cereal::CarParams::Reader &CP, double steer_ratio, double stiffness_factor, double angle_offset_average_deg)
+  : car_fingerprint(CP.getCarFingerprint().cStr()), car_steer_ratio(CP.getSteerRatio()),
+    min_sr(0.5 * CP.getSteerRatio()), max_sr(2.0 * CP.getSteerRatio()),
+    angle_offset_average(angle_offset_average_deg), angle_offset(angle_offset_average_deg) {
+  this->car_params.setRoot(CP);
+  this->learner = std::make_unique<ParamsLearner>(CP, steer_ratio, stiffness_factor, radians(angle_offset_average_deg));
+}
+
+void Paramsd::build_live_parameters(cereal::LiveParametersData::Builder live_parameters) {
+  const CarEKF::VectorX *x = &this->learner->kf->get_x();
+  if (!x->allFinite()) {
+    LOGE("NaN in liveParameters estimate. Resetting to default values");
+    this->learner = std::make_unique<ParamsLearner>(this->car_params.getRoot<cereal::CarParams>().asReader(), this->car_steer_ratio, 1.0, 0.0);
+    x = &this->learner->kf->get_x();
+  }
+
+  const double offset = (*x)(CAR_STATE_ANGLE_OFFSET_START);
+  const double offset_fast = (*x)(CAR_STATE_ANGLE_OFFSET_FAST_START);
+  this->angle_offset_average = std::clamp(degrees(offset), this->angle_offset_average - MAX_ANGLE_OFFSET_DELTA, this->angle_offset_average + MAX_ANGLE_OFFSET_DELTA);
+  this->angle_offset = std::clamp(degrees(offset + offset_fast), this->angle_offset - MAX_ANGLE_OFFSET_DELTA, this->angle_offset + MAX_ANGLE_OFFSET_DELTA);
+
+  live_parameters.setPosenetValid(true);
+  live_parameters.setSensorValid(true);
+  live_parameters.setSteerRatio((*x)(CAR_STATE_STEER_RATIO_START));
+  live_parameters.setStiffnessFactor((*x)(CAR_STATE_STIFFNESS_START));
+  live_parameters.setAngleOffsetAverageDeg(this->angle_offset_average);
+  live_parameters.setAngleOffsetDeg(this->angle_offset);
+  // the checks are on the float32 values of the message, as in paramsd.py
+  this->steer_ratio = live_parameters.getSteerRatio();
+  this->stiffness_factor = live_parameters.getStiffnessFactor();
+  live_parameters.setValid(std::abs(live_parameters.getAngleOffsetAverageDeg()) < 10.0 &&
+                           std::abs(live_parameters.getAngleOffsetDeg()) < 10.0 &&
+                           0.2 <= this->stiffness_factor && this->stiffness_factor <= 5.0 &&
+                           this->min_sr <= this->steer_ratio && this->steer_ratio <= this->max_sr);
+}
+
+std::string Paramsd::params_json() const {
+  return json11::Json(json11::Json::object {
+    {"carFingerprint", this->car_fingerprint},
+    {"steerRatio", this->steer_ratio},
+    {"stiffnessFactor", this->stiffness_factor},
+    {"angleOffsetAverageDeg", (double)(float)this->angle_offset_average},
+  }).dump();
+}
+
+// the steer ratio and angle offset learnt on the last drive of the car, when they are sane
+static void initial_values(Params &params, const cereal::CarParams::Reader &CP, double &steer_ratio, double &angle_offset_average) {
+  steer_ratio = CP.getSteerRatio();
+  angle_offset_average = 0.0;
+
+  std::string err;
+  json11::Json last = json11::Json::parse(params.get("LiveParameters"), err);
+  if (!err.empty() || !last.is_object()) {
+    LOGW("Parameter learner resetting to default values");
+    return;
+  }
+  if (last["carFingerprint"].string_value() != CP.getCarFingerprint().cStr()) {
+    LOGW("Parameter learner found parameters for wrong car.");
+    return;
+  }
+  const double last_sr = last["steerRatio"].number_value();
+  const double last_offset = last["angleOffsetAverageDeg"].number_value();
+  if (!last["steerRatio"].is_number() || !last["angleOffsetAverageDeg"].is_number() ||
+      std::abs(last_offset) >= 10.0 || last_sr < 0.5 * CP.getSteerRatio() || last_sr > 2.0 * CP.getSteerRatio()) {
+    LOGW("Invalid starting values found %s", last.dump().c_str());
+    return;
+  }
+  steer_ratio = last_sr;
+  angle_offset_average = last_offset;
+}
+
+int paramsd_thread() {
+  Params params;
+  // wait for stats about the car to come in from controls
+  LOGW("paramsd is waiting for CarParams");
+  std::string car_params_bytes;
+  while (!do_exit && (car_params_bytes = params.get("CarParams")).empty()) {
+    util::sleep_for(100);
+  }
+  if (do_exit) return 0;
+  LOGW("paramsd got CarParams");
+
+  AlignedBuffer aligned_buf;
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.align(car_params_bytes.data(), car_params_bytes.size()));
+  cereal::CarParams::Reader CP = cmsg.getRoot<cereal::CarParams>();
+
+  double steer_ratio, angle_offset_average;
+  initial_values(params, CP, steer_ratio, angle_offset_average);
+
+  // When driving in wet conditions the stiffness can go down, and then be too low on the next drive
+  // Without a way to detect this the stiffness is the one of the setting on every drive
+  std::string stiffness_adj = params.get("TireStiffnessFactorAdj");
+  const double stiffness_factor = stiffness_adj.empty() ? 1.0 : std::atof(stiffness_adj.c_str()) / 100.0;
+
+  Paramsd paramsd(CP, steer_ratio, stiffness_factor, angle_offset_average);
+
+  PubMaster pm({"liveParameters"});
+  SubMaster sm({"liveLocationKalman", "carState"});
+  const SubMaster::Handle live_location_h = sm.handle("liveLocationKalman");
+  const SubMaster::Handle car_state_h = sm.handle("carState");
+
+  uint64_t published = 0;
+  while (!do_exit) {
+    sm.update();
+
+    // in the order of the services of paramsd.py
+    for (SubMaster::Handle h : {live_location_h, car_state_h}) {
+      if (sm.updated(h)) {
+        const cereal::Event::Reader &log = sm[h];
+        paramsd.handle_log(log.getLogMonoTime() * 1e-9, log);
+      }
+    }
+
+    if (sm.updated(live_location_h)) {
+      MessageBuilder msg;
+      auto event = msg.initEvent();
+      event.setLogMonoTime(sm[car_state_h].getLogMonoTime());
+      paramsd.build_live_parameters(event.initLiveParameters());
+
+      if (++published % 1200 == 0) {  // once a minute
+        // LAZY, it's written with the next batch of the params
+        params.put("LiveParameters", paramsd.params_json());
+      }
+
+      pm.send("liveParameters", msg);
+    }
+  }
+  return 0;
+}
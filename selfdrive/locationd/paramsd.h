@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/locationd/models/car_kf.h"
+
+// The car parameter learner of paramsd.py, the car filter run on carState and liveLocationKalman
+class ParamsLearner {
+public:
+  ParamsLearner(const cereal::CarParams::Reader &CP, double steer_ratio, double stiffness_factor, double angle_offset);
+
+  void handle_log(double t, const cereal::Event::Reader &log);
+  void handle_live_location(double t, const cereal::LiveLocationKalman::Reader &msg);
+  void handle_car_state(double t, const cereal::CarState::Reader &msg);
+
+  std::unique_ptr<CarKalman> kf;
+
+private:
+  bool active = false;
+  double speed = 0.0;
+  bool steering_pressed = false;
+  double steering_angle = 0.0;
+};
+
+// paramsd, the learner with the liveParameters built from it, from the values of the last drive
+class Paramsd {
+public:
+  Paramsd(const cereal::CarParams::Reader &CP, double steer_ratio, double stiffness_factor, double angle_offset_average_deg);
+
+  void handle_log(double t, const cereal::Event::Reader &log) { this->learner->handle_log(t, log); }
+  // after a liveLocationKalman, a NaN in the estimate resets the learner to the values of the car
+  void build_live_parameters(cereal::LiveParametersData::Builder live_parameters);
+  // the LiveParameters param of the last build
+  std::string params_json() const;
+
+  const CarKalman &kf() const { return *this->learner->kf; }
+
+private:
+  const std::string car_fingerprint;
+  const double car_steer_ratio;
+  const double min_sr, max_sr;
+  std::unique_ptr<ParamsLearner> learner;
+
+  double angle_offset_average;
+  double angle_offset;
+  double steer_ratio = 0.0, stiffness_factor = 0.0;
+
+  // the CarParams the learner is reset to, copied out of the param
+  capnp::MallocMessageBuilder car_params;
+};
+
+int paramsd_thread();
@@ -0,0 +1,7 @@
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/paramsd.h"
+
+int main() {
+  set_realtime_priority(5);
+  return paramsd_thread();
+}
@@ -0,0 +1,49 @@
+#include <cstdio>
+
+#include "selfdrive/loggerd/logreader.h"
+#include "selfdrive/locationd/paramsd.h"
+
+// Runs the carState and liveLocationKalman of a log through the C++ paramsd, in log order, from the
+// carParams of the log and the default starting values. After every liveLocationKalman it prints the
+// state of the car filter and the liveParameters built, one line of %.17g values, for the comparison
+// with paramsd.py in test/test_paramsd.py
+// usage: ./paramsd_replay rlog
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s rlog\n", argv[0]);
+    return 1;
+  }
+  LogReader log;
+  if (!log.load(argv[1])) {
+    fprintf(stderr, "%s: can't be read\n", argv[1]);
+    return 1;
+  }
+
+  std::unique_ptr<capnp::FlatArrayMessageReader> car_params;
+  for (uint32_t i : log.service(cereal::Event::CAR_PARAMS)) {
+    car_params = std::make_unique<capnp::FlatArrayMessageReader>(log.events()[i].words);
+    break;
+  }
+  if (!car_params) {
+    fprintf(stderr, "%s: no carParams\n", argv[1]);
+    return 1;
+  }
+  cereal::CarParams::Reader CP = car_params->getRoot<cereal::Event>().getCarParams();
+  Paramsd paramsd(CP, CP.getSteerRatio(), 1.0, 0.0);
+
+  for (const LogReader::Event &e : log.events()) {
+    if (e.which != cereal::Event::CAR_STATE && e.which != cereal::Event::LIVE_LOCATION_KALMAN) continue;
+    capnp::FlatArrayMessageReader msg(e.words);
+    cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+    paramsd.handle_log(e.mono_time * 1e-9, event);
+    if (e.which != cereal::Event::LIVE_LOCATION_KALMAN) continue;
+
+    MessageBuilder out;
+    auto live_parameters = out.initEvent().initLiveParameters();
+    paramsd.build_live_parameters(live_parameters);
+    for (int i = 0; i < CAR_DIM_STATE; i++) printf("%.17g ", paramsd.kf().get_x()(i));
+    printf("%.17g %.17g %.17g %.17g %d\n", live_parameters.getSteerRatio(), live_parameters.getStiffnessFactor(),
+           live_parameters.getAngleOffsetAverageDeg(), live_parameters.getAngleOffsetDeg(), live_parameters.getValid());
+  }
+  return 0;
+}
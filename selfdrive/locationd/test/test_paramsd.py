@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+import math
+import os
+import random
+import subprocess
+import tempfile
+import unittest
+
+import numpy as np
+
+import cereal.messaging as messaging
+from selfdrive.locationd.paramsd import ParamsLearner
+
+REPLAY = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "paramsd_replay")
+
+
+def car_params():
+  msg = messaging.new_message('carParams')
+  CP = msg.carParams
+  CP.carFingerprint = "TEST"
+  CP.mass = 1500.
+  CP.rotationalInertia = 2500.
+  CP.wheelbase = 2.7
+  CP.centerToFront = 1.2
+  CP.tireStiffnessFront = 2e5
+  CP.tireStiffnessRear = 2.4e5
+  CP.steerRatio = 15.
+  return msg
+
+
+def drive(seconds=60.):
+  # a drive that starts and stops, with turns, steering presses and bad yaw rates
+  random.seed(0)
+  msgs = [car_params()]
+  for i in range(int(seconds * 100)):
+    t = i * 0.01
+    v = max(0., 20. * math.sin(t / 20.))
+    angle = 30. * math.sin(t / 3.) + random.gauss(0., 0.5)
+
+    cs = messaging.new_message('carState')
+    cs.logMonoTime = int(t * 1e9)
+    cs.carState.vEgo = v
+    cs.carState.steeringAngleDeg = angle
+    cs.carState.steeringPressed = 4. < t % 10. < 5.
+    msgs.append(cs)
+
+    if i % 5 == 0:
+      llk = messaging.new_message('liveLocationKalman')
+      llk.logMonoTime = int(t * 1e9) + 1000
+      yaw_rate = v * math.radians(angle) / 15. / 2.7 + random.gauss(0., 0.01)
+      llk.liveLocationKalman.angularVelocityCalibrated.value = [0., 0., -yaw_rate]
+      llk.liveLocationKalman.angularVelocityCalibrated.std = [0.01, 0.01, 0.02 if i % 300 else 20.]
+      llk.liveLocationKalman.angularVelocityCalibrated.valid = True
+      llk.liveLocationKalman.inputsOK = True
+      llk.liveLocationKalman.posenetOK = i % 700 != 0
+      msgs.append(llk)
+  return msgs
+
+
+class TestParamsd(unittest.TestCase):
+  def test_cpp_matches_python(self):
+    msgs = drive()
+
+    CP = msgs[0].carParams
+    learner = ParamsLearner(CP, CP.steerRatio, 1.0, 0.0)
+    expected = []
+    for m in msgs[1:]:
+      learner.handle_log(m.logMonoTime * 1e-9, m.which(), getattr(m, m.which()))
+      if m.which() == 'liveLocationKalman':
+        expected.append(np.array(learner.kf.x))
+
+    with tempfile.NamedTemporaryFile(suffix=".rlog") as f:
+      f.write(b"".join(m.to_bytes() for m in msgs))
+      f.flush()
+      out = subprocess.check_output([REPLAY, f.name], encoding='utf8')
+    dim = len(expected[0])
+    got = [np.array([float(v) for v in line.split()[:dim]]) for line in out.splitlines()]
+
+    self.assertEqual(len(got), len(expected))
+    np.testing.assert_allclose(np.array(got), np.array(expected), rtol=1e-9, atol=1e-12)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -94,6 +94,27 @@ bool UbloxMsgParser::add_data(const uint8_t *incoming_data, uint32_t incoming_da
 
 
 std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
+  // NAV-PVT and RXM-RAWX come at the measurement rate, they are read straight from the parse buffer
+  const uint8_t *payload = msg_parse_buf + ublox::UBLOX_HEADER_SIZE;
+  const uint16_t msg_type = (msg_parse_buf[2] << 8) | msg_parse_buf[3];
+  const uint16_t payload_size = UBLOX_MSG_SIZE(msg_parse_buf);
+  if (msg_type == 0x0107) {
+    if (payload_size < sizeof(ublox::ubx_nav_pvt_t)) {
+      LOGE("NAV-PVT too short: %d", payload_size);
+      return {"gpsLocationExternal", kj::Array<capnp::word>()};
+    }
+    return {"gpsLocationExternal", gen_nav_pvt((const ublox::ubx_nav_pvt_t *)payload)};
+  } else if (msg_type == 0x0215) {
+    const ublox::ubx_rxm_rawx_t *rawx = (const ublox::ubx_rxm_rawx_t *)payload;
+    if (payload_size < sizeof(ublox::ubx_rxm_rawx_t) ||
+        payload_size < sizeof(ublox::ubx_rxm_rawx_t) + rawx->numMeas * sizeof(ublox::ubx_rxm_rawx_meas_t)) {
+      LOGE("RXM-RAWX too short: %d", payload_size);
+      return {"ubloxGnss", kj::Array<capnp::word>()};
+    }
+    return {"ubloxGnss", gen_rxm_rawx(rawx)};
+  }
+
+  // the rare ones through kaitai
   std::string dat = data();
   kaitai::kstream stream(dat);
 
@@ -101,15 +122,9 @@ std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
   auto body = ubx_message.body();
 
   switch (ubx_message.msg_type()) {
-  case 0x0107:
-    return {"gpsLocationExternal", gen_nav_pvt(static_cast<ubx_t::nav_pvt_t*>(body))};
-    break;
   case 0x0213:
     return {"ubloxGnss", gen_rxm_sfrbx(static_cast<ubx_t::rxm_sfrbx_t*>(body))};
     break;
-  case 0x0215:
-    return {"ubloxGnss", gen_rxm_rawx(static_cast<ubx_t::rxm_rawx_t*>(body))};
-    break;
   case 0x0a09:
     return {"ubloxGnss", gen_mon_hw(static_cast<ubx_t::mon_hw_t*>(body))};
     break;
@@ -124,32 +139,32 @@ std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
 }
 
 
-kj::Array<capnp::word> UbloxMsgParser::gen_nav_pvt(ubx_t::nav_pvt_t *msg) {
+kj::Array<capnp::word> UbloxMsgParser::gen_nav_pvt(const ublox::ubx_nav_pvt_t *msg) {
   MessageBuilder msg_builder;
   auto gpsLoc = msg_builder.initEvent().initGpsLocationExternal();
   gpsLoc.setSource(cereal::GpsLocationData::SensorSource::UBLOX);
-  gpsLoc.setFlags(msg->flags());
-  gpsLoc.setLatitude(msg->lat() * 1e-07);
-  gpsLoc.setLongitude(msg->lon() * 1e-07);
-  gpsLoc.setAltitude(msg->height() * 1e-03);
-  gpsLoc.setSpeed(msg->g_speed() * 1e-03);
-  gpsLoc.setBearingDeg(msg->head_mot() * 1e-5);
-  gpsLoc.setAccuracy(msg->h_acc() * 1e-03);
+  gpsLoc.setFlags(msg->flags);
+  gpsLoc.setLatitude(msg->lat * 1e-07);
+  gpsLoc.setLongitude(msg->lon * 1e-07);
+  gpsLoc.setAltitude(msg->height * 1e-03);
+  gpsLoc.setSpeed(msg->gSpeed * 1e-03);
+  gpsLoc.setBearingDeg(msg->headMot * 1e-5);
+  gpsLoc.setAccuracy(msg->hAcc * 1e-03);
   std::tm timeinfo = std::tm();
-  timeinfo.tm_year = msg->year() - 1900;
-  timeinfo.tm_mon = msg->month() - 1;
-  timeinfo.tm_mday = msg->day();
-  timeinfo.tm_hour = msg->hour();
-  timeinfo.tm_min = msg->min();
-  timeinfo.tm_sec = msg->sec();
+  timeinfo.tm_year = msg->year - 1900;
+  timeinfo.tm_mon = msg->month - 1;
+  timeinfo.tm_mday = msg->day;
+  timeinfo.tm_hour = msg->hour;
+  timeinfo.tm_min = msg->min;
+  timeinfo.tm_sec = msg->sec;
 
   std::time_t utc_tt = timegm(&timeinfo);
-  gpsLoc.setTimestamp(utc_tt * 1e+03 + msg->nano() * 1e-06);
-  float f[] = { msg->vel_n() * 1e-03f, msg->vel_e() * 1e-03f, msg->vel_d() * 1e-03f };
+  gpsLoc.setTimestamp(utc_tt * 1e+03 + msg->nano * 1e-06);
+  float f[] = { msg->velN * 1e-03f, msg->velE * 1e-03f, msg->velD * 1e-03f };
   gpsLoc.setVNED(f);
-  gpsLoc.setVerticalAccuracy(msg->v_acc() * 1e-03);
-  gpsLoc.setSpeedAccuracy(msg->s_acc() * 1e-03);
-  gpsLoc.setBearingAccuracyDeg(msg->head_acc() * 1e-05);
+  gpsLoc.setVerticalAccuracy(msg->vAcc * 1e-03);
+  gpsLoc.setSpeedAccuracy(msg->sAcc * 1e-03);
+  gpsLoc.setBearingAccuracyDeg(msg->headAcc * 1e-05);
   return capnp::messageToFlatArray(msg_builder);
 }
 
@@ -260,41 +275,41 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
   return kj::Array<capnp::word>();
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(ubx_t::rxm_rawx_t *msg) {
+kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(const ublox::ubx_rxm_rawx_t *msg) {
   MessageBuilder msg_builder;
   auto mr = msg_builder.initEvent().initUbloxGnss().initMeasurementReport();
-  mr.setRcvTow(msg->rcv_tow());
-  mr.setGpsWeek(msg->week());
-  mr.setLeapSeconds(msg->leap_s());
-  mr.setGpsWeek(msg->week());
-
-  auto mb = mr.initMeasurements(msg->num_meas());
-  auto measurements = *msg->measurements();
-  for(int8_t i = 0; i < msg->num_meas(); i++) {
-    mb[i].setSvId(measurements[i]->sv_id());
-    mb[i].setPseudorange(measurements[i]->pr_mes());
-    mb[i].setCarrierCycles(measurements[i]->cp_mes());
-    mb[i].setDoppler(measurements[i]->do_mes());
-    mb[i].setGnssId(measurements[i]->gnss_id());
-    mb[i].setGlonassFrequencyIndex(measurements[i]->freq_id());
-    mb[i].setLocktime(measurements[i]->lock_time());
-    mb[i].setCno(measurements[i]->cno());
-    mb[i].setPseudorangeStdev(0.01 * (pow(2, (measurements[i]->pr_stdev() & 15)))); // weird scaling, might be wrong
-    mb[i].setCarrierPhaseStdev(0.004 * (measurements[i]->cp_stdev() & 15));
-    mb[i].setDopplerStdev(0.002 * (pow(2, (measurements[i]->do_stdev() & 15)))); // weird scaling, might be wrong
+  mr.setRcvTow(msg->rcvTow);
+  mr.setGpsWeek(msg->week);
+  mr.setLeapSeconds(msg->leapS);
+  mr.setGpsWeek(msg->week);
+
+  auto mb = mr.initMeasurements(msg->numMeas);
+  for(int i = 0; i < msg->numMeas; i++) {
+    const ublox::ubx_rxm_rawx_meas_t &meas = msg->meas[i];
+    mb[i].setSvId(meas.svId);
+    mb[i].setPseudorange(meas.prMes);
+    mb[i].setCarrierCycles(meas.cpMes);
+    mb[i].setDoppler(meas.doMes);
+    mb[i].setGnssId(meas.gnssId);
+    mb[i].setGlonassFrequencyIndex(meas.freqId);
+    mb[i].setLocktime(meas.locktime);
+    mb[i].setCno(meas.cno);
+    mb[i].setPseudorangeStdev(0.01 * (pow(2, (meas.prStdev & 15)))); // weird scaling, might be wrong
+    mb[i].setCarrierPhaseStdev(0.004 * (meas.cpStdev & 15));
+    mb[i].setDopplerStdev(0.002 * (pow(2, (meas.doStdev & 15)))); // weird scaling, might be wrong
 
     auto ts = mb[i].initTrackingStatus();
-    auto trk_stat = measurements[i]->trk_stat();
+    auto trk_stat = meas.trkStat;
     ts.setPseudorangeValid(bit_to_bool(trk_stat, 0));
     ts.setCarrierPhaseValid(bit_to_bool(trk_stat, 1));
     ts.setHalfCycleValid(bit_to_bool(trk_stat, 2));
     ts.setHalfCycleSubtracted(bit_to_bool(trk_stat, 3));
   }
 
-  mr.setNumMeas(msg->num_meas());
+  mr.setNumMeas(msg->numMeas);
   auto rs = mr.initReceiverStatus();
-  rs.setLeapSecValid(bit_to_bool(msg->rec_stat(), 0));
-  rs.setClkReset(bit_to_bool(msg->rec_stat(), 2));
+  rs.setLeapSecValid(bit_to_bool(msg->recStat, 0));
+  rs.setClkReset(bit_to_bool(msg->recStat, 2));
   return capnp::messageToFlatArray(msg_builder);
 }
 
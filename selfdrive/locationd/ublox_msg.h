@@ -46,6 +46,74 @@ namespace ublox {
     uint32_t tAccNs;
   } __attribute__((packed));
 
+  // Payloads of the hot messages, decoded in place from the parse buffer instead of through kaitai.
+  // Little endian like the receiver, the field types follow ubx.ksy
+  struct ubx_nav_pvt_t {
+    uint32_t iTOW;
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t min;
+    uint8_t sec;
+    uint8_t valid;
+    uint32_t tAcc;
+    int32_t nano;
+    uint8_t fixType;
+    uint8_t flags;
+    uint8_t flags2;
+    uint8_t numSV;
+    int32_t lon;
+    int32_t lat;
+    int32_t height;
+    int32_t hMSL;
+    uint32_t hAcc;
+    uint32_t vAcc;
+    int32_t velN;
+    int32_t velE;
+    int32_t velD;
+    int32_t gSpeed;
+    int32_t headMot;
+    int32_t sAcc;
+    uint32_t headAcc;
+    uint16_t pDOP;
+    uint8_t flags3;
+    uint8_t reserved1[5];
+    int32_t headVeh;
+    int16_t magDec;
+    uint16_t magAcc;
+  } __attribute__((packed));
+  static_assert(sizeof(ubx_nav_pvt_t) == 92);
+
+  struct ubx_rxm_rawx_meas_t {
+    double prMes;
+    double cpMes;
+    float doMes;
+    uint8_t gnssId;
+    uint8_t svId;
+    uint8_t reserved2;
+    uint8_t freqId;
+    uint16_t locktime;
+    uint8_t cno;
+    uint8_t prStdev;
+    uint8_t cpStdev;
+    uint8_t doStdev;
+    uint8_t trkStat;
+    uint8_t reserved3;
+  } __attribute__((packed));
+  static_assert(sizeof(ubx_rxm_rawx_meas_t) == 32);
+
+  struct ubx_rxm_rawx_t {
+    double rcvTow;
+    uint16_t week;
+    int8_t leapS;
+    uint8_t numMeas;
+    uint8_t recStat;
+    uint8_t reserved1[3];
+    ubx_rxm_rawx_meas_t meas[];
+  } __attribute__((packed));
+  static_assert(sizeof(ubx_rxm_rawx_t) == 16);
+
   inline std::string ubx_add_checksum(const std::string &msg) {
     assert(msg.size() > 2);
 
@@ -96,9 +164,9 @@ class UbloxMsgParser {
     inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
 
     std::pair<std::string, kj::Array<capnp::word>> gen_msg();
-    kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
+    kj::Array<capnp::word> gen_nav_pvt(const ublox::ubx_nav_pvt_t *msg);
     kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
-    kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
+    kj::Array<capnp::word> gen_rxm_rawx(const ublox::ubx_rxm_rawx_t *msg);
     kj::Array<capnp::word> gen_mon_hw(ubx_t::mon_hw_t *msg);
     kj::Array<capnp::word> gen_mon_hw2(ubx_t::mon_hw2_t *msg);
 
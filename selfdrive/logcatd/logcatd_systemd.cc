@@ -1,9 +1,11 @@
 #include <systemd/sd-journal.h>
 
+#include <algorithm>
 #include <cassert>
 #include <csignal>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "json11.hpp"
 
@@ -11,10 +13,52 @@
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
+// the fields of an entry that are read, the message is them as json
+const char *FIELDS[] = {"MESSAGE", "PRIORITY", "SYSLOG_IDENTIFIER", "_PID", "_COMM", "_SYSTEMD_UNIT"};
+
+// The entries are sent in one androidLogs event once the first of them is BATCH_US old, or there
+// are MAX_BATCH of them, so a crash looping service is a few events a second. An event stays under
+// the third of the 4MB segment of androidLogs msgq takes at most, a burst of long lines is sent in
+// several of them
+const uint64_t BATCH_US = 100 * 1000;
+const size_t MAX_BATCH = 1000;
+const size_t MAX_BATCH_BYTES = 1024 * 1024;
+// of an entry in the event besides its strings, the struct and the pointers, with room for padding
+const size_t ENTRY_OVERHEAD_BYTES = 96;
+// a field is cut there, so one entry fits the budget even with everything in it escaped in the json
+const size_t MAX_FIELD_BYTES = 128 * 1024;
+
+struct Entry {
+  uint64_t ts;
+  std::map<std::string, std::string> kv;
+  std::string message;
+};
+
+static size_t entry_bytes(const Entry &entry) {
+  auto it = entry.kv.find("SYSLOG_IDENTIFIER");
+  return ENTRY_OVERHEAD_BYTES + entry.message.size() + (it != entry.kv.end() ? it->second.size() : 0);
+}
+
+static void send_batch(PubMaster &pm, std::vector<Entry> &batch) {
+  MessageBuilder msg;
+  auto entries = msg.initEvent().initAndroidLogs(batch.size());
+  for (int i = 0; i < batch.size(); i++) {
+    auto &kv = batch[i].kv;
+    auto androidEntry = entries[i];
+    androidEntry.setTs(batch[i].ts);
+    androidEntry.setMessage(batch[i].message);
+    if (kv.count("_PID")) androidEntry.setPid(std::atoi(kv["_PID"].c_str()));
+    if (kv.count("PRIORITY")) androidEntry.setPriority(std::atoi(kv["PRIORITY"].c_str()));
+    if (kv.count("SYSLOG_IDENTIFIER")) androidEntry.setTag(kv["SYSLOG_IDENTIFIER"]);
+  }
+  pm.send("androidLogs", msg);
+  batch.clear();
+}
+
 ExitHandler do_exit;
 int main(int argc, char *argv[]) {
 
-  PubMaster pm({"androidLog"});
+  PubMaster pm({"androidLogs"});
 
   sd_journal *journal;
   int err = sd_journal_open(&journal, 0);
@@ -24,48 +68,60 @@ int main(int argc, char *argv[]) {
   err = sd_journal_seek_tail(journal);
   assert(err >= 0);
 
+  std::vector<Entry> batch;
+  uint64_t batch_start = 0;
+  size_t batch_bytes = 0;
   while (!do_exit) {
-    err = sd_journal_next(journal);
-    assert(err >= 0);
-
-    // Wait for new message if we didn't receive anything
-    if (err == 0) {
-      err = sd_journal_wait(journal, 1000 * 1000);
-      assert (err >= 0);
-      continue; // Try again
-    }
-
-    uint64_t timestamp = 0;
-    err = sd_journal_get_realtime_usec(journal, &timestamp);
-    assert(err >= 0);
-
-    const void *data;
-    size_t length;
-    std::map<std::string, std::string> kv;
-
-    SD_JOURNAL_FOREACH_DATA(journal, data, length) {
-      std::string str((char*)data, length);
-
-      // Split "KEY=VALUE"" on "=" and put in map
-      std::size_t found = str.find("=");
-      if (found != std::string::npos) {
-        kv[str.substr(0, found)] = str.substr(found + 1, std::string::npos);
+    const int next = sd_journal_next(journal);
+    assert(next >= 0);
+
+    const uint64_t now = nanos_since_boot() / 1000;
+    if (next > 0) {
+      Entry &entry = batch.emplace_back();
+      err = sd_journal_get_realtime_usec(journal, &entry.ts);
+      assert(err >= 0);
+
+      for (const char *field : FIELDS) {
+        const void *data;
+        size_t length;
+        if (sd_journal_get_data(journal, field, &data, &length) < 0) continue;
+
+        // "KEY=VALUE"
+        std::string str((char*)data, std::min(length, MAX_FIELD_BYTES));
+        std::size_t found = str.find("=");
+        if (found != std::string::npos) {
+          entry.kv[str.substr(0, found)] = str.substr(found + 1, std::string::npos);
+        }
       }
+      entry.message = json11::Json(entry.kv).dump();
+
+      // the entry that would take the event over the budget goes in the next one
+      const size_t bytes = entry_bytes(entry);
+      if (batch.size() > 1 && batch_bytes + bytes > MAX_BATCH_BYTES) {
+        Entry pending = std::move(entry);
+        batch.pop_back();
+        send_batch(pm, batch);
+        batch.push_back(std::move(pending));
+        batch_bytes = 0;
+      }
+      batch_bytes += bytes;
+      if (batch.size() == 1) batch_start = now;
     }
 
-    MessageBuilder msg;
-
-    // Build message
-    auto androidEntry = msg.initEvent().initAndroidLog();
-    androidEntry.setTs(timestamp);
-    androidEntry.setMessage(json11::Json(kv).dump());
-    if (kv.count("_PID")) androidEntry.setPid(std::atoi(kv["_PID"].c_str()));
-    if (kv.count("PRIORITY")) androidEntry.setPriority(std::atoi(kv["PRIORITY"].c_str()));
-    if (kv.count("SYSLOG_IDENTIFIER")) androidEntry.setTag(kv["SYSLOG_IDENTIFIER"]);
+    if (!batch.empty() && (now >= batch_start + BATCH_US || batch.size() >= MAX_BATCH || batch_bytes >= MAX_BATCH_BYTES)) {
+      send_batch(pm, batch);
+      batch_bytes = 0;
+    }
 
-    pm.send("androidLog", msg);
+    // Wait for new messages if we didn't receive anything, or until the batch is due
+    if (next == 0) {
+      const uint64_t timeout = batch.empty() ? 1000 * 1000 : batch_start + BATCH_US - std::min(now, batch_start + BATCH_US);
+      err = sd_journal_wait(journal, timeout);
+      assert (err >= 0);
+    }
   }
 
+  if (!batch.empty()) send_batch(pm, batch);
   sd_journal_close(journal);
   return 0;
 }
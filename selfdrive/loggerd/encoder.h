@@ -1,12 +1,61 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "cereal/visionipc/visionbuf.h"
+#include "selfdrive/common/timing.h"
+
+// what an encoder did since its stats were last taken
+struct EncoderStats {
+  uint32_t frames = 0;      // encoded
+  uint64_t bytes = 0;       // of encoded frames
+  uint32_t queue_depth = 0; // frames queued but not encoded yet, when the stats were taken
+  std::vector<float> latencies;  // ms from queueing a frame to getting it encoded
+};
 
 class VideoEncoder {
 public:
   virtual ~VideoEncoder() {}
   virtual int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
                            int in_width, int in_height, uint64_t ts) = 0;
+  // encoders that can read the VisionIpc buffer itself override this to skip the plane copies
+  virtual int encode_buf(const VisionBuf *buf, uint64_t ts) {
+    return encode_frame(buf->y, buf->u, buf->v, buf->width, buf->height, ts);
+  }
   virtual void encoder_open(const char* path) = 0;
   virtual void encoder_close() = 0;
+  // hint that the next encoder_open will be for path, so its files can be created ahead of time
+  virtual void encoder_prepare(const char* path) {}
+
+  // resets them, from the thread encoding
+  EncoderStats take_stats() {
+    stats.queue_depth = stats_queued.size();
+    return std::exchange(stats, {});
+  }
+
+protected:
+  // encoders report each frame they queue and get out, matched by the timestamp in us
+  void frame_queued(uint64_t ts_us) {
+    // a frame that never comes out doesn't make the list grow
+    if (stats_queued.size() >= 64) stats_queued.pop_front();
+    stats_queued.push_back({ts_us, nanos_since_boot()});
+  }
+  void frame_encoded(uint64_t ts_us, size_t size) {
+    // frames come out in order, the ones before were dropped by the encoder
+    while (!stats_queued.empty() && stats_queued.front().first <= ts_us) {
+      if (stats_queued.front().first == ts_us) {
+        stats.latencies.push_back((nanos_since_boot() - stats_queued.front().second) / 1e6);
+      }
+      stats_queued.pop_front();
+    }
+    stats.frames++;
+    stats.bytes += size;
+  }
+
+private:
+  EncoderStats stats;
+  std::deque<std::pair<uint64_t, uint64_t>> stats_queued;  // timestamp and when it was queued
 };
@@ -0,0 +1,222 @@
+#include "selfdrive/loggerd/file_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+
+// O_DIRECT needs buffers, sizes and offsets aligned to the logical block size
+constexpr size_t DIRECT_ALIGNMENT = 4096;
+constexpr size_t DIRECT_BUF_SIZE = 1024 * 1024;
+// latency samples kept between two stats reports
+constexpr size_t MAX_LATENCY_SAMPLES = 4096;
+
+static std::atomic<uint64_t> stats_bytes_written = 0;
+static std::atomic<int> stats_queue_depth = 0;
+static std::mutex stats_lock;
+static std::vector<float> stats_latencies;
+
+static void record_write(size_t size, double start_ms) {
+  stats_bytes_written += size;
+  std::lock_guard lk(stats_lock);
+  if (stats_latencies.size() < MAX_LATENCY_SAMPLES) {
+    stats_latencies.push_back(millis_since_boot() - start_ms);
+  }
+}
+
+FileWriterStats file_writer_stats() {
+  FileWriterStats stats = {.bytes_written = stats_bytes_written, .queue_depth = (uint32_t)std::max(0, stats_queue_depth.load())};
+
+  std::vector<float> latencies;
+  {
+    std::lock_guard lk(stats_lock);
+    latencies.swap(stats_latencies);
+  }
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    stats.write_latency_p99 = latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * 0.99))];
+    stats.write_latency_max = latencies.back();
+  }
+  return stats;
+}
+
+// allocates the blocks of the whole file at once, so it's contiguous and appends don't touch the
+// free space maps. Not every filesystem supports it, then the file just grows as usual
+static bool preallocate(int fd, size_t size) {
+#ifdef __APPLE__
+  return false;
+#else
+  if (size == 0) return false;
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+    if (errno != EOPNOTSUPP) LOGW("fallocate failed, errno=%d", errno);
+    return false;
+  }
+  return true;
+#endif
+}
+
+std::unique_ptr<FileWriter> FileWriter::open(const char* path, size_t prealloc_size) {
+  static const bool direct_io = getenv("LOGGERD_DIRECT_IO") != nullptr;
+  if (direct_io) {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+    if (fd >= 0) {
+      // the destructor truncates to the written size, which also frees the unused preallocation
+      preallocate(fd, prealloc_size);
+      return std::make_unique<DirectFileWriter>(fd);
+    }
+    // e.g. tmpfs has no O_DIRECT
+    LOGW("O_DIRECT open of %s failed, errno=%d, using buffered writes", path, errno);
+  }
+
+  FILE* file = fopen(path, "wb");
+  if (file == nullptr) return nullptr;
+  return std::make_unique<BufferedFileWriter>(file, preallocate(fileno(file), prealloc_size));
+}
+
+// ***** buffered *****
+
+BufferedFileWriter::~BufferedFileWriter() {
+  if (preallocated) {
+    // blocks reserved past the end stay allocated until the file is truncated
+    int err = fflush(file);
+    if (err == 0 && ftruncate(fileno(file), ftell(file)) != 0) {
+      LOGE("ftruncate failed, errno=%d", errno);
+    }
+  }
+  int err = fclose(file);
+  assert(err == 0);
+}
+
+bool BufferedFileWriter::write(const void* data, size_t size) {
+  const double start_ms = millis_since_boot();
+  bool ret = fwrite(data, 1, size, file) == size;
+  record_write(size, start_ms);
+  return ret;
+}
+
+// ***** direct *****
+
+DirectFileWriter::DirectFileWriter(int fd) : fd(fd) {
+  for (auto &buf : bufs) {
+    int err = posix_memalign((void **)&buf, DIRECT_ALIGNMENT, DIRECT_BUF_SIZE);
+    assert(err == 0);
+  }
+  writer = std::thread(&DirectFileWriter::write_thread, this);
+}
+
+DirectFileWriter::~DirectFileWriter() {
+  // the tail is written padded to the alignment, then cut back to the real size
+  if (cur_size > 0) {
+    const size_t padded = (cur_size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+    memset(bufs[cur] + cur_size, 0, padded - cur_size);
+    submit(cur, padded);
+  }
+  wait_idle();
+  {
+    std::lock_guard lk(lock);
+    stop = true;
+  }
+  cv.notify_all();
+  writer.join();
+
+  if (ftruncate(fd, total_size) != 0) {
+    LOGE("ftruncate failed, errno=%d", errno);
+  }
+  close(fd);
+  for (auto &buf : bufs) free(buf);
+}
+
+bool DirectFileWriter::write(const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  total_size += size;
+  while (size > 0) {
+    const size_t n = std::min(size, DIRECT_BUF_SIZE - cur_size);
+    memcpy(bufs[cur] + cur_size, p, n);
+    cur_size += n;
+    p += n;
+    size -= n;
+
+    if (cur_size == DIRECT_BUF_SIZE) {
+      submit(cur, cur_size);
+      cur = !cur;
+      cur_size = 0;
+    }
+  }
+  std::lock_guard lk(lock);
+  return !error;
+}
+
+void DirectFileWriter::submit(int idx, size_t size) {
+  stats_queue_depth++;
+  std::unique_lock lk(lock);
+  cv.wait(lk, [&] { return pending == -1; });
+  pending = idx;
+  pending_size = size;
+  lk.unlock();
+  cv.notify_all();
+}
+
+void DirectFileWriter::wait_idle() {
+  std::unique_lock lk(lock);
+  cv.wait(lk, [&] { return pending == -1; });
+}
+
+void DirectFileWriter::write_thread() {
+  std::unique_lock lk(lock);
+  while (true) {
+    cv.wait(lk, [&] { return pending != -1 || stop; });
+    if (pending == -1) break;
+
+    const uint8_t* buf = bufs[pending];
+    const size_t size = pending_size;
+    lk.unlock();
+
+    const double start_ms = millis_since_boot();
+    size_t written = 0;
+    while (written < size) {
+      ssize_t ret = ::write(fd, buf + written, size - written);
+      if (ret <= 0) {
+        if (ret < 0 && errno == EINTR) continue;
+        LOGE("direct write failed, errno=%d", errno);
+        break;
+      }
+      written += ret;
+    }
+    record_write(written, start_ms);
+
+    lk.lock();
+    error |= written < size;
+    stats_queue_depth--;
+    pending = -1;
+    cv.notify_all();
+  }
+}
+
+std::unique_ptr<FrameIndexWriter> FrameIndexWriter::open(const std::string &vid_path) {
+  auto file = FileWriter::open((vid_path + ".idx").c_str());
+  if (!file) return nullptr;
+
+  FrameIndexHeader header;
+  file->write(&header, sizeof(header));
+  return std::unique_ptr<FrameIndexWriter>(new FrameIndexWriter(std::move(file)));
+}
+
+void FrameIndexWriter::frame(size_t size, bool keyframe) {
+  FrameIndexEntry entry = {
+    .frame_id = frame_id++,
+    .flags = keyframe ? FRAME_INDEX_KEYFRAME : 0u,
+    .offset = offset,
+    .size = (uint32_t)size,
+  };
+  file->write(&entry, sizeof(entry));
+  offset += size;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Sequential output file of loggerd, for the logs and the hevc videos
+class FileWriter {
+ public:
+  // LOGGERD_DIRECT_IO selects DirectFileWriter, nullptr if the file can't be created.
+  // prealloc_size reserves that many bytes of disk up front without changing the file size, closing
+  // the writer gives back what wasn't used
+  static std::unique_ptr<FileWriter> open(const char* path, size_t prealloc_size = 0);
+  virtual ~FileWriter() {}
+  virtual bool write(const void* data, size_t size) = 0;
+};
+
+// Page cache writes through stdio
+class BufferedFileWriter : public FileWriter {
+ public:
+  BufferedFileWriter(FILE* file, bool preallocated = false) : file(file), preallocated(preallocated) {}
+  ~BufferedFileWriter();
+  bool write(const void* data, size_t size) override;
+
+ private:
+  FILE* file;
+  bool preallocated;
+};
+
+// O_DIRECT writes from a dedicated thread, so page cache flushes don't stall the caller. write()
+// fills one of two aligned buffers while the thread writes out the other one
+class DirectFileWriter : public FileWriter {
+ public:
+  DirectFileWriter(int fd);
+  ~DirectFileWriter();
+  bool write(const void* data, size_t size) override;
+
+ private:
+  // hands buffer idx to the thread, waits while the other buffer is still being written
+  void submit(int idx, size_t size);
+  void wait_idle();
+  void write_thread();
+
+  int fd;
+  uint8_t* bufs[2];
+  int cur = 0;
+  size_t cur_size = 0;
+  uint64_t total_size = 0;
+  bool error = false;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  int pending = -1;  // buffer the thread is writing
+  size_t pending_size = 0;
+  bool stop = false;
+  std::thread writer;
+};
+
+// <video>.idx, the frame index of a raw hevc or h264 video, so a frame can be found without parsing
+// the log or the bitstream. A FrameIndexHeader and then a FrameIndexEntry per encoded frame, in file
+// order, little endian. The entry of frame n is at sizeof(FrameIndexHeader) + n * sizeof(FrameIndexEntry),
+// decoding it starts at the entry of the last keyframe before it. The bytes before the first frame are
+// the codec config
+#define FRAME_INDEX_MAGIC 0x58444946  // "FIDX"
+#define FRAME_INDEX_KEYFRAME 1
+
+struct FrameIndexHeader {
+  uint32_t magic = FRAME_INDEX_MAGIC;
+  uint32_t version = 1;
+};
+
+struct FrameIndexEntry {
+  uint32_t frame_id;  // in the segment, the segmentId of its EncodeIndex
+  uint32_t flags;
+  uint64_t offset;    // in the video
+  uint32_t size;
+  uint32_t reserved;
+};
+static_assert(sizeof(FrameIndexHeader) == 8 && sizeof(FrameIndexEntry) == 24);
+
+class FrameIndexWriter {
+ public:
+  // nullptr if the file can't be created
+  static std::unique_ptr<FrameIndexWriter> open(const std::string &vid_path);
+  // the encoders report every write to the video, in order
+  void config(size_t size) { offset += size; }
+  void frame(size_t size, bool keyframe);
+
+ private:
+  FrameIndexWriter(std::unique_ptr<FileWriter> file) : file(std::move(file)) {}
+
+  std::unique_ptr<FileWriter> file;
+  uint32_t frame_id = 0;
+  uint64_t offset = 0;
+};
+
+struct FileWriterStats {
+  uint64_t bytes_written;
+  uint32_t queue_depth;  // buffers waiting for or in a direct write
+  float write_latency_p99, write_latency_max;  // ms, of the writes since the last call
+};
+
+// totals of all writers, resets the latency samples
+FileWriterStats file_writer_stats();
@@ -3,6 +3,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdint>
@@ -13,6 +14,10 @@
 #include <fstream>
 #include <iostream>
 #include <streambuf>
+#include <vector>
+
+#include <bzlib.h>
+#include <zstd.h>
 #ifdef QCOM
 #include <cutils/properties.h>
 #endif
@@ -20,6 +25,7 @@
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/version.h"
 
 // ***** logging helpers *****
@@ -47,6 +53,199 @@ int logger_mkpath(char* file_path) {
   return 0;
 }
 
+// ***** block compression *****
+
+// input per bz2 stream, one bzip2 block at level 9
+constexpr size_t BZ_BLOCK_SIZE = 900 * 1000;
+constexpr size_t ZSTD_BLOCK_SIZE = 1024 * 1024;
+constexpr int ZSTD_LEVEL = 3;
+// blocks waiting for compression and IO per file, write() waits for the writer beyond that
+constexpr int MAX_PENDING_BLOCKS = 16;
+// disk reserved for the logs of a segment, a bit more than a minute of compressed rlog and qlog
+constexpr size_t RLOG_PREALLOC_SIZE = 16 * 1024 * 1024;
+constexpr size_t QLOG_PREALLOC_SIZE = 2 * 1024 * 1024;
+
+static std::atomic<int> total_pending_blocks = 0;
+
+int logger_pending_blocks() {
+  return total_pending_blocks;
+}
+
+// Worker threads shared by all open log files. Each file holds a reference, so the workers outlive
+// the last file waiting on them even when it's closed during static destruction at exit
+class BlockCompressor {
+ public:
+  static std::shared_ptr<BlockCompressor> get() {
+    static std::mutex lock;
+    static std::weak_ptr<BlockCompressor> current;
+    std::lock_guard lk(lock);
+    std::shared_ptr<BlockCompressor> ret = current.lock();
+    if (!ret) {
+      ret.reset(new BlockCompressor());
+      current = ret;
+    }
+    return ret;
+  }
+
+  ~BlockCompressor() {
+    for (size_t i = 0; i < workers.size(); i++) tasks.push(nullptr);
+    for (auto &w : workers) w.join();
+  }
+
+  std::shared_future<std::string> compress(std::string &&block, BlockLogFile::compress_fn fn) {
+    auto task = std::make_shared<std::packaged_task<std::string()>>([block = std::move(block), fn]() {
+      return fn(block);
+    });
+    std::shared_future<std::string> ret = task->get_future().share();
+    tasks.push(task);
+    return ret;
+  }
+
+ private:
+  BlockCompressor() {
+    const int num_workers = std::clamp((int)std::thread::hardware_concurrency() / 2, 1, 4);
+    for (int i = 0; i < num_workers; i++) {
+      workers.emplace_back([this]() {
+        while (true) {
+          auto task = tasks.pop();
+          if (!task) break;
+          (*task)();
+        }
+      });
+    }
+  }
+
+  SafeQueue<std::shared_ptr<std::packaged_task<std::string()>>> tasks;
+  std::vector<std::thread> workers;
+};
+
+BlockLogFile::BlockLogFile(const char* path, size_t block_size, compress_fn compress, size_t prealloc_size)
+  : compressor(BlockCompressor::get()), block_size(block_size), compress(compress) {
+  file = FileWriter::open(path, prealloc_size);
+  assert(file != nullptr);
+  block.reserve(block_size);
+  writer = std::thread(&BlockLogFile::write_thread, this);
+}
+
+BlockLogFile::~BlockLogFile() {
+  close();
+}
+
+void BlockLogFile::close() {
+  if (closed) return;
+
+  flush_block();
+  blocks.push({});
+  writer.join();
+  closed = true;
+}
+
+void BlockLogFile::write(void* data, size_t size, uint64_t mono_time) {
+  if (mono_time != 0) {
+    if (block_mono_start == 0) block_mono_start = mono_time;
+    block_mono_end = std::max(block_mono_end, mono_time);
+  }
+  block.append((const char *)data, size);
+  if (block.size() >= block_size) {
+    flush_block();
+  }
+}
+
+void BlockLogFile::flush_block() {
+  if (block.empty()) return;
+
+  {
+    // backpressure, the blocks hold the uncompressed data until they're written
+    std::unique_lock lk(pending_lock);
+    if (pending_blocks >= MAX_PENDING_BLOCKS) {
+      LOGW_100("log compression is falling behind, waiting for %d pending blocks", pending_blocks);
+      pending_cv.wait(lk, [this] { return pending_blocks < MAX_PENDING_BLOCKS; });
+    }
+    pending_blocks++;
+  }
+  total_pending_blocks++;
+  BlockIndex idx = {.size = (uint32_t)block.size(), .mono_start = block_mono_start, .mono_end = block_mono_end};
+  blocks.push({compressor->compress(std::move(block), compress), idx});
+  block = std::string();
+  block.reserve(block_size);
+  block_mono_start = block_mono_end = 0;
+}
+
+void BlockLogFile::write_thread() {
+  bool error_logged = false;
+  uint64_t offset = 0;
+  while (true) {
+    PendingBlock b = blocks.pop();
+    if (!b.data.valid()) break;
+
+    const std::string &data = b.data.get();
+    if (!file->write(data.data(), data.size()) && !error_logged) {
+      LOGE("log write error, errno=%d", errno);
+      error_logged = true;
+    }
+    b.index.offset = offset;
+    b.index.compressed_size = data.size();
+    index.push_back(b.index);
+    offset += data.size();
+    {
+      std::lock_guard lk(pending_lock);
+      pending_blocks--;
+    }
+    pending_cv.notify_one();
+    total_pending_blocks--;
+  }
+}
+
+static std::string bz2_compress(const std::string &block) {
+  // worst case bz2 output size from the bzip2 manual
+  unsigned int out_size = block.size() + block.size() / 100 + 600;
+  std::string out(out_size, '\0');
+  int bzerror = BZ2_bzBuffToBuffCompress(out.data(), &out_size, (char *)block.data(), block.size(), 9, 0, 30);
+  if (bzerror != BZ_OK) {
+    LOGE("BZ2_bzBuffToBuffCompress error, bzerror=%d", bzerror);
+    return std::string();
+  }
+  out.resize(out_size);
+  return out;
+}
+
+BZFile::BZFile(const char* path, size_t prealloc_size) : BlockLogFile(path, BZ_BLOCK_SIZE, bz2_compress, prealloc_size) {}
+
+static std::string zstd_compress(const std::string &block) {
+  std::string out(ZSTD_compressBound(block.size()), '\0');
+  size_t ret = ZSTD_compress(out.data(), out.size(), block.data(), block.size(), ZSTD_LEVEL);
+  if (ZSTD_isError(ret)) {
+    LOGE("ZSTD_compress error, %s", ZSTD_getErrorName(ret));
+    return std::string();
+  }
+  out.resize(ret);
+  return out;
+}
+
+ZstdFile::ZstdFile(const char* path, size_t prealloc_size) : BlockLogFile(path, ZSTD_BLOCK_SIZE, zstd_compress, prealloc_size) {}
+
+ZstdFile::~ZstdFile() {
+  close();
+
+  // seek table, see logger.h
+  std::string table;
+  auto put = [&table](auto v) { table.append((const char *)&v, sizeof(v)); };
+  put((uint32_t)(ZSTD_MAGIC_SKIPPABLE_START | 0xE));
+  put((uint32_t)(index.size() * 32 + 8));
+  for (auto &b : index) {
+    put(b.offset);
+    put(b.compressed_size);
+    put(b.size);
+    put(b.mono_start);
+    put(b.mono_end);
+  }
+  put((uint32_t)index.size());
+  put((uint32_t)ZSTD_LOG_SEEK_MAGIC);
+  if (!file->write(table.data(), table.size())) {
+    LOGE("failed to write the zstd seek table, errno=%d", errno);
+  }
+}
+
 // ***** log metadata *****
 kj::Array<capnp::word> logger_build_init_data() {
   MessageBuilder msg;
@@ -144,6 +343,37 @@ static void log_sentinel(LoggerState *s, cereal::Sentinel::SentinelType type, in
 
 // ***** logging functions *****
 
+// logMonoTime of a serialized Event, read from the wire format instead of through a message reader.
+// It's the first word of the root struct's data section. 0 when the root isn't a plain struct pointer
+static uint64_t event_mono_time(const void* data, size_t size) {
+  uint32_t num_segments;
+  if (size < sizeof(uint32_t)) return 0;
+  memcpy(&num_segments, data, sizeof(num_segments));
+  num_segments += 1;
+  // segment table, padded to a word
+  const size_t root = ((num_segments + 2) / 2) * sizeof(capnp::word);
+  if (num_segments > 512 || root + sizeof(uint64_t) > size) return 0;
+
+  uint64_t ptr;
+  memcpy(&ptr, (const char *)data + root, sizeof(ptr));
+  const int32_t offset = (int32_t)(uint32_t)ptr >> 2;
+  const uint16_t data_words = ptr >> 32;
+  if ((ptr & 3) != 0 || data_words == 0) return 0;
+
+  const size_t field = root + (1 + (int64_t)offset) * sizeof(capnp::word);
+  if (offset < 0 || field + sizeof(uint64_t) > size) return 0;
+  uint64_t mono_time;
+  memcpy(&mono_time, (const char *)data + field, sizeof(mono_time));
+  return mono_time;
+}
+
+void LogBatch::add(const void* data, size_t size, bool in_qlog) {
+  entries.push_back({.offset = buf.size(), .size = size, .mono_time = event_mono_time(data, size), .in_qlog = in_qlog});
+  buf.append((const char *)data, size);
+  // capnp messages are whole words already, this only keeps the next offset aligned
+  buf.resize((buf.size() + sizeof(capnp::word) - 1) / sizeof(capnp::word) * sizeof(capnp::word));
+}
+
 void logger_init(LoggerState *s, const char* log_name, bool has_qlog) {
   umask(0);
 
@@ -156,10 +386,15 @@ void logger_init(LoggerState *s, const char* log_name, bool has_qlog) {
   s->init_data = logger_build_init_data();
 }
 
-static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
+std::string logger_segment_path(LoggerState *s, const char* root_path, int part) {
+  return util::string_format("%s/%s--%d", root_path, s->route_name.c_str(), part);
+}
+
+static LoggerHandle* logger_open(LoggerState *s, const char* root_path, int part) {
   int err;
 
   LoggerHandle *h = NULL;
+  pthread_mutex_lock(&s->lock);
   for (int i=0; i<LOGGER_MAX_HANDLES; i++) {
     if (s->handles[i].refcnt == 0) {
       h = &s->handles[i];
@@ -167,49 +402,76 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
     }
   }
   assert(h);
+  // reserve the handle, the files are created without holding the logger lock
+  pthread_mutex_init(&h->lock, NULL);
+  h->refcnt = 1;
+  pthread_mutex_unlock(&s->lock);
 
-  snprintf(h->segment_path, sizeof(h->segment_path),
-          "%s/%s--%d", root_path, s->route_name.c_str(), s->part);
+  snprintf(h->segment_path, sizeof(h->segment_path), "%s", logger_segment_path(s, root_path, part).c_str());
 
-  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.bz2", h->segment_path, s->log_name);
+  // LOGGERD_ZSTD writes the rlog as seekable zstd, the qlog stays bz2. Off by default, only the LogReader
+  // in selfdrive/loggerd reads rlog.zst, the python tools/lib LogReader only knows bz2
+  const bool zstd = getenv("LOGGERD_ZSTD") != nullptr;
+  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.%s", h->segment_path, s->log_name, zstd ? "zst" : "bz2");
   snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.bz2", h->segment_path);
   snprintf(h->lock_path, sizeof(h->lock_path), "%s.lock", h->log_path);
 
+  FILE* lock_file = NULL;
   err = logger_mkpath(h->log_path);
-  if (err) return NULL;
-
-  FILE* lock_file = fopen(h->lock_path, "wb");
-  if (lock_file == NULL) return NULL;
+  if (!err) lock_file = fopen(h->lock_path, "wb");
+  if (lock_file == NULL) {
+    pthread_mutex_destroy(&h->lock);
+    pthread_mutex_lock(&s->lock);
+    h->refcnt = 0;
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+  }
   fclose(lock_file);
 
-  h->log = std::make_unique<BZFile>(h->log_path);
+  if (zstd) {
+    h->log = std::make_unique<ZstdFile>(h->log_path, RLOG_PREALLOC_SIZE);
+  } else {
+    h->log = std::make_unique<BZFile>(h->log_path, RLOG_PREALLOC_SIZE);
+  }
   if (s->has_qlog) {
-    h->q_log = std::make_unique<BZFile>(h->qlog_path);
+    h->q_log = std::make_unique<BZFile>(h->qlog_path, QLOG_PREALLOC_SIZE);
   }
-
-  pthread_mutex_init(&h->lock, NULL);
-  h->refcnt++;
   return h;
 }
 
+// removes a prepared segment that was never logged to
+static void logger_discard(LoggerHandle* h) {
+  std::string segment_path = h->segment_path, log_path = h->log_path, qlog_path = h->qlog_path;
+  lh_close(h);
+  unlink(log_path.c_str());
+  unlink(qlog_path.c_str());
+  if (rmdir(segment_path.c_str()) != 0) {
+    LOGW("couldn't remove unused segment %s, errno=%d", segment_path.c_str(), errno);
+  }
+}
+
 int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part) {
   bool is_start_of_route = !s->cur_handle;
   if (!is_start_of_route) log_sentinel(s, cereal::Sentinel::SentinelType::END_OF_SEGMENT);
 
-  pthread_mutex_lock(&s->lock);
-  s->part++;
-
-  LoggerHandle* next_h = logger_open(s, root_path);
+  LoggerHandle* next_h = NULL;
+  if (s->next_handle.valid()) {
+    next_h = s->next_handle.get();
+    if (next_h && s->next_root_path != root_path) {
+      logger_discard(next_h);
+      next_h = NULL;
+    }
+  }
   if (!next_h) {
-    pthread_mutex_unlock(&s->lock);
-    return -1;
+    next_h = logger_open(s, root_path, s->part + 1);
+    if (!next_h) return -1;
   }
 
-  if (s->cur_handle) {
-    lh_close(s->cur_handle);
-  }
+  pthread_mutex_lock(&s->lock);
+  LoggerHandle* prev_h = s->cur_handle;
+  s->part++;
   s->cur_handle = next_h;
 
   if (out_segment_path) {
@@ -224,6 +486,13 @@ int logger_next(LoggerState *s, const char* root_path,
   // write beggining of log metadata
   log_init_data(s);
   log_sentinel(s, is_start_of_route ? cereal::Sentinel::SentinelType::START_OF_ROUTE : cereal::Sentinel::SentinelType::START_OF_SEGMENT);
+
+  // closing waits for the last blocks to be compressed and written
+  s->next_root_path = root_path;
+  s->next_handle = std::async(std::launch::async, [s, prev_h, root = s->next_root_path, part = s->part + 1]() {
+    if (prev_h) lh_close(prev_h);
+    return logger_open(s, root.c_str(), part);
+  });
   return 0;
 }
 
@@ -242,9 +511,22 @@ LoggerHandle* logger_get_handle(LoggerState *s) {
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog) {
   pthread_mutex_lock(&s->lock);
   if (s->cur_handle) {
-    lh_log(s->cur_handle, data, data_size, in_qlog);
+    lh_log(s->cur_handle, data, data_size, in_qlog, event_mono_time(data, data_size));
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+double logger_log_batch(LoggerState *s, const LogBatch &batch) {
+  if (batch.count() == 0) return 0;
+
+  pthread_mutex_lock(&s->lock);
+  const double start_ms = millis_since_boot();
+  if (s->cur_handle) {
+    lh_log_batch(s->cur_handle, batch);
   }
+  const double hold_ms = millis_since_boot() - start_ms;
   pthread_mutex_unlock(&s->lock);
+  return hold_ms;
 }
 
 void logger_close(LoggerState *s, ExitHandler *exit_handler) {
@@ -256,18 +538,37 @@ void logger_close(LoggerState *s, ExitHandler *exit_handler) {
     lh_close(s->cur_handle);
   }
   pthread_mutex_unlock(&s->lock);
+
+  if (s->next_handle.valid()) {
+    LoggerHandle* next_h = s->next_handle.get();
+    if (next_h) logger_discard(next_h);
+  }
 }
 
-void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog) {
+void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog, uint64_t mono_time) {
   pthread_mutex_lock(&h->lock);
   assert(h->refcnt > 0);
-  h->log->write(data, data_size);
+  h->log->write(data, data_size, mono_time);
   if (in_qlog && h->q_log) {
     h->q_log->write(data, data_size);
   }
   pthread_mutex_unlock(&h->lock);
 }
 
+void lh_log_batch(LoggerHandle* h, const LogBatch &batch) {
+  pthread_mutex_lock(&h->lock);
+  assert(h->refcnt > 0);
+  // one write per message, the log files index blocks by message
+  for (auto &e : batch.entries) {
+    void *data = (void *)(batch.buf.data() + e.offset);
+    h->log->write(data, e.size, e.mono_time);
+    if (e.in_qlog && h->q_log) {
+      h->q_log->write(data, e.size);
+    }
+  }
+  pthread_mutex_unlock(&h->lock);
+}
+
 void lh_close(LoggerHandle* h) {
   pthread_mutex_lock(&h->lock);
   assert(h->refcnt > 0);
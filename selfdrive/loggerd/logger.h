@@ -3,59 +3,100 @@
 #include <cassert>
 #include <pthread.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
-#include <bzlib.h>
 #include <capnp/serialize.h>
 #include <kj/array.h>
 
+#include "selfdrive/common/queue.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/loggerd/file_writer.h"
 
 const std::string LOG_ROOT = Path::log_root();
 
 #define LOGGER_MAX_HANDLES 16
 
-class BZFile {
+class BlockCompressor;
+
+// Log file written in independently compressed blocks. Messages are collected into a block, full
+// blocks are compressed on a worker pool and a writer thread appends them to the file in order,
+// so write() only waits for compression or IO when too many blocks are pending
+class BlockLogFile {
  public:
-  BZFile(const char* path) {
-    file = fopen(path, "wb");
-    assert(file != nullptr);
-    int bzerror;
-    bz_file = BZ2_bzWriteOpen(&bzerror, file, 9, 0, 30);
-    assert(bzerror == BZ_OK);
-  }
-  ~BZFile() {
-    int bzerror;
-    BZ2_bzWriteClose(&bzerror, bz_file, 0, nullptr, nullptr);
-    if (bzerror != BZ_OK) {
-      LOGE("BZ2_bzWriteClose error, bzerror=%d", bzerror);
-    }
-    int err = fclose(file);
-    assert(err == 0);
-  }
-  inline void write(void* data, size_t size) {
-    int bzerror;
-    do {
-      BZ2_bzWrite(&bzerror, bz_file, data, size);
-    } while (bzerror == BZ_IO_ERROR && errno == EINTR);
-
-    if (bzerror != BZ_OK && !error_logged) {
-      LOGE("BZ2_bzWrite error, bzerror=%d", bzerror);
-      error_logged = true;
-    }
-  }
-  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  typedef std::string (*compress_fn)(const std::string &block);
+
+  BlockLogFile(const char* path, size_t block_size, compress_fn compress, size_t prealloc_size = 0);
+  virtual ~BlockLogFile();
+  // mono_time is the logMonoTime of the message for the block index, 0 when unknown
+  void write(void* data, size_t size, uint64_t mono_time = 0);
+  inline void write(kj::ArrayPtr<capnp::byte> array, uint64_t mono_time = 0) { write(array.begin(), array.size(), mono_time); }
+
+ protected:
+  struct BlockIndex {
+    uint64_t offset;
+    uint32_t compressed_size, size;
+    uint64_t mono_start, mono_end;
+  };
+
+  // flushes the last block and waits for the writer, the file stays open for a trailer
+  void close();
+
+  std::unique_ptr<FileWriter> file;
+  std::vector<BlockIndex> index;  // one entry per written block, complete after close()
+  uint64_t block_mono_start = 0, block_mono_end = 0;
 
  private:
-  bool error_logged = false;
-  FILE* file = nullptr;
-  BZFILE* bz_file = nullptr;
+  struct PendingBlock {
+    std::shared_future<std::string> data;  // invalid stops the writer
+    BlockIndex index;
+  };
+
+  void flush_block();
+  void write_thread();
+
+  std::shared_ptr<BlockCompressor> compressor;  // released after the writer is done with its futures
+  const size_t block_size;
+  const compress_fn compress;
+  std::string block;
+  SafeQueue<PendingBlock> blocks;
+  std::mutex pending_lock;
+  std::condition_variable pending_cv;
+  int pending_blocks = 0;
+  std::thread writer;
+  bool closed = false;
+};
+
+// bz2 log, one bz2 stream per block. Concatenated streams decompress like a single one (bzip2 -d, python bz2)
+class BZFile : public BlockLogFile {
+ public:
+  BZFile(const char* path, size_t prealloc_size = 0);
 };
 
+// zstd log, one zstd frame per ~1MB block, followed by a skippable frame with a seek table so readers
+// can start decoding at any block. The trailer, all little endian:
+//   u32 0x184D2A5E (skippable frame magic), u32 size of the rest of the frame,
+//   per block: u64 file offset, u32 compressed size, u32 decompressed size, u64 first logMonoTime, u64 last logMonoTime
+//   u32 number of blocks, u32 ZSTD_LOG_SEEK_MAGIC
+// The file ends with the magic, the table starts 8 + 32 * number of blocks bytes before the end
+class ZstdFile : public BlockLogFile {
+ public:
+  ZstdFile(const char* path, size_t prealloc_size = 0);
+  ~ZstdFile();
+};
+
+#define ZSTD_LOG_SEEK_MAGIC 0x4B53504F  // "OPSK"
+
 typedef struct LoggerHandle {
   pthread_mutex_t lock;
   int refcnt;
@@ -63,9 +104,31 @@ typedef struct LoggerHandle {
   char log_path[4096];
   char qlog_path[4096];
   char lock_path[4096];
-  std::unique_ptr<BZFile> log, q_log;
+  std::unique_ptr<BlockLogFile> log, q_log;
 } LoggerHandle;
 
+// Messages collected by one poll round, written by logger_log_batch with a single lock acquisition.
+// The messages are copied into one buffer at word aligned offsets
+class LogBatch {
+ public:
+  LogBatch() { buf.reserve(1024 * 1024); }
+  void add(const void* data, size_t size, bool in_qlog);
+  void clear() { buf.clear(); entries.clear(); }
+  size_t count() const { return entries.size(); }
+  size_t bytes() const { return buf.size(); }
+
+ private:
+  struct Entry {
+    size_t offset, size;
+    uint64_t mono_time;
+    bool in_qlog;
+  };
+  std::string buf;
+  std::vector<Entry> entries;
+
+  friend void lh_log_batch(LoggerHandle* h, const LogBatch &batch);
+};
+
 typedef struct LoggerState {
   pthread_mutex_t lock;
   int part;
@@ -76,6 +139,10 @@ typedef struct LoggerState {
 
   LoggerHandle handles[LOGGER_MAX_HANDLES];
   LoggerHandle* cur_handle;
+  // closes the previous segment and opens the one after cur_handle in the background,
+  // so logger_next only has to swap the handles
+  std::future<LoggerHandle*> next_handle;
+  std::string next_root_path;
 } LoggerState;
 
 int logger_mkpath(char* file_path);
@@ -86,8 +153,15 @@ int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part);
 LoggerHandle* logger_get_handle(LoggerState *s);
+// directory of segment part, also for the segments that aren't open yet
+std::string logger_segment_path(LoggerState *s, const char* root_path, int part);
+// blocks of all open log files waiting for compression or IO
+int logger_pending_blocks();
 void logger_close(LoggerState *s, ExitHandler *exit_handler=nullptr);
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog);
+// returns how long the logger lock was held, in ms
+double logger_log_batch(LoggerState *s, const LogBatch &batch);
 
-void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog);
+void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog, uint64_t mono_time = 0);
+void lh_log_batch(LoggerHandle* h, const LogBatch &batch);
 void lh_close(LoggerHandle* h);
@@ -3,6 +3,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cerrno>
@@ -11,6 +12,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <string>
@@ -25,6 +28,7 @@
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
+#include "selfdrive/common/trace.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
@@ -37,6 +41,9 @@
 #include "selfdrive/loggerd/raw_logger.h"
 #define Encoder RawLogger
 #endif
+#ifndef __APPLE__
+#include "selfdrive/loggerd/v4l2_encoder.h"
+#endif
 
 namespace {
 
@@ -46,9 +53,18 @@ const int MAX_CAM_IDX = Hardware::TICI() ? LOG_CAMERA_ID_ECAMERA : LOG_CAMERA_ID
 const int DCAM_BITRATE = Hardware::TICI() ? MAIN_BITRATE : 2500000;
 
 #define NO_CAMERA_PATIENCE 500 // fall back to time-based rotation if all cameras are dead
+#define STREAM_PATIENCE 5000 // stop the encoder thread of a stream that's been gone this long
+#define STREAM_DISCOVERY_PERIOD 1000
+#define LOG_BATCH_MAX_SIZE (1024 * 1024) // log a batch early when a poll round brings this much
+#define ENCODER_STATS_PERIOD 1000
+// LOGGERD_ADAPTIVE_QCAMERA halves the qcamera frame rate while the main encoder can't keep up
+#define THROTTLE_AFTER 3   // stats periods in a row with backpressure
+#define UNTHROTTLE_AFTER 10 // stats periods in a row without
 
 const int SEGMENT_LENGTH = getenv("LOGGERD_TEST") ? atoi(getenv("LOGGERD_SEGMENT_LENGTH")) : 60;
 
+const bool ADAPTIVE_QCAMERA = getenv("LOGGERD_ADAPTIVE_QCAMERA") != NULL;
+
 ExitHandler do_exit;
 
 LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
@@ -56,6 +72,7 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
     .stream_type = VISION_STREAM_YUV_BACK,
     .filename = "fcamera.hevc",
     .frame_packet_name = "roadCameraState",
+    .encode_data_name = "roadEncodeData",
     .fps = MAIN_FPS,
     .bitrate = MAIN_BITRATE,
     .is_h265 = true,
@@ -67,6 +84,7 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
     .stream_type = VISION_STREAM_YUV_FRONT,
     .filename = "dcamera.hevc",
     .frame_packet_name = "driverCameraState",
+    .encode_data_name = "driverEncodeData",
     .fps = MAIN_FPS, // on EONs, more compressed this way
     .bitrate = DCAM_BITRATE,
     .is_h265 = true,
@@ -78,6 +96,7 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
     .stream_type = VISION_STREAM_YUV_WIDE,
     .filename = "ecamera.hevc",
     .frame_packet_name = "wideRoadCameraState",
+    .encode_data_name = "wideRoadEncodeData",
     .fps = MAIN_FPS,
     .bitrate = MAIN_BITRATE,
     .is_h265 = true,
@@ -87,15 +106,26 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
   },
   [LOG_CAMERA_ID_QCAMERA] = {
     .filename = "qcamera.ts",
+    .encode_data_name = "qRoadEncodeData",
     .fps = MAIN_FPS,
     .bitrate = 256000,
     .is_h265 = false,
     .downscale = true,
-    .frame_width = Hardware::TICI() ? 526 : 480,
-    .frame_height = Hardware::TICI() ? 330 : 360 // keep pixel count the same?
+    .frame_width = QCAMERA_WIDTH,
+    .frame_height = QCAMERA_HEIGHT
   },
 };
 
+// an encoder over the last stats period
+struct EncoderReport {
+  uint32_t queue_depth;
+  float latency_p50, latency_p99;  // ms
+  uint32_t dropped, skipped;
+  uint32_t bitrate, target_bitrate;
+  float fps;
+  bool throttled;
+};
+
 struct LoggerdState {
   Context *ctx;
   LoggerState logger = {};
@@ -105,23 +135,167 @@ struct LoggerdState {
   std::atomic<int> rotate_segment;
   std::atomic<double> last_camera_seen_tms;
   std::atomic<int> waiting_rotate;
-  int max_waiting = 0;
+  std::atomic<int> max_waiting = 0;  // encoder threads that trigger rotation
   double last_rotate_tms = 0.;
+
+  // by video file, set by the encoder threads and published by the main thread
+  std::mutex encoder_stats_lock;
+  std::map<std::string, EncoderReport> encoder_stats;
 };
 LoggerdState s;
 
-void encoder_thread(int cam_idx) {
+// an encoder thread runs while camerad has its stream
+struct EncoderThreadState {
+  std::thread thread;
+  std::atomic<bool> stop = false;
+  std::atomic<bool> done = false; // set by the thread as it exits, it's joined without waiting
+  double last_seen_tms = 0.;
+};
+
+// LOGGERD_V4L2 selects the streams encoded by the kernel's V4L2 memory to memory encoder, "all" or a
+// list of filenames like "fcamera.hevc,qcamera.ts". The other streams use the platform encoder
+static bool v4l2_selected(const char *filename) {
+  static const std::vector<std::string> streams = [] {
+    std::vector<std::string> ret;
+    const std::string env = util::getenv("LOGGERD_V4L2");
+    size_t start = 0;
+    while (start <= env.size()) {
+      size_t end = env.find(',', start);
+      if (end == std::string::npos) end = env.size();
+      if (end > start) ret.push_back(env.substr(start, end - start));
+      start = end + 1;
+    }
+    return ret;
+  }();
+  for (const auto &s : streams) {
+    if (s == "all" || s == filename) return true;
+  }
+  return false;
+}
+
+// in_bufs are NV12 buffers in the venus layout for OmxEncoder to encode in place, the other encoders ignore them
+VideoEncoder *create_encoder(const LogCameraInfo &info, int width, int height, VisionBuf *in_bufs = nullptr, size_t num_in_bufs = 0) {
+#ifndef __APPLE__
+  if (v4l2_selected(info.filename)) {
+    if (!V4L2Encoder::find_device(info.is_h265).empty()) {
+      return new V4L2Encoder(info.filename, width, height, info.fps, info.bitrate, info.is_h265, info.downscale);
+    }
+    LOGE("no V4L2 encoder for %s", info.filename);
+  }
+#endif
+#if defined(QCOM) || defined(QCOM2)
+  return new OmxEncoder(info.filename, width, height, info.fps, info.bitrate, info.is_h265, info.downscale, in_bufs, num_in_bufs);
+#else
+  return new Encoder(info.filename, width, height, info.fps, info.bitrate, info.is_h265, info.downscale);
+#endif
+}
+
+// camerad stream in the venus input layout of an encoder, its buffers become the encoder's input buffers.
+// nullptr if there is none
+std::unique_ptr<VisionIpcClient> connect_encoder_stream(const std::string &name, int width, int height) {
+#if defined(QCOM) || defined(QCOM2)
+  auto client = std::make_unique<VisionIpcClient>("camerad", name, false);
+  client->lease_buffers = true;
+  if (client->connect(false) && client->buffers[0].nv12 &&
+      client->buffers[0].width == width && client->buffers[0].height == height) {
+    return client;
+  }
+#endif
+  return nullptr;
+}
+
+// The frame with frame_id from a stream camerad sends along with the one it was received from
+VisionBuf *recv_same_frame(VisionIpcClient &client, uint32_t frame_id) {
+  VisionIpcBufExtra extra;
+  while (VisionBuf *buf = client.recv(&extra, 20)) {
+    if (extra.frame_id == frame_id) return buf;
+    if (extra.frame_id > frame_id) break;
+  }
+  return nullptr;
+}
+
+float percentile(std::vector<float> &v, double p) {
+  if (v.empty()) return 0;
+  auto it = v.begin() + std::min(v.size() - 1, (size_t)(p * v.size()));
+  std::nth_element(v.begin(), it, v.end());
+  return *it;
+}
+
+void encoder_thread(int cam_idx, std::atomic<bool> *stop, std::atomic<bool> *done) {
   assert(cam_idx < LOG_CAMERA_ID_MAX-1);
   const LogCameraInfo &cam_info = cameras_logged[cam_idx];
   set_thread_name(cam_info.filename);
 
   int cnt = 0, cur_seg = -1;
   int encode_idx = 0;
+  bool counted = false;  // in s.max_waiting
   LoggerHandle *lh = NULL;
-  std::vector<Encoder *> encoders;
+  std::vector<VideoEncoder *> encoders;
   VisionIpcClient vipc_client = VisionIpcClient("camerad", cam_info.stream_type, false);
+  // keep camerad from writing into the frame while it's being encoded
+  vipc_client.lease_buffers = true;
+  // per encoder, camerad's copy of the frames in its input layout. nullptr when it copies the frame itself
+  std::vector<std::unique_ptr<VisionIpcClient>> enc_clients;
+  std::vector<const LogCameraInfo *> encoder_infos;
+  auto add_encoder = [&](const LogCameraInfo &info, int width, int height, std::unique_ptr<VisionIpcClient> client) {
+    VideoEncoder *e = create_encoder(info, width, height, client ? client->buffers : nullptr, client ? client->num_buffers : 0);
+#if defined(QCOM) || defined(QCOM2)
+    if (OmxEncoder *omx = dynamic_cast<OmxEncoder *>(e)) {
+      if (info.encode_data_name) omx->publish(info.encode_data_name);
+    } else {
+      // a V4L2 encoder took the stream
+      client.reset();
+    }
+#endif
+    encoders.push_back(e);
+    enc_clients.push_back(std::move(client));
+    encoder_infos.push_back(&info);
+  };
+
+  // for encoderStats, per encoder over the current period
+  std::vector<uint32_t> dropped, skipped;
+  uint32_t last_frame_id = 0;
+  double stats_start_tms = millis_since_boot();
+  double encode_ms = 0;  // spent in encode_buf, it blocks while the encoders are behind
+  int pressure_periods = 0, relief_periods = 0;
+  bool throttled = false;  // the encoders after the main one, qcamera, take every other frame
+  auto report_stats = [&]() {
+    const double tms = millis_since_boot();
+    const double period_ms = tms - stats_start_tms;
+    const bool pressure = std::any_of(dropped.begin(), dropped.end(), [](uint32_t d) { return d > 0; }) ||
+                          encode_ms > period_ms * 0.9;
+    pressure_periods = pressure ? pressure_periods + 1 : 0;
+    relief_periods = pressure ? 0 : relief_periods + 1;
+    if (ADAPTIVE_QCAMERA && encoders.size() > 1) {
+      if (!throttled && pressure_periods >= THROTTLE_AFTER) {
+        LOGW("camera %d encoders behind, throttling qcamera", cam_idx);
+        throttled = true;
+      } else if (throttled && relief_periods >= UNTHROTTLE_AFTER) {
+        LOGW("camera %d encoders caught up", cam_idx);
+        throttled = false;
+      }
+    }
 
-  while (!do_exit) {
+    std::lock_guard lk(s.encoder_stats_lock);
+    for (int i = 0; i < encoders.size(); ++i) {
+      EncoderStats stats = encoders[i]->take_stats();
+      EncoderReport &r = s.encoder_stats[encoder_infos[i]->filename];
+      r.queue_depth = stats.queue_depth;
+      r.latency_p50 = percentile(stats.latencies, 0.5);
+      r.latency_p99 = percentile(stats.latencies, 0.99);
+      r.dropped = dropped[i];
+      r.skipped = skipped[i];
+      r.bitrate = stats.bytes * 8 * 1000 / period_ms;
+      r.target_bitrate = encoder_infos[i]->bitrate;
+      r.fps = stats.frames * 1000 / period_ms;
+      r.throttled = throttled && i > 0;
+      dropped[i] = skipped[i] = 0;
+    }
+    stats_start_tms = tms;
+    encode_ms = 0;
+  };
+
+  while (!do_exit && !*stop) {
     if (!vipc_client.connect(false)) {
       util::sleep_for(100);
       continue;
@@ -133,23 +307,33 @@ void encoder_thread(int cam_idx) {
       LOGD("encoder init %dx%d", buf_info.width, buf_info.height);
 
       // main encoder
-      encoders.push_back(new Encoder(cam_info.filename, buf_info.width, buf_info.height,
-                                     cam_info.fps, cam_info.bitrate, cam_info.is_h265, cam_info.downscale));
+      add_encoder(cam_info, buf_info.width, buf_info.height,
+                  connect_encoder_stream(encoder_stream_name(cam_info.stream_type), buf_info.width, buf_info.height));
 
-      // qcamera encoder
+      // qcamera encoder, camerad downscales its frames
       if (cam_info.has_qcamera) {
         LogCameraInfo &qcam_info = cameras_logged[LOG_CAMERA_ID_QCAMERA];
-        encoders.push_back(new Encoder(qcam_info.filename,
-                                       qcam_info.frame_width, qcam_info.frame_height,
-                                       qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale));
+        add_encoder(qcam_info, qcam_info.frame_width, qcam_info.frame_height,
+                    connect_encoder_stream(QCAMERA_STREAM_NAME, qcam_info.frame_width, qcam_info.frame_height));
       }
+      dropped.resize(encoders.size());
+      skipped.resize(encoders.size());
     }
 
-    while (!do_exit) {
+    while (!do_exit && !*stop) {
       VisionIpcBufExtra extra;
       VisionBuf* buf = vipc_client.recv(&extra);
+      if (millis_since_boot() - stats_start_tms >= ENCODER_STATS_PERIOD) {
+        report_stats();
+      }
       if (buf == nullptr) continue;
 
+      // frames VisionIpc had to drop because we were too slow
+      if (last_frame_id > 0 && extra.frame_id > last_frame_id + 1) {
+        for (auto &d : dropped) d += extra.frame_id - last_frame_id - 1;
+      }
+      last_frame_id = extra.frame_id;
+
       if (cam_info.trigger_rotate) {
         s.last_camera_seen_tms = millis_since_boot();
       }
@@ -158,41 +342,71 @@ void encoder_thread(int cam_idx) {
         // trigger rotate and wait logger rotated to new segment
         ++s.waiting_rotate;
         std::unique_lock lk(s.rotate_lock);
-        s.rotate_cv.wait(lk, [&] { return s.rotate_segment > cur_seg || do_exit; });
+        s.rotate_cv.wait(lk, [&] { return s.rotate_segment > cur_seg || do_exit || *stop; });
+        if (s.rotate_segment <= cur_seg) {
+          // stopped while waiting, the logger shouldn't wait for this camera anymore
+          --s.waiting_rotate;
+        }
       }
-      if (do_exit) break;
+      if (do_exit || *stop) break;
 
       // rotate the encoder if the logger is on a newer segment
       if (s.rotate_segment > cur_seg) {
         cur_seg = s.rotate_segment;
         cnt = 0;
 
+        if (cam_info.trigger_rotate && !counted) {
+          // joining a running segment, catch up to the other cameras so the rotation isn't held up
+          std::unique_lock lk(s.rotate_lock);
+          cnt = (millis_since_boot() - s.last_rotate_tms) * cam_info.fps / 1000;
+          ++s.max_waiting;
+          counted = true;
+        }
+
         LOGW("camera %d rotate encoder to %s", cam_idx, s.segment_path);
         for (auto &e : encoders) {
           e->encoder_close();
           e->encoder_open(s.segment_path);
         }
+        // create the files of the next segment now, rotating to it then only swaps them in
+        const std::string next_path = logger_segment_path(&s.logger, LOG_ROOT.c_str(), cur_seg + 1);
+        for (auto &e : encoders) {
+          e->encoder_prepare(next_path.c_str());
+        }
         if (lh) {
           lh_close(lh);
         }
         lh = logger_get_handle(&s.logger);
       }
 
-      // encode a frame
+      // encode a frame, in place from camerad's copy for the encoder when it sent one
       for (int i = 0; i < encoders.size(); ++i) {
-        int out_id = encoders[i]->encode_frame(buf->y, buf->u, buf->v,
-                                               buf->width, buf->height, extra.timestamp_eof);
-        
+        if (i > 0 && throttled && encode_idx % 2) {
+          skipped[i]++;
+          continue;
+        }
+
+        TRACE_SCOPE("encode_buf");
+        const double encode_start_tms = millis_since_boot();
+        VisionBuf *enc_buf = enc_clients[i] ? recv_same_frame(*enc_clients[i], extra.frame_id) : nullptr;
+        int out_id = encoders[i]->encode_buf(enc_buf ? enc_buf : buf, extra.timestamp_eof);
+        if (enc_buf) {
+          enc_clients[i]->release();
+        }
+        encode_ms += millis_since_boot() - encode_start_tms;
+
         if (out_id == -1) {
           LOGE("Failed to encode frame. frame_id: %d encode_id: %d", extra.frame_id, encode_idx);
+          dropped[i]++;
         }
 
         // publish encode index
         if (i == 0 && out_id != -1) {
           MessageBuilder msg;
+          auto event = msg.initEvent();
           // this is really ugly
-          auto eidx = cam_idx == LOG_CAMERA_ID_DCAMERA ? msg.initEvent().initDriverEncodeIdx() :
-                     (cam_idx == LOG_CAMERA_ID_ECAMERA ? msg.initEvent().initWideRoadEncodeIdx() : msg.initEvent().initRoadEncodeIdx());
+          auto eidx = cam_idx == LOG_CAMERA_ID_DCAMERA ? event.initDriverEncodeIdx() :
+                     (cam_idx == LOG_CAMERA_ID_ECAMERA ? event.initWideRoadEncodeIdx() : event.initRoadEncodeIdx());
           eidx.setFrameId(extra.frame_id);
           eidx.setTimestampSof(extra.timestamp_sof);
           eidx.setTimestampEof(extra.timestamp_eof);
@@ -207,10 +421,11 @@ void encoder_thread(int cam_idx) {
           if (lh) {
             // TODO: this should read cereal/services.h for qlog decimation
             auto bytes = msg.toBytes();
-            lh_log(lh, bytes.begin(), bytes.size(), true);
+            lh_log(lh, bytes.begin(), bytes.size(), true, event.getLogMonoTime());
           }
         }
       }
+      vipc_client.release();
 
       cnt++;
       encode_idx++;
@@ -222,11 +437,62 @@ void encoder_thread(int cam_idx) {
     }
   }
 
+  if (counted) {
+    std::unique_lock lk(s.rotate_lock);
+    --s.max_waiting;
+  }
+
+  {
+    std::lock_guard lk(s.encoder_stats_lock);
+    for (auto info : encoder_infos) {
+      s.encoder_stats.erase(info->filename);
+    }
+  }
+
   LOG("encoder destroy");
   for(auto &e : encoders) {
     e->encoder_close();
     delete e;
   }
+  *done = true;
+}
+
+// starts the encoder threads of new camerad streams, and stops them when their stream is gone
+void update_encoder_threads(const bool (&record)[LOG_CAMERA_ID_MAX], EncoderThreadState (&threads)[LOG_CAMERA_ID_MAX]) {
+  const double tms = millis_since_boot();
+  const auto streams = VisionIpcClient::list_streams("camerad");
+
+  for (int cam_idx = 0; cam_idx < LOG_CAMERA_ID_QCAMERA; cam_idx++) {
+    if (!record[cam_idx]) continue;
+
+    EncoderThreadState &t = threads[cam_idx];
+    bool present = std::any_of(streams.begin(), streams.end(), [&](auto &info) {
+      return info.type == cameras_logged[cam_idx].stream_type;
+    });
+    if (present) {
+      t.last_seen_tms = tms;
+    }
+
+    // a stopped thread drains its encoders on its own, it's joined on a later pass once it's done
+    if (t.thread.joinable() && t.done) {
+      t.thread.join();
+    }
+
+    if (present && !t.thread.joinable()) {
+      LOGW("starting encoder thread for %s", cameras_logged[cam_idx].filename);
+      t.stop = false;
+      t.done = false;
+      t.thread = std::thread(encoder_thread, cam_idx, &t.stop, &t.done);
+    } else if (!present && t.thread.joinable() && !t.stop && (tms - t.last_seen_tms) > STREAM_PATIENCE) {
+      LOGW("stopping encoder thread for %s, stream is gone", cameras_logged[cam_idx].filename);
+      {
+        // under the lock so a thread about to wait for rotation can't miss it
+        std::unique_lock lk(s.rotate_lock);
+        t.stop = true;
+      }
+      s.rotate_cv.notify_all();
+    }
+  }
 }
 
 int clear_locks_fn(const char* fpath, const struct stat *sb, int tyupeflag) {
@@ -256,7 +522,7 @@ void logger_rotate() {
 }
 
 void rotate_if_needed() {
-  if (s.waiting_rotate == s.max_waiting) {
+  if (s.max_waiting > 0 && s.waiting_rotate == s.max_waiting) {
     logger_rotate();
   }
 
@@ -301,30 +567,35 @@ int main(int argc, char** argv) {
   logger_rotate();
   params.put("CurrentRoute", s.logger.route_name);
 
-  // init encoders
+  // init encoders, their threads are started once camerad has the stream
   s.last_camera_seen_tms = millis_since_boot();
-  // TODO: create these threads dynamically on frame packet presence
-  std::vector<std::thread> encoder_threads;
-  encoder_threads.push_back(std::thread(encoder_thread, LOG_CAMERA_ID_FCAMERA));
-  if (cameras_logged[LOG_CAMERA_ID_FCAMERA].trigger_rotate) {
-    s.max_waiting += 1;
-  }
-
-  if (!Hardware::PC() && params.getBool("RecordFront")) {
-    encoder_threads.push_back(std::thread(encoder_thread, LOG_CAMERA_ID_DCAMERA));
-    if (cameras_logged[LOG_CAMERA_ID_DCAMERA].trigger_rotate) {
-      s.max_waiting += 1;
-    }
-  }
-  if (Hardware::TICI()) {
-    encoder_threads.push_back(std::thread(encoder_thread, LOG_CAMERA_ID_ECAMERA));
-    if (cameras_logged[LOG_CAMERA_ID_ECAMERA].trigger_rotate) {
-      s.max_waiting += 1;
-    }
-  }
+  const bool record[LOG_CAMERA_ID_MAX] = {
+    [LOG_CAMERA_ID_FCAMERA] = true,
+    [LOG_CAMERA_ID_DCAMERA] = !Hardware::PC() && params.getBool("RecordFront"),
+    [LOG_CAMERA_ID_ECAMERA] = Hardware::TICI(),
+  };
+  EncoderThreadState encoder_threads[LOG_CAMERA_ID_MAX];
+  double last_discovery_ts = 0;
+
+  PubMaster pm({"loggerdState", "encoderStats"});
+  double last_stats_ts = millis_since_boot();
+
+  // messages of a poll round are logged together, the logger is locked once per batch
+  LogBatch batch;
+  uint64_t msg_count = 0, batch_count = 0;
+  double lock_hold_ms = 0, lock_hold_max_ms = 0;
+  auto flush_batch = [&]() {
+    TRACE_SCOPE("log_batch");
+    TRACE_COUNTER("log_batch_messages", batch.count());
+    const double hold_ms = logger_log_batch(&s.logger, batch);
+    msg_count += batch.count();
+    batch_count += batch.count() > 0;
+    lock_hold_ms += hold_ms;
+    lock_hold_max_ms = std::max(lock_hold_max_ms, hold_ms);
+    batch.clear();
+    rotate_if_needed();
+  };
 
-  uint64_t msg_count = 0, bytes_count = 0;
-  double start_ts = millis_since_boot();
   while (!do_exit) {
     // poll for new messages on all sockets
     for (auto sock : poller->poll(1000)) {
@@ -333,23 +604,67 @@ int main(int argc, char** argv) {
       Message *msg = nullptr;
       while (!do_exit && (msg = sock->receive(true))) {
         const bool in_qlog = qs.freq != -1 && (qs.counter++ % qs.freq == 0);
-        logger_log(&s.logger, (uint8_t *)msg->getData(), msg->getSize(), in_qlog);
-        bytes_count += msg->getSize();
+        batch.add(msg->getData(), msg->getSize(), in_qlog);
         delete msg;
 
-        rotate_if_needed();
+        if (batch.bytes() >= LOG_BATCH_MAX_SIZE) flush_batch();
+      }
+    }
+    flush_batch();
+
+    if (millis_since_boot() - last_discovery_ts >= STREAM_DISCOVERY_PERIOD) {
+      last_discovery_ts = millis_since_boot();
+      update_encoder_threads(record, encoder_threads);
+    }
 
-        if ((++msg_count % 1000) == 0) {
-          double seconds = (millis_since_boot() - start_ts) / 1000.0;
-          LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
+    if (millis_since_boot() - last_stats_ts >= 1000) {
+      const double seconds = (millis_since_boot() - last_stats_ts) / 1000.0;
+      last_stats_ts = millis_since_boot();
+      FileWriterStats stats = file_writer_stats();
+      MessageBuilder msg;
+      auto state = msg.initEvent().initLoggerdState();
+      state.setBytesWritten(stats.bytes_written);
+      state.setWriteQueueDepth(stats.queue_depth);
+      state.setPendingLogBlocks(logger_pending_blocks());
+      state.setWriteLatencyP99(stats.write_latency_p99);
+      state.setWriteLatencyMax(stats.write_latency_max);
+      state.setMessagesPerSecond(msg_count / seconds);
+      state.setLogLockHoldTime(batch_count > 0 ? lock_hold_ms / batch_count : 0);
+      state.setLogLockHoldTimeMax(lock_hold_max_ms);
+      pm.send("loggerdState", msg);
+
+      std::unique_lock lk(s.encoder_stats_lock);
+      if (!s.encoder_stats.empty()) {
+        MessageBuilder enc_msg;
+        auto enc_stats = enc_msg.initEvent().initEncoderStats().initEncoders(s.encoder_stats.size());
+        int i = 0;
+        for (auto &[name, r] : s.encoder_stats) {
+          auto e = enc_stats[i++];
+          e.setName(name);
+          e.setInputQueueDepth(r.queue_depth);
+          e.setEncodeLatencyP50(r.latency_p50);
+          e.setEncodeLatencyP99(r.latency_p99);
+          e.setDroppedFrames(r.dropped);
+          e.setSkippedFrames(r.skipped);
+          e.setBitrate(r.bitrate);
+          e.setTargetBitrate(r.target_bitrate);
+          e.setFps(r.fps);
+          e.setThrottled(r.throttled);
         }
+        pm.send("encoderStats", enc_msg);
       }
+      lk.unlock();
+
+      msg_count = batch_count = 0;
+      lock_hold_ms = lock_hold_max_ms = 0;
     }
   }
 
   LOGW("closing encoders");
   s.rotate_cv.notify_all();
-  for (auto &t : encoder_threads) t.join();
+  for (auto &t : encoder_threads) {
+    if (t.thread.joinable()) t.thread.join();
+  }
 
   LOGW("closing logger");
   logger_close(&s.logger, &do_exit);
@@ -0,0 +1,353 @@
+#include "selfdrive/loggerd/logreader.h"
+
+#include <bzlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include <capnp/schema.h>
+
+#include "selfdrive/common/swaglog.h"
+
+// A read only mapping of a file, or anonymous memory the decompressed log is written to
+class LogBuffer {
+ public:
+  LogBuffer(void *data, size_t size) : data((char *)data), size(size) {}
+  ~LogBuffer() {
+    if (data != nullptr) munmap(data, size);
+  }
+
+  static std::unique_ptr<LogBuffer> map(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+
+    std::unique_ptr<LogBuffer> r;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      void *p = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+      if (p != MAP_FAILED) r = std::make_unique<LogBuffer>(p, st.st_size);
+    }
+    close(fd);
+    return r;
+  }
+
+  static std::unique_ptr<LogBuffer> alloc(size_t size) {
+    void *p = size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : nullptr;
+    return p != MAP_FAILED ? std::make_unique<LogBuffer>(p, size) : nullptr;
+  }
+
+  char *const data;
+  const size_t size;
+};
+
+namespace {
+
+enum class Format { RAW, BZ2, ZSTD };
+
+struct Chunk {
+  const char *in;
+  size_t in_size;
+  size_t out_offset, out_size;  // zstd, from the frame header
+  std::string out;              // bz2, the size is only known after decompressing
+  bool ok = false;
+};
+
+struct Log {
+  std::unique_ptr<LogBuffer> file, data;
+  size_t data_size = 0;
+  Format format = Format::RAW;
+  std::vector<Chunk> chunks;
+};
+
+// fn(i) for i in [0, n), on up to threads threads
+template <class F>
+void parallel_for(size_t n, int threads, F fn) {
+  std::atomic<size_t> next = 0;
+  auto work = [&]() {
+    for (size_t i; (i = next++) < n;) fn(i);
+  };
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < std::min((size_t)threads, n); t++) workers.emplace_back(work);
+  work();
+  for (auto &w : workers) w.join();
+}
+
+// Decompresses one bz2 stream from in, appended to out. Returns the bzip2 status, BZ_STREAM_END once
+// the stream is complete
+int bz2_decompress(const char *in, size_t in_size, std::string &out, size_t *consumed) {
+  bz_stream strm = {};
+  int ret = BZ2_bzDecompressInit(&strm, 0, 0);
+  if (ret != BZ_OK) return ret;
+
+  size_t produced = out.size();
+  out.resize(produced + std::max(in_size * 4, (size_t)1 << 20));
+  strm.next_in = (char *)in;
+  strm.avail_in = in_size;
+  while (ret == BZ_OK) {
+    if (out.size() - produced < (1 << 16)) out.resize(out.size() * 2);
+    strm.next_out = out.data() + produced;
+    strm.avail_out = out.size() - produced;
+    ret = BZ2_bzDecompress(&strm);
+    produced = strm.next_out - out.data();
+    // input ended inside the stream
+    if (ret == BZ_OK && strm.avail_in == 0 && strm.avail_out > 0) break;
+  }
+  out.resize(produced);
+  *consumed = in_size - strm.avail_in;
+  BZ2_bzDecompressEnd(&strm);
+  return ret;
+}
+
+// Concatenated bz2 streams one after the other, up to the end or the first error
+void bz2_decompress_all(const char *in, size_t in_size, std::string &out) {
+  size_t pos = 0;
+  while (pos < in_size) {
+    size_t consumed = 0;
+    if (bz2_decompress(in + pos, in_size - pos, out, &consumed) != BZ_STREAM_END) break;
+    pos += consumed;
+  }
+}
+
+// Where the bz2 streams start: "BZh", the block size and the magic of the first block, byte aligned.
+// A match inside compressed data is not impossible, decompress checks that every chunk is one stream
+std::vector<size_t> bz2_stream_starts(const char *data, size_t size) {
+  static const char block_magic[] = "1AY&SY";  // 0x314159265359
+  std::vector<size_t> starts;
+  const char *end = data + size;
+  for (const char *p = data; (p = (const char *)memmem(p, end - p, "BZh", 3)) != nullptr; p++) {
+    if (end - p >= 10 && p[3] >= '1' && p[3] <= '9' && memcmp(p + 4, block_magic, 6) == 0) {
+      starts.push_back(p - data);
+    }
+  }
+  return starts;
+}
+
+void zstd_decompress_stream(const char *in, size_t in_size, std::string &out) {
+  ZSTD_DStream *d = ZSTD_createDStream();
+  ZSTD_initDStream(d);
+  ZSTD_inBuffer input = {in, in_size, 0};
+  std::string buf(ZSTD_DStreamOutSize(), '\0');
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output = {buf.data(), buf.size(), 0};
+    if (ZSTD_isError(ZSTD_decompressStream(d, &output, &input))) break;
+    out.append(buf.data(), output.pos);
+  }
+  ZSTD_freeDStream(d);
+}
+
+std::unique_ptr<LogBuffer> from_string(const std::string &s) {
+  auto r = LogBuffer::alloc(s.size());
+  if (r) memcpy(r->data, s.data(), s.size());
+  return r;
+}
+
+// Splits a log into the chunks decompressed in parallel. Logs that can't be split, e.g. zstd without
+// frame sizes, are decompressed here
+void prepare(Log &log) {
+  const char *in = log.file->data;
+  const size_t in_size = log.file->size;
+  uint32_t magic = 0;
+  if (in_size >= 4) memcpy(&magic, in, 4);
+
+  if (in_size >= 3 && memcmp(in, "BZh", 3) == 0) {
+    log.format = Format::BZ2;
+    std::vector<size_t> starts = bz2_stream_starts(in, in_size);
+    if (starts.empty() || starts[0] != 0) starts.insert(starts.begin(), 0);
+    for (size_t i = 0; i < starts.size(); i++) {
+      const size_t end = i + 1 < starts.size() ? starts[i + 1] : in_size;
+      log.chunks.push_back({.in = in + starts[i], .in_size = end - starts[i]});
+    }
+  } else if (magic == ZSTD_MAGICNUMBER) {
+    log.format = Format::ZSTD;
+    bool sizes_known = true;
+    size_t pos = 0, out_size = 0;
+    while (pos < in_size) {
+      const size_t frame_size = ZSTD_findFrameCompressedSize(in + pos, in_size - pos);
+      if (ZSTD_isError(frame_size)) break;  // truncated
+
+      memcpy(&magic, in + pos, 4);
+      // skippable frames, the seek table
+      if ((magic & 0xFFFFFFF0) != ZSTD_MAGIC_SKIPPABLE_START) {
+        const unsigned long long content_size = ZSTD_getFrameContentSize(in + pos, in_size - pos);
+        if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR) {
+          sizes_known = false;
+          break;
+        }
+        log.chunks.push_back({.in = in + pos, .in_size = frame_size, .out_offset = out_size, .out_size = content_size});
+        out_size += content_size;
+      }
+      pos += frame_size;
+    }
+
+    if (sizes_known) {
+      log.data = LogBuffer::alloc(out_size);
+    } else {
+      log.chunks.clear();
+      std::string out;
+      zstd_decompress_stream(in, in_size, out);
+      log.data = from_string(out);
+    }
+  }
+}
+
+void decompress(Log &log, Chunk &c) {
+  if (log.format == Format::BZ2) {
+    size_t consumed = 0;
+    c.ok = bz2_decompress(c.in, c.in_size, c.out, &consumed) == BZ_STREAM_END && consumed == c.in_size;
+  } else if (log.data) {
+    const size_t ret = ZSTD_decompress(log.data->data + c.out_offset, c.out_size, c.in, c.in_size);
+    c.ok = !ZSTD_isError(ret) && ret == c.out_size;
+  }
+}
+
+// The decompressed log, up to the first chunk that failed
+void finish(Log &log) {
+  const size_t first_failed = std::find_if(log.chunks.begin(), log.chunks.end(), [](auto &c) { return !c.ok; }) - log.chunks.begin();
+
+  if (log.format == Format::RAW) {
+    log.data = std::move(log.file);
+    log.data_size = log.data->size;
+  } else if (log.format == Format::ZSTD) {
+    if (!log.data) return;
+    log.data_size = first_failed < log.chunks.size() ? log.chunks[first_failed].out_offset : log.data->size;
+  } else if (log.format == Format::BZ2) {
+    std::string tail;
+    if (first_failed + 1 == log.chunks.size()) {
+      // truncated, what the last stream decompressed to
+      tail = std::move(log.chunks[first_failed].out);
+    } else if (first_failed < log.chunks.size()) {
+      // not a stream start after all, one stream after the other from here
+      const Chunk &c = log.chunks[first_failed];
+      bz2_decompress_all(c.in, log.file->data + log.file->size - c.in, tail);
+    }
+
+    size_t size = tail.size();
+    for (size_t i = 0; i < first_failed; i++) size += log.chunks[i].out.size();
+    log.data = LogBuffer::alloc(size);
+    if (!log.data) return;
+
+    char *p = log.data->data;
+    for (size_t i = 0; i < first_failed; i++) {
+      memcpy(p, log.chunks[i].out.data(), log.chunks[i].out.size());
+      p += log.chunks[i].out.size();
+      log.chunks[i].out = std::string();
+    }
+    memcpy(p, tail.data(), tail.size());
+    log.data_size = size;
+  }
+  log.chunks.clear();
+}
+
+// The complete messages of a decompressed log
+std::vector<kj::ArrayPtr<const capnp::word>> split_messages(const Log &log) {
+  std::vector<kj::ArrayPtr<const capnp::word>> msgs;
+  if (!log.data) return msgs;
+
+  const capnp::word *p = (const capnp::word *)log.data->data;
+  size_t left = log.data_size / sizeof(capnp::word);
+  while (left > 0) {
+    const size_t size = capnp::expectedSizeInWordsFromPrefix(kj::arrayPtr(p, left));
+    if (size == 0 || size > left) break;
+
+    msgs.push_back(kj::arrayPtr(p, size));
+    p += size;
+    left -= size;
+  }
+  return msgs;
+}
+
+}  // namespace
+
+LogReader::LogReader(int threads) : threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+LogReader::~LogReader() {}
+
+bool LogReader::load(const std::vector<std::string> &paths) {
+  bool ret = true;
+  std::vector<Log> logs(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    logs[i].file = LogBuffer::map(paths[i]);
+    if (!logs[i].file) {
+      LOGE("failed to read log %s", paths[i].c_str());
+      ret = false;
+      continue;
+    }
+    prepare(logs[i]);
+  }
+
+  // the chunks of all logs together, a few segments still keep every thread busy
+  std::vector<std::pair<Log *, Chunk *>> chunks;
+  for (auto &log : logs) {
+    for (auto &c : log.chunks) chunks.push_back({&log, &c});
+  }
+  parallel_for(chunks.size(), threads, [&](size_t i) { decompress(*chunks[i].first, *chunks[i].second); });
+  parallel_for(logs.size(), threads, [&](size_t i) {
+    if (logs[i].file || logs[i].data) finish(logs[i]);
+  });
+
+  std::vector<Event> added;
+  for (auto &log : logs) {
+    for (auto &words : split_messages(log)) added.push_back({.words = words});
+    // the compressed file isn't needed anymore
+    log.file.reset();
+    if (log.data) buffers.push_back(std::move(log.data));
+  }
+
+  // reading the headers is most of the time for raw logs
+  std::vector<uint8_t> valid(added.size());
+  const size_t batch = 4096;
+  parallel_for((added.size() + batch - 1) / batch, threads, [&](size_t b) {
+    for (size_t i = b * batch; i < std::min(added.size(), (b + 1) * batch); i++) {
+      try {
+        capnp::FlatArrayMessageReader msg(added[i].words);
+        cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+        added[i].mono_time = event.getLogMonoTime();
+        added[i].which = event.which();
+        valid[i] = true;
+      } catch (const kj::Exception &) {
+        valid[i] = false;
+      }
+    }
+  });
+
+  const size_t invalid = std::count(valid.begin(), valid.end(), 0);
+  if (invalid > 0) LOGW("skipped %zu events that failed to parse", invalid);
+  for (size_t i = 0; i < added.size(); i++) {
+    if (valid[i]) events_.push_back(added[i]);
+  }
+
+  std::stable_sort(events_.begin(), events_.end(), [](const Event &a, const Event &b) { return a.mono_time < b.mono_time; });
+  services.clear();
+  for (uint32_t i = 0; i < events_.size(); i++) {
+    const size_t which = (size_t)events_[i].which;
+    if (which >= services.size()) services.resize(which + 1);
+    services[which].push_back(i);
+  }
+  return ret;
+}
+
+const std::vector<uint32_t> &LogReader::service(cereal::Event::Which which) const {
+  static const std::vector<uint32_t> empty;
+  return (size_t)which < services.size() ? services[(size_t)which] : empty;
+}
+
+const std::vector<uint32_t> &LogReader::service(const std::string &name) const {
+  static const std::vector<uint32_t> empty;
+  KJ_IF_MAYBE(field, capnp::Schema::from<cereal::Event>().findFieldByName(name)) {
+    const uint16_t discriminant = field->getProto().getDiscriminantValue();
+    if (discriminant != capnp::schema::Field::NO_DISCRIMINANT) return service((cereal::Event::Which)discriminant);
+  }
+  return empty;
+}
+
+size_t LogReader::seek(uint64_t mono_time) const {
+  auto it = std::lower_bound(events_.begin(), events_.end(), mono_time, [](const Event &e, uint64_t t) { return e.mono_time < t; });
+  return it - events_.begin();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <capnp/serialize.h>
+#include <kj/array.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+// a log in memory, see logreader.cc
+class LogBuffer;
+
+// Reads the logs of one or more segments, raw, bz2 or zstd. The blocks logger.cc compresses
+// independently, bz2 streams and zstd frames, are decompressed in parallel into mmap'd buffers and
+// the events point into them. An event is read without copies with
+//   capnp::FlatArrayMessageReader msg(e.words);
+//   cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+class LogReader {
+ public:
+  struct Event {
+    uint64_t mono_time;
+    cereal::Event::Which which;
+    kj::ArrayPtr<const capnp::word> words;  // valid as long as the LogReader
+
+    const char *data() const { return (const char *)words.begin(); }
+    size_t size() const { return words.size() * sizeof(capnp::word); }
+  };
+
+  // threads 0 for one per core
+  explicit LogReader(int threads = 0);
+  ~LogReader();
+
+  // Adds the events of the logs, false if one could not be read. A truncated log, e.g. of a segment
+  // still being written, keeps what decompresses
+  bool load(const std::vector<std::string> &paths);
+  bool load(const std::string &path) { return load(std::vector<std::string>{path}); }
+
+  // all events by logMonoTime, in log order for equal times
+  const std::vector<Event> &events() const { return events_; }
+  // indices into events() of one service
+  const std::vector<uint32_t> &service(cereal::Event::Which which) const;
+  const std::vector<uint32_t> &service(const std::string &name) const;
+  // index of the first event at or after mono_time, events().size() if there is none
+  size_t seek(uint64_t mono_time) const;
+
+ private:
+  const int threads;
+  std::vector<std::unique_ptr<LogBuffer>> buffers;
+  std::vector<Event> events_;
+  std::vector<std::vector<uint32_t>> services;
+};
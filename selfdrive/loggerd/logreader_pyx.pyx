@@ -0,0 +1,75 @@
+# distutils: language = c++
+# cython: c_string_encoding=ascii, language_level=3
+
+from libcpp.string cimport string
+from libcpp.vector cimport vector
+from libc.stdint cimport uint32_t, uint64_t
+from libcpp cimport bool
+
+from cereal.messaging import log_from_bytes
+
+
+cdef extern from "selfdrive/loggerd/logreader.h":
+  cdef cppclass cpp_LogReader "LogReader":
+    cppclass Event:
+      uint64_t mono_time
+      const char *data()
+      size_t size()
+
+    cpp_LogReader(int)
+    bool load(vector[string]) nogil
+    const vector[Event] &events()
+    const vector[uint32_t] &service(string)
+    size_t seek(uint64_t)
+
+
+cdef class LogReader:
+  """The C++ LogReader of selfdrive/loggerd/logreader.h, events by logMonoTime.
+
+  lr[i] is the event reader of the i-th event, lr.raw(i) its bytes. Unlike tools.lib.logreader the
+  events are sorted and indexed, lr.service("carState") are the indices of one service and
+  lr.seek(t) the first event at or after logMonoTime t.
+  """
+  cdef cpp_LogReader *lr
+
+  def __cinit__(self, paths, int threads=0):
+    if isinstance(paths, str):
+      paths = [paths]
+    self.lr = new cpp_LogReader(threads)
+
+    cdef vector[string] p = [s.encode('utf8') for s in paths]
+    cdef bool ok
+    with nogil:
+      ok = self.lr.load(p)
+    if not ok:
+      raise IOError(f"failed to read {paths}")
+
+  def __dealloc__(self):
+    del self.lr
+
+  def __len__(self):
+    return self.lr.events().size()
+
+  def raw(self, size_t i):
+    if i >= self.lr.events().size():
+      raise IndexError(i)
+    cdef const cpp_LogReader.Event *e = &self.lr.events()[i]
+    return e.data()[:e.size()]
+
+  def mono_time(self, size_t i):
+    if i >= self.lr.events().size():
+      raise IndexError(i)
+    return self.lr.events()[i].mono_time
+
+  def __getitem__(self, size_t i):
+    return log_from_bytes(self.raw(i))
+
+  def __iter__(self):
+    for i in range(self.lr.events().size()):
+      yield log_from_bytes(self.raw(i))
+
+  def service(self, str name):
+    return list(self.lr.service(name.encode('utf8')))
+
+  def seek(self, uint64_t mono_time):
+    return self.lr.seek(mono_time)
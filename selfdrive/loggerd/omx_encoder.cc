@@ -6,9 +6,12 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 
 #include <OMX_Component.h>
 #include <OMX_IndexExt.h>
@@ -68,7 +71,10 @@ OMX_ERRORTYPE OmxEncoder::empty_buffer_done(OMX_HANDLETYPE component, OMX_PTR ap
                                                    OMX_BUFFERHEADERTYPE *buffer) {
   // printf("empty_buffer_done\n");
   OmxEncoder *e = (OmxEncoder*)app_data;
-  e->free_in.push(buffer);
+  if (!e->free_in.push(buffer)) {
+    // can't happen with the queue sized for the port, the buffer is out of the rotation then
+    LOGE("%s: free input queue full, input buffer %p lost", e->filename, buffer);
+  }
   return OMX_ErrorNone;
 }
 
@@ -76,7 +82,12 @@ OMX_ERRORTYPE OmxEncoder::fill_buffer_done(OMX_HANDLETYPE component, OMX_PTR app
                                                   OMX_BUFFERHEADERTYPE *buffer) {
   // printf("fill_buffer_done\n");
   OmxEncoder *e = (OmxEncoder*)app_data;
-  e->done_out.push(buffer);
+  if (!e->done_out.push(buffer)) {
+    // the output is dropped, the buffer goes back to the component
+    LOGE("%s: encoded output queue full, dropping %u bytes", e->filename, buffer->nFilledLen);
+    buffer->nFilledLen = 0;
+    OMX_FillThisBuffer(e->handle, buffer);
+  }
   return OMX_ErrorNone;
 }
 
@@ -156,12 +167,15 @@ static const char* omx_color_fomat_name(uint32_t format) {
 
 // ***** encoder functions *****
 
-OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale) {
+OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale,
+                       VisionBuf *in_bufs, size_t num_in_bufs) {
   this->filename = filename;
   this->width = width;
   this->height = height;
   this->fps = fps;
   this->remuxing = !h265;
+  // about a minute of video, the usual segment length
+  this->prealloc_size = (size_t)bitrate / 8 * 64;
 
   this->downscale = downscale;
   if (this->downscale) {
@@ -196,8 +210,26 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
   // in_port.format.video.eColorFormat = OMX_COLOR_FormatYUV420SemiPlanar;
   in_port.format.video.eColorFormat = (OMX_COLOR_FORMATTYPE)QOMX_COLOR_FORMATYUV420PackedSemiPlanar32m;
 
+  if (in_bufs) {
+    // one input buffer per VisionBuf, the encoder doesn't copy them into its own. With downscale they are
+    // already scaled, only frames copied in are downscaled. Those go to buffers of our own, the VisionBufs
+    // are camerad's to write
+    assert(num_in_bufs >= in_port.nBufferCountMin && num_in_bufs + OMX_COPY_IN_BUFS <= OMX_QUEUE_SIZE);
+    in_port.nBufferCountActual = num_in_bufs + OMX_COPY_IN_BUFS;
+    this->in_vipc_bufs = in_bufs;
+    this->num_vipc_in = num_in_bufs;
+
+    OMX_QCOM_PARAM_PORTDEFINITIONTYPE qcom_port = {0};
+    qcom_port.nSize = sizeof(qcom_port);
+    qcom_port.nPortIndex = (OMX_U32) PORT_INDEX_IN;
+    qcom_port.nMemRegion = OMX_QCOM_MemRegionEBI1;
+    OMX_CHECK(OMX_SetParameter(this->handle, (OMX_INDEXTYPE)OMX_QcomIndexPortDefn, (OMX_PTR) &qcom_port));
+  }
+
   OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &in_port));
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &in_port));
+  assert(in_port.nBufferCountActual <= OMX_QUEUE_SIZE);
+  assert(!in_bufs || in_port.nBufferCountActual == num_in_bufs + OMX_COPY_IN_BUFS);
   this->in_buf_headers.resize(in_port.nBufferCountActual);
 
   // setup output port
@@ -220,6 +252,7 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
   OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &out_port));
 
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &out_port));
+  assert(out_port.nBufferCountActual <= OMX_QUEUE_SIZE);
   this->out_buf_headers.resize(out_port.nBufferCountActual);
 
   OMX_VIDEO_PARAM_BITRATETYPE bitrate_type = {0};
@@ -298,9 +331,35 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
 
   OMX_CHECK(OMX_SendCommand(this->handle, OMX_CommandStateSet, OMX_StateIdle, NULL));
 
-  for (auto &buf : this->in_buf_headers) {
-    OMX_CHECK(OMX_AllocateBuffer(this->handle, &buf, PORT_INDEX_IN, this,
-                             in_port.nBufferSize));
+  this->in_pmem.resize(this->in_buf_headers.size());
+  if (in_bufs) {
+    // ion as well, all the buffers of the port are given to it the same way
+    this->own_in_bufs.resize(OMX_COPY_IN_BUFS);
+    for (VisionBuf &vb : this->own_in_bufs) {
+      vb.allocate(in_port.nBufferSize);
+      const size_t stride = VENUS_Y_STRIDE(COLOR_FMT_NV12, this->width);
+      vb.init_nv12(this->width, this->height, stride, stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, this->height));
+    }
+  }
+  for (size_t i = 0; i < this->in_buf_headers.size(); i++) {
+    if (in_bufs) {
+      const VisionBuf &vb = i < num_in_bufs ? in_bufs[i] : this->own_in_bufs[i - num_in_bufs];
+      assert(vb.nv12 && vb.width == this->width && vb.height == this->height && vb.len >= in_port.nBufferSize);
+      assert(vb.stride == VENUS_Y_STRIDE(COLOR_FMT_NV12, this->width));
+      assert(vb.uv_offset == vb.stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, this->height));
+
+      OMX_QCOM_PLATFORM_PRIVATE_PMEM_INFO &pmem = this->in_pmem[i];
+      pmem.pmem_fd = vb.fd;
+      pmem.offset = 0;
+      pmem.size = vb.len;
+      pmem.mapped_size = vb.mmap_len;
+      pmem.buffer = vb.addr;
+      OMX_CHECK(OMX_UseBuffer(this->handle, &this->in_buf_headers[i], PORT_INDEX_IN, &pmem,
+                              in_port.nBufferSize, (OMX_U8 *)vb.addr));
+    } else {
+      OMX_CHECK(OMX_AllocateBuffer(this->handle, &this->in_buf_headers[i], PORT_INDEX_IN, this,
+                               in_port.nBufferSize));
+    }
   }
 
   for (auto &buf : this->out_buf_headers) {
@@ -326,6 +385,28 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
   }
 }
 
+void OmxEncoder::publish(const char *service) {
+  this->publish_service = service;
+  this->pm = std::make_unique<PubMaster>(std::vector<const char *>{service});
+}
+
+void OmxEncoder::publish_frame(const uint8_t *data, size_t len, uint64_t ts_us, bool keyframe) {
+  MessageBuilder msg;
+  auto event = msg.initEvent();
+  auto ed = (!strcmp(this->publish_service, "driverEncodeData")) ? event.initDriverEncodeData() :
+            (!strcmp(this->publish_service, "wideRoadEncodeData")) ? event.initWideRoadEncodeData() :
+            (!strcmp(this->publish_service, "qRoadEncodeData")) ? event.initQRoadEncodeData() : event.initRoadEncodeData();
+  ed.setTimestampEof(ts_us * 1000);
+  ed.setEncodeId(this->publish_id++);
+  ed.setKeyframe(keyframe);
+  // a consumer joining late can start decoding at any keyframe
+  if (keyframe && this->codec_config_len > 0) {
+    ed.setHeader(kj::arrayPtr(this->codec_config, this->codec_config_len));
+  }
+  ed.setData(kj::arrayPtr(data, len));
+  this->pm->send(this->publish_service, msg);
+}
+
 void OmxEncoder::handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf) {
   int err;
   uint8_t *buf_data = out_buf->pBuffer + out_buf->nOffset;
@@ -343,7 +424,21 @@ void OmxEncoder::handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf) {
 
   if (e->of) {
     //printf("write %d flags 0x%x\n", out_buf->nFilledLen, out_buf->nFlags);
-    fwrite(buf_data, out_buf->nFilledLen, 1, e->of);
+    e->of->write(buf_data, out_buf->nFilledLen);
+  }
+  if (e->index) {
+    if (out_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG) {
+      e->index->config(out_buf->nFilledLen);
+    } else if (out_buf->nFilledLen > 0) {
+      e->index->frame(out_buf->nFilledLen, out_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME);
+    }
+  }
+
+  if (!(out_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG) && out_buf->nFilledLen > 0) {
+    e->frame_encoded(out_buf->nTimeStamp, out_buf->nFilledLen);
+    if (e->pm) {
+      e->publish_frame(buf_data, out_buf->nFilledLen, out_buf->nTimeStamp, out_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME);
+    }
   }
 
   if (e->remuxing) {
@@ -405,16 +500,22 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
   // THIS IS A REALLY BAD IDEA, but apparently the race has to happen 30 times to trigger this
   //pthread_mutex_unlock(&this->lock);
   OMX_BUFFERHEADERTYPE* in_buf = nullptr;
-  while (!this->free_in.try_pop(in_buf, 20)) {
-    if (do_exit) {
+  if (this->in_vipc_bufs) {
+    // not one of camerad's, they are still written and read by the others
+    in_buf = take_free_in([this](OMX_BUFFERHEADERTYPE *buf) { return in_index(buf) >= this->num_vipc_in; });
+    if (!in_buf) {
       return -1;
     }
+  } else {
+    while (!this->free_in.try_pop(in_buf, 20)) {
+      if (do_exit) {
+        return -1;
+      }
+    }
   }
 
   //pthread_mutex_lock(&this->lock);
 
-  int ret = this->counter;
-
   uint8_t *in_buf_ptr = in_buf->pBuffer;
   // printf("in_buf ptr %p\n", in_buf_ptr);
 
@@ -446,6 +547,64 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
                    this->width, this->height);
   assert(err == 0);
 
+  if (this->in_vipc_bufs) {
+    // ion memory the cpu wrote through its cache
+    this->own_in_bufs[in_index(in_buf) - this->num_vipc_in].sync(VISIONBUF_SYNC_TO_DEVICE);
+  }
+
+  return queue_in_buf(in_buf, ts);
+}
+
+int OmxEncoder::encode_buf(const VisionBuf *buf, uint64_t ts) {
+  if (!this->in_vipc_bufs || buf < this->in_vipc_bufs || buf >= this->in_vipc_bufs + this->num_vipc_in) {
+    return VideoEncoder::encode_buf(buf, ts);
+  }
+  if (!this->is_open) {
+    return -1;
+  }
+
+  OMX_BUFFERHEADERTYPE *in_buf = this->in_buf_headers[buf - this->in_vipc_bufs];
+  auto is_in_buf = [in_buf](OMX_BUFFERHEADERTYPE *b) { return b == in_buf; };
+  if (!take_free_in(is_in_buf)) {
+    return -1;
+  }
+  int ret = queue_in_buf(in_buf, ts);
+
+  // the frame is only leased to us until the next one is received, the encoder has to be done reading it
+  if (take_free_in(is_in_buf)) {
+    this->free_in.push(in_buf);
+  }
+  return ret;
+}
+
+OMX_BUFFERHEADERTYPE *OmxEncoder::take_free_in(const std::function<bool(OMX_BUFFERHEADERTYPE *)> &match) {
+  // the others are free as well, they go back in the queue
+  std::vector<OMX_BUFFERHEADERTYPE *> others;
+  OMX_BUFFERHEADERTYPE *found = nullptr;
+  while (!found && !do_exit) {
+    OMX_BUFFERHEADERTYPE *buf;
+    if (!this->free_in.try_pop(buf, 20)) {
+      continue;
+    }
+    if (match(buf)) {
+      found = buf;
+    } else {
+      others.push_back(buf);
+    }
+  }
+  for (auto buf : others) {
+    this->free_in.push(buf);
+  }
+  return found;
+}
+
+size_t OmxEncoder::in_index(OMX_BUFFERHEADERTYPE *in_buf) const {
+  return std::find(this->in_buf_headers.begin(), this->in_buf_headers.end(), in_buf) - this->in_buf_headers.begin();
+}
+
+int OmxEncoder::queue_in_buf(OMX_BUFFERHEADERTYPE *in_buf, uint64_t ts) {
+  int ret = this->counter;
+
   // in_buf->nFilledLen = (this->width*this->height) + (this->width*this->height/2);
   in_buf->nFilledLen = VENUS_BUFFER_SIZE(COLOR_FMT_NV12, this->width, this->height);
   in_buf->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
@@ -454,6 +613,7 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
   this->last_t = in_buf->nTimeStamp;
 
   OMX_CHECK(OMX_EmptyThisBuffer(this->handle, in_buf));
+  frame_queued(in_buf->nTimeStamp);
 
   // pump output
   while (true) {
@@ -471,18 +631,29 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
   return ret;
 }
 
-void OmxEncoder::encoder_open(const char* path) {
+OmxEncoder::SegmentOutput OmxEncoder::open_output(const std::string &path) {
   int err;
 
-  snprintf(this->vid_path, sizeof(this->vid_path), "%s/%s", path, this->filename);
-  LOGD("encoder_open %s remuxing:%d", this->vid_path, this->remuxing);
+  SegmentOutput out;
+  out.path = path;
+  out.vid_path = util::string_format("%s/%s", path.c_str(), this->filename);
+  out.lock_path = util::string_format("%s/%s.lock", path.c_str(), this->filename);
+
+  // a prepared segment can be ahead of the logger creating its directory
+  err = mkdir(path.c_str(), 0777);
+  assert(err == 0 || errno == EEXIST);
+
+  // create camera lock file, before the video so it's never uploaded while empty
+  int lock_fd = open(out.lock_path.c_str(), O_RDWR | O_CREAT, 0777);
+  assert(lock_fd >= 0);
+  close(lock_fd);
 
   if (this->remuxing) {
-    avformat_alloc_output_context2(&this->ofmt_ctx, NULL, NULL, this->vid_path);
-    assert(this->ofmt_ctx);
+    avformat_alloc_output_context2(&out.ofmt_ctx, NULL, NULL, out.vid_path.c_str());
+    assert(out.ofmt_ctx);
 
-    this->out_stream = avformat_new_stream(this->ofmt_ctx, NULL);
-    assert(this->out_stream);
+    out.out_stream = avformat_new_stream(out.ofmt_ctx, NULL);
+    assert(out.out_stream);
 
     // set codec correctly
     av_register_all();
@@ -491,33 +662,90 @@ void OmxEncoder::encoder_open(const char* path) {
     codec = avcodec_find_encoder(AV_CODEC_ID_H264);
     assert(codec);
 
-    this->codec_ctx = avcodec_alloc_context3(codec);
-    assert(this->codec_ctx);
-    this->codec_ctx->width = this->width;
-    this->codec_ctx->height = this->height;
-    this->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    this->codec_ctx->time_base = (AVRational){ 1, this->fps };
+    out.codec_ctx = avcodec_alloc_context3(codec);
+    assert(out.codec_ctx);
+    out.codec_ctx->width = this->width;
+    out.codec_ctx->height = this->height;
+    out.codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    out.codec_ctx->time_base = (AVRational){ 1, this->fps };
 
-    err = avio_open(&this->ofmt_ctx->pb, this->vid_path, AVIO_FLAG_WRITE);
+    err = avio_open(&out.ofmt_ctx->pb, out.vid_path.c_str(), AVIO_FLAG_WRITE);
     assert(err >= 0);
+  } else {
+    out.of = FileWriter::open(out.vid_path.c_str(), this->prealloc_size);
+    assert(out.of);
+    out.index = FrameIndexWriter::open(out.vid_path);
+    assert(out.index);
+  }
+  return out;
+}
+
+void OmxEncoder::close_output(SegmentOutput &out) {
+  if (out.ofmt_ctx) {
+    av_write_trailer(out.ofmt_ctx);
+    avcodec_free_context(&out.codec_ctx);
+    avio_closep(&out.ofmt_ctx->pb);
+    avformat_free_context(out.ofmt_ctx);
+  }
+  out.of.reset();
+  out.index.reset();
+  unlink(out.lock_path.c_str());
+}
+
+void OmxEncoder::discard_output(SegmentOutput &out) {
+  if (out.ofmt_ctx) {
+    avcodec_free_context(&out.codec_ctx);
+    avio_closep(&out.ofmt_ctx->pb);
+    avformat_free_context(out.ofmt_ctx);
+  }
+  out.of.reset();
+  out.index.reset();
+  unlink(out.vid_path.c_str());
+  unlink((out.vid_path + ".idx").c_str());
+  unlink(out.lock_path.c_str());
+}
+
+void OmxEncoder::encoder_prepare(const char* path) {
+  if (this->next_output.valid()) {
+    SegmentOutput out = this->next_output.get();
+    discard_output(out);
+  }
+  this->next_output = std::async(std::launch::async, &OmxEncoder::open_output, this, std::string(path));
+}
+
+void OmxEncoder::encoder_open(const char* path) {
+  SegmentOutput out;
+  if (this->next_output.valid()) {
+    out = this->next_output.get();
+    if (out.path != path) {
+      discard_output(out);
+      out = open_output(path);
+    }
+  } else {
+    out = open_output(path);
+  }
+
+  snprintf(this->vid_path, sizeof(this->vid_path), "%s", out.vid_path.c_str());
+  snprintf(this->lock_path, sizeof(this->lock_path), "%s", out.lock_path.c_str());
+  LOGD("encoder_open %s remuxing:%d", this->vid_path, this->remuxing);
 
+  this->ofmt_ctx = out.ofmt_ctx;
+  this->codec_ctx = out.codec_ctx;
+  this->out_stream = out.out_stream;
+  this->of = std::move(out.of);
+  this->index = std::move(out.index);
+
+  if (this->remuxing) {
     this->wrote_codec_config = false;
   } else {
-    this->of = fopen(this->vid_path, "wb");
-    assert(this->of);
 #ifndef QCOM2
     if (this->codec_config_len > 0) {
-      fwrite(this->codec_config, this->codec_config_len, 1, this->of);
+      this->of->write(this->codec_config, this->codec_config_len);
+      this->index->config(this->codec_config_len);
     }
 #endif
   }
 
-  // create camera lock file
-  snprintf(this->lock_path, sizeof(this->lock_path), "%s/%s.lock", path, this->filename);
-  int lock_fd = open(this->lock_path, O_RDWR | O_CREAT, 0777);
-  assert(lock_fd >= 0);
-  close(lock_fd);
-
   this->is_open = true;
   this->counter = 0;
 }
@@ -547,16 +775,17 @@ void OmxEncoder::encoder_close() {
       this->dirty = false;
     }
 
-    if (this->remuxing) {
-      av_write_trailer(this->ofmt_ctx);
-      avcodec_free_context(&this->codec_ctx);
-      avio_closep(&this->ofmt_ctx->pb);
-      avformat_free_context(this->ofmt_ctx);
-    } else {
-      fclose(this->of);
-      this->of = nullptr;
-    }
-    unlink(this->lock_path);
+    // the trailer and the last writes don't hold up the first frames of the next segment
+    SegmentOutput out;
+    out.lock_path = this->lock_path;
+    out.of = std::move(this->of);
+    out.index = std::move(this->index);
+    out.ofmt_ctx = this->remuxing ? this->ofmt_ctx : NULL;
+    out.codec_ctx = this->remuxing ? this->codec_ctx : NULL;
+    this->ofmt_ctx = NULL;
+    this->codec_ctx = NULL;
+    if (this->prev_close.valid()) this->prev_close.wait();
+    this->prev_close = std::async(std::launch::async, [out = std::move(out)]() mutable { close_output(out); });
   }
   this->is_open = false;
 }
@@ -564,6 +793,12 @@ void OmxEncoder::encoder_close() {
 OmxEncoder::~OmxEncoder() {
   assert(!this->is_open);
 
+  if (this->prev_close.valid()) this->prev_close.wait();
+  if (this->next_output.valid()) {
+    SegmentOutput out = this->next_output.get();
+    discard_output(out);
+  }
+
   OMX_CHECK(OMX_SendCommand(this->handle, OMX_CommandStateSet, OMX_StateIdle, NULL));
 
   wait_for_state(OMX_StateIdle);
@@ -580,6 +815,10 @@ OmxEncoder::~OmxEncoder() {
 
   wait_for_state(OMX_StateLoaded);
 
+  for (VisionBuf &vb : this->own_in_bufs) {
+    vb.free();
+  }
+
   OMX_CHECK(OMX_FreeHandle(this->handle));
 
   OMX_BUFFERHEADERTYPE *out_buf;
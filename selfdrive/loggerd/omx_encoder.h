@@ -2,25 +2,46 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <OMX_Component.h>
+#include <OMX_QCOMExtns.h>
 extern "C" {
 #include <libavformat/avformat.h>
 }
 
+#include "cereal/messaging/messaging.h"
 #include "selfdrive/common/queue.h"
 #include "selfdrive/loggerd/encoder.h"
+#include "selfdrive/loggerd/file_writer.h"
+
+// capacity of the buffer queues, more than the encoder allocates per port
+#define OMX_QUEUE_SIZE 32
+// input buffers of the encoder's own, with in_bufs, for the frames that are copied
+#define OMX_COPY_IN_BUFS 2
 
 // OmxEncoder, lossey codec using hardware hevc
+// With in_bufs, NV12 VisionIpc buffers in the venus input layout, the ion buffers become the input buffers
+// of the encoder. encode_buf() on one of them encodes the frame in place and returns once the encoder read it,
+// while the caller holds the lease. Other frames are still copied, into input buffers of the encoder's own
 class OmxEncoder : public VideoEncoder {
 public:
-  OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale);
+  OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale,
+             VisionBuf *in_bufs = nullptr, size_t num_in_bufs = 0);
   ~OmxEncoder();
   int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
                    int in_width, int in_height, uint64_t ts);
+  int encode_buf(const VisionBuf *buf, uint64_t ts);
   void encoder_open(const char* path);
   void encoder_close();
+  void encoder_prepare(const char* path);
+  // also send the encoded frames on service, as EncodeData events, so they can be streamed or
+  // recorded without another encoder
+  void publish(const char *service);
 
   // OMX callbacks
   static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE component, OMX_PTR app_data, OMX_EVENTTYPE event,
@@ -32,7 +53,32 @@ public:
 
 private:
   void wait_for_state(OMX_STATETYPE state);
+  int queue_in_buf(OMX_BUFFERHEADERTYPE *in_buf, uint64_t ts);
+  // takes the first free input buffer that matches out of the free queue, waits for the encoder to give
+  // one back. nullptr on exit
+  OMX_BUFFERHEADERTYPE *take_free_in(const std::function<bool(OMX_BUFFERHEADERTYPE *)> &match);
+  size_t in_index(OMX_BUFFERHEADERTYPE *in_buf) const;
   static void handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf);
+  void publish_frame(const uint8_t *data, size_t len, uint64_t ts_us, bool keyframe);
+
+  // video file, frame index and lock of one segment. They are opened in the background before the rotation and
+  // closed in the background after it, so a rotation only swaps them
+  struct SegmentOutput {
+    std::string path, vid_path, lock_path;
+    std::unique_ptr<FileWriter> of;
+    std::unique_ptr<FrameIndexWriter> index;
+    AVFormatContext *ofmt_ctx = NULL;
+    AVCodecContext *codec_ctx = NULL;
+    AVStream *out_stream = NULL;
+  };
+  SegmentOutput open_output(const std::string &path);
+  static void close_output(SegmentOutput &out);
+  // for a prepared segment that was never encoded to
+  static void discard_output(SegmentOutput &out);
+
+  std::future<SegmentOutput> next_output;
+  std::future<void> prev_close;
+  size_t prealloc_size;
 
   int width, height, fps;
   char vid_path[1024];
@@ -42,12 +88,17 @@ private:
   int counter = 0;
 
   const char* filename;
-  FILE *of;
+  std::unique_ptr<FileWriter> of;
+  std::unique_ptr<FrameIndexWriter> index;
 
   size_t codec_config_len;
   uint8_t *codec_config = NULL;
   bool wrote_codec_config;
 
+  std::unique_ptr<PubMaster> pm;
+  const char *publish_service = nullptr;
+  uint32_t publish_id = 0;
+
   std::mutex state_lock;
   std::condition_variable state_cv;
   OMX_STATETYPE state = OMX_StateLoaded;
@@ -55,12 +106,20 @@ private:
   OMX_HANDLETYPE handle;
 
   std::vector<OMX_BUFFERHEADERTYPE *> in_buf_headers;
+  // the VisionIpc buffers behind the first num_vipc_in input buffers, index for index. The others
+  // are own_in_bufs
+  VisionBuf *in_vipc_bufs = nullptr;
+  size_t num_vipc_in = 0;
+  std::vector<VisionBuf> own_in_bufs;
+  std::vector<OMX_QCOM_PLATFORM_PRIVATE_PMEM_INFO> in_pmem;
   std::vector<OMX_BUFFERHEADERTYPE *> out_buf_headers;
 
   uint64_t last_t;
 
-  SafeQueue<OMX_BUFFERHEADERTYPE *> free_in;
-  SafeQueue<OMX_BUFFERHEADERTYPE *> done_out;
+  // filled from the OMX callbacks, at most one entry per port buffer. OMX doesn't promise which
+  // thread calls them, so both are multi producer
+  MpmcQueue<OMX_BUFFERHEADERTYPE *, OMX_QUEUE_SIZE> free_in;
+  MpmcQueue<OMX_BUFFERHEADERTYPE *, OMX_QUEUE_SIZE> done_out;
 
   AVFormatContext *ofmt_ctx;
   AVCodecContext *codec_ctx;
@@ -23,6 +23,8 @@ extern "C" {
 RawLogger::RawLogger(const char* filename, int width, int height, int fps,
                      int bitrate, bool h265, bool downscale)
   : filename(filename),
+    width(width),
+    height(height),
     fps(fps) {
 
   av_register_all();
@@ -30,13 +32,43 @@ RawLogger::RawLogger(const char* filename, int width, int height, int fps,
   // codec = avcodec_find_encoder(AV_CODEC_ID_FFV1);
   assert(codec);
 
+  for (AVFrame *&frame : frames) {
+    frame = av_frame_alloc();
+    assert(frame);
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    int err = av_frame_get_buffer(frame, 32);
+    assert(err >= 0);
+    free_frames.push(frame);
+  }
+
+  thread = std::thread(&RawLogger::encoder_thread, this);
+}
+
+RawLogger::~RawLogger() {
+  encoder_close();
+  exiting = true;
+  queued_frames.push(NULL);
+  thread.join();
+
+  for (AVFrame *&frame : frames) {
+    av_frame_free(&frame);
+  }
+}
+
+void RawLogger::encoder_open(const char* path) {
+  // a new context for every segment, the flush of the frame threads at the close ends the old one
   codec_ctx = avcodec_alloc_context3(codec);
   assert(codec_ctx);
   codec_ctx->width = width;
   codec_ctx->height = height;
   codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
 
-  // codec_ctx->thread_count = 2;
+  // ffvhuff is intra only, frames go to the frame threads and each frame is cut in slices.
+  // ffmpeg uses the kinds the codec supports
+  codec_ctx->thread_count = util::getenv("RAW_ENCODER_THREADS", 0);
+  codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
 
   // ffv1enc doesn't respect AV_PICTURE_TYPE_I. make every frame a key frame for now.
   // codec_ctx->gop_size = 0;
@@ -46,23 +78,6 @@ RawLogger::RawLogger(const char* filename, int width, int height, int fps,
   int err = avcodec_open2(codec_ctx, codec, NULL);
   assert(err >= 0);
 
-  frame = av_frame_alloc();
-  assert(frame);
-  frame->format = codec_ctx->pix_fmt;
-  frame->width = width;
-  frame->height = height;
-  frame->linesize[0] = width;
-  frame->linesize[1] = width/2;
-  frame->linesize[2] = width/2;
-}
-
-RawLogger::~RawLogger() {
-  av_frame_free(&frame);
-  avcodec_close(codec_ctx);
-  av_free(codec_ctx);
-}
-
-void RawLogger::encoder_open(const char* path) {
   vid_path = util::string_format("%s/%s.mkv", path, filename);
 
   // create camera lock file
@@ -85,7 +100,7 @@ void RawLogger::encoder_open(const char* path) {
   stream->time_base = (AVRational){ 1, fps };
   // codec_ctx->time_base = stream->time_base;
 
-  int err = avcodec_parameters_from_context(stream->codecpar, codec_ctx);
+  err = avcodec_parameters_from_context(stream->codecpar, codec_ctx);
   assert(err >= 0);
 
   err = avio_open(&format_ctx->pb, vid_path.c_str(), AVIO_FLAG_WRITE);
@@ -101,10 +116,22 @@ void RawLogger::encoder_open(const char* path) {
 void RawLogger::encoder_close() {
   if (!is_open) return;
 
+  // the queued frames go to this segment
+  {
+    std::unique_lock lk(flush_lock);
+    flushed = false;
+  }
+  queued_frames.push(NULL);
+  {
+    std::unique_lock lk(flush_lock);
+    flush_cv.wait(lk, [this] { return flushed; });
+  }
+  drain_encoded();
+
   int err = av_write_trailer(format_ctx);
   assert(err == 0);
 
-  avcodec_close(stream->codec);
+  avcodec_free_context(&codec_ctx);
 
   err = avio_closep(&format_ctx->pb);
   assert(err == 0);
@@ -118,35 +145,90 @@ void RawLogger::encoder_close() {
 
 int RawLogger::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
                             int in_width, int in_height, uint64_t ts) {
+  drain_encoded();
+
+  // waits only when the encoder is a whole pool behind
+  AVFrame *frame = free_frames.pop();
+  // the encoder let go of the buffers of the frames it gave back, this only copies if one didn't
+  int err = av_frame_make_writable(frame);
+  assert(err >= 0);
+
+  av_image_copy_plane(frame->data[0], frame->linesize[0], y_ptr, in_width, in_width, in_height);
+  av_image_copy_plane(frame->data[1], frame->linesize[1], u_ptr, in_width/2, in_width/2, in_height/2);
+  av_image_copy_plane(frame->data[2], frame->linesize[2], v_ptr, in_width/2, in_width/2, in_height/2);
+  frame->pts = ts;
+
+  frame_queued(ts / 1000);
+  bool pushed = queued_frames.push(frame);
+  assert(pushed);
+  return counter++;
+}
+
+void RawLogger::drain_encoded() {
+  std::pair<uint64_t, size_t> e;
+  while (encoded.try_pop(e)) {
+    frame_encoded(e.first, e.second);
+  }
+}
+
+void RawLogger::encoder_thread() {
+  set_thread_name("raw_logger");
+
+  while (true) {
+    AVFrame *frame = queued_frames.pop();
+    if (frame) {
+      encode(frame);
+      continue;
+    }
+    if (exiting) break;
+
+    // end of the segment, the frames still in the frame threads come out
+    int err = avcodec_send_frame(codec_ctx, NULL);
+    if (err < 0) LOGE("encoder flush error %d\n", err);
+    write_packets();
+    while (!in_encoder.empty()) {
+      free_frames.push(in_encoder.front());
+      in_encoder.pop_front();
+    }
+    {
+      std::unique_lock lk(flush_lock);
+      flushed = true;
+    }
+    flush_cv.notify_one();
+  }
+}
+
+void RawLogger::encode(AVFrame *frame) {
+  int err = avcodec_send_frame(codec_ctx, frame);
+  if (err < 0) {
+    LOGE("encoding error %d\n", err);
+    free_frames.push(frame);
+    return;
+  }
+  in_encoder.push_back(frame);
+  write_packets();
+}
+
+void RawLogger::write_packets() {
   AVPacket pkt;
   av_init_packet(&pkt);
   pkt.data = NULL;
   pkt.size = 0;
 
-  frame->data[0] = (uint8_t*)y_ptr;
-  frame->data[1] = (uint8_t*)u_ptr;
-  frame->data[2] = (uint8_t*)v_ptr;
-  frame->pts = ts;
-
-  int ret = counter;
+  while (avcodec_receive_packet(codec_ctx, &pkt) == 0) {
+    // intra only, the packets come out in the order of the frames
+    if (!in_encoder.empty()) {
+      free_frames.push(in_encoder.front());
+      in_encoder.pop_front();
+    }
+    encoded.push({pkt.pts / 1000, (size_t)pkt.size});
 
-  int got_output = 0;
-  int err = avcodec_encode_video2(codec_ctx, &pkt, frame, &got_output);
-  if (err) {
-    LOGE("encoding error\n");
-    ret = -1;
-  } else if (got_output) {
     av_packet_rescale_ts(&pkt, codec_ctx->time_base, stream->time_base);
     pkt.stream_index = 0;
-
-    err = av_interleaved_write_frame(format_ctx, &pkt);
+    int err = av_interleaved_write_frame(format_ctx, &pkt);
     if (err < 0) {
       LOGE("encoder writer error\n");
-      ret = -1;
-    } else {
-      counter++;
     }
+    av_packet_unref(&pkt);
   }
-
-  return ret;
 }
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 extern "C" {
@@ -11,8 +17,16 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "selfdrive/common/queue.h"
 #include "selfdrive/loggerd/encoder.h"
 
+// frames copied and waiting for the encoder thread, or in the ffmpeg threads
+#define RAW_FRAME_POOL 16
+
+// The ffvhuff encoder of PC. encode_frame copies the planes into a frame of a pool and queues it, the
+// encoding and muxing are on a thread of the logger, with the frame and slice threads of ffmpeg
+// (RAW_ENCODER_THREADS, 0 for one per core). encode_frame only waits when the whole pool is queued.
+// The returned index is the frame's in the segment, a frame that fails to encode later is logged
 class RawLogger : public VideoEncoder {
  public:
   RawLogger(const char* filename, int width, int height, int fps,
@@ -24,7 +38,13 @@ class RawLogger : public VideoEncoder {
   void encoder_close();
 
 private:
+  void encoder_thread();
+  void encode(AVFrame *frame);
+  void write_packets();
+  void drain_encoded();
+
   const char* filename;
+  int width, height;
   int fps;
   int counter = 0;
   bool is_open = false;
@@ -37,5 +57,18 @@ private:
   AVStream *stream = NULL;
   AVFormatContext *format_ctx = NULL;
 
-  AVFrame *frame = NULL;
+  // the pool, free ones and the queued ones in order. A NULL queued flushes the encoder for the
+  // close of the segment, or stops the thread on exit
+  AVFrame *frames[RAW_FRAME_POOL] = {};
+  SpscQueue<AVFrame *, 2 * RAW_FRAME_POOL> free_frames, queued_frames;
+  // of the encoder thread, sent to the encoder and not out yet
+  std::deque<AVFrame *> in_encoder;
+  // timestamp and size of the encoded frames, for the stats taken on the logger's thread
+  SpscQueue<std::pair<uint64_t, size_t>, 4 * RAW_FRAME_POOL> encoded;
+
+  std::atomic<bool> exiting = false;
+  std::mutex flush_lock;
+  std::condition_variable flush_cv;
+  bool flushed = false;
+  std::thread thread;
 };
@@ -0,0 +1,593 @@
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+
+#include "selfdrive/loggerd/v4l2_encoder.h"
+
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "libyuv.h"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// Check the ioctl result and assert if it failed.
+#define V4L2_CHECK(_expr)                                     \
+  do {                                                        \
+    int ret_ = (_expr);                                       \
+    if (ret_ != 0) LOGE("%s failed, errno=%d", #_expr, errno); \
+    assert(ret_ == 0);                                        \
+  } while (0)
+
+extern ExitHandler do_exit;
+
+static int xioctl(int fd, unsigned long request, void *arg) {
+  int ret;
+  do {
+    ret = ioctl(fd, request, arg);
+  } while (ret == -1 && errno == EINTR);
+  return ret;
+}
+
+static void set_control(int fd, uint32_t id, int32_t value) {
+  v4l2_control ctrl = {.id = id, .value = value};
+  if (xioctl(fd, VIDIOC_S_CTRL, &ctrl) != 0) {
+    LOGW("V4L2 control 0x%x not supported, errno=%d", id, errno);
+  }
+}
+
+// the VPS, SPS and PPS NAL units at the start of an Annex B keyframe, with their start codes
+static std::vector<uint8_t> parameter_sets(const uint8_t *data, size_t size, bool h265) {
+  std::vector<uint8_t> ret;
+  size_t i = 0;
+  while (i + 3 < size) {
+    // start of this NAL unit, 3 or 4 byte start code
+    if (!(data[i] == 0 && data[i+1] == 0 && (data[i+2] == 1 || (data[i+2] == 0 && data[i+3] == 1)))) break;
+    const size_t start = i;
+    const size_t header = i + (data[i+2] == 1 ? 3 : 4);
+    if (header >= size) break;
+    const int type = h265 ? (data[header] >> 1) & 0x3f : data[header] & 0x1f;
+    const bool is_ps = h265 ? (type >= 32 && type <= 34) : (type == 7 || type == 8);
+    if (!is_ps) break;
+
+    size_t end = header + 1;
+    while (end + 2 < size && !(data[end] == 0 && data[end+1] == 0 && (data[end+2] == 1 || data[end+2] == 0))) end++;
+    if (end + 2 >= size) break;
+    ret.insert(ret.end(), data + start, data + end);
+    i = end;
+  }
+  return ret;
+}
+
+static bool device_encodes(int fd, uint32_t codec) {
+  v4l2_capability cap = {};
+  if (xioctl(fd, VIDIOC_QUERYCAP, &cap) != 0) return false;
+  const uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+  if (!(caps & V4L2_CAP_VIDEO_M2M_MPLANE)) return false;
+
+  v4l2_fmtdesc desc = {};
+  desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  for (desc.index = 0; xioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+    if (desc.pixelformat == codec) return true;
+  }
+  return false;
+}
+
+std::string V4L2Encoder::find_device(bool h265) {
+  const char *env = getenv("LOGGERD_V4L2_DEVICE");
+  if (env) return env;
+
+  const uint32_t codec = h265 ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+  for (int i = 0; i < 64; i++) {
+    std::string path = "/dev/video" + std::to_string(i);
+    int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) continue;
+    const bool found = device_encodes(fd, codec);
+    close(fd);
+    if (found) return path;
+  }
+  return "";
+}
+
+// ***** encoder functions *****
+
+V4L2Encoder::V4L2Encoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale)
+  : filename(filename), width(width), height(height), fps(fps), h265(h265), downscale(downscale), remuxing(!h265) {
+  const std::string device = find_device(h265);
+  assert(!device.empty());
+  this->fd = open(device.c_str(), O_RDWR | O_NONBLOCK);
+  assert(this->fd >= 0);
+  LOGD("V4L2 encoder %s on %s", filename, device.c_str());
+
+  // encoded stream
+  v4l2_format fmt = {};
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  fmt.fmt.pix_mp.width = width;
+  fmt.fmt.pix_mp.height = height;
+  fmt.fmt.pix_mp.pixelformat = h265 ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+  fmt.fmt.pix_mp.num_planes = 1;
+  fmt.fmt.pix_mp.plane_fmt[0].sizeimage = std::max(width * height, 512 * 1024);
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_S_FMT, &fmt));
+
+  // raw frames, asking for the I420 layout of VisionBuf so frames can be imported as they are
+  fmt = {};
+  fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  fmt.fmt.pix_mp.width = width;
+  fmt.fmt.pix_mp.height = height;
+  fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+  fmt.fmt.pix_mp.num_planes = 1;
+  fmt.fmt.pix_mp.plane_fmt[0].bytesperline = width;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_S_FMT, &fmt));
+
+  this->in_format = fmt.fmt.pix_mp.pixelformat;
+  assert(this->in_format == V4L2_PIX_FMT_YUV420 || this->in_format == V4L2_PIX_FMT_NV12);
+  assert(fmt.fmt.pix_mp.num_planes == 1);
+  this->in_stride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+  this->in_scanlines = fmt.fmt.pix_mp.height;
+  this->in_size = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+  this->layout_matches_visionbuf = this->in_format == V4L2_PIX_FMT_YUV420 &&
+                                   this->in_stride == width && this->in_scanlines == height;
+
+  v4l2_streamparm parm = {};
+  parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  parm.parm.output.timeperframe = {1, (uint32_t)fps};
+  if (xioctl(this->fd, VIDIOC_S_PARM, &parm) != 0) {
+    LOGW("V4L2 frame rate not set, errno=%d", errno);
+  }
+
+  set_control(this->fd, V4L2_CID_MPEG_VIDEO_BITRATE_MODE, V4L2_MPEG_VIDEO_BITRATE_MODE_VBR);
+  set_control(this->fd, V4L2_CID_MPEG_VIDEO_BITRATE, bitrate);
+  set_control(this->fd, V4L2_CID_MPEG_VIDEO_GOP_SIZE, fps);
+  set_control(this->fd, V4L2_CID_MPEG_VIDEO_B_FRAMES, 0);
+  // parameter sets in their own buffer, they start every segment
+  set_control(this->fd, V4L2_CID_MPEG_VIDEO_HEADER_MODE, V4L2_MPEG_VIDEO_HEADER_MODE_SEPARATE);
+
+  // encoded output buffers are always mmap'ed
+  v4l2_requestbuffers req = {};
+  req.count = V4L2_OUT_BUFS;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  req.memory = V4L2_MEMORY_MMAP;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_REQBUFS, &req));
+  assert(req.count > 0);
+
+  this->out_bufs.resize(req.count);
+  for (uint32_t i = 0; i < req.count; i++) {
+    v4l2_plane plane = {};
+    v4l2_buffer b = {};
+    b.index = i;
+    b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    b.memory = V4L2_MEMORY_MMAP;
+    b.m.planes = &plane;
+    b.length = 1;
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_QUERYBUF, &b));
+
+    this->out_bufs[i].len = plane.length;
+    this->out_bufs[i].addr = mmap(NULL, plane.length, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, plane.m.mem_offset);
+    assert(this->out_bufs[i].addr != MAP_FAILED);
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_QBUF, &b));
+  }
+
+  // downscaled frames are made here, so they are always copied
+  setup_input(!downscale && this->layout_matches_visionbuf);
+  if (downscale) {
+    this->y_ptr2 = (uint8_t *)malloc(width*height);
+    this->u_ptr2 = (uint8_t *)malloc(width*height/4);
+    this->v_ptr2 = (uint8_t *)malloc(width*height/4);
+  }
+
+  int type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_STREAMON, &type));
+  type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_STREAMON, &type));
+}
+
+V4L2Encoder::~V4L2Encoder() {
+  assert(!this->is_open);
+
+  int type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_STREAMOFF, &type));
+  type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_STREAMOFF, &type));
+
+  release_input();
+  for (auto &buf : this->out_bufs) {
+    munmap(buf.addr, buf.len);
+  }
+  close(this->fd);
+
+  if (this->downscale) {
+    free(this->y_ptr2);
+    free(this->u_ptr2);
+    free(this->v_ptr2);
+  }
+}
+
+void V4L2Encoder::setup_input(bool dmabuf) {
+  this->dmabuf_input = dmabuf;
+
+  v4l2_requestbuffers req = {};
+  req.count = V4L2_IN_BUFS;
+  req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  req.memory = dmabuf ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_REQBUFS, &req));
+  assert(req.count > 0);
+
+  // the driver can hand out more than asked for, the rest stays unused
+  this->in_bufs.assign(std::min<uint32_t>(req.count, V4L2_IN_BUFS), {});
+  for (int i = 0; !dmabuf && i < this->in_bufs.size(); i++) {
+    v4l2_plane plane = {};
+    v4l2_buffer b = {};
+    b.index = i;
+    b.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    b.memory = V4L2_MEMORY_MMAP;
+    b.m.planes = &plane;
+    b.length = 1;
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_QUERYBUF, &b));
+
+    this->in_bufs[i].len = plane.length;
+    this->in_bufs[i].addr = mmap(NULL, plane.length, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, plane.m.mem_offset);
+    assert(this->in_bufs[i].addr != MAP_FAILED);
+  }
+  std::fill(std::begin(this->in_queued), std::end(this->in_queued), false);
+  this->next_in = 0;
+}
+
+void V4L2Encoder::release_input() {
+  for (auto &buf : this->in_bufs) {
+    if (buf.addr) munmap(buf.addr, buf.len);
+  }
+  this->in_bufs.clear();
+
+  v4l2_requestbuffers req = {};
+  req.count = 0;
+  req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  req.memory = this->dmabuf_input ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+  V4L2_CHECK(xioctl(this->fd, VIDIOC_REQBUFS, &req));
+}
+
+int V4L2Encoder::queue_input(int index, int dmabuf_fd, size_t size, uint64_t ts) {
+  v4l2_plane plane = {};
+  plane.bytesused = size;
+  if (this->dmabuf_input) {
+    plane.m.fd = dmabuf_fd;
+    plane.length = size;
+  } else {
+    plane.length = this->in_bufs[index].len;
+  }
+
+  v4l2_buffer b = {};
+  b.index = index;
+  b.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  b.memory = this->dmabuf_input ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+  b.m.planes = &plane;
+  b.length = 1;
+  // copied to the encoded buffer, the muxer takes the pts from it
+  b.timestamp.tv_sec = ts / 1000000000ULL;
+  b.timestamp.tv_usec = (ts / 1000ULL) % 1000000ULL;
+
+  int ret = xioctl(this->fd, VIDIOC_QBUF, &b);
+  if (ret == 0) {
+    this->in_queued[index] = true;
+    frame_queued(ts / 1000ULL);
+  }
+  return ret;
+}
+
+bool V4L2Encoder::dequeue_input(int timeout_ms) {
+  pollfd pfd = {.fd = this->fd, .events = POLLOUT};
+  if (poll(&pfd, 1, timeout_ms) <= 0 || !(pfd.revents & POLLOUT)) return false;
+
+  bool dequeued = false;
+  while (true) {
+    v4l2_plane plane = {};
+    v4l2_buffer b = {};
+    b.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    b.memory = this->dmabuf_input ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+    b.m.planes = &plane;
+    b.length = 1;
+    if (xioctl(this->fd, VIDIOC_DQBUF, &b) != 0) break;
+
+    this->in_queued[b.index] = false;
+    dequeued = true;
+  }
+  return dequeued;
+}
+
+bool V4L2Encoder::dequeue_output(int timeout_ms) {
+  pollfd pfd = {.fd = this->fd, .events = POLLIN};
+  if (poll(&pfd, 1, timeout_ms) <= 0 || !(pfd.revents & POLLIN)) return true;
+
+  while (true) {
+    v4l2_plane plane = {};
+    v4l2_buffer b = {};
+    b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    b.memory = V4L2_MEMORY_MMAP;
+    b.m.planes = &plane;
+    b.length = 1;
+    if (xioctl(this->fd, VIDIOC_DQBUF, &b) != 0) return true;
+
+    const uint64_t ts_us = b.timestamp.tv_sec * 1000000ULL + b.timestamp.tv_usec;
+    const uint8_t *data = (const uint8_t *)this->out_bufs[b.index].addr + plane.data_offset;
+    handle_out_buf(data, plane.bytesused - plane.data_offset, b.flags, ts_us);
+
+    const bool last = b.flags & V4L2_BUF_FLAG_LAST;
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_QBUF, &b));
+    if (last) return false;
+  }
+}
+
+void V4L2Encoder::handle_out_buf(const uint8_t *data, size_t size, uint32_t flags, uint64_t ts_us) {
+  int err;
+  if (size == 0) return;
+
+  // the first buffer has the parameter sets, see V4L2_MPEG_VIDEO_HEADER_MODE_SEPARATE
+  const bool is_config = !this->got_output && !(flags & V4L2_BUF_FLAG_KEYFRAME);
+  this->got_output = true;
+  if (is_config) {
+    this->codec_config.assign(data, data + size);
+  } else {
+    if (this->codec_config.empty() && (flags & V4L2_BUF_FLAG_KEYFRAME)) {
+      // the driver ignored HEADER_MODE_SEPARATE and put them in front of the keyframe
+      this->codec_config = parameter_sets(data, size, this->h265);
+      if (this->codec_config.empty()) LOGE("%s: no parameter sets in the first keyframe", this->filename);
+    }
+    frame_encoded(ts_us, size);
+  }
+
+  if (this->of) {
+    this->of->write(data, size);
+  }
+  if (this->index) {
+    if (is_config) {
+      this->index->config(size);
+    } else {
+      this->index->frame(size, flags & V4L2_BUF_FLAG_KEYFRAME);
+    }
+  }
+
+  if (this->remuxing && this->ofmt_ctx) {
+    if (!this->wrote_codec_config && !this->codec_config.empty()) {
+      // extradata will be freed by av_free() in avcodec_free_context()
+      this->codec_ctx->extradata = (uint8_t*)av_mallocz(this->codec_config.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+      this->codec_ctx->extradata_size = this->codec_config.size();
+      memcpy(this->codec_ctx->extradata, this->codec_config.data(), this->codec_config.size());
+
+      err = avcodec_parameters_from_context(this->out_stream->codecpar, this->codec_ctx);
+      assert(err >= 0);
+      err = avformat_write_header(this->ofmt_ctx, NULL);
+      assert(err >= 0);
+
+      this->wrote_codec_config = true;
+    }
+
+    if (!is_config && this->wrote_codec_config) {
+      AVRational in_timebase = {1, 1000000};
+
+      AVPacket pkt;
+      av_init_packet(&pkt);
+      pkt.data = (uint8_t *)data;
+      pkt.size = size;
+
+      enum AVRounding rnd = static_cast<enum AVRounding>(AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
+      pkt.pts = pkt.dts = av_rescale_q_rnd(ts_us, in_timebase, this->ofmt_ctx->streams[0]->time_base, rnd);
+      pkt.duration = av_rescale_q(1000000 / this->fps, in_timebase, this->ofmt_ctx->streams[0]->time_base);
+
+      if (flags & V4L2_BUF_FLAG_KEYFRAME) {
+        pkt.flags |= AV_PKT_FLAG_KEY;
+      }
+
+      err = av_write_frame(this->ofmt_ctx, &pkt);
+      if (err < 0) { LOGW("ts encoder write issue"); }
+    }
+  }
+}
+
+int V4L2Encoder::free_input() {
+  for (int i = 0; i < this->in_bufs.size(); i++) {
+    if (!this->in_queued[i]) return i;
+  }
+  return -1;
+}
+
+int V4L2Encoder::finish_frame() {
+  // pump output
+  dequeue_output(0);
+  this->dirty = true;
+  return this->counter++;
+}
+
+void V4L2Encoder::request_keyframe() {
+  set_control(this->fd, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1);
+}
+
+int V4L2Encoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                              int in_width, int in_height, uint64_t ts) {
+  int err;
+  if (!this->is_open) {
+    return -1;
+  }
+
+  if (this->dmabuf_input) {
+    // planes without a VisionBuf to import, switch the input queue to copies
+    int type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_STREAMOFF, &type));
+    release_input();
+    setup_input(false);
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_STREAMON, &type));
+  }
+
+  int index;
+  while ((index = free_input()) < 0) {
+    dequeue_input(20);
+    dequeue_output(0);
+    if (do_exit) {
+      return -1;
+    }
+  }
+
+  if (this->downscale) {
+    libyuv::I420Scale(y_ptr, in_width,
+                      u_ptr, in_width/2,
+                      v_ptr, in_width/2,
+                      in_width, in_height,
+                      this->y_ptr2, this->width,
+                      this->u_ptr2, this->width/2,
+                      this->v_ptr2, this->width/2,
+                      this->width, this->height,
+                      libyuv::kFilterNone);
+    y_ptr = this->y_ptr2;
+    u_ptr = this->u_ptr2;
+    v_ptr = this->v_ptr2;
+  }
+
+  uint8_t *in_y_ptr = (uint8_t *)this->in_bufs[index].addr;
+  uint8_t *in_uv_ptr = in_y_ptr + this->in_stride * this->in_scanlines;
+  if (this->in_format == V4L2_PIX_FMT_NV12) {
+    err = libyuv::I420ToNV12(y_ptr, this->width,
+                             u_ptr, this->width/2,
+                             v_ptr, this->width/2,
+                             in_y_ptr, this->in_stride,
+                             in_uv_ptr, this->in_stride,
+                             this->width, this->height);
+  } else {
+    err = libyuv::I420Copy(y_ptr, this->width,
+                           u_ptr, this->width/2,
+                           v_ptr, this->width/2,
+                           in_y_ptr, this->in_stride,
+                           in_uv_ptr, this->in_stride/2,
+                           in_uv_ptr + this->in_stride/2 * this->in_scanlines/2, this->in_stride/2,
+                           this->width, this->height);
+  }
+  assert(err == 0);
+
+  V4L2_CHECK(queue_input(index, -1, this->in_size, ts));
+  return finish_frame();
+}
+
+int V4L2Encoder::encode_buf(const VisionBuf *buf, uint64_t ts) {
+  if (!this->dmabuf_input) {
+    return encode_frame(buf->y, buf->u, buf->v, buf->width, buf->height, ts);
+  }
+  if (!this->is_open) {
+    return -1;
+  }
+
+  const int index = this->next_in;
+  this->next_in = (this->next_in + 1) % this->in_bufs.size();
+  if (queue_input(index, buf->fd, buf->len, ts) != 0) {
+    // e.g. shm buffers on PC aren't DMABUFs
+    LOGW("V4L2 DMABUF import failed, errno=%d, copying frames", errno);
+    return encode_frame(buf->y, buf->u, buf->v, buf->width, buf->height, ts);
+  }
+
+  // the frame is only leased until the next recv, wait until the encoder has read it
+  while (this->in_queued[index]) {
+    dequeue_input(20);
+    dequeue_output(0);
+    if (do_exit) {
+      return -1;
+    }
+  }
+  return finish_frame();
+}
+
+void V4L2Encoder::encoder_open(const char* path) {
+  int err;
+
+  snprintf(this->vid_path, sizeof(this->vid_path), "%s/%s", path, this->filename);
+  LOGD("encoder_open %s remuxing:%d", this->vid_path, this->remuxing);
+
+  if (this->remuxing) {
+    avformat_alloc_output_context2(&this->ofmt_ctx, NULL, NULL, this->vid_path);
+    assert(this->ofmt_ctx);
+
+    this->out_stream = avformat_new_stream(this->ofmt_ctx, NULL);
+    assert(this->out_stream);
+
+    av_register_all();
+
+    AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    assert(codec);
+
+    this->codec_ctx = avcodec_alloc_context3(codec);
+    assert(this->codec_ctx);
+    this->codec_ctx->width = this->width;
+    this->codec_ctx->height = this->height;
+    this->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    this->codec_ctx->time_base = (AVRational){ 1, this->fps };
+
+    err = avio_open(&this->ofmt_ctx->pb, this->vid_path, AVIO_FLAG_WRITE);
+    assert(err >= 0);
+
+    this->wrote_codec_config = false;
+  } else {
+    this->of = FileWriter::open(this->vid_path);
+    assert(this->of);
+    this->index = FrameIndexWriter::open(this->vid_path);
+    assert(this->index);
+    if (!this->codec_config.empty()) {
+      this->of->write(this->codec_config.data(), this->codec_config.size());
+      this->index->config(this->codec_config.size());
+    }
+  }
+
+  // create camera lock file
+  snprintf(this->lock_path, sizeof(this->lock_path), "%s/%s.lock", path, this->filename);
+  int lock_fd = open(this->lock_path, O_RDWR | O_CREAT, 0777);
+  assert(lock_fd >= 0);
+  close(lock_fd);
+
+  // every segment has to start with a keyframe to be decodable on its own
+  if (this->got_output) {
+    request_keyframe();
+  }
+
+  this->is_open = true;
+  this->counter = 0;
+}
+
+void V4L2Encoder::encoder_close() {
+  if (!this->is_open) return;
+
+  if (this->dirty) {
+    // drain the frames still in the encoder, then restart it for the next segment
+    v4l2_encoder_cmd cmd = {};
+    cmd.cmd = V4L2_ENC_CMD_STOP;
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_ENCODER_CMD, &cmd));
+
+    const double deadline = millis_since_boot() + 1000;
+    while (dequeue_output(20) && millis_since_boot() < deadline) {
+      dequeue_input(0);
+    }
+    dequeue_input(0);
+
+    cmd.cmd = V4L2_ENC_CMD_START;
+    V4L2_CHECK(xioctl(this->fd, VIDIOC_ENCODER_CMD, &cmd));
+    this->dirty = false;
+  }
+
+  if (this->remuxing) {
+    av_write_trailer(this->ofmt_ctx);
+    avcodec_free_context(&this->codec_ctx);
+    avio_closep(&this->ofmt_ctx->pb);
+    avformat_free_context(this->ofmt_ctx);
+    this->ofmt_ctx = NULL;
+  } else {
+    this->of.reset();
+    this->index.reset();
+  }
+  unlink(this->lock_path);
+  this->is_open = false;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "selfdrive/loggerd/encoder.h"
+#include "selfdrive/loggerd/file_writer.h"
+
+#define V4L2_IN_BUFS 4
+#define V4L2_OUT_BUFS 6
+
+// V4L2 memory to memory encoder, the kernel video encoder of PCs and newer SoCs. Every instance opens
+// its own encoding context on the device, so several streams are encoded at once.
+// encode_buf() queues the VisionIpc buffer as a DMABUF, the encoder reads the camera frame in place.
+// Downscaled streams, and buffers the driver can't import or whose layout it doesn't take, are copied
+// into mmap'ed input buffers instead
+class V4L2Encoder : public VideoEncoder {
+public:
+  V4L2Encoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale);
+  ~V4L2Encoder();
+  int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                   int in_width, int in_height, uint64_t ts);
+  int encode_buf(const VisionBuf *buf, uint64_t ts);
+  void encoder_open(const char* path);
+  void encoder_close();
+
+  // M2M device that encodes to the codec, LOGGERD_V4L2_DEVICE overrides the search. Empty if there is none
+  static std::string find_device(bool h265);
+
+private:
+  struct MappedBuf {
+    void *addr = nullptr;
+    size_t len = 0;
+  };
+
+  void setup_input(bool dmabuf);
+  void release_input();
+  // takes back the input buffers the encoder is done with, waits up to timeout_ms for one
+  bool dequeue_input(int timeout_ms);
+  int queue_input(int index, int dmabuf_fd, size_t size, uint64_t ts);
+  // writes out the encoded buffers, waits up to timeout_ms for the first. false on the last buffer of a drain
+  bool dequeue_output(int timeout_ms);
+  void handle_out_buf(const uint8_t *data, size_t size, uint32_t flags, uint64_t ts_us);
+  int free_input();
+  int finish_frame();
+  void request_keyframe();
+
+  const char* filename;
+  int width, height, fps;
+  bool h265, downscale, remuxing;
+  int fd = -1;
+
+  // input layout the driver took, I420 or NV12
+  uint32_t in_format;
+  int in_stride, in_scanlines;
+  size_t in_size;
+  bool dmabuf_input = false;
+  bool layout_matches_visionbuf = false;
+  std::vector<MappedBuf> in_bufs;
+  bool in_queued[V4L2_IN_BUFS] = {};
+  int next_in = 0;
+
+  std::vector<MappedBuf> out_bufs;
+
+  uint8_t *y_ptr2 = nullptr, *u_ptr2 = nullptr, *v_ptr2 = nullptr;
+
+  char vid_path[1024];
+  char lock_path[1024];
+  bool is_open = false;
+  bool dirty = false;
+  int counter = 0;
+
+  std::unique_ptr<FileWriter> of;
+  std::unique_ptr<FrameIndexWriter> index;
+  std::vector<uint8_t> codec_config;
+  bool wrote_codec_config = false;
+  bool got_output = false;
+  AVFormatContext *ofmt_ctx = NULL;
+  AVCodecContext *codec_ctx = NULL;
+  AVStream *out_stream = NULL;
+};
@@ -1,6 +1,8 @@
 import importlib
+import mmap
 import os
 import signal
+import struct
 import time
 import subprocess
 from abc import ABC, abstractmethod
@@ -17,7 +19,8 @@ from selfdrive.swaglog import cloudlog
 from selfdrive.hardware import HARDWARE
 from cereal import log
 
-WATCHDOG_FN = "/dev/shm/wd_"
+WATCHDOG_TABLE = "/dev/shm/watchdog"
+WATCHDOG_SLOT = struct.Struct("<iIQ")  # pid, reserved, kick time in nanos since boot
 ENABLE_WATCHDOG = os.getenv("NO_WATCHDOG") is None
 
 
@@ -82,15 +85,12 @@ class ManagerProcess(ABC):
     self.stop()
     self.start()
 
-  def check_watchdog(self, started):
+  def check_watchdog(self, started, watchdog_times):
     if self.watchdog_max_dt is None or self.proc is None:
       return
 
-    try:
-      fn = WATCHDOG_FN + str(self.proc.pid)
-      self.last_watchdog_time = int(open(fn).read())
-    except Exception:
-      pass
+    if self.proc.pid in watchdog_times:
+      self.last_watchdog_time = watchdog_times[self.proc.pid]
 
     dt = sec_since_boot() - self.last_watchdog_time / 1e9
 
@@ -268,10 +268,28 @@ class DaemonProcess(ManagerProcess):
     pass
 
 
+def read_watchdog_table():
+  # the last kick of every process in the table, a slot that changed while reading is left for the next pass
+  try:
+    with open(WATCHDOG_TABLE, "rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+      first, second = m[:], m[:]
+  except (OSError, ValueError):
+    return {}
+
+  times = {}
+  for off in range(0, len(first) - WATCHDOG_SLOT.size + 1, WATCHDOG_SLOT.size):
+    pid, _, kick_time = WATCHDOG_SLOT.unpack_from(first, off)
+    if pid != 0 and first[off:off + WATCHDOG_SLOT.size] == second[off:off + WATCHDOG_SLOT.size]:
+      times[pid] = kick_time
+  return times
+
+
 def ensure_running(procs, started, driverview=False, not_run=None):
   if not_run is None:
     not_run = []
 
+  watchdog_times = read_watchdog_table()
+
   for p in procs:
     if p.name in not_run:
       p.stop(block=False)
@@ -286,5 +304,5 @@ def ensure_running(procs, started, driverview=False, not_run=None):
     else:
       p.stop(block=False)
 
-    p.check_watchdog(started)
+    p.check_watchdog(started, watchdog_times)
 
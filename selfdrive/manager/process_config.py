@@ -25,6 +25,7 @@ if EnableLogger and not EnableUploader:
     NativeProcess("ui", "selfdrive/ui", ["./ui"], persistent=True, watchdog_max_dt=(5 if TICI else None)),
     NativeProcess("soundd", "selfdrive/ui", ["./soundd"]),
     NativeProcess("locationd", "selfdrive/locationd", ["./locationd"]),
+    NativeProcess("paramsd", "selfdrive/locationd", ["./paramsd"]),
     NativeProcess("boardd", "selfdrive/boardd", ["./boardd"], enabled=False),
     PythonProcess("calibrationd", "selfdrive.locationd.calibrationd"),
     PythonProcess("controlsd", "selfdrive.controls.controlsd"),
@@ -32,7 +33,6 @@ if EnableLogger and not EnableUploader:
     PythonProcess("dmonitoringd", "selfdrive.monitoring.dmonitoringd", enabled=(not PC or WEBCAM), driverview=True),
     PythonProcess("logmessaged", "selfdrive.logmessaged", persistent=True),
     PythonProcess("pandad", "selfdrive.pandad", persistent=True),
-    PythonProcess("paramsd", "selfdrive.locationd.paramsd"),
     PythonProcess("plannerd", "selfdrive.controls.plannerd"),
     PythonProcess("radard", "selfdrive.controls.radard"),
     PythonProcess("thermald", "selfdrive.thermald.thermald", persistent=True),
@@ -61,6 +61,7 @@ elif EnableUploader:
     NativeProcess("ui", "selfdrive/ui", ["./ui"], persistent=True, watchdog_max_dt=(5 if TICI else None)),
     NativeProcess("soundd", "selfdrive/ui", ["./soundd"]),
     NativeProcess("locationd", "selfdrive/locationd", ["./locationd"]),
+    NativeProcess("paramsd", "selfdrive/locationd", ["./paramsd"]),
     NativeProcess("boardd", "selfdrive/boardd", ["./boardd"], enabled=False),
     PythonProcess("calibrationd", "selfdrive.locationd.calibrationd"),
     PythonProcess("controlsd", "selfdrive.controls.controlsd"),
@@ -68,7 +69,6 @@ elif EnableUploader:
     PythonProcess("dmonitoringd", "selfdrive.monitoring.dmonitoringd", enabled=(not PC or WEBCAM), driverview=True),
     PythonProcess("logmessaged", "selfdrive.logmessaged", persistent=True),
     PythonProcess("pandad", "selfdrive.pandad", persistent=True),
-    PythonProcess("paramsd", "selfdrive.locationd.paramsd"),
     PythonProcess("plannerd", "selfdrive.controls.plannerd"),
     PythonProcess("radard", "selfdrive.controls.radard"),
     PythonProcess("thermald", "selfdrive.thermald.thermald", persistent=True),
@@ -97,6 +97,7 @@ else:
     NativeProcess("ui", "selfdrive/ui", ["./ui"], persistent=True, watchdog_max_dt=(5 if TICI else None)),
     NativeProcess("soundd", "selfdrive/ui", ["./soundd"]),
     NativeProcess("locationd", "selfdrive/locationd", ["./locationd"]),
+    NativeProcess("paramsd", "selfdrive/locationd", ["./paramsd"]),
     NativeProcess("boardd", "selfdrive/boardd", ["./boardd"], enabled=False),
     PythonProcess("calibrationd", "selfdrive.locationd.calibrationd"),
     PythonProcess("controlsd", "selfdrive.controls.controlsd"),
@@ -104,7 +105,6 @@ else:
     PythonProcess("dmonitoringd", "selfdrive.monitoring.dmonitoringd", enabled=(not PC or WEBCAM), driverview=True),
     #PythonProcess("logmessaged", "selfdrive.logmessaged", persistent=True),
     PythonProcess("pandad", "selfdrive.pandad", persistent=True),
-    PythonProcess("paramsd", "selfdrive.locationd.paramsd"),
     PythonProcess("plannerd", "selfdrive.controls.plannerd"),
     PythonProcess("radard", "selfdrive.controls.radard"),
     PythonProcess("thermald", "selfdrive.thermald.thermald", persistent=True),
@@ -5,14 +5,21 @@
 #include <cstdlib>
 
 #include "cereal/visionipc/visionipc_client.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
 #include "selfdrive/modeld/models/dmonitoring.h"
+#include "selfdrive/modeld/models/rate_governor.h"
 
 ExitHandler do_exit;
 
-void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
+void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client, bool full_frame) {
   PubMaster pm({"driverState"});
+  SubMaster sm(ModelRateGovernor::services(true));
+  // the driver camera's, DCAM_FREQ of services.py
+  ModelRateGovernor governor(Hardware::TICI() ? 20 : 10, true);
   double last = 0;
 
   while (!do_exit) {
@@ -20,12 +27,24 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
     VisionBuf *buf = vipc_client.recv(&extra);
     if (buf == nullptr) continue;
 
+    sm.update(0);
+    governor.update(sm);
+    if (!governor.should_run(extra.frame_id)) continue;
+
+    // the GPU reads buf_cl, the CPU only the rows of the crop
+    if (full_frame && !model.gpu_preprocess) {
+      int row, rows;
+      dmonitoring_input_rows(&model, buf->width, buf->height, &row, &rows);
+      buf->sync_rows(row, rows, VISIONBUF_SYNC_FROM_DEVICE);
+    }
+
     double t1 = millis_since_boot();
-    DMonitoringResult res = dmonitoring_eval_frame(&model, buf->addr, buf->width, buf->height);
+    DMonitoringResult res = full_frame ? dmonitoring_eval_frame(&model, buf->addr, buf->buf_cl, buf->width, buf->height)
+                                       : dmonitoring_eval_input(&model, (const uint8_t *)buf->addr);
     double t2 = millis_since_boot();
 
     // send dm packet
-    dmonitoring_publish(pm, extra.frame_id, res, (t2 - t1) / 1000.0, model.output);
+    dmonitoring_publish(pm, extra.frame_id, res, (t2 - t1) / 1000.0, governor.rate(), model.output);
 
     //printf("dmonitoring process: %.2fms, from last %.2fms\n", t2 - t1, t1 - last);
     last = t1;
@@ -35,11 +54,25 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
 int main(int argc, char **argv) {
   setpriority(PRIO_PROCESS, 0, -15);
 
+  // camerad sends the crop scaled to the model input, with DMONITORING_FULL_FRAME it's done here
+  // from the full frames
+  const bool full_frame = getenv("DMONITORING_FULL_FRAME") != NULL;
+
+  // the full frames are cropped and scaled on the GPU, from the buffers mapped into this context
+  cl_device_id device_id = NULL;
+  cl_context context = NULL;
+  if (full_frame) {
+    device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+    context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  }
+
   // init the models
   DMonitoringModelState model;
-  dmonitoring_init(&model);
+  dmonitoring_init(&model, device_id, context);
 
-  VisionIpcClient vipc_client = VisionIpcClient("camerad", VISION_STREAM_YUV_FRONT, true);
+  VisionIpcClient vipc_client = full_frame ? VisionIpcClient("camerad", VISION_STREAM_YUV_FRONT, true, device_id, context)
+                                           : VisionIpcClient("camerad", DM_INPUT_STREAM_NAME, true);
+  vipc_client.sync_on_recv = !full_frame;
   while (!do_exit && !vipc_client.connect(false)) {
     util::sleep_for(100);
   }
@@ -47,9 +80,10 @@ int main(int argc, char **argv) {
   // run the models
   if (vipc_client.connected) {
     LOGW("connected with buffer size: %d", vipc_client.buffers[0].len);
-    run_model(model, vipc_client);
+    run_model(model, vipc_client, full_frame);
   }
 
   dmonitoring_free(&model);
+  if (context) CL_CHECK(clReleaseContext(context));
   return 0;
 }
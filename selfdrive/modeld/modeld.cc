@@ -1,133 +1,225 @@
 #include <cstdio>
 #include <cstdlib>
-#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <eigen3/Eigen/Dense>
 
 #include "cereal/messaging/messaging.h"
 #include "cereal/visionipc/visionipc_client.h"
+#include "common/transformations/orientation.hpp"
+#include "selfdrive/common/alloc_tracker.h"
+#include "selfdrive/common/calib_shm.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/queue.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/trace.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/modeld/models/driving.h"
+#include "selfdrive/modeld/models/rate_governor.h"
 
 ExitHandler do_exit;
-// globals
-bool live_calib_seen;
-mat3 cur_transform;
-std::mutex transform_lock;
 
+// decodes liveCalibration and publishes the transforms of it for modeld, the UI and others in CalibShm
 void calibration_thread(bool wide_camera) {
   set_thread_name("calibration");
   set_realtime_priority(50);
 
   SubMaster sm({"liveCalibration"});
 
-  /*
-     import numpy as np
-     from common.transformations.model import medmodel_frame_from_road_frame
-     medmodel_frame_from_ground = medmodel_frame_from_road_frame[:, (0, 1, 3)]
-     ground_from_medmodel_frame = np.linalg.inv(medmodel_frame_from_ground)
-  */
-  Eigen::Matrix<float, 3, 3> ground_from_medmodel_frame;
-  ground_from_medmodel_frame <<
-    0.00000000e+00, 0.00000000e+00, 1.00000000e+00,
-    -1.09890110e-03, 0.00000000e+00, 2.81318681e-01,
-    -1.84808520e-20, 9.00738606e-04,-4.28751576e-02;
-
-  Eigen::Matrix<float, 3, 3> cam_intrinsics = Eigen::Matrix<float, 3, 3, Eigen::RowMajor>(wide_camera ? ecam_intrinsic_matrix.v : fcam_intrinsic_matrix.v);
-  const mat3 yuv_transform = get_model_yuv_transform();
+  Eigen::Matrix3d view_from_device;
+  view_from_device << 0,1,0,
+                      0,0,1,
+                      1,0,0;
 
+  CalibShm calib_shm(true);
   while (!do_exit) {
     sm.update(100);
     if(sm.updated("liveCalibration")) {
-      auto extrinsic_matrix = sm["liveCalibration"].getLiveCalibration().getExtrinsicMatrix();
-      Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
-      for (int i = 0; i < 4*3; i++) {
-        extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
+      auto live_calib = sm["liveCalibration"].getLiveCalibration();
+      auto extrinsic_list = live_calib.getExtrinsicMatrix();
+      float extrinsic_matrix[3*4] = {};
+      for (int i = 0; i < 3*4 && i < extrinsic_list.size(); i++) {
+        extrinsic_matrix[i] = extrinsic_list[i];
       }
+      CalibTransform t = {.model_transform = model_transform_from_extrinsic(extrinsic_matrix, wide_camera), .wide_camera = wide_camera};
 
-      auto camera_frame_from_road_frame = cam_intrinsics * extrinsic_matrix_eigen;
-      Eigen::Matrix<float, 3, 3> camera_frame_from_ground;
-      camera_frame_from_ground.col(0) = camera_frame_from_road_frame.col(0);
-      camera_frame_from_ground.col(1) = camera_frame_from_road_frame.col(1);
-      camera_frame_from_ground.col(2) = camera_frame_from_road_frame.col(3);
-
-      auto warp_matrix = camera_frame_from_ground * ground_from_medmodel_frame;
-      mat3 transform = {};
-      for (int i=0; i<3*3; i++) {
-        transform.v[i] = warp_matrix(i / 3, i % 3);
+      auto rpy_list = live_calib.getRpyCalib();
+      Eigen::Vector3d rpy = Eigen::Vector3d::Zero();
+      for (int i = 0; i < 3 && i < rpy_list.size(); i++) {
+        t.rpy[i] = rpy[i] = rpy_list[i];
+      }
+      Eigen::Matrix3d view_from_calib = view_from_device * euler2rot(rpy);
+      for (int i = 0; i < 3*3; i++) {
+        t.view_from_calib.v[i] = view_from_calib(i / 3, i % 3);
       }
-      mat3 model_transform = matmul3(yuv_transform, transform);
-      std::lock_guard lk(transform_lock);
-      cur_transform = model_transform;
-      live_calib_seen = true;
+      calib_shm.write(t);
     }
   }
 }
 
+// A frame on its way through the pipeline: warped on the thread of run_model, while the model runs
+// on the previous one in execute_thread, then parsed and published in publish_thread
+struct ModelInput {
+  VisionIpcBufExtra extra;
+  uint32_t frame_id;
+  uint32_t vipc_dropped_frames;
+  float frame_drop_ratio;
+  float model_rate;
+  float vec_desire[DESIRE_LEN];
+  cl_mem net_input_cl;
+  uint64_t timestamp_recv, timestamp_prepared;
+  float prepare_time;
+};
+
+struct ModelResult {
+  ModelInput input;
+  std::vector<float> output;
+  uint64_t timestamp_executed;
+  float execution_time;
+};
+
+// ModelFrame alternates between two inputs, one for each is free. The second one is freed after the
+// first run, thneed records every GPU command of the process during it
+SafeQueue<bool> free_inputs;
+SafeQueue<ModelInput> prepared_inputs;
+SafeQueue<ModelResult> model_results;
+
+void execute_thread(ModelState &model) {
+  set_thread_name("modeld_execute");
+
+  bool recorded = false;
+  ModelInput input;
+  static AllocStats allocs("model_execute");
+  while (!do_exit) {
+    if (!prepared_inputs.try_pop(input, 100)) continue;
+    NoAllocRegion region(allocs);
+
+    double mt1 = millis_since_boot();
+    {
+      TRACE_SCOPE("model_execute");
+      model_execute(&model, input.net_input_cl, input.vec_desire);
+    }
+    double mt2 = millis_since_boot();
+    const uint64_t timestamp_executed = nanos_since_boot();
+
+    free_inputs.push(true);
+    if (!recorded) {
+      free_inputs.push(true);
+      recorded = true;
+    }
+    model_results.push({input, model.output, timestamp_executed, (float)((mt2 - mt1) / 1000.0)});
+  }
+}
+
+void publish_thread() {
+  set_thread_name("modeld_publish");
+  PubMaster pm({"modelV2", "modelV2Compact", "cameraOdometry"});
+
+  ModelResult result;
+  static AllocStats allocs("model_publish");
+  while (!do_exit) {
+    if (!model_results.try_pop(result, 100)) continue;
+    NoAllocRegion region(allocs);
+
+    TRACE_SCOPE("model_publish");
+    const ModelInput &input = result.input;
+    const ModelDataRaw model_buf = model_outputs(result.output.data());
+    const ModelFrameTimestamps timestamps = {input.extra.timestamp_eof, input.extra.timestamp_processed, input.extra.timestamp_sent,
+                                             input.timestamp_recv, input.timestamp_prepared, result.timestamp_executed};
+    model_publish(pm, input.extra.frame_id, input.frame_id, input.frame_drop_ratio, input.model_rate, model_buf, timestamps,
+                  input.prepare_time, result.execution_time, kj::ArrayPtr<const float>(result.output.data(), result.output.size()));
+    posenet_publish(pm, input.extra.frame_id, input.vipc_dropped_frames, model_buf, input.extra.timestamp_eof);
+  }
+}
+
 void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   // messaging
-  PubMaster pm({"modelV2", "cameraOdometry"});
-  SubMaster sm({"lateralPlan", "roadCameraState"});
+  auto services = ModelRateGovernor::services(false);
+  services.insert(services.end(), {"lateralPlan", "roadCameraState"});
+  SubMaster sm(services);
+  ModelRateGovernor governor(MODEL_FREQ, false);
 
   // setup filter to track dropped frames
   FirstOrderFilter frame_dropped_filter(0., 10., 1. / MODEL_FREQ);
 
   uint32_t frame_id = 0, last_vipc_frame_id = 0;
-  double last = 0;
   uint32_t run_count = 0;
 
+  CalibShm calib_shm;
+  CalibTransform calib = {};
+
+  free_inputs.push(true);
+  std::thread executor(execute_thread, std::ref(model));
+  std::thread publisher(publish_thread);
+
+  static AllocStats allocs("model_prepare");
   while (!do_exit) {
+    // wait for a free input before taking the frame, so the warp is of the newest one
+    bool free_input;
+    if (!free_inputs.try_pop(free_input, 100)) continue;
+    NoAllocRegion region(allocs);
+
     VisionIpcBufExtra extra = {};
     VisionBuf *buf = vipc_client.recv(&extra);
-    if (buf == nullptr) continue;
+    if (buf == nullptr) {
+      free_inputs.push(true);
+      continue;
+    }
+    const uint64_t timestamp_recv = nanos_since_boot();
 
-    transform_lock.lock();
-    mat3 model_transform = cur_transform;
-    const bool run_model_this_iter = live_calib_seen;
-    transform_lock.unlock();
+    const bool calibrated = calib_shm.read(calib);
+    const mat3 &model_transform = calib.model_transform;
 
     // TODO: path planner timeout?
     sm.update(0);
+    governor.update(sm);
+    const bool governed_skip = !governor.should_run(extra.frame_id);
+    const bool run_model_this_iter = calibrated && !governed_skip;
     int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
     frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
 
     if (run_model_this_iter) {
       run_count++;
 
-      float vec_desire[DESIRE_LEN] = {0};
+      ModelInput input = {.extra = extra, .frame_id = frame_id, .model_rate = governor.rate(), .vec_desire = {0}, .timestamp_recv = timestamp_recv};
       if (desire >= 0 && desire < DESIRE_LEN) {
-        vec_desire[desire] = 1.0;
+        input.vec_desire[desire] = 1.0;
       }
 
       double mt1 = millis_since_boot();
-      ModelDataRaw model_buf = model_eval_frame(&model, buf->buf_cl, buf->width, buf->height,
-                                                model_transform, vec_desire);
+      {
+        TRACE_SCOPE("model_prepare_frame");
+        input.net_input_cl = model_prepare_frame(&model, buf->buf_cl, buf->width, buf->height, model_transform);
+      }
       double mt2 = millis_since_boot();
-      float model_execution_time = (mt2 - mt1) / 1000.0;
+      input.timestamp_prepared = nanos_since_boot();
+      input.prepare_time = (mt2 - mt1) / 1000.0;
 
       // tracked dropped frames
-      uint32_t vipc_dropped_frames = extra.frame_id - last_vipc_frame_id - 1;
-      float frames_dropped = frame_dropped_filter.update((float)std::min(vipc_dropped_frames, 10U));
+      input.vipc_dropped_frames = extra.frame_id - last_vipc_frame_id - 1;
+      float frames_dropped = frame_dropped_filter.update((float)std::min(input.vipc_dropped_frames, 10U));
       if (run_count < 10) { // let frame drops warm up
         frame_dropped_filter.reset(0);
         frames_dropped = 0.;
       }
+      input.frame_drop_ratio = frames_dropped / (1 + frames_dropped);
+      TRACE_COUNTER("vipc_dropped_frames", input.vipc_dropped_frames);
 
-      float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
-
-      model_publish(pm, extra.frame_id, frame_id, frame_drop_ratio, model_buf, extra.timestamp_eof, model_execution_time,
-                    kj::ArrayPtr<const float>(model.output.data(), model.output.size()));
-      posenet_publish(pm, extra.frame_id, vipc_dropped_frames, model_buf, extra.timestamp_eof);
-
-      //printf("model process: %.2fms, from last %.2fms, vipc_frame_id %u, frame_id, %u, frame_drop %.3f\n", mt2 - mt1, mt1 - last, extra.frame_id, frame_id, frame_drop_ratio);
-      last = mt1;
+      prepared_inputs.push(input);
       last_vipc_frame_id = extra.frame_id;
+    } else {
+      // frames the governor skips aren't dropped
+      if (governed_skip) last_vipc_frame_id = extra.frame_id;
+      free_inputs.push(true);
     }
   }
+
+  executor.join();
+  publisher.join();
 }
 
 int main(int argc, char **argv) {
@@ -138,6 +230,7 @@ int main(int argc, char **argv) {
   } else if (Hardware::TICI()) {
     set_core_affinity(7);  
   }
+  rt_memory_lock();
   bool wide_camera = Hardware::TICI() ? Params().getBool("EnableWideCamera") : false;
 
   // start calibration thread
@@ -169,5 +262,8 @@ int main(int argc, char **argv) {
   LOG("joining calibration thread");
   thread.join();
   CL_CHECK(clReleaseContext(context));
+
+  std::string summary = alloc_summary();
+  if (!summary.empty()) LOGW("allocations:\n%s", summary.c_str());
   return 0;
 }
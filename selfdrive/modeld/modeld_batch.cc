@@ -0,0 +1,275 @@
+#include <sys/stat.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "selfdrive/camerad/cameras/frame_reader.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/logreader.h"
+#include "selfdrive/modeld/models/driving.h"
+
+// Runs the driving model over the road camera of many segments, offline and batch segments at a time:
+// the frames of every segment in the batch are warped into their row of one input and the model runs
+// once on all of them. Each row keeps its recurrent state, desire and traffic convention, the inputs
+// of modeld are taken from the rlog of the segment. A row that finishes its segment goes on with the
+// next one, with a new state. Writes <out>/<segment>/rlog with the modelV2 of every frame.
+// Run from selfdrive/modeld for the models and kernels
+// The logs don't say which side the car drives on, --rhd for right hand drive segments, the IsRHD param
+// usage: ./modeld_batch [--runner cpu|gpu|dsp] [--batch N] [--rhd] --out DIR segment...
+
+struct Row {
+  std::string dir;
+  std::unique_ptr<LogReader> log;
+  size_t event = 0;  // next one of log
+  std::unique_ptr<FrameReader> reader;
+  std::unique_ptr<ModelFrame> frame;
+  cl_mem yuv_cl = NULL;
+  std::vector<uint8_t> yuv;
+  mat3 transform = {};
+  bool calibrated = false;
+  int desire = 0;
+  float prev_desire[DESIRE_LEN] = {};
+  // of the frame in the input
+  uint32_t frame_id = 0;
+  uint64_t mono_time = 0, timestamp_eof = 0;
+  std::vector<kj::Array<capnp::word>> out;
+  uint32_t frames = 0;
+};
+
+static std::string segment_log_path(const std::string &dir) {
+  for (const char *fn : {"rlog.bz2", "rlog.zst", "rlog"}) {
+    if (util::file_exists(dir + "/" + fn)) return dir + "/" + fn;
+  }
+  return "";
+}
+
+static void write_log(const std::string &out_dir, Row &row) {
+  std::string name = row.dir;
+  while (!name.empty() && name.back() == '/') name.pop_back();
+  name = name.substr(name.find_last_of('/') + 1);
+  const std::string path = out_dir + "/" + name;
+  mkdir(path.c_str(), 0755);
+
+  FILE *f = fopen((path + "/rlog").c_str(), "wb");
+  assert(f != NULL);
+  for (auto &words : row.out) {
+    auto bytes = words.asBytes();
+    fwrite(bytes.begin(), 1, bytes.size(), f);
+  }
+  fclose(f);
+  printf("%s: %u frames\n", row.dir.c_str(), row.frames);
+  row.out.clear();
+}
+
+// Starts the row on the segment, false if it has no log or road camera video
+static bool start_segment(Row &row, const std::string &dir, cl_device_id device_id, cl_context context) {
+  const std::string log_path = segment_log_path(dir);
+  if (log_path.empty() || !util::file_exists(dir + "/fcamera.hevc")) {
+    printf("skipping %s, not a segment with a log and fcamera.hevc\n", dir.c_str());
+    return false;
+  }
+  auto log = std::make_unique<LogReader>();
+  auto reader = std::make_unique<FrameReader>(std::vector<std::string>{dir + "/fcamera.hevc"});
+  if (!log->load(log_path) || !reader->open()) {
+    printf("skipping %s, the log or video can't be read\n", dir.c_str());
+    return false;
+  }
+
+  if (row.yuv_cl == NULL || reader->width != row.reader->width || reader->height != row.reader->height) {
+    if (row.yuv_cl != NULL) CL_CHECK(clReleaseMemObject(row.yuv_cl));
+    row.yuv.resize(reader->width * reader->height * 3 / 2);
+    row.yuv_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, row.yuv.size(), NULL, &err));
+  }
+  row.dir = dir;
+  row.log = std::move(log);
+  row.event = 0;
+  row.reader = std::move(reader);
+  // a new one for the frame before the first
+  row.frame = std::make_unique<ModelFrame>(device_id, context);
+  row.calibrated = false;
+  row.desire = 0;
+  memset(row.prev_desire, 0, sizeof(row.prev_desire));
+  row.frames = 0;
+  return true;
+}
+
+// Reads the log of the row up to its next road frame and decodes it, false at the end of the segment
+static bool next_frame(Row &row) {
+  auto &events = row.log->events();
+  while (row.event < events.size()) {
+    const LogReader::Event &e = events[row.event++];
+    if (e.which != cereal::Event::LIVE_CALIBRATION && e.which != cereal::Event::LATERAL_PLAN &&
+        e.which != cereal::Event::ROAD_ENCODE_IDX) {
+      continue;
+    }
+    capnp::FlatArrayMessageReader msg(e.words);
+    cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+    if (e.which == cereal::Event::LIVE_CALIBRATION) {
+      auto extrinsic_list = event.getLiveCalibration().getExtrinsicMatrix();
+      float extrinsic_matrix[3*4] = {};
+      for (int i = 0; i < 3*4 && i < extrinsic_list.size(); i++) {
+        extrinsic_matrix[i] = extrinsic_list[i];
+      }
+      row.transform = model_transform_from_extrinsic(extrinsic_matrix, false);
+      row.calibrated = true;
+    } else if (e.which == cereal::Event::LATERAL_PLAN) {
+      row.desire = (int)event.getLateralPlan().getDesire();
+    } else {
+      auto idx = event.getRoadEncodeIdx();
+      // modeld waits for a calibration too
+      if (!row.calibrated) continue;
+
+      const size_t segment_id = idx.getSegmentId();
+      if (segment_id != row.reader->last_frame + 1 && !row.reader->seek(0, segment_id)) return false;
+      const int w = row.reader->width, h = row.reader->height;
+      uint8_t *y = row.yuv.data(), *u = y + w * h, *v = u + (w / 2) * (h / 2);
+      if (!row.reader->next_yuv(y, u, v)) return false;
+      if (row.reader->last_frame != segment_id) continue;
+
+      row.frame_id = idx.getFrameId();
+      row.mono_time = e.mono_time;
+      row.timestamp_eof = idx.getTimestampEof();
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  std::string runner = "gpu", out_dir;
+  int batch = 4;
+  bool rhd = false;
+  std::deque<std::string> pending;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--runner") == 0 && i + 1 < argc) {
+      runner = argv[++i];
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_dir = argv[++i];
+    } else if (strcmp(argv[i], "--rhd") == 0) {
+      rhd = true;
+    } else {
+      pending.push_back(argv[i]);
+    }
+  }
+  if (out_dir.empty() || pending.empty() || batch < 1) {
+    fprintf(stderr, "usage: %s [--runner cpu|gpu|dsp] [--batch N] [--rhd] --out DIR segment...\n", argv[0]);
+    return 1;
+  }
+  mkdir(out_dir.c_str(), 0755);
+
+  int runtime = USE_GPU_RUNTIME;
+  if (runner == "cpu") {
+    runtime = USE_CPU_RUNTIME;
+  } else if (runner == "dsp") {
+    runtime = USE_DSP_RUNTIME;
+  } else {
+    assert(runner == "gpu");
+  }
+
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  cl_command_queue q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+
+  // a row each of the outputs, the recurrent state is read back from the outputs, and of the inputs
+  std::vector<float> output(batch * MODEL_OUTPUT_SIZE);
+  std::vector<float> pulse_desire(batch * DESIRE_LEN), traffic_convention(batch * TRAFFIC_CONVENTION_LEN);
+  SNPEModel model("../../models/supercombo.dlc", output.data(), MODEL_OUTPUT_SIZE, runtime, batch);
+#ifdef TEMPORAL
+  model.addRecurrent(&output[MODEL_TEMPORAL_IDX], MODEL_TEMPORAL_SIZE);
+#endif
+#ifdef DESIRE
+  model.addDesire(pulse_desire.data(), DESIRE_LEN);
+#endif
+#ifdef TRAFFIC_CONVENTION
+  for (int b = 0; b < batch; b++) {
+    traffic_convention[b * TRAFFIC_CONVENTION_LEN + (rhd ? 1 : 0)] = 1.0;
+  }
+  model.addTrafficConvention(traffic_convention.data(), TRAFFIC_CONVENTION_LEN);
+#endif
+
+  std::vector<Row> rows(batch);
+  const int buf_size = MODEL_FRAME_SIZE * 2;
+  std::vector<float> net_input(batch * buf_size);
+  double model_ms = 0;
+  int steps = 0;
+  while (true) {
+    bool any = false;
+    for (int b = 0; b < batch; b++) {
+      Row &row = rows[b];
+      float *input = &net_input[b * buf_size];
+      while (true) {
+        if (row.log && next_frame(row)) break;
+        if (row.log) {
+          write_log(out_dir, row);
+          row.log.reset();
+        }
+
+        // the next segment, from an empty recurrent state
+        while (!pending.empty() && !start_segment(row, pending.front(), device_id, context)) pending.pop_front();
+        if (pending.empty() && !row.log) break;
+        pending.pop_front();
+        memset(&output[b * MODEL_OUTPUT_SIZE + MODEL_TEMPORAL_IDX], 0, MODEL_TEMPORAL_SIZE * sizeof(float));
+      }
+
+      if (!row.log) {
+        // no more segments for the row, its outputs are not used
+        memset(input, 0, buf_size * sizeof(float));
+        memset(&pulse_desire[b * DESIRE_LEN], 0, DESIRE_LEN * sizeof(float));
+        continue;
+      }
+      any = true;
+
+      CL_CHECK(clEnqueueWriteBuffer(q, row.yuv_cl, CL_TRUE, 0, row.yuv.size(), row.yuv.data(), 0, NULL, NULL));
+      cl_mem net_input_cl = row.frame->prepare(row.yuv_cl, row.reader->width, row.reader->height, row.transform);
+      memcpy(input, row.frame->read_frames(net_input_cl), buf_size * sizeof(float));
+
+      // a pulse on the rising edge, as in model_execute
+      float *pulse = &pulse_desire[b * DESIRE_LEN];
+      for (int i = 1; i < DESIRE_LEN; i++) {
+        const float d = i == row.desire ? 1.0 : 0.0;
+        pulse[i] = d - row.prev_desire[i] > .99 ? d : 0.0;
+        row.prev_desire[i] = d;
+      }
+    }
+    if (!any) break;
+
+    double t1 = millis_since_boot();
+    model.execute(net_input.data(), batch * buf_size);
+    model_ms += millis_since_boot() - t1;
+    steps++;
+
+    for (int b = 0; b < batch; b++) {
+      Row &row = rows[b];
+      if (!row.log) continue;
+      MessageBuilder msg;
+      auto event = msg.initEvent();
+      event.setLogMonoTime(row.mono_time);
+      auto framed = event.initModelV2();
+      framed.setFrameId(row.frame_id);
+      framed.setTimestampEof(row.timestamp_eof);
+      fill_model(framed, model_outputs(&output[b * MODEL_OUTPUT_SIZE]));
+      row.out.push_back(capnp::messageToFlatArray(msg));
+      row.frames++;
+    }
+  }
+
+  if (steps > 0) {
+    printf("%d runs of %d frames, %.2fms a run, %.2fms a frame\n", steps, batch, model_ms / steps, model_ms / steps / batch);
+  }
+  for (Row &row : rows) {
+    if (row.yuv_cl != NULL) CL_CHECK(clReleaseMemObject(row.yuv_cl));
+  }
+  CL_CHECK(clReleaseCommandQueue(q));
+  CL_CHECK(clReleaseContext(context));
+  return 0;
+}
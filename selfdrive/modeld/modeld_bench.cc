@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libyuv.h"
+
+#include "selfdrive/camerad/cameras/frame_reader.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+#include "selfdrive/modeld/models/driving.h"
+
+// Runs the chain of modeld on a set of frames without camerad: model_prepare_frame, model_execute
+// and fill_model, and prints the p50 and p99 of every stage and the GPU busy time. The frames are
+// decoded from fcamera.hevc files, or random. The MODELD_* env vars of model_init apply.
+// Run from selfdrive/modeld for the models and kernels
+// usage: ./modeld_bench [--runner thneed|gpu|cpu|dsp] [--frames N] [--iterations N] [fcamera.hevc ...]
+
+struct Stage {
+  const char *name;
+  std::vector<double> ms;
+};
+
+static double percentile(std::vector<double> v, double p) {
+  auto it = v.begin() + (v.size() - 1) * p;
+  std::nth_element(v.begin(), it, v.end());
+  return *it;
+}
+
+// busy and total us of the GPU over the last sampling window of kgsl
+static bool read_gpu_busy(uint64_t &busy, uint64_t &total) {
+  const char *path = Hardware::TICI() ? "/sys/class/kgsl/kgsl-3d0/gpubusy"
+                                      : "/sys/devices/soc/b00000.qcom,kgsl-3d0/kgsl/kgsl-3d0/gpubusy";
+  std::string s = util::read_file(path);
+  return sscanf(s.c_str(), "%lu %lu", &busy, &total) == 2 && total > 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::string runner = "thneed";
+  int num_frames = 20, iterations = 1000;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--runner") == 0 && i + 1 < argc) {
+      runner = argv[++i];
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      num_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  int runtime = USE_GPU_RUNTIME;
+  if (runner == "cpu") {
+    runtime = USE_CPU_RUNTIME;
+  } else if (runner == "dsp") {
+    runtime = USE_DSP_RUNTIME;
+  } else {
+    assert(runner == "thneed" || runner == "gpu");
+  }
+
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+
+  // frames, in the YUV420 of the camerad buffers
+  int width = Hardware::TICI() ? 1928 : 1164;
+  int height = Hardware::TICI() ? 1208 : 874;
+  std::vector<std::vector<uint8_t>> frames;
+  if (files.size() > 0) {
+    FrameReader fr(files);
+    assert(fr.open());
+    width = fr.width;
+    height = fr.height;
+    std::vector<uint8_t> rgb(width * height * 3);
+    while (frames.size() < num_frames && fr.next(rgb.data(), width * 3)) {
+      auto &yuv = frames.emplace_back(width * height * 3 / 2);
+      uint8_t *y = yuv.data(), *u = y + width * height, *v = u + (width / 2) * (height / 2);
+      libyuv::RGB24ToI420(rgb.data(), width * 3, y, width, u, width / 2, v, width / 2, width, height);
+    }
+  } else {
+    std::mt19937 rng(0);
+    for (int i = 0; i < num_frames; i++) {
+      auto &yuv = frames.emplace_back(width * height * 3 / 2);
+      for (auto &b : yuv) b = rng();
+    }
+  }
+  assert(frames.size() > 0);
+  std::vector<cl_mem> frames_cl;
+  for (auto &yuv : frames) {
+    frames_cl.push_back(CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, yuv.size(), yuv.data(), &err)));
+  }
+
+  ModelState model;
+  model_init(&model, device_id, context, runtime, runner == "thneed");
+  printf("%s runner, %zu %dx%d frames, %d iterations\n", runner.c_str(), frames.size(), width, height, iterations);
+
+  // the model's zoom of the road camera, around the center of the frame
+  const mat3 transform = {{
+    2.0f, 0.0f, (width - 2.0f * MODEL_WIDTH) / 2.0f,
+    0.0f, 2.0f, (height - 2.0f * MODEL_HEIGHT) / 2.0f,
+    0.0f, 0.0f, 1.0f,
+  }};
+  float desire[DESIRE_LEN] = {};
+
+  Stage prepare = {"prepare"}, execute = {"execute"}, parse = {"parse"}, total = {"total"};
+  double gpu_busy_sum = 0;
+  int gpu_busy_samples = 0;
+  for (int i = 0; i < iterations; i++) {
+    const int f = i % frames.size();
+    double t1 = millis_since_boot();
+    cl_mem net_input_cl = model_prepare_frame(&model, frames_cl[f], width, height, transform);
+    double t2 = millis_since_boot();
+    ModelDataRaw net_outputs = model_execute(&model, net_input_cl, desire);
+    double t3 = millis_since_boot();
+    MessageBuilder msg;
+    auto framed = msg.initEvent().initModelV2();
+    fill_model(framed, net_outputs);
+    double t4 = millis_since_boot();
+
+    // the first run records thneed, not part of the stats
+    if (i == 0) continue;
+    prepare.ms.push_back(t2 - t1);
+    execute.ms.push_back(t3 - t2);
+    parse.ms.push_back(t4 - t3);
+    total.ms.push_back(t4 - t1);
+
+    uint64_t busy, gpu_total;
+    if (i % 10 == 0 && read_gpu_busy(busy, gpu_total)) {
+      gpu_busy_sum += (double)busy / gpu_total;
+      gpu_busy_samples++;
+    }
+  }
+
+  for (const Stage &s : {prepare, execute, parse, total}) {
+    if (s.ms.empty()) continue;
+    printf("%-8s p50 %7.3fms  p99 %7.3fms\n", s.name, percentile(s.ms, 0.5), percentile(s.ms, 0.99));
+  }
+  if (gpu_busy_samples > 0) {
+    printf("GPU busy %.1f%%\n", gpu_busy_sum / gpu_busy_samples * 100);
+  }
+
+  model_free(&model);
+  for (cl_mem m : frames_cl) CL_CHECK(clReleaseMemObject(m));
+  CL_CHECK(clReleaseContext(context));
+  return 0;
+}
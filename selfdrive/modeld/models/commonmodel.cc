@@ -5,52 +5,134 @@
 #include <cmath>
 #include <cstring>
 
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define USE_NEON_EXP
+#endif
+
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/timing.h"
 
-ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
+ModelFrame::ModelFrame(cl_device_id device_id, cl_context context, bool fused_warp, bool fp16)
+    : fp16(fp16), fused_warp(fused_warp || fp16), elem_size(fp16 ? sizeof(uint16_t) : sizeof(float)) {
   input_frames = std::make_unique<float[]>(buf_size);
 
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+  // read backs don't wait for the warp of the next frame
+  read_q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
   y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
   u_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
   v_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
-  net_input_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+  // start zeroed, like input_frames
+  cl_buffer_region cur_region = {MODEL_FRAME_SIZE * elem_size, MODEL_FRAME_SIZE * elem_size};
+  for (int i = 0; i < 2; i++) {
+    input_frames_cl[i] = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, buf_size * elem_size, &input_frames[0], &err));
+    cur_frame_cl[i] = CL_CHECK_ERR(clCreateSubBuffer(input_frames_cl[i], CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &cur_region, &err));
+  }
 
   transform_init(&transform, context, device_id);
   loadyuv_init(&loadyuv, context, device_id, MODEL_WIDTH, MODEL_HEIGHT);
 }
 
-float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform) {
-  transform_queue(&this->transform, q,
-                  yuv_cl, frame_width, frame_height,
-                  y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, transform);
-  loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, net_input_cl);
+cl_mem ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform) {
+  // the previous frame is copied to the front of the other buffer, the new one is loaded behind it
+  const int cur = next_input, prev = next_input ^ 1;
+  next_input = prev;
+  CL_CHECK(clEnqueueCopyBuffer(q, input_frames_cl[prev], input_frames_cl[cur], MODEL_FRAME_SIZE * elem_size, 0,
+                               MODEL_FRAME_SIZE * elem_size, 0, nullptr, nullptr));
+  if (fused_warp) {
+    transform_tensor_queue(&this->transform, q, yuv_cl, frame_width, frame_height,
+                           cur_frame_cl[cur], MODEL_WIDTH, MODEL_HEIGHT, transform, fp16);
+  } else {
+    transform_queue(&this->transform, q,
+                    yuv_cl, frame_width, frame_height,
+                    y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, transform);
+    loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, cur_frame_cl[cur]);
+  }
+  clFinish(q);
+  return input_frames_cl[cur];
+}
 
+float* ModelFrame::read_frames(cl_mem frames_cl) {
+  assert(!fp16);
   std::memmove(&input_frames[0], &input_frames[MODEL_FRAME_SIZE], sizeof(float) * MODEL_FRAME_SIZE);
-  clEnqueueReadBuffer(q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr);
-  clFinish(q);
+  CL_CHECK(clEnqueueReadBuffer(read_q, frames_cl, CL_TRUE, MODEL_FRAME_SIZE * sizeof(float), MODEL_FRAME_SIZE * sizeof(float),
+                               &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr));
   return &input_frames[0];
 }
 
 ModelFrame::~ModelFrame() {
   transform_destroy(&transform);
   loadyuv_destroy(&loadyuv);
-  CL_CHECK(clReleaseMemObject(net_input_cl));
+  for (int i = 0; i < 2; i++) {
+    CL_CHECK(clReleaseMemObject(cur_frame_cl[i]));
+    CL_CHECK(clReleaseMemObject(input_frames_cl[i]));
+  }
   CL_CHECK(clReleaseMemObject(v_cl));
   CL_CHECK(clReleaseMemObject(u_cl));
   CL_CHECK(clReleaseMemObject(y_cl));
+  CL_CHECK(clReleaseCommandQueue(read_q));
   CL_CHECK(clReleaseCommandQueue(q));
 }
 
+#ifdef USE_NEON_EXP
+// cephes expf: exp(x) = 2^n * exp(r), with n = round(x / ln2) and a polynomial for exp(r)
+static inline float32x4_t exp_f32x4(float32x4_t x) {
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-88.3762626647949f)), vdupq_n_f32(88.3762626647949f));
+  const float32x4_t n = vrndmq_f32(vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(1.44269504088896341f)));
+  // ln2 in two parts, so r keeps its precision
+  x = vfmsq_f32(x, n, vdupq_n_f32(0.693359375f));
+  x = vfmsq_f32(x, n, vdupq_n_f32(-2.12194440e-4f));
+
+  float32x4_t y = vdupq_n_f32(1.9875691500e-4f);
+  y = vfmaq_f32(vdupq_n_f32(1.3981999507e-3f), y, x);
+  y = vfmaq_f32(vdupq_n_f32(8.3334519073e-3f), y, x);
+  y = vfmaq_f32(vdupq_n_f32(4.1665795894e-2f), y, x);
+  y = vfmaq_f32(vdupq_n_f32(1.6666665459e-1f), y, x);
+  y = vfmaq_f32(vdupq_n_f32(5.0000001201e-1f), y, x);
+  y = vfmaq_f32(vaddq_f32(x, vdupq_n_f32(1.0f)), y, vmulq_f32(x, x));
+
+  const int32x4_t pow2n = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+  return vmulq_f32(y, vreinterpretq_f32_s32(pow2n));
+}
+#endif
+
+void exp_n(const float* input, float* output, size_t len) {
+  size_t i = 0;
+#ifdef USE_NEON_EXP
+  for (; i + 4 <= len; i += 4) {
+    vst1q_f32(&output[i], exp_f32x4(vld1q_f32(&input[i])));
+  }
+#endif
+  for (; i < len; i++) {
+    output[i] = expf(input[i]);
+  }
+}
+
+void sigmoid_n(const float* input, float* output, size_t len) {
+  size_t i = 0;
+#ifdef USE_NEON_EXP
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  for (; i + 4 <= len; i += 4) {
+    const float32x4_t e = exp_f32x4(vnegq_f32(vld1q_f32(&input[i])));
+    vst1q_f32(&output[i], vdivq_f32(one, vaddq_f32(one, e)));
+  }
+#endif
+  for (; i < len; i++) {
+    output[i] = sigmoid(input[i]);
+  }
+}
+
 void softmax(const float* input, float* output, size_t len) {
   const float max_val = *std::max_element(input, input + len);
+  for(int i = 0; i < len; i++) {
+    output[i] = input[i] - max_val;
+  }
+  exp_n(output, output, len);
   float denominator = 0;
   for(int i = 0; i < len; i++) {
-    float const v_exp = expf(input[i] - max_val);
-    denominator += v_exp;
-    output[i] = v_exp;
+    denominator += output[i];
   }
 
   const float inv_denominator = 1. / denominator;
@@ -25,19 +25,36 @@ const bool send_raw_pred = getenv("SEND_RAW_PRED") != NULL;
 void softmax(const float* input, float* output, size_t len);
 float softplus(float input);
 float sigmoid(float input);
+// of len contiguous elements, 4 at a time with NEON on aarch64, within a few ulp of expf
+void exp_n(const float* input, float* output, size_t len);
+void sigmoid_n(const float* input, float* output, size_t len);
 
 class ModelFrame {
  public:
-  ModelFrame(cl_device_id device_id, cl_context context);
+  // fused_warp warps the camera frame straight into the model input with transform_tensor_queue,
+  // instead of transform_queue and loadyuv_queue. fp16 keeps the frames in half, with the fused warp.
+  // Only for runners with a GPU input, read_frames is float
+  ModelFrame(cl_device_id device_id, cl_context context, bool fused_warp = false, bool fp16 = false);
   ~ModelFrame();
-  float* prepare(cl_mem yuv_cl, int width, int height, const mat3& transform);
+  // warps the frame into the model input. The last two, [prev, cur], stay on the GPU in the returned
+  // buffer, runners that read it there take it as is. The inputs alternate between two buffers, the
+  // next frame is prepared while the model runs on the last one
+  cl_mem prepare(cl_mem yuv_cl, int width, int height, const mat3& transform);
+  // host copy of the frames for the other runners, called with every input in order
+  float* read_frames(cl_mem frames_cl);
 
   const int buf_size = MODEL_FRAME_SIZE * 2;
+  const bool fp16;
 
  private:
+  const bool fused_warp;
+  // bytes of a tensor element
+  const size_t elem_size;
   Transform transform;
   LoadYUVState loadyuv;
-  cl_command_queue q;
-  cl_mem y_cl, u_cl, v_cl, net_input_cl;
+  cl_command_queue q, read_q;
+  cl_mem y_cl, u_cl, v_cl;
+  cl_mem input_frames_cl[2], cur_frame_cl[2];
+  int next_input = 0;
   std::unique_ptr<float[]> input_frames;
 };
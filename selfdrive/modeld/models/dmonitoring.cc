@@ -1,16 +1,18 @@
+#include <cstdlib>
 #include <cstring>
 
 #include "libyuv.h"
 
 #include "selfdrive/common/mat.h"
+#include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/hardware/hw.h"
 
 #include "selfdrive/modeld/models/dmonitoring.h"
 
-#define MODEL_WIDTH 320
-#define MODEL_HEIGHT 640
+#define MODEL_WIDTH DM_INPUT_WIDTH
+#define MODEL_HEIGHT DM_INPUT_HEIGHT
 #define FULL_W 852 // should get these numbers from camerad
 
 #if defined(QCOM) || defined(QCOM2)
@@ -19,11 +21,36 @@
 #define input_lambda(x) x // for non SNPE running platforms, assume keras model instead has lambda layer
 #endif
 
-void dmonitoring_init(DMonitoringModelState* s) {
+#if defined(QCOM) || defined(QCOM2)
+#define INPUT_OFFSET -128.f
+#define INPUT_SCALE 0.0078125f
+#else
+#define INPUT_OFFSET 0.f
+#define INPUT_SCALE 1.f
+#endif
+
+void dmonitoring_init(DMonitoringModelState* s, cl_device_id device_id, cl_context context) {
   const char *model_path = Hardware::PC() ? "../../models/dmonitoring_model.dlc" : "../../models/dmonitoring_model_q.dlc";
   int runtime = USE_DSP_RUNTIME;
-  s->m = new DefaultRunModel(model_path, &s->output[0], OUTPUT_SIZE, runtime);
+#if (defined(QCOM) || defined(QCOM2)) && defined(USE_THNEED)
+  // the recorded GPU commands replay without SNPE's overhead per run, DMONITORINGMODELD_SNPE=1 runs the
+  // dlc on the DSP as before, to compare the execution times in driverState
+  const char *thneed_path = "../../models/dmonitoring_model.thneed";
+  if (getenv("DMONITORINGMODELD_SNPE") == NULL && util::file_exists(thneed_path)) {
+    s->m = new ThneedModel(thneed_path, &s->output[0], OUTPUT_SIZE, USE_GPU_RUNTIME, context);
+  } else
+#endif
+  {
+    s->m = new DefaultRunModel(model_path, &s->output[0], OUTPUT_SIZE, runtime);
+  }
   s->is_rhd = Params().getBool("IsRHD");
+
+  s->gpu_preprocess = context != NULL;
+  if (s->gpu_preprocess) {
+    s->q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+    transform_init(&s->transform, context, device_id);
+    s->net_input_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6 * sizeof(float), NULL, &err));
+  }
 }
 
 template <class T>
@@ -39,7 +66,7 @@ static inline auto get_yuv_buf(std::vector<uint8_t> &buf, const int width, int h
   return std::make_tuple(y, u, v);
 }
 
-struct Rect {int x, y, w, h;};
+typedef DMonitoringCrop Rect;
 void crop_yuv(uint8_t *raw, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v, const Rect &rect) {
   uint8_t *raw_y = raw;
   uint8_t *raw_u = raw_y + (width * height);
@@ -52,28 +79,77 @@ void crop_yuv(uint8_t *raw, int width, int height, uint8_t *y, uint8_t *u, uint8
   }
 }
 
-DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height) {
-  Rect crop_rect;
-  if (Hardware::TICI()) {
-    const int full_width_tici = 1928;
-    const int full_height_tici = 1208;
-    const int adapt_width_tici = 668;
-    const int cropped_height = adapt_width_tici / 1.33;
-    crop_rect = {full_width_tici / 2 - adapt_width_tici / 2,
-                 full_height_tici / 2 - cropped_height / 2 - 196,
-                 cropped_height / 2,
-                 cropped_height};
-    if (!s->is_rhd) {
-      crop_rect.x += adapt_width_tici - crop_rect.w + 32;
-    }
+static Rect get_crop_rect(DMonitoringModelState* s, int width, int height) {
+  return get_dmonitoring_crop(width, height, s->is_rhd);
+}
 
-  } else {
-    crop_rect = {0, 0, height / 2, height};
-    if (!s->is_rhd) {
-      crop_rect.x += width - crop_rect.w;
+void dmonitoring_input_rows(DMonitoringModelState* s, int width, int height, int *row, int *rows) {
+  const Rect crop_rect = get_crop_rect(s, width, height);
+  *row = crop_rect.y;
+  *rows = crop_rect.h;
+}
+
+// the crop scaled to the model input, mirrored for RHD like the CPU path, straight from the camera
+// buffer. The Y warp samples bilinear at pixel centers like I420Scale, the pixels can be off by one.
+// NULL if the runner reads net_input_cl itself
+static float *prepare_input_gpu(DMonitoringModelState* s, cl_mem stream_cl, int width, int height) {
+  const Rect crop_rect = get_crop_rect(s, width, height);
+  const float sx = (float)crop_rect.w / MODEL_WIDTH;
+  const float sy = (float)crop_rect.h / MODEL_HEIGHT;
+  const float tx = s->is_rhd ? crop_rect.x + crop_rect.w - 0.5f * sx - 0.5f
+                             : crop_rect.x + 0.5f * sx - 0.5f;
+  const mat3 projection = {{
+    s->is_rhd ? -sx : sx, 0.0f, tx,
+    0.0f, sy, crop_rect.y + 0.5f * sy - 0.5f,
+    0.0f, 0.0f, 1.0f,
+  }};
+
+  const int yuv_buf_len = (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6;
+  float *net_input_buf = get_buffer(s->net_input_buf, yuv_buf_len);
+  transform_tensor_queue(&s->transform, s->q, stream_cl, width, height, s->net_input_cl, MODEL_WIDTH, MODEL_HEIGHT,
+                         projection, false, INPUT_OFFSET, INPUT_SCALE);
+  if (s->m->hasGpuInput()) {
+    // the runner copies it on its own queue
+    CL_CHECK(clFinish(s->q));
+    return NULL;
+  }
+  // the runner reads a host buffer
+  CL_CHECK(clEnqueueReadBuffer(s->q, s->net_input_cl, CL_TRUE, 0, yuv_buf_len * sizeof(float), net_input_buf, 0, NULL, NULL));
+  return net_input_buf;
+}
+
+// the model sized yuv frame as the tensor of the model
+static float *input_to_tensor(DMonitoringModelState* s, const uint8_t *resized_buf) {
+  const int resized_width = MODEL_WIDTH;
+  const int resized_height = MODEL_HEIGHT;
+
+  int yuv_buf_len = (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6; // Y|u|v -> y|y|y|y|u|v
+  float *net_input_buf = get_buffer(s->net_input_buf, yuv_buf_len);
+  // one shot conversion, O(n) anyway
+  // yuvframe2tensor, normalize
+  for (int r = 0; r < MODEL_HEIGHT/2; r++) {
+    for (int c = 0; c < MODEL_WIDTH/2; c++) {
+      // Y_ul
+      net_input_buf[(r*MODEL_WIDTH/2) + c + (0*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r)*resized_width + (2*c)]);
+      // Y_dl
+      net_input_buf[(r*MODEL_WIDTH/2) + c + (1*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r+1)*resized_width + (2*c)]);
+      // Y_ur
+      net_input_buf[(r*MODEL_WIDTH/2) + c + (2*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r)*resized_width + (2*c+1)]);
+      // Y_dr
+      net_input_buf[(r*MODEL_WIDTH/2) + c + (3*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r+1)*resized_width + (2*c+1)]);
+      // U
+      net_input_buf[(r*MODEL_WIDTH/2) + c + (4*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(resized_width*resized_height) + r*resized_width/2 + c]);
+      // V
+      net_input_buf[(r*MODEL_WIDTH/2) + c + (5*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(resized_width*resized_height) + ((resized_width/2)*(resized_height/2)) + c + (r*resized_width/2)]);
     }
   }
 
+  return net_input_buf;
+}
+
+static float *prepare_input_cpu(DMonitoringModelState* s, void* stream_buf, int width, int height) {
+  const Rect crop_rect = get_crop_rect(s, width, height);
+
   int resized_width = MODEL_WIDTH;
   int resized_height = MODEL_HEIGHT;
 
@@ -104,27 +180,11 @@ DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_
                     resized_v, resized_width / 2,
                     resized_width, resized_height,
                     mode);
+  return input_to_tensor(s, resized_buf);
+}
 
-  int yuv_buf_len = (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6; // Y|u|v -> y|y|y|y|u|v
-  float *net_input_buf = get_buffer(s->net_input_buf, yuv_buf_len);
-  // one shot conversion, O(n) anyway
-  // yuvframe2tensor, normalize
-  for (int r = 0; r < MODEL_HEIGHT/2; r++) {
-    for (int c = 0; c < MODEL_WIDTH/2; c++) {
-      // Y_ul
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (0*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r)*resized_width + (2*c)]);
-      // Y_dl
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (1*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r+1)*resized_width + (2*c)]);
-      // Y_ur
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (2*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r)*resized_width + (2*c+1)]);
-      // Y_dr
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (3*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(2*r+1)*resized_width + (2*c+1)]);
-      // U
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (4*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(resized_width*resized_height) + r*resized_width/2 + c]);
-      // V
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (5*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = input_lambda(resized_buf[(resized_width*resized_height) + ((resized_width/2)*(resized_height/2)) + c + (r*resized_width/2)]);
-    }
-  }
+static DMonitoringResult eval_input(DMonitoringModelState* s, float *net_input_buf) {
+  const int yuv_buf_len = (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6;
 
   //printf("preprocess completed. %d \n", yuv_buf_len);
   //FILE *dump_yuv_file = fopen("/tmp/rawdump.yuv", "wb");
@@ -140,7 +200,11 @@ DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_
   //fclose(dump_yuv_file2);
 
   double t1 = millis_since_boot();
-  s->m->execute(net_input_buf, yuv_buf_len);
+  if (net_input_buf == NULL) {
+    s->m->executeGpu(s->net_input_cl, yuv_buf_len);
+  } else {
+    s->m->execute(net_input_buf, yuv_buf_len);
+  }
   double t2 = millis_since_boot();
 
   DMonitoringResult ret = {0};
@@ -166,13 +230,24 @@ DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_
   return ret;
 }
 
-void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred) {
+DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, cl_mem stream_cl, int width, int height) {
+  float *net_input_buf = s->gpu_preprocess ? prepare_input_gpu(s, stream_cl, width, height)
+                                           : prepare_input_cpu(s, stream_buf, width, height);
+  return eval_input(s, net_input_buf);
+}
+
+DMonitoringResult dmonitoring_eval_input(DMonitoringModelState* s, const uint8_t *input_yuv) {
+  return eval_input(s, input_to_tensor(s, input_yuv));
+}
+
+void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, float model_rate, kj::ArrayPtr<const float> raw_pred) {
   // make msg
   MessageBuilder msg;
   auto framed = msg.initEvent().initDriverState();
   framed.setFrameId(frame_id);
   framed.setModelExecutionTime(execution_time);
   framed.setDspExecutionTime(res.dsp_execution_time);
+  framed.setModelRate(model_rate);
 
   framed.setFaceOrientation(res.face_orientation);
   framed.setFaceOrientationStd(res.face_orientation_meta);
@@ -197,4 +272,9 @@ void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResu
 
 void dmonitoring_free(DMonitoringModelState* s) {
   delete s->m;
+  if (s->gpu_preprocess) {
+    CL_CHECK(clReleaseMemObject(s->net_input_cl));
+    transform_destroy(&s->transform);
+    CL_CHECK(clReleaseCommandQueue(s->q));
+  }
 }
@@ -35,10 +35,21 @@ typedef struct DMonitoringModelState {
   std::vector<uint8_t> cropped_buf;
   std::vector<uint8_t> premirror_cropped_buf;
   std::vector<float> net_input_buf;
+
+  // crop, scale and normalize on the GPU, with the context of the camera buffers
+  bool gpu_preprocess;
+  cl_command_queue q;
+  Transform transform;
+  cl_mem net_input_cl;
 } DMonitoringModelState;
 
-void dmonitoring_init(DMonitoringModelState* s);
-DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height);
-void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred);
+// with a context the input is prepared on the GPU from the frames' buf_cl
+void dmonitoring_init(DMonitoringModelState* s, cl_device_id device_id = NULL, cl_context context = NULL);
+// the rows of the frame the CPU path reads, the crop
+void dmonitoring_input_rows(DMonitoringModelState* s, int width, int height, int *row, int *rows);
+DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, cl_mem stream_cl, int width, int height);
+// the crop already scaled to the input by camerad, a DM_INPUT_WIDTH x DM_INPUT_HEIGHT frame of DM_INPUT_STREAM_NAME
+DMonitoringResult dmonitoring_eval_input(DMonitoringModelState* s, const uint8_t *input_yuv);
+void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, float model_rate, kj::ArrayPtr<const float> raw_pred);
 void dmonitoring_free(DMonitoringModelState* s);
 
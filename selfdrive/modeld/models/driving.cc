@@ -3,7 +3,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 
 #include <eigen3/Eigen/Dense>
@@ -47,6 +49,9 @@ constexpr int OUTPUT_SIZE =  POSE_IDX + POSE_SIZE;
 #else
   constexpr int TEMPORAL_SIZE = 0;
 #endif
+const int MODEL_OUTPUT_SIZE = OUTPUT_SIZE + TEMPORAL_SIZE;
+const int MODEL_TEMPORAL_IDX = OUTPUT_SIZE;
+const int MODEL_TEMPORAL_SIZE = TEMPORAL_SIZE;
 
 constexpr float FCW_THRESHOLD_5MS2_HIGH = 0.15;
 constexpr float FCW_THRESHOLD_5MS2_LOW = 0.05;
@@ -57,17 +62,22 @@ float prev_brake_3ms2_probs[3] = {0,0,0};
 
 // #define DUMP_YUV
 
-void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
-  s->frame = new ModelFrame(device_id, context);
-
+void model_init(ModelState* s, cl_device_id device_id, cl_context context, int runtime, bool thneed) {
   constexpr int output_size = OUTPUT_SIZE + TEMPORAL_SIZE;
   s->output.resize(output_size);
 
 #if (defined(QCOM) || defined(QCOM2)) && defined(USE_THNEED)
-  s->m = std::make_unique<ThneedModel>("../../models/supercombo.thneed", &s->output[0], output_size, USE_GPU_RUNTIME);
-#else
-  s->m = std::make_unique<DefaultRunModel>("../../models/supercombo.dlc", &s->output[0], output_size, USE_GPU_RUNTIME);
+  if (thneed && runtime == USE_GPU_RUNTIME) {
+    s->m = std::make_unique<ThneedModel>("../../models/supercombo.thneed", &s->output[0], output_size, USE_GPU_RUNTIME, context);
+  } else
 #endif
+  {
+    s->m = std::make_unique<DefaultRunModel>("../../models/supercombo.dlc", &s->output[0], output_size, runtime);
+  }
+
+  // fp16 frames only reach a runner with a GPU input, which converts them
+  const bool fp16 = getenv("MODELD_FP16") != NULL && s->m->hasGpuInput();
+  s->frame = new ModelFrame(device_id, context, getenv("MODELD_FUSED_WARP") != NULL, fp16);
 
 #ifdef TEMPORAL
   s->m->addRecurrent(&s->output[OUTPUT_SIZE], TEMPORAL_SIZE);
@@ -84,8 +94,11 @@ void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
 #endif
 }
 
-ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
-                           const mat3 &transform, float *desire_in) {
+cl_mem model_prepare_frame(ModelState* s, cl_mem yuv_cl, int width, int height, const mat3 &transform) {
+  return s->frame->prepare(yuv_cl, width, height, transform);
+}
+
+ModelDataRaw model_execute(ModelState* s, cl_mem net_input_cl, float *desire_in) {
 #ifdef DESIRE
   if (desire_in != NULL) {
     for (int i = 1; i < DESIRE_LEN; i++) {
@@ -103,22 +116,60 @@ ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int heigh
 
   //for (int i = 0; i < OUTPUT_SIZE + TEMPORAL_SIZE; i++) { printf("%f ", s->output[i]); } printf("\n");
 
-  auto net_input_buf = s->frame->prepare(yuv_cl, width, height, transform);
-  s->m->execute(net_input_buf, s->frame->buf_size);
+  if (s->m->hasGpuInput()) {
+    s->m->executeGpu(net_input_cl, s->frame->buf_size, s->frame->fp16);
+  } else {
+    s->m->execute(s->frame->read_frames(net_input_cl), s->frame->buf_size);
+  }
+  return model_outputs(s->output.data());
+}
 
-  // net outputs
+ModelDataRaw model_outputs(float *output) {
   ModelDataRaw net_outputs;
-  net_outputs.plan = &s->output[PLAN_IDX];
-  net_outputs.lane_lines = &s->output[LL_IDX];
-  net_outputs.lane_lines_prob = &s->output[LL_PROB_IDX];
-  net_outputs.road_edges = &s->output[RE_IDX];
-  net_outputs.lead = &s->output[LEAD_IDX];
-  net_outputs.lead_prob = &s->output[LEAD_PROB_IDX];
-  net_outputs.meta = &s->output[DESIRE_STATE_IDX];
-  net_outputs.pose = &s->output[POSE_IDX];
+  net_outputs.plan = &output[PLAN_IDX];
+  net_outputs.lane_lines = &output[LL_IDX];
+  net_outputs.lane_lines_prob = &output[LL_PROB_IDX];
+  net_outputs.road_edges = &output[RE_IDX];
+  net_outputs.lead = &output[LEAD_IDX];
+  net_outputs.lead_prob = &output[LEAD_PROB_IDX];
+  net_outputs.meta = &output[DESIRE_STATE_IDX];
+  net_outputs.pose = &output[POSE_IDX];
   return net_outputs;
 }
 
+mat3 model_transform_from_extrinsic(const float *extrinsic_matrix, bool wide_camera) {
+  /*
+     import numpy as np
+     from common.transformations.model import medmodel_frame_from_road_frame
+     medmodel_frame_from_ground = medmodel_frame_from_road_frame[:, (0, 1, 3)]
+     ground_from_medmodel_frame = np.linalg.inv(medmodel_frame_from_ground)
+  */
+  Eigen::Matrix<float, 3, 3> ground_from_medmodel_frame;
+  ground_from_medmodel_frame <<
+    0.00000000e+00, 0.00000000e+00, 1.00000000e+00,
+    -1.09890110e-03, 0.00000000e+00, 2.81318681e-01,
+    -1.84808520e-20, 9.00738606e-04,-4.28751576e-02;
+
+  Eigen::Matrix<float, 3, 3> cam_intrinsics = Eigen::Matrix<float, 3, 3, Eigen::RowMajor>(wide_camera ? ecam_intrinsic_matrix.v : fcam_intrinsic_matrix.v);
+  Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
+  for (int i = 0; i < 4*3; i++) {
+    extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
+  }
+
+  auto camera_frame_from_road_frame = cam_intrinsics * extrinsic_matrix_eigen;
+  Eigen::Matrix<float, 3, 3> camera_frame_from_ground;
+  camera_frame_from_ground.col(0) = camera_frame_from_road_frame.col(0);
+  camera_frame_from_ground.col(1) = camera_frame_from_road_frame.col(1);
+  camera_frame_from_ground.col(2) = camera_frame_from_road_frame.col(3);
+
+  auto warp_matrix = camera_frame_from_ground * ground_from_medmodel_frame;
+  mat3 transform = {};
+  for (int i=0; i<3*3; i++) {
+    transform.v[i] = warp_matrix(i / 3, i % 3);
+  }
+  return matmul3(get_model_yuv_transform(), transform);
+}
+
 void model_free(ModelState* s) {
   delete s->frame;
 }
@@ -143,12 +194,6 @@ static const float *get_lead_data(const float *lead, int t_offset) {
 }
 
 
-void fill_sigmoid(const float *input, float *output, int len, int stride) {
-  for (int i=0; i<len; i++) {
-    output[i] = sigmoid(input[i*stride]);
-  }
-}
-
 void fill_lead_v3(cereal::ModelDataV2::LeadDataV3::Builder lead, const float *lead_data, const float *prob, int t_offset, float prob_t) {
   float t[LEAD_TRAJ_LEN] = {0.0, 2.0, 4.0, 6.0, 8.0, 10.0};
   const float *data = get_lead_data(lead_data, t_offset);
@@ -162,15 +207,18 @@ void fill_lead_v3(cereal::ModelDataV2::LeadDataV3::Builder lead, const float *le
   float y_stds_arr[LEAD_TRAJ_LEN];
   float v_stds_arr[LEAD_TRAJ_LEN];
   float a_stds_arr[LEAD_TRAJ_LEN];
+  // the stds of all points follow the means, exp them in one go
+  float stds[LEAD_MHP_VALS];
+  exp_n(&data[LEAD_MHP_VALS], stds, LEAD_MHP_VALS);
   for (int i=0; i<LEAD_TRAJ_LEN; i++) {
     x_arr[i] = data[i*LEAD_PRED_DIM+0];
     y_arr[i] = data[i*LEAD_PRED_DIM+1];
     v_arr[i] = data[i*LEAD_PRED_DIM+2];
     a_arr[i] = data[i*LEAD_PRED_DIM+3];
-    x_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+0]);
-    y_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+1]);
-    v_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+2]);
-    a_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+3]);
+    x_stds_arr[i] = stds[i*LEAD_PRED_DIM+0];
+    y_stds_arr[i] = stds[i*LEAD_PRED_DIM+1];
+    v_stds_arr[i] = stds[i*LEAD_PRED_DIM+2];
+    a_stds_arr[i] = stds[i*LEAD_PRED_DIM+3];
   }
   lead.setT(t);
   lead.setX(x_arr);
@@ -192,19 +240,24 @@ void fill_meta(cereal::ModelDataV2::MetaData::Builder meta, const float *meta_da
             &desire_pred_softmax[i*DESIRE_LEN], DESIRE_LEN);
   }
 
+  // the engaged prob, then META_STRIDE probs for each interval
+  float meta_sigmoid[1 + NUM_META_INTERVALS*META_STRIDE];
+  sigmoid_n(&meta_data[DESIRE_LEN], meta_sigmoid, 1 + NUM_META_INTERVALS*META_STRIDE);
+
   float gas_disengage_sigmoid[NUM_META_INTERVALS];
   float brake_disengage_sigmoid[NUM_META_INTERVALS];
   float steer_override_sigmoid[NUM_META_INTERVALS];
   float brake_3ms2_sigmoid[NUM_META_INTERVALS];
   float brake_4ms2_sigmoid[NUM_META_INTERVALS];
   float brake_5ms2_sigmoid[NUM_META_INTERVALS];
-
-  fill_sigmoid(&meta_data[DESIRE_LEN+1], gas_disengage_sigmoid, NUM_META_INTERVALS, META_STRIDE);
-  fill_sigmoid(&meta_data[DESIRE_LEN+2], brake_disengage_sigmoid, NUM_META_INTERVALS, META_STRIDE);
-  fill_sigmoid(&meta_data[DESIRE_LEN+3], steer_override_sigmoid, NUM_META_INTERVALS, META_STRIDE);
-  fill_sigmoid(&meta_data[DESIRE_LEN+4], brake_3ms2_sigmoid, NUM_META_INTERVALS, META_STRIDE);
-  fill_sigmoid(&meta_data[DESIRE_LEN+5], brake_4ms2_sigmoid, NUM_META_INTERVALS, META_STRIDE);
-  fill_sigmoid(&meta_data[DESIRE_LEN+6], brake_5ms2_sigmoid, NUM_META_INTERVALS, META_STRIDE);
+  for (int i=0; i<NUM_META_INTERVALS; i++) {
+    gas_disengage_sigmoid[i] = meta_sigmoid[1 + i*META_STRIDE + 0];
+    brake_disengage_sigmoid[i] = meta_sigmoid[1 + i*META_STRIDE + 1];
+    steer_override_sigmoid[i] = meta_sigmoid[1 + i*META_STRIDE + 2];
+    brake_3ms2_sigmoid[i] = meta_sigmoid[1 + i*META_STRIDE + 3];
+    brake_4ms2_sigmoid[i] = meta_sigmoid[1 + i*META_STRIDE + 4];
+    brake_5ms2_sigmoid[i] = meta_sigmoid[1 + i*META_STRIDE + 5];
+  }
 
   std::memmove(prev_brake_5ms2_probs, &prev_brake_5ms2_probs[1], 4*sizeof(float));
   std::memmove(prev_brake_3ms2_probs, &prev_brake_3ms2_probs[1], 2*sizeof(float));
@@ -229,7 +282,7 @@ void fill_meta(cereal::ModelDataV2::MetaData::Builder meta, const float *meta_da
   disengage.setBrake4MetersPerSecondSquaredProbs(brake_4ms2_sigmoid);
   disengage.setBrake5MetersPerSecondSquaredProbs(brake_5ms2_sigmoid);
 
-  meta.setEngagedProb(sigmoid(meta_data[DESIRE_LEN]));
+  meta.setEngagedProb(meta_sigmoid[0]);
   meta.setDesirePrediction(desire_pred_softmax);
   meta.setDesireState(desire_state_softmax);
   meta.setHardBrakePredicted(above_fcw_threshold);
@@ -306,9 +359,11 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   float lane_line_stds_arr[4];
   for (int i = 0; i < 4; i++) {
     fill_xyzt(lane_lines[i], &net_outputs.lane_lines[i*TRAJECTORY_SIZE*2], 2, -1, plan_t_arr, false);
-    lane_line_probs_arr[i] = sigmoid(net_outputs.lane_lines_prob[i*2+1]);
-    lane_line_stds_arr[i] = exp(net_outputs.lane_lines[2*TRAJECTORY_SIZE*(4 + i)]);
+    lane_line_probs_arr[i] = net_outputs.lane_lines_prob[i*2+1];
+    lane_line_stds_arr[i] = net_outputs.lane_lines[2*TRAJECTORY_SIZE*(4 + i)];
   }
+  sigmoid_n(lane_line_probs_arr, lane_line_probs_arr, 4);
+  exp_n(lane_line_stds_arr, lane_line_stds_arr, 4);
   framed.setLaneLineProbs(lane_line_probs_arr);
   framed.setLaneLineStds(lane_line_stds_arr);
 
@@ -317,8 +372,9 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   float road_edge_stds_arr[2];
   for (int i = 0; i < 2; i++) {
     fill_xyzt(road_edges[i], &net_outputs.road_edges[i*TRAJECTORY_SIZE*2], 2, -1, plan_t_arr, false);
-    road_edge_stds_arr[i] = exp(net_outputs.road_edges[2*TRAJECTORY_SIZE*(2 + i)]);
+    road_edge_stds_arr[i] = net_outputs.road_edges[2*TRAJECTORY_SIZE*(2 + i)];
   }
+  exp_n(road_edge_stds_arr, road_edge_stds_arr, 2);
   framed.setRoadEdgeStds(road_edge_stds_arr);
 
   // meta
@@ -332,22 +388,90 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   }
 }
 
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
-                   const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
-                   float model_execution_time, kj::ArrayPtr<const float> raw_pred) {
+// with one scale for the list, the largest value is +-INT16_MAX. Not finite values are 0
+static float quantize(capnp::List<float>::Reader v, capnp::List<int16_t>::Builder q) {
+  float max_abs = 0;
+  for (float f : v) {
+    if (std::isfinite(f)) max_abs = std::max(max_abs, std::abs(f));
+  }
+  const float scale = max_abs > 0 ? max_abs / INT16_MAX : 1.0;
+  for (int i = 0; i < v.size(); i++) {
+    q.set(i, std::isfinite(v[i]) ? (int16_t)std::lround(v[i] / scale) : 0);
+  }
+  return scale;
+}
+
+static void fill_quantized(cereal::ModelDataV2Compact::QuantizedXYZ::Builder q, const cereal::ModelDataV2::XYZTData::Reader &xyzt) {
+  q.setXScale(quantize(xyzt.getX(), q.initX(xyzt.getX().size())));
+  q.setYScale(quantize(xyzt.getY(), q.initY(xyzt.getY().size())));
+  q.setZScale(quantize(xyzt.getZ(), q.initZ(xyzt.getZ().size())));
+}
+
+void fill_model_compact(cereal::ModelDataV2Compact::Builder compact, const cereal::ModelDataV2::Reader &framed) {
+  compact.setFrameId(framed.getFrameId());
+  compact.setTimestampEof(framed.getTimestampEof());
+  compact.setModelRate(framed.getModelRate());
+
+  fill_quantized(compact.initPosition(), framed.getPosition());
+  auto lane_lines = framed.getLaneLines();
+  auto compact_lane_lines = compact.initLaneLines(lane_lines.size());
+  for (int i = 0; i < lane_lines.size(); i++) {
+    fill_quantized(compact_lane_lines[i], lane_lines[i]);
+  }
+  compact.setLaneLineProbs(framed.getLaneLineProbs());
+  compact.setLaneLineStds(framed.getLaneLineStds());
+  auto road_edges = framed.getRoadEdges();
+  auto compact_road_edges = compact.initRoadEdges(road_edges.size());
+  for (int i = 0; i < road_edges.size(); i++) {
+    fill_quantized(compact_road_edges[i], road_edges[i]);
+  }
+  compact.setRoadEdgeStds(framed.getRoadEdgeStds());
+
+  if (framed.getLeadsV3().size() > 0) {
+    auto lead = framed.getLeadsV3()[0];
+    compact.setLeadProb(lead.getProb());
+    compact.setLeadX(lead.getX()[0]);
+    compact.setLeadY(lead.getY()[0]);
+    compact.setLeadV(lead.getV()[0]);
+  }
+
+  auto meta = framed.getMeta();
+  compact.setEngagedProb(meta.getEngagedProb());
+  compact.setHardBrakePredicted(meta.getHardBrakePredicted());
+  compact.setDesireState(meta.getDesireState());
+}
+
+void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop, float model_rate,
+                   const ModelDataRaw &net_outputs, const ModelFrameTimestamps &timestamps,
+                   float prepare_time, float model_execution_time, kj::ArrayPtr<const float> raw_pred) {
+  // Large message at 20Hz, reuse the buffers across frames. Only called from the publish thread of modeld
+  static MessageArena arena(16384);
+
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
+  MessageBuilder msg(arena);
   auto framed = msg.initEvent().initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameAge(frame_age);
   framed.setFrameDropPerc(frame_drop * 100);
-  framed.setTimestampEof(timestamp_eof);
+  framed.setModelRate(model_rate);
+  framed.setTimestampEof(timestamps.eof);
+  framed.setTimestampProcessed(timestamps.processed);
+  framed.setTimestampSent(timestamps.sent);
+  framed.setTimestampRecv(timestamps.recv);
+  framed.setTimestampPrepared(timestamps.prepared);
+  framed.setTimestampExecuted(timestamps.executed);
+  framed.setPrepareTime(prepare_time);
   framed.setModelExecutionTime(model_execution_time);
   if (send_raw_pred) {
     framed.setRawPredictions(raw_pred.asBytes());
   }
   fill_model(framed, net_outputs);
+  framed.setTimestampPublished(nanos_since_boot());
+
+  MessageBuilder compact_msg;
+  fill_model_compact(compact_msg.initEvent().initModelV2Compact(), framed.asReader());
   pm.send("modelV2", msg);
+  pm.send("modelV2Compact", compact_msg);
 }
 
 void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
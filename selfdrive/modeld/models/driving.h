@@ -17,6 +17,8 @@
 constexpr int DESIRE_LEN = 8;
 constexpr int TRAFFIC_CONVENTION_LEN = 2;
 constexpr int MODEL_FREQ = 20;
+// floats of an output row of the model, and where the recurrent state it reads back starts in it
+extern const int MODEL_OUTPUT_SIZE, MODEL_TEMPORAL_IDX, MODEL_TEMPORAL_SIZE;
 
 struct ModelDataRaw {
   float *plan;
@@ -44,13 +46,35 @@ typedef struct ModelState {
 #endif
 } ModelState;
 
-void model_init(ModelState* s, cl_device_id device_id, cl_context context);
-ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
-                           const mat3 &transform, float *desire_in);
+// Where a frame was on its way from the camera to modelV2, all nanos since boot
+struct ModelFrameTimestamps {
+  uint64_t eof;
+  uint64_t processed;
+  uint64_t sent;
+  uint64_t recv;
+  uint64_t prepared;
+  uint64_t executed;
+};
+
+// runtime is the SNPE runtime. With thneed, the GPU one runs the recorded supercombo.thneed where
+// thneed is built
+void model_init(ModelState* s, cl_device_id device_id, cl_context context, int runtime = USE_GPU_RUNTIME, bool thneed = true);
+// warps the frame into the next model input, on the queue of s->frame. Can run on another thread
+// than model_execute, for the frame after the one the model runs on
+cl_mem model_prepare_frame(ModelState* s, cl_mem yuv_cl, int width, int height, const mat3 &transform);
+// runs the model on an input of model_prepare_frame, the outputs are in s->output until the next call
+ModelDataRaw model_execute(ModelState* s, cl_mem net_input_cl, float *desire_in);
+// the outputs in a copy of s->output
+ModelDataRaw model_outputs(float *output);
 void model_free(ModelState* s);
+// the warp of the camera frame into the model input, for the 3x4 row major extrinsic matrix of liveCalibration
+mat3 model_transform_from_extrinsic(const float *extrinsic_matrix, bool wide_camera);
 void poly_fit(float *in_pts, float *in_stds, float *out);
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
-                   const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
-                   float model_execution_time, kj::ArrayPtr<const float> raw_pred);
+void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_outputs);
+// the modelV2Compact of a filled modelV2
+void fill_model_compact(cereal::ModelDataV2Compact::Builder compact, const cereal::ModelDataV2::Reader &framed);
+void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop, float model_rate,
+                   const ModelDataRaw &net_outputs, const ModelFrameTimestamps &timestamps,
+                   float prepare_time, float model_execution_time, kj::ArrayPtr<const float> raw_pred);
 void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                      const ModelDataRaw &net_outputs, uint64_t timestamp_eof);
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/modeld/models/driving.h"
+
+// Times building modelV2 from a model output with fill_model, and checks exp_n and sigmoid_n against
+// expf on it. The output is the rawPredictions of a modelV2 sent with SEND_RAW_PRED, saved as a file.
+// Without one it's random, more than the model outputs
+// usage: models/driving_benchmark [raw_predictions] [iterations]
+
+int main(int argc, char *argv[]) {
+  std::vector<float> output;
+  if (argc > 1) {
+    std::string raw = util::read_file(argv[1]);
+    assert(raw.size() > 0 && raw.size() % sizeof(float) == 0);
+    output.resize(raw.size() / sizeof(float));
+    memcpy(output.data(), raw.data(), raw.size());
+  } else {
+    std::mt19937 rng(0);
+    std::normal_distribution<float> dist(0, 3);
+    output.resize(16384);
+    for (auto &v : output) v = dist(rng);
+  }
+  const int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+
+  std::vector<float> ref(output.size()), vec(output.size());
+  double max_exp_err = 0, max_sigmoid_err = 0;
+  exp_n(output.data(), vec.data(), output.size());
+  for (int i = 0; i < output.size(); i++) {
+    ref[i] = expf(output[i]);
+    max_exp_err = std::max(max_exp_err, (double)std::abs(vec[i] - ref[i]) / ref[i]);
+  }
+  sigmoid_n(output.data(), vec.data(), output.size());
+  for (int i = 0; i < output.size(); i++) {
+    ref[i] = sigmoid(output[i]);
+    max_sigmoid_err = std::max(max_sigmoid_err, (double)std::abs(vec[i] - ref[i]) / ref[i]);
+  }
+  printf("%zu outputs, max relative error exp_n %g, sigmoid_n %g\n", output.size(), max_exp_err, max_sigmoid_err);
+
+  double t1 = millis_since_boot();
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < output.size(); j++) ref[j] = expf(output[j]);
+  }
+  double t2 = millis_since_boot();
+  for (int i = 0; i < iterations; i++) {
+    exp_n(output.data(), vec.data(), output.size());
+  }
+  double t3 = millis_since_boot();
+  printf("expf %.3fus, exp_n %.3fus per output\n", (t2 - t1) * 1e3 / iterations, (t3 - t2) * 1e3 / iterations);
+
+  const ModelDataRaw net_outputs = model_outputs(output.data());
+  double fill_ms = 0;
+  for (int i = 0; i < iterations; i++) {
+    MessageBuilder msg;
+    auto framed = msg.initEvent().initModelV2();
+    double t4 = millis_since_boot();
+    fill_model(framed, net_outputs);
+    fill_ms += millis_since_boot() - t4;
+  }
+  printf("fill_model %.3fus\n", fill_ms * 1e3 / iterations);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include "selfdrive/modeld/models/rate_governor.h"
+
+#include <algorithm>
+
+#include "selfdrive/common/swaglog.h"
+
+// as in controlsd
+const int HIGH_CPU_USAGE = 95;
+
+std::vector<const char *> ModelRateGovernor::services(bool driver_monitoring) {
+  std::vector<const char *> ret = {"deviceState", "controlsState"};
+  if (driver_monitoring) {
+    ret.insert(ret.end(), {"carState", "driverMonitoringState"});
+  }
+  return ret;
+}
+
+void ModelRateGovernor::update(SubMaster &sm) {
+  auto device_state = sm["deviceState"].getDeviceState();
+  auto cpus = device_state.getCpuUsagePercent();
+  const bool pressure = device_state.getThermalStatus() >= cereal::DeviceState::ThermalStatus::RED ||
+                        std::any_of(cpus.begin(), cpus.end(), [](int8_t usage) { return usage > HIGH_CPU_USAGE; });
+
+  int new_divisor = 1;
+  if (pressure && !sm["controlsState"].getControlsState().getEnabled()) {
+    new_divisor = 2;
+  }
+  if (driver_monitoring) {
+    auto dm_state = sm["driverMonitoringState"].getDriverMonitoringState();
+    if (sm["carState"].getCarState().getStandstill() && dm_state.getFaceDetected() && !dm_state.getIsDistracted()) {
+      new_divisor = 4;
+    }
+  }
+
+  if (new_divisor != divisor) {
+    LOGW("model rate %.1f -> %.1f Hz", frame_rate / divisor, frame_rate / new_divisor);
+    divisor = new_divisor;
+  }
+}
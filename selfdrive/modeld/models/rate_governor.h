@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+
+// Picks the frames a model runs on. Under thermal or CPU pressure it runs on every other frame, but only
+// while controls aren't engaged, controlsd doesn't engage then anyway (overheat, highCpuUsage). Driver
+// monitoring also runs on every fourth frame while the car stands still with an attentive driver.
+// The models stamp rate() on their outputs, so consumers can tell a slower model from dropped frames
+class ModelRateGovernor {
+public:
+  // frame_rate of the camera, the rate without pressure
+  ModelRateGovernor(float frame_rate, bool driver_monitoring) : frame_rate(frame_rate), driver_monitoring(driver_monitoring) {}
+  // the services the governor reads, to add to the SubMaster passed to update
+  static std::vector<const char *> services(bool driver_monitoring);
+  void update(SubMaster &sm);
+  bool should_run(uint32_t frame_id) const { return frame_id % divisor == 0; }
+  // frames per second the model runs at
+  float rate() const { return frame_rate / divisor; }
+
+private:
+  float frame_rate;
+  bool driver_monitoring;
+  int divisor = 1;
+};
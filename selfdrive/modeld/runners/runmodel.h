@@ -1,9 +1,21 @@
 #pragma once
+
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
 class RunModel {
 public:
   virtual void addRecurrent(float *state, int state_size) {}
   virtual void addDesire(float *state, int state_size) {}
   virtual void addTrafficConvention(float *state, int state_size) {}
   virtual void execute(float *net_input_buf, int buf_size) {}
+  // runners that read the input frames from ModelFrame's buffer on the GPU, without the host copy.
+  // half if the frames are fp16, see ModelFrame
+  virtual bool hasGpuInput() { return false; }
+  virtual void executeGpu(cl_mem net_input_cl, int buf_size, bool half = false) {}
 };
 
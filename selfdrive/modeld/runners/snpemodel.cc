@@ -13,9 +13,11 @@ void PrintErrorStringAndExit() {
   std::exit(EXIT_FAILURE);
 }
 
-SNPEModel::SNPEModel(const char *path, float *loutput, size_t loutput_size, int runtime) {
+SNPEModel::SNPEModel(const char *path, float *loutput, size_t loutput_size, int runtime, int batch) {
   output = loutput;
   output_size = loutput_size;
+  this->batch = batch;
+  assert(batch >= 1);
 #if defined(QCOM) || defined(QCOM2)
   if (runtime==USE_GPU_RUNTIME) {
     Runtime = zdl::DlSystem::Runtime_t::GPU;
@@ -52,6 +54,19 @@ SNPEModel::SNPEModel(const char *path, float *loutput, size_t loutput_size, int
     if (!snpe) std::cerr << zdl::DlSystem::getLastErrorString() << std::endl;
   }
 
+  if (batch > 1) {
+    // built again with batch as the first dimension of every input
+    zdl::DlSystem::TensorShapeMap input_dims;
+    for (const char *name : *snpe->getInputTensorNames()) {
+      const zdl::DlSystem::TensorShape &shape = *snpe->getInputDimensions(name);
+      std::vector<size_t> dims(shape.getDimensions(), shape.getDimensions() + shape.rank());
+      dims[0] = batch;
+      input_dims.add(name, zdl::DlSystem::TensorShape(dims.data(), dims.size()));
+    }
+    snpe = snpeBuilder.setInputDimensions(input_dims).build();
+    if (!snpe) PrintErrorStringAndExit();
+  }
+
   // get input and output names
   const auto &strListi_opt = snpe->getInputTensorNames();
   if (!strListi_opt) throw std::runtime_error("Error obtaining Input tensor names");
@@ -99,7 +114,7 @@ SNPEModel::SNPEModel(const char *path, float *loutput, size_t loutput_size, int
     }
 
     std::vector<size_t> outputStrides = {output_size * sizeof(float), sizeof(float)};
-    outputBuffer = ubFactory.createUserBuffer(output, output_size * sizeof(float), outputStrides, &userBufferEncodingFloat);
+    outputBuffer = ubFactory.createUserBuffer(output, batch * output_size * sizeof(float), outputStrides, &userBufferEncodingFloat);
     outputMap.add(output_tensor_name, outputBuffer.get());
   }
 }
@@ -130,15 +145,17 @@ std::unique_ptr<zdl::DlSystem::IUserBuffer> SNPEModel::addExtra(float *state, in
 
   zdl::DlSystem::UserBufferEncodingFloat userBufferEncodingFloat;
   zdl::DlSystem::IUserBufferFactory& ubFactory = zdl::SNPE::SNPEFactory::getUserBufferFactory();
-  std::vector<size_t> retStrides = {state_size * sizeof(float), sizeof(float)};
-  auto ret = ubFactory.createUserBuffer(state, state_size * sizeof(float), retStrides, &userBufferEncodingFloat);
+  const bool in_output = state >= output && state < output + output_size;
+  const size_t row = in_output ? output_size : state_size;
+  std::vector<size_t> retStrides = {row * sizeof(float), sizeof(float)};
+  auto ret = ubFactory.createUserBuffer(state, ((batch - 1) * row + state_size) * sizeof(float), retStrides, &userBufferEncodingFloat);
   inputMap.add(input_tensor_name, ret.get());
   return ret;
 }
 
 void SNPEModel::execute(float *net_input_buf, int buf_size) {
 #ifdef USE_THNEED
-  if (Runtime == zdl::DlSystem::Runtime_t::GPU) {
+  if (Runtime == zdl::DlSystem::Runtime_t::GPU && batch == 1) {
     float *inputs[4] = {recurrent, trafficConvention, desire, net_input_buf};
     if (thneed == NULL) {
       bool ret = inputBuffer->setBufferAddress(net_input_buf);
@@ -171,6 +188,11 @@ void SNPEModel::execute(float *net_input_buf, int buf_size) {
       }
       free(outputs_golden);
     } else {
+      if (recurrent >= output && recurrent < output + output_size) {
+        // the state of the last run is still in the output on the GPU
+        thneed->copy_output_to_input(0, recurrent - output);
+        inputs[0] = NULL;
+      }
       thneed->execute(inputs, output);
     }
   } else {
@@ -22,7 +22,9 @@
 
 class SNPEModel : public RunModel {
 public:
-  SNPEModel(const char *path, float *loutput, size_t loutput_size, int runtime);
+  // batch > 1 runs that many independent inputs at once, for the offline tools. Every input and the
+  // output then hold batch rows, back to back, see addExtra. No thneed then
+  SNPEModel(const char *path, float *loutput, size_t loutput_size, int runtime, int batch = 1);
   void addRecurrent(float *state, int state_size);
   void addTrafficConvention(float *state, int state_size);
   void addDesire(float *state, int state_size);
@@ -51,8 +53,10 @@ private:
   std::unique_ptr<zdl::DlSystem::IUserBuffer> outputBuffer;
   float *output;
   size_t output_size;
+  int batch;
 
-  // recurrent and desire
+  // recurrent and desire. The rows of state are state_size apart, or output_size for a state within
+  // the output, the recurrent state the model reads back
   std::unique_ptr<zdl::DlSystem::IUserBuffer> addExtra(float *state, int state_size, int idx);
   float *recurrent;
   size_t recurrent_size;
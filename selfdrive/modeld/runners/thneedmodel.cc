@@ -2,19 +2,27 @@
 
 #include <cassert>
 
-ThneedModel::ThneedModel(const char *path, float *loutput, size_t loutput_size, int runtime) {
-  thneed = new Thneed(true);
+ThneedModel::ThneedModel(const char *path, float *loutput, size_t loutput_size, int runtime, cl_context context) {
+  thneed = new Thneed(true, context);
   thneed->record = 0;
   thneed->load(path);
   thneed->clexec();
   thneed->find_inputs_outputs();
+  // the frame is the last input
+  assert(thneed->inputs.size() == 4 || thneed->inputs.size() == 1);
 
   recorded = false;
+  gpu_input = context != NULL;
   output = loutput;
+  output_size = loutput_size;
 }
 
 void ThneedModel::addRecurrent(float *state, int state_size) {
   recurrent = state;
+  if (state >= output && state + state_size <= output + output_size) {
+    assert(thneed->inputs.size() == 4 && thneed->input_sizes[0] == state_size * sizeof(float));
+    recurrent_offset = state - output;
+  }
 }
 
 void ThneedModel::addTrafficConvention(float *state, int state_size) {
@@ -27,7 +35,20 @@ void ThneedModel::addDesire(float *state, int state_size) {
 
 void ThneedModel::execute(float *net_input_buf, int buf_size) {
   float *inputs[4] = {recurrent, trafficConvention, desire, net_input_buf};
+  run(thneed->inputs.size() == 1 ? &inputs[3] : inputs);
+}
+
+void ThneedModel::executeGpu(cl_mem net_input_cl, int buf_size, bool half) {
+  assert(gpu_input);
+  // the frames go straight into the model's input buffer, before recording so the copy isn't part of it
+  thneed->copy_input(thneed->inputs.size() - 1, net_input_cl, half);
+  float *inputs[4] = {recurrent, trafficConvention, desire, NULL};
+  run(thneed->inputs.size() == 1 ? &inputs[3] : inputs);
+}
+
+void ThneedModel::run(float **inputs) {
   if (!recorded) {
+    thneed->make_current();
     thneed->record = THNEED_RECORD;
     thneed->copy_inputs(inputs);
     thneed->clexec();
@@ -36,6 +57,11 @@ void ThneedModel::execute(float *net_input_buf, int buf_size) {
 
     recorded = true;
   } else {
+    if (recurrent_offset >= 0) {
+      // the state of the last run is still in the output on the GPU
+      thneed->copy_output_to_input(0, recurrent_offset);
+      inputs[0] = NULL;
+    }
     thneed->execute(inputs, output);
   }
 }
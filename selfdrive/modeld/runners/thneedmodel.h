@@ -5,20 +5,32 @@
 
 class ThneedModel : public RunModel {
 public:
-  ThneedModel(const char *path, float *loutput, size_t loutput_size, int runtime);
+  // Runs a model recorded by thneed/compile, the driving model with its recurrent state, traffic convention
+// and desire inputs or the dmonitoring model with only the frame.
+// With the context of ModelFrame the input frames are copied on the GPU, see executeGpu
+  ThneedModel(const char *path, float *loutput, size_t loutput_size, int runtime, cl_context context = NULL);
   void addRecurrent(float *state, int state_size);
   void addTrafficConvention(float *state, int state_size);
   void addDesire(float *state, int state_size);
   void execute(float *net_input_buf, int buf_size);
+  bool hasGpuInput() { return gpu_input; }
+  void executeGpu(cl_mem net_input_cl, int buf_size, bool half = false);
 private:
+  void run(float **inputs);
+
   Thneed *thneed = NULL;
   bool recorded;
+  bool gpu_input;
 
   float *output;
+  size_t output_size;
 
   // recurrent and desire
-  float *recurrent;
-  float *trafficConvention;
-  float *desire;
+  float *recurrent = NULL;
+  // of a recurrent state within the output, which is then copied into the input on the GPU after the
+  // first run
+  int recurrent_offset = -1;
+  float *trafficConvention = NULL;
+  float *desire = NULL;
 };
 
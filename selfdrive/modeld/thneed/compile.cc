@@ -7,8 +7,17 @@
 #define DESIRE_LEN 8
 #define TRAFFIC_CONVENTION_LEN 2
 
+// usage: thneed/compile model.dlc model.thneed [--binary] [--autotune] [--dmonitoring]
+// --dmonitoring for the driver monitoring model, its only input is the frame
 // TODO: This should probably use SNPE directly.
 int main(int argc, char* argv[]) {
+  bool save_binaries = false, autotune = false, dmonitoring = false;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--binary") == 0) save_binaries = true;
+    if (strcmp(argv[i], "--autotune") == 0) autotune = true;
+    if (strcmp(argv[i], "--dmonitoring") == 0) dmonitoring = true;
+  }
+
   #define OUTPUT_SIZE 0x10000
   float *output = (float*)calloc(OUTPUT_SIZE, sizeof(float));
   SNPEModel mdl(argv[1], output, 0, USE_GPU_RUNTIME);
@@ -18,17 +27,20 @@ int main(int argc, char* argv[]) {
   float traffic_convention[TRAFFIC_CONVENTION_LEN] = {0};
   float *input = (float*)calloc(0x1000000, sizeof(float));
 
-  mdl.addRecurrent(state, TEMPORAL_SIZE);
-  mdl.addDesire(desire, DESIRE_LEN);
-  mdl.addTrafficConvention(traffic_convention, TRAFFIC_CONVENTION_LEN);
+  if (!dmonitoring) {
+    mdl.addRecurrent(state, TEMPORAL_SIZE);
+    mdl.addDesire(desire, DESIRE_LEN);
+    mdl.addTrafficConvention(traffic_convention, TRAFFIC_CONVENTION_LEN);
+  }
 
   // first run
   printf("************** execute 1 **************\n");
   memset(output, 0, OUTPUT_SIZE * sizeof(float));
   mdl.execute(input, 0);
 
+  if (autotune) mdl.thneed->autotune();
+
   // save model
-  bool save_binaries = (argc > 3) && (strcmp(argv[3], "--binary") == 0);
   mdl.thneed->save(argv[2], save_binaries);
   return 0;
 }
@@ -0,0 +1,35 @@
+#include <sys/resource.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/modeld/thneed/thneed.h"
+
+// Times loading a thneed file and its first run, and the peak RSS after. One load per process, a
+// thneed doesn't free its GPU memory. --profile then times every kernel over 20 runs, see Thneed::profile
+// usage: thneed/load_benchmark ../../models/supercombo.thneed [--profile [trace.json]]
+
+int main(int argc, char *argv[]) {
+  assert(argc > 1);
+
+  double t1 = millis_since_boot();
+  Thneed thneed(true);
+  thneed.record = 0;
+  double t2 = millis_since_boot();
+  thneed.load(argv[1]);
+  double t3 = millis_since_boot();
+  thneed.clexec();
+  double t4 = millis_since_boot();
+
+  struct rusage usage;
+  assert(getrusage(RUSAGE_SELF, &usage) == 0);
+  printf("clinit %.1fms, load %.1fms, first run %.1fms\n", t2 - t1, t3 - t2, t4 - t3);
+  printf("%zu kernels, peak RSS %.1fMB\n", thneed.kq.size(), usage.ru_maxrss / 1024.0);
+
+  if (argc > 2 && strcmp(argv[2], "--profile") == 0) {
+    thneed.profile(20, argc > 3 ? argv[3] : NULL);
+  }
+  return 0;
+}
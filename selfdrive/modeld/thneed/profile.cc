@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#include "json11.hpp"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/modeld/thneed/thneed.h"
+using namespace json11;
+
+static string work_size_str(cl_uint work_dim, const size_t *work_size) {
+  string ret;
+  for (int i = 0; i < work_dim; i++) {
+    ret += (i ? "x" : "") + std::to_string(work_size[i]);
+  }
+  return ret;
+}
+
+static cl_command_queue profiling_queue(cl_context context, cl_device_id device_id) {
+  cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+  return CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
+}
+
+static double event_us(cl_event event) {
+  cl_ulong start, end;
+  CL_CHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL));
+  CL_CHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL));
+  return (end - start) / 1e3;
+}
+
+// the fastest of runs of k alone, to leave out the runs that got interrupted
+static double kernel_us(cl_command_queue queue, CLQueuedKernel &k, int runs) {
+  double best = 1e12;
+  for (int i = 0; i < runs; i++) {
+    cl_event event;
+    if (k.exec(queue, &event) != CL_SUCCESS) return -1;
+    CL_CHECK(clWaitForEvents(1, &event));
+    best = std::min(best, event_us(event));
+    CL_CHECK(clReleaseEvent(event));
+  }
+  return best;
+}
+
+void Thneed::profile(int runs, const char *trace_path) {
+  assert(runs > 0);
+  cl_command_queue queue = profiling_queue(context, device_id);
+
+  // the first run builds the kernels of a loaded thneed and warms up the caches
+  for (auto &k : kq) CL_CHECK(k->exec(queue));
+  CL_CHECK(clFinish(queue));
+
+  struct KernelStats {
+    string name, global_work_size, local_work_size;
+    int count = 0;
+    double total_us = 0, max_us = 0;
+  };
+  map<string, KernelStats> stats;  // by name and work sizes
+  Json::array trace;
+  cl_ulong trace_start = 0;
+  double gpu_total_us = 0, wall_total_us = 0;
+
+  vector<cl_event> events(kq.size());
+  for (int run = 0; run < runs; run++) {
+    for (int i = 0; i < kq.size(); i++) {
+      CL_CHECK(kq[i]->exec(queue, &events[i]));
+    }
+    CL_CHECK(clFinish(queue));
+
+    cl_ulong run_start = 0, run_end = 0;
+    for (int i = 0; i < kq.size(); i++) {
+      cl_ulong start, end;
+      CL_CHECK(clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL));
+      CL_CHECK(clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL));
+      CL_CHECK(clReleaseEvent(events[i]));
+      if (trace_start == 0) trace_start = start;
+      if (i == 0) run_start = start;
+      run_end = end;
+
+      const CLQueuedKernel &k = *kq[i];
+      const string gws = work_size_str(k.work_dim, k.global_work_size), lws = work_size_str(k.work_dim, k.local_work_size);
+      KernelStats &s = stats[k.name + " " + gws + " " + lws];
+      const double us = (end - start) / 1e3;
+      s.name = k.name;
+      s.global_work_size = gws;
+      s.local_work_size = lws;
+      s.count++;
+      s.total_us += us;
+      s.max_us = std::max(s.max_us, us);
+      gpu_total_us += us;
+
+      if (trace_path) {
+        trace.push_back(Json::object({
+          {"name", k.name}, {"ph", "X"}, {"pid", 0}, {"tid", run},
+          {"ts", (start - trace_start) / 1e3}, {"dur", us},
+          {"args", Json::object({{"index", i}, {"global_work_size", gws}, {"local_work_size", lws}})},
+        }));
+      }
+    }
+    wall_total_us += (run_end - run_start) / 1e3;
+  }
+  CL_CHECK(clReleaseCommandQueue(queue));
+
+  vector<KernelStats> sorted;
+  for (auto &it : stats) sorted.push_back(it.second);
+  std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) { return a.total_us > b.total_us; });
+
+  printf("%zu kernels, %.2f ms per run on the GPU, %.2f ms from the first start to the last end, over %d runs\n",
+         kq.size(), gpu_total_us / 1e3 / runs, wall_total_us / 1e3 / runs, runs);
+  printf("%7s %6s %5s %8s %8s  %-56s %-16s %s\n", "ms/run", "share", "count", "avg us", "max us", "kernel", "global", "local");
+  double cumulative = 0;
+  for (auto &s : sorted) {
+    cumulative += s.total_us;
+    printf("%7.3f %5.1f%% %5d %8.1f %8.1f  %-56s %-16s %s\n", s.total_us / 1e3 / runs, 100. * cumulative / gpu_total_us,
+           s.count / runs, s.total_us / s.count, s.max_us, s.name.c_str(), s.global_work_size.c_str(), s.local_work_size.c_str());
+  }
+
+  if (trace_path) {
+    // chrome://tracing or ui.perfetto.dev, one row per run
+    std::ofstream f(trace_path);
+    f << Json(Json::object({{"traceEvents", trace}, {"displayTimeUnit", "ns"}})).dump();
+    printf("wrote the trace of %zu kernel runs to %s\n", trace.size(), trace_path);
+  }
+}
+
+void Thneed::autotune(int runs) {
+  cl_command_queue queue = profiling_queue(context, device_id);
+
+  // the output with the recorded work sizes, new ones have to give the same
+  assert(output != NULL);
+  size_t output_size;
+  CL_CHECK(clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(output_size), &output_size, NULL));
+  vector<float> expected(output_size / sizeof(float)), got(expected.size());
+  auto run_graph = [&](vector<float> &out) {
+    for (auto &k : kq) CL_CHECK(k->exec(queue));
+    CL_CHECK(clFinish(queue));
+    CL_CHECK(clEnqueueReadBuffer(command_queue, output, CL_TRUE, 0, output_size, out.data(), 0, NULL, NULL));
+  };
+  run_graph(expected);
+
+  double before_us = 0, after_us = 0;
+  int changed = 0;
+  for (auto &k : kq) {
+    size_t max_group_size;
+    CL_CHECK(clGetKernelWorkGroupInfo(k->kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, NULL));
+
+    // powers of two that divide the global work size, in every dimension
+    vector<vector<size_t>> dim_sizes(k->work_dim);
+    for (int d = 0; d < k->work_dim; d++) {
+      for (size_t s = 1; s <= max_group_size; s *= 2) {
+        if (k->global_work_size[d] % s == 0) dim_sizes[d].push_back(s);
+      }
+    }
+
+    size_t recorded[3], best[3];
+    std::copy_n(k->local_work_size, 3, recorded);
+    std::copy_n(k->local_work_size, 3, best);
+    const double recorded_us = kernel_us(queue, *k, runs);
+    assert(recorded_us >= 0);
+    double best_us = recorded_us;
+
+    vector<size_t> idx(k->work_dim, 0);
+    while (true) {
+      size_t group_size = 1;
+      for (int d = 0; d < k->work_dim; d++) {
+        k->local_work_size[d] = dim_sizes[d][idx[d]];
+        group_size *= k->local_work_size[d];
+      }
+      if (group_size <= max_group_size) {
+        // kernels that can't run with a size fail to enqueue
+        const double us = kernel_us(queue, *k, runs);
+        if (us >= 0 && us < best_us) {
+          best_us = us;
+          std::copy_n(k->local_work_size, 3, best);
+        }
+      }
+
+      int d = 0;
+      while (d < k->work_dim && ++idx[d] == dim_sizes[d].size()) idx[d++] = 0;
+      if (d == k->work_dim) break;
+    }
+
+    // small gains are noise, and kernels written for their work size give other results with another
+    std::copy_n(best, 3, k->local_work_size);
+    bool keep = best_us < recorded_us * 0.95;
+    if (keep) {
+      run_graph(got);
+      for (int i = 0; keep && i < got.size(); i++) {
+        keep = std::abs(got[i] - expected[i]) <= 1e-2 * (1 + std::abs(expected[i]));
+      }
+    }
+    if (keep) {
+      changed++;
+    } else {
+      std::copy_n(recorded, 3, k->local_work_size);
+      best_us = recorded_us;
+    }
+    before_us += recorded_us;
+    after_us += best_us;
+  }
+  CL_CHECK(clReleaseCommandQueue(queue));
+
+  printf("Thneed::autotune: new local work sizes for %d of %zu kernels, %.2f ms -> %.2f ms of kernel time\n",
+         changed, kq.size(), before_us / 1e3, after_us / 1e3);
+}
@@ -1,4 +1,11 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cassert>
+#include <algorithm>
+#include <cstring>
 #include <set>
 
 #include "json11.hpp"
@@ -7,26 +14,74 @@ using namespace json11;
 
 extern map<cl_program, string> g_program_source;
 
+// Files start with this header, then the json of the kernels and objects. The weights and program
+// binaries follow at data_offset, each one at an offset from there aligned to THNEED_ALIGN, so they
+// can be uploaded straight from the mapped file. Files without it are the old format: the json size,
+// the json and the blobs back to back
+#define THNEED_MAGIC "THNB"
+#define THNEED_VERSION 1
+#define THNEED_ALIGN 0x1000
+
+struct ThneedFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t json_size;
+  uint32_t data_offset;
+};
+
+static size_t thneed_align(size_t sz) {
+  return (sz + THNEED_ALIGN - 1) & ~(size_t)(THNEED_ALIGN - 1);
+}
+
 void Thneed::load(const char *filename) {
   printf("Thneed::load: loading from %s\n", filename);
 
-  FILE *f = fopen(filename, "rb");
-  fseek(f, 0L, SEEK_END);
-  int sz = ftell(f);
-  fseek(f, 0L, SEEK_SET);
-  char *buf = (char*)malloc(sz);
-  fread(buf, 1, sz, f);
-  fclose(f);
-
-  int jsz = *(int *)buf;
-  string jj(buf+4, jsz);
+  // the weights are only read once, by the copies into the CL buffers, so the pages of the mapping
+  // are never more than page cache
+  int fd = open(filename, O_RDONLY);
+  assert(fd >= 0);
+  struct stat st;
+  assert(fstat(fd, &st) == 0);
+  size_t sz = st.st_size;
+  char *buf = (char *)mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(buf != MAP_FAILED);
+  close(fd);
+  madvise(buf, sz, MADV_SEQUENTIAL);
+
+  string jj;
+  size_t ptr, data_offset = 0;
+  if (sz >= sizeof(ThneedFileHeader) && memcmp(buf, THNEED_MAGIC, 4) == 0) {
+    const ThneedFileHeader *hdr = (const ThneedFileHeader *)buf;
+    assert(hdr->version == THNEED_VERSION);
+    jj = string(buf + sizeof(ThneedFileHeader), hdr->json_size);
+    ptr = data_offset = hdr->data_offset;
+  } else {
+    int jsz = *(int *)buf;
+    jj = string(buf+4, jsz);
+    ptr = 4+jsz;
+  }
   string err;
   Json jdat = Json::parse(jj, err);
 
+  // the next blob of len bytes, at its offset in the new format
+  auto next_blob = [&](const Json &obj, size_t len) {
+    if (obj["offset"].is_number()) ptr = data_offset + obj["offset"].int_value();
+    const char *ret = &buf[ptr];
+    ptr += len;
+    assert(ptr <= sz);
+    return ret;
+  };
+
   map<cl_mem, cl_mem> real_mem;
   real_mem[NULL] = NULL;
 
-  int ptr = 4+jsz;
+  // the buffers shared by intermediates that are never live at the same time
+  vector<cl_mem> slots;
+  for (auto &slot : jdat["slots"].array_items()) {
+    slots.push_back(clCreateBuffer(context, CL_MEM_READ_WRITE, slot.int_value(), NULL, NULL));
+    assert(slots.back() != NULL);
+  }
+
   for (auto &obj : jdat["objects"].array_items()) {
     auto mobj = obj.object_items();
     int sz = mobj["size"].int_value();
@@ -39,8 +94,9 @@ void Thneed::load(const char *filename) {
     } else {
       if (mobj["needs_load"].bool_value()) {
         //printf("loading %p %d @ 0x%X\n", clbuf, sz, ptr);
-        clbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_WRITE, sz, &buf[ptr], NULL);
-        ptr += sz;
+        clbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_WRITE, sz, (void *)next_blob(obj, sz), NULL);
+      } else if (mobj["slot"].is_number()) {
+        clbuf = slots[mobj["slot"].int_value()];
       } else {
         clbuf = clCreateBuffer(context, CL_MEM_READ_WRITE, sz, NULL, NULL);
       }
@@ -93,8 +149,7 @@ void Thneed::load(const char *filename) {
     string name = obj["name"].string_value();
     size_t length = obj["length"].int_value();
     const unsigned char *srcs[1];
-    srcs[0] = (const unsigned char *)&buf[ptr];
-    ptr += length;
+    srcs[0] = (const unsigned char *)next_blob(obj, length);
 
     if (record & THNEED_DEBUG) printf("binary %s with size %zu\n", name.c_str(), length);
 
@@ -135,8 +190,87 @@ void Thneed::load(const char *filename) {
     kq.push_back(kk);
   }
 
-  free(buf);
   clFinish(command_queue);
+  munmap(buf, sz);
+}
+
+// Intermediates only live from the first to the last kernel using them, the ones that are never live at
+// the same time get the same slot, one buffer at load. The weights, the inputs and the outputs, filled and
+// read between runs, keep their own. Images count as their buffer. Returns the slot sizes
+vector<Json> Thneed::plan_slots(vector<Json> &objects, const map<string, string> &image_buffers) {
+  map<string, pair<int, int>> live;  // first and last kernel
+  set<string> pinned;
+  for (int i = 0; i < kq.size(); i++) {
+    auto &k = kq[i];
+    for (int j = 0; j < k->num_args; j++) {
+      const string &a = k->args[j];
+      if (a.size() != 8 || *(cl_mem*)a.data() == NULL) continue;
+      auto it = image_buffers.find(a);
+      const string &storage = it != image_buffers.end() ? it->second : a;
+
+      if (k->arg_names[j] == "weights" || k->arg_names[j] == "biases" ||
+          (k->name == "zero_pad_image_float" && k->arg_names[j] == "input") ||
+          (k->name == "image2d_to_buffer_float" && k->arg_names[j] == "output")) {
+        pinned.insert(storage);
+      }
+      auto lt = live.find(storage);
+      if (lt == live.end()) {
+        live[storage] = {i, i};
+      } else {
+        lt->second.second = i;
+      }
+    }
+  }
+
+  struct Interval {
+    int first, last, size;
+    Json *obj;
+  };
+  vector<Interval> intervals;
+  for (auto &obj : objects) {
+    const string id = obj["id"].string_value();
+    if (obj["arg_type"] == "image2d_t" || obj["arg_type"] == "image1d_t" || obj["needs_load"].bool_value() ||
+        pinned.count(id) || !live.count(id)) continue;
+    intervals.push_back({live[id].first, live[id].second, obj["size"].int_value(), &obj});
+  }
+  std::sort(intervals.begin(), intervals.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
+  // first fit by size: the smallest free slot that's big enough, else the biggest free one grows
+  struct Slot {
+    int size, last;
+  };
+  vector<Slot> slots;
+  size_t before = 0, after = 0;
+  for (auto &in : intervals) {
+    int best = -1;
+    for (int s = 0; s < slots.size(); s++) {
+      if (slots[s].last >= in.first) continue;
+      const bool fits = slots[s].size >= in.size;
+      if (best == -1 || (fits && (slots[best].size < in.size || slots[s].size < slots[best].size)) ||
+          (!fits && slots[best].size < in.size && slots[s].size > slots[best].size)) {
+        best = s;
+      }
+    }
+    if (best == -1) {
+      best = slots.size();
+      slots.push_back({0, 0});
+    }
+    slots[best].size = std::max(slots[best].size, in.size);
+    slots[best].last = in.last;
+    before += in.size;
+
+    auto mobj = in.obj->object_items();
+    mobj["slot"] = best;
+    *in.obj = mobj;
+  }
+
+  vector<Json> ret;
+  for (auto &s : slots) {
+    ret.push_back(s.size);
+    after += s.size;
+  }
+  printf("Thneed::save: %zu intermediates in %zu slots, %.1f MB -> %.1f MB\n", intervals.size(), slots.size(), before / 1e6, after / 1e6);
+  return ret;
 }
 
 void Thneed::save(const char *filename, bool save_binaries) {
@@ -148,6 +282,7 @@ void Thneed::save(const char *filename, bool save_binaries) {
   std::vector<Json> objects;
   std::map<string, string> programs;
   std::map<string, string> binaries;
+  std::map<string, string> image_buffers;
 
   for (auto &k : kq) {
     kernels.push_back(k->to_json());
@@ -172,6 +307,7 @@ void Thneed::save(const char *filename, bool save_binaries) {
               clGetImageInfo(val, CL_IMAGE_BUFFER, sizeof(buf), &buf, NULL);
               string aa = string((char *)&buf, sizeof(buf));
               jj["buffer_id"] = aa;
+              image_buffers[a] = aa;
 
               size_t width, height, row_pitch;
               clGetImageInfo(val, CL_IMAGE_WIDTH, sizeof(width), &width, NULL);
@@ -228,7 +364,20 @@ void Thneed::save(const char *filename, bool save_binaries) {
     }
   }
 
+  vector<Json> slots = plan_slots(objects, image_buffers);
+
+  // offsets of the blobs from data_offset, in the order they're saved
   vector<string> saved_buffers;
+  vector<size_t> saved_offsets;
+  size_t data_size = 0;
+  auto add_blob = [&](string blob) {
+    data_size = thneed_align(data_size);
+    saved_offsets.push_back(data_size);
+    data_size += blob.size();
+    saved_buffers.push_back(std::move(blob));
+    return (int)saved_offsets.back();
+  };
+
   for (auto &obj : objects) {
     auto mobj = obj.object_items();
     cl_mem val = *(cl_mem*)(mobj["id"].string_value().data());
@@ -247,15 +396,16 @@ void Thneed::save(const char *filename, bool save_binaries) {
         assert(ret == CL_SUCCESS);
       }
       //printf("saving buffer: %d %p %s\n", sz, buf, mobj["arg_type"].string_value().c_str());
-      saved_buffers.push_back(string(buf, sz));
+      mobj["offset"] = add_blob(string(buf, sz));
+      obj = mobj;
       free(buf);
     }
   }
 
   std::vector<Json> jbinaries;
   for (auto &obj : binaries) {
-    jbinaries.push_back(Json::object({{"name", obj.first}, {"length", (int)obj.second.size()}}));
-    saved_buffers.push_back(obj.second);
+    int offset = add_blob(obj.second);
+    jbinaries.push_back(Json::object({{"name", obj.first}, {"length", (int)obj.second.size()}, {"offset", offset}}));
   }
 
   Json jdat = Json::object({
@@ -263,16 +413,26 @@ void Thneed::save(const char *filename, bool save_binaries) {
     {"objects", objects},
     {"programs", programs},
     {"binaries", jbinaries},
+    {"slots", slots},
   });
 
   string str = jdat.dump();
-  int jsz = str.length();
+
+  ThneedFileHeader hdr;
+  memcpy(hdr.magic, THNEED_MAGIC, sizeof(hdr.magic));
+  hdr.version = THNEED_VERSION;
+  hdr.json_size = str.length();
+  hdr.data_offset = thneed_align(sizeof(hdr) + str.length());
 
   FILE *f = fopen(filename, "wb");
-  fwrite(&jsz, 1, sizeof(jsz), f);
-  fwrite(str.data(), 1, jsz, f);
-  for (auto &s : saved_buffers) {
-    fwrite(s.data(), 1, s.length(), f);
+  fwrite(&hdr, 1, sizeof(hdr), f);
+  fwrite(str.data(), 1, str.length(), f);
+  size_t pos = sizeof(hdr) + str.length();
+  for (int i = 0; i < saved_buffers.size(); i++) {
+    // zero padding up to the aligned offset of the blob
+    for (; pos < hdr.data_offset + saved_offsets[i]; pos++) fputc(0, f);
+    fwrite(saved_buffers[i].data(), 1, saved_buffers[i].length(), f);
+    pos += saved_buffers[i].length();
   }
   fclose(f);
 }
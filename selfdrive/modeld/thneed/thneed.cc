@@ -21,6 +21,14 @@ map<pair<cl_kernel, int>, string> g_args;
 map<pair<cl_kernel, int>, int> g_args_size;
 map<cl_program, string> g_program_source;
 
+// 4 elements per work item, the model inputs are multiples of 16 bytes
+static const char *half_to_float_src = R"(
+__kernel void half_to_float(__global const half *in, __global float *out) {
+  const int i = get_global_id(0);
+  vstore4(vload_half4(i, in), i, out);
+}
+)";
+
 void hexdump(uint32_t *d, int len) {
   assert((len%4) == 0);
   printf("  dumping %p len 0x%x\n", d, len);
@@ -216,16 +224,20 @@ void CachedCommand::exec() {
 
 // *********** Thneed ***********
 
-Thneed::Thneed(bool do_clinit) {
-  if (do_clinit) clinit();
+Thneed::Thneed(bool do_clinit, cl_context _context, shared_ptr<GPUMalloc> _ram) {
+  if (do_clinit) clinit(_context);
   assert(g_fd != -1);
   fd = g_fd;
-  ram = make_unique<GPUMalloc>(0x80000, fd);
+  ram = _ram ? _ram : make_shared<GPUMalloc>(0x80000, fd);
   record = THNEED_RECORD;
   timestamp = -1;
   g_thneed = this;
 }
 
+void Thneed::make_current() {
+  g_thneed = this;
+}
+
 void Thneed::stop() {
   find_inputs_outputs();
   printf("Thneed::stop: recorded %lu commands\n", cmds.size());
@@ -249,6 +261,7 @@ void Thneed::find_inputs_outputs() {
         void *ret = clEnqueueMapBuffer(command_queue, aa, CL_TRUE, CL_MAP_WRITE, 0, sz, 0, NULL, NULL, &err);
         assert(err == CL_SUCCESS);
         inputs.push_back(ret);
+        input_clmem.push_back(aa);
       }
 
       if (k->name == "image2d_to_buffer_float" && k->arg_names[i] == "output") {
@@ -261,12 +274,47 @@ void Thneed::find_inputs_outputs() {
 void Thneed::copy_inputs(float **finputs) {
   //cl_int ret;
   for (int idx = 0; idx < inputs.size(); ++idx) {
+    if (finputs[idx] == NULL) continue;
     if (record & THNEED_DEBUG) printf("copying %lu -- %p -> %p\n", input_sizes[idx], finputs[idx], inputs[idx]);
     memcpy(inputs[idx], finputs[idx], input_sizes[idx]);
   }
 }
 
+void Thneed::copy_input(int idx, cl_mem input, bool half) {
+  // the input stays mapped, the GPU writes it like the memcpy of copy_inputs would
+  size_t sz;
+  CL_CHECK(clGetMemObjectInfo(input, CL_MEM_SIZE, sizeof(sz), &sz, NULL));
+  assert(sz >= (half ? input_sizes[idx] / 2 : input_sizes[idx]));
+  if (record & THNEED_DEBUG) printf("copying %lu -- %p -> %p on the GPU%s\n", input_sizes[idx], input, input_clmem[idx], half ? " from fp16" : "");
+  if (half) {
+    assert(input_sizes[idx] % (4 * sizeof(float)) == 0);
+    if (half_to_float == NULL) {
+      cl_program prg = cl_program_from_source(context, device_id, half_to_float_src, "");
+      half_to_float = CL_CHECK_ERR(clCreateKernel(prg, "half_to_float", &err));
+      CL_CHECK(clReleaseProgram(prg));
+    }
+    CL_CHECK(clSetKernelArg(half_to_float, 0, sizeof(cl_mem), &input));
+    CL_CHECK(clSetKernelArg(half_to_float, 1, sizeof(cl_mem), &input_clmem[idx]));
+    const size_t work_size = input_sizes[idx] / (4 * sizeof(float));
+    CL_CHECK(clEnqueueNDRangeKernel(command_queue, half_to_float, 1, NULL, &work_size, NULL, 0, NULL, NULL));
+  } else {
+    CL_CHECK(clEnqueueCopyBuffer(command_queue, input, input_clmem[idx], 0, 0, input_sizes[idx], 0, NULL, NULL));
+  }
+  CL_CHECK(clFinish(command_queue));
+}
+
+void Thneed::copy_output_to_input(int idx, size_t offset) {
+  assert(output != NULL);
+  size_t sz;
+  CL_CHECK(clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(sz), &sz, NULL));
+  assert(offset * sizeof(float) + input_sizes[idx] <= sz);
+  if (record & THNEED_DEBUG) printf("copying %lu from output %p + %lu -> %p on the GPU\n", input_sizes[idx], output, offset, input_clmem[idx]);
+  CL_CHECK(clEnqueueCopyBuffer(command_queue, output, input_clmem[idx], offset * sizeof(float), 0, input_sizes[idx], 0, NULL, NULL));
+  CL_CHECK(clFinish(command_queue));
+}
+
 void Thneed::copy_output(float *foutput) {
+  if (foutput == NULL) return;
   if (output != NULL) {
     size_t sz;
     clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
@@ -277,10 +325,25 @@ void Thneed::copy_output(float *foutput) {
   }
 }
 
+const float *Thneed::output_buffer() {
+  assert(output != NULL);
+  if (output_mapped == NULL) {
+    // kept mapped like the inputs, the GPU writes it in place
+    size_t sz;
+    CL_CHECK(clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(sz), &sz, NULL));
+    output_mapped = CL_CHECK_ERR(clEnqueueMapBuffer(command_queue, output, CL_TRUE, CL_MAP_READ, 0, sz, 0, NULL, NULL, &err));
+  }
+  return (const float *)output_mapped;
+}
+
 void Thneed::wait() {
+  wait(timestamp);
+}
+
+void Thneed::wait(int until_timestamp) {
   struct kgsl_device_waittimestamp_ctxtid wait;
   wait.context_id = context_id;
-  wait.timestamp = timestamp;
+  wait.timestamp = until_timestamp;
   wait.timeout = -1;
 
   uint64_t tb = nanos_since_boot();
@@ -298,22 +361,7 @@ void Thneed::execute(float **finputs, float *foutput, bool slow) {
   copy_inputs(finputs);
 
   // ****** set power constraint
-  int ret;
-  struct kgsl_device_constraint_pwrlevel pwrlevel;
-  pwrlevel.level = KGSL_CONSTRAINT_PWR_MAX;
-
-  struct kgsl_device_constraint constraint;
-  constraint.type = KGSL_CONSTRAINT_PWRLEVEL;
-  constraint.context_id = context_id;
-  constraint.data = (void*)&pwrlevel;
-  constraint.size = sizeof(pwrlevel);
-
-  struct kgsl_device_getproperty prop;
-  prop.type = KGSL_PROP_PWR_CONSTRAINT;
-  prop.value = (void*)&constraint;
-  prop.sizebytes = sizeof(constraint);
-  ret = ioctl(fd, IOCTL_KGSL_SETPROPERTY, &prop);
-  assert(ret == 0);
+  set_power_constraint(true);
 
   // ****** run commands
   int i = 0;
@@ -328,12 +376,7 @@ void Thneed::execute(float **finputs, float *foutput, bool slow) {
   copy_output(foutput);
 
   // ****** unset power constraint
-  constraint.type = KGSL_CONSTRAINT_NONE;
-  constraint.data = NULL;
-  constraint.size = 0;
-
-  ret = ioctl(fd, IOCTL_KGSL_SETPROPERTY, &prop);
-  assert(ret == 0);
+  set_power_constraint(false);
 
   if (record & THNEED_DEBUG) {
     te = nanos_since_boot();
@@ -341,9 +384,89 @@ void Thneed::execute(float **finputs, float *foutput, bool slow) {
   }
 }
 
-void Thneed::clinit() {
-  device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
-  context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+int Thneed::execute_async(float **finputs) {
+  copy_inputs(finputs);
+  set_power_constraint(true);
+  for (auto &it : cmds) it->exec();
+  return timestamp;
+}
+
+void Thneed::finish(int until_timestamp, float *foutput) {
+  wait(until_timestamp);
+  copy_output(foutput);
+  set_power_constraint(false);
+}
+
+void Thneed::set_power_constraint(bool max) {
+  struct kgsl_device_constraint_pwrlevel pwrlevel;
+  pwrlevel.level = KGSL_CONSTRAINT_PWR_MAX;
+
+  struct kgsl_device_constraint constraint;
+  if (max) {
+    constraint.type = KGSL_CONSTRAINT_PWRLEVEL;
+    constraint.data = (void*)&pwrlevel;
+    constraint.size = sizeof(pwrlevel);
+  } else {
+    constraint.type = KGSL_CONSTRAINT_NONE;
+    constraint.data = NULL;
+    constraint.size = 0;
+  }
+  constraint.context_id = context_id;
+
+  struct kgsl_device_getproperty prop;
+  prop.type = KGSL_PROP_PWR_CONSTRAINT;
+  prop.value = (void*)&constraint;
+  prop.sizebytes = sizeof(constraint);
+  int ret = ioctl(fd, IOCTL_KGSL_SETPROPERTY, &prop);
+  assert(ret == 0);
+}
+
+// *********** ThneedScheduler ***********
+
+void ThneedScheduler::add(Thneed *thneed, int priority) {
+  std::lock_guard lk(lock);
+  priorities[thneed] = priority;
+}
+
+void ThneedScheduler::submit(Thneed *thneed, float **finputs, float *foutput) {
+  std::lock_guard lk(lock);
+  assert(priorities.find(thneed) != priorities.end());
+  runs.push_back({thneed, priorities[thneed], finputs, foutput});
+}
+
+bool ThneedScheduler::run_next() {
+  Run run;
+  {
+    std::lock_guard lk(lock);
+    if (runs.empty()) return false;
+    // first of the most important, runs of the same priority stay in order
+    auto it = runs.begin();
+    for (auto jt = runs.begin(); jt != runs.end(); ++jt) {
+      if (jt->priority < it->priority) it = jt;
+    }
+    run = *it;
+    runs.erase(it);
+  }
+  int until_timestamp = run.thneed->execute_async(run.finputs);
+  run.thneed->finish(until_timestamp, run.foutput);
+  return true;
+}
+
+int ThneedScheduler::run_pending() {
+  int cnt = 0;
+  while (run_next()) cnt++;
+  return cnt;
+}
+
+void Thneed::clinit(cl_context _context) {
+  if (_context != NULL) {
+    context = _context;
+    CL_CHECK(clRetainContext(context));
+    CL_CHECK(clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(device_id), &device_id, NULL));
+  } else {
+    device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+    context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  }
   //cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
   cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, 0, 0};
   command_queue = CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
@@ -496,7 +619,7 @@ int CLQueuedKernel::get_arg_num(const char *search_arg_name) {
   assert(false);
 }
 
-cl_int CLQueuedKernel::exec() {
+cl_int CLQueuedKernel::exec(cl_command_queue queue, cl_event *event) {
   if (kernel == NULL) {
     kernel = clCreateKernel(program, name.c_str(), NULL);
     arg_names.clear();
@@ -524,8 +647,8 @@ cl_int CLQueuedKernel::exec() {
     debug_print(thneed->record & THNEED_VERBOSE_DEBUG);
   }
 
-  return clEnqueueNDRangeKernel(thneed->command_queue,
-    kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+  return clEnqueueNDRangeKernel(queue ? queue : thneed->command_queue,
+    kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, event);
 }
 
 void CLQueuedKernel::debug_print(bool verbose) {
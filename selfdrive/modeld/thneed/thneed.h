@@ -6,7 +6,9 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -43,7 +45,8 @@ class CLQueuedKernel {
                    cl_uint _work_dim,
                    const size_t *_global_work_size,
                    const size_t *_local_work_size);
-    cl_int exec();
+    // on the thneed's queue if queue is NULL, event is for a profiling queue
+    cl_int exec(cl_command_queue queue=NULL, cl_event *event=NULL);
     void debug_print(bool verbose);
     int get_arg_num(const char *search_arg_name);
     cl_program program;
@@ -92,15 +95,41 @@ class CachedCommand: public CachedIoctl {
 
 class Thneed {
   public:
-    Thneed(bool do_clinit=false);
+    // clinit uses the context if there is one, so its buffers can be copied into the inputs.
+    // Thneeds loaded into one context can share the arena of their recorded commands
+    Thneed(bool do_clinit=false, cl_context _context=NULL, shared_ptr<GPUMalloc> _ram=nullptr);
+    // the ioctls of the process are recorded into, and debug printed for, the current thneed, the
+    // last one created. With several make the one about to record current first
+    void make_current();
     void stop();
     void execute(float **finputs, float *foutput, bool slow=false);
     void wait();
+    void wait(int until_timestamp);
+
+    // The recorded commands have the GPU addresses of the inputs and the output built in, so they can't
+    // be pointed at other buffers. Instead the buffers stay mapped for the lifetime of the thneed and
+    // callers fill and read them in place, passing NULL in finputs and foutput to skip the copies
+    float *input_buffer(int idx) { return (float *)inputs[idx]; }
+    const float *output_buffer();
+    // submits the commands without waiting and returns the timestamp of the last one, for finish
+    int execute_async(float **finputs);
+    // waits for the commands of execute_async, then copies the output unless foutput is NULL
+    void finish(int until_timestamp, float *foutput);
     int optimize();
+    // runs kq on a queue with CL_QUEUE_PROFILING_ENABLE, then prints the GPU time of the kernels by name
+    // and work sizes, the most expensive first. With trace_path also writes every kernel of every run
+    // there as a Chrome trace
+    void profile(int runs, const char *trace_path=NULL);
+    // for every kernel of kq, times each local work size of powers of two that divide its global work
+    // size and keeps the fastest, if it's clearly faster and the output stays the same. save() then
+    // stores them. Times the kernels alone, the best of runs
+    void autotune(int runs=5);
 
     vector<void *> inputs;
+    vector<cl_mem> input_clmem;
     vector<size_t> input_sizes;
     cl_mem output = NULL;
+    void *output_mapped = NULL;
 
     cl_context context = NULL;
     cl_command_queue command_queue;
@@ -110,13 +139,19 @@ class Thneed {
     // protected?
     int record;
     int timestamp;
-    unique_ptr<GPUMalloc> ram;
+    shared_ptr<GPUMalloc> ram;
     vector<unique_ptr<CachedIoctl> > cmds;
     int fd;
 
     // all CL kernels
     void find_inputs_outputs();
+    // inputs that are NULL are left as they are, e.g. filled by copy_input
     void copy_inputs(float **finputs);
+    // copies a buffer of the thneed's context into input idx on the GPU, half converts it from fp16
+    void copy_input(int idx, cl_mem input, bool half=false);
+    // copies the output from float offset on into input idx on the GPU, for a recurrent state the model
+    // reads back. It doesn't go through the host, pass NULL for the input in finputs then
+    void copy_output_to_input(int idx, size_t offset);
     void copy_output(float *foutput);
     cl_int clexec();
     vector<shared_ptr<CLQueuedKernel> > kq;
@@ -128,6 +163,35 @@ class Thneed {
     void load(const char *filename);
     void save(const char *filename, bool save_binaries=false);
   private:
-    void clinit();
+    vector<json11::Json> plan_slots(vector<json11::Json> &objects, const map<string, string> &image_buffers);
+    void clinit(cl_context _context);
+    // KGSL_CONSTRAINT_PWR_MAX while the commands run
+    void set_power_constraint(bool max);
+    // for copy_input of fp16 buffers, built the first time it's needed
+    cl_kernel half_to_float = NULL;
 };
 
+// Runs several thneeds of one context one at a time, so the commands of different graphs never
+// interleave on the GPU. The pending run with the lowest priority goes first and the queue is checked
+// again after every run, a lower priority graph like dmonitoring next to driving only gets the GPU
+// when nothing more important is waiting
+class ThneedScheduler {
+  public:
+    void add(Thneed *thneed, int priority);
+    // queues a run of an added thneed, finputs and foutput have to stay valid until it's done
+    void submit(Thneed *thneed, float **finputs, float *foutput);
+    // runs the most important pending run, false if there was none
+    bool run_next();
+    // runs until nothing is pending, returns the number of runs
+    int run_pending();
+  private:
+    struct Run {
+      Thneed *thneed;
+      int priority;
+      float **finputs;
+      float *foutput;
+    };
+    map<Thneed *, int> priorities;
+    vector<Run> runs;
+    mutex lock;
+};
@@ -10,6 +10,8 @@ void transform_init(Transform* s, cl_context ctx, cl_device_id device_id) {
 
   cl_program prg = cl_program_from_file(ctx, device_id, "transforms/transform.cl", "");
   s->krnl = CL_CHECK_ERR(clCreateKernel(prg, "warpPerspective", &err));
+  s->tensor_krnl = CL_CHECK_ERR(clCreateKernel(prg, "warpPerspectiveTensor", &err));
+  s->tensor_half_krnl = CL_CHECK_ERR(clCreateKernel(prg, "warpPerspectiveTensorHalf", &err));
   // done with this
   CL_CHECK(clReleaseProgram(prg));
 
@@ -21,6 +23,8 @@ void transform_destroy(Transform* s) {
   CL_CHECK(clReleaseMemObject(s->m_y_cl));
   CL_CHECK(clReleaseMemObject(s->m_uv_cl));
   CL_CHECK(clReleaseKernel(s->krnl));
+  CL_CHECK(clReleaseKernel(s->tensor_krnl));
+  CL_CHECK(clReleaseKernel(s->tensor_half_krnl));
 }
 
 void transform_queue(Transform* s,
@@ -93,3 +97,31 @@ void transform_queue(Transform* s,
   CL_CHECK(clEnqueueNDRangeKernel(q, s->krnl, 2, NULL,
                               (const size_t*)&work_size_uv, NULL, 0, 0, NULL));
 }
+
+void transform_tensor_queue(Transform* s,
+                            cl_command_queue q,
+                            cl_mem in_yuv, int in_width, int in_height,
+                            cl_mem out, int out_width, int out_height,
+                            const mat3& projection, bool half, float offset, float scale) {
+  cl_kernel krnl = half ? s->tensor_half_krnl : s->tensor_krnl;
+  mat3 projection_uv = transform_scale_buffer(projection, 0.5);
+
+  CL_CHECK(clEnqueueWriteBuffer(q, s->m_y_cl, CL_TRUE, 0, 3*3*sizeof(float), (void*)projection.v, 0, NULL, NULL));
+  CL_CHECK(clEnqueueWriteBuffer(q, s->m_uv_cl, CL_TRUE, 0, 3*3*sizeof(float), (void*)projection_uv.v, 0, NULL, NULL));
+
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), &in_yuv));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_int), &in_width));
+  CL_CHECK(clSetKernelArg(krnl, 2, sizeof(cl_int), &in_height));
+  CL_CHECK(clSetKernelArg(krnl, 3, sizeof(cl_mem), &out));
+  CL_CHECK(clSetKernelArg(krnl, 4, sizeof(cl_int), &out_width));
+  CL_CHECK(clSetKernelArg(krnl, 5, sizeof(cl_int), &out_height));
+  CL_CHECK(clSetKernelArg(krnl, 6, sizeof(cl_mem), &s->m_y_cl));
+  CL_CHECK(clSetKernelArg(krnl, 7, sizeof(cl_mem), &s->m_uv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 8, sizeof(cl_float), &offset));
+  CL_CHECK(clSetKernelArg(krnl, 9, sizeof(cl_float), &scale));
+
+  // one work item per 2x2 block of Y
+  const size_t work_size[2] = {(size_t)out_width/2, (size_t)out_height/2};
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL,
+                                  (const size_t*)&work_size, NULL, 0, 0, NULL));
+}
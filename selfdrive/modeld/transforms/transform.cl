@@ -5,6 +5,44 @@
 #define INTER_REMAP_COEF_BITS 15
 #define INTER_REMAP_COEF_SCALE (1 << INTER_REMAP_COEF_BITS)
 
+// bilinear sample of the plane at the projection of (dx, dy)
+inline uchar warp_sample(__global const uchar * src,
+                         int src_step, int src_offset, int src_rows, int src_cols,
+                         __constant float * M, int dx, int dy)
+{
+    float X0 = M[0] * dx + M[1] * dy + M[2];
+    float Y0 = M[3] * dx + M[4] * dy + M[5];
+    float W = M[6] * dx + M[7] * dy + M[8];
+    W = W != 0.0f ? INTER_TAB_SIZE / W : 0.0f;
+    int X = rint(X0 * W), Y = rint(Y0 * W);
+
+    short sx = convert_short_sat(X >> INTER_BITS);
+    short sy = convert_short_sat(Y >> INTER_BITS);
+    short ay = (short)(Y & (INTER_TAB_SIZE - 1));
+    short ax = (short)(X & (INTER_TAB_SIZE - 1));
+
+    int v0 = (sx >= 0 && sx < src_cols && sy >= 0 && sy < src_rows) ?
+        convert_int(src[mad24(sy, src_step, src_offset + sx)]) : 0;
+    int v1 = (sx+1 >= 0 && sx+1 < src_cols && sy >= 0 && sy < src_rows) ?
+        convert_int(src[mad24(sy, src_step, src_offset + (sx+1))]) : 0;
+    int v2 = (sx >= 0 && sx < src_cols && sy+1 >= 0 && sy+1 < src_rows) ?
+        convert_int(src[mad24(sy+1, src_step, src_offset + sx)]) : 0;
+    int v3 = (sx+1 >= 0 && sx+1 < src_cols && sy+1 >= 0 && sy+1 < src_rows) ?
+        convert_int(src[mad24(sy+1, src_step, src_offset + (sx+1))]) : 0;
+
+    float taby = 1.f/INTER_TAB_SIZE*ay;
+    float tabx = 1.f/INTER_TAB_SIZE*ax;
+
+    int itab0 = convert_short_sat_rte( (1.0f-taby)*(1.0f-tabx) * INTER_REMAP_COEF_SCALE );
+    int itab1 = convert_short_sat_rte( (1.0f-taby)*tabx * INTER_REMAP_COEF_SCALE );
+    int itab2 = convert_short_sat_rte( taby*(1.0f-tabx) * INTER_REMAP_COEF_SCALE );
+    int itab3 = convert_short_sat_rte( taby*tabx * INTER_REMAP_COEF_SCALE );
+
+    int val = v0 * itab0 +  v1 * itab1 + v2 * itab2 + v3 * itab3;
+
+    return convert_uchar_sat((val + (1 << (INTER_REMAP_COEF_BITS-1))) >> INTER_REMAP_COEF_BITS);
+}
+
 __kernel void warpPerspective(__global const uchar * src,
                               int src_step, int src_offset, int src_rows, int src_cols,
                               __global uchar * dst,
@@ -16,39 +54,70 @@ __kernel void warpPerspective(__global const uchar * src,
 
     if (dx < dst_cols && dy < dst_rows)
     {
-        float X0 = M[0] * dx + M[1] * dy + M[2];
-        float Y0 = M[3] * dx + M[4] * dy + M[5];
-        float W = M[6] * dx + M[7] * dy + M[8];
-        W = W != 0.0f ? INTER_TAB_SIZE / W : 0.0f;
-        int X = rint(X0 * W), Y = rint(Y0 * W);
-
-        short sx = convert_short_sat(X >> INTER_BITS);
-        short sy = convert_short_sat(Y >> INTER_BITS);
-        short ay = (short)(Y & (INTER_TAB_SIZE - 1));
-        short ax = (short)(X & (INTER_TAB_SIZE - 1));
-
-        int v0 = (sx >= 0 && sx < src_cols && sy >= 0 && sy < src_rows) ?
-            convert_int(src[mad24(sy, src_step, src_offset + sx)]) : 0;
-        int v1 = (sx+1 >= 0 && sx+1 < src_cols && sy >= 0 && sy < src_rows) ?
-            convert_int(src[mad24(sy, src_step, src_offset + (sx+1))]) : 0;
-        int v2 = (sx >= 0 && sx < src_cols && sy+1 >= 0 && sy+1 < src_rows) ?
-            convert_int(src[mad24(sy+1, src_step, src_offset + sx)]) : 0;
-        int v3 = (sx+1 >= 0 && sx+1 < src_cols && sy+1 >= 0 && sy+1 < src_rows) ?
-            convert_int(src[mad24(sy+1, src_step, src_offset + (sx+1))]) : 0;
-
-        float taby = 1.f/INTER_TAB_SIZE*ay;
-        float tabx = 1.f/INTER_TAB_SIZE*ax;
-
         int dst_index = mad24(dy, dst_step, dst_offset + dx);
+        dst[dst_index] = warp_sample(src, src_step, src_offset, src_rows, src_cols, M, dx, dy);
+    }
+}
 
-        int itab0 = convert_short_sat_rte( (1.0f-taby)*(1.0f-tabx) * INTER_REMAP_COEF_SCALE );
-        int itab1 = convert_short_sat_rte( (1.0f-taby)*tabx * INTER_REMAP_COEF_SCALE );
-        int itab2 = convert_short_sat_rte( taby*(1.0f-tabx) * INTER_REMAP_COEF_SCALE );
-        int itab3 = convert_short_sat_rte( taby*tabx * INTER_REMAP_COEF_SCALE );
+// warpPerspective of the three planes and loadyuv in one pass, without the planes in between. Each
+// work item writes the 6 channels of a 2x2 block: the Y pixels of even and odd rows and columns,
+// then U and V
+inline void warp_block(__global const uchar * src, int src_width, int src_height,
+                       __constant float * M_y, __constant float * M_uv, int ux, int uy, float * v)
+{
+    int src_uv_width = src_width / 2;
+    int src_uv_height = src_height / 2;
+    int u_offset = src_width * src_height;
+    int v_offset = u_offset + src_uv_width * src_uv_height;
+    int x = ux * 2;
+    int y = uy * 2;
+
+    v[0] = warp_sample(src, src_width, 0, src_height, src_width, M_y, x, y);
+    v[1] = warp_sample(src, src_width, 0, src_height, src_width, M_y, x, y + 1);
+    v[2] = warp_sample(src, src_width, 0, src_height, src_width, M_y, x + 1, y);
+    v[3] = warp_sample(src, src_width, 0, src_height, src_width, M_y, x + 1, y + 1);
+    v[4] = warp_sample(src, src_uv_width, u_offset, src_uv_height, src_uv_width, M_uv, ux, uy);
+    v[5] = warp_sample(src, src_uv_width, v_offset, src_uv_height, src_uv_width, M_uv, ux, uy);
+}
 
-        int val = v0 * itab0 +  v1 * itab1 + v2 * itab2 + v3 * itab3;
+// the pixels are stored as (v + offset) * scale
+__kernel void warpPerspectiveTensor(__global const uchar * src, int src_width, int src_height,
+                                    __global float * out, int dst_width, int dst_height,
+                                    __constant float * M_y, __constant float * M_uv,
+                                    float offset, float scale)
+{
+    int ux = get_global_id(0);
+    int uy = get_global_id(1);
+    int uv_width = dst_width / 2;
+    int uv_height = dst_height / 2;
 
-        uchar pix = convert_uchar_sat((val + (1 << (INTER_REMAP_COEF_BITS-1))) >> INTER_REMAP_COEF_BITS);
-        dst[dst_index] = pix;
+    if (ux < uv_width && uy < uv_height)
+    {
+        float v[6];
+        warp_block(src, src_width, src_height, M_y, M_uv, ux, uy, v);
+        int uv_size = uv_width * uv_height;
+        int i = mad24(uy, uv_width, ux);
+        for (int c = 0; c < 6; c++) out[uv_size*c + i] = (v[c] + offset) * scale;
+    }
+}
+
+// the same tensor in fp16, the pixels are exact in half without scaling
+__kernel void warpPerspectiveTensorHalf(__global const uchar * src, int src_width, int src_height,
+                                        __global half * out, int dst_width, int dst_height,
+                                        __constant float * M_y, __constant float * M_uv,
+                                        float offset, float scale)
+{
+    int ux = get_global_id(0);
+    int uy = get_global_id(1);
+    int uv_width = dst_width / 2;
+    int uv_height = dst_height / 2;
+
+    if (ux < uv_width && uy < uv_height)
+    {
+        float v[6];
+        warp_block(src, src_width, src_height, M_y, M_uv, ux, uy, v);
+        int uv_size = uv_width * uv_height;
+        int i = mad24(uy, uv_width, ux);
+        for (int c = 0; c < 6; c++) vstore_half((v[c] + offset) * scale, uv_size*c + i, out);
     }
 }
@@ -10,7 +10,7 @@
 #include "selfdrive/common/mat.h"
 
 typedef struct {
-  cl_kernel krnl;
+  cl_kernel krnl, tensor_krnl, tensor_half_krnl;
   cl_mem m_y_cl, m_uv_cl;
 } Transform;
 
@@ -23,3 +23,11 @@ void transform_queue(Transform* s, cl_command_queue q,
                      cl_mem out_y, cl_mem out_u, cl_mem out_v,
                      int out_width, int out_height,
                      const mat3& projection);
+
+// the same warp straight into the float model input of loadyuv_queue, in one kernel. half writes
+// it in fp16, the pixels are normalized to (v + offset) * scale
+void transform_tensor_queue(Transform* s, cl_command_queue q,
+                            cl_mem yuv, int in_width, int in_height,
+                            cl_mem out, int out_width, int out_height,
+                            const mat3& projection, bool half = false,
+                            float offset = 0.f, float scale = 1.f);
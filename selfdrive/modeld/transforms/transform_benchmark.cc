@@ -0,0 +1,96 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/mat.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/modeld/models/commonmodel.h"
+#include "selfdrive/modeld/transforms/loadyuv.h"
+#include "selfdrive/modeld/transforms/transform.h"
+
+// Checks the fused warp of transform_tensor_queue against transform_queue and loadyuv_queue on
+// random camera frames and projections, then times both. Run from selfdrive/modeld for the kernels
+// usage: transforms/transform_benchmark [iterations]
+
+constexpr int FRAME_WIDTH = 1164;
+constexpr int FRAME_HEIGHT = 874;
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 100;
+
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  cl_command_queue q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+
+  Transform transform;
+  LoadYUVState loadyuv;
+  transform_init(&transform, context, device_id);
+  loadyuv_init(&loadyuv, context, device_id, MODEL_WIDTH, MODEL_HEIGHT);
+
+  const size_t yuv_size = FRAME_WIDTH * FRAME_HEIGHT * 3 / 2;
+  cl_mem yuv_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, yuv_size, NULL, &err));
+  cl_mem y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
+  cl_mem u_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
+  cl_mem v_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
+  cl_mem ref_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+  cl_mem fused_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> jitter(-0.05, 0.05);
+  std::vector<uint8_t> yuv(yuv_size);
+  std::vector<float> ref(MODEL_FRAME_SIZE), fused(MODEL_FRAME_SIZE);
+
+  int mismatches = 0;
+  double ref_s = 0, fused_s = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (auto &b : yuv) b = rng();
+    CL_CHECK(clEnqueueWriteBuffer(q, yuv_cl, CL_TRUE, 0, yuv_size, yuv.data(), 0, NULL, NULL));
+
+    // roughly the model crop of the road camera, with some rotation and perspective. Parts of the
+    // output fall outside the frame, where both sample zeros
+    mat3 projection = {{
+      2.0f + jitter(rng), jitter(rng), 70.0f + 100.0f * jitter(rng),
+      jitter(rng), 2.0f + jitter(rng), 180.0f + 100.0f * jitter(rng),
+      0.001f * jitter(rng), 0.001f * jitter(rng), 1.0f,
+    }};
+
+    double t1 = millis_since_boot();
+    transform_queue(&transform, q, yuv_cl, FRAME_WIDTH, FRAME_HEIGHT, y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, projection);
+    loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, ref_cl);
+    CL_CHECK(clFinish(q));
+    double t2 = millis_since_boot();
+    transform_tensor_queue(&transform, q, yuv_cl, FRAME_WIDTH, FRAME_HEIGHT, fused_cl, MODEL_WIDTH, MODEL_HEIGHT, projection);
+    CL_CHECK(clFinish(q));
+    double t3 = millis_since_boot();
+    ref_s += (t2 - t1) / 1000.0;
+    fused_s += (t3 - t2) / 1000.0;
+
+    CL_CHECK(clEnqueueReadBuffer(q, ref_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), ref.data(), 0, NULL, NULL));
+    CL_CHECK(clEnqueueReadBuffer(q, fused_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), fused.data(), 0, NULL, NULL));
+    // same fixed point sampling in both, the tensors are expected to be identical
+    for (int j = 0; j < MODEL_FRAME_SIZE; j++) {
+      if (ref[j] != fused[j]) {
+        if (mismatches < 10) printf("iteration %d, element %d: %f != %f\n", i, j, ref[j], fused[j]);
+        mismatches++;
+      }
+    }
+  }
+
+  printf("%d frames, %d mismatched elements\n", iterations, mismatches);
+  printf("transform + loadyuv %.3fms per frame, fused %.3fms per frame\n", ref_s / iterations * 1e3, fused_s / iterations * 1e3);
+
+  CL_CHECK(clReleaseMemObject(fused_cl));
+  CL_CHECK(clReleaseMemObject(ref_cl));
+  CL_CHECK(clReleaseMemObject(v_cl));
+  CL_CHECK(clReleaseMemObject(u_cl));
+  CL_CHECK(clReleaseMemObject(y_cl));
+  CL_CHECK(clReleaseMemObject(yuv_cl));
+  transform_destroy(&transform);
+  loadyuv_destroy(&loadyuv);
+  CL_CHECK(clReleaseCommandQueue(q));
+  CL_CHECK(clReleaseContext(context));
+  return mismatches ? 1 : 0;
+}
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 from cereal import car
 from common.params import Params
+from common.realtime import DT_DMON
 import cereal.messaging as messaging
 from selfdrive.controls.lib.events import Events
 from selfdrive.monitoring.driver_monitor import DriverStatus
@@ -46,37 +47,42 @@ def dmonitoringd_thread(sm=None, pm=None):
     if sm.updated['modelV2']:
       driver_status.set_policy(sm['modelV2'])
 
-    # Get data from dmonitoringmodeld
-    events = Events()
-    driver_status.get_pose(sm['driverState'], sm['liveCalibration'].rpyCalib, sm['carState'].vEgo, sm['controlsState'].enabled)
-
-    # Block engaging after max number of distrations
-    if driver_status.terminal_alert_cnt >= driver_status.settings._MAX_TERMINAL_ALERTS or \
-       driver_status.terminal_time >= driver_status.settings._MAX_TERMINAL_DURATION:
-      events.add(car.CarEvent.EventName.tooDistracted)
-
-    # Update events from driver state
-    driver_status.update(events, driver_engaged, sm['controlsState'].enabled, sm['carState'].standstill, sm['carState'].vEgo)
-
-    # build driverMonitoringState packet
-    dat = messaging.new_message('driverMonitoringState')
-    dat.driverMonitoringState = {
-      "events": events.to_msg(),
-      "faceDetected": driver_status.face_detected,
-      "isDistracted": driver_status.driver_distracted,
-      "awarenessStatus": driver_status.awareness,
-      "posePitchOffset": driver_status.pose.pitch_offseter.filtered_stat.mean(),
-      "posePitchValidCount": driver_status.pose.pitch_offseter.filtered_stat.n,
-      "poseYawOffset": driver_status.pose.yaw_offseter.filtered_stat.mean(),
-      "poseYawValidCount": driver_status.pose.yaw_offseter.filtered_stat.n,
-      "stepChange": driver_status.step_change,
-      "awarenessActive": driver_status.awareness_active,
-      "awarenessPassive": driver_status.awareness_passive,
-      "isLowStd": driver_status.pose.low_std,
-      "hiStdCount": driver_status.hi_stds,
-      "isActiveMode": driver_status.active_monitoring_mode,
-    }
-    pm.send('driverMonitoringState', dat)
+    # a driverState of a model that skipped frames, see ModelRateGovernor, stands in for them too, so
+    # the awareness keeps its pace and driverMonitoringState its rate
+    model_rate = sm['driverState'].modelRate
+    steps = max(1, round(1. / (DT_DMON * model_rate))) if model_rate > 0 else 1
+    for _ in range(steps):
+      # Get data from dmonitoringmodeld
+      events = Events()
+      driver_status.get_pose(sm['driverState'], sm['liveCalibration'].rpyCalib, sm['carState'].vEgo, sm['controlsState'].enabled)
+
+      # Block engaging after max number of distrations
+      if driver_status.terminal_alert_cnt >= driver_status.settings._MAX_TERMINAL_ALERTS or \
+         driver_status.terminal_time >= driver_status.settings._MAX_TERMINAL_DURATION:
+        events.add(car.CarEvent.EventName.tooDistracted)
+
+      # Update events from driver state
+      driver_status.update(events, driver_engaged, sm['controlsState'].enabled, sm['carState'].standstill, sm['carState'].vEgo)
+
+      # build driverMonitoringState packet
+      dat = messaging.new_message('driverMonitoringState')
+      dat.driverMonitoringState = {
+        "events": events.to_msg(),
+        "faceDetected": driver_status.face_detected,
+        "isDistracted": driver_status.driver_distracted,
+        "awarenessStatus": driver_status.awareness,
+        "posePitchOffset": driver_status.pose.pitch_offseter.filtered_stat.mean(),
+        "posePitchValidCount": driver_status.pose.pitch_offseter.filtered_stat.n,
+        "poseYawOffset": driver_status.pose.yaw_offseter.filtered_stat.mean(),
+        "poseYawValidCount": driver_status.pose.yaw_offseter.filtered_stat.n,
+        "stepChange": driver_status.step_change,
+        "awarenessActive": driver_status.awareness_active,
+        "awarenessPassive": driver_status.awareness_passive,
+        "isLowStd": driver_status.pose.low_std,
+        "hiStdCount": driver_status.hi_stds,
+        "isActiveMode": driver_status.active_monitoring_mode,
+      }
+      pm.send('driverMonitoringState', dat)
 
 def main(sm=None, pm=None):
   dmonitoringd_thread(sm, pm)
@@ -9,13 +9,28 @@ ExitHandler do_exit;
 int main(int argc, char **argv) {
   setpriority(PRIO_PROCESS, 0, -15);
 
-  PubMaster publisher({"procLog"});
-  while (!do_exit) {
+  // the scanner keeps an fd open per process
+  struct rlimit nofile;
+  if (getrlimit(RLIMIT_NOFILE, &nofile) == 0) {
+    nofile.rlim_cur = nofile.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &nofile);
+  }
+
+  const std::vector<std::string> thread_log_processes = threadLogProcesses();
+  PubMaster publisher({"procLog", "threadLog"});
+  for (uint64_t cnt = 0; !do_exit; cnt++) {
+    // procLog every 2 secs, threadLog at 10hz
+    if (cnt % 20 == 0) {
+      MessageBuilder msg;
+      buildProcLogMessage(msg);
+      publisher.send("procLog", msg);
+    }
+
     MessageBuilder msg;
-    buildProcLogMessage(msg);
-    publisher.send("procLog", msg);
+    buildThreadLogMessage(msg, thread_log_processes);
+    publisher.send("threadLog", msg);
 
-    util::sleep_for(2000);  // 2 secs
+    util::sleep_for(100);
   }
 
   return 0;
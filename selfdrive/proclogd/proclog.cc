@@ -1,10 +1,13 @@
 #include "selfdrive/proclogd/proclog.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <cassert>
+#include <cstring>
 #include <fstream>
-#include <iterator>
+#include <memory>
 #include <sstream>
 
 #include "selfdrive/common/swaglog.h"
@@ -63,55 +66,67 @@ enum StatPos {
 };
 
 // parse /proc/pid/stat
-std::optional<ProcStat> procStat(std::string stat) {
+std::optional<ProcStat> procStat(const char *stat, size_t len) {
   // To avoid being fooled by names containing a closing paren, scan backwards.
-  auto open_paren = stat.find('(');
-  auto close_paren = stat.rfind(')');
-  if (open_paren == std::string::npos || close_paren == std::string::npos || open_paren > close_paren) {
+  const char *open_paren = (const char *)memchr(stat, '(', len);
+  const char *close_paren = (const char *)memrchr(stat, ')', len);
+  if (!open_paren || !close_paren || open_paren > close_paren) {
     return std::nullopt;
   }
 
-  std::string name = stat.substr(open_paren + 1, close_paren - open_paren - 1);
-  // repace space in name with _
-  std::replace(&stat[open_paren], &stat[close_paren], ' ', '_');
-  std::istringstream iss(stat);
-  std::vector<std::string> v{std::istream_iterator<std::string>(iss),
-                             std::istream_iterator<std::string>()};
-  try {
-    if (v.size() != StatPos::MAX_FIELD) {
-      throw std::invalid_argument("stat");
+  // the fields as integers, the state as its char
+  int64_t v[StatPos::MAX_FIELD + 1] = {};
+  int n = 0;
+  const char *p = stat, *end = stat + len;
+  auto parse_field = [&]() {
+    while (p < end && *p == ' ') p++;
+    if (p == end || *p == '\n') return false;
+    if (++n > StatPos::MAX_FIELD) return false;
+    if (n == StatPos::state) {
+      v[n] = *p++;
+    } else {
+      const bool negative = *p == '-';
+      if (negative) p++;
+      uint64_t x = 0;
+      for (; p < end && *p >= '0' && *p <= '9'; p++) x = x * 10 + (*p - '0');
+      v[n] = negative ? -(int64_t)x : (int64_t)x;
     }
-    ProcStat p = {
-      .name = name,
-      .pid = stoi(v[StatPos::pid - 1]),
-      .state = v[StatPos::state - 1][0],
-      .ppid = stoi(v[StatPos::ppid - 1]),
-      .utime = stoul(v[StatPos::utime - 1]),
-      .stime = stoul(v[StatPos::stime - 1]),
-      .cutime = stol(v[StatPos::cutime - 1]),
-      .cstime = stol(v[StatPos::cstime - 1]),
-      .priority = stol(v[StatPos::priority - 1]),
-      .nice = stol(v[StatPos::nice - 1]),
-      .num_threads = stol(v[StatPos::num_threads - 1]),
-      .starttime = stoull(v[StatPos::starttime - 1]),
-      .vms = stoul(v[StatPos::vsize - 1]),
-      .rss = stoul(v[StatPos::rss - 1]),
-      .processor = stoi(v[StatPos::processor - 1]),
-    };
-    return p;
-  } catch (const std::invalid_argument &e) {
-    LOGE("failed to parse procStat (%s) :%s", e.what(), stat.c_str());
-  } catch (const std::out_of_range &e) {
-    LOGE("failed to parse procStat (%s) :%s", e.what(), stat.c_str());
-  }
-  return std::nullopt;
+    // a field ends at a space or the end of the line
+    return p == end || *p == ' ' || *p == '\n';
+  };
+  bool valid = parse_field();
+  p = close_paren + 1;
+  n = StatPos::state - 1;
+  while (valid && parse_field()) {}
+  if (!valid || n != StatPos::MAX_FIELD || (p < end && *p != '\n')) {
+    LOGE("failed to parse procStat :%.*s", (int)len, stat);
+    return std::nullopt;
+  }
+
+  return ProcStat{
+    .pid = (int)v[StatPos::pid],
+    .ppid = (int)v[StatPos::ppid],
+    .processor = (int)v[StatPos::processor],
+    .state = (char)v[StatPos::state],
+    .cutime = (long)v[StatPos::cutime],
+    .cstime = (long)v[StatPos::cstime],
+    .priority = (long)v[StatPos::priority],
+    .nice = (long)v[StatPos::nice],
+    .num_threads = (long)v[StatPos::num_threads],
+    .utime = (unsigned long)v[StatPos::utime],
+    .stime = (unsigned long)v[StatPos::stime],
+    .vms = (unsigned long)v[StatPos::vsize],
+    .rss = (unsigned long)v[StatPos::rss],
+    .starttime = (unsigned long long)v[StatPos::starttime],
+    .name = std::string(open_paren + 1, close_paren),
+  };
 }
 
 // return list of PIDs from /proc
-std::vector<int> pids() {
+std::vector<int> pids(const std::string &dir) {
   std::vector<int> ids;
-  DIR *d = opendir("/proc");
-  assert(d);
+  DIR *d = opendir(dir.c_str());
+  if (!d) return ids;
   char *p_end;
   struct dirent *de = NULL;
   while ((de = readdir(d))) {
@@ -126,6 +141,24 @@ std::vector<int> pids() {
   return ids;
 }
 
+// the context switches out of /proc/pid/task/tid/status
+bool ctxtSwitches(const char *status, size_t len, uint64_t *voluntary, uint64_t *nonvoluntary) {
+  auto field = [&](const char *name, uint64_t *value) {
+    const size_t name_len = strlen(name);
+    for (const char *p = status, *end = status + len; p < end;) {
+      const char *eol = (const char *)memchr(p, '\n', end - p);
+      if (!eol) eol = end;
+      if (eol - p > name_len && strncmp(p, name, name_len) == 0) {
+        *value = strtoull(p + name_len, nullptr, 10);
+        return true;
+      }
+      p = eol + 1;
+    }
+    return false;
+  };
+  return field("voluntary_ctxt_switches:", voluntary) && field("nonvoluntary_ctxt_switches:", nonvoluntary);
+}
+
 // null-delimited cmdline arguments to vector
 std::vector<std::string> cmdline(std::istream &stream) {
   std::vector<std::string> ret;
@@ -154,6 +187,89 @@ const ProcCache &getProcExtraInfo(int pid, const std::string &name) {
 
 }  // namespace Parser
 
+ProcScanner::ProcScanner(const std::string &dir, bool extra_info, bool ctxt_switches)
+    : dir(dir), extra_info(extra_info), ctxt_switches(ctxt_switches) {}
+
+ProcScanner::~ProcScanner() {
+  for (auto &[pid, proc] : procs_) {
+    closeProc(proc);
+  }
+}
+
+void ProcScanner::closeProc(Proc &proc) {
+  if (proc.fd >= 0) close(proc.fd);
+  if (proc.status_fd >= 0) close(proc.status_fd);
+}
+
+// the file of a pid with its fd, or by its path when it's out of fds
+static ssize_t read_proc_file(int fd, const std::string &path, char *buf, size_t size) {
+  if (fd >= 0) return pread(fd, buf, size, 0);
+
+  std::string content = util::read_file(path);
+  const size_t len = std::min(content.size(), size);
+  memcpy(buf, content.data(), len);
+  return len > 0 ? len : -1;
+}
+
+bool ProcScanner::readStat(int pid, Proc &proc) {
+  const std::string pid_path = dir + "/" + std::to_string(pid);
+  char buf[4096];
+  ssize_t len = read_proc_file(proc.fd, pid_path + "/stat", buf, 2048);
+  if (len <= 0) return false;
+
+  auto stat = Parser::procStat(buf, len);
+  if (!stat) return false;
+  proc.stat = std::move(*stat);
+
+  if (ctxt_switches) {
+    len = read_proc_file(proc.status_fd, pid_path + "/status", buf, sizeof(buf));
+    if (len <= 0 || !Parser::ctxtSwitches(buf, len, &proc.voluntary_ctxt_switches, &proc.nonvoluntary_ctxt_switches)) return false;
+  }
+  return true;
+}
+
+const std::map<int, ProcScanner::Proc> &ProcScanner::scan() {
+  std::vector<int> ids = Parser::pids(dir);
+  std::sort(ids.begin(), ids.end());
+
+  auto it = procs_.begin();
+  for (int pid : ids) {
+    // the ones that are gone since the last scan
+    while (it != procs_.end() && it->first < pid) {
+      closeProc(it->second);
+      it = procs_.erase(it);
+    }
+    if (it == procs_.end() || it->first != pid) {
+      const std::string pid_path = dir + "/" + std::to_string(pid);
+      Proc proc = {.fd = open((pid_path + "/stat").c_str(), O_RDONLY | O_CLOEXEC)};
+      if (ctxt_switches) proc.status_fd = open((pid_path + "/status").c_str(), O_RDONLY | O_CLOEXEC);
+      it = procs_.emplace_hint(it, pid, std::move(proc));
+    }
+
+    Proc &proc = it->second;
+    if (!readStat(pid, proc)) {
+      closeProc(proc);
+      it = procs_.erase(it);
+      continue;
+    }
+    // a new pid, or one that exec'd
+    if (extra_info && (proc.info.pid != pid || proc.info.name != proc.stat.name)) {
+      std::string proc_path = dir + "/" + std::to_string(pid);
+      proc.info.pid = pid;
+      proc.info.name = proc.stat.name;
+      proc.info.exe = util::readlink(proc_path + "/exe");
+      std::ifstream stream(proc_path + "/cmdline");
+      proc.info.cmdline = Parser::cmdline(stream);
+    }
+    ++it;
+  }
+  while (it != procs_.end()) {
+    closeProc(it->second);
+    it = procs_.erase(it);
+  }
+  return procs_;
+}
+
 const double jiffy = sysconf(_SC_CLK_TCK);
 const size_t page_size = sysconf(_SC_PAGE_SIZE);
 
@@ -191,21 +307,16 @@ void buildMemInfo(cereal::ProcLog::Builder &builder) {
   mem.setShared(mem_info["Shmem:"]);
 }
 
+static ProcScanner proc_scanner;
+
 void buildProcs(cereal::ProcLog::Builder &builder) {
-  auto pids = Parser::pids();
-  std::vector<ProcStat> proc_stats;
-  proc_stats.reserve(pids.size());
-  for (int pid : pids) {
-    std::string path = "/proc/" + std::to_string(pid) + "/stat";
-    if (auto stat = Parser::procStat(util::read_file(path))) {
-      proc_stats.push_back(*stat);
-    }
-  }
+  const auto &proc_scan = proc_scanner.scan();
 
-  auto procs = builder.initProcs(proc_stats.size());
-  for (size_t i = 0; i < proc_stats.size(); i++) {
-    auto l = procs[i];
-    const ProcStat &r = proc_stats[i];
+  auto procs = builder.initProcs(proc_scan.size());
+  size_t n = 0;
+  for (auto &[pid, proc] : proc_scan) {
+    auto l = procs[n++];
+    const ProcStat &r = proc.stat;
     l.setPid(r.pid);
     l.setState(r.state);
     l.setPpid(r.ppid);
@@ -222,7 +333,7 @@ void buildProcs(cereal::ProcLog::Builder &builder) {
     l.setProcessor(r.processor);
     l.setName(r.name);
 
-    const ProcCache &extra_info = Parser::getProcExtraInfo(r.pid, r.name);
+    const ProcCache &extra_info = proc.info;
     l.setExe(extra_info.exe);
     auto lcmdline = l.initCmdline(extra_info.cmdline.size());
     for (size_t i = 0; i < lcmdline.size(); i++) {
@@ -237,3 +348,60 @@ void buildProcLogMessage(MessageBuilder &msg) {
   buildCPUTimes(procLog);
   buildMemInfo(procLog);
 }
+
+std::vector<std::string> threadLogProcesses() {
+  std::vector<std::string> names;
+  std::istringstream iss(util::getenv("PROCLOGD_THREADS", "modeld,dmonitoringmodeld,camerad,boardd,sensord,locationd,loggerd,ui"));
+  for (std::string name; std::getline(iss, name, ',');) {
+    if (!name.empty()) names.push_back(name);
+  }
+  return names;
+}
+
+// by its comm, the name of its executable, or the last module of the title of a python process
+static bool process_matches(const ProcScanner::Proc &proc, const std::vector<std::string> &names) {
+  const std::string arg0 = proc.info.cmdline.empty() ? "" : proc.info.cmdline[0];
+  const std::string exe_name = util::base_name(arg0);
+  const std::string module = arg0.substr(arg0.rfind('.') + 1);
+  for (const std::string &name : names) {
+    if (name == proc.stat.name || name == exe_name || (module != arg0 && name == module)) return true;
+  }
+  return false;
+}
+
+void buildThreadLogMessage(MessageBuilder &msg, const std::vector<std::string> &names) {
+  // the processes as of the last procLog, and a scanner of the threads of each
+  static std::map<int, std::unique_ptr<ProcScanner>> task_scanners;
+  const auto &procs = proc_scanner.procs();
+  for (auto it = task_scanners.begin(); it != task_scanners.end();) {
+    it = procs.count(it->first) ? std::next(it) : task_scanners.erase(it);
+  }
+  for (auto &[pid, proc] : procs) {
+    if (!task_scanners.count(pid) && process_matches(proc, names)) {
+      task_scanners[pid] = std::make_unique<ProcScanner>("/proc/" + std::to_string(pid) + "/task", false, true);
+    }
+  }
+
+  std::vector<std::pair<int, const ProcScanner::Proc *>> threads;
+  for (auto &[pid, scanner] : task_scanners) {
+    for (auto &[tid, thread] : scanner->scan()) {
+      threads.push_back({pid, &thread});
+    }
+  }
+
+  auto lthreads = msg.initEvent().initThreadLog().initThreads(threads.size());
+  for (size_t i = 0; i < threads.size(); i++) {
+    auto l = lthreads[i];
+    const ProcScanner::Proc &t = *threads[i].second;
+    l.setPid(threads[i].first);
+    l.setTid(t.stat.pid);
+    l.setName(t.stat.name);
+    l.setState(t.stat.state);
+    l.setCpuUser(t.stat.utime / jiffy);
+    l.setCpuSystem(t.stat.stime / jiffy);
+    l.setVoluntaryCtxtSwitches(t.voluntary_ctxt_switches);
+    l.setNonvoluntaryCtxtSwitches(t.nonvoluntary_ctxt_switches);
+    l.setProcessor(t.stat.processor);
+    l.setPriority(t.stat.priority);
+  }
+}
@@ -1,3 +1,4 @@
+#include <map>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -28,8 +29,10 @@ struct ProcStat {
 
 namespace Parser {
 
-std::vector<int> pids();
-std::optional<ProcStat> procStat(std::string stat);
+std::vector<int> pids(const std::string &dir = "/proc");
+std::optional<ProcStat> procStat(const char *stat, size_t len);
+inline std::optional<ProcStat> procStat(const std::string &stat) { return procStat(stat.data(), stat.size()); }
+bool ctxtSwitches(const char *status, size_t len, uint64_t *voluntary, uint64_t *nonvoluntary);
 std::vector<std::string> cmdline(std::istream &stream);
 std::vector<CPUTime> cpuTimes(std::istream &stream);
 std::unordered_map<std::string, uint64_t> memInfo(std::istream &stream);
@@ -37,4 +40,42 @@ const ProcCache &getProcExtraInfo(int pid, const std::string &name);
 
 };  // namespace Parser
 
+// Keeps the stat file of every pid it knows open and rereads it with pread on each scan, the exe and
+// cmdline are only read for a new pid. The fd of a pid that exited fails to read, even after its pid
+// is reused, and the pid is opened again as a new one. On a task directory like /proc/<pid>/task it
+// scans the threads of a process the same way.
+class ProcScanner {
+public:
+  struct Proc {
+    int fd = -1, status_fd = -1;
+    ProcStat stat;
+    // with extra_info
+    ProcCache info;
+    // with ctxt_switches, out of the status file
+    uint64_t voluntary_ctxt_switches = 0, nonvoluntary_ctxt_switches = 0;
+  };
+
+  ProcScanner(const std::string &dir = "/proc", bool extra_info = true, bool ctxt_switches = false);
+  ~ProcScanner();
+  ProcScanner(const ProcScanner &) = delete;
+  ProcScanner &operator=(const ProcScanner &) = delete;
+  // the processes that are alive, by pid
+  const std::map<int, Proc> &scan();
+  // as of the last scan
+  const std::map<int, Proc> &procs() const { return procs_; }
+
+private:
+  bool readStat(int pid, Proc &proc);
+  void closeProc(Proc &proc);
+
+  std::string dir;
+  bool extra_info, ctxt_switches;
+  std::map<int, Proc> procs_;
+};
+
 void buildProcLogMessage(MessageBuilder &msg);
+
+// the names of the processes in threadLog, out of PROCLOGD_THREADS
+std::vector<std::string> threadLogProcesses();
+// the threads of the processes of the last procLog that match names
+void buildThreadLogMessage(MessageBuilder &msg, const std::vector<std::string> &names);
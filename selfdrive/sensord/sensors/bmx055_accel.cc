@@ -1,5 +1,6 @@
 #include "bmx055_accel.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include "selfdrive/common/swaglog.h"
@@ -48,7 +49,10 @@ void BMX055_Accel::get_event(cereal::SensorEventData::Builder &event) {
   uint8_t buffer[6];
   int len = read_register(BMX055_ACCEL_I2C_REG_X_LSB, buffer, sizeof(buffer));
   assert(len == 6);
+  fill_event(event, buffer, start_time);
+}
 
+void BMX055_Accel::fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp) {
   // 12 bit = +-2g
   float scale = 9.81 * 2.0f / (1 << 11);
   float x = -read_12_bit(buffer[0], buffer[1]) * scale;
@@ -59,7 +63,7 @@ void BMX055_Accel::get_event(cereal::SensorEventData::Builder &event) {
   event.setVersion(1);
   event.setSensor(SENSOR_ACCELEROMETER);
   event.setType(SENSOR_TYPE_ACCELEROMETER);
-  event.setTimestamp(start_time);
+  event.setTimestamp(timestamp);
 
   float xyz[] = {x, y, z};
   auto svec = event.initAcceleration();
@@ -67,3 +71,29 @@ void BMX055_Accel::get_event(cereal::SensorEventData::Builder &event) {
   svec.setStatus(true);
 
 }
+
+int BMX055_Accel::init_fifo() {
+  // setting the mode clears the FIFO, in stream mode a full FIFO drops its oldest frame
+  return set_register(BMX055_ACCEL_I2C_REG_FIFO_CONFIG_1, BMX055_ACCEL_FIFO_STREAM_XYZ);
+}
+
+int BMX055_Accel::read_fifo() {
+  uint64_t read_time = nanos_since_boot();
+  uint8_t status;
+  int ret = read_register(BMX055_ACCEL_I2C_REG_FIFO_STATUS, &status, 1);
+  if (ret < 0) return ret;
+
+  const int frames = std::min(status & BMX055_ACCEL_FIFO_FRAMES, BMX055_ACCEL_FIFO_DEPTH);
+  fifo_data.resize(frames * 6);
+  if (frames > 0) {
+    // the address stays at the FIFO data register, a read of it pops a frame after the other
+    ret = read_burst(BMX055_ACCEL_I2C_REG_FIFO, fifo_data.data(), fifo_data.size());
+    if (ret < 0) return ret;
+  }
+  fifo_clock.update(frames, read_time, status & BMX055_ACCEL_FIFO_OVERRUN);
+  return frames;
+}
+
+void BMX055_Accel::get_fifo_event(int i, cereal::SensorEventData::Builder &event) {
+  fill_event(event, &fifo_data[i * 6], fifo_clock.timestamp(i));
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <vector>
+
+#include "selfdrive/sensord/sensors/fifo_sensor.h"
 #include "selfdrive/sensord/sensors/i2c_sensor.h"
 
 // Address of the chip on the bus
@@ -9,8 +12,10 @@
 #define BMX055_ACCEL_I2C_REG_ID     0x00
 #define BMX055_ACCEL_I2C_REG_X_LSB  0x02
 #define BMX055_ACCEL_I2C_REG_TEMP   0x08
+#define BMX055_ACCEL_I2C_REG_FIFO_STATUS 0x0E
 #define BMX055_ACCEL_I2C_REG_BW     0x10
 #define BMX055_ACCEL_I2C_REG_HBW    0x13
+#define BMX055_ACCEL_I2C_REG_FIFO_CONFIG_1 0x3E
 #define BMX055_ACCEL_I2C_REG_FIFO   0x3F
 
 // Constants
@@ -28,10 +33,29 @@
 #define BMX055_ACCEL_BW_500HZ   0b01110
 #define BMX055_ACCEL_BW_1000HZ  0b01111
 
-class BMX055_Accel : public I2CSensor {
+// the output data rate is twice the bandwidth of the filter
+#define BMX055_ACCEL_ODR_HZ     250
+
+#define BMX055_ACCEL_FIFO_STREAM_XYZ 0b10000000
+#define BMX055_ACCEL_FIFO_OVERRUN    0b10000000
+#define BMX055_ACCEL_FIFO_FRAMES     0b01111111
+#define BMX055_ACCEL_FIFO_DEPTH      32
+
+class BMX055_Accel : public I2CSensor, public FifoSensor {
   uint8_t get_device_address() {return BMX055_ACCEL_I2C_ADDR;}
+  FifoClock fifo_clock = FifoClock(BMX055_ACCEL_ODR_HZ);
+  std::vector<uint8_t> fifo_data;
+  void fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp);
 public:
   BMX055_Accel(I2CBus *bus);
   int init();
   void get_event(cereal::SensorEventData::Builder &event);
+  bool sample_registers(uint &register_address, uint8_t &len) {
+    register_address = BMX055_ACCEL_I2C_REG_X_LSB;
+    len = 6;
+    return true;
+  }
+  int init_fifo();
+  int read_fifo();
+  void get_fifo_event(int i, cereal::SensorEventData::Builder &event);
 };
@@ -1,9 +1,11 @@
 #include "bmx055_gyro.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 
 #define DEG2RAD(x) ((x) * M_PI / 180.0)
 
@@ -59,7 +61,10 @@ void BMX055_Gyro::get_event(cereal::SensorEventData::Builder &event) {
   uint8_t buffer[6];
   int len = read_register(BMX055_GYRO_I2C_REG_RATE_X_LSB, buffer, sizeof(buffer));
   assert(len == 6);
+  fill_event(event, buffer, start_time);
+}
 
+void BMX055_Gyro::fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp) {
   // 16 bit = +- 125 deg/s
   float scale = 125.0f / (1 << 15);
   float x = -DEG2RAD(read_16_bit(buffer[0], buffer[1]) * scale);
@@ -70,7 +75,7 @@ void BMX055_Gyro::get_event(cereal::SensorEventData::Builder &event) {
   event.setVersion(1);
   event.setSensor(SENSOR_GYRO_UNCALIBRATED);
   event.setType(SENSOR_TYPE_GYROSCOPE_UNCALIBRATED);
-  event.setTimestamp(start_time);
+  event.setTimestamp(timestamp);
 
   float xyz[] = {x, y, z};
   auto svec = event.initGyroUncalibrated();
@@ -78,3 +83,31 @@ void BMX055_Gyro::get_event(cereal::SensorEventData::Builder &event) {
   svec.setStatus(true);
 
 }
+
+int BMX055_Gyro::init_fifo() {
+  int ret = set_register(BMX055_GYRO_I2C_REG_BW, BMX055_GYRO_BW_64HZ);
+  if (ret < 0) return ret;
+  // setting the mode clears the FIFO, in stream mode a full FIFO drops its oldest frame
+  return set_register(BMX055_GYRO_I2C_REG_FIFO_CONFIG_1, BMX055_GYRO_FIFO_STREAM_XYZ);
+}
+
+int BMX055_Gyro::read_fifo() {
+  uint64_t read_time = nanos_since_boot();
+  uint8_t status;
+  int ret = read_register(BMX055_GYRO_I2C_REG_FIFO_STATUS, &status, 1);
+  if (ret < 0) return ret;
+
+  const int frames = std::min(status & BMX055_GYRO_FIFO_FRAMES, BMX055_GYRO_FIFO_DEPTH);
+  fifo_data.resize(frames * 6);
+  if (frames > 0) {
+    // the address stays at the FIFO data register, a read of it pops a frame after the other
+    ret = read_burst(BMX055_GYRO_I2C_REG_FIFO, fifo_data.data(), fifo_data.size());
+    if (ret < 0) return ret;
+  }
+  fifo_clock.update(frames, read_time, status & BMX055_GYRO_FIFO_OVERRUN);
+  return frames;
+}
+
+void BMX055_Gyro::get_fifo_event(int i, cereal::SensorEventData::Builder &event) {
+  fill_event(event, &fifo_data[i * 6], fifo_clock.timestamp(i));
+}
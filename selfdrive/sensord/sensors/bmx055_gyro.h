@@ -1,5 +1,8 @@
 #pragma once
 
+#include <vector>
+
+#include "selfdrive/sensord/sensors/fifo_sensor.h"
 #include "selfdrive/sensord/sensors/i2c_sensor.h"
 
 // Address of the chip on the bus
@@ -8,9 +11,11 @@
 // Registers of the chip
 #define BMX055_GYRO_I2C_REG_ID         0x00
 #define BMX055_GYRO_I2C_REG_RATE_X_LSB 0x02
+#define BMX055_GYRO_I2C_REG_FIFO_STATUS 0x0E
 #define BMX055_GYRO_I2C_REG_RANGE      0x0F
 #define BMX055_GYRO_I2C_REG_BW         0x10
 #define BMX055_GYRO_I2C_REG_HBW        0x13
+#define BMX055_GYRO_I2C_REG_FIFO_CONFIG_1 0x3E
 #define BMX055_GYRO_I2C_REG_FIFO       0x3F
 
 // Constants
@@ -26,12 +31,32 @@
 #define BMX055_GYRO_RANGE_125       0b100
 
 #define BMX055_GYRO_BW_116HZ 0b0010
+// 200 Hz output data rate, 64 Hz filter
+#define BMX055_GYRO_BW_64HZ  0b0110
+#define BMX055_GYRO_FIFO_ODR_HZ 200
+
+#define BMX055_GYRO_FIFO_STREAM_XYZ 0b10000000
+#define BMX055_GYRO_FIFO_OVERRUN    0b10000000
+#define BMX055_GYRO_FIFO_FRAMES     0b01111111
+#define BMX055_GYRO_FIFO_DEPTH      100
 
 
-class BMX055_Gyro : public I2CSensor {
+class BMX055_Gyro : public I2CSensor, public FifoSensor {
   uint8_t get_device_address() {return BMX055_GYRO_I2C_ADDR;}
+  FifoClock fifo_clock = FifoClock(BMX055_GYRO_FIFO_ODR_HZ);
+  std::vector<uint8_t> fifo_data;
+  void fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp);
 public:
   BMX055_Gyro(I2CBus *bus);
   int init();
   void get_event(cereal::SensorEventData::Builder &event);
+  bool sample_registers(uint &register_address, uint8_t &len) {
+    register_address = BMX055_GYRO_I2C_REG_RATE_X_LSB;
+    len = 6;
+    return true;
+  }
+  // at the 200 Hz output data rate instead of the 1 kHz of polling, to keep the events per message down
+  int init_fifo();
+  int read_fifo();
+  void get_fifo_event(int i, cereal::SensorEventData::Builder &event);
 };
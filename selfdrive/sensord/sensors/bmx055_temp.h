@@ -9,4 +9,9 @@ public:
   BMX055_Temp(I2CBus *bus);
   int init();
   void get_event(cereal::SensorEventData::Builder &event);
+  bool sample_registers(uint &register_address, uint8_t &len) {
+    register_address = BMX055_ACCEL_I2C_REG_TEMP;
+    len = 1;
+    return true;
+  }
 };
@@ -0,0 +1,22 @@
+#include "fifo_sensor.h"
+
+#include <algorithm>
+#include <cmath>
+
+FifoClock::FifoClock(double odr_hz) : nominal_period(1e9 / odr_hz), period(1e9 / odr_hz) {}
+
+void FifoClock::update(int n, uint64_t read_time, bool reset) {
+  if (n <= 0) return;
+
+  // the newest sample was taken within a period before the read
+  const double expected = read_time - period / 2;
+  const double predicted = last + n * period;
+  if (last == 0 || reset || std::abs(expected - predicted) > 2 * period) {
+    last = expected;
+  } else {
+    const double error = expected - predicted;
+    period = std::clamp(period + 0.001 * error / n, 0.95 * nominal_period, 1.05 * nominal_period);
+    last = predicted + 0.05 * error;
+  }
+  first = last - (n - 1) * period;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+// A sensor that buffers its samples in a hardware FIFO, drained with one burst read per loop
+class FifoSensor {
+public:
+  virtual ~FifoSensor() {};
+  virtual int init_fifo() = 0;
+  // drains the FIFO, returns how many events its samples make or < 0 on an error
+  virtual int read_fifo() = 0;
+  // event i of the last read_fifo, oldest first
+  virtual void get_fifo_event(int i, cereal::SensorEventData::Builder &event) = 0;
+};
+
+// The timestamps of the samples of a FIFO, spaced by the output data rate of the sensor. The sensor
+// runs on its own oscillator, so the period follows the reads slowly, and the timestamps restart
+// from the read after an overrun or when they drifted more than a couple of samples.
+class FifoClock {
+public:
+  FifoClock(double odr_hz);
+  // n samples were read at read_time, the last one is the newest
+  void update(int n, uint64_t read_time, bool reset);
+  // of sample i of the last update
+  uint64_t timestamp(int i) const { return first + i * period; }
+
+private:
+  const double nominal_period;
+  double period;
+  // of the newest sample so far, and the first of the last update
+  double last = 0, first = 0;
+};
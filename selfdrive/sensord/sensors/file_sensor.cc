@@ -10,5 +10,4 @@ int FileSensor::init() {
 }
 
 FileSensor::~FileSensor() {
-  file.close();
 }
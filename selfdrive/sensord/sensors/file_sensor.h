@@ -1,14 +1,14 @@
 #pragma once
 
-#include <fstream>
 #include <string>
 
 #include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/sysfs.h"
 #include "selfdrive/sensord/sensors/sensor.h"
 
 class FileSensor : public Sensor {
 protected:
-  std::ifstream file;
+  SysfsReader file;
 
 public:
   FileSensor(std::string filename);
@@ -1,5 +1,7 @@
 #include "i2c_sensor.h"
 
+#include <cstring>
+
 int16_t read_12_bit(uint8_t lsb, uint8_t msb) {
   uint16_t combined = (uint16_t(msb) << 8) | uint16_t(lsb & 0xF0);
   return int16_t(combined) / (1 << 4);
@@ -20,9 +22,39 @@ I2CSensor::I2CSensor(I2CBus *bus) : bus(bus) {
 }
 
 int I2CSensor::read_register(uint register_address, uint8_t *buffer, uint8_t len) {
+  if (sample_len != 0 && register_address == sample_register && len == sample_len) {
+    memcpy(buffer, sample, len);
+    sample_len = 0;
+    return len;
+  }
   return bus->read_register(get_device_address(), register_address, buffer, len);
 }
 
+int I2CSensor::read_burst(uint register_address, uint8_t *buffer, uint16_t len) {
+  return bus->read_burst(get_device_address(), register_address, buffer, len);
+}
+
 int I2CSensor::set_register(uint register_address, uint8_t data) {
   return bus->set_register(get_device_address(), register_address, data);
 }
+
+void I2CSensor::read_samples(const std::vector<I2CSensor *> &sensors) {
+  std::vector<I2CRead> reads;
+  std::vector<I2CSensor *> read_sensors;
+  for (I2CSensor *s : sensors) {
+    uint register_address;
+    uint8_t len;
+    if (s->bus != sensors[0]->bus || !s->sample_registers(register_address, len) || len > sizeof(s->sample)) continue;
+
+    s->sample_register = register_address;
+    s->sample_len = 0;
+    reads.push_back({s->get_device_address(), (uint8_t)register_address, s->sample, len});
+    read_sensors.push_back(s);
+  }
+
+  if (!reads.empty() && sensors[0]->bus->read_registers(reads.data(), reads.size()) == 0) {
+    for (int i = 0; i < reads.size(); i++) {
+      read_sensors[i]->sample_len = reads[i].len;
+    }
+  }
+}
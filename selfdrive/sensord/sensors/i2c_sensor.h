@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
 #include "cereal/gen/cpp/log.capnp.h"
 #include "selfdrive/common/i2c.h"
@@ -17,10 +18,23 @@ private:
   I2CBus *bus;
   virtual uint8_t get_device_address() = 0;
 
+  // the sample of the last read_samples, for the read_register of get_event
+  uint8_t sample[8];
+  uint sample_register = 0;
+  uint8_t sample_len = 0;
+
 public:
   I2CSensor(I2CBus *bus);
   int read_register(uint register_address, uint8_t *buffer, uint8_t len);
+  int read_burst(uint register_address, uint8_t *buffer, uint16_t len);
   int set_register(uint register_address, uint8_t data);
   virtual int init() = 0;
   virtual void get_event(cereal::SensorEventData::Builder &event) = 0;
+
+  // The registers get_event reads, false for a sensor that can't be read ahead of its get_event
+  virtual bool sample_registers(uint &register_address, uint8_t &len) { return false; }
+  // Reads the samples of the sensors on the bus of the first one in one transaction, their next
+  // get_event takes it instead of reading the registers. If a sensor doesn't answer, none of them
+  // are read and each get_event reads its own
+  static void read_samples(const std::vector<I2CSensor *> &sensors);
 };
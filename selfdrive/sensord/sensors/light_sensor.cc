@@ -7,11 +7,9 @@
 
 void LightSensor::get_event(cereal::SensorEventData::Builder &event) {
   uint64_t start_time = nanos_since_boot();
-  file.clear();
-  file.seekg(0);
 
-  int value;
-  file >> value;
+  int64_t value = 0;
+  file.read_int(value);
 
   event.setSource(cereal::SensorEventData::SensorSource::RPR0521);
   event.setVersion(1);
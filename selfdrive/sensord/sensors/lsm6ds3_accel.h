@@ -23,4 +23,11 @@ public:
   LSM6DS3_Accel(I2CBus *bus);
   int init();
   void get_event(cereal::SensorEventData::Builder &event);
+  bool sample_registers(uint &register_address, uint8_t &len) {
+    register_address = LSM6DS3_ACCEL_I2C_REG_OUTX_L_XL;
+    len = 6;
+    return true;
+  }
+  // of the 6 bytes of a sample, from the output registers or the FIFO
+  void fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp);
 };
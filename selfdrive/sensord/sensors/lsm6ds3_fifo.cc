@@ -0,0 +1,53 @@
+#include "lsm6ds3_fifo.h"
+
+#include <algorithm>
+
+#include "selfdrive/common/timing.h"
+
+LSM6DS3_Fifo::LSM6DS3_Fifo(LSM6DS3_Accel *accel, LSM6DS3_Gyro *gyro) : accel(accel), gyro(gyro) {}
+
+int LSM6DS3_Fifo::init_fifo() {
+  // the accel and gyro run at 104 Hz already
+  int ret = accel->set_register(LSM6DS3_FIFO_I2C_REG_CTRL3, LSM6DS3_FIFO_NO_DECIMATION);
+  if (ret < 0) return ret;
+
+  // bypass mode empties the FIFO, in continuous mode a full FIFO drops its oldest samples
+  ret = accel->set_register(LSM6DS3_FIFO_I2C_REG_CTRL5, LSM6DS3_FIFO_MODE_BYPASS);
+  if (ret < 0) return ret;
+  return accel->set_register(LSM6DS3_FIFO_I2C_REG_CTRL5, LSM6DS3_FIFO_ODR_104HZ | LSM6DS3_FIFO_MODE_CONTINUOUS);
+}
+
+int LSM6DS3_Fifo::read_fifo() {
+  uint64_t read_time = nanos_since_boot();
+  // the words in the FIFO, and the word of its set the next read returns
+  uint8_t status[4];
+  int ret = accel->read_register(LSM6DS3_FIFO_I2C_REG_STATUS1, status, sizeof(status));
+  if (ret < 0) return ret;
+
+  const int words = status[0] | ((status[1] & LSM6DS3_FIFO_DIFF_HIGH) << 8);
+  const int pattern = status[2] | ((status[3] & LSM6DS3_FIFO_PATTERN_HIGH) << 8);
+  skip_words = (LSM6DS3_FIFO_SET_WORDS - pattern % LSM6DS3_FIFO_SET_WORDS) % LSM6DS3_FIFO_SET_WORDS;
+  const int sets = std::clamp((words - skip_words) / LSM6DS3_FIFO_SET_WORDS, 0, LSM6DS3_FIFO_MAX_SETS);
+  if (sets == 0) {
+    skip_words = 0;
+    return 0;
+  }
+
+  // with auto increment the address wraps around the two data registers, one at a word
+  fifo_data.resize((skip_words + sets * LSM6DS3_FIFO_SET_WORDS) * 2);
+  ret = accel->read_burst(LSM6DS3_FIFO_I2C_REG_DATA_OUT_L, fifo_data.data(), fifo_data.size());
+  if (ret < 0) return ret;
+
+  fifo_clock.update(sets, read_time, (status[1] & LSM6DS3_FIFO_OVERRUN) || skip_words > 0);
+  return sets * 2;
+}
+
+void LSM6DS3_Fifo::get_fifo_event(int i, cereal::SensorEventData::Builder &event) {
+  const uint8_t *set = &fifo_data[(skip_words + (i / 2) * LSM6DS3_FIFO_SET_WORDS) * 2];
+  const uint64_t timestamp = fifo_clock.timestamp(i / 2);
+  if (i % 2 == 0) {
+    accel->fill_event(event, set + 6, timestamp);
+  } else {
+    gyro->fill_event(event, set, timestamp);
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "selfdrive/sensord/sensors/fifo_sensor.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_accel.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_gyro.h"
+
+// Registers of the chip
+#define LSM6DS3_FIFO_I2C_REG_CTRL3       0x08
+#define LSM6DS3_FIFO_I2C_REG_CTRL5       0x0A
+#define LSM6DS3_FIFO_I2C_REG_STATUS1     0x3A
+#define LSM6DS3_FIFO_I2C_REG_DATA_OUT_L  0x3E
+
+// Constants
+#define LSM6DS3_FIFO_NO_DECIMATION   0b001001
+#define LSM6DS3_FIFO_ODR_104HZ       (0b0100 << 3)
+#define LSM6DS3_FIFO_MODE_BYPASS     0b000
+#define LSM6DS3_FIFO_MODE_CONTINUOUS 0b110
+#define LSM6DS3_FIFO_ODR_HZ          104
+
+#define LSM6DS3_FIFO_OVERRUN         0b01000000
+#define LSM6DS3_FIFO_DIFF_HIGH       0b00001111
+#define LSM6DS3_FIFO_PATTERN_HIGH    0b00000011
+
+// of the gyro and then the accel, 16 bit words
+#define LSM6DS3_FIFO_SET_WORDS       6
+// more than a loop ever finds, the rest waits for the next one
+#define LSM6DS3_FIFO_MAX_SETS        32
+
+// The gyro and the accel share the FIFO of the chip, a set of a gyro and an accel sample per period
+class LSM6DS3_Fifo : public FifoSensor {
+  LSM6DS3_Accel *accel;
+  LSM6DS3_Gyro *gyro;
+  FifoClock fifo_clock = FifoClock(LSM6DS3_FIFO_ODR_HZ);
+  std::vector<uint8_t> fifo_data;
+  // words of a set cut by an overrun, at the start of fifo_data
+  int skip_words = 0;
+public:
+  LSM6DS3_Fifo(LSM6DS3_Accel *accel, LSM6DS3_Gyro *gyro);
+  int init_fifo();
+  int read_fifo();
+  void get_fifo_event(int i, cereal::SensorEventData::Builder &event);
+};
@@ -42,13 +42,24 @@ fail:
   return ret;
 }
 
+int LSM6DS3_Gyro::init_drdy() {
+  int ret = set_register(LSM6DS3_GYRO_I2C_REG_DRDY_CFG, LSM6DS3_GYRO_DRDY_PULSED);
+  if (ret < 0) {
+    return ret;
+  }
+  return set_register(LSM6DS3_GYRO_I2C_REG_INT1_CTRL, LSM6DS3_GYRO_INT1_DRDY_G);
+}
+
 void LSM6DS3_Gyro::get_event(cereal::SensorEventData::Builder &event) {
 
   uint64_t start_time = nanos_since_boot();
   uint8_t buffer[6];
   int len = read_register(LSM6DS3_GYRO_I2C_REG_OUTX_L_G, buffer, sizeof(buffer));
   assert(len == sizeof(buffer));
+  fill_event(event, buffer, start_time);
+}
 
+void LSM6DS3_Gyro::fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp) {
   float scale = 8.75 / 1000.0;
   float x = DEG2RAD(read_16_bit(buffer[0], buffer[1]) * scale);
   float y = DEG2RAD(read_16_bit(buffer[2], buffer[3]) * scale);
@@ -58,7 +69,7 @@ void LSM6DS3_Gyro::get_event(cereal::SensorEventData::Builder &event) {
   event.setVersion(2);
   event.setSensor(SENSOR_GYRO_UNCALIBRATED);
   event.setType(SENSOR_TYPE_GYROSCOPE_UNCALIBRATED);
-  event.setTimestamp(start_time);
+  event.setTimestamp(timestamp);
 
   float xyz[] = {y, -x, z};
   auto svec = event.initGyroUncalibrated();
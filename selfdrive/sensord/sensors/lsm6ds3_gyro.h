@@ -6,6 +6,8 @@
 #define LSM6DS3_GYRO_I2C_ADDR       0x6A
 
 // Registers of the chip
+#define LSM6DS3_GYRO_I2C_REG_DRDY_CFG  0x0B
+#define LSM6DS3_GYRO_I2C_REG_INT1_CTRL 0x0D
 #define LSM6DS3_GYRO_I2C_REG_ID        0x0F
 #define LSM6DS3_GYRO_I2C_REG_CTRL2_G   0x11
 #define LSM6DS3_GYRO_I2C_REG_OUTX_L_G  0x22
@@ -14,6 +16,8 @@
 #define LSM6DS3_GYRO_CHIP_ID        0x69
 #define LSM6DS3TRC_GYRO_CHIP_ID     0x6A
 #define LSM6DS3_GYRO_ODR_104HZ      (0b0100 << 4)
+#define LSM6DS3_GYRO_DRDY_PULSED    0b10000000
+#define LSM6DS3_GYRO_INT1_DRDY_G    0b00000010
 
 
 class LSM6DS3_Gyro : public I2CSensor {
@@ -22,5 +26,14 @@ class LSM6DS3_Gyro : public I2CSensor {
 public:
   LSM6DS3_Gyro(I2CBus *bus);
   int init();
+  // a pulse on INT1 for every gyro sample
+  int init_drdy();
   void get_event(cereal::SensorEventData::Builder &event);
+  bool sample_registers(uint &register_address, uint8_t &len) {
+    register_address = LSM6DS3_GYRO_I2C_REG_OUTX_L_G;
+    len = 6;
+    return true;
+  }
+  // of the 6 bytes of a sample, from the output registers or the FIFO
+  void fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp);
 };
@@ -22,4 +22,9 @@ public:
   LSM6DS3_Temp(I2CBus *bus);
   int init();
   void get_event(cereal::SensorEventData::Builder &event);
+  bool sample_registers(uint &register_address, uint8_t &len) {
+    register_address = LSM6DS3_TEMP_I2C_REG_OUT_TEMP_L;
+    len = 2;
+    return true;
+  }
 };
@@ -1,10 +1,18 @@
+#include <poll.h>
 #include <sys/resource.h>
+#include <unistd.h>
 
+#include <linux/gpio.h>
+
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <thread>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/alloc_tracker.h"
+#include "selfdrive/common/gpio.h"
 #include "selfdrive/common/i2c.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
@@ -16,6 +24,7 @@
 #include "selfdrive/sensord/sensors/constants.h"
 #include "selfdrive/sensord/sensors/light_sensor.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_accel.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_fifo.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_gyro.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_temp.h"
 #include "selfdrive/sensord/sensors/mmc5603nj_magn.h"
@@ -23,8 +32,57 @@
 
 #define I2C_BUS_IMU 1
 
+// a missed edge only delays a loop, it doesn't stop them
+#define DRDY_TIMEOUT_MS 20
+// between the logs of the latency and jitter
+#define DRDY_STATS_EDGES 1000
+
 ExitHandler do_exit;
 
+// the timestamp of the last rising edge, 0 without one within DRDY_TIMEOUT_MS
+static uint64_t wait_drdy(int fd) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  uint64_t timestamp = 0;
+  // the ones that queued up while reading
+  for (int timeout = DRDY_TIMEOUT_MS; poll(&pfd, 1, timeout) > 0; timeout = 0) {
+    struct gpioevent_data ev;
+    if (read(fd, &ev, sizeof(ev)) != sizeof(ev)) break;
+    timestamp = ev.timestamp;
+  }
+  return timestamp;
+}
+
+// from its edge to the publish of the samples, and the period between edges
+struct DrdyStats {
+  int edges = 0;
+  double latency_sum = 0, latency_max = 0;
+  double period_sum = 0, period_sq_sum = 0;
+  uint64_t last_edge = 0;
+
+  void update(uint64_t edge) {
+    // the events carry CLOCK_REALTIME before linux 5.7, CLOCK_MONOTONIC after
+    const double realtime_age = (double)nanos_since_epoch() - edge;
+    const double monotonic_age = (double)nanos_monotonic() - edge;
+    const double latency = (std::abs(realtime_age) < std::abs(monotonic_age) ? realtime_age : monotonic_age) * 1e-6;
+    latency_sum += latency;
+    latency_max = std::max(latency_max, latency);
+    if (last_edge != 0) {
+      const double period = (edge - last_edge) * 1e-6;
+      period_sum += period;
+      period_sq_sum += period * period;
+    }
+    last_edge = edge;
+
+    if (++edges == DRDY_STATS_EDGES) {
+      const double period_mean = period_sum / (edges - 1);
+      const double jitter = std::sqrt(std::max(period_sq_sum / (edges - 1) - period_mean * period_mean, 0.0));
+      LOG("imu latency %.3f ms mean, %.3f ms max, period %.3f ms, jitter %.3f ms",
+          latency_sum / edges, latency_max, period_mean, jitter);
+      *this = {.last_edge = edge};
+    }
+  }
+};
+
 int sensor_loop() {
   I2CBus *i2c_bus_imu;
 
@@ -46,6 +104,8 @@ int sensor_loop() {
 
   MMC5603NJ_Magn mmc5603nj_magn(i2c_bus_imu);
 
+  LSM6DS3_Fifo lsm6ds3_fifo(&lsm6ds3_accel, &lsm6ds3_gyro);
+
   LightSensor light("/sys/class/i2c-adapter/i2c-2/2-0038/iio:device1/in_intensity_both_raw");
 
   // Sensor init
@@ -79,29 +139,92 @@ int sensor_loop() {
     }
   }
 
+  // With SENSORD_FIFO the IMUs buffer their samples, every loop drains them and publishes each with
+  // the time it was sampled at. The sensors that fail to set up their FIFO are polled like before.
+  std::vector<FifoSensor *> fifo_sensors;
+  if (getenv("SENSORD_FIFO")) {
+    std::vector<std::pair<FifoSensor *, std::vector<Sensor *>>> fifo_init = {
+      {&bmx055_accel, {&bmx055_accel}},
+      {&bmx055_gyro, {&bmx055_gyro}},
+      {&lsm6ds3_fifo, {&lsm6ds3_accel, &lsm6ds3_gyro}},
+    };
+    for (auto &[fifo_sensor, polled] : fifo_init) {
+      if (fifo_sensor->init_fifo() < 0) {
+        LOGE("Error initializing sensor FIFO");
+        continue;
+      }
+      fifo_sensors.push_back(fifo_sensor);
+      for (Sensor *s : polled) {
+        sensors.erase(std::remove(sensors.begin(), sensors.end(), s), sensors.end());
+      }
+    }
+  }
+
+  // With SENSORD_DRDY a loop starts on the data ready pulse of the gyro of the LSM6DS3, at its 104 Hz
+  int drdy_fd = -1;
+  if (getenv("SENSORD_DRDY")) {
+    if (lsm6ds3_gyro.init_drdy() < 0 || (drdy_fd = gpiochip_get_ro_value_fd("sensord", GPIOCHIP_INT, GPIO_LSM_INT)) < 0) {
+      LOGE("Error initializing the data ready interrupt, polling at 100 Hz");
+    }
+  }
+
+  // the samples of the polled IMU sensors are read in one transaction per loop
+  std::vector<I2CSensor *> i2c_sensors;
+  for (Sensor *s : sensors) {
+    if (I2CSensor *i2c_sensor = dynamic_cast<I2CSensor *>(s)) i2c_sensors.push_back(i2c_sensor);
+  }
+
   PubMaster pm({"sensorEvents"});
 
+  std::vector<int> fifo_events(fifo_sensors.size());
+  DrdyStats drdy_stats;
+  // at a fixed rate, a late loop doesn't delay the ones after it
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  static AllocStats allocs("sensor_loop");
   while (!do_exit) {
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    const uint64_t drdy_edge = drdy_fd >= 0 ? wait_drdy(drdy_fd) : 0;
+    NoAllocRegion region(allocs);
+
+    int num_events = sensors.size();
+    for (int i = 0; i < fifo_sensors.size(); i++) {
+      fifo_events[i] = std::max(fifo_sensors[i]->read_fifo(), 0);
+      num_events += fifo_events[i];
+    }
 
-    const int num_events = sensors.size();
     MessageBuilder msg;
     auto sensor_events = msg.initEvent().initSensorEvents(num_events);
 
-    for (int i = 0; i < num_events; i++) {
-      auto event = sensor_events[i];
-      sensors[i]->get_event(event);
+    int n = 0;
+    for (int i = 0; i < fifo_sensors.size(); i++) {
+      for (int j = 0; j < fifo_events[i]; j++) {
+        auto event = sensor_events[n++];
+        fifo_sensors[i]->get_fifo_event(j, event);
+      }
+    }
+    if (!i2c_sensors.empty()) I2CSensor::read_samples(i2c_sensors);
+    for (Sensor *sensor : sensors) {
+      auto event = sensor_events[n++];
+      sensor->get_event(event);
     }
 
     pm.send("sensorEvents", msg);
 
-    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::milliseconds(10) - (end - begin));
+    if (drdy_fd >= 0) {
+      if (drdy_edge != 0) drdy_stats.update(drdy_edge);
+    } else {
+      next = std::max(next + std::chrono::milliseconds(10), std::chrono::steady_clock::now());
+      std::this_thread::sleep_until(next);
+    }
   }
+  if (drdy_fd >= 0) close(drdy_fd);
+
+  std::string summary = alloc_summary();
+  if (!summary.empty()) LOGW("allocations:\n%s", summary.c_str());
   return 0;
 }
 
 int main(int argc, char *argv[]) {
   setpriority(PRIO_PROCESS, 0, -18);
+  rt_memory_lock();
   return sensor_loop();
 }
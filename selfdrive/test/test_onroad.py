@@ -23,9 +23,9 @@ PROCS = {
   "selfdrive.controls.controlsd": 50.0,
   "./loggerd": 45.0,
   "./locationd": 9.1,
+  "./paramsd": 3.0,
   "selfdrive.controls.plannerd": 20.0,
   "./_ui": 15.0,
-  "selfdrive.locationd.paramsd": 9.1,
   "./camerad": 7.07,
   "./_sensord": 6.17,
   "selfdrive.controls.radard": 5.67,
@@ -56,7 +56,7 @@ if TICI:
     "./camerad": 31.0,
     "./_ui": 21.0,
     "selfdrive.controls.plannerd": 12.0,
-    "selfdrive.locationd.paramsd": 5.0,
+    "./paramsd": 5.0,
     "./_dmonitoringmodeld": 10.0,
     "selfdrive.thermald.thermald": 1.5,
   })
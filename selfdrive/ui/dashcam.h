@@ -193,7 +193,7 @@ void draw_date_time(UIState *s) {
   nvgStroke(s->vg);
 
   nvgFontSize(s->vg, 34);
-  nvgFontFace(s->vg, "sans-bold");
+  nvgFontFaceId(s->vg, s->fonts[FONT_SANS_BOLD]);
   nvgFillColor(s->vg, nvgRGBA(255, 255, 255, 200));
   nvgText(s->vg,rect_x+229,rect_y+57,now,NULL);
 }
@@ -209,7 +209,7 @@ static void rotate_video(UIState *s) {
 static void screen_draw_button(UIState *s) {
   // Set button to bottom left of screen
 //  if (s->vision_connected && s->plus_state == 0) {
-  if (s->vipc_client->connected || s->scene.is_OpenpilotViewEnabled) {
+  if (s->vision_connected || s->scene.is_OpenpilotViewEnabled) {
     int btn_w = 140;
     int btn_h = 140;
     int btn_x = s->fb_w - btn_w - 35;
@@ -232,7 +232,7 @@ static void screen_draw_button(UIState *s) {
       nvgFillColor(s->vg, nvgRGBA(255, 255, 255, 200));
     }
     nvgFontSize(s->vg, 45);
-    nvgFontFace(s->vg, "sans-bold");
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_BOLD]);
     nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_MIDDLE);
     nvgText(s->vg, btn_xc, btn_yc, "REC", NULL);
   }
@@ -283,7 +283,7 @@ void dashcam(UIState *s) {
     }
   }
 
-  if (!s->vipc_client->connected) {
+  if (!s->vision_connected) {
     // Assume car is not in drive so stop recording
     stop_capture();
   }
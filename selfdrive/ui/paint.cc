@@ -2,6 +2,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <set>
+#include <tuple>
 
 #ifdef __APPLE__
 #include <OpenGL/gl3.h>
@@ -21,6 +24,7 @@
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
+#include "selfdrive/ui/qt/frame_profiler.h"
 #include "selfdrive/ui/ui.h"
 #include <iostream>
 #include <time.h> // opkr
@@ -29,16 +33,16 @@
 
 static void ui_print(UIState *s, int x, int y,  const char* fmt, ... )
 {
-  char* msg_buf = NULL;
+  char msg_buf[256];
   va_list args;
   va_start(args, fmt);
-  vasprintf( &msg_buf, fmt, args);
+  vsnprintf(msg_buf, sizeof(msg_buf), fmt, args);
   va_end(args);
   nvgText(s->vg, x, y, msg_buf, NULL);
 }
 
-static void ui_draw_text(const UIState *s, float x, float y, const char *string, float size, NVGcolor color, const char *font_name) {
-  nvgFontFace(s->vg, font_name);
+static void ui_draw_text(const UIState *s, float x, float y, const char *string, float size, NVGcolor color, UIFont font) {
+  nvgFontFaceId(s->vg, s->fonts[font]);
   nvgFontSize(s->vg, size*0.8);
   nvgFillColor(s->vg, color);
   nvgText(s->vg, x, y, string, NULL);
@@ -126,11 +130,11 @@ static void draw_lead(UIState *s, const cereal::RadarState::LeadData::Reader &le
 
   if (s->scene.radarDistance < 149) {                                         //radar가 인식되면
     //draw_chevron(s, x, y, sz, nvgRGBA(201, 34, 49, fillAlpha), COLOR_ORANGE); //orange ==> red
-    ui_draw_text(s, x, y + sz/1.5f, "R", 20 * 2.5, COLOR_WHITE, "sans-bold");
+    ui_draw_text(s, x, y + sz/1.5f, "R", 20 * 2.5, COLOR_WHITE, FONT_SANS_BOLD);
     ui_draw_image(s, {x_l, y_l, sz_w * 2, sz_h}, "lead_under_radar", 1.0f);  
   } else {                                                                                 //camera가 인식되면
     //draw_chevron(s, x, y, sz, nvgRGBA(150, 0, 200, fillAlpha), nvgRGBA(0, 150, 200, 200)); //oceanblue ==> purple
-    ui_draw_text(s, x, y + sz/1.5f, "C", 20 * 2.5, COLOR_ORANGE, "sans-bold");
+    ui_draw_text(s, x, y + sz/1.5f, "C", 20 * 2.5, COLOR_ORANGE, FONT_SANS_BOLD);
     ui_draw_image(s, {x_l, y_l, sz_w * 2, sz_h}, "lead_under_camera", 1.0f);  
   }
 }
@@ -214,17 +218,51 @@ static void ui_draw_line(UIState *s, const line_vertices_data &vd, NVGcolor *col
   nvgFill(s->vg);
 }
 
+static void init_vision_textures(UIState *s) {
+  VisionIpcClient *vipc_client = s->vision->client();
+  for (int i = 0; i < vipc_client->num_buffers; i++) {
+    s->texture[i].reset(new EGLImageTexture(&vipc_client->buffers[i]));
+
+    glBindTexture(GL_TEXTURE_2D, s->texture[i]->frame_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // BGR
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_BLUE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_GREEN);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+  }
+  assert(glGetError() == GL_NO_ERROR);
+}
+
 static void draw_vision_frame(UIState *s) {
   glBindVertexArray(s->frame_vao);
   mat4 *out_mat = &s->rear_frame_mat;
   glActiveTexture(GL_TEXTURE0);
 
-  if (s->last_frame) {
-    glBindTexture(GL_TEXTURE_2D, s->texture[s->last_frame->idx]->frame_tex);
-    if (!Hardware::EON()) {
-      // this is handled in ion on QCOM
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, s->last_frame->width, s->last_frame->height,
-                   0, GL_RGB, GL_UNSIGNED_BYTE, s->last_frame->addr);
+  {
+    std::lock_guard lk(s->vision->buffers_lock);
+    if (s->vision_textures_stale) {
+      init_vision_textures(s);
+      s->vision_textures_stale = false;
+      s->vision->buffersReady();
+    }
+
+    VisionBuf *buf = s->vision->takeFrame(&s->last_frame_eof);
+    if (buf) {
+      s->last_frame = buf;
+      s->last_frame_uploaded = false;
+      s->last_frame_presented = false;
+    }
+
+    if (s->last_frame) {
+      glBindTexture(GL_TEXTURE_2D, s->texture[s->last_frame->idx]->frame_tex);
+      if (!Hardware::EON() && !s->last_frame_uploaded) {
+        // this is handled in ion on QCOM, paints without a new frame keep the texture
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, s->last_frame->width, s->last_frame->height,
+                     0, GL_RGB, GL_UNSIGNED_BYTE, s->last_frame->addr);
+        s->last_frame_uploaded = true;
+      }
     }
   }
 
@@ -364,38 +402,38 @@ static void ui_draw_tpms(UIState *s) {
   nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE);
   const int pos_x = viz_tpms_x + (viz_tpms_w / 2);
   const int pos_y = viz_tpms_y + 45;
-  ui_draw_text(s, pos_x, pos_y, "TPMS(psi)", 45, COLOR_WHITE_ALPHA(180), "sans-regular");
+  ui_draw_text(s, pos_x, pos_y, "TPMS(psi)", 45, COLOR_WHITE_ALPHA(180), FONT_SANS_REGULAR);
   snprintf(tpmsFl, sizeof(tpmsFl), "%.1f", scene.tpmsPressureFl);
   snprintf(tpmsFr, sizeof(tpmsFr), "%.1f", scene.tpmsPressureFr);
   snprintf(tpmsRl, sizeof(tpmsRl), "%.1f", scene.tpmsPressureRl);
   snprintf(tpmsRr, sizeof(tpmsRr), "%.1f", scene.tpmsPressureRr);
   if (scene.tpmsPressureFl < 29) {
-    ui_draw_text(s, pos_x-55, pos_y+50, tpmsFl, 60, COLOR_RED, "sans-bold");
+    ui_draw_text(s, pos_x-55, pos_y+50, tpmsFl, 60, COLOR_RED, FONT_SANS_BOLD);
   } else if (scene.tpmsPressureFl > 50) {
-    ui_draw_text(s, pos_x-55, pos_y+50, "N/A", 60, COLOR_WHITE_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x-55, pos_y+50, "N/A", 60, COLOR_WHITE_ALPHA(200), FONT_SANS_SEMIBOLD);
   } else {
-    ui_draw_text(s, pos_x-55, pos_y+50, tpmsFl, 60, COLOR_GREEN_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x-55, pos_y+50, tpmsFl, 60, COLOR_GREEN_ALPHA(200), FONT_SANS_SEMIBOLD);
   }
   if (scene.tpmsPressureFr < 29) {
-    ui_draw_text(s, pos_x+55, pos_y+50, tpmsFr, 60, COLOR_RED, "sans-bold");
+    ui_draw_text(s, pos_x+55, pos_y+50, tpmsFr, 60, COLOR_RED, FONT_SANS_BOLD);
   } else if (scene.tpmsPressureFr > 50) {
-    ui_draw_text(s, pos_x+55, pos_y+50, "N/A", 60, COLOR_WHITE_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x+55, pos_y+50, "N/A", 60, COLOR_WHITE_ALPHA(200), FONT_SANS_SEMIBOLD);
   } else {
-    ui_draw_text(s, pos_x+55, pos_y+50, tpmsFr, 60, COLOR_GREEN_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x+55, pos_y+50, tpmsFr, 60, COLOR_GREEN_ALPHA(200), FONT_SANS_SEMIBOLD);
   }
   if (scene.tpmsPressureRl < 29) {
-    ui_draw_text(s, pos_x-55, pos_y+100, tpmsRl, 60, COLOR_RED, "sans-bold");
+    ui_draw_text(s, pos_x-55, pos_y+100, tpmsRl, 60, COLOR_RED, FONT_SANS_BOLD);
   } else if (scene.tpmsPressureRl > 50) {
-    ui_draw_text(s, pos_x-55, pos_y+100, "N/A", 60, COLOR_WHITE_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x-55, pos_y+100, "N/A", 60, COLOR_WHITE_ALPHA(200), FONT_SANS_SEMIBOLD);
   } else {
-    ui_draw_text(s, pos_x-55, pos_y+100, tpmsRl, 60, COLOR_GREEN_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x-55, pos_y+100, tpmsRl, 60, COLOR_GREEN_ALPHA(200), FONT_SANS_SEMIBOLD);
   }
   if (scene.tpmsPressureRr < 29) {
-    ui_draw_text(s, pos_x+55, pos_y+100, tpmsRr, 60, COLOR_RED, "sans-bold");
+    ui_draw_text(s, pos_x+55, pos_y+100, tpmsRr, 60, COLOR_RED, FONT_SANS_BOLD);
   } else if (scene.tpmsPressureRr > 50) {
-    ui_draw_text(s, pos_x+55, pos_y+100, "N/A", 60, COLOR_WHITE_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x+55, pos_y+100, "N/A", 60, COLOR_WHITE_ALPHA(200), FONT_SANS_SEMIBOLD);
   } else {
-    ui_draw_text(s, pos_x+55, pos_y+100, tpmsRr, 60, COLOR_GREEN_ALPHA(200), "sans-semibold");
+    ui_draw_text(s, pos_x+55, pos_y+100, tpmsRr, 60, COLOR_GREEN_ALPHA(200), FONT_SANS_SEMIBOLD);
   }
 }
 
@@ -432,8 +470,8 @@ static void ui_draw_debug(UIState *s) {
   nvgTextAlign(s->vg, NVG_ALIGN_MIDDLE | NVG_ALIGN_MIDDLE);
 
   if (scene.nDebugUi1) {
-    ui_draw_text(s, 30, 870-bdr_s, scene.alertTextMsg1.c_str(), 40, COLOR_WHITE_ALPHA(100), "sans-semibold");
-    ui_draw_text(s, 30, 900-bdr_s, scene.alertTextMsg2.c_str(), 40, COLOR_WHITE_ALPHA(100), "sans-semibold");
+    ui_draw_text(s, 30, 870-bdr_s, scene.alertTextMsg1.c_str(), 40, COLOR_WHITE_ALPHA(100), FONT_SANS_SEMIBOLD);
+    ui_draw_text(s, 30, 900-bdr_s, scene.alertTextMsg2.c_str(), 40, COLOR_WHITE_ALPHA(100), FONT_SANS_SEMIBOLD);
   }
   
   nvgFillColor(s->vg, COLOR_WHITE_ALPHA(100));
@@ -453,6 +491,7 @@ static void ui_draw_debug(UIState *s) {
     ui_print(s, ui_viz_rx, ui_viz_ry+400, "SC:%.2f", scene.lateralPlan.steerRateCost);
     ui_print(s, ui_viz_rx, ui_viz_ry+440, "OS:%.2f", abs(scene.output_scale));
     ui_print(s, ui_viz_rx, ui_viz_ry+480, "%.2f | %.2f", scene.lateralPlan.lProb, scene.lateralPlan.rProb);
+    ui_print(s, ui_viz_rx, ui_viz_ry+200, "UI:%.1f|%.1fms", s->update_cpu_ms, s->draw_cpu_ms);
     //ui_print(s, ui_viz_rx, ui_viz_ry+800, "A:%.5f", scene.accel_sensor2);
     if (scene.map_is_running) {
       if (scene.liveMapData.opkrspeedsign) ui_print(s, ui_viz_rx, ui_viz_ry+520, "SS:%.0f", scene.liveMapData.opkrspeedsign);
@@ -493,7 +532,7 @@ static void ui_draw_gear( UIState *s ) {
   //int  y_pos = 155;
   char str_msg[512];
 
-  nvgFontFace(s->vg, "sans-bold");
+  nvgFontFaceId(s->vg, s->fonts[FONT_SANS_BOLD]);
   nvgFontSize(s->vg, 160 );
   switch( ngetGearShifter )
   {
@@ -591,15 +630,15 @@ static void ui_draw_vision_maxspeed_org(UIState *s) {
   nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE);
   if (cruise_speed >= 20 && s->scene.controls_state.getEnabled()) {
     const std::string cruise_speed_str = std::to_string((int)std::nearbyint(cruise_speed));
-    ui_draw_text(s, rect.centerX(), bdr_s+65, cruise_speed_str.c_str(), 26 * 2.8, COLOR_WHITE_ALPHA(is_cruise_set ? 200 : 100), "sans-bold");
+    ui_draw_text(s, rect.centerX(), bdr_s+65, cruise_speed_str.c_str(), 26 * 2.8, COLOR_WHITE_ALPHA(is_cruise_set ? 200 : 100), FONT_SANS_BOLD);
   } else {
-  	ui_draw_text(s, rect.centerX(), bdr_s+65, "-", 26 * 2.8, COLOR_WHITE_ALPHA(is_cruise_set ? 200 : 100), "sans-semibold");
+  	ui_draw_text(s, rect.centerX(), bdr_s+65, "-", 26 * 2.8, COLOR_WHITE_ALPHA(is_cruise_set ? 200 : 100), FONT_SANS_SEMIBOLD);
   }
   if (is_cruise_set) {
     const std::string maxspeed_str = std::to_string((int)std::nearbyint(maxspeed));
-    ui_draw_text(s, rect.centerX(), bdr_s+165, maxspeed_str.c_str(), 48 * 2.4, COLOR_WHITE, "sans-bold");
+    ui_draw_text(s, rect.centerX(), bdr_s+165, maxspeed_str.c_str(), 48 * 2.4, COLOR_WHITE, FONT_SANS_BOLD);
   } else {
-    ui_draw_text(s, rect.centerX(), bdr_s+165, "-", 42 * 2.4, COLOR_WHITE_ALPHA(100), "sans-semibold");
+    ui_draw_text(s, rect.centerX(), bdr_s+165, "-", 42 * 2.4, COLOR_WHITE_ALPHA(100), FONT_SANS_SEMIBOLD);
   }
 }
 
@@ -615,12 +654,12 @@ static void ui_draw_vision_maxspeed(UIState *s) {
   ui_draw_rect(s->vg, rect, COLOR_WHITE_ALPHA(100), 10, 20.);
 
   nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE);
-  ui_draw_text(s, rect.centerX()+viz_max_o/2, bdr_s+65, "MAX", 26 * 2.2, COLOR_WHITE_ALPHA(is_cruise_set ? 200 : 100), "sans-regular");
+  ui_draw_text(s, rect.centerX()+viz_max_o/2, bdr_s+65, "MAX", 26 * 2.2, COLOR_WHITE_ALPHA(is_cruise_set ? 200 : 100), FONT_SANS_REGULAR);
   if (is_cruise_set) {
     const std::string maxspeed_str = std::to_string((int)std::nearbyint(maxspeed));
-    ui_draw_text(s, rect.centerX()+viz_max_o/2, bdr_s+165, maxspeed_str.c_str(), 48 * 2.3, COLOR_WHITE, "sans-bold");
+    ui_draw_text(s, rect.centerX()+viz_max_o/2, bdr_s+165, maxspeed_str.c_str(), 48 * 2.3, COLOR_WHITE, FONT_SANS_BOLD);
   } else {
-    ui_draw_text(s, rect.centerX()+viz_max_o/2, bdr_s+165, "-", 42 * 2.3, COLOR_WHITE_ALPHA(100), "sans-semibold");
+    ui_draw_text(s, rect.centerX()+viz_max_o/2, bdr_s+165, "-", 42 * 2.3, COLOR_WHITE_ALPHA(100), FONT_SANS_SEMIBOLD);
   }
 }
 
@@ -647,15 +686,15 @@ static void ui_draw_vision_cruise_speed(UIState *s) {
 
   nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE);
   if (s->scene.limitSpeedCamera > 29) {
-    ui_draw_text(s, rect.centerX(), bdr_s+65, "SPEED LIMIT", 26 * 2.2, COLOR_WHITE_ALPHA(s->scene.cruiseAccStatus ? 200 : 100), "sans-regular");
+    ui_draw_text(s, rect.centerX(), bdr_s+65, "SPEED LIMIT", 26 * 2.2, COLOR_WHITE_ALPHA(s->scene.cruiseAccStatus ? 200 : 100), FONT_SANS_REGULAR);
   } else {
-    ui_draw_text(s, rect.centerX(), bdr_s+65, "CRUISE", 26 * 2.2, COLOR_WHITE_ALPHA(s->scene.cruiseAccStatus ? 200 : 100), "sans-regular");
+    ui_draw_text(s, rect.centerX(), bdr_s+65, "CRUISE", 26 * 2.2, COLOR_WHITE_ALPHA(s->scene.cruiseAccStatus ? 200 : 100), FONT_SANS_REGULAR);
   }
   const std::string cruise_speed_str = std::to_string((int)std::nearbyint(cruise_speed));
   if (cruise_speed >= 20 && s->scene.controls_state.getEnabled()) {
-    ui_draw_text(s, rect.centerX(), bdr_s+165, cruise_speed_str.c_str(), 48 * 2.3, COLOR_WHITE, "sans-bold");
+    ui_draw_text(s, rect.centerX(), bdr_s+165, cruise_speed_str.c_str(), 48 * 2.3, COLOR_WHITE, FONT_SANS_BOLD);
   } else {
-    ui_draw_text(s, rect.centerX(), bdr_s+165, "-", 42 * 2.3, COLOR_WHITE_ALPHA(100), "sans-semibold");
+    ui_draw_text(s, rect.centerX(), bdr_s+165, "-", 42 * 2.3, COLOR_WHITE_ALPHA(100), FONT_SANS_SEMIBOLD);
   }
 }
 
@@ -696,16 +735,16 @@ static void ui_draw_vision_cameradist(UIState *s) {
 
   if (s->scene.liveMapData.opkrspeedlimitdist > 1000){
     //const std::string cameradist_str = std::to_string((int)std::nearbyint(cameradist));
-    ui_draw_text(s, rect.centerX() - 20, int(bdr_s)+275, str, 40 * 2.0, text_color, "sans-bold");
-    ui_draw_text(s, rect.centerX() + 65, int(bdr_s)+280, "km", 30 * 1.6, text_color, "sans-semibold");
+    ui_draw_text(s, rect.centerX() - 20, int(bdr_s)+275, str, 40 * 2.0, text_color, FONT_SANS_BOLD);
+    ui_draw_text(s, rect.centerX() + 65, int(bdr_s)+280, "km", 30 * 1.6, text_color, FONT_SANS_SEMIBOLD);
   } else if (s->scene.liveMapData.opkrspeedlimit > 29){    
     const std::string cameradist_str = std::to_string((int)std::nearbyint(cameradist));
-    ui_draw_text(s, rect.centerX() - 15, int(bdr_s)+275, cameradist_str.c_str(), 40 * 2.0, text_color, "sans-bold");
-    ui_draw_text(s, rect.centerX() + 65, int(bdr_s)+280, "m", 30 * 1.6, text_color, "sans-semibold");
+    ui_draw_text(s, rect.centerX() - 15, int(bdr_s)+275, cameradist_str.c_str(), 40 * 2.0, text_color, FONT_SANS_BOLD);
+    ui_draw_text(s, rect.centerX() + 65, int(bdr_s)+280, "m", 30 * 1.6, text_color, FONT_SANS_SEMIBOLD);
   } else {
     const std::string cameradist_str = std::to_string((int)std::nearbyint(cameradist));
-    ui_draw_text(s, rect.centerX() - 15, int(bdr_s)+275, cameradist_str.c_str(), 36 * 2.0, text_color, "sans-semibold");
-    ui_draw_text(s, rect.centerX() + 65, int(bdr_s)+280, "m", 26 * 1.6, text_color, "sans-semibold");
+    ui_draw_text(s, rect.centerX() - 15, int(bdr_s)+275, cameradist_str.c_str(), 36 * 2.0, text_color, FONT_SANS_SEMIBOLD);
+    ui_draw_text(s, rect.centerX() + 65, int(bdr_s)+280, "m", 26 * 1.6, text_color, FONT_SANS_SEMIBOLD);
   } 
 }
 
@@ -757,8 +796,8 @@ static void ui_draw_vision_speed(UIState *s) {
   if (scene.brakePress && !scene.comma_stock_ui) val_color = nvgRGBA(180, 0, 0, 200);
   else if (scene.brakeLights && !scene.comma_stock_ui) val_color = nvgRGBA(255, 100, 0, 200);
   nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE);
-  ui_draw_text(s, s->fb_w/2, 210, speed_str.c_str(), 96 * 2.5, val_color, "sans-bold");
-  ui_draw_text(s, s->fb_w/2, 290, s->scene.is_metric ? "km/h" : "mph", 36 * 2.5, COLOR_WHITE_ALPHA(200), "sans-regular");
+  ui_draw_text(s, s->fb_w/2, 210, speed_str.c_str(), 96 * 2.5, val_color, FONT_SANS_BOLD);
+  ui_draw_text(s, s->fb_w/2, 290, s->scene.is_metric ? "km/h" : "mph", 36 * 2.5, COLOR_WHITE_ALPHA(200), FONT_SANS_REGULAR);
 }
 
 static void ui_draw_vision_event(UIState *s) {
@@ -839,26 +878,133 @@ static void ui_draw_vision_event(UIState *s) {
   if (!s->scene.comma_stock_ui) ui_draw_debug(s);
 }
 
+// The texts that are drawn again and again, like the values of the bottom bar, are laid out by
+// fontstash on every nvgText. They are rendered once in white into an atlas and then drawn as one
+// quad of it, tinted by the color. A new text is drawn with nvgText until the next ui_draw put it
+// in the atlas, and when the atlas is full it starts over.
+const int TEXT_ATLAS_W = 2048;
+const int TEXT_ATLAS_H = 1024;
+// around the bounds of nanovg, for the antialiasing
+const int TEXT_ATLAS_PAD = 2;
+
+struct TextCache {
+  struct Key {
+    UIFont font;
+    float size;
+    int align;
+    std::string text;
+    bool operator<(const Key &k) const { return std::tie(font, size, align, text) < std::tie(k.font, k.size, k.align, k.text); }
+  };
+  // the rect in the atlas, and where it is from the origin of the text
+  struct Entry {
+    float x, y, w, h;
+    float dx, dy;
+  };
+
+  NVGLUframebuffer *fb = nullptr;
+  std::map<Key, Entry> entries;
+  std::set<Key> pending;
+  // the rows of the atlas, filled left to right
+  float shelf_x = 0, shelf_y = 0, shelf_h = 0;
+  bool full = false;
+};
+
+static void ui_draw_cached_text(UIState *s, float x, float y, const char *text, UIFont font, float size, int align, NVGcolor color) {
+  TextCache *cache = s->text_cache;
+  TextCache::Key key = {font, size, align, text};
+  auto it = cache->entries.find(key);
+  if (it == cache->entries.end()) {
+    nvgFontFaceId(s->vg, s->fonts[font]);
+    nvgFontSize(s->vg, size);
+    nvgTextAlign(s->vg, align);
+    nvgFillColor(s->vg, color);
+    nvgText(s->vg, x, y, text, NULL);
+    cache->pending.insert(std::move(key));
+    return;
+  }
+
+  // at whole pixels like in the atlas, nanovg tints the premultiplied white by the inner color
+  const TextCache::Entry &e = it->second;
+  const float qx = std::round(x) + e.dx;
+  const float qy = std::round(y) + e.dy;
+  NVGpaint paint = nvgImagePattern(s->vg, qx - e.x, qy - e.y, TEXT_ATLAS_W, TEXT_ATLAS_H, 0, cache->fb->image, 1.0f);
+  paint.innerColor = paint.outerColor = color;
+  nvgBeginPath(s->vg);
+  nvgRect(s->vg, qx, qy, e.w, e.h);
+  nvgFillPaint(s->vg, paint);
+  nvgFill(s->vg);
+}
+
+// Renders the texts that were missing in the atlas, out of the nanovg frame of ui_draw
+static void ui_update_text_cache(UIState *s) {
+  TextCache *cache = s->text_cache;
+  if (cache->pending.empty()) return;
+
+  if (!cache->fb) {
+    cache->fb = nvgluCreateFramebuffer(s->vg, TEXT_ATLAS_W, TEXT_ATLAS_H, NVG_IMAGE_PREMULTIPLIED | NVG_IMAGE_FLIPY);
+    assert(cache->fb != nullptr);
+    cache->full = true;
+  }
+
+  GLint prev_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, cache->fb->fbo);
+  glViewport(0, 0, TEXT_ATLAS_W, TEXT_ATLAS_H);
+  if (cache->full) {
+    cache->entries.clear();
+    cache->shelf_x = cache->shelf_y = cache->shelf_h = 0;
+    cache->full = false;
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  }
+
+  nvgBeginFrame(s->vg, TEXT_ATLAS_W, TEXT_ATLAS_H, 1.0f);
+  nvgFillColor(s->vg, COLOR_WHITE);
+  for (auto it = cache->pending.begin(); it != cache->pending.end(); it = cache->pending.erase(it)) {
+    const TextCache::Key &key = *it;
+    nvgFontFaceId(s->vg, s->fonts[key.font]);
+    nvgFontSize(s->vg, key.size);
+    nvgTextAlign(s->vg, key.align);
+    float bounds[4];
+    nvgTextBounds(s->vg, 0, 0, key.text.c_str(), NULL, bounds);
+    const float dx = std::floor(bounds[0]) - TEXT_ATLAS_PAD;
+    const float dy = std::floor(bounds[1]) - TEXT_ATLAS_PAD;
+    const float w = std::ceil(bounds[2]) + TEXT_ATLAS_PAD - dx;
+    const float h = std::ceil(bounds[3]) + TEXT_ATLAS_PAD - dy;
+
+    if (cache->shelf_x + w > TEXT_ATLAS_W) {
+      cache->shelf_x = 0;
+      cache->shelf_y += cache->shelf_h;
+      cache->shelf_h = 0;
+    }
+    if (w > TEXT_ATLAS_W || cache->shelf_y + h > TEXT_ATLAS_H) {
+      // the rest waits for the next update, that starts over
+      cache->full = true;
+      break;
+    }
+    nvgText(s->vg, cache->shelf_x - dx, cache->shelf_y - dy, key.text.c_str(), NULL);
+    cache->entries[key] = {cache->shelf_x, cache->shelf_y, w, h, dx, dy};
+    cache->shelf_x += w;
+    cache->shelf_h = std::max(cache->shelf_h, h);
+  }
+  nvgEndFrame(s->vg);
+  glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+}
+
 //BB START: functions added for the display of various items
 static int bb_ui_draw_measure(UIState *s, const char* bb_value, const char* bb_uom, const char* bb_label,
     int bb_x, int bb_y, int bb_uom_dx,
     NVGcolor bb_valueColor, NVGcolor bb_labelColor, NVGcolor bb_uomColor,
     int bb_valueFontSize, int bb_labelFontSize, int bb_uomFontSize )  {
-  nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE);
+  const int align = NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE;
   int dx = 0;
   if (strlen(bb_uom) > 0) {
     dx = (int)(bb_uomFontSize*2.5/2);
    }
   //print value
-  nvgFontFace(s->vg, "sans-semibold");
-  nvgFontSize(s->vg, bb_valueFontSize*2.5);
-  nvgFillColor(s->vg, bb_valueColor);
-  nvgText(s->vg, bb_x-dx/2, bb_y+ (int)(bb_valueFontSize*2.5)+5, bb_value, NULL);
+  ui_draw_cached_text(s, bb_x-dx/2, bb_y+ (int)(bb_valueFontSize*2.5)+5, bb_value, FONT_SANS_SEMIBOLD, bb_valueFontSize*2.5, align, bb_valueColor);
   //print label
-  nvgFontFace(s->vg, "sans-regular");
-  nvgFontSize(s->vg, bb_labelFontSize*2.5);
-  nvgFillColor(s->vg, bb_labelColor);
-  nvgText(s->vg, bb_x, bb_y + (int)(bb_valueFontSize*2.5)+5 + (int)(bb_labelFontSize*2.5)+5, bb_label, NULL);
+  ui_draw_cached_text(s, bb_x, bb_y + (int)(bb_valueFontSize*2.5)+5 + (int)(bb_labelFontSize*2.5)+5, bb_label, FONT_SANS_REGULAR, bb_labelFontSize*2.5, align, bb_labelColor);
   //print uom
   if (strlen(bb_uom) > 0) {
       nvgSave(s->vg);
@@ -866,12 +1012,11 @@ static int bb_ui_draw_measure(UIState *s, const char* bb_value, const char* bb_u
     int ry = bb_y + (int)(bb_valueFontSize*2.5/2)+25;
     nvgTranslate(s->vg,rx,ry);
     nvgRotate(s->vg, -1.5708); //-90deg in radians
-    nvgFontFace(s->vg, "sans-regular");
-    nvgFontSize(s->vg, (int)(bb_uomFontSize*2.5));
-    nvgFillColor(s->vg, bb_uomColor);
-    nvgText(s->vg, 0, 0, bb_uom, NULL);
+    ui_draw_cached_text(s, 0, 0, bb_uom, FONT_SANS_REGULAR, (int)(bb_uomFontSize*2.5), align, bb_uomColor);
     nvgRestore(s->vg);
   }
+  // the callers draw text of their own after this
+  nvgTextAlign(s->vg, align);
   return (int)((bb_valueFontSize + bb_labelFontSize)*2.5) + 5;
 }
 
@@ -1177,7 +1322,6 @@ static void bb_ui_draw_UI(UIState *s) {
   const int bb_dmr_y = bdr_s + 220;
 
   bb_ui_draw_measures_right(s, bb_dml_x, bb_dml_y, bb_dml_w);
-  bb_ui_draw_measures_left(s, bb_dmr_x, bb_dmr_y-20, bb_dmr_w);
 }
 
 //static void draw_navi_button(UIState *s) {
@@ -1206,7 +1350,7 @@ static void bb_ui_draw_UI(UIState *s) {
 //}
 
 static void draw_laneless_button(UIState *s) {
-  if (s->vipc_client->connected || s->scene.is_OpenpilotViewEnabled) {
+  if (s->vision_connected || s->scene.is_OpenpilotViewEnabled) {
     int btn_w = 140;
     int btn_h = 140;
     int btn_x1 = s->fb_w - btn_w - 195 - 20;
@@ -1219,6 +1363,7 @@ static void draw_laneless_button(UIState *s) {
     nvgStrokeColor(s->vg, nvgRGBA(0,0,0,80));
     nvgStrokeWidth(s->vg, 6);
     nvgStroke(s->vg);
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_SEMIBOLD]);
     nvgFontSize(s->vg, 43);    
     
     if (s->scene.laneless_mode == 0) {
@@ -1255,6 +1400,12 @@ static void draw_laneless_button(UIState *s) {
   }
 }
 
+// from the framebuffer ui_update_hud_layer drew it into
+static void ui_draw_hud_layer(UIState *s) {
+  NVGpaint paint = nvgImagePattern(s->vg, 0, 0, s->fb_w, s->fb_h, 0, s->hud_fb->image, 1.0f);
+  ui_fill_rect(s->vg, {0, 0, s->fb_w, s->fb_h}, paint);
+}
+
 static void ui_draw_vision_header(UIState *s) {
   NVGpaint gradient = nvgLinearGradient(s->vg, 0, header_h - (header_h / 2.5), 0, header_h,
                                         nvgRGBAf(0, 0, 0, 0.45), nvgRGBAf(0, 0, 0, 0));
@@ -1274,9 +1425,9 @@ static void ui_draw_vision_header(UIState *s) {
  
   if (!s->scene.comma_stock_ui) {
     bb_ui_draw_UI(s);
-    ui_draw_tpms(s);
 //    draw_navi_button(s);
   }
+  ui_draw_hud_layer(s);
   if (s->scene.end_to_end && !s->scene.comma_stock_ui) {
     draw_laneless_button(s);
   }
@@ -1393,11 +1544,73 @@ void draw_kr_date_time(UIState *s) {
   nvgStrokeWidth(s->vg, 0);
   nvgStroke(s->vg);
 
+  nvgFontFaceId(s->vg, s->fonts[FONT_SANS_SEMIBOLD]);
   nvgFontSize(s->vg, 50);
   nvgFillColor(s->vg, nvgRGBA(255, 255, 255, 200));
   nvgText(s->vg, s->fb_w/2, rect_y, now, NULL);
 }
 
+// The parts of the hud that only change with the device, the gps or the clock, drawn into a
+// framebuffer of their own when what they show changed, and from there every frame
+static void ui_draw_hud_layer_contents(UIState *s) {
+  const UIScene &scene = s->scene;
+  if (!scene.comma_stock_ui) {
+    const int bb_dmr_w = 180;
+    const int bb_dmr_x = s->fb_w - bb_dmr_w - bdr_s;
+    const int bb_dmr_y = bdr_s + 220;
+    bb_ui_draw_measures_left(s, bb_dmr_x, bb_dmr_y-20, bb_dmr_w);
+    ui_draw_tpms(s);
+  }
+  if ((scene.kr_date_show || scene.kr_time_show) && !scene.comma_stock_ui) {
+    draw_kr_date_time(s);
+  }
+}
+
+// everything ui_draw_hud_layer_contents shows, at the precision it shows it
+static HudKey hud_layer_key(const UIState *s) {
+  const UIScene &scene = s->scene;
+  const bool clock = (scene.kr_date_show || scene.kr_time_show) && !scene.comma_stock_ui;
+  return {
+    (double)scene.comma_stock_ui, (double)scene.batt_less,
+    (double)(int)scene.cpuTemp, (double)scene.cpuPerc, (double)(int)scene.ambientTemp, (double)(scene.fanSpeed / 1000),
+    (double)(int)scene.batTemp, (double)(int)scene.batPercent,
+    (double)(scene.deviceState.getBatteryStatus() == "Charging"),
+    std::round(scene.gpsAccuracyUblox * 100), (double)scene.satelliteCount, std::round(scene.altitudeUblox),
+    scene.tpmsPressureFl, scene.tpmsPressureFr, scene.tpmsPressureRl, scene.tpmsPressureRr,
+    (double)scene.kr_date_show, (double)scene.kr_time_show,
+    // seconds, the date is part of them
+    clock ? (double)time(NULL) : 0.0,
+  };
+}
+
+static void ui_update_hud_layer(UIState *s) {
+  const HudKey key = hud_layer_key(s);
+  const bool resized = s->hud_fb_w != s->fb_w || s->hud_fb_h != s->fb_h;
+  if (s->hud_fb && !resized && key == s->hud_key) return;
+
+  if (!s->hud_fb || resized) {
+    if (s->hud_fb) nvgluDeleteFramebuffer(s->hud_fb);
+    // nanovg draws premultiplied, and bottom up into a framebuffer
+    s->hud_fb = nvgluCreateFramebuffer(s->vg, s->fb_w, s->fb_h, NVG_IMAGE_PREMULTIPLIED | NVG_IMAGE_FLIPY);
+    assert(s->hud_fb != nullptr);
+    s->hud_fb_w = s->fb_w;
+    s->hud_fb_h = s->fb_h;
+  }
+  s->hud_key = key;
+
+  // the qt widget draws into a framebuffer object as well
+  GLint prev_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, s->hud_fb->fbo);
+  glViewport(0, 0, s->fb_w, s->fb_h);
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  nvgBeginFrame(s->vg, s->fb_w, s->fb_h, 1.0f);
+  ui_draw_hud_layer_contents(s);
+  nvgEndFrame(s->vg);
+  glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+}
+
 // live camera offset adjust by OPKR
 static void ui_draw_live_tune_panel(UIState *s) {
   const int width = 160;
@@ -1518,16 +1731,52 @@ static void ui_draw_vision(UIState *s) {
   if (scene->live_tune_panel_enable) {
     ui_draw_live_tune_panel(s);
   }
-  if ((scene->kr_date_show || scene->kr_time_show) && !scene->comma_stock_ui) {
-    draw_kr_date_time(s);
+}
+
+// the p50 and p99 of the stages of FrameProfiler, over the last frames, and the hit rates of the caches
+static void ui_draw_profiler(UIState *s) {
+  FrameProfiler &profiler = FrameProfiler::instance();
+  const auto stats = profiler.stats();
+  const auto caches = profiler.cacheStats();
+  const int x = 220, w = 620, line_h = 40;
+  const int h = (stats.size() + caches.size() + 2) * line_h + 20;
+  const int y = (s->fb_h - h) / 2;
+  ui_fill_rect(s->vg, {x, y, w, h}, COLOR_BLACK_ALPHA(160), 20);
+
+  nvgTextAlign(s->vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+  nvgFontFaceId(s->vg, s->fonts[FONT_SANS_REGULAR]);
+  nvgFontSize(s->vg, 34);
+  nvgFillColor(s->vg, COLOR_WHITE_ALPHA(220));
+  int ty = y + 10;
+  nvgText(s->vg, x + 20, ty, "stage", NULL);
+  nvgText(s->vg, x + 380, ty, "p50 ms", NULL);
+  nvgText(s->vg, x + 500, ty, "p99 ms", NULL);
+  for (const auto &st : stats) {
+    ty += line_h;
+    nvgText(s->vg, x + 20, ty, st.name.c_str(), NULL);
+    ui_print(s, x + 380, ty, "%.2f", st.p50_ms);
+    ui_print(s, x + 500, ty, "%.2f", st.p99_ms);
+  }
+  ty += line_h;
+  ui_print(s, x + 20, ty, "dropped vsyncs %d", profiler.droppedVsyncs());
+  for (const auto &c : caches) {
+    ty += line_h;
+    ui_print(s, x + 20, ty, "%s hits %.0f%% of %d", c.name.c_str(), 100.0 * c.hits / c.total, c.total);
   }
 }
 
 void ui_draw(UIState *s, int w, int h) {
-  const bool draw_vision = s->scene.started && s->vipc_client->connected;
+  FrameProfiler::Scope scope("ui_draw");
+  const bool draw_vision = s->scene.started && s->vision_connected;
 
-  glViewport(0, 0, s->fb_w, s->fb_h);
   if (draw_vision) {
+    FrameProfiler::Scope scope("ui_update_hud_layer");
+    ui_update_text_cache(s);
+    ui_update_hud_layer(s);
+  }
+  glViewport(s->fb_x, s->fb_y, s->fb_w, s->fb_h);
+  if (draw_vision) {
+    FrameProfiler::Scope scope("draw_vision_frame");
     draw_vision_frame(s);
   }
   glEnable(GL_BLEND);
@@ -1535,9 +1784,62 @@ void ui_draw(UIState *s, int w, int h) {
   // NVG drawing functions - should be no GL inside NVG frame
   nvgBeginFrame(s->vg, s->fb_w, s->fb_h, 1.0f);
   if (draw_vision) {
-    ui_draw_vision(s);
+    {
+      FrameProfiler::Scope scope("ui_draw_vision");
+      ui_draw_vision(s);
+    }
     dashcam(s);
   }
+  if (FrameProfiler::instance().showOverlay()) {
+    ui_draw_profiler(s);
+  }
+  {
+    // where nanovg renders what it was given
+    FrameProfiler::Scope scope("nvgEndFrame");
+    nvgEndFrame(s->vg);
+  }
+  glDisable(GL_BLEND);
+}
+
+// as OnroadAlerts::paintEvent, for the direct render that has no widgets over it
+void ui_draw_alert(UIState *s, const Alert &alert, const QColor &color) {
+  if (alert.size == cereal::ControlsState::AlertSize::NONE) return;
+
+  const int h = alert.size == cereal::ControlsState::AlertSize::SMALL ? 271 :
+                alert.size == cereal::ControlsState::AlertSize::MID ? 420 : s->fb_h;
+  const Rect r = {0, s->fb_h - h, s->fb_w, h};
+  const std::string text1 = alert.text1.toStdString(), text2 = alert.text2.toStdString();
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  nvgBeginFrame(s->vg, s->fb_w, s->fb_h, 1.0f);
+  ui_fill_rect(s->vg, r, nvgRGBA(color.red(), color.green(), color.blue(), color.alpha()));
+  ui_fill_rect(s->vg, r, nvgLinearGradient(s->vg, r.x, r.y, r.x, r.bottom(), COLOR_BLACK_ALPHA(13), COLOR_BLACK_ALPHA(89)));
+
+  nvgFillColor(s->vg, COLOR_WHITE);
+  nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_MIDDLE);
+  const int cy = r.y + r.h / 2;
+  if (alert.size == cereal::ControlsState::AlertSize::SMALL) {
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_SEMIBOLD]);
+    nvgFontSize(s->vg, 77);
+    nvgText(s->vg, r.centerX(), cy, text1.c_str(), NULL);
+  } else if (alert.size == cereal::ControlsState::AlertSize::MID) {
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_BOLD]);
+    nvgFontSize(s->vg, 88);
+    nvgText(s->vg, r.centerX(), cy - 50, text1.c_str(), NULL);
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_REGULAR]);
+    nvgFontSize(s->vg, 66);
+    nvgText(s->vg, r.centerX(), cy + 66, text2.c_str(), NULL);
+  } else {
+    const bool l = alert.text1.length() > 15;
+    nvgTextAlign(s->vg, NVG_ALIGN_CENTER | NVG_ALIGN_TOP);
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_BOLD]);
+    nvgFontSize(s->vg, l ? 132 : 177);
+    nvgTextBox(s->vg, 0, r.y + (l ? 240 : 270), s->fb_w, text1.c_str(), NULL);
+    nvgFontFaceId(s->vg, s->fonts[FONT_SANS_REGULAR]);
+    nvgFontSize(s->vg, 88);
+    nvgTextBox(s->vg, 0, r.h - (l ? 361 : 420), s->fb_w, text2.c_str(), NULL);
+  }
   nvgEndFrame(s->vg);
   glDisable(GL_BLEND);
 }
@@ -1620,15 +1922,18 @@ void ui_nvg_init(UIState *s) {
   assert(s->vg);
 
   // init fonts
+  // in the order of UIFont
   std::pair<const char *, const char *> fonts[] = {
       {"sans-regular", "../assets/fonts/opensans_regular.ttf"},
       {"sans-semibold", "../assets/fonts/opensans_semibold.ttf"},
       {"sans-bold", "../assets/fonts/opensans_bold.ttf"},
   };
-  for (auto [name, file] : fonts) {
-    int font_id = nvgCreateFont(s->vg, name, file);
-    assert(font_id >= 0);
+  static_assert(std::size(fonts) == FONT_COUNT);
+  for (int i = 0; i < FONT_COUNT; i++) {
+    s->fonts[i] = nvgCreateFont(s->vg, fonts[i].first, fonts[i].second);
+    assert(s->fonts[i] >= 0);
   }
+  s->text_cache = new TextCache();
 
   // init images
   std::vector<std::pair<const char *, const char *>> images = {
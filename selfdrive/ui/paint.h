@@ -3,6 +3,7 @@
 #include "selfdrive/ui/ui.h"
 
 void ui_draw(UIState *s, int w, int h);
+void ui_draw_alert(UIState *s, const Alert &alert, const QColor &color);
 void ui_draw_image(const UIState *s, const Rect &r, const char *name, float alpha);
 void ui_draw_rect(NVGcontext *vg, const Rect &r, NVGcolor color, int width, float radius = 0);
 void ui_fill_rect(NVGcontext *vg, const Rect &r, const NVGpaint &paint, float radius = 0);
@@ -4,10 +4,14 @@
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 
+#include <algorithm>
+#include <mutex>
+
 #include <QCryptographicHash>
 #include <QDateTime>
 #include <QDebug>
 #include <QFile>
+#include <QHash>
 #include <QJsonDocument>
 #include <QNetworkRequest>
 
@@ -18,6 +22,9 @@
 
 namespace CommaApi {
 
+// a token is made again this long before it expires, or half its lifetime if that's shorter
+const int JWT_REFRESH_MARGIN = 5 * 60;
+
 QByteArray rsa_sign(const QByteArray &data) {
   auto file = QFile(Path::rsa_file().c_str());
   if (!file.open(QIODevice::ReadOnly)) {
@@ -43,9 +50,22 @@ QByteArray rsa_sign(const QByteArray &data) {
 }
 
 QString create_jwt(const QJsonObject &payloads, int expiry) {
-  QJsonObject header = {{"alg", "RS256"}};
+  struct Token {
+    QString jwt;
+    qint64 refresh_at;
+  };
+  static std::mutex lock;
+  static QHash<QString, Token> tokens;
 
   auto t = QDateTime::currentSecsSinceEpoch();
+  const QString key = QJsonDocument(payloads).toJson(QJsonDocument::Compact) + QString::number(expiry);
+  std::lock_guard lk(lock);
+  auto cached = tokens.find(key);
+  if (cached != tokens.end() && t < cached->refresh_at) {
+    return cached->jwt;
+  }
+
+  QJsonObject header = {{"alg", "RS256"}};
   QJsonObject payload = {{"identity", getDongleId().value_or("")}, {"nbf", t}, {"iat", t}, {"exp", t + expiry}};
   for (auto it = payloads.begin(); it != payloads.end(); ++it) {
     payload.insert(it.key(), it.value());
@@ -58,14 +78,21 @@ QString create_jwt(const QJsonObject &payloads, int expiry) {
   auto hash = QCryptographicHash::hash(jwt.toUtf8(), QCryptographicHash::Sha256);
   auto sig = rsa_sign(hash);
   jwt += '.' + sig.toBase64(b64_opts);
+  // without a key it's made again, until there is one
+  if (!sig.isEmpty()) {
+    tokens[key] = {jwt, t + expiry - std::min(JWT_REFRESH_MARGIN, expiry / 2)};
+  }
   return jwt;
 }
 
+QNetworkAccessManager *networkAccessManager() {
+  static thread_local QNetworkAccessManager *manager = new QNetworkAccessManager();
+  return manager;
+}
+
 }  // namespace CommaApi
 
 HttpRequest::HttpRequest(QObject *parent, bool create_jwt, int timeout) : create_jwt(create_jwt), QObject(parent) {
-  networkAccessManager = new QNetworkAccessManager(this);
-
   networkTimer = new QTimer(this);
   networkTimer->setSingleShot(true);
   networkTimer->setInterval(timeout);
@@ -93,11 +120,17 @@ void HttpRequest::sendRequest(const QString &requestURL, const HttpRequest::Meth
   QNetworkRequest request;
   request.setUrl(QUrl(requestURL));
   request.setRawHeader(QByteArray("Authorization"), ("JWT " + token).toUtf8());
+  // the connections to the api are kept open and shared, over HTTP/2 if the server has it
+  request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
 
+  QNetworkAccessManager *manager = CommaApi::networkAccessManager();
   if (method == HttpRequest::Method::GET) {
-    reply = networkAccessManager->get(request);
+    if (request.url().toString() == etag_url) {
+      request.setRawHeader("If-None-Match", etag);
+    }
+    reply = manager->get(request);
   } else if (method == HttpRequest::Method::DELETE) {
-    reply = networkAccessManager->deleteResource(request);
+    reply = manager->deleteResource(request);
   }
 
   networkTimer->start();
@@ -116,6 +149,14 @@ void HttpRequest::requestFinished() {
     QString response = reply->readAll();
 
     if (reply->error() == QNetworkReply::NoError) {
+      const QString url = reply->request().url().toString();
+      if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304 && url == etag_url) {
+        response = etag_response;
+      } else if (reply->operation() == QNetworkAccessManager::GetOperation && reply->hasRawHeader("ETag")) {
+        etag_url = url;
+        etag = reply->rawHeader("ETag");
+        etag_response = response;
+      }
       success = true;
       emit receivedResponse(response);
     } else {
@@ -123,8 +164,9 @@ void HttpRequest::requestFinished() {
       emit failedResponse(reply->errorString());
     }
   } else {
-    networkAccessManager->clearAccessCache();
-    networkAccessManager->clearConnectionCache();
+    // the connection may be one of a network that is gone
+    CommaApi::networkAccessManager()->clearAccessCache();
+    CommaApi::networkAccessManager()->clearConnectionCache();
     emit timeoutResponse("timeout");
   }
   emit requestDone(success);
@@ -11,12 +11,16 @@ namespace CommaApi {
 
 const QString BASE_URL = util::getenv("API_HOST", "https://api.retropilot.org").c_str();
 QByteArray rsa_sign(const QByteArray &data);
+// The tokens are kept and given again until they are near their expiry, one for each payloads and expiry
 QString create_jwt(const QJsonObject &payloads = {}, int expiry = 3600);
+// Of the thread, for all the requests of the thread to share its connections to the api
+QNetworkAccessManager *networkAccessManager();
 
 }  // namespace CommaApi
 
 /**
  * Makes a request to the request endpoint.
+ * A GET that comes back with an ETag is asked again with If-None-Match, and a 304 is the response before.
  */
 
 class HttpRequest : public QObject {
@@ -33,10 +37,14 @@ protected:
   QNetworkReply *reply = nullptr;
 
 private:
-  QNetworkAccessManager *networkAccessManager = nullptr;
   QTimer *networkTimer = nullptr;
   bool create_jwt;
 
+  // of the last GET with an ETag
+  QString etag_url;
+  QByteArray etag;
+  QString etag_response;
+
 private slots:
   void requestTimeout();
   void requestFinished();
@@ -0,0 +1,83 @@
+#include "selfdrive/ui/qt/direct_render.h"
+
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/ui/paint.h"
+#include "selfdrive/ui/qt/frame_profiler.h"
+#include "selfdrive/ui/qt/onroad.h"
+
+// above the surface of the window of Qt
+const uint32_t DIRECT_RENDER_LAYER = 0x40000000;
+const int DIRECT_RENDER_BUFFERS = 3;
+
+// The context of Qt is current again after the direct render, for the widgets it paints next
+class SavedEGLContext {
+public:
+  SavedEGLContext() : display(eglGetCurrentDisplay()), draw(eglGetCurrentSurface(EGL_DRAW)),
+                      read(eglGetCurrentSurface(EGL_READ)), context(eglGetCurrentContext()) {}
+  ~SavedEGLContext() {
+    if (context != EGL_NO_CONTEXT) eglMakeCurrent(display, draw, read, context);
+  }
+
+private:
+  EGLDisplay display;
+  EGLSurface draw, read;
+  EGLContext context;
+};
+
+DirectRender::DirectRender(QWidget *onroad, OnroadAlerts *alerts) : QObject(onroad), onroad(onroad), alerts(alerts) {
+  for (VisionReceiver *v : {QUIState::ui_state.vision_rear, QUIState::ui_state.vision_wide}) {
+    QObject::connect(v, &VisionReceiver::frameReceived, this, &DirectRender::render);
+  }
+}
+
+void DirectRender::updateState(const UIState &s) {
+  // nothing of Qt next to the camera view
+  setShown(onroad->isVisible() && s.vision_connected && onroad->width() == onroad->window()->width());
+  // the HUD and the alerts change without frames too
+  render();
+}
+
+void DirectRender::setShown(bool show) {
+  if (show == shown) return;
+
+  if (show && !fb) {
+    SavedEGLContext saved;
+    fb = std::make_unique<FrameBuffer>("onroad", DIRECT_RENDER_LAYER, false, &fb_w, &fb_h, DIRECT_RENDER_BUFFERS);
+    eglSwapInterval(eglGetCurrentDisplay(), 1);
+
+    // the view inside the border, as the NvgWindow in the margins of OnroadWindow
+    UIState *s = &QUIState::ui_state;
+    s->fb_x = s->fb_y = bdr_s;
+    s->fb_w = fb_w - 2 * bdr_s;
+    s->fb_h = fb_h - 2 * bdr_s;
+    ui_nvg_init(s);
+  }
+  fb->set_visible(show);
+  shown = show;
+}
+
+void DirectRender::render() {
+  if (!shown) return;
+
+  UIState *s = &QUIState::ui_state;
+  SavedEGLContext saved;
+  fb->make_current();
+  {
+    FrameProfiler::Scope scope("DirectRender");
+    const double cpu_start = millis_thread_cpu();
+    const QColor bg = alerts->color();
+    glViewport(0, 0, fb_w, fb_h);
+    glClearColor(bg.redF(), bg.greenF(), bg.blueF(), 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    ui_draw(s, s->fb_w, s->fb_h);
+    ui_draw_alert(s, alerts->current(), bg);
+    s->draw_cpu_ms = millis_thread_cpu() - cpu_start;
+  }
+  fb->swap();
+
+  FrameProfiler::instance().frameSwapped(s->last_frame_presented ? 0 : s->last_frame_eof);
+  s->last_frame_presented = true;
+}
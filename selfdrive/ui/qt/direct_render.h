@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+
+#include <QObject>
+#include <QWidget>
+
+#include "selfdrive/common/framebuffer.h"
+#include "selfdrive/ui/ui.h"
+
+class OnroadAlerts;
+
+// The onroad view drawn straight into a SurfaceFlinger surface of its own, over the window of Qt: the
+// camera frame, ui_draw and the alert in one GL pass, without the FBO of a QOpenGLWidget that Qt then
+// composites into its window. The surface has three buffers and a swap interval of one, the swap of a
+// frame only waits for a vsync when two are queued already. "camera to present" of the profiler is
+// from the end of the exposure of a frame to its swap, as it is for NvgWindow.
+// Shown while the onroad view is the whole screen, the sidebar and the offroad views are still Qt's.
+// On EON, with the UIDirectRender param
+class DirectRender : public QObject {
+  Q_OBJECT
+
+public:
+  DirectRender(QWidget *onroad, OnroadAlerts *alerts);
+
+public slots:
+  void updateState(const UIState &s);
+
+private:
+  void render();
+  void setShown(bool show);
+
+  QWidget *onroad;
+  OnroadAlerts *alerts;
+  std::unique_ptr<FrameBuffer> fb;
+  int fb_w = 0, fb_h = 0;
+  bool shown = false;
+};
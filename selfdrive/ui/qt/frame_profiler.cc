@@ -0,0 +1,132 @@
+#include "selfdrive/ui/qt/frame_profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+#include "selfdrive/ui/qt/params_cache.h"
+
+// per stage, about 10s of frames
+const int STAGE_HISTORY = 200;
+// the displays of the devices and most monitors
+const double VSYNC_MS = 1000.0 / 60;
+// the road camera, that triggers the paints of the onroad view
+const double FRAME_MS = 1000.0 / 20;
+
+static double percentile(std::vector<double> v, double p) {
+  auto it = v.begin() + (v.size() - 1) * p;
+  std::nth_element(v.begin(), it, v.end());
+  return *it;
+}
+
+FrameProfiler &FrameProfiler::instance() {
+  static FrameProfiler profiler;
+  return profiler;
+}
+
+FrameProfiler::~FrameProfiler() {
+  setTrace(false);
+}
+
+void FrameProfiler::record(const char *name, uint64_t start_us, uint64_t end_us) {
+  std::lock_guard lk(lock);
+  Stage &stage = stages[name];
+  const double ms = (end_us - start_us) / 1000.0;
+  if (stage.ms.size() < STAGE_HISTORY) {
+    stage.ms.push_back(ms);
+  } else {
+    stage.ms[stage.next] = ms;
+  }
+  stage.next = (stage.next + 1) % STAGE_HISTORY;
+
+  if (trace) {
+    char event[256];
+    snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%zu},\n",
+             name, (unsigned long long)start_us, (unsigned long long)(end_us - start_us), std::hash<std::thread::id>{}(std::this_thread::get_id()) % 100000);
+    trace_buf += event;
+  }
+}
+
+void FrameProfiler::frameSwapped(uint64_t camera_eof_ns) {
+  if (camera_eof_ns != 0) {
+    // the part of glass to glass that is the ui's, the display scans it out after the next vsync
+    record("camera to present", camera_eof_ns / 1000, nanos_since_boot() / 1000);
+  }
+
+  const double now = millis_since_boot();
+  if (last_swap_ms > 0) {
+    // the vsyncs since the last swap, past the ones a camera frame takes
+    const int vsyncs = std::round((now - last_swap_ms) / VSYNC_MS);
+    dropped_vsyncs += std::max(0, vsyncs - (int)std::round(FRAME_MS / VSYNC_MS));
+  }
+  last_swap_ms = now;
+
+  if (now - last_stats_ms > 1000) {
+    last_stats_ms = now;
+    updateStats();
+  }
+}
+
+std::vector<FrameProfiler::StageStats> FrameProfiler::stats() {
+  std::lock_guard lk(lock);
+  return last_stats;
+}
+
+void FrameProfiler::cacheAccess(const char *name, bool hit) {
+  std::lock_guard lk(lock);
+  CacheStats &cache = caches.try_emplace(name, CacheStats{name, 0, 0}).first->second;
+  cache.hits += hit;
+  cache.total++;
+}
+
+std::vector<FrameProfiler::CacheStats> FrameProfiler::cacheStats() {
+  std::lock_guard lk(lock);
+  std::vector<CacheStats> ret;
+  for (auto &[name, cache] : caches) {
+    ret.push_back(cache);
+  }
+  return ret;
+}
+
+void FrameProfiler::updateStats() {
+  ParamsCache params;
+  show_overlay = params.getBool("ShowUIProfiler");
+  setTrace(params.getBool("UIProfilerTrace"));
+
+  std::lock_guard lk(lock);
+  last_stats.clear();
+  for (auto &[name, stage] : stages) {
+    last_stats.push_back({name, percentile(stage.ms, 0.5), percentile(stage.ms, 0.99)});
+  }
+  if (trace && !trace_buf.empty()) {
+    fwrite(trace_buf.data(), 1, trace_buf.size(), trace);
+    fflush(trace);
+    trace_buf.clear();
+  }
+}
+
+void FrameProfiler::setTrace(bool on) {
+  std::lock_guard lk(lock);
+  if (on == (trace != nullptr)) return;
+
+  if (on) {
+    // the json array format, it may end without the closing bracket
+    const std::string path = Hardware::PC() ? util::getenv("HOME") + "/ui_trace.json" : "/data/ui_trace.json";
+    trace = fopen(path.c_str(), "w");
+    if (!trace) {
+      LOGE("can't open %s for the ui trace", path.c_str());
+      return;
+    }
+    fputs("[\n", trace);
+    LOGW("writing the ui trace to %s", path.c_str());
+  } else {
+    fwrite(trace_buf.data(), 1, trace_buf.size(), trace);
+    fclose(trace);
+    trace = nullptr;
+    trace_buf.clear();
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/trace.h"
+
+// Times the stages of the UI frames: the updates of QUIState, the paints of the camera views, ui_draw
+// and the map. Keeps the last durations of every stage for the p50 and p99 of the overlay of paint.cc,
+// and counts the vsyncs the onroad view missed, and the hit rates of the caches. With the UIProfilerTrace param the stages are also
+// written as chrome trace events, to be opened in chrome://tracing or perfetto. The stages are
+// spans of trace.h as well, next to the ones of the other processes with OPENPILOT_TRACE.
+class FrameProfiler {
+public:
+  struct StageStats {
+    std::string name;
+    double p50_ms, p99_ms;
+  };
+  struct CacheStats {
+    std::string name;
+    int hits, total;
+  };
+
+  // Records a stage from construction to the end of the scope
+  class Scope {
+  public:
+    Scope(const char *name) : name(name), start_us(nanos_since_boot() / 1000), span(name) {}
+    ~Scope() { FrameProfiler::instance().record(name, start_us, nanos_since_boot() / 1000); }
+
+  private:
+    const char *name;
+    uint64_t start_us;
+    trace::Scope span;
+  };
+
+  static FrameProfiler &instance();
+
+  void record(const char *name, uint64_t start_us, uint64_t end_us);
+  // After each swap of the onroad view, also reads the params and updates the stats once a second.
+  // With the end of the exposure of the camera frame it presented, if it's one not presented before
+  void frameSwapped(uint64_t camera_eof_ns = 0);
+
+  bool showOverlay() const { return show_overlay; }
+  // of the last update, the stages by name
+  std::vector<StageStats> stats();
+  int droppedVsyncs() const { return dropped_vsyncs; }
+
+  // A lookup of the cache, e.g. of the map tiles or the routes, from any thread
+  void cacheAccess(const char *name, bool hit);
+  // since the start, the caches by name
+  std::vector<CacheStats> cacheStats();
+
+private:
+  FrameProfiler() = default;
+  ~FrameProfiler();
+  void updateStats();
+  void setTrace(bool on);
+
+  // durations in ms, a ring of the last ones
+  struct Stage {
+    std::vector<double> ms;
+    size_t next = 0;
+  };
+
+  std::mutex lock;
+  std::map<std::string, Stage> stages;
+  std::vector<StageStats> last_stats;
+  std::map<std::string, CacheStats> caches;
+
+  bool show_overlay = false;
+  FILE *trace = nullptr;
+  std::string trace_buf;
+
+  double last_swap_ms = 0;
+  double last_stats_ms = 0;
+  int dropped_vsyncs = 0;
+};
@@ -7,6 +7,8 @@
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/ui/ui.h"
 #include "selfdrive/ui/qt/util.h"
+#include "selfdrive/ui/qt/frame_profiler.h"
+#include "selfdrive/ui/qt/maps/map_cache.h"
 #include "selfdrive/ui/qt/maps/map_helpers.h"
 #include "selfdrive/ui/qt/request_repeater.h"
 
@@ -14,6 +16,9 @@
 const int PAN_TIMEOUT = 100;
 const qreal REROUTE_DISTANCE = 25;
 const float MANEUVER_TRANSITION_THRESHOLD = 10;
+const float ROUTE_SIMPLIFY_TOLERANCE = 1.0;
+// the traffic of a cached route is that old at most
+const double ROUTE_CACHE_TTL_MS = 10 * 60 * 1000;
 
 const float MAX_ZOOM = 17;
 const float MIN_ZOOM = 14;
@@ -22,54 +27,59 @@ const float MIN_PITCH = 0;
 const float MAP_SCALE = 2;
 
 
-MapWindow::MapWindow(const QMapboxGLSettings &settings) :
-  m_settings(settings), velocity_filter(0, 10, 0.1) {
-  sm = new SubMaster({"liveLocationKalman"});
-
+MapWindow::MapWindow(const QMapboxGLSettings &settings) : m_settings(settings) {
   timer = new QTimer(this);
   QObject::connect(timer, SIGNAL(timeout()), this, SLOT(timerUpdate()));
   timer->start(100);
 
-  recompute_timer = new QTimer(this);
-  QObject::connect(recompute_timer, SIGNAL(timeout()), this, SLOT(recomputeRoute()));
-  recompute_timer->start(1000);
-
   // Instructions
   map_instructions = new MapInstructions(this);
-  QObject::connect(this, &MapWindow::instructionsChanged, map_instructions, &MapInstructions::updateInstructions);
-  QObject::connect(this, &MapWindow::distanceChanged, map_instructions, &MapInstructions::updateDistance);
   map_instructions->setFixedWidth(width());
   map_instructions->setVisible(false);
 
   map_eta = new MapETA(this);
-  QObject::connect(this, &MapWindow::ETAChanged, map_eta, &MapETA::updateETA);
 
   const int h = 120;
   map_eta->setFixedHeight(h);
   map_eta->move(25, 1080 - h - bdr_s*2);
   map_eta->setVisible(false);
 
-  // Routing
-  QVariantMap parameters;
-  parameters["mapbox.access_token"] = m_settings.accessToken();
-
-  geoservice_provider = new QGeoServiceProvider("mapbox", parameters);
-  routing_manager = geoservice_provider->routingManager();
-  if (routing_manager == nullptr) {
-    qDebug() << geoservice_provider->errorString();
-    assert(routing_manager);
-  }
-  QObject::connect(routing_manager, &QGeoRoutingManager::finished, this, &MapWindow::routeCalculated);
-
   auto last_gps_position = coordinate_from_param("LastGPSPosition");
   if (last_gps_position) {
     last_position = *last_gps_position;
   }
 
+  // Navigation
+  nav_thread = new QThread(this);
+  navigator = new MapNavigator(m_settings.accessToken());
+  navigator->moveToThread(nav_thread);
+  QObject::connect(nav_thread, &QThread::started, navigator, &MapNavigator::start);
+  QObject::connect(nav_thread, &QThread::finished, navigator, &QObject::deleteLater);
+
+  QObject::connect(navigator, &MapNavigator::positionChanged, this, &MapWindow::updatePosition);
+  QObject::connect(navigator, &MapNavigator::waitingForGps, [=]() { localizer_valid = false; });
+  QObject::connect(navigator, &MapNavigator::destinationChanged, [=]() { setVisible(true); });
+  QObject::connect(navigator, &MapNavigator::routeChanged, this, &MapWindow::updateRoute);
+  QObject::connect(navigator, &MapNavigator::routeCleared, this, &MapWindow::clearRoute);
+  QObject::connect(navigator, &MapNavigator::routeFailed, [=]() { map_instructions->showError("Failed to Route"); });
+  QObject::connect(navigator, &MapNavigator::distanceChanged, map_instructions, &MapInstructions::updateDistance);
+  QObject::connect(navigator, &MapNavigator::distanceChanged, [=]() {
+    if (!m_map.isNull()) m_map->setPitch(MAX_PITCH); // TODO: smooth pitching based on maneuver distance
+  });
+  QObject::connect(navigator, &MapNavigator::instructionsChanged, map_instructions, &MapInstructions::updateInstructions);
+  QObject::connect(navigator, &MapNavigator::ETAChanged, map_eta, &MapETA::updateETA);
+  nav_thread->start();
+
+  // the map is made on the first onroad transition, that doesn't get here
+  const bool started = QUIState::ui_state.scene.started;
+  QMetaObject::invokeMethod(navigator, [=]() { navigator->offroadTransition(!started); });
+
   grabGesture(Qt::GestureType::PinchGesture);
 }
 
 MapWindow::~MapWindow() {
+  nav_thread->quit();
+  nav_thread->wait();
   makeCurrent();
 }
 
@@ -120,104 +130,78 @@ void MapWindow::timerUpdate() {
     update();
   }
 
-  sm->update(0);
-  if (sm->updated("liveLocationKalman")) {
-    auto location = (*sm)["liveLocationKalman"].getLiveLocationKalman();
-    gps_ok = location.getGpsOK();
-
-    localizer_valid = location.getStatus() == cereal::LiveLocationKalman::Status::VALID;
-
-    if (localizer_valid) {
-      auto pos = location.getPositionGeodetic();
-      auto orientation = location.getCalibratedOrientationNED();
-
-      float velocity = location.getVelocityCalibrated().getValue()[0];
-      float bearing = RAD2DEG(orientation.getValue()[2]);
-      auto coordinate = QMapbox::Coordinate(pos.getValue()[0], pos.getValue()[1]);
-
-      last_position = coordinate;
-      last_bearing = bearing;
-      velocity_filter.update(velocity);
-    }
-  }
-
   if (m_map.isNull()) {
     return;
   }
 
+  // Retry all timed out requests
+  if (QUIState::ui_state.scene.started && ++timer_count % 10 == 0) {
+    m_map->connectionEstablished();
+  }
+
   loaded_once = loaded_once || m_map->isFullyLoaded();
   if (!loaded_once) {
     map_instructions->showError("Map Loading");
     return;
   }
 
+  // routes are only requested and drawn once the map can show them
+  if (!navigator_loaded) {
+    QMetaObject::invokeMethod(navigator, &MapNavigator::setMapLoaded);
+    navigator_loaded = true;
+  }
+
   initLayers();
 
   if (!localizer_valid) {
     map_instructions->showError("Waiting for GPS");
+  }
+}
+
+void MapWindow::updatePosition(double latitude, double longitude, float bearing, float zoom, QVariantMap car_pos_source) {
+  last_position = QMapbox::Coordinate(latitude, longitude);
+  last_bearing = bearing;
+  last_zoom = zoom;
+  localizer_valid = true;
+
+  if (m_map.isNull() || !loaded_once) {
     return;
   }
 
   if (pan_counter == 0) {
-    if (last_position) m_map->setCoordinate(*last_position);
-    if (last_bearing) m_map->setBearing(*last_bearing);
+    m_map->setCoordinate(*last_position);
+    m_map->setBearing(bearing);
   } else {
     pan_counter--;
   }
 
   if (zoom_counter == 0) {
-    m_map->setZoom(util::map_val<float>(velocity_filter.x(), 0, 30, MAX_ZOOM, MIN_ZOOM));
+    m_map->setZoom(zoom);
   } else {
     zoom_counter--;
   }
 
   // Update current location marker
-  auto point = coordinate_to_collection(*last_position);
-  QMapbox::Feature feature1(QMapbox::Feature::PointType, point, {}, {});
-  QVariantMap carPosSource;
-  carPosSource["type"] = "geojson";
-  carPosSource["data"] = QVariant::fromValue<QMapbox::Feature>(feature1);
-  m_map->updateSource("carPosSource", carPosSource);
+  m_map->updateSource("carPosSource", car_pos_source);
+}
 
-  // Show route instructions
-  if (segment.isValid()) {
-    auto cur_maneuver = segment.maneuver();
-    auto attrs = cur_maneuver.extendedAttributes();
-    if (cur_maneuver.isValid() && attrs.contains("mapbox.banner_instructions")) {
-      float along_geometry = distance_along_geometry(segment.path(), to_QGeoCoordinate(*last_position));
-      float distance_to_maneuver = segment.distance() - along_geometry;
-      emit distanceChanged(std::max(0.0f, distance_to_maneuver));
-
-      m_map->setPitch(MAX_PITCH); // TODO: smooth pitching based on maneuver distance
-
-      auto banner = attrs["mapbox.banner_instructions"].toList();
-      if (banner.size()) {
-        auto banner_0 = banner[0].toMap();
-        float show_at = banner_0["distance_along_geometry"].toDouble();
-        emit instructionsChanged(banner_0, distance_to_maneuver < show_at);
-      }
+void MapWindow::updateRoute(QVariantMap nav_source) {
+  if (m_map.isNull()) {
+    return;
+  }
 
-      // Transition to next route segment
-      if (!shouldRecompute() && (distance_to_maneuver < -MANEUVER_TRANSITION_THRESHOLD)) {
-        auto next_segment = segment.nextRouteSegment();
-        if (next_segment.isValid()) {
-          segment = next_segment;
-
-          recompute_backoff = std::max(0, recompute_backoff - 1);
-          recompute_countdown = 0;
-        } else {
-          qWarning() << "Destination reached";
-          Params().remove("NavDestination");
-
-          // Clear route if driving away from destination
-          float d = segment.maneuver().position().distanceTo(to_QGeoCoordinate(*last_position));
-          if (d > REROUTE_DISTANCE) {
-            clearRoute();
-          }
-        }
-      }
-    }
+  m_map->updateSource("navSource", nav_source);
+  m_map->setLayoutProperty("navLayer", "visibility", "visible");
+}
+
+void MapWindow::clearRoute() {
+  if (!m_map.isNull()) {
+    m_map->setLayoutProperty("navLayer", "visibility", "none");
+    m_map->setPitch(MIN_PITCH);
   }
+
+  map_instructions->hideIfNoError();
+  map_eta->setVisible(false);
 }
 
 void MapWindow::resizeGL(int w, int h) {
@@ -248,9 +232,132 @@ void MapWindow::initializeGL() {
 
 void MapWindow::paintGL() {
   if (!isVisible()) return;
+  FrameProfiler::Scope scope("MapWindow::paintGL");
   m_map->render();
 }
 
+MapNavigator::MapNavigator(const QString &access_token) : access_token(access_token), velocity_filter(0, 10, 0.1) {}
+
+MapNavigator::~MapNavigator() {
+  delete geoservice_provider;
+}
+
+void MapNavigator::start() {
+  sm = std::make_unique<SubMaster, const std::initializer_list<const char *>>({"liveLocationKalman"});
+
+  timer = new QTimer(this);
+  QObject::connect(timer, &QTimer::timeout, this, &MapNavigator::timerUpdate);
+  timer->start(100);
+
+  recompute_timer = new QTimer(this);
+  QObject::connect(recompute_timer, &QTimer::timeout, this, &MapNavigator::recomputeRoute);
+  recompute_timer->start(1000);
+
+  // Routing
+  QVariantMap parameters;
+  parameters["mapbox.access_token"] = access_token;
+
+  geoservice_provider = new QGeoServiceProvider("mapbox", parameters);
+  routing_manager = geoservice_provider->routingManager();
+  if (routing_manager == nullptr) {
+    qDebug() << geoservice_provider->errorString();
+    assert(routing_manager);
+  }
+  QObject::connect(routing_manager, &QGeoRoutingManager::finished, this, &MapNavigator::routeCalculated);
+}
+
+void MapNavigator::setMapLoaded() {
+  map_loaded = true;
+}
+
+void MapNavigator::offroadTransition(bool offroad) {
+  started = !offroad;
+  last_bearing = {};
+}
+
+void MapNavigator::timerUpdate() {
+  sm->update(0);
+  if (!sm->updated("liveLocationKalman")) {
+    return;
+  }
+
+  auto location = (*sm)["liveLocationKalman"].getLiveLocationKalman();
+  gps_ok = location.getGpsOK();
+
+  localizer_valid = location.getStatus() == cereal::LiveLocationKalman::Status::VALID;
+  if (!localizer_valid) {
+    emit waitingForGps();
+    return;
+  }
+
+  auto pos = location.getPositionGeodetic();
+  auto orientation = location.getCalibratedOrientationNED();
+
+  float velocity = location.getVelocityCalibrated().getValue()[0];
+  float bearing = RAD2DEG(orientation.getValue()[2]);
+  auto coordinate = QMapbox::Coordinate(pos.getValue()[0], pos.getValue()[1]);
+
+  last_position = coordinate;
+  last_bearing = bearing;
+  velocity_filter.update(velocity);
+
+  // Current location marker
+  auto point = coordinate_to_collection(coordinate);
+  QMapbox::Feature feature1(QMapbox::Feature::PointType, point, {}, {});
+  QVariantMap carPosSource;
+  carPosSource["type"] = "geojson";
+  carPosSource["data"] = QVariant::fromValue<QMapbox::Feature>(feature1);
+
+  float zoom = util::map_val<float>(velocity_filter.x(), 0, 30, MAX_ZOOM, MIN_ZOOM);
+  emit positionChanged(coordinate.first, coordinate.second, bearing, zoom, carPosSource);
+
+  if (map_loaded) {
+    updateInstructions();
+  }
+}
+
+void MapNavigator::updateInstructions() {
+  // Show route instructions
+  if (!segment.isValid()) {
+    return;
+  }
+
+  auto cur_maneuver = segment.maneuver();
+  auto attrs = cur_maneuver.extendedAttributes();
+  if (cur_maneuver.isValid() && attrs.contains("mapbox.banner_instructions")) {
+    float along_geometry = distance_along_geometry(segment.path(), to_QGeoCoordinate(*last_position));
+    float distance_to_maneuver = segment.distance() - along_geometry;
+    emit distanceChanged(std::max(0.0f, distance_to_maneuver));
+
+    auto banner = attrs["mapbox.banner_instructions"].toList();
+    if (banner.size()) {
+      auto banner_0 = banner[0].toMap();
+      float show_at = banner_0["distance_along_geometry"].toDouble();
+      emit instructionsChanged(banner_0, distance_to_maneuver < show_at);
+    }
+
+    // Transition to next route segment
+    if (!shouldRecompute() && (distance_to_maneuver < -MANEUVER_TRANSITION_THRESHOLD)) {
+      auto next_segment = segment.nextRouteSegment();
+      if (next_segment.isValid()) {
+        segment = next_segment;
+
+        recompute_backoff = std::max(0, recompute_backoff - 1);
+        recompute_countdown = 0;
+      } else {
+        qWarning() << "Destination reached";
+        Params().remove("NavDestination");
+
+        // Clear route if driving away from destination
+        float d = segment.maneuver().position().distanceTo(to_QGeoCoordinate(*last_position));
+        if (d > REROUTE_DISTANCE) {
+          clearRoute();
+        }
+      }
+    }
+  }
+}
+
 static float get_time_typical(const QGeoRouteSegment &segment) {
   auto maneuver = segment.maneuver();
   auto attrs = maneuver.extendedAttributes();
@@ -258,16 +365,11 @@ static float get_time_typical(const QGeoRouteSegment &segment) {
 }
 
 
-void MapWindow::recomputeRoute() {
-  if (!QUIState::ui_state.scene.started) {
+void MapNavigator::recomputeRoute() {
+  if (!started) {
     return;
   }
 
-  // Retry all timed out requests
-  if (!m_map.isNull()) {
-    m_map->connectionEstablished();
-  }
-
   if (!last_position) {
     return;
   }
@@ -284,7 +386,7 @@ void MapWindow::recomputeRoute() {
 
     // Only open the map on setting destination the first time
     if (allow_open) {
-      setVisible(true); // Show map on destination set/change
+      emit destinationChanged(); // Show map on destination set/change
       allow_open = false;
     }
 
@@ -298,7 +400,7 @@ void MapWindow::recomputeRoute() {
   if (!gps_ok && segment.isValid()) return; // Don't recompute when gps drifts in tunnels
 
   // Only do API request when map is fully loaded
-  if (loaded_once) {
+  if (map_loaded) {
     if (recompute_countdown == 0 && should_recompute) {
       recompute_countdown = std::pow(2, recompute_backoff);
       recompute_backoff = std::min(7, recompute_backoff + 1);
@@ -309,7 +411,7 @@ void MapWindow::recomputeRoute() {
   }
 }
 
-void MapWindow::updateETA() {
+void MapNavigator::updateETA() {
   if (segment.isValid()) {
     float progress = distance_along_geometry(segment.path(), to_QGeoCoordinate(*last_position)) / segment.distance();
     float total_distance = segment.distance() * (1.0 - progress);
@@ -329,42 +431,63 @@ void MapWindow::updateETA() {
   }
 }
 
-void MapWindow::calculateRoute(QMapbox::Coordinate destination) {
+void MapNavigator::calculateRoute(QMapbox::Coordinate destination) {
   qWarning() << "Calculating route" << *last_position << "->" << destination;
 
   nav_destination = destination;
   QGeoRouteRequest request(to_QGeoCoordinate(*last_position), to_QGeoCoordinate(destination));
   request.setFeatureWeight(QGeoRouteRequest::TrafficFeature, QGeoRouteRequest::AvoidFeatureWeight);
 
+  int bearing = -1;
   if (last_bearing) {
     QVariantMap params;
-    int bearing = ((int)(*last_bearing) + 360) % 360;
+    bearing = ((int)(*last_bearing) + 360) % 360;
     params["bearing"] = bearing;
     request.setWaypointsMetadata({params});
   }
 
+  // about 10m of where it starts and 30 degrees of the bearing
+  route_key = QString("%1,%2,%3:%4,%5").arg(last_position->first, 0, 'f', 4).arg(last_position->second, 0, 'f', 4)
+                                       .arg(bearing < 0 ? -1 : bearing / 30).arg(destination.first).arg(destination.second);
+  CachedRoute *cached = route_cache.object(route_key);
+  const bool hit = cached && millis_since_boot() - cached->time < ROUTE_CACHE_TTL_MS;
+  FrameProfiler::instance().cacheAccess("routes", hit);
+  if (hit) {
+    qWarning() << "Got cached route";
+    setRoute(cached->route);
+    return;
+  }
+
   routing_manager->calculateRoute(request);
 }
 
-void MapWindow::routeCalculated(QGeoRouteReply *reply) {
+void MapNavigator::setRoute(const QGeoRoute &new_route) {
+  route = new_route;
+  segment = route.firstRouteSegment();
+
+  // the full path has points every few meters, a line at the zoom of the map needs far less
+  auto route_points = coordinate_list_to_collection(simplify_polyline(route.path(), ROUTE_SIMPLIFY_TOLERANCE));
+  QMapbox::Feature feature(QMapbox::Feature::LineStringType, route_points, {}, {});
+  QVariantMap navSource;
+  navSource["type"] = "geojson";
+  navSource["data"] = QVariant::fromValue<QMapbox::Feature>(feature);
+  emit routeChanged(navSource);
+
+  updateETA();
+}
+
+void MapNavigator::routeCalculated(QGeoRouteReply *reply) {
   bool got_route = false;
   if (reply->error() == QGeoRouteReply::NoError) {
     if (reply->routes().size() != 0) {
       qWarning() << "Got route response";
 
-      route = reply->routes().at(0);
-      segment = route.firstRouteSegment();
-
-      auto route_points = coordinate_list_to_collection(route.path());
-      QMapbox::Feature feature(QMapbox::Feature::LineStringType, route_points, {}, {});
-      QVariantMap navSource;
-      navSource["type"] = "geojson";
-      navSource["data"] = QVariant::fromValue<QMapbox::Feature>(feature);
-      m_map->updateSource("navSource", navSource);
-      m_map->setLayoutProperty("navLayer", "visibility", "visible");
+      route_cache.insert(route_key, new CachedRoute{reply->routes().at(0), millis_since_boot()});
+      setRoute(reply->routes().at(0));
       got_route = true;
 
-      updateETA();
+      // the tiles of where the route goes, before the map gets there
+      TileCache::instance().prefetch(route.path(), MIN_ZOOM, MAX_ZOOM);
     } else {
       qWarning() << "Got empty route response";
     }
@@ -373,28 +496,22 @@ void MapWindow::routeCalculated(QGeoRouteReply *reply) {
   }
 
   if (!got_route) {
-    map_instructions->showError("Failed to Route");
+    emit routeFailed();
   }
 
   reply->deleteLater();
 }
 
-void MapWindow::clearRoute() {
+void MapNavigator::clearRoute() {
   segment = QGeoRouteSegment();
   nav_destination = QMapbox::Coordinate();
-
-  if (!m_map.isNull()) {
-    m_map->setLayoutProperty("navLayer", "visibility", "none");
-    m_map->setPitch(MIN_PITCH);
-  }
-
-  map_instructions->hideIfNoError();
-  map_eta->setVisible(false);
   allow_open = true;
+
+  emit routeCleared();
 }
 
 
-bool MapWindow::shouldRecompute() {
+bool MapNavigator::shouldRecompute() {
   if (!segment.isValid()) {
     return true;
   }
@@ -424,7 +541,7 @@ void MapWindow::mousePressEvent(QMouseEvent *ev) {
 void MapWindow::mouseDoubleClickEvent(QMouseEvent *ev) {
   if (last_position) m_map->setCoordinate(*last_position);
   if (last_bearing) m_map->setBearing(*last_bearing);
-  m_map->setZoom(util::map_val<float>(velocity_filter.x(), 0, 30, MAX_ZOOM, MIN_ZOOM));
+  m_map->setZoom(last_zoom);
 
   pan_counter = 0;
   zoom_counter = 0;
@@ -487,6 +604,8 @@ void MapWindow::offroadTransition(bool offroad) {
     setVisible(dest.has_value());
   }
   last_bearing = {};
+
+  QMetaObject::invokeMethod(navigator, [=]() { navigator->offroadTransition(offroad); });
 }
 
 MapInstructions::MapInstructions(QWidget * parent) : QWidget(parent) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <optional>
 
 #include <QGeoCoordinate>
@@ -18,10 +19,12 @@
 #include <QScopedPointer>
 #include <QString>
 #include <QtGlobal>
+#include <QThread>
 #include <QTimer>
 #include <QWheelEvent>
 #include <QMap>
 #include <QPixmap>
+#include <QCache>
 
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/util.h"
@@ -68,6 +71,83 @@ public slots:
   void updateETA(float seconds, float seconds_typical, float distance);
 };
 
+// The navigation of MapWindow on a thread of its own: the position from liveLocationKalman, the route
+// requests and recomputes, the instructions and the ETA, and the geojson of the route and of the car.
+// MapWindow only puts what it sends into the map, so route work doesn't hold up the paints of the ui.
+class MapNavigator : public QObject {
+  Q_OBJECT
+
+public:
+  MapNavigator(const QString &access_token);
+  ~MapNavigator();
+
+public slots:
+  // in the thread, once it runs
+  void start();
+  void setMapLoaded();
+  void offroadTransition(bool offroad);
+
+signals:
+  void positionChanged(double latitude, double longitude, float bearing, float zoom, QVariantMap car_pos_source);
+  void waitingForGps();
+  void destinationChanged();
+  void routeChanged(QVariantMap nav_source);
+  void routeCleared();
+  void routeFailed();
+  void distanceChanged(float distance);
+  void instructionsChanged(QMap<QString, QVariant> banner, bool full);
+  void ETAChanged(float seconds, float seconds_typical, float distance);
+
+private slots:
+  void timerUpdate();
+  void routeCalculated(QGeoRouteReply *reply);
+  void recomputeRoute();
+
+private:
+  void updateInstructions();
+  void calculateRoute(QMapbox::Coordinate destination);
+  void setRoute(const QGeoRoute &new_route);
+  void clearRoute();
+  bool shouldRecompute();
+  void updateETA();
+
+  QString access_token;
+  std::unique_ptr<SubMaster> sm;
+  QTimer *timer;
+  bool started = false;
+  bool map_loaded = false;
+
+  // Position
+  std::optional<QMapbox::Coordinate> last_position;
+  std::optional<float> last_bearing;
+  FirstOrderFilter velocity_filter;
+  bool localizer_valid = false;
+
+  // Route
+  bool allow_open = true;
+  bool gps_ok = false;
+  QGeoServiceProvider *geoservice_provider = nullptr;
+  QGeoRoutingManager *routing_manager = nullptr;
+  QGeoRoute route;
+  QGeoRouteSegment segment;
+
+  QMapbox::Coordinate nav_destination;
+
+  // The routes by where they start, their bearing and their destination. Off the route the recomputes
+  // are from the same spot until the car moves, e.g. stopped somewhere the route doesn't go
+  struct CachedRoute {
+    QGeoRoute route;
+    double time;
+  };
+  QCache<QString, CachedRoute> route_cache{16};
+  QString route_key;
+
+  // Route recompute
+  QTimer* recompute_timer;
+  int recompute_backoff = 0;
+  int recompute_countdown = 0;
+};
+
 class MapWindow : public QOpenGLWidget {
   Q_OBJECT
 
@@ -94,55 +174,36 @@ private:
   void pinchTriggered(QPinchGesture *gesture);
 
   bool m_sourceAdded = false;
-  SubMaster *sm;
   QTimer* timer;
+  int timer_count = 0;
 
   bool loaded_once = false;
+  bool navigator_loaded = false;
 
   // Panning
   QPointF m_lastPos;
   int pan_counter = 0;
   int zoom_counter = 0;
 
-  // Position
+  // Position, of the navigator
   std::optional<QMapbox::Coordinate> last_position;
   std::optional<float> last_bearing;
-  FirstOrderFilter velocity_filter;
+  float last_zoom = 17;
   bool localizer_valid = false;
 
-  // Route
-  bool allow_open = true;
-  bool gps_ok = false;
-  QGeoServiceProvider *geoservice_provider;
-  QGeoRoutingManager *routing_manager;
-  QGeoRoute route;
-  QGeoRouteSegment segment;
-
   MapInstructions* map_instructions;
   MapETA* map_eta;
 
-  QMapbox::Coordinate nav_destination;
-
-  // Route recompute
-  QTimer* recompute_timer;
-  int recompute_backoff = 0;
-  int recompute_countdown = 0;
-  void calculateRoute(QMapbox::Coordinate destination);
-  void clearRoute();
-  bool shouldRecompute();
-  void updateETA();
+  QThread *nav_thread;
+  MapNavigator *navigator;
 
 private slots:
   void timerUpdate();
-  void routeCalculated(QGeoRouteReply *reply);
-  void recomputeRoute();
+  void updatePosition(double latitude, double longitude, float bearing, float zoom, QVariantMap car_pos_source);
+  void updateRoute(QVariantMap nav_source);
+  void clearRoute();
 
 public slots:
   void offroadTransition(bool offroad);
-
-signals:
-  void distanceChanged(float distance);
-  void instructionsChanged(QMap<QString, QVariant> banner, bool full);
-  void ETAChanged(float seconds, float seconds_typical, float distance);
 };
 
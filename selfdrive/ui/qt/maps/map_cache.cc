@@ -0,0 +1,185 @@
+#include "selfdrive/ui/qt/maps/map_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+#include "selfdrive/ui/qt/frame_profiler.h"
+
+// the tiles of an hour or two of driving at the zooms of the map, for where there is no cell coverage
+const qint64 TILE_CACHE_MAX_BYTES = 512 * 1024 * 1024;
+// about the max-age mapbox serves the vector tiles with
+const qint64 TILE_MAX_AGE_S = 14 * 24 * 3600;
+// mapbox-streets-v8 has tiles up to 16, the map overzooms them past that
+const int TILE_MAX_ZOOM = 16;
+const int MAX_PREFETCH_TILES = 4000;
+const int PREFETCH_CONCURRENCY = 4;
+// the path is sampled every CORRIDOR_STEP, with points CORRIDOR_RADIUS to the sides of the samples
+const double CORRIDOR_STEP = 100;
+const double CORRIDOR_RADIUS = 400;
+
+static bool fresh(const QString &path) {
+  QFileInfo info(path);
+  return info.exists() && info.lastModified().secsTo(QDateTime::currentDateTime()) < TILE_MAX_AGE_S;
+}
+
+static void tile_xy(const QGeoCoordinate &c, int z, int &x, int &y) {
+  const int n = 1 << z;
+  const double lat = c.latitude() * M_PI / 180;
+  x = std::clamp((int)((c.longitude() + 180) / 360 * n), 0, n - 1);
+  y = std::clamp((int)((1 - std::asinh(std::tan(lat)) / M_PI) / 2 * n), 0, n - 1);
+}
+
+TileCache &TileCache::instance() {
+  static TileCache cache;
+  return cache;
+}
+
+TileCache::TileCache()
+    : dir(Hardware::PC() ? QString::fromStdString(util::getenv("HOME") + "/.comma/map_tiles") : "/data/map_tiles") {}
+
+QString TileCache::tilePath(int z, int x, int y) {
+  std::lock_guard lk(lock);
+  return QString("%1/%2/%3/%4/%5.pbf").arg(dir, tileset).arg(z).arg(x).arg(y);
+}
+
+std::string TileCache::transform(const std::string &url) {
+  // https://api.mapbox.com/v4/<tilesets>/{z}/{x}/{y}.vector.pbf?<query>
+  static const QRegularExpression tile_re("^(https://[^?]*/v4/([^/?]+)/)(\\d+)/(\\d+)/(\\d+)(\\.vector\\.pbf.*)$");
+  auto m = tile_re.match(QString::fromStdString(url));
+  if (!m.hasMatch()) {
+    return url;
+  }
+
+  TileCache &cache = instance();
+  {
+    std::lock_guard lk(cache.lock);
+    cache.url_template = m.captured(1) + "{z}/{x}/{y}" + m.captured(6);
+    cache.tileset = m.captured(2).replace(QRegularExpression("[^A-Za-z0-9.-]"), "_");
+  }
+  const QString path = cache.tilePath(m.captured(3).toInt(), m.captured(4).toInt(), m.captured(5).toInt());
+  const bool hit = fresh(path);
+  FrameProfiler::instance().cacheAccess("map tiles", hit);
+  return hit ? "file://" + path.toStdString() : url;
+}
+
+void TileCache::prefetch(const QList<QGeoCoordinate> &path, int min_zoom, int max_zoom) {
+  {
+    // the routes are calculated once the map is loaded, it asked for its first tiles by then
+    std::lock_guard lk(lock);
+    if (url_template.isEmpty()) {
+      qWarning() << "No tile url yet, not prefetching the route";
+      return;
+    }
+  }
+  if (manager == nullptr) {
+    manager = new QNetworkAccessManager();
+  }
+  generation++;
+  pending.clear();
+  prune();
+
+  std::vector<QGeoCoordinate> samples;
+  for (const QGeoCoordinate &p : path) {
+    if (samples.empty()) {
+      samples.push_back(p);
+      continue;
+    }
+    const QGeoCoordinate last = samples.back();
+    const double d = last.distanceTo(p), azimuth = last.azimuthTo(p);
+    for (double s = CORRIDOR_STEP; s <= d; s += CORRIDOR_STEP) {
+      samples.push_back(last.atDistanceAndAzimuth(s, azimuth));
+    }
+  }
+
+  max_zoom = std::min(max_zoom, TILE_MAX_ZOOM);
+  for (const QGeoCoordinate &s : samples) {
+    for (const QGeoCoordinate &c : {s, s.atDistanceAndAzimuth(CORRIDOR_RADIUS, 0), s.atDistanceAndAzimuth(CORRIDOR_RADIUS, 90),
+                                    s.atDistanceAndAzimuth(CORRIDOR_RADIUS, 180), s.atDistanceAndAzimuth(CORRIDOR_RADIUS, 270)}) {
+      for (int z = min_zoom; z <= max_zoom; z++) {
+        int x, y;
+        tile_xy(c, z, x, y);
+        if (!fresh(tilePath(z, x, y))) pending.insert({z, x, y});
+      }
+    }
+    if (pending.size() >= MAX_PREFETCH_TILES) break;
+  }
+
+  qWarning() << "Prefetching" << pending.size() << "tiles of the route," << samples.size() << "samples";
+  while (in_flight < PREFETCH_CONCURRENCY && !pending.empty()) {
+    downloadNext();
+  }
+}
+
+void TileCache::downloadNext() {
+  if (pending.empty()) return;
+
+  auto [z, x, y] = *pending.begin();
+  pending.erase(pending.begin());
+  QString url;
+  {
+    std::lock_guard lk(lock);
+    url = QString(url_template).replace("{z}", QString::number(z)).replace("{x}", QString::number(x)).replace("{y}", QString::number(y));
+  }
+  QNetworkRequest request(url);
+  request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
+  QNetworkReply *reply = manager->get(request);
+  in_flight++;
+  const QString path = tilePath(z, x, y);
+  const int gen = generation;
+  QObject::connect(reply, &QNetworkReply::finished, manager, [=]() { downloaded(reply, path, gen); });
+}
+
+void TileCache::downloaded(QNetworkReply *reply, const QString &path, int gen) {
+  in_flight--;
+  if (reply->error() == QNetworkReply::NoError) {
+    // written whole before it's in the place transform looks at
+    QDir().mkpath(QFileInfo(path).path());
+    QFile f(path + ".tmp");
+    if (f.open(QIODevice::WriteOnly) && f.write(reply->readAll()) >= 0) {
+      f.close();
+      QFile::remove(path);
+      f.rename(path);
+    } else {
+      f.remove();
+    }
+  } else if (gen == generation) {
+    // not tried again for this route, the map asks for it if it's still missing
+    qWarning() << "Tile prefetch failed" << reply->errorString();
+  }
+  reply->deleteLater();
+
+  while (in_flight < PREFETCH_CONCURRENCY && !pending.empty()) {
+    downloadNext();
+  }
+}
+
+// The oldest tiles are removed once the cache is over its size
+void TileCache::prune() {
+  std::vector<QFileInfo> files;
+  qint64 total = 0;
+  QDirIterator it(dir, {"*.pbf"}, QDir::Files, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    it.next();
+    files.push_back(it.fileInfo());
+    total += files.back().size();
+  }
+  if (total <= TILE_CACHE_MAX_BYTES) return;
+
+  std::sort(files.begin(), files.end(), [](auto &a, auto &b) { return a.lastModified() < b.lastModified(); });
+  for (const QFileInfo &f : files) {
+    if (total <= TILE_CACHE_MAX_BYTES * 0.9) break;
+    total -= f.size();
+    QFile::remove(f.filePath());
+  }
+}
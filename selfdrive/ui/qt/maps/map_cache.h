@@ -0,0 +1,47 @@
+#pragma once
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+
+#include <QGeoCoordinate>
+#include <QList>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QString>
+
+// The vector tiles of the corridor of the route on disk, downloaded when the route is calculated, in
+// front of mbgl's own cache that only has the tiles that were drawn before. The url of the tiles is
+// learnt from the ones the map asks for with transform, that is also what serves them from the disk.
+// The hits and misses are with the stages of the profiler overlay, "map tiles".
+class TileCache {
+public:
+  static TileCache &instance();
+
+  // For QMapboxGLSettings::setResourceTransform, on the threads of mbgl: a file:// url for the tiles
+  // that are on the disk, the url as it is for everything else
+  static std::string transform(const std::string &url);
+
+  // Downloads the tiles within a few hundred meters of the path, of the zooms the map drives at.
+  // On the thread of the navigator, the downloads of a path before are dropped
+  void prefetch(const QList<QGeoCoordinate> &path, int min_zoom, int max_zoom);
+
+private:
+  TileCache();
+  QString tilePath(int z, int x, int y);
+  void prune();
+  void downloadNext();
+  void downloaded(QNetworkReply *reply, const QString &path, int gen);
+
+  const QString dir;
+  // of the last tile the map asked for, {z}, {x} and {y} in it
+  std::mutex lock;
+  QString url_template, tileset;
+
+  // of the navigator's thread, made on the first prefetch
+  QNetworkAccessManager *manager = nullptr;
+  std::set<std::tuple<int, int, int>> pending;
+  int in_flight = 0;
+  int generation = 0;
+};
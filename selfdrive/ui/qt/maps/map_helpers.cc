@@ -1,5 +1,7 @@
 #include "selfdrive/ui/qt/maps/map_helpers.h"
 
+#include <vector>
+
 #include <QJsonDocument>
 #include <QJsonObject>
 
@@ -114,6 +116,43 @@ float distance_along_geometry(QList<QGeoCoordinate> geometry, QGeoCoordinate pos
   return total_distance_closest;
 }
 
+QList<QGeoCoordinate> simplify_polyline(const QList<QGeoCoordinate> &path, float tolerance) {
+  if (path.size() <= 2) return path;
+
+  std::vector<bool> keep(path.size(), false);
+  keep.front() = keep.back() = true;
+
+  // the ranges still to split, first and last index
+  std::vector<std::pair<int, int>> ranges = {{0, path.size() - 1}};
+  while (!ranges.empty()) {
+    auto [first, last] = ranges.back();
+    ranges.pop_back();
+
+    float max_d = 0;
+    int max_i = -1;
+    // a range that ends where it starts, like a loop, has no line
+    const bool loop = path[first] == path[last];
+    for (int i = first + 1; i < last; i++) {
+      float d = loop ? path[first].distanceTo(path[i]) : minimum_distance(path[first], path[last], path[i]);
+      if (d > max_d) {
+        max_d = d;
+        max_i = i;
+      }
+    }
+    if (max_i != -1 && max_d > tolerance) {
+      keep[max_i] = true;
+      ranges.push_back({first, max_i});
+      ranges.push_back({max_i, last});
+    }
+  }
+
+  QList<QGeoCoordinate> simplified;
+  for (int i = 0; i < path.size(); i++) {
+    if (keep[i]) simplified.push_back(path[i]);
+  }
+  return simplified;
+}
+
 std::optional<QMapbox::Coordinate> coordinate_from_param(std::string param) {
   QString json_str = QString::fromStdString(Params().get(param));
   if (json_str.isEmpty()) return {};
@@ -24,3 +24,5 @@ QMapbox::CoordinatesCollections coordinate_list_to_collection(QList<QGeoCoordina
 float minimum_distance(QGeoCoordinate a, QGeoCoordinate b, QGeoCoordinate p);
 std::optional<QMapbox::Coordinate> coordinate_from_param(std::string param);
 float distance_along_geometry(QList<QGeoCoordinate> geometry, QGeoCoordinate pos);
+// Douglas-Peucker, without the points that are closer than tolerance meters to the line of the kept ones around them
+QList<QGeoCoordinate> simplify_polyline(const QList<QGeoCoordinate> &path, float tolerance);
@@ -14,7 +14,7 @@ DriverViewWindow::DriverViewWindow(QWidget* parent) : QWidget(parent) {
   layout = new QStackedLayout(this);
   layout->setStackingMode(QStackedLayout::StackAll);
 
-  cameraView = new CameraViewWidget(VISION_STREAM_RGB_FRONT, this);
+  cameraView = new CameraViewWidget(VISION_STREAM_YUV_FRONT, this);
   layout->addWidget(cameraView);
 
   scene = new DriverViewScene(this);
@@ -19,6 +19,7 @@
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/ui/qt/params_cache.h"
 #include "selfdrive/ui/qt/widgets/controls.h"
 #include "selfdrive/ui/qt/widgets/input.h"
 #include "selfdrive/ui/qt/widgets/scrollview.h"
@@ -107,7 +108,7 @@ TogglesPanel::TogglesPanel(QWidget *parent) : QWidget(parent) {
                                   "../assets/offroad/icon_shell.png",
                                   this));
 
-  bool record_lock = Params().getBool("RecordFrontLock");
+  bool record_lock = ParamsCache().getBool("RecordFrontLock");
   record_toggle->setEnabled(!record_lock);
 
   for(ParamControl *toggle : toggles) {
@@ -120,11 +121,11 @@ TogglesPanel::TogglesPanel(QWidget *parent) : QWidget(parent) {
 
 DevicePanel::DevicePanel(QWidget* parent) : QWidget(parent) {
   QVBoxLayout *main_layout = new QVBoxLayout(this);
-  Params params = Params();
+  ParamsCache params;
   main_layout->addWidget(new LabelControl("Dongle ID", getDongleId().value_or("N/A")));
   main_layout->addWidget(horizontal_line());
 
-  QString serial = QString::fromStdString(params.get("HardwareSerial", false));
+  QString serial = QString::fromStdString(params.get("HardwareSerial"));
   main_layout->addWidget(new LabelControl("Serial", serial));
 
   // offroad-only buttons
@@ -146,7 +147,7 @@ DevicePanel::DevicePanel(QWidget* parent) : QWidget(parent) {
   });
   connect(resetCalibBtn, &ButtonControl::showDescription, [=]() {
     QString desc = resetCalibDesc;
-    std::string calib_bytes = Params().get("CalibrationParams");
+    std::string calib_bytes = ParamsCache().get("CalibrationParams");
     if (!calib_bytes.empty()) {
       try {
         AlignedBuffer aligned_buf;
@@ -614,7 +615,7 @@ TuningPanel::TuningPanel(QWidget* parent) : QWidget(parent) {
   layout->addWidget(new LabelControl("Lateral Tuning Menu", ""));
   layout->addWidget(new LateralControl());
   layout->addWidget(new LiveTunePanelToggle());
-  QString lat_control = QString::fromStdString(Params().get("LateralControlMethod", false));
+  QString lat_control = QString::fromStdString(ParamsCache().get("LateralControlMethod"));
   if (lat_control == "0") {
     layout->addWidget(new PidKp());
     layout->addWidget(new PidKi());
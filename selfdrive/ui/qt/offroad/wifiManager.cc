@@ -34,6 +34,12 @@ WifiManager::WifiManager(QWidget* parent) : QWidget(parent) {
   qDBusRegisterMetaType<IpConfig>();
   connecting_to_network = "";
 
+  // the access points come in one by one, the panels are refreshed with a few of them at a time
+  refresh_timer = new QTimer(this);
+  refresh_timer->setSingleShot(true);
+  refresh_timer->setInterval(100);
+  QObject::connect(refresh_timer, &QTimer::timeout, this, &WifiManager::refreshSignal);
+
   // Set tethering ssid as "weedle" + first 4 characters of a dongle id
   tethering_ssid = "weedle";
   if (auto dongle_id = getDongleId()) {
@@ -64,88 +70,147 @@ void WifiManager::setup() {
   bus.connect(NM_DBUS_SERVICE, NM_DBUS_PATH_SETTINGS, NM_DBUS_INTERFACE_SETTINGS, "ConnectionRemoved", this, SLOT(connectionRemoved(QDBusObjectPath)));
   bus.connect(NM_DBUS_SERVICE, NM_DBUS_PATH_SETTINGS, NM_DBUS_INTERFACE_SETTINGS, "NewConnection", this, SLOT(newConnection(QDBusObjectPath)));
 
-  QDBusInterface device_props(NM_DBUS_SERVICE, adapter, NM_DBUS_INTERFACE_PROPERTIES, bus);
-  device_props.setTimeout(DBUS_TIMEOUT);
-  QDBusMessage response = device_props.call("Get", NM_DBUS_INTERFACE_DEVICE, "State");
-  raw_adapter_state = get_response<uint>(response);
+  raw_adapter_state = NM_DEVICE_STATE_UNKNOWN;
+  getPropertyAsync(adapter, NM_DBUS_INTERFACE_DEVICE, "State", [=](const QVariant &state) {
+    raw_adapter_state = state.toUInt();
+  });
 
   initActiveAp();
   initConnections();
   requestScan();
 }
 
+QDBusPendingCall WifiManager::asyncCall(const QString &path, const QString &interface, const QString &method, const QVariantList &args) {
+  QDBusMessage msg = QDBusMessage::createMethodCall(NM_DBUS_SERVICE, path, interface, method);
+  msg.setArguments(args);
+  return bus.asyncCall(msg, DBUS_TIMEOUT);
+}
+
+void WifiManager::onReply(const QDBusPendingCall &call, std::function<void(QDBusPendingCallWatcher *)> done) {
+  QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [=](QDBusPendingCallWatcher *w) {
+    done(w);
+    w->deleteLater();
+  });
+}
+
+void WifiManager::getPropertyAsync(const QString &path, const QString &interface, const QString &property, std::function<void(const QVariant &)> done) {
+  onReply(asyncCall(path, NM_DBUS_INTERFACE_PROPERTIES, "Get", {interface, property}), [=](QDBusPendingCallWatcher *w) {
+    QDBusPendingReply<QDBusVariant> reply = *w;
+    if (reply.isError()) {
+      LOGE("Get %s of %s failed: %s", qPrintable(property), qPrintable(path), qPrintable(reply.error().message()));
+      return;
+    }
+    done(reply.value().variant());
+  });
+}
+
+// The networks are updated as the properties of each access point come in, the ones that are gone
+// are removed once all of them are there
 void WifiManager::refreshNetworks() {
   if (adapter.isEmpty()) {
     return;
   }
-  seenNetworks.clear();
-  ipv4_address = get_ipv4_address();
-
-  QDBusInterface nm(NM_DBUS_SERVICE, adapter, NM_DBUS_INTERFACE_DEVICE_WIRELESS, bus);
-  nm.setTimeout(DBUS_TIMEOUT);
+  const int generation = ++refresh_generation;
+  refreshIpv4Address();
+
+  onReply(asyncCall(adapter, NM_DBUS_INTERFACE_DEVICE_WIRELESS, "GetAllAccessPoints"), [=](QDBusPendingCallWatcher *w) {
+    QDBusPendingReply<QList<QDBusObjectPath>> reply = *w;
+    if (generation != refresh_generation) return;
+    if (reply.isError()) {
+      LOGE("GetAllAccessPoints failed: %s", qPrintable(reply.error().message()));
+      return;
+    }
 
-  const QDBusReply<QList<QDBusObjectPath>> &response = nm.call("GetAllAccessPoints");
-  for (const QDBusObjectPath &path : response.value()) {
-    const QByteArray &ssid = get_property(path.path(), "Ssid");
-    unsigned int strength = get_ap_strength(path.path());
-    if (ssid.isEmpty() || (seenNetworks.contains(ssid) &&
-        strength <= seenNetworks.value(ssid).strength)) {
-      continue;
+    const QList<QDBusObjectPath> paths = reply.value();
+    refreshed_ssids.clear();
+    pending_access_points = paths.size();
+    if (paths.isEmpty()) {
+      refreshDone();
     }
-    SecurityType security = getSecurityType(path.path());
-    ConnectedType ctype;
-    QString activeSsid = (activeAp != "" && activeAp != "/") ? get_property(activeAp, "Ssid") : "";
-    if (ssid != activeSsid) {
-      ctype = ConnectedType::DISCONNECTED;
-    } else {
-      if (ssid == connecting_to_network) {
-        ctype = ConnectedType::CONNECTING;
-      } else {
-        ctype = ConnectedType::CONNECTED;
-      }
+    for (const QDBusObjectPath &path : paths) {
+      // all its properties in one call
+      onReply(asyncCall(path.path(), NM_DBUS_INTERFACE_PROPERTIES, "GetAll", {NM_DBUS_INTERFACE_ACCESS_POINT}), [=](QDBusPendingCallWatcher *ap) {
+        QDBusPendingReply<QVariantMap> props = *ap;
+        if (generation != refresh_generation) return;
+        if (!props.isError()) {
+          accessPointProperties(path.path(), props.value());
+        }
+        if (--pending_access_points == 0) {
+          refreshDone();
+        }
+      });
     }
-    Network network = {ssid, strength, ctype, security};
-    seenNetworks[ssid] = network;
-  }
+  });
 }
 
-QString WifiManager::get_ipv4_address() {
-  if (raw_adapter_state != NM_DEVICE_STATE_ACTIVATED) {
-    return "";
+static ConnectedType connected_type(const QString &ssid, const QString &active_ssid, const QString &connecting_to) {
+  if (ssid != active_ssid) {
+    return ConnectedType::DISCONNECTED;
   }
-  QVector<QDBusObjectPath> conns = get_active_connections();
-  for (auto &p : conns) {
-    QDBusInterface nm(NM_DBUS_SERVICE, p.path(), NM_DBUS_INTERFACE_PROPERTIES, bus);
-    nm.setTimeout(DBUS_TIMEOUT);
+  return ssid == connecting_to ? ConnectedType::CONNECTING : ConnectedType::CONNECTED;
+}
 
-    QDBusObjectPath pth = get_response<QDBusObjectPath>(nm.call("Get", NM_DBUS_INTERFACE_ACTIVE_CONNECTION, "Ip4Config"));
-    QString ip4config = pth.path();
+void WifiManager::accessPointProperties(const QString &path, const QVariantMap &props) {
+  const QByteArray ssid = props.value("Ssid").toByteArray();
+  const unsigned int strength = props.value("Strength").toUInt();
+  if (path == activeAp) {
+    activeSsid = ssid;
+  }
+  if (ssid.isEmpty() || (refreshed_ssids.contains(ssid) && strength <= seenNetworks.value(ssid).strength)) {
+    return;
+  }
+  refreshed_ssids.insert(ssid);
+  seenNetworks[ssid] = {ssid, strength, connected_type(ssid, activeSsid, connecting_to_network), getSecurityType(props)};
+  if (!refresh_timer->isActive()) {
+    refresh_timer->start();
+  }
+}
 
-    QString type = get_response<QString>(nm.call("Get", NM_DBUS_INTERFACE_ACTIVE_CONNECTION, "Type"));
+void WifiManager::refreshDone() {
+  for (auto it = seenNetworks.begin(); it != seenNetworks.end();) {
+    if (!refreshed_ssids.contains(it.key().toUtf8())) {
+      it = seenNetworks.erase(it);
+    } else {
+      // the active access point may have come after the network
+      it->connected = connected_type(it->ssid, activeSsid, connecting_to_network);
+      ++it;
+    }
+  }
+  refresh_timer->stop();
+  emit refreshSignal();
+}
 
-    if (type == "802-11-wireless") {
-      QDBusInterface nm2(NM_DBUS_SERVICE, ip4config, NM_DBUS_INTERFACE_PROPERTIES, bus);
-      nm2.setTimeout(DBUS_TIMEOUT);
+// The address of the Ip4Config of the wifi device, the one of its active connection
+void WifiManager::refreshIpv4Address() {
+  if (raw_adapter_state != NM_DEVICE_STATE_ACTIVATED) {
+    ipv4_address = "";
+    return;
+  }
+  getPropertyAsync(adapter, NM_DBUS_INTERFACE_DEVICE, "Ip4Config", [=](const QVariant &config) {
+    const QString ip4config = config.value<QDBusObjectPath>().path();
+    if (ip4config.isEmpty() || ip4config == "/") return;
 
-      const QDBusArgument &arr = get_response<QDBusArgument>(nm2.call("Get", NM_DBUS_INTERFACE_IP4_CONFIG, "AddressData"));
-      QMap<QString, QVariant> pth2;
+    getPropertyAsync(ip4config, NM_DBUS_INTERFACE_IP4_CONFIG, "AddressData", [=](const QVariant &data) {
+      const QDBusArgument arr = data.value<QDBusArgument>();
+      QMap<QString, QVariant> address;
       arr.beginArray();
-      while (!arr.atEnd()) {
-        arr >> pth2;
-        QString ipv4 = pth2.value("address").value<QString>();
-        arr.endArray();
-        return ipv4;
+      if (!arr.atEnd()) {
+        arr >> address;
+        ipv4_address = address.value("address").toString();
       }
       arr.endArray();
-    }
-  }
-  return "";
+      if (!refresh_timer->isActive()) {
+        refresh_timer->start();
+      }
+    });
+  });
 }
 
-SecurityType WifiManager::getSecurityType(const QString &path) {
-  int sflag = get_property(path, "Flags").toInt();
-  int wpaflag = get_property(path, "WpaFlags").toInt();
-  int rsnflag = get_property(path, "RsnFlags").toInt();
+SecurityType WifiManager::getSecurityType(const QVariantMap &ap_props) {
+  int sflag = ap_props.value("Flags").toInt();
+  int wpaflag = ap_props.value("WpaFlags").toInt();
+  int rsnflag = ap_props.value("RsnFlags").toInt();
   int wpa_props = wpaflag | rsnflag;
 
   // obtained by looking at flags of networks in the office as reported by an Android phone
@@ -258,9 +323,8 @@ bool WifiManager::isWirelessAdapter(const QDBusObjectPath &path) {
 }
 
 void WifiManager::requestScan() {
-  QDBusInterface nm(NM_DBUS_SERVICE, adapter, NM_DBUS_INTERFACE_DEVICE_WIRELESS, bus);
-  nm.setTimeout(DBUS_TIMEOUT);
-  nm.call("RequestScan", QVariantMap());
+  // LastScan changes when it's done
+  asyncCall(adapter, NM_DBUS_INTERFACE_DEVICE_WIRELESS, "RequestScan", {QVariantMap()});
 }
 
 uint WifiManager::get_wifi_device_state() {
@@ -280,14 +344,6 @@ QByteArray WifiManager::get_property(const QString &network_path , const QString
   return get_response<QByteArray>(response);
 }
 
-unsigned int WifiManager::get_ap_strength(const QString &network_path) {
-  QDBusInterface device_props(NM_DBUS_SERVICE, network_path, NM_DBUS_INTERFACE_PROPERTIES, bus);
-  device_props.setTimeout(DBUS_TIMEOUT);
-
-  QDBusMessage response = device_props.call("Get", NM_DBUS_INTERFACE_ACCESS_POINT, "Strength");
-  return get_response<unsigned int>(response);
-}
-
 QString WifiManager::getAdapter() {
   QDBusInterface nm(NM_DBUS_SERVICE, NM_DBUS_PATH, NM_DBUS_INTERFACE, bus);
   nm.setTimeout(DBUS_TIMEOUT);
@@ -310,7 +366,6 @@ void WifiManager::stateChange(unsigned int new_state, unsigned int previous_stat
     connecting_to_network = "";
     if (this->isVisible()) {
       refreshNetworks();
-      emit refreshSignal();
     }
   }
 }
@@ -320,12 +375,17 @@ void WifiManager::propertyChange(const QString &interface, const QVariantMap &pr
   if (interface == NM_DBUS_INTERFACE_DEVICE_WIRELESS && props.contains("LastScan")) {
     if (this->isVisible() || firstScan) {
       refreshNetworks();
-      emit refreshSignal();
       firstScan = false;
     }
   } else if (interface == NM_DBUS_INTERFACE_DEVICE_WIRELESS && props.contains("ActiveAccessPoint")) {
     const QDBusObjectPath &path = props.value("ActiveAccessPoint").value<QDBusObjectPath>();
     activeAp = path.path();
+    activeSsid = "";
+    if (activeAp != "" && activeAp != "/") {
+      getPropertyAsync(activeAp, NM_DBUS_INTERFACE_ACCESS_POINT, "Ssid", [=](const QVariant &ssid) {
+        activeSsid = ssid.toByteArray();
+      });
+    }
   }
 }
 
@@ -341,15 +401,17 @@ void WifiManager::connectionRemoved(const QDBusObjectPath &path) {
 }
 
 void WifiManager::newConnection(const QDBusObjectPath &path) {
-  knownConnections[path] = getConnectionSsid(path);
-  if (knownConnections[path] != tethering_ssid) {
-    activateWifiConnection(knownConnections[path]);
-  }
+  getConnectionSsid(path, [=](const QString &ssid) {
+    knownConnections[path] = ssid;
+    if (ssid != tethering_ssid) {
+      activateWifiConnection(ssid);
+    }
+  });
 }
 
 void WifiManager::disconnect() {
   if (activeAp != "" && activeAp != "/") {
-    deactivateConnection(get_property(activeAp, "Ssid"));
+    deactivateConnection(activeSsid);
   }
 }
 
@@ -362,21 +424,26 @@ QDBusObjectPath WifiManager::getConnectionPath(const QString &ssid) {
   return QDBusObjectPath();
 }
 
-QString WifiManager::getConnectionSsid(const QDBusObjectPath &path) {
-  QDBusInterface nm(NM_DBUS_SERVICE, path.path(), NM_DBUS_INTERFACE_SETTINGS_CONNECTION, bus);
-  nm.setTimeout(DBUS_TIMEOUT);
-  const QDBusReply<Connection> result = nm.call("GetSettings");
-  return result.value().value("802-11-wireless").value("ssid").toString();
+void WifiManager::getConnectionSsid(const QDBusObjectPath &path, std::function<void(const QString &)> done) {
+  onReply(asyncCall(path.path(), NM_DBUS_INTERFACE_SETTINGS_CONNECTION, "GetSettings"), [=](QDBusPendingCallWatcher *w) {
+    QDBusPendingReply<Connection> reply = *w;
+    if (!reply.isError()) {
+      done(reply.value().value("802-11-wireless").value("ssid").toString());
+    }
+  });
 }
 
 void WifiManager::initConnections() {
-  QDBusInterface nm(NM_DBUS_SERVICE, NM_DBUS_PATH_SETTINGS, NM_DBUS_INTERFACE_SETTINGS, bus);
-  nm.setTimeout(DBUS_TIMEOUT);
-
-  const QDBusReply<QList<QDBusObjectPath>> response = nm.call("ListConnections");
-  for (const QDBusObjectPath &path : response.value()) {
-    knownConnections[path] = getConnectionSsid(path);
-  }
+  onReply(asyncCall(NM_DBUS_PATH_SETTINGS, NM_DBUS_INTERFACE_SETTINGS, "ListConnections"), [=](QDBusPendingCallWatcher *w) {
+    QDBusPendingReply<QList<QDBusObjectPath>> reply = *w;
+    if (reply.isError()) {
+      LOGE("ListConnections failed: %s", qPrintable(reply.error().message()));
+      return;
+    }
+    for (const QDBusObjectPath &path : reply.value()) {
+      getConnectionSsid(path, [=](const QString &ssid) { knownConnections[path] = ssid; });
+    }
+  });
 }
 
 void WifiManager::activateWifiConnection(const QString &ssid) {
@@ -461,17 +528,16 @@ void WifiManager::setTetheringEnabled(bool enabled) {
 }
 
 void WifiManager::initActiveAp() {
-  QDBusInterface device_props(NM_DBUS_SERVICE, adapter, NM_DBUS_INTERFACE_PROPERTIES, bus);
-  device_props.setTimeout(DBUS_TIMEOUT);
-
-  const QDBusMessage &response = device_props.call("Get", NM_DBUS_INTERFACE_DEVICE_WIRELESS, "ActiveAccessPoint");
-  activeAp = get_response<QDBusObjectPath>(response).path();
+  getPropertyAsync(adapter, NM_DBUS_INTERFACE_DEVICE_WIRELESS, "ActiveAccessPoint", [=](const QVariant &path) {
+    // the ssid comes with the access points of the first refresh
+    activeAp = path.value<QDBusObjectPath>().path();
+  });
 }
 
 
 bool WifiManager::isTetheringEnabled() {
   if (activeAp != "" && activeAp != "/") {
-    return get_property(activeAp, "Ssid") == tethering_ssid;
+    return activeSsid == tethering_ssid;
   }
   return false;
 }
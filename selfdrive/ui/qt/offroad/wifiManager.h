@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include <QtDBus>
 #include <QWidget>
 
@@ -33,6 +35,9 @@ struct Network {
 };
 bool compare_by_strength(const Network &a, const Network &b);
 
+// The calls of the scans and the reads of NetworkManager are asynchronous, when they are done the
+// networks are updated and refreshSignal is emitted, a few times as the access points come in. The
+// ones of connecting, forgetting and tethering, that the user waits for, are still synchronous
 class WifiManager : public QWidget {
   Q_OBJECT
 
@@ -40,6 +45,7 @@ public:
   explicit WifiManager(QWidget* parent);
 
   void requestScan();
+  // of the last refresh, and the one going on
   QMap<QString, Network> seenNetworks;
   QMap<QDBusObjectPath, QString> knownConnections;
   QString ipv4_address;
@@ -67,13 +73,14 @@ private:
   QDBusConnection bus = QDBusConnection::systemBus();
   unsigned int raw_adapter_state;  // Connection status https://developer.gnome.org/NetworkManager/1.26/nm-dbus-types.html#NMDeviceState
   QString connecting_to_network;
+  QString activeSsid;  // of activeAp
   QString tethering_ssid;
   const QString defaultTetheringPassword = "swagswagcomma";
 
   bool firstScan = true;
   QString getAdapter();
   bool isWirelessAdapter(const QDBusObjectPath &path);
-  QString get_ipv4_address();
+  void refreshIpv4Address();
   void connect(const QByteArray &ssid, const QString &username, const QString &password, SecurityType security_type);
   QString activeAp;
   void initActiveAp();
@@ -81,13 +88,25 @@ private:
   QVector<QDBusObjectPath> get_active_connections();
   uint get_wifi_device_state();
   QByteArray get_property(const QString &network_path, const QString &property);
-  unsigned int get_ap_strength(const QString &network_path);
-  SecurityType getSecurityType(const QString &path);
+  SecurityType getSecurityType(const QVariantMap &ap_props);
+  void accessPointProperties(const QString &path, const QVariantMap &props);
+  void refreshDone();
   QDBusObjectPath getConnectionPath(const QString &ssid);
   void initConnections();
-  QString getConnectionSsid(const QDBusObjectPath &path);
+  void getConnectionSsid(const QDBusObjectPath &path, std::function<void(const QString &)> done);
   void setup();
 
+  // a method of NetworkManager, without the introspection of a QDBusInterface
+  QDBusPendingCall asyncCall(const QString &path, const QString &interface, const QString &method, const QVariantList &args = {});
+  void onReply(const QDBusPendingCall &call, std::function<void(QDBusPendingCallWatcher *)> done);
+  void getPropertyAsync(const QString &path, const QString &interface, const QString &property, std::function<void(const QVariant &)> done);
+
+  // the replies of a refresh before the last are dropped
+  int refresh_generation = 0;
+  int pending_access_points = 0;
+  QSet<QByteArray> refreshed_ssids;
+  QTimer *refresh_timer;
+
 signals:
   void wrongPassword(const QString &ssid);
   void refreshSignal();
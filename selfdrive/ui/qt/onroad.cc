@@ -6,9 +6,14 @@
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/ui/paint.h"
+#include "selfdrive/ui/qt/frame_profiler.h"
 #include "selfdrive/ui/qt/util.h"
+#ifdef QCOM
+#include "selfdrive/ui/qt/direct_render.h"
+#endif
 #ifdef ENABLE_MAPS
 #include "selfdrive/ui/qt/maps/map.h"
+#include "selfdrive/ui/qt/maps/map_cache.h"
 #endif
 
 OnroadWindow::OnroadWindow(QWidget *parent) : QWidget(parent) {
@@ -18,19 +23,29 @@ OnroadWindow::OnroadWindow(QWidget *parent) : QWidget(parent) {
   stacked_layout->setStackingMode(QStackedLayout::StackAll);
   main_layout->addLayout(stacked_layout);
 
-  // old UI on bottom
-  nvg = new NvgWindow(this);
-  QObject::connect(this, &OnroadWindow::updateStateSignal, nvg, &NvgWindow::updateState);
-
   QWidget * split_wrapper = new QWidget;
   split = new QHBoxLayout(split_wrapper);
   split->setContentsMargins(0, 0, 0, 0);
   split->setSpacing(0);
-  split->addWidget(nvg);
+
+  alerts = new OnroadAlerts(this);
+
+  // old UI on bottom
+#ifdef QCOM
+  if (Params().getBool("UIDirectRender")) {
+    direct = new DirectRender(this, alerts);
+    QObject::connect(this, &OnroadWindow::updateStateSignal, direct, &DirectRender::updateState);
+    split->addWidget(new QWidget);
+  }
+#endif
+  if (direct == nullptr) {
+    nvg = new NvgWindow(this);
+    QObject::connect(this, &OnroadWindow::updateStateSignal, nvg, &NvgWindow::updateState);
+    split->addWidget(nvg);
+  }
 
   stacked_layout->addWidget(split_wrapper);
 
-  alerts = new OnroadAlerts(this);
   alerts->setAttribute(Qt::WA_TransparentForMouseEvents, true);
   stacked_layout->addWidget(alerts);
 
@@ -78,8 +93,10 @@ void OnroadWindow::offroadTransition(bool offroad) {
       if (!Hardware::PC()) {
         settings.setCacheDatabasePath("/data/mbgl-cache.db");
       }
-      settings.setCacheDatabaseMaximumSize(20 * 1024 * 1024);
+      // the styles, sprites and the tiles drawn before, the ones of the routes are in TileCache
+      settings.setCacheDatabaseMaximumSize(100 * 1024 * 1024);
       settings.setAccessToken(token.trimmed());
+      settings.setResourceTransform(TileCache::transform);
 
       MapWindow * m = new MapWindow(settings);
       m->setFixedWidth(width() / 2 - bdr_s);
@@ -162,6 +179,16 @@ void OnroadAlerts::paintEvent(QPaintEvent *event) {
 
 NvgWindow::NvgWindow(QWidget *parent) : QOpenGLWidget(parent) {
   setAttribute(Qt::WA_OpaquePaintEvent);
+
+  // frames trigger their own paints, updateState only comes at UI_FREQ
+  for (VisionReceiver *v : {QUIState::ui_state.vision_rear, QUIState::ui_state.vision_wide}) {
+    QObject::connect(v, &VisionReceiver::frameReceived, this, QOverload<>::of(&NvgWindow::update));
+  }
+  QObject::connect(this, &QOpenGLWidget::frameSwapped, [] {
+    UIState &s = QUIState::ui_state;
+    FrameProfiler::instance().frameSwapped(s.last_frame_presented ? 0 : s.last_frame_eof);
+    s.last_frame_presented = true;
+  });
 }
 
 NvgWindow::~NvgWindow() {
@@ -181,14 +208,10 @@ void NvgWindow::initializeGL() {
 }
 
 void NvgWindow::updateState(const UIState &s) {
-  // Connecting to visionIPC requires opengl to be current
-  if (s.vipc_client->connected) {
-    makeCurrent();
-  }
-  if (isVisible() != s.vipc_client->connected) {
-    setVisible(s.vipc_client->connected);
+  if (isVisible() != s.vision_connected) {
+    setVisible(s.vision_connected);
   }
-  repaint();
+  update();
 }
 
 void NvgWindow::resizeGL(int w, int h) {
@@ -196,7 +219,9 @@ void NvgWindow::resizeGL(int w, int h) {
 }
 
 void NvgWindow::paintGL() {
+  const double cpu_start = millis_thread_cpu();
   ui_draw(&QUIState::ui_state, width(), height());
+  QUIState::ui_state.draw_cpu_ms = millis_thread_cpu() - cpu_start;
 
   double cur_draw_t = millis_since_boot();
   double dt = cur_draw_t - prev_draw_t;
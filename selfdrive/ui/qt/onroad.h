@@ -18,6 +18,8 @@ class OnroadAlerts : public QWidget {
 public:
   OnroadAlerts(QWidget *parent = 0) : QWidget(parent) {};
   void updateAlert(const Alert &a, const QColor &color);
+  const Alert &current() const { return alert; }
+  QColor color() const { return bg; }
 
 protected:
   void paintEvent(QPaintEvent*) override;
@@ -48,6 +50,8 @@ public slots:
   void updateState(const UIState &s);
 };
 
+class DirectRender;
+
 // container for all onroad widgets
 class OnroadWindow : public QWidget {
   Q_OBJECT
@@ -60,7 +64,8 @@ private:
   void paintEvent(QPaintEvent *event);
 
   OnroadAlerts *alerts;
-  NvgWindow *nvg;
+  NvgWindow *nvg = nullptr;
+  DirectRender *direct = nullptr;
   QColor bg = bg_colors[STATUS_DISENGAGED];
   QHBoxLayout* split;
 
@@ -0,0 +1,116 @@
+#include "selfdrive/ui/qt/params_cache.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+#include <QDir>
+#include <QFileSystemWatcher>
+#include <QThread>
+#include <QTimer>
+
+#include "selfdrive/common/params.h"
+#include "selfdrive/hardware/hw.h"
+
+// a put is a rename into the dir, writes that come together get one reload
+const int RELOAD_DEBOUNCE_MS = 50;
+
+namespace {
+
+class ParamsSnapshot {
+public:
+  ParamsSnapshot() : values(Params().readAll()) {
+    thread = new QThread;
+    context = new QObject;
+    context->moveToThread(thread);
+    thread->start();
+    QMetaObject::invokeMethod(context, [=]() { watch(); });
+  }
+
+  std::string get(const std::string &key) {
+    std::lock_guard lk(lock);
+    auto it = values.find(key);
+    return it != values.end() ? it->second : "";
+  }
+
+  void set(const std::string &key, const std::string &val) {
+    std::lock_guard lk(lock);
+    values[key] = val;
+  }
+
+  void erase(const std::string &key) {
+    std::lock_guard lk(lock);
+    values.erase(key);
+  }
+
+private:
+  // in the thread
+  void watch() {
+    // the params dir too, d is a symlink that gets replaced when the params are made again
+    const QString params_path = QString::fromStdString(Path::params());
+    const QString d_path = params_path + "/d";
+    QFileSystemWatcher *watcher = new QFileSystemWatcher({params_path, d_path}, context);
+    watchFiles(watcher, d_path);
+
+    QTimer *reload_timer = new QTimer(context);
+    reload_timer->setSingleShot(true);
+    reload_timer->setInterval(RELOAD_DEBOUNCE_MS);
+    QObject::connect(watcher, &QFileSystemWatcher::directoryChanged, reload_timer, qOverload<>(&QTimer::start));
+    QObject::connect(watcher, &QFileSystemWatcher::fileChanged, reload_timer, qOverload<>(&QTimer::start));
+    QObject::connect(reload_timer, &QTimer::timeout, [=]() {
+      if (!watcher->directories().contains(d_path)) {
+        watcher->addPath(d_path);
+      }
+      watchFiles(watcher, d_path);
+      auto all = Params().readAll();
+      std::lock_guard lk(lock);
+      values = std::move(all);
+    });
+  }
+
+  // the scripts of the settings write some params in place, like date > LastUpdateTime, which
+  // doesn't change the dir
+  void watchFiles(QFileSystemWatcher *watcher, const QString &d_path) {
+    QStringList files;
+    for (const QString &key : QDir(d_path).entryList(QDir::Files)) {
+      files.push_back(d_path + "/" + key);
+    }
+    const QStringList watched = watcher->files();
+    files.erase(std::remove_if(files.begin(), files.end(), [&](const QString &f) { return watched.contains(f); }), files.end());
+    if (!files.isEmpty()) {
+      watcher->addPaths(files);
+    }
+  }
+
+  std::mutex lock;
+  std::map<std::string, std::string> values;
+
+  // for the life of the process, like the ui
+  QThread *thread;
+  QObject *context;
+};
+
+ParamsSnapshot &snapshot() {
+  static ParamsSnapshot *s = new ParamsSnapshot();
+  return *s;
+}
+
+}  // namespace
+
+std::string ParamsCache::get(const std::string &key) {
+  return snapshot().get(key);
+}
+
+int ParamsCache::put(const std::string &key, const std::string &val) {
+  int ret = Params().put(key, val);
+  if (ret == 0) {
+    snapshot().set(key, val);
+  }
+  return ret;
+}
+
+int ParamsCache::remove(const std::string &key) {
+  int ret = Params().remove(key);
+  snapshot().erase(key);
+  return ret;
+}
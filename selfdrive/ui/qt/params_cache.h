@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+// The params as the ui reads them, from a snapshot of all the keys that is loaded by one readAll
+// and reloaded on a thread of its own when the params dir or files change. A read is a lookup in memory,
+// so the GUI thread doesn't open a file per key. The writes go to the files and then the snapshot,
+// like Params. Used like Params, the instances share the snapshot.
+class ParamsCache {
+public:
+  std::string get(const std::string &key);
+  inline bool getBool(const std::string &key) {
+    return get(key) == "1";
+  }
+
+  int put(const std::string &key, const std::string &val);
+  inline int putBool(const std::string &key, bool val) {
+    return put(key, val ? "1" : "0");
+  }
+  int remove(const std::string &key);
+};
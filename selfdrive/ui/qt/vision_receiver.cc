@@ -0,0 +1,76 @@
+#include "selfdrive/ui/qt/vision_receiver.h"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+
+VisionReceiver::VisionReceiver(const std::string &name, VisionStreamType type, QObject *parent) : QObject(parent) {
+  vipc_client = std::make_unique<VisionIpcClient>(name, type, true);
+}
+
+VisionReceiver::VisionReceiver(const std::string &name, const std::string &stream_name, QObject *parent) : QObject(parent) {
+  vipc_client = std::make_unique<VisionIpcClient>(name, stream_name, true);
+}
+
+VisionReceiver::~VisionReceiver() {
+  stop();
+}
+
+void VisionReceiver::start() {
+  if (running) return;
+
+  running = true;
+  thread = std::thread(&VisionReceiver::run, this);
+}
+
+void VisionReceiver::stop() {
+  if (!running) return;
+
+  running = false;
+  thread.join();
+  // connect again on the next start
+  vipc_client->connected = false;
+  latest_idx = -1;
+}
+
+VisionBuf *VisionReceiver::takeFrame(uint64_t *timestamp_eof) {
+  int idx = latest_idx.exchange(-1);
+  if (idx >= 0 && timestamp_eof) {
+    *timestamp_eof = timestamps_eof[idx % timestamps_eof.size()];
+  }
+  return idx >= 0 ? &vipc_client->buffers[idx] : nullptr;
+}
+
+void VisionReceiver::run() {
+  while (running) {
+    if (!vipc_client->connected) {
+      bool ok;
+      {
+        std::lock_guard lk(buffers_lock);
+        buffers_ready = false;
+        latest_idx = -1;
+        ok = vipc_client->connect(false);
+      }
+      if (!ok) {
+        util::sleep_for(100);
+        continue;
+      }
+      emit connected();
+    }
+
+    VisionIpcBufExtra extra = {};
+    VisionBuf *buf = vipc_client->recv(&extra);
+    if (buf != nullptr) {
+      timestamps_eof[buf->idx % timestamps_eof.size()] = extra.timestamp_eof;
+      if (buffers_ready && latest_idx.exchange(buf->idx) < 0) {
+        emit frameReceived();
+      }
+    } else if (!Hardware::PC()) {
+      LOGE("visionIPC receive timeout");
+    }
+
+    if (!vipc_client->connected) {
+      emit disconnected();
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <QObject>
+
+#include "cereal/visionipc/visionipc_client.h"
+
+// Connects to a VisionIpc stream and receives its frames on a thread of its own, so a slow paint
+// doesn't hold up the frames and the GUI thread doesn't sit in recv. Only the newest frame is kept,
+// the ones that arrive before the GUI thread took the previous one replace it.
+class VisionReceiver : public QObject {
+  Q_OBJECT
+
+public:
+  VisionReceiver(const std::string &name, VisionStreamType type, QObject *parent = nullptr);
+  // A stream the server created by name
+  VisionReceiver(const std::string &name, const std::string &stream_name, QObject *parent = nullptr);
+  ~VisionReceiver();
+
+  void start();
+  void stop();
+  bool isRunning() const { return running; }
+
+  // The newest frame since the last call, nullptr if there is none. With the end of its exposure, boot time ns
+  VisionBuf *takeFrame(uint64_t *timestamp_eof = nullptr);
+  // After connected, once the GUI thread made its textures of the buffers. No frames are posted before
+  void buffersReady() { buffers_ready = true; }
+  VisionIpcClient *client() { return vipc_client.get(); }
+
+  // Held by the thread while connecting, that maps the buffers again, and by the GUI thread while it uses them
+  std::mutex buffers_lock;
+
+signals:
+  void connected();
+  void disconnected();
+  // Once per frame the GUI thread can take, a newer frame before it took it doesn't signal again
+  void frameReceived();
+
+private:
+  void run();
+
+  std::unique_ptr<VisionIpcClient> vipc_client;
+  std::thread thread;
+  std::atomic<bool> running = false;
+  std::atomic<bool> buffers_ready = false;
+  std::atomic<int> latest_idx = -1;
+  // by buffer, a buffer is written again after the ones queued behind it
+  std::array<std::atomic<uint64_t>, 64> timestamps_eof = {};
+};
@@ -1,5 +1,6 @@
 #include "selfdrive/ui/qt/widgets/cameraview.h"
 
+#include "selfdrive/ui/qt/frame_profiler.h"
 #include "selfdrive/ui/qt/qt_window.h"
 
 namespace {
@@ -36,6 +37,40 @@ const char frame_fragment_shader[] =
 #endif
   "}\n";
 
+// BT.601 limited range, the inverse of rgb_to_yuv.cl. On QCOM the NV12 buffer is an external image
+// that samples as rgb, elsewhere the planes are textures of their own and uNV12 has u and v in one
+const char yuv_fragment_shader[] =
+#ifdef NANOVG_GL3_IMPLEMENTATION
+  "#version 150 core\n"
+#else
+  "#version 300 es\n"
+#endif
+#ifdef QCOM
+  "#extension GL_OES_EGL_image_external_essl3 : require\n"
+  "precision mediump float;\n"
+  "uniform samplerExternalOES uTexture;\n"
+  "in vec4 vTexCoord;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  "  colorOut = vec4(texture(uTexture, vTexCoord.xy).rgb, 1.0);\n"
+  "}\n";
+#else
+  "precision mediump float;\n"
+  "uniform sampler2D uTextureY;\n"
+  "uniform sampler2D uTextureU;\n"
+  "uniform sampler2D uTextureV;\n"
+  "uniform bool uNV12;\n"
+  "in vec4 vTexCoord;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  "  float y = 1.164 * (texture(uTextureY, vTexCoord.xy).r - 0.0625);\n"
+  "  vec2 uv = uNV12 ? texture(uTextureU, vTexCoord.xy).rg\n"
+  "                  : vec2(texture(uTextureU, vTexCoord.xy).r, texture(uTextureV, vTexCoord.xy).r);\n"
+  "  uv -= 0.5;\n"
+  "  colorOut = vec4(y + 1.596 * uv.y, y - 0.391 * uv.x - 0.813 * uv.y, y + 2.018 * uv.x, 1.0);\n"
+  "}\n";
+#endif
+
 const mat4 device_transform = {{
   1.0,  0.0, 0.0, 0.0,
   0.0,  1.0, 0.0, 0.0,
@@ -73,18 +108,39 @@ mat4 get_driver_view_transform() {
   return transform;
 }
 
+bool is_yuv(VisionStreamType stream_type) {
+  return stream_type == VISION_STREAM_YUV_BACK || stream_type == VISION_STREAM_YUV_FRONT || stream_type == VISION_STREAM_YUV_WIDE;
+}
+
+// the frames of a yuv stream that the GPU imports, on QCOM the NV12 ones camerad makes for the
+// encoder (encoder_stream_name in camera_common.h) instead of the I420 ones
+VisionReceiver *yuv_receiver(VisionStreamType stream_type, QObject *parent) {
+#ifdef QCOM
+  const char *name = stream_type == VISION_STREAM_YUV_BACK ? "yuv_back_encoder" :
+                     stream_type == VISION_STREAM_YUV_FRONT ? "yuv_front_encoder" : "yuv_wide_encoder";
+  return new VisionReceiver("camerad", name, parent);
+#else
+  return new VisionReceiver("camerad", stream_type, parent);
+#endif
+}
+
 } // namespace
 
 CameraViewWidget::CameraViewWidget(VisionStreamType stream_type, QWidget* parent) : stream_type(stream_type), QOpenGLWidget(parent) {
   setAttribute(Qt::WA_OpaquePaintEvent);
 
-  timer = new QTimer(this);
-  connect(timer, &QTimer::timeout, this, &CameraViewWidget::updateFrame);
+  yuv = is_yuv(stream_type);
+  vision = yuv ? yuv_receiver(stream_type, this) : new VisionReceiver("camerad", stream_type, this);
+  connect(vision, &VisionReceiver::connected, this, &CameraViewWidget::visionConnected);
+  connect(vision, &VisionReceiver::disconnected, this, &CameraViewWidget::visionDisconnected);
+  connect(vision, &VisionReceiver::frameReceived, this, QOverload<>::of(&CameraViewWidget::update));
 }
 
 CameraViewWidget::~CameraViewWidget() {
+  vision->stop();
   makeCurrent();
   if (isValid()) {
+    yuv_textures.clear();
     glDeleteVertexArrays(1, &frame_vao);
     glDeleteBuffers(1, &frame_vbo);
     glDeleteBuffers(1, &frame_ibo);
@@ -95,11 +151,12 @@ CameraViewWidget::~CameraViewWidget() {
 void CameraViewWidget::initializeGL() {
   initializeOpenGLFunctions();
 
-  gl_shader = std::make_unique<GLShader>(frame_vertex_shader, frame_fragment_shader);
+  gl_shader = std::make_unique<GLShader>(frame_vertex_shader, yuv ? yuv_fragment_shader : frame_fragment_shader);
   GLint frame_pos_loc = glGetAttribLocation(gl_shader->prog, "aPosition");
   GLint frame_texcoord_loc = glGetAttribLocation(gl_shader->prog, "aTexCoord");
 
-  auto [x1, x2, y1, y2] = stream_type == VISION_STREAM_RGB_FRONT ? std::tuple(0.f, 1.f, 1.f, 0.f) : std::tuple(1.f, 0.f, 1.f, 0.f);
+  const bool front = stream_type == VISION_STREAM_RGB_FRONT || stream_type == VISION_STREAM_YUV_FRONT;
+  auto [x1, x2, y1, y2] = front ? std::tuple(0.f, 1.f, 1.f, 0.f) : std::tuple(1.f, 0.f, 1.f, 0.f);
   const uint8_t frame_indicies[] = {0, 1, 2, 0, 2, 3};
   const float frame_coords[4][4] = {
     {-1.0, -1.0, x2, y1}, //bl
@@ -125,12 +182,13 @@ void CameraViewWidget::initializeGL() {
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindVertexArray(0);
 
-  if (stream_type == VISION_STREAM_RGB_FRONT) {
+  if (front) {
     frame_mat = matmul(device_transform, get_driver_view_transform());
   } else {
-    auto intrinsic_matrix = stream_type == VISION_STREAM_RGB_WIDE ? ecam_intrinsic_matrix : fcam_intrinsic_matrix;
+    const bool wide = stream_type == VISION_STREAM_RGB_WIDE || stream_type == VISION_STREAM_YUV_WIDE;
+    auto intrinsic_matrix = wide ? ecam_intrinsic_matrix : fcam_intrinsic_matrix;
     float zoom = ZOOM / intrinsic_matrix.v[0];
-    if (stream_type == VISION_STREAM_RGB_WIDE) {
+    if (wide) {
       zoom *= 0.5;
     }
     float zx = zoom * 2 * intrinsic_matrix.v[2] / width();
@@ -144,52 +202,48 @@ void CameraViewWidget::initializeGL() {
     }};
     frame_mat = matmul(device_transform, frame_transform);
   }
-  vipc_client = std::make_unique<VisionIpcClient>("camerad", stream_type, true);
 }
 
 void CameraViewWidget::showEvent(QShowEvent *event) {
-  timer->start(0);
+  vision->start();
 }
 
 void CameraViewWidget::hideEvent(QHideEvent *event) {
-  timer->stop();
-  vipc_client->connected = false;
+  vision->stop();
   latest_frame = nullptr;
 }
 
-void CameraViewWidget::paintGL() {
-  if (!latest_frame) {
-    glClearColor(0, 0, 0, 1.0);
-    glClear(GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-    return;
-  }
-
-  glViewport(0, 0, width(), height());
-
-  glBindVertexArray(frame_vao);
-  glActiveTexture(GL_TEXTURE0);
-
-  glBindTexture(GL_TEXTURE_2D, texture[latest_frame->idx]->frame_tex);
-  if (!Hardware::EON()) {
-    // this is handled in ion on QCOM
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, latest_frame->width, latest_frame->height,
-                  0, GL_RGB, GL_UNSIGNED_BYTE, latest_frame->addr);
-  }
+void CameraViewWidget::visionConnected() {
+  // queued from the receiver thread, it may have stopped since
+  if (!vision->isRunning()) return;
 
-  glUseProgram(gl_shader->prog);
-  glUniform1i(gl_shader->getUniformLocation("uTexture"), 0);
-  glUniformMatrix4fv(gl_shader->getUniformLocation("uTransform"), 1, GL_TRUE, frame_mat.v);
+  textures_stale = true;
+  latest_frame = nullptr;
+  update();
+}
 
-  assert(glGetError() == GL_NO_ERROR);
-  glEnableVertexAttribArray(0);
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, (const void *)0);
-  glDisableVertexAttribArray(0);
-  glBindVertexArray(0);
+void CameraViewWidget::visionDisconnected() {
+  latest_frame = nullptr;
 }
 
-void CameraViewWidget::updateFrame() {
-  if (!vipc_client->connected && vipc_client->connect(false)) {
-    // init vision
+void CameraViewWidget::paintGL() {
+  FrameProfiler::Scope scope("CameraViewWidget");
+  std::lock_guard lk(vision->buffers_lock);
+  if (textures_stale && yuv) {
+    VisionIpcClient *vipc_client = vision->client();
+    yuv_textures.clear();
+#ifdef QCOM
+    for (int i = 0; i < vipc_client->num_buffers; i++) {
+      yuv_textures.emplace_back(new YUVImageTexture(&vipc_client->buffers[i]));
+    }
+#else
+    yuv_textures.emplace_back(new YUVImageTexture(&vipc_client->buffers[0]));
+#endif
+    assert(glGetError() == GL_NO_ERROR);
+    textures_stale = false;
+    vision->buffersReady();
+  } else if (textures_stale) {
+    VisionIpcClient *vipc_client = vision->client();
     for (int i = 0; i < vipc_client->num_buffers; i++) {
       texture[i].reset(new EGLImageTexture(&vipc_client->buffers[i]));
 
@@ -203,17 +257,59 @@ void CameraViewWidget::updateFrame() {
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
       assert(glGetError() == GL_NO_ERROR);
     }
-    latest_frame = nullptr;
+    textures_stale = false;
+    vision->buffersReady();
+  }
+
+  VisionBuf *buf = vision->takeFrame();
+  if (buf) {
+    latest_frame = buf;
+    latest_frame_uploaded = false;
+    emit frameUpdated();
   }
 
-  if (vipc_client->connected) {
-    VisionBuf *buf = vipc_client->recv();
-    if (buf != nullptr) {
-      latest_frame = buf;
-      update();
-      emit frameUpdated();
-    } else {
-      LOGE("visionIPC receive timeout");
+  if (!latest_frame) {
+    glClearColor(0, 0, 0, 1.0);
+    glClear(GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    return;
+  }
+
+  glViewport(0, 0, width(), height());
+
+  glBindVertexArray(frame_vao);
+  glUseProgram(gl_shader->prog);
+
+  if (yuv) {
+    YUVImageTexture *tex = yuv_textures[yuv_textures.size() == 1 ? 0 : latest_frame->idx].get();
+    if (!latest_frame_uploaded) {
+      tex->upload(latest_frame);
+      latest_frame_uploaded = true;
     }
+    tex->bind();
+#ifdef QCOM
+    glUniform1i(gl_shader->getUniformLocation("uTexture"), 0);
+#else
+    glUniform1i(gl_shader->getUniformLocation("uTextureY"), 0);
+    glUniform1i(gl_shader->getUniformLocation("uTextureU"), 1);
+    glUniform1i(gl_shader->getUniformLocation("uTextureV"), 2);
+    glUniform1i(gl_shader->getUniformLocation("uNV12"), latest_frame->nv12);
+#endif
+  } else {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture[latest_frame->idx]->frame_tex);
+    if (!Hardware::EON() && !latest_frame_uploaded) {
+      // this is handled in ion on QCOM, paints without a new frame keep the texture
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, latest_frame->width, latest_frame->height,
+                    0, GL_RGB, GL_UNSIGNED_BYTE, latest_frame->addr);
+      latest_frame_uploaded = true;
+    }
+    glUniform1i(gl_shader->getUniformLocation("uTexture"), 0);
   }
+  glUniformMatrix4fv(gl_shader->getUniformLocation("uTransform"), 1, GL_TRUE, frame_mat.v);
+
+  assert(glGetError() == GL_NO_ERROR);
+  glEnableVertexAttribArray(0);
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, (const void *)0);
+  glDisableVertexAttribArray(0);
+  glBindVertexArray(0);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <QOpenGLFunctions>
 #include <QOpenGLWidget>
@@ -9,6 +10,7 @@
 #include "selfdrive/common/glutil.h"
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/visionimg.h"
+#include "selfdrive/ui/qt/vision_receiver.h"
 #include "selfdrive/ui/ui.h"
 
 class CameraViewWidget : public QOpenGLWidget, protected QOpenGLFunctions {
@@ -29,16 +31,22 @@ protected:
   void hideEvent(QHideEvent *event) override;
 
 protected slots:
-  void updateFrame();
+  void visionConnected();
+  void visionDisconnected();
 
 private:
   VisionBuf *latest_frame = nullptr;
+  bool latest_frame_uploaded = false;
+  bool textures_stale = false;
   GLuint frame_vao, frame_vbo, frame_ibo;
   mat4 frame_mat;
-  std::unique_ptr<VisionIpcClient> vipc_client;
+  VisionReceiver *vision;
   std::unique_ptr<EGLImageTexture> texture[UI_BUF_COUNT];
+  // one per buffer when they are imported, else one the frames are uploaded to
+  std::vector<std::unique_ptr<YUVImageTexture>> yuv_textures;
   std::unique_ptr<GLShader> gl_shader;
 
   VisionStreamType stream_type;
-  QTimer* timer;
+  // sampled from the yuv stream of the camera, without camerad's rgb one
+  bool yuv;
 };
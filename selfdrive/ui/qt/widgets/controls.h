@@ -6,6 +6,7 @@
 #include <QPushButton>
 
 #include "selfdrive/common/params.h"
+#include "selfdrive/ui/qt/params_cache.h"
 #include "selfdrive/ui/qt/widgets/toggle.h"
 
 QFrame *horizontal_line(QWidget *parent = nullptr);
@@ -126,5 +127,5 @@ public:
 
 private:
   std::string key;
-  Params params;
+  ParamsCache params;
 };
@@ -6,6 +6,7 @@
 #include <QVBoxLayout>
 
 #include "selfdrive/common/params.h"
+#include "selfdrive/ui/qt/params_cache.h"
 
 class AbstractAlert : public QFrame {
   Q_OBJECT
@@ -13,7 +14,7 @@ class AbstractAlert : public QFrame {
 protected:
   AbstractAlert(bool hasRebootBtn, QWidget *parent = nullptr);
   QVBoxLayout *scrollable_layout;
-  Params params;
+  ParamsCache params;
 
 signals:
   void dismiss();
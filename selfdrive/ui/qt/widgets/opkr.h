@@ -4,6 +4,7 @@
 #include <QSoundEffect>
 
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/ui/qt/params_cache.h"
 #include "selfdrive/ui/qt/widgets/controls.h"
 #include "selfdrive/ui/ui.h"
 #include <QComboBox>
@@ -16,7 +17,7 @@ public:
   SwitchOpenpilot();
 
 private:
-  Params params;
+  ParamsCache params;
 
   QString githubid;
   QString githubrepo;
@@ -32,10 +33,10 @@ class SshLegacyToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  SshLegacyToggle() : ToggleControl("Use Existing Public Key", "When connecting via SSH, the existing public key (0.8.2 or lower) is used.", "", Params().getBool("OpkrSSHLegacy")) {
+  SshLegacyToggle() : ToggleControl("Use Existing Public Key", "When connecting via SSH, the existing public key (0.8.2 or lower) is used.", "", ParamsCache().getBool("OpkrSSHLegacy")) {
     QObject::connect(this, &SshLegacyToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrSSHLegacy", status);
+      ParamsCache().putBool("OpkrSSHLegacy", status);
     });
   }
 };
@@ -44,10 +45,10 @@ class GetoffAlertToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  GetoffAlertToggle() : ToggleControl("Enable Device Notification After Get Off", "Send a notification to disconnect the device after get off.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrEnableGetoffAlert")) {
+  GetoffAlertToggle() : ToggleControl("Enable Device Notification After Get Off", "Send a notification to disconnect the device after get off.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrEnableGetoffAlert")) {
     QObject::connect(this, &GetoffAlertToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrEnableGetoffAlert", status);
+      ParamsCache().putBool("OpkrEnableGetoffAlert", status);
     });
   }
 };
@@ -56,10 +57,10 @@ class AutoResumeToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  AutoResumeToggle() : ToggleControl("Enable Auto Resume", "Auto Resume is used when stopping while using SCC.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrAutoResume")) {
+  AutoResumeToggle() : ToggleControl("Enable Auto Resume", "Auto Resume is used when stopping while using SCC.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrAutoResume")) {
     QObject::connect(this, &AutoResumeToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrAutoResume", status);
+      ParamsCache().putBool("OpkrAutoResume", status);
     });
   }
 };
@@ -68,10 +69,10 @@ class VariableCruiseToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  VariableCruiseToggle() : ToggleControl("Enable Variable Cruise", "Acceleration/deceleration is supported by using the cruise button while SCC is in use.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrVariableCruise")) {
+  VariableCruiseToggle() : ToggleControl("Enable Variable Cruise", "Acceleration/deceleration is supported by using the cruise button while SCC is in use.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrVariableCruise")) {
     QObject::connect(this, &VariableCruiseToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrVariableCruise", status);
+      ParamsCache().putBool("OpkrVariableCruise", status);
     });
   }
 };
@@ -80,10 +81,10 @@ class CruiseGapAdjustToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  CruiseGapAdjustToggle() : ToggleControl("Auto Set Cruise Cap When Stopped", "When stopping, the cruise gap is changed to 1 space for a quick departure. After moving from standstill, it returns to the original cruise gap according to certain conditions.", "../assets/offroad/icon_shell.png", Params().getBool("CruiseGapAdjust")) {
+  CruiseGapAdjustToggle() : ToggleControl("Auto Set Cruise Cap When Stopped", "When stopping, the cruise gap is changed to 1 space for a quick departure. After moving from standstill, it returns to the original cruise gap according to certain conditions.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("CruiseGapAdjust")) {
     QObject::connect(this, &CruiseGapAdjustToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("CruiseGapAdjust", status);
+      ParamsCache().putBool("CruiseGapAdjust", status);
     });
   }
 };
@@ -92,10 +93,10 @@ class AutoEnabledToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  AutoEnabledToggle() : ToggleControl("Enable Auto Engage", "When disengaged, if the cruise button is in the standby state (only CRUISE is displayed and the speed is not specified), auto engage is activated.", "../assets/offroad/icon_shell.png", Params().getBool("AutoEnable")) {
+  AutoEnabledToggle() : ToggleControl("Enable Auto Engage", "When disengaged, if the cruise button is in the standby state (only CRUISE is displayed and the speed is not specified), auto engage is activated.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("AutoEnable")) {
     QObject::connect(this, &AutoEnabledToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("AutoEnable", status);
+      ParamsCache().putBool("AutoEnable", status);
     });
   }
 };
@@ -104,10 +105,10 @@ class CruiseAutoResToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  CruiseAutoResToggle() : ToggleControl("Enable Cruise Auto RES", "If brake is pressed and disengages cruise (CANCEL button not applicable), when the brake pedal is released/the gas pedal pedal is pressed, the previous set speed is set. Cruise Auto RES is enabled when cruise speed is over 30km/h or a car is recognized at the front.", "../assets/offroad/icon_shell.png", Params().getBool("CruiseAutoRes")) {
+  CruiseAutoResToggle() : ToggleControl("Enable Cruise Auto RES", "If brake is pressed and disengages cruise (CANCEL button not applicable), when the brake pedal is released/the gas pedal pedal is pressed, the previous set speed is set. Cruise Auto RES is enabled when cruise speed is over 30km/h or a car is recognized at the front.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("CruiseAutoRes")) {
     QObject::connect(this, &CruiseAutoResToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("CruiseAutoRes", status);
+      ParamsCache().putBool("CruiseAutoRes", status);
     });
   }
 };
@@ -116,10 +117,10 @@ class BatteryChargingControlToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  BatteryChargingControlToggle() : ToggleControl("Enable Battery Charging Control", "Enables battery charging control.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrBatteryChargingControl")) {
+  BatteryChargingControlToggle() : ToggleControl("Enable Battery Charging Control", "Enables battery charging control.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrBatteryChargingControl")) {
     QObject::connect(this, &BatteryChargingControlToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrBatteryChargingControl", status);
+      ParamsCache().putBool("OpkrBatteryChargingControl", status);
     });
   }
 };
@@ -128,10 +129,10 @@ class BlindSpotDetectToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  BlindSpotDetectToggle() : ToggleControl("Display Blind Spot Detection Icon", "When a car is detected at your blind spot, an icon is displayed on the screen.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrBlindSpotDetect")) {
+  BlindSpotDetectToggle() : ToggleControl("Display Blind Spot Detection Icon", "When a car is detected at your blind spot, an icon is displayed on the screen.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrBlindSpotDetect")) {
     QObject::connect(this, &BlindSpotDetectToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrBlindSpotDetect", status);
+      ParamsCache().putBool("OpkrBlindSpotDetect", status);
       if (state) {
         QUIState::ui_state.scene.nOpkrBlindSpotDetect = true;
       } else {
@@ -145,10 +146,10 @@ class MadModeEnabledToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  MadModeEnabledToggle() : ToggleControl("ACC MAIN openpilot ON/OFF", "Use ACC MAIN to activate openpilot.", "../assets/offroad/icon_shell.png", Params().getBool("MadModeEnabled")) {
+  MadModeEnabledToggle() : ToggleControl("ACC MAIN openpilot ON/OFF", "Use ACC MAIN to activate openpilot.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("MadModeEnabled")) {
     QObject::connect(this, &MadModeEnabledToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("MadModeEnabled", status);
+      ParamsCache().putBool("MadModeEnabled", status);
     });
   }
 };
@@ -157,10 +158,10 @@ class WhitePandaSupportToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  WhitePandaSupportToggle() : ToggleControl("White Panda Support", "Turn on the feature when using White Panda", "../assets/offroad/icon_shell.png", Params().getBool("WhitePandaSupport")) {
+  WhitePandaSupportToggle() : ToggleControl("White Panda Support", "Turn on the feature when using White Panda", "../assets/offroad/icon_shell.png", ParamsCache().getBool("WhitePandaSupport")) {
     QObject::connect(this, &WhitePandaSupportToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("WhitePandaSupport", status);
+      ParamsCache().putBool("WhitePandaSupport", status);
     });
   }
 };
@@ -169,10 +170,10 @@ class SteerWarningFixToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  SteerWarningFixToggle() : ToggleControl("Turn Off Steering Warning", "Turn on the feature when the vehicle has a steering error that makes it impossible to steer (only for some cars). Do not turn on the feature when it occurs in a normal error environment while driving.", "../assets/offroad/icon_shell.png", Params().getBool("SteerWarningFix")) {
+  SteerWarningFixToggle() : ToggleControl("Turn Off Steering Warning", "Turn on the feature when the vehicle has a steering error that makes it impossible to steer (only for some cars). Do not turn on the feature when it occurs in a normal error environment while driving.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("SteerWarningFix")) {
     QObject::connect(this, &SteerWarningFixToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("SteerWarningFix", status);
+      ParamsCache().putBool("SteerWarningFix", status);
     });
   }
 };
@@ -181,10 +182,10 @@ class SteerWindDownToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  SteerWindDownToggle() : ToggleControl("Steer Wind Down", "During Steer Warning, the torque is gradually reduced. In some vehicles, the steering angle limit light may appear. Turn off the feature to use the maximum steering angle regardless of the error.", "../assets/offroad/icon_shell.png", Params().getBool("SteerWindDown")) {
+  SteerWindDownToggle() : ToggleControl("Steer Wind Down", "During Steer Warning, the torque is gradually reduced. In some vehicles, the steering angle limit light may appear. Turn off the feature to use the maximum steering angle regardless of the error.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("SteerWindDown")) {
     QObject::connect(this, &SteerWindDownToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("SteerWindDown", status);
+      ParamsCache().putBool("SteerWindDown", status);
     });
   }
 };
@@ -193,10 +194,10 @@ class AutoScreenDimmingToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  AutoScreenDimmingToggle() : ToggleControl("Auto Screen Dimming Control", "By maintaining the minimum brightness while driving, it reduces battery consumption and heat generation, and increases the brightness when an event occurs to temporarily secure visibility.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrAutoScreenDimming")) {
+  AutoScreenDimmingToggle() : ToggleControl("Auto Screen Dimming Control", "By maintaining the minimum brightness while driving, it reduces battery consumption and heat generation, and increases the brightness when an event occurs to temporarily secure visibility.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrAutoScreenDimming")) {
     QObject::connect(this, &AutoScreenDimmingToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrAutoScreenDimming", status);
+      ParamsCache().putBool("OpkrAutoScreenDimming", status);
     });
   }
 };
@@ -205,10 +206,10 @@ class LiveSteerRatioToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  LiveSteerRatioToggle() : ToggleControl("Enable Live SteerRatio", "Enables Live SteerRatio instead of variable/fixed SteerRatio.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrLiveSteerRatio")) {
+  LiveSteerRatioToggle() : ToggleControl("Enable Live SteerRatio", "Enables Live SteerRatio instead of variable/fixed SteerRatio.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrLiveSteerRatio")) {
     QObject::connect(this, &LiveSteerRatioToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrLiveSteerRatio", status);
+      ParamsCache().putBool("OpkrLiveSteerRatio", status);
     });
   }
 };
@@ -217,10 +218,10 @@ class VariableSteerMaxToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  VariableSteerMaxToggle() : ToggleControl("Enable Variable SteerMax", "Enable variable SteerMax based on curvature.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrVariableSteerMax")) {
+  VariableSteerMaxToggle() : ToggleControl("Enable Variable SteerMax", "Enable variable SteerMax based on curvature.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrVariableSteerMax")) {
     QObject::connect(this, &VariableSteerMaxToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrVariableSteerMax", status);
+      ParamsCache().putBool("OpkrVariableSteerMax", status);
     });
   }
 };
@@ -229,10 +230,10 @@ class VariableSteerDeltaToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  VariableSteerDeltaToggle() : ToggleControl("Enable Variable SteerDelta", "Enable variable SteerDelta based on curvature (change from DeltaUp to 5, change from DeltaDown to 10).", "../assets/offroad/icon_shell.png", Params().getBool("OpkrVariableSteerDelta")) {
+  VariableSteerDeltaToggle() : ToggleControl("Enable Variable SteerDelta", "Enable variable SteerDelta based on curvature (change from DeltaUp to 5, change from DeltaDown to 10).", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrVariableSteerDelta")) {
     QObject::connect(this, &VariableSteerDeltaToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrVariableSteerDelta", status);
+      ParamsCache().putBool("OpkrVariableSteerDelta", status);
     });
   }
 };
@@ -241,10 +242,10 @@ class ShaneFeedForward : public ToggleControl {
   Q_OBJECT
 
 public:
-  ShaneFeedForward() : ToggleControl("Enable Shane FeedForward", "Enables Shane's FeedForward. Depending on the steering angle, torque is lowered on straight roads and dynamically adjusted on curved roads.", "../assets/offroad/icon_shell.png", Params().getBool("ShaneFeedForward")) {
+  ShaneFeedForward() : ToggleControl("Enable Shane FeedForward", "Enables Shane's FeedForward. Depending on the steering angle, torque is lowered on straight roads and dynamically adjusted on curved roads.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("ShaneFeedForward")) {
     QObject::connect(this, &ShaneFeedForward::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("ShaneFeedForward", status);
+      ParamsCache().putBool("ShaneFeedForward", status);
     });
   }
 };
@@ -253,10 +254,10 @@ class DrivingRecordToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  DrivingRecordToggle() : ToggleControl("Enable Auto Recording", "Automatically record/stop the screen while driving. Recording starts after departure and ends when the car stops.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrDrivingRecord")) {
+  DrivingRecordToggle() : ToggleControl("Enable Auto Recording", "Automatically record/stop the screen while driving. Recording starts after departure and ends when the car stops.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrDrivingRecord")) {
     QObject::connect(this, &DrivingRecordToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrDrivingRecord", status);
+      ParamsCache().putBool("OpkrDrivingRecord", status);
       if (state) {
         QUIState::ui_state.scene.driving_record = true;
       } else {
@@ -270,10 +271,10 @@ class TurnSteeringDisableToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  TurnSteeringDisableToggle() : ToggleControl("Enable Autosteer Suspension", "When turn signal is used below the lane change speed, autosteer is temporary suspended.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrTurnSteeringDisable")) {
+  TurnSteeringDisableToggle() : ToggleControl("Enable Autosteer Suspension", "When turn signal is used below the lane change speed, autosteer is temporary suspended.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrTurnSteeringDisable")) {
     QObject::connect(this, &TurnSteeringDisableToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrTurnSteeringDisable", status);
+      ParamsCache().putBool("OpkrTurnSteeringDisable", status);
     });
   }
 };
@@ -282,10 +283,10 @@ class HotspotOnBootToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  HotspotOnBootToggle() : ToggleControl("Auto Launch Hotspot on Boot", "Automatically launch hotspot after booting.", "", Params().getBool("OpkrHotspotOnBoot")) {
+  HotspotOnBootToggle() : ToggleControl("Auto Launch Hotspot on Boot", "Automatically launch hotspot after booting.", "", ParamsCache().getBool("OpkrHotspotOnBoot")) {
     QObject::connect(this, &HotspotOnBootToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrHotspotOnBoot", status);
+      ParamsCache().putBool("OpkrHotspotOnBoot", status);
     });
   }
 };
@@ -294,10 +295,10 @@ class CruiseOverMaxSpeedToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  CruiseOverMaxSpeedToggle() : ToggleControl("Set Cruise Over Max Speed", "If the current speed exceeds the set speed, the set speed is synchronized with the current speed.", "../assets/offroad/icon_shell.png", Params().getBool("CruiseOverMaxSpeed")) {
+  CruiseOverMaxSpeedToggle() : ToggleControl("Set Cruise Over Max Speed", "If the current speed exceeds the set speed, the set speed is synchronized with the current speed.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("CruiseOverMaxSpeed")) {
     QObject::connect(this, &CruiseOverMaxSpeedToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("CruiseOverMaxSpeed", status);
+      ParamsCache().putBool("CruiseOverMaxSpeed", status);
     });
   }
 };
@@ -306,10 +307,10 @@ class DebugUiOneToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  DebugUiOneToggle() : ToggleControl("DEBUG UI 1", "", "../assets/offroad/icon_shell.png", Params().getBool("DebugUi1")) {
+  DebugUiOneToggle() : ToggleControl("DEBUG UI 1", "", "../assets/offroad/icon_shell.png", ParamsCache().getBool("DebugUi1")) {
     QObject::connect(this, &DebugUiOneToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("DebugUi1", status);
+      ParamsCache().putBool("DebugUi1", status);
       if (state) {
         QUIState::ui_state.scene.nDebugUi1 = true;
       } else {
@@ -323,10 +324,10 @@ class DebugUiTwoToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  DebugUiTwoToggle() : ToggleControl("DEBUG UI 2", "", "../assets/offroad/icon_shell.png", Params().getBool("DebugUi2")) {
+  DebugUiTwoToggle() : ToggleControl("DEBUG UI 2", "", "../assets/offroad/icon_shell.png", ParamsCache().getBool("DebugUi2")) {
     QObject::connect(this, &DebugUiTwoToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("DebugUi2", status);
+      ParamsCache().putBool("DebugUi2", status);
       if (state) {
         QUIState::ui_state.scene.nDebugUi2 = true;
       } else {
@@ -340,10 +341,10 @@ class LongLogToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  LongLogToggle() : ToggleControl("LONG LOG View", "Instead of the variable cruise log, the long tuning debug log is displayed on the screen.", "../assets/offroad/icon_shell.png", Params().getBool("LongLogDisplay")) {
+  LongLogToggle() : ToggleControl("LONG LOG View", "Instead of the variable cruise log, the long tuning debug log is displayed on the screen.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("LongLogDisplay")) {
     QObject::connect(this, &LongLogToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("LongLogDisplay", status);
+      ParamsCache().putBool("LongLogDisplay", status);
     });
   }
 };
@@ -352,10 +353,10 @@ class PrebuiltToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  PrebuiltToggle() : ToggleControl("Create Prebuilt File", "Shortens the boot time by creating a prebuilt file. If you have made UI modifications, turn off the feature temporarily.", "../assets/offroad/icon_shell.png", Params().getBool("PutPrebuiltOn")) {
+  PrebuiltToggle() : ToggleControl("Create Prebuilt File", "Shortens the boot time by creating a prebuilt file. If you have made UI modifications, turn off the feature temporarily.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("PutPrebuiltOn")) {
     QObject::connect(this, &PrebuiltToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("PutPrebuiltOn", status);
+      ParamsCache().putBool("PutPrebuiltOn", status);
     });
   }
 };
@@ -364,10 +365,10 @@ class LDWSToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  LDWSToggle() : ToggleControl("LDWS Car Settings", "", "../assets/offroad/icon_shell.png", Params().getBool("LdwsCarFix")) {
+  LDWSToggle() : ToggleControl("LDWS Car Settings", "", "../assets/offroad/icon_shell.png", ParamsCache().getBool("LdwsCarFix")) {
     QObject::connect(this, &LDWSToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("LdwsCarFix", status);
+      ParamsCache().putBool("LdwsCarFix", status);
     });
   }
 };
@@ -376,10 +377,10 @@ class FPTwoToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  FPTwoToggle() : ToggleControl("Enable FingerPrint 2.0", "Enable Fingerprint 2.0. The car is recognized by ECU firmware recognition.", "../assets/offroad/icon_shell.png", Params().getBool("FingerprintTwoSet")) {
+  FPTwoToggle() : ToggleControl("Enable FingerPrint 2.0", "Enable Fingerprint 2.0. The car is recognized by ECU firmware recognition.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("FingerprintTwoSet")) {
     QObject::connect(this, &FPTwoToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("FingerprintTwoSet", status);
+      ParamsCache().putBool("FingerprintTwoSet", status);
     });
   }
 };
@@ -388,10 +389,10 @@ class GearDToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  GearDToggle() : ToggleControl("Gear D Force Recognition", "For use when engagement is not possible due to a gear recognition problem. It is fundamentally necessary to analyze CABANA data, but it is a temporary solution.", "../assets/offroad/icon_shell.png", Params().getBool("JustDoGearD")) {
+  GearDToggle() : ToggleControl("Gear D Force Recognition", "For use when engagement is not possible due to a gear recognition problem. It is fundamentally necessary to analyze CABANA data, but it is a temporary solution.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("JustDoGearD")) {
     QObject::connect(this, &GearDToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("JustDoGearD", status);
+      ParamsCache().putBool("JustDoGearD", status);
     });
   }
 };
@@ -400,10 +401,10 @@ class ComIssueToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  ComIssueToggle() : ToggleControl("Turn off ComIssue", "Turn on this feature to turn off Communication Error Between Processes alarm when using White Panda.", "../assets/offroad/icon_shell.png", Params().getBool("ComIssueGone")) {
+  ComIssueToggle() : ToggleControl("Turn off ComIssue", "Turn on this feature to turn off Communication Error Between Processes alarm when using White Panda.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("ComIssueGone")) {
     QObject::connect(this, &ComIssueToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("ComIssueGone", status);
+      ParamsCache().putBool("ComIssueGone", status);
     });
   }
 };
@@ -412,10 +413,10 @@ class RunNaviOnBootToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  RunNaviOnBootToggle() : ToggleControl("Navi Auto Launch On Boot", "After booting, navigation (T Map) is automatically launched.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrRunNaviOnBoot")) {
+  RunNaviOnBootToggle() : ToggleControl("Navi Auto Launch On Boot", "After booting, navigation (T Map) is automatically launched.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrRunNaviOnBoot")) {
     QObject::connect(this, &RunNaviOnBootToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrRunNaviOnBoot", status);
+      ParamsCache().putBool("OpkrRunNaviOnBoot", status);
     });
   }
 };
@@ -424,10 +425,10 @@ class BattLessToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  BattLessToggle() : ToggleControl("Use Batteryless", "Toggle for batteryless device. Relevant settings will be applied.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrBattLess")) {
+  BattLessToggle() : ToggleControl("Use Batteryless", "Toggle for batteryless device. Relevant settings will be applied.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrBattLess")) {
     QObject::connect(this, &BattLessToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrBattLess", status);
+      ParamsCache().putBool("OpkrBattLess", status);
     });
   }
 };
@@ -436,10 +437,10 @@ class LiveTunePanelToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  LiveTunePanelToggle() : ToggleControl("Enable LiveTune and UI", "Display the Live Tune UI. Tuning values can be set in realtime on the onroad screen. The adjustments are set in the parameters, values are maintained even after a reboot or the toggle is turned off.", "../assets/offroad/icon_shell.png", Params().getBool("OpkrLiveTunePanelEnable")) {
+  LiveTunePanelToggle() : ToggleControl("Enable LiveTune and UI", "Display the Live Tune UI. Tuning values can be set in realtime on the onroad screen. The adjustments are set in the parameters, values are maintained even after a reboot or the toggle is turned off.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("OpkrLiveTunePanelEnable")) {
     QObject::connect(this, &LiveTunePanelToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("OpkrLiveTunePanelEnable", status);
+      ParamsCache().putBool("OpkrLiveTunePanelEnable", status);
       if (state) {
         QUIState::ui_state.scene.live_tune_panel_enable = true;
         QUIState::ui_state.scene.opkr_livetune_ui = true;
@@ -455,10 +456,10 @@ class KRDateToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  KRDateToggle() : ToggleControl("Onroad Date Display", "Display the current date on the onroad screen.", "../assets/offroad/icon_shell.png", Params().getBool("KRDateShow")) {
+  KRDateToggle() : ToggleControl("Onroad Date Display", "Display the current date on the onroad screen.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("KRDateShow")) {
     QObject::connect(this, &KRDateToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("KRDateShow", status);
+      ParamsCache().putBool("KRDateShow", status);
       if (state) {
         QUIState::ui_state.scene.kr_date_show = true;
       } else {
@@ -472,10 +473,10 @@ class KRTimeToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  KRTimeToggle() : ToggleControl("Onroad Time Display", "Display the current time on the onroad screen.", "../assets/offroad/icon_shell.png", Params().getBool("KRTimeShow")) {
+  KRTimeToggle() : ToggleControl("Onroad Time Display", "Display the current time on the onroad screen.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("KRTimeShow")) {
     QObject::connect(this, &KRTimeToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("KRTimeShow", status);
+      ParamsCache().putBool("KRTimeShow", status);
       if (state) {
         QUIState::ui_state.scene.kr_time_show = true;
       } else {
@@ -489,10 +490,10 @@ class LeadCustomToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  LeadCustomToggle() : ToggleControl("Display Preceding Vehicle", "Display the custom image of the preceding vehicle on the onroad screen.", "../assets/offroad/icon_shell.png", Params().getBool("LeadCustom")) {
+  LeadCustomToggle() : ToggleControl("Display Preceding Vehicle", "Display the custom image of the preceding vehicle on the onroad screen.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("LeadCustom")) {
     QObject::connect(this, &LeadCustomToggle::toggleFlipped, [=](int state) {
       char status = state ? true : false;
-      Params().putBool("LeadCustom", status);
+      ParamsCache().putBool("LeadCustom", status);
     });
   }
 };
@@ -501,10 +502,10 @@ class RadarLongHelperToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  RadarLongHelperToggle() : ToggleControl("Enable Radar Long Assist", "When VOACC, radar value + comma vision long (interpolation) is used at close range (less than 25m). In situations where VOACC cannot stop sufficiently, it uses radar values to make sure the car stops. The feature is used only when the radar recognizes the car in front. When the car in front is not recognized (green chevron), the car is decelerated only with comma visoin long. When this feature is off, it means to always use comma vision long.", "../assets/offroad/icon_shell.png", Params().getBool("RadarLongHelper")) {
+  RadarLongHelperToggle() : ToggleControl("Enable Radar Long Assist", "When VOACC, radar value + comma vision long (interpolation) is used at close range (less than 25m). In situations where VOACC cannot stop sufficiently, it uses radar values to make sure the car stops. The feature is used only when the radar recognizes the car in front. When the car in front is not recognized (green chevron), the car is decelerated only with comma visoin long. When this feature is off, it means to always use comma vision long.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("RadarLongHelper")) {
     QObject::connect(this, &RadarLongHelperToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("RadarLongHelper", status);
+      ParamsCache().putBool("RadarLongHelper", status);
     });
   }
 };
@@ -513,10 +514,10 @@ class FCATypeToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  FCATypeToggle() : ToggleControl("Enable FCA11", "FCA11 is used instead of SCC12 for forward collision warnings. It is used when a forward collision error occurs during engage or boot. Please note that a car without the signal may cause a CAN error.", "../assets/offroad/icon_shell.png", Params().getBool("FCAType")) {
+  FCATypeToggle() : ToggleControl("Enable FCA11", "FCA11 is used instead of SCC12 for forward collision warnings. It is used when a forward collision error occurs during engage or boot. Please note that a car without the signal may cause a CAN error.", "../assets/offroad/icon_shell.png", ParamsCache().getBool("FCAType")) {
     QObject::connect(this, &FCATypeToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("FCAType", status);
+      ParamsCache().putBool("FCAType", status);
     });
   }
 };
@@ -525,10 +526,10 @@ class GitPullOnBootToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  GitPullOnBootToggle() : ToggleControl("Auto Git Pull at Boot", "If there is an update after booting, Git Pull is automatically executed and rebooted.", "", Params().getBool("GitPullOnBoot")) {
+  GitPullOnBootToggle() : ToggleControl("Auto Git Pull at Boot", "If there is an update after booting, Git Pull is automatically executed and rebooted.", "", ParamsCache().getBool("GitPullOnBoot")) {
     QObject::connect(this, &GitPullOnBootToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("GitPullOnBoot", status);
+      ParamsCache().putBool("GitPullOnBoot", status);
     });
   }
 };
@@ -537,10 +538,10 @@ class StoppingDistAdjToggle : public ToggleControl {
   Q_OBJECT
 
 public:
-  StoppingDistAdjToggle() : ToggleControl("Set Stopping Distance", "The car stops slightly ahead of the radar stopping distance. Some rattles may occur, so if you are uncomfortable, disable this feature.", "", Params().getBool("StoppingDistAdj")) {
+  StoppingDistAdjToggle() : ToggleControl("Set Stopping Distance", "The car stops slightly ahead of the radar stopping distance. Some rattles may occur, so if you are uncomfortable, disable this feature.", "", ParamsCache().getBool("StoppingDistAdj")) {
     QObject::connect(this, &StoppingDistAdjToggle::toggleFlipped, [=](int state) {
       bool status = state ? true : false;
-      Params().putBool("StoppingDistAdj", status);
+      ParamsCache().putBool("StoppingDistAdj", status);
     });
   }
 };
@@ -554,7 +555,7 @@ public:
 
 private:
   QPushButton btn;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -570,7 +571,7 @@ private:
   QPushButton btn;
   QString carname;
   QLabel carname_label;
-  Params params;
+  ParamsCache params;
   
   void refresh(QString carname);
 };
@@ -585,7 +586,7 @@ public:
 private:
   QPushButton btn;
   QComboBox combobox;
-  Params params;
+  ParamsCache params;
 
   void refresh();
 };
@@ -602,7 +603,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -617,7 +618,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -632,7 +633,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -647,7 +648,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   QSoundEffect effect;
   
   void refresh();
@@ -664,7 +665,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -679,7 +680,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -695,7 +696,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -709,7 +710,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -726,7 +727,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -741,7 +742,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -756,7 +757,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -771,7 +772,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -786,7 +787,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -800,7 +801,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -815,7 +816,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -830,7 +831,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -846,7 +847,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -861,7 +862,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -878,7 +879,7 @@ private:
   QPushButton btnplus;
   QPushButton btndirect;
   QLabel label;
-  Params params;
+  ParamsCache params;
   float digit = 0.01;
   
   void refresh();
@@ -894,7 +895,7 @@ private:
   QPushButton btnminus;
   QPushButton btnplus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   float digit = 0.01;
   
   void refresh();
@@ -910,7 +911,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -925,7 +926,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -940,7 +941,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -955,7 +956,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -970,7 +971,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -985,7 +986,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1000,7 +1001,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1015,7 +1016,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1030,7 +1031,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1045,7 +1046,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1060,7 +1061,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1077,7 +1078,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1092,7 +1093,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1107,7 +1108,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1122,7 +1123,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1137,7 +1138,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1152,7 +1153,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1167,7 +1168,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1182,7 +1183,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1197,7 +1198,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1212,7 +1213,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1227,7 +1228,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1242,7 +1243,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1257,7 +1258,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1272,7 +1273,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1287,7 +1288,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1302,7 +1303,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1317,7 +1318,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1332,7 +1333,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1347,7 +1348,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1362,7 +1363,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1377,7 +1378,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1391,7 +1392,7 @@ public:
 private:
   QLabel local_hash;
   QLabel remote_hash;
-  Params params;
+  ParamsCache params;
 };
 
 class RESChoice : public AbstractControl {
@@ -1404,7 +1405,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1419,7 +1420,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1434,7 +1435,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1449,7 +1450,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1464,7 +1465,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1479,7 +1480,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1503,7 +1504,7 @@ private:
   QLabel label2a;
   QLabel label3a;
   QLabel label4a;
-  Params params;
+  ParamsCache params;
   
   void refresh1();
   void refresh2();
@@ -1521,7 +1522,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1545,7 +1546,7 @@ private:
   QLabel label2a;
   QLabel label3a;
   QLabel label4a;
-  Params params;
+  ParamsCache params;
 
   void refresh1();
   void refresh2();
@@ -1562,7 +1563,7 @@ public:
 private:
   QPushButton btn;
   QPushButton btn2;
-  Params params;
+  ParamsCache params;
   
   void refresh();
   void refresh2();
@@ -1578,7 +1579,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1593,7 +1594,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1608,7 +1609,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
@@ -1623,7 +1624,7 @@ private:
   QPushButton btnplus;
   QPushButton btnminus;
   QLabel label;
-  Params params;
+  ParamsCache params;
   
   void refresh();
 };
\ No newline at end of file
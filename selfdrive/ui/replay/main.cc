@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/replay.h"
+
+ExitHandler do_exit;
+
+// usage: replay <route or segment directory> [--start seconds] [--speed x] [--block service,service...]
+// Commands on stdin, one per line:
+//   p           pause or resume
+//   s <seconds> seek to seconds from the start of the route, +<seconds> and -<seconds> relative
+//   x <speed>   play at speed times real time
+//   q           quit
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <route or segment directory> [--start seconds] [--speed x] [--block service,service...]\n", argv[0]);
+    return 1;
+  }
+
+  double start = 0;
+  float speed = 1;
+  std::set<std::string> block;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--start") == 0) {
+      start = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--speed") == 0) {
+      speed = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--block") == 0) {
+      std::stringstream ss(argv[i + 1]);
+      for (std::string s; std::getline(ss, s, ',');) block.insert(s);
+    }
+  }
+
+  Replay replay(argv[1], block);
+  replay.set_speed(speed);
+  if (!replay.start(start)) {
+    fprintf(stderr, "no segments with a log in %s\n", argv[1]);
+    return 1;
+  }
+  printf("replaying %zu segments of %s\n", replay.segments(), argv[1]);
+
+  // stdin blocks, the commands are read in their own thread
+  std::thread commands([&]() {
+    for (std::string line; !do_exit && std::getline(std::cin, line);) {
+      std::stringstream ss(line);
+      std::string cmd, arg;
+      ss >> cmd >> arg;
+      if (cmd == "p") {
+        replay.pause(!replay.paused());
+      } else if (cmd == "s" && !arg.empty()) {
+        const double t = atof(arg.c_str());
+        replay.seek(arg[0] == '+' || arg[0] == '-' ? replay.current_seconds() + t : t);
+      } else if (cmd == "x" && !arg.empty()) {
+        replay.set_speed(atof(arg.c_str()));
+      } else if (cmd == "q") {
+        do_exit = true;
+      }
+    }
+  });
+  commands.detach();
+
+  while (!do_exit) {
+    printf("\r%8.1f s %5.2fx%s%s   ", replay.current_seconds(), replay.speed(),
+           replay.paused() ? " paused" : "", replay.finished() ? " finished" : "");
+    fflush(stdout);
+    util::sleep_for(250);
+  }
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,292 @@
+#include "selfdrive/ui/replay/replay.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <capnp/schema.h>
+
+#include "libyuv.h"
+
+#include "cereal/services.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// as in camerad
+const int RGB_BUF_COUNT = 4;
+const int YUV_BUF_COUNT = 8;
+// decoded frames a camera thread keeps ahead of the replay
+const size_t FRAMES_AHEAD = 20;
+// loggerd segments are a minute long, a seek goes to the segment of that minute
+const double SEGMENT_SECONDS = 60;
+
+static std::string segment_log_path(const std::string &dir) {
+  for (const char *fn : {"rlog.bz2", "rlog.zst", "rlog"}) {
+    if (util::file_exists(dir + "/" + fn)) return dir + "/" + fn;
+  }
+  return "";
+}
+
+Replay::Replay(const std::string &route, const std::set<std::string> &block) {
+  if (!segment_log_path(route).empty()) {
+    segment_dirs.push_back(route);
+  } else {
+    for (int seg = 0; !segment_log_path(route + "--" + std::to_string(seg)).empty(); seg++) {
+      segment_dirs.push_back(route + "--" + std::to_string(seg));
+    }
+  }
+
+  // the union fields of Event that are services are published with their name
+  for (auto field : capnp::Schema::from<cereal::Event>().getUnionFields()) {
+    const uint16_t which = field.getProto().getDiscriminantValue();
+    const std::string name = field.getProto().getName();
+    auto it = std::find_if(std::begin(services), std::end(services), [&](const auto &s) { return name == s.name; });
+    if (it == std::end(services) || block.count(name)) continue;
+
+    if (which >= service_names.size()) service_names.resize(which + 1);
+    service_names[which] = name;
+  }
+  sockets.resize(service_names.size(), nullptr);
+}
+
+Replay::~Replay() {
+  {
+    std::unique_lock lk(lock);
+    exit = true;
+  }
+  cv.notify_all();
+  if (stream.joinable()) stream.join();
+  for (auto &cam : cameras) {
+    if (cam.thread.joinable()) {
+      cam.requests.push({.segment = SIZE_MAX});
+      cam.thread.join();
+    }
+  }
+  for (auto s : sockets) delete s;
+}
+
+bool Replay::start(double seconds) {
+  if (segment_dirs.empty()) return false;
+
+  // the size of every video is taken from its first file
+  for (auto &cam : cameras) {
+    std::vector<std::string> files;
+    for (auto &dir : segment_dirs) files.push_back(dir + "/" + cam.video);
+    auto it = std::find_if(files.begin(), files.end(), util::file_exists);
+    if (it == files.end()) continue;
+
+    cam.reader = std::make_unique<FrameReader>(files);
+    if (!cam.reader->seek(it - files.begin(), 0)) {
+      cam.reader.reset();
+      continue;
+    }
+    if (!vipc_server) vipc_server = std::make_unique<VisionIpcServer>("camerad");
+    vipc_server->create_buffers(cam.rgb_type, RGB_BUF_COUNT, true, cam.reader->width, cam.reader->height);
+    vipc_server->create_buffers(cam.yuv_type, YUV_BUF_COUNT, false, cam.reader->width, cam.reader->height);
+    LOGW("replaying %s, %dx%d", cam.video, cam.reader->width, cam.reader->height);
+  }
+  if (vipc_server) vipc_server->start_listener();
+  for (auto &cam : cameras) {
+    if (cam.reader) cam.thread = std::thread(&Replay::camera_thread, this, std::ref(cam));
+  }
+
+  ctx.reset(Context::create());
+  seek(seconds);
+  stream = std::thread(&Replay::stream_thread, this);
+  return true;
+}
+
+void Replay::seek(double seconds) {
+  {
+    std::unique_lock lk(lock);
+    seek_to = std::clamp(seconds, 0.0, segment_dirs.size() * SEGMENT_SECONDS);
+  }
+  cv.notify_all();
+}
+
+void Replay::pause(bool paused) {
+  {
+    std::unique_lock lk(lock);
+    paused_ = paused;
+    timing_changed = true;
+  }
+  cv.notify_all();
+}
+
+void Replay::set_speed(float speed) {
+  {
+    std::unique_lock lk(lock);
+    speed_ = std::max(speed, 0.01f);
+    timing_changed = true;
+  }
+  cv.notify_all();
+}
+
+// Keeps the log of a segment and the next one loaded, and waits for the one of segment
+std::shared_ptr<LogReader> Replay::segment_log(size_t segment) {
+  for (auto it = logs.begin(); it != logs.end();) {
+    it = (it->first == segment || it->first == segment + 1) ? std::next(it) : logs.erase(it);
+  }
+  for (size_t s : {segment, segment + 1}) {
+    if (s < segment_dirs.size() && logs.count(s) == 0) {
+      const std::string path = segment_log_path(segment_dirs[s]);
+      logs[s] = std::async(std::launch::async, [path]() {
+        auto log = std::make_shared<LogReader>();
+        if (!log->load(path)) LOGE("failed to load %s", path.c_str());
+        return log;
+      }).share();
+    }
+  }
+  return logs[segment].get();
+}
+
+void Replay::stream_thread() {
+  size_t segment = 0, idx = 0;
+  std::shared_ptr<LogReader> log;
+  uint64_t segment_start = 0;
+  // the event at mono_base is played at wall_base
+  uint64_t mono_base = 0, wall_base = 0;
+
+  while (true) {
+    double target = -1;
+    float speed = 1;
+    {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [&]() { return exit || seek_to >= 0 || (!paused_ && !finished_); });
+      if (exit) break;
+
+      std::swap(target, seek_to);
+      if (timing_changed) mono_base = 0;
+      timing_changed = false;
+      speed = speed_;
+    }
+
+    if (target >= 0) {
+      segment = std::min((size_t)(target / SEGMENT_SECONDS), segment_dirs.size() - 1);
+      log = segment_log(segment);
+      segment_start = log->events().empty() ? 0 : log->events()[0].mono_time;
+      idx = log->seek(segment_start + (target - segment * SEGMENT_SECONDS) * 1e9);
+      mono_base = 0;
+      finished_ = false;
+      LOGW("seeking to %.1f s, segment %zu", target, segment);
+      continue;
+    }
+
+    if (idx >= log->events().size()) {
+      if (segment + 1 >= segment_dirs.size()) {
+        LOGW("replay finished");
+        finished_ = true;
+        continue;
+      }
+      log = segment_log(++segment);
+      segment_start = log->events().empty() ? 0 : log->events()[0].mono_time;
+      idx = 0;
+      continue;
+    }
+
+    const LogReader::Event &e = log->events()[idx];
+    const uint64_t now = nanos_since_boot();
+    if (mono_base == 0) {
+      mono_base = e.mono_time;
+      wall_base = now;
+    }
+    const uint64_t due = wall_base + (e.mono_time > mono_base ? (e.mono_time - mono_base) / (double)speed : 0);
+    if (due > now) {
+      std::unique_lock lk(lock);
+      // woken early by a seek, pause or speed change
+      if (cv.wait_for(lk, std::chrono::nanoseconds(due - now), [&]() { return exit || seek_to >= 0 || timing_changed; })) continue;
+    }
+
+    publish(segment, e);
+    current_seconds_ = segment * SEGMENT_SECONDS + (e.mono_time - segment_start) * 1e-9;
+    idx++;
+  }
+}
+
+void Replay::publish(size_t segment, const LogReader::Event &e) {
+  const size_t which = (size_t)e.which;
+  if (which < service_names.size() && !service_names[which].empty()) {
+    if (sockets[which] == nullptr) {
+      sockets[which] = PubSocket::create(ctx.get(), service_names[which]);
+    }
+    if (sockets[which] != nullptr) {
+      sockets[which]->send((char *)e.data(), e.size());
+    }
+  }
+
+  for (auto &cam : cameras) {
+    if (e.which == cam.encode_idx && cam.reader) {
+      capnp::FlatArrayMessageReader msg(e.words);
+      cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+      auto idx = cam.encode_idx == cereal::Event::ROAD_ENCODE_IDX ? event.getRoadEncodeIdx() :
+                 cam.encode_idx == cereal::Event::DRIVER_ENCODE_IDX ? event.getDriverEncodeIdx() : event.getWideRoadEncodeIdx();
+      cam.requests.push({
+        .segment = segment,
+        .segment_id = idx.getSegmentId(),
+        .extra = {.frame_id = idx.getFrameId(), .timestamp_sof = idx.getTimestampSof(), .timestamp_eof = idx.getTimestampEof()},
+      });
+    }
+  }
+}
+
+// Serves the requested frames, and decodes ahead of them while there are none
+void Replay::camera_thread(Camera &cam) {
+  struct Decoded {
+    size_t segment, segment_id;
+    std::vector<uint8_t> yuv;
+  };
+  const size_t w = cam.reader->width, h = cam.reader->height;
+  std::deque<Decoded> ahead;
+  std::vector<std::vector<uint8_t>> free_bufs;
+  bool reader_done = false;
+
+  auto decode = [&]() {
+    std::vector<uint8_t> yuv;
+    if (!free_bufs.empty()) {
+      yuv = std::move(free_bufs.back());
+      free_bufs.pop_back();
+    }
+    yuv.resize(w * h * 3 / 2);
+    reader_done = !cam.reader->next_yuv(yuv.data(), yuv.data() + w * h, yuv.data() + w * h * 5 / 4);
+    if (!reader_done) ahead.push_back({cam.reader->last_file, cam.reader->last_frame, std::move(yuv)});
+  };
+  auto drop_front = [&]() {
+    free_bufs.push_back(std::move(ahead.front().yuv));
+    ahead.pop_front();
+  };
+
+  while (true) {
+    FrameRequest r;
+    if (!cam.requests.try_pop(r, 0)) {
+      if (ahead.size() < FRAMES_AHEAD && !reader_done) {
+        decode();
+        continue;
+      }
+      if (!cam.requests.try_pop(r, 50)) continue;
+    }
+    if (r.segment == SIZE_MAX) break;
+
+    auto before = [&](const Decoded &d) { return d.segment < r.segment || (d.segment == r.segment && d.segment_id < r.segment_id); };
+    while (!ahead.empty() && before(ahead.front())) drop_front();
+    if (ahead.empty() || ahead.front().segment != r.segment || ahead.front().segment_id != r.segment_id) {
+      // not in the frames decoded ahead, a seek or a missing frame
+      while (!ahead.empty()) drop_front();
+      reader_done = !cam.reader->seek(r.segment, r.segment_id);
+      if (!reader_done) decode();
+    }
+    if (ahead.empty() || before(ahead.front()) || ahead.front().segment_id != r.segment_id) {
+      LOGW_100("%s frame %zu of segment %zu not found", cam.video, r.segment_id, r.segment);
+      continue;
+    }
+
+    const uint8_t *y = ahead.front().yuv.data(), *u = y + w * h, *v = u + w * h / 4;
+    VisionBuf *yuv_buf = vipc_server->get_buffer(cam.yuv_type);
+    memcpy(yuv_buf->addr, y, w * h * 3 / 2);
+    VisionBuf *rgb_buf = vipc_server->get_buffer(cam.rgb_type);
+    libyuv::I420ToRGB24(y, w, u, w / 2, v, w / 2, (uint8_t *)rgb_buf->addr, rgb_buf->stride, w, h);
+    drop_front();
+
+    vipc_server->send(rgb_buf, &r.extra);
+    vipc_server->send(yuv_buf, &r.extra);
+  }
+}
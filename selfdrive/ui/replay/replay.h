@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/camerad/cameras/frame_reader.h"
+#include "selfdrive/common/queue.h"
+#include "selfdrive/loggerd/logreader.h"
+
+// Plays a route back into the running stack, in place of the car and camerad. The events of the
+// rlogs are published on msgq at their recorded relative times, at speed times real time, the log of
+// the next segment loads while one plays. The camera videos are decoded ahead in a thread per camera
+// and their frames are served through a VisionIpcServer when their encode index events are played.
+// The route is a segment directory or a route prefix, its segments are <route>--0, <route>--1, ...
+class Replay {
+ public:
+  // services in block are not published, e.g. the ones a daemon under test sends
+  Replay(const std::string &route, const std::set<std::string> &block = {});
+  ~Replay();
+
+  // Starts playing at seconds from the start of the route, false if it has no segments
+  bool start(double seconds = 0);
+  void seek(double seconds);
+  void pause(bool paused);
+  void set_speed(float speed);
+
+  bool paused() const { return paused_; }
+  float speed() const { return speed_; }
+  bool finished() const { return finished_; }
+  // seconds from the start of the route of the last event played
+  double current_seconds() const { return current_seconds_; }
+  size_t segments() const { return segment_dirs.size(); }
+
+ private:
+  struct FrameRequest {
+    size_t segment, segment_id;  // the video file and the frame in it
+    VisionIpcBufExtra extra;
+  };
+
+  struct Camera {
+    const char *video;
+    cereal::Event::Which encode_idx;
+    VisionStreamType rgb_type, yuv_type;
+    std::unique_ptr<FrameReader> reader;
+    SafeQueue<FrameRequest> requests;
+    std::thread thread;
+  };
+
+  std::shared_ptr<LogReader> segment_log(size_t segment);
+  void stream_thread();
+  void camera_thread(Camera &cam);
+  void publish(size_t segment, const LogReader::Event &e);
+
+  std::vector<std::string> segment_dirs;
+  std::atomic<bool> exit = false;
+
+  // the requested state, guarded by lock
+  std::mutex lock;
+  std::condition_variable cv;
+  double seek_to = -1;
+  bool timing_changed = false;
+  std::atomic<bool> paused_ = false, finished_ = false;
+  std::atomic<float> speed_ = 1.0;
+  std::atomic<double> current_seconds_ = 0;
+
+  // the stream thread's
+  std::map<size_t, std::shared_future<std::shared_ptr<LogReader>>> logs;
+  std::vector<std::string> service_names;  // by Event::Which, empty if it's not a service
+  std::vector<PubSocket *> sockets;
+  std::unique_ptr<Context> ctx;
+  std::thread stream;
+
+  Camera cameras[3] = {
+    {"fcamera.hevc", cereal::Event::ROAD_ENCODE_IDX, VISION_STREAM_RGB_BACK, VISION_STREAM_YUV_BACK},
+    {"dcamera.hevc", cereal::Event::DRIVER_ENCODE_IDX, VISION_STREAM_RGB_FRONT, VISION_STREAM_YUV_FRONT},
+    {"ecamera.hevc", cereal::Event::WIDE_ROAD_ENCODE_IDX, VISION_STREAM_RGB_WIDE, VISION_STREAM_YUV_WIDE},
+  };
+  std::unique_ptr<VisionIpcServer> vipc_server;
+};
@@ -1,13 +1,23 @@
 #include <sys/resource.h>
 
+#include <algorithm>
+#include <cstring>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include <QApplication>
+#include <QAudioDeviceInfo>
+#include <QAudioOutput>
+#include <QFile>
 #include <QString>
 #include <QSoundEffect>
+#include <QThread>
 #include <string>  //opkr
 
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/ui/ui.h"
@@ -16,6 +26,167 @@
 // TODO: detect when we can't play sounds
 // TODO: detect when we can't display the UI
 
+// the sounds are mixed as mono 16 bit pcm at this rate
+const int SAMPLE_RATE = 48000;
+// the period of the mixer, and how many of them the output buffers
+const int PERIOD_FRAMES = SAMPLE_RATE / 100;
+const int BUFFER_PERIODS = 2;
+// of the safety alerts, from the controlsState that set them to their first samples out of the buffer
+const double MAX_ONSET_MS = 40;
+
+static bool is_safety_alert(AudibleAlert alert) {
+  return alert == AudibleAlert::CHIME_WARNING1 || alert == AudibleAlert::CHIME_WARNING2 ||
+         alert == AudibleAlert::CHIME_WARNING2_REPEAT || alert == AudibleAlert::CHIME_WARNING_REPEAT ||
+         alert == AudibleAlert::CHIME_ERROR;
+}
+
+// 16 bit pcm wav, the channels averaged and resampled to SAMPLE_RATE
+static std::vector<int16_t> load_wav(const QString &fn) {
+  QFile f(fn);
+  if (!f.open(QIODevice::ReadOnly)) {
+    LOGE("can't open %s", qPrintable(fn));
+    return {};
+  }
+  const QByteArray d = f.readAll();
+  if (d.size() < 12 || memcmp(d.data(), "RIFF", 4) != 0 || memcmp(d.data() + 8, "WAVE", 4) != 0) {
+    LOGE("%s is not a wav", qPrintable(fn));
+    return {};
+  }
+
+  uint16_t format = 0, channels = 0, bits = 0;
+  uint32_t rate = 0;
+  const int16_t *samples = nullptr;
+  size_t num_samples = 0;
+  // the chunks, there can be others like LIST or JUNK around fmt and data
+  for (int i = 12; i + 8 <= d.size();) {
+    uint32_t size;
+    memcpy(&size, d.data() + i + 4, 4);
+    const char *chunk = d.data() + i + 8;
+    size = std::min<uint32_t>(size, d.size() - i - 8);
+    if (memcmp(d.data() + i, "fmt ", 4) == 0 && size >= 16) {
+      memcpy(&format, chunk, 2);
+      memcpy(&channels, chunk + 2, 2);
+      memcpy(&rate, chunk + 4, 4);
+      memcpy(&bits, chunk + 14, 2);
+    } else if (memcmp(d.data() + i, "data", 4) == 0) {
+      samples = (const int16_t *)chunk;
+      num_samples = size / sizeof(int16_t);
+    }
+    i += 8 + size + (size & 1);
+  }
+  if (format != 1 || bits != 16 || channels == 0 || rate == 0 || !samples) {
+    LOGE("%s: only 16 bit pcm is supported", qPrintable(fn));
+    return {};
+  }
+
+  const size_t frames = num_samples / channels;
+  std::vector<float> mono(frames);
+  for (size_t i = 0; i < frames; i++) {
+    float sum = 0;
+    for (int c = 0; c < channels; c++) sum += samples[i * channels + c];
+    mono[i] = sum / channels;
+  }
+
+  // linear, the sounds are chimes
+  const size_t out_frames = frames * SAMPLE_RATE / rate;
+  std::vector<int16_t> out(out_frames);
+  for (size_t i = 0; i < out_frames; i++) {
+    const double pos = (double)i * rate / SAMPLE_RATE;
+    const size_t j = pos;
+    const double t = pos - j;
+    const float next = j + 1 < frames ? mono[j + 1] : mono[j];
+    out[i] = std::clamp<float>(mono[j] * (1 - t) + next * t, INT16_MIN, INT16_MAX);
+  }
+  return out;
+}
+
+// Mixes the alert sounds, decoded once at startup, into a QAudioOutput on a thread of its own. The buffer
+// of the output is a few short periods, so a sound starts within them of play(), without the buffering
+// of QSoundEffect. Logs the onset of every sound, and a warning when a safety alert takes longer than MAX_ONSET_MS.
+class PcmMixer : public QIODevice {
+public:
+  PcmMixer(std::map<AudibleAlert, std::vector<int16_t>> pcm) : pcm(std::move(pcm)) {}
+
+  // in the audio thread
+  void start(const QAudioFormat &format) {
+    output = new QAudioOutput(format, this);
+    output->setBufferSize(PERIOD_FRAMES * BUFFER_PERIODS * sizeof(int16_t));
+    open(QIODevice::ReadOnly);
+    output->start(this);
+    LOGW("soundd mixer started with a buffer of %.1fms", bytes_to_ms(output->bufferSize()));
+  }
+
+  // from any thread
+  void play(AudibleAlert alert, bool loop, float volume) {
+    auto it = pcm.find(alert);
+    if (it == pcm.end() || it->second.empty()) return;
+
+    std::lock_guard lk(lock);
+    voices.push_back({alert, &it->second, 0, loop, volume, nanos_since_boot(), false});
+  }
+
+  void stopLooping() {
+    std::lock_guard lk(lock);
+    voices.erase(std::remove_if(voices.begin(), voices.end(), [](const Voice &v) { return v.loop; }), voices.end());
+  }
+
+protected:
+  qint64 readData(char *data, qint64 maxlen) override {
+    const int frames = maxlen / sizeof(int16_t);
+    // what the output still has to play before these
+    const double queued_ms = bytes_to_ms(output->bufferSize() - output->bytesFree());
+
+    mix.assign(frames, 0);
+    {
+      std::lock_guard lk(lock);
+      for (Voice &v : voices) {
+        if (!v.started) {
+          v.started = true;
+          const double onset_ms = (nanos_since_boot() - v.trigger_ns) / 1e6 + queued_ms;
+          if (is_safety_alert(v.alert) && onset_ms > MAX_ONSET_MS) {
+            LOGW("soundd onset of alert %d took %.1fms", (int)v.alert, onset_ms);
+          } else {
+            LOGD("soundd onset of alert %d %.1fms", (int)v.alert, onset_ms);
+          }
+        }
+        for (int i = 0; i < frames && v.pos < v.pcm->size(); i++) {
+          mix[i] += (*v.pcm)[v.pos++] * v.volume;
+          if (v.loop && v.pos == v.pcm->size()) v.pos = 0;
+        }
+      }
+      voices.erase(std::remove_if(voices.begin(), voices.end(), [](const Voice &v) { return v.pos >= v.pcm->size(); }), voices.end());
+    }
+
+    // silence between the sounds too, the output never goes idle
+    int16_t *out = (int16_t *)data;
+    for (int i = 0; i < frames; i++) {
+      out[i] = std::clamp<float>(mix[i], INT16_MIN, INT16_MAX);
+    }
+    return frames * sizeof(int16_t);
+  }
+
+  qint64 writeData(const char *data, qint64 len) override { return -1; }
+
+private:
+  static double bytes_to_ms(int bytes) { return bytes / sizeof(int16_t) * 1000.0 / SAMPLE_RATE; }
+
+  struct Voice {
+    AudibleAlert alert;
+    const std::vector<int16_t> *pcm;
+    size_t pos;
+    bool loop;
+    float volume;
+    uint64_t trigger_ns;
+    bool started;
+  };
+
+  const std::map<AudibleAlert, std::vector<int16_t>> pcm;
+  QAudioOutput *output = nullptr;
+  std::mutex lock;
+  std::vector<Voice> voices;
+  std::vector<float> mix;
+};
+
 class Sound : public QObject {
 public:
   explicit Sound(QObject *parent = 0) {
@@ -31,11 +202,36 @@ public:
       {AudibleAlert::CHIME_ERROR, sound_asset_path + "error.wav", false},
       {AudibleAlert::CHIME_PROMPT, sound_asset_path + "error.wav", false}
     };
-    for (auto &[alert, fn, loops] : sound_list) {
-      QSoundEffect *s = new QSoundEffect(this);
-      QObject::connect(s, &QSoundEffect::statusChanged, this, &Sound::checkStatus);
-      s->setSource(QUrl::fromLocalFile(fn));
-      sounds[alert] = {s, loops ? QSoundEffect::Infinite : 0};
+
+    QAudioFormat format;
+    format.setSampleRate(SAMPLE_RATE);
+    format.setChannelCount(1);
+    format.setSampleSize(16);
+    format.setCodec("audio/pcm");
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    format.setSampleType(QAudioFormat::SignedInt);
+
+    if (QAudioDeviceInfo::defaultOutputDevice().isFormatSupported(format)) {
+      std::map<AudibleAlert, std::vector<int16_t>> pcm;
+      for (auto &[alert, fn, loops] : sound_list) {
+        pcm[alert] = load_wav(fn);
+        loops_of[alert] = loops;
+      }
+
+      audio_thread = new QThread(this);
+      mixer = new PcmMixer(std::move(pcm));
+      mixer->moveToThread(audio_thread);
+      QObject::connect(audio_thread, &QThread::started, mixer, [=]() { mixer->start(format); });
+      QObject::connect(audio_thread, &QThread::finished, mixer, &QObject::deleteLater);
+      audio_thread->start(QThread::TimeCriticalPriority);
+    } else {
+      LOGW("soundd mixer format not supported, using QSoundEffect");
+      for (auto &[alert, fn, loops] : sound_list) {
+        QSoundEffect *s = new QSoundEffect(this);
+        QObject::connect(s, &QSoundEffect::statusChanged, this, &Sound::checkStatus);
+        s->setSource(QUrl::fromLocalFile(fn));
+        sounds[alert] = {s, loops ? QSoundEffect::Infinite : 0};
+      }
     }
 
     sm = new SubMaster({"carState", "controlsState"});
@@ -45,6 +241,10 @@ public:
     timer->start();
   };
   ~Sound() {
+    if (audio_thread) {
+      audio_thread->quit();
+      audio_thread->wait();
+    }
     delete sm;
   };
 
@@ -77,6 +277,9 @@ private slots:
     if (!alert.equal(a)) {
       alert = a;
       // stop sounds
+      if (mixer) {
+        mixer->stopLooping();
+      }
       for (auto &[s, loops] : sounds) {
         // Only stop repeating sounds
         if (s->loopsRemaining() == QSoundEffect::Infinite) {
@@ -86,16 +289,22 @@ private slots:
 
       // play sound
       if (alert.sound != AudibleAlert::NONE) {
-        auto &[s, loops] = sounds[alert.sound];
-        s->setLoopCount(loops);
-        if ((std::stof(Params().get("OpkrUIVolumeBoost")) * 0.01) < -0.03) {
-          s->setVolume(0.0);
-        } else if ((std::stof(Params().get("OpkrUIVolumeBoost")) * 0.01) > 0.03) {
-          s->setVolume(std::stof(Params().get("OpkrUIVolumeBoost")) * 0.01);
+        const float volume_boost = std::stof(Params().get("OpkrUIVolumeBoost")) * 0.01;
+        float alert_volume = volume;
+        if (volume_boost < -0.03) {
+          alert_volume = 0.0;
+        } else if (volume_boost > 0.03) {
+          alert_volume = volume_boost;
+        }
+
+        if (mixer) {
+          mixer->play(alert.sound, loops_of[alert.sound], alert_volume);
         } else {
-          s->setVolume(volume);
+          auto &[s, loops] = sounds[alert.sound];
+          s->setLoopCount(loops);
+          s->setVolume(alert_volume);
+          s->play();
         }
-        s->play();
       }
     }
   }
@@ -105,6 +314,11 @@ private:
   float volume = Hardware::MIN_VOLUME;
   QMap<AudibleAlert, QPair<QSoundEffect*, int>> sounds;
   SubMaster *sm;
+
+  // the mixer, when the output takes its format
+  QThread *audio_thread = nullptr;
+  PcmMixer *mixer = nullptr;
+  std::map<AudibleAlert, bool> loops_of;
 };
 
 int main(int argc, char **argv) {
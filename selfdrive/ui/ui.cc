@@ -4,16 +4,21 @@
 #include <string>  //opkr
 #include <iostream>
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdio>
 
+#include "selfdrive/common/calib_shm.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/common/visionimg.h"
 #include "selfdrive/common/watchdog.h"
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/ui/paint.h"
+#include "selfdrive/ui/qt/frame_profiler.h"
+#include "selfdrive/ui/qt/params_cache.h"
 #include "selfdrive/ui/qt/qt_window.h"
 
 #define BACKLIGHT_DT 0.05
@@ -21,99 +26,108 @@
 #define BACKLIGHT_OFFROAD 75
 
 
-// Projects a point in car to space to the corresponding point in full frame
-// image space.
-static bool calib_frame_to_full_frame(const UIState *s, float in_x, float in_y, float in_z, vertex_data *out) {
-  const float margin = 500.0f;
-  const vec3 pt = (vec3){{in_x, in_y, in_z}};
-  const vec3 Ep = matvecmul3(s->scene.view_from_calib, pt);
-  const vec3 KEp = matvecmul3(s->wide_camera ? ecam_intrinsic_matrix : fcam_intrinsic_matrix, Ep);
-
-  // Project.
-  float x = KEp.v[0] / KEp.v[2];
-  float y = KEp.v[1] / KEp.v[2];
+// points in car space, every coordinate in an array of its own for matvecmul3_project
+struct CalibPoints {
+  float x[TRAJECTORY_SIZE * 2], y[TRAJECTORY_SIZE * 2], z[TRAJECTORY_SIZE * 2];
+  int n;
+};
 
-  nvgTransformPoint(&out->x, &out->y, s->car_space_transform, x, y);
-  return out->x >= -margin && out->x <= s->fb_w + margin && out->y >= -margin && out->y <= s->fb_h + margin;
+// Projects points in car space to the corresponding points in full frame image space. The camera
+// matrix, the calibration and the car space transform of nanovg are one matrix, the points are
+// projected with one matvecmul3_project. Only the ones near the frame are written to out, returns
+// their number.
+static int calib_frame_to_full_frame(const UIState *s, const CalibPoints &pts, vertex_data *out) {
+  const float margin = 500.0f;
+  const mat3 &K = s->wide_camera ? ecam_intrinsic_matrix : fcam_intrinsic_matrix;
+  // the 2x3 affine of nanovg, column major
+  const float *t = s->car_space_transform;
+  const mat3 car_space = {{
+    t[0], t[2], t[4],
+    t[1], t[3], t[5],
+    0.0f, 0.0f, 1.0f,
+  }};
+  const mat3 transform = matmul3(car_space, matmul3(K, s->scene.view_from_calib));
+
+  float px[TRAJECTORY_SIZE * 2], py[TRAJECTORY_SIZE * 2];
+  matvecmul3_project(transform, pts.x, pts.y, pts.z, pts.n, px, py);
+
+  int n = 0;
+  for (int i = 0; i < pts.n; i++) {
+    out[n] = {px[i], py[i]};
+    n += px[i] >= -margin && px[i] <= s->fb_w + margin && py[i] >= -margin && py[i] <= s->fb_h + margin;
+  }
+  return n;
 }
 
-static void ui_init_vision(UIState *s) {
-  // Invisible until we receive a calibration message.
-  s->scene.world_objects_visible = false;
+// the points of a line of modelV2Compact
+struct ModelLine {
+  float x[TRAJECTORY_SIZE] = {}, y[TRAJECTORY_SIZE] = {}, z[TRAJECTORY_SIZE] = {};
 
-  for (int i = 0; i < s->vipc_client->num_buffers; i++) {
-    s->texture[i].reset(new EGLImageTexture(&s->vipc_client->buffers[i]));
-
-    glBindTexture(GL_TEXTURE_2D, s->texture[i]->frame_tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // BGR
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_BLUE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_GREEN);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+  explicit ModelLine(const cereal::ModelDataV2Compact::QuantizedXYZ::Reader &q) {
+    const auto qx = q.getX(), qy = q.getY(), qz = q.getZ();
+    for (int i = 0; i < std::min<int>({TRAJECTORY_SIZE, qx.size(), qy.size(), qz.size()}); i++) {
+      x[i] = qx[i] * q.getXScale();
+      y[i] = qy[i] * q.getYScale();
+      z[i] = qz[i] * q.getZScale();
+    }
   }
-  assert(glGetError() == GL_NO_ERROR);
-}
+};
 
-static int get_path_length_idx(const cereal::ModelDataV2::XYZTData::Reader &line, const float path_height) {
-  const auto line_x = line.getX();
+static int get_path_length_idx(const ModelLine &line, const float path_height) {
   int max_idx = 0;
-  for (int i = 0; i < TRAJECTORY_SIZE && line_x[i] < path_height; ++i) {
+  for (int i = 0; i < TRAJECTORY_SIZE && line.x[i] < path_height; ++i) {
     max_idx = i;
   }
   return max_idx;
 }
 
-static void update_leads(UIState *s, const cereal::RadarState::Reader &radar_state, std::optional<cereal::ModelDataV2::XYZTData::Reader> line) {
+// the leads of radarState, and the first one again when it is a radar track
+static void update_leads(UIState *s, const cereal::RadarState::Reader &radar_state, std::optional<ModelLine> line) {
+  UIScene &scene = s->scene;
   for (int i = 0; i < 2; ++i) {
     auto lead_data = (i == 0) ? radar_state.getLeadOne() : radar_state.getLeadTwo();
     if (lead_data.getStatus()) {
-      float z = line ? (*line).getZ()[get_path_length_idx(*line, lead_data.getDRel())] : 0.0;
+      float z = line ? line->z[get_path_length_idx(*line, lead_data.getDRel())] : 0.0;
       // negative because radarState uses left positive convention
-      calib_frame_to_full_frame(s, lead_data.getDRel(), -lead_data.getYRel(), z + 1.22, &s->scene.lead_vertices[i]);
+      CalibPoints pt = {.x = {lead_data.getDRel()}, .y = {-lead_data.getYRel()}, .z = {z + 1.22f}, .n = 1};
+      calib_frame_to_full_frame(s, pt, &scene.lead_vertices[i]);
+      if (i == 0 && lead_data.getRadar()) {
+        scene.lead_vertices_radar[0] = scene.lead_vertices[0];
+      }
     }
-    s->scene.lead_data[i] = lead_data;
+    scene.lead_data[i] = lead_data;
   }
 }
 
-static void update_leads_radar(UIState *s, const cereal::RadarState::Reader &radar_state, std::optional<cereal::ModelDataV2::XYZTData::Reader> line) {
-  auto lead_data = radar_state.getLeadOne();
-    if (lead_data.getStatus() && lead_data.getRadar()) {
-      float z = line ? (*line).getZ()[get_path_length_idx(*line, lead_data.getDRel())] : 0.0;
-      // negative because radarState uses left positive convention
-      calib_frame_to_full_frame(s, lead_data.getDRel(), -lead_data.getYRel(), z + 1.22, &s->scene.lead_vertices_radar[0]);
-    }
-}
-
-static void update_line_data(const UIState *s, const cereal::ModelDataV2::XYZTData::Reader &line,
+static void update_line_data(const UIState *s, const ModelLine &line,
                              float y_off, float z_off, line_vertices_data *pvd, int max_idx) {
-  const auto line_x = line.getX(), line_y = line.getY(), line_z = line.getZ();
-  vertex_data *v = &pvd->v[0];
-  for (int i = 0; i <= max_idx; i++) {
-    v += calib_frame_to_full_frame(s, line_x[i], line_y[i] - y_off, line_z[i] + z_off, v);
-  }
-  for (int i = max_idx; i >= 0; i--) {
-    v += calib_frame_to_full_frame(s, line_x[i], line_y[i] + y_off, line_z[i] + z_off, v);
-  }
-  pvd->cnt = v - pvd->v;
+  const int n = max_idx + 1;
+  CalibPoints pts;
+  pts.n = 2 * n;
+  for (int i = 0; i < n; i++) {
+    pts.x[i] = line.x[i];
+    pts.y[i] = line.y[i] - y_off;
+    pts.z[i] = line.z[i] + z_off;
+    pts.x[2 * n - 1 - i] = line.x[i];
+    pts.y[2 * n - 1 - i] = line.y[i] + y_off;
+    pts.z[2 * n - 1 - i] = line.z[i] + z_off;
+  }
+  pvd->cnt = calib_frame_to_full_frame(s, pts, pvd->v);
   assert(pvd->cnt <= std::size(pvd->v));
 }
 
-static void update_model(UIState *s, const cereal::ModelDataV2::Reader &model) {
-  SubMaster &sm = *(s->sm);
+static void update_lines(UIState *s, const cereal::ModelDataV2Compact::Reader &model) {
   UIScene &scene = s->scene;
-  auto model_position = model.getPosition();
-  float max_distance = std::clamp(model_position.getX()[TRAJECTORY_SIZE - 1],
+  float max_distance = std::clamp(ModelLine(model.getPosition()).x[TRAJECTORY_SIZE - 1],
                                   MIN_DRAW_DISTANCE, MAX_DRAW_DISTANCE);
 
   // update lane lines
   const auto lane_lines = model.getLaneLines();
   const auto lane_line_probs = model.getLaneLineProbs();
-  int max_idx = get_path_length_idx(lane_lines[0], max_distance);
+  int max_idx = get_path_length_idx(ModelLine(lane_lines[0]), max_distance);
   for (int i = 0; i < std::size(scene.lane_line_vertices); i++) {
     scene.lane_line_probs[i] = lane_line_probs[i];
-    update_line_data(s, lane_lines[i], 0.025 * scene.lane_line_probs[i], 0, &scene.lane_line_vertices[i], max_idx);
+    update_line_data(s, ModelLine(lane_lines[i]), 0.025 * scene.lane_line_probs[i], 0, &scene.lane_line_vertices[i], max_idx);
   }
 
   // update road edges
@@ -121,18 +135,30 @@ static void update_model(UIState *s, const cereal::ModelDataV2::Reader &model) {
   const auto road_edge_stds = model.getRoadEdgeStds();
   for (int i = 0; i < std::size(scene.road_edge_vertices); i++) {
     scene.road_edge_stds[i] = road_edge_stds[i];
-    update_line_data(s, road_edges[i], 0.025, 0, &scene.road_edge_vertices[i], max_idx);
+    update_line_data(s, ModelLine(road_edges[i]), 0.025, 0, &scene.road_edge_vertices[i], max_idx);
   }
+}
 
-  scene.lateral_plan = sm["lateralPlan"].getLateralPlan();
-  // update path
-  auto lead_one = (*s->sm)["radarState"].getRadarState().getLeadOne();
+// the path, up to the lead
+static void update_track(UIState *s, const cereal::ModelDataV2Compact::Reader &model, const cereal::RadarState::Reader &radar_state) {
+  const ModelLine model_position(model.getPosition());
+  float max_distance = std::clamp(model_position.x[TRAJECTORY_SIZE - 1],
+                                  MIN_DRAW_DISTANCE, MAX_DRAW_DISTANCE);
+  auto lead_one = radar_state.getLeadOne();
   if (lead_one.getStatus()) {
     const float lead_d = lead_one.getDRel() * 2.;
     max_distance = std::clamp((float)(lead_d - fmin(lead_d * 0.35, 10.)), 0.0f, max_distance);
   }
-  max_idx = get_path_length_idx(model_position, max_distance);
-  update_line_data(s, model_position, 0.25, 1.22, &scene.track_vertices, max_idx);
+  int max_idx = get_path_length_idx(model_position, max_distance);
+  update_line_data(s, model_position, 0.25, 1.22, &s->scene.track_vertices, max_idx);
+}
+
+// True once after each new message of the topic, frame is what the derived values were last made of
+static bool topic_changed(const SubMaster &sm, const char *name, uint64_t &frame) {
+  const uint64_t rcv_frame = sm.rcv_frame(name);
+  if (rcv_frame == frame) return false;
+  frame = rcv_frame;
+  return true;
 }
 
 static void update_sockets(UIState *s) {
@@ -143,14 +169,12 @@ static void update_state(UIState *s) {
   SubMaster &sm = *(s->sm);
   UIScene &scene = s->scene;
 
-  // update engageability and DM icons at 2Hz
-  if (sm.frame % (UI_FREQ / 2) == 0) {
-    scene.engageable = sm["controlsState"].getControlsState().getEngageable();
+  if (sm.updated("driverMonitoringState")) {
     scene.dm_active = sm["driverMonitoringState"].getDriverMonitoringState().getIsActiveMode();
   }
-
   if (sm.updated("controlsState")) {
     scene.controls_state = sm["controlsState"].getControlsState();
+    scene.engageable = scene.controls_state.getEngageable();
     scene.lateralControlMethod = scene.controls_state.getLateralControlMethod();
     if (scene.lateralControlMethod == 0) {
       scene.output_scale = scene.controls_state.getLateralControlState().getPidState().getOutput();
@@ -206,14 +230,21 @@ static void update_state(UIState *s) {
     scene.liveParams.stiffnessFactor = live_data.getStiffnessFactor();
     scene.liveParams.steerRatio = live_data.getSteerRatio();
   }
-  if (sm.updated("radarState") && s->vg) {
-    std::optional<cereal::ModelDataV2::XYZTData::Reader> line;
-    if (sm.rcv_frame("modelV2") > 0) {
-      line = sm["modelV2"].getModelV2().getPosition();
+  // the transform modeld derived from liveCalibration, decoded here only without modeld, like in a replay
+  static CalibShm calib_shm;
+  static uint32_t calib_seq = 0;
+  CalibTransform calib;
+  uint32_t seq;
+  bool calib_changed = false;
+  if (calib_shm.read(calib, &seq)) {
+    if (seq != calib_seq) {
+      calib_seq = seq;
+      calib_changed = true;
+      scene.world_objects_visible = true;
+      scene.view_from_calib = calib.view_from_calib;
     }
-    update_leads(s, sm["radarState"].getRadarState(), line);
-  }
-  if (sm.updated("liveCalibration")) {
+  } else if (sm.updated("liveCalibration")) {
+    calib_changed = true;
     scene.world_objects_visible = true;
     auto rpy_list = sm["liveCalibration"].getLiveCalibration().getRpyCalib();
     Eigen::Vector3d rpy;
@@ -230,8 +261,24 @@ static void update_state(UIState *s) {
       }
     }
   }
-  if (sm.updated("modelV2") && s->vg) {
-    update_model(s, sm["modelV2"].getModelV2());
+  // the vertices, made again only of a new model, lead or calibration
+  if (s->vg) {
+    const bool model_changed = topic_changed(sm, "modelV2Compact", scene.model_rcv_frame);
+    const bool radar_changed = topic_changed(sm, "radarState", scene.radar_rcv_frame);
+    const bool has_model = sm.rcv_frame("modelV2Compact") > 0;
+    if (has_model && (model_changed || calib_changed)) {
+      update_lines(s, sm["modelV2Compact"].getModelV2Compact());
+    }
+    if (has_model && (model_changed || radar_changed || calib_changed)) {
+      update_track(s, sm["modelV2Compact"].getModelV2Compact(), sm["radarState"].getRadarState());
+    }
+    if (sm.rcv_frame("radarState") > 0 && (radar_changed || calib_changed)) {
+      std::optional<ModelLine> line;
+      if (has_model) {
+        line.emplace(sm["modelV2Compact"].getModelV2Compact().getPosition());
+      }
+      update_leads(s, sm["radarState"].getRadarState(), line);
+    }
   }
   if (sm.updated("deviceState")) {
     scene.deviceState = sm["deviceState"].getDeviceState();
@@ -263,13 +310,6 @@ static void update_state(UIState *s) {
     scene.altitudeUblox = ge_data.getAltitude();
     scene.bearingUblox = ge_data.getBearingDeg();
   }
-  if (sm.updated("radarState") && s->vg) {
-    std::optional<cereal::ModelDataV2::XYZTData::Reader> line;
-    if (sm.rcv_frame("modelV2") > 0) {
-      line = sm["modelV2"].getModelV2().getPosition();
-    }
-    update_leads_radar(s, sm["radarState"].getRadarState(), line);
-  }  
   if (sm.updated("carParams")) {
     scene.longitudinal_control = sm["carParams"].getCarParams().getOpenpilotLongitudinalControl();
     scene.steerMax_V = sm["carParams"].getCarParams().getSteerMaxV()[0];
@@ -337,7 +377,7 @@ static void update_state(UIState *s) {
 static void update_params(UIState *s) {
   const uint64_t frame = s->sm->frame;
   UIScene &scene = s->scene;
-  Params params;
+  ParamsCache params;
   if (frame % (5*UI_FREQ) == 0) {
     scene.is_metric = params.getBool("IsMetric");
     scene.is_OpenpilotViewEnabled = params.getBool("IsOpenpilotViewEnabled");
@@ -426,25 +466,6 @@ static void update_params(UIState *s) {
   }
 }
 
-static void update_vision(UIState *s) {
-  if (!s->vipc_client->connected && s->scene.started) {
-    if (s->vipc_client->connect(false)) {
-      ui_init_vision(s);
-    }
-  }
-
-  if (s->vipc_client->connected) {
-    VisionBuf * buf = s->vipc_client->recv();
-    if (buf != nullptr) {
-      s->last_frame = buf;
-    } else if (!Hardware::PC()) {
-      LOGE("visionIPC receive timeout");
-    }
-  } else if (s->scene.started) {
-    util::sleep_for(1000. / UI_FREQ);
-  }
-}
-
 static void update_status(UIState *s) {
   if (s->scene.started && s->sm->updated("controlsState")) {
     auto controls_state = (*s->sm)["controlsState"].getControlsState();
@@ -469,7 +490,7 @@ static void update_status(UIState *s) {
       s->status = STATUS_DISENGAGED;
       s->scene.started_frame = s->sm->frame;
 
-      s->wide_camera = Hardware::TICI() ? Params().getBool("EnableWideCamera") : false;
+      s->wide_camera = Hardware::TICI() ? ParamsCache().getBool("EnableWideCamera") : false;
 
       // Update intrinsics matrix after possible wide camera toggle change
       if (s->vg) {
@@ -477,22 +498,29 @@ static void update_status(UIState *s) {
       }
 
       // Choose vision ipc client
-      if (s->wide_camera) {
-        s->vipc_client = s->vipc_client_wide;
-      } else {
-        s->vipc_client = s->vipc_client_rear;
-      }
+      s->vision = s->wide_camera ? s->vision_wide : s->vision_rear;
+      s->vision->start();
     } else {
-      s->vipc_client->connected = false;
+      s->vision->stop();
+      s->vision_connected = false;
+      s->last_frame = nullptr;
     }
   }
   started_prev = s->scene.started;
 }
 
 
+void ui_update_state(UIState *s) {
+  {
+    FrameProfiler::Scope scope("update_state");
+    update_state(s);
+  }
+  update_status(s);
+}
+
 QUIState::QUIState(QObject *parent) : QObject(parent) {
   ui_state.sm = std::make_unique<SubMaster, const std::initializer_list<const char *>>({
-    "modelV2", "controlsState", "liveCalibration", "radarState", "deviceState", "roadCameraState",
+    "modelV2Compact", "controlsState", "liveCalibration", "radarState", "deviceState", "roadCameraState",
     "pandaState", "carParams", "driverMonitoringState", "sensorEvents", "carState", "liveLocationKalman",
     "ubloxGnss", "gpsLocationExternal", "radarState", "liveParameters", "lateralPlan", "liveMapData",
   });
@@ -501,42 +529,65 @@ QUIState::QUIState(QObject *parent) : QObject(parent) {
   ui_state.fb_h = vwp_h;
   ui_state.scene.started = false;
   ui_state.last_frame = nullptr;
+  ui_state.vision_connected = false;
   ui_state.wide_camera = Hardware::TICI() ? Params().getBool("EnableWideCamera") : false;
   ui_state.sidebar_view = false;
 
-  ui_state.vipc_client_rear = new VisionIpcClient("camerad", VISION_STREAM_RGB_BACK, true);
-  ui_state.vipc_client_wide = new VisionIpcClient("camerad", VISION_STREAM_RGB_WIDE, true);
-
-  ui_state.vipc_client = ui_state.vipc_client_rear;
+  ui_state.vision_rear = new VisionReceiver("camerad", VISION_STREAM_RGB_BACK, this);
+  ui_state.vision_wide = new VisionReceiver("camerad", VISION_STREAM_RGB_WIDE, this);
+  ui_state.vision = ui_state.vision_rear;
+  for (VisionReceiver *v : {ui_state.vision_rear, ui_state.vision_wide}) {
+    QObject::connect(v, &VisionReceiver::connected, this, &QUIState::visionConnected);
+    QObject::connect(v, &VisionReceiver::disconnected, this, &QUIState::visionDisconnected);
+  }
 
-  // update timer
+  // update timer, the frames of the road camera trigger their paints themselves
   timer = new QTimer(this);
   QObject::connect(timer, &QTimer::timeout, this, &QUIState::update);
-  timer->start(0);
+  timer->start(1000 / UI_FREQ);
 
   ui_state.lock_on_anim_index = 0;
 }
 
 void QUIState::update() {
-  update_params(&ui_state);
-  update_sockets(&ui_state);
-  update_state(&ui_state);
-  update_status(&ui_state);
-  update_vision(&ui_state);
+  const double cpu_start = millis_thread_cpu();
+  FrameProfiler::Scope scope("QUIState::update");
+  {
+    FrameProfiler::Scope scope("update_params");
+    update_params(&ui_state);
+  }
+  {
+    FrameProfiler::Scope scope("update_sockets");
+    update_sockets(&ui_state);
+  }
+  ui_update_state(&ui_state);
 
   if (ui_state.scene.started != started_prev || ui_state.sm->frame == 1) {
     started_prev = ui_state.scene.started;
     emit offroadTransition(!ui_state.scene.started);
-
-    // Change timeout to 0 when onroad, this will call update continuously.
-    // This puts visionIPC in charge of update frequency, reducing video latency
-    timer->start(ui_state.scene.started ? 0 : 1000 / UI_FREQ);
   }
 
   watchdog_kick();
+  ui_state.update_cpu_ms = millis_thread_cpu() - cpu_start;
   emit uiUpdate(ui_state);
 }
 
+void QUIState::visionConnected() {
+  // queued from the receiver thread, it may have stopped since
+  if (!ui_state.vision->isRunning()) return;
+
+  // Invisible until we receive a calibration message.
+  ui_state.scene.world_objects_visible = false;
+  ui_state.vision_connected = true;
+  ui_state.vision_textures_stale = true;
+  ui_state.last_frame = nullptr;
+}
+
+void QUIState::visionDisconnected() {
+  ui_state.vision_connected = false;
+  ui_state.last_frame = nullptr;
+}
+
 Device::Device(QObject *parent) : brightness_filter(BACKLIGHT_OFFROAD, BACKLIGHT_TS, BACKLIGHT_DT), QObject(parent) {
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <map>
 #include <memory>
@@ -23,6 +24,7 @@
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/common/visionimg.h"
+#include "selfdrive/ui/qt/vision_receiver.h"
 
 #define UI_FEATURE_BRAKE 1
 #define UI_FEATURE_AUTOHOLD 1
@@ -238,7 +240,10 @@ typedef struct UIScene {
   int satelliteCount;
   float gpsAccuracy;
 
-  // modelV2
+  // the rcv_frames of the messages the vertices were made of
+  uint64_t model_rcv_frame, radar_rcv_frame;
+
+  // modelV2Compact
   float lane_line_probs[4];
   float road_edge_stds[2];
   line_vertices_data track_vertices;
@@ -290,20 +295,47 @@ typedef struct UIScene {
   } liveMapData;
 } UIScene;
 
+struct NVGLUframebuffer;
+struct TextCache;
+
+// the fonts of ui_nvg_init, by their nanovg ids in UIState
+typedef enum UIFont {
+  FONT_SANS_REGULAR,
+  FONT_SANS_SEMIBOLD,
+  FONT_SANS_BOLD,
+  FONT_COUNT,
+} UIFont;
+
+// the values the cached hud layer of paint.cc shows, it's drawn again when they change
+const int HUD_KEY_SIZE = 19;
+typedef std::array<double, HUD_KEY_SIZE> HudKey;
+
 typedef struct UIState {
-  VisionIpcClient * vipc_client;
-  VisionIpcClient * vipc_client_rear;
-  VisionIpcClient * vipc_client_wide;
+  // the road camera, rear or wide
+  VisionReceiver * vision;
+  VisionReceiver * vision_rear;
+  VisionReceiver * vision_wide;
+  bool vision_connected;
+  // the textures are made of the buffers of the next paint
+  bool vision_textures_stale;
   VisionBuf * last_frame;
+  bool last_frame_uploaded;
+  // of last_frame, boot time ns, and if it's drawn since the last swap that was presented
+  uint64_t last_frame_eof = 0;
+  bool last_frame_presented = true;
 
-  // framebuffer
+  // framebuffer, and where the view is in it with the border of the direct render
   int fb_w, fb_h;
+  int fb_x = 0, fb_y = 0;
 
   // NVG
   NVGcontext *vg;
 
   // images
   std::map<std::string, int> images;
+  int fonts[FONT_COUNT];
+  // the texts paint.cc draws as quads of an atlas
+  TextCache *text_cache;
 
   std::unique_ptr<SubMaster> sm;
 
@@ -317,6 +349,11 @@ typedef struct UIState {
   GLuint frame_vao, frame_vbo, frame_ibo;
   mat4 rear_frame_mat;
 
+  // the slow changing parts of the hud
+  NVGLUframebuffer *hud_fb;
+  int hud_fb_w, hud_fb_h;
+  HudKey hud_key;
+
   bool awake;
   bool sidebar_view;
 
@@ -325,8 +362,13 @@ typedef struct UIState {
 
   int lock_on_anim_index;
 
+  // cpu time of the last update of the state and of the last paint of the onroad view
+  float update_cpu_ms, draw_cpu_ms;
+
 } UIState;
 
+// The scene and the status from what the SubMaster of s has after its update, by QUIState and ui_bench
+void ui_update_state(UIState *s);
 
 class QUIState : public QObject {
   Q_OBJECT
@@ -343,6 +385,8 @@ signals:
 
 private slots:
   void update();
+  void visionConnected();
+  void visionDisconnected();
 
 private:
   QTimer *timer;
@@ -0,0 +1,285 @@
+#include <bzlib.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GLES3/gl3.h>
+
+#include <capnp/dynamic.h>
+#include <QApplication>
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+
+#include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/hardware/hw.h"
+#include "selfdrive/ui/paint.h"
+#include "selfdrive/ui/qt/qt_window.h"
+#include "selfdrive/ui/qt/util.h"
+#include "selfdrive/ui/ui.h"
+
+// Draws the onroad view offscreen from the messages of an rlog, without a device or camerad. Every
+// modelV2Compact ends a frame: the messages since the previous one go to the SubMaster with update_msgs,
+// ui_update_state makes the scene and ui_draw renders it into a framebuffer, with a static road camera
+// frame sent through a VisionIpcServer like camerad does. The params of the ui aren't read, the options
+// of the scene are their defaults. Prints the p50, p90 and p99 of the frame times, of ui_draw and with
+// glFinish, and the GL calls of ui_draw per frame, so changes of paint.cc can be compared.
+// Run from selfdrive/ui for the assets, with a GL platform like QT_QPA_PLATFORM=offscreen on mesa
+// usage: ui_bench <rlog or rlog.bz2> [--frames N] [--image camera.png] [--save last_frame.png]
+
+static uint64_t gl_calls = 0, gl_draws = 0;
+
+// The GL calls of paint.cc and nanovg, that are built into this binary, resolve to these. Those of Qt
+// go through the functions it resolved itself, and aren't counted
+#define COUNT_GL(name, params, args, count)                                  \
+  extern "C" void GL_APIENTRY name params {                                  \
+    static auto real = (void (GL_APIENTRY *) params)dlsym(RTLD_NEXT, #name); \
+    count;                                                                   \
+    real args;                                                               \
+  }
+
+COUNT_GL(glDrawArrays, (GLenum mode, GLint first, GLsizei count), (mode, first, count), (gl_calls++, gl_draws++))
+COUNT_GL(glDrawElements, (GLenum mode, GLsizei count, GLenum type, const void *indices), (mode, count, type, indices), (gl_calls++, gl_draws++))
+COUNT_GL(glUseProgram, (GLuint program), (program), gl_calls++)
+COUNT_GL(glActiveTexture, (GLenum texture), (texture), gl_calls++)
+COUNT_GL(glBindTexture, (GLenum target, GLuint texture), (target, texture), gl_calls++)
+COUNT_GL(glBindBuffer, (GLenum target, GLuint buffer), (target, buffer), gl_calls++)
+COUNT_GL(glBindBufferRange, (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size), (target, index, buffer, offset, size), gl_calls++)
+COUNT_GL(glBindVertexArray, (GLuint array), (array), gl_calls++)
+COUNT_GL(glBindFramebuffer, (GLenum target, GLuint framebuffer), (target, framebuffer), gl_calls++)
+COUNT_GL(glBufferData, (GLenum target, GLsizeiptr size, const void *data, GLenum usage), (target, size, data, usage), gl_calls++)
+COUNT_GL(glTexImage2D, (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels),
+         (target, level, internalformat, width, height, border, format, type, pixels), gl_calls++)
+COUNT_GL(glTexSubImage2D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels),
+         (target, level, xoffset, yoffset, width, height, format, type, pixels), gl_calls++)
+COUNT_GL(glUniform1i, (GLint location, GLint v0), (location, v0), gl_calls++)
+COUNT_GL(glUniform4fv, (GLint location, GLsizei count, const GLfloat *value), (location, count, value), gl_calls++)
+COUNT_GL(glUniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat *value), (location, count, transpose, value), gl_calls++)
+COUNT_GL(glEnable, (GLenum cap), (cap), gl_calls++)
+COUNT_GL(glDisable, (GLenum cap), (cap), gl_calls++)
+COUNT_GL(glBlendFuncSeparate, (GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha), (sfactorRGB, dfactorRGB, sfactorAlpha, dfactorAlpha), gl_calls++)
+COUNT_GL(glStencilFunc, (GLenum func, GLint ref, GLuint mask), (func, ref, mask), gl_calls++)
+COUNT_GL(glStencilOp, (GLenum fail, GLenum zfail, GLenum zpass), (fail, zfail, zpass), gl_calls++)
+COUNT_GL(glStencilOpSeparate, (GLenum face, GLenum sfail, GLenum dpfail, GLenum dppass), (face, sfail, dpfail, dppass), gl_calls++)
+COUNT_GL(glStencilMask, (GLuint mask), (mask), gl_calls++)
+COUNT_GL(glColorMask, (GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha), (red, green, blue, alpha), gl_calls++)
+
+static std::string read_log(const char *fn) {
+  std::ifstream f(fn, std::ios::binary);
+  std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  if (raw.size() < 3 || raw.compare(0, 3, "BZh") != 0) return raw;
+
+  std::string out;
+  bz_stream strm = {};
+  BZ2_bzDecompressInit(&strm, 0, 0);
+  strm.next_in = raw.data();
+  strm.avail_in = raw.size();
+  int ret = BZ_OK;
+  char buf[1 << 16];
+  while (ret == BZ_OK) {
+    strm.next_out = buf;
+    strm.avail_out = sizeof(buf);
+    ret = BZ2_bzDecompress(&strm);
+    out.append(buf, sizeof(buf) - strm.avail_out);
+    // concatenated streams, rlogs are written in parallel blocks
+    if (ret == BZ_STREAM_END && strm.avail_in > 0) {
+      BZ2_bzDecompressEnd(&strm);
+      char *next = strm.next_in;
+      unsigned int avail = strm.avail_in;
+      strm = {};
+      BZ2_bzDecompressInit(&strm, 0, 0);
+      strm.next_in = next;
+      strm.avail_in = avail;
+      ret = BZ_OK;
+    }
+  }
+  BZ2_bzDecompressEnd(&strm);
+  if (ret != BZ_STREAM_END) fprintf(stderr, "%s: bz2 error %d, using what decompressed\n", fn, ret);
+  return out;
+}
+
+static double percentile(std::vector<double> v, double p) {
+  auto it = v.begin() + (v.size() - 1) * p;
+  std::nth_element(v.begin(), it, v.end());
+  return *it;
+}
+
+// BGR like the rgb buffers of camerad, the frame shader swaps it back
+static std::vector<uint8_t> camera_frame(const char *image_fn, int width, int height, int stride) {
+  QImage image;
+  if (image_fn && !image.load(image_fn)) {
+    fprintf(stderr, "can't load %s, using a gradient\n", image_fn);
+  }
+  if (image.isNull()) {
+    image = QImage(width, height, QImage::Format_RGB888);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        image.setPixel(x, y, qRgb(64 + 64 * y / height, 64 + 64 * y / height, 80));
+      }
+    }
+  }
+  image = image.scaled(width, height).convertToFormat(QImage::Format_RGB888);
+
+  std::vector<uint8_t> bgr(stride * height);
+  for (int y = 0; y < height; y++) {
+    const uint8_t *src = image.constScanLine(y);
+    for (int x = 0; x < width; x++) {
+      bgr[y * stride + x * 3 + 0] = src[x * 3 + 2];
+      bgr[y * stride + x * 3 + 1] = src[x * 3 + 1];
+      bgr[y * stride + x * 3 + 2] = src[x * 3 + 0];
+    }
+  }
+  return bgr;
+}
+
+int main(int argc, char *argv[]) {
+  const char *log_fn = nullptr, *image_fn = nullptr, *save_fn = nullptr;
+  size_t max_frames = SIZE_MAX;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      max_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      image_fn = argv[++i];
+    } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      save_fn = argv[++i];
+    } else {
+      log_fn = argv[i];
+    }
+  }
+  if (!log_fn) {
+    fprintf(stderr, "usage: %s <rlog or rlog.bz2> [--frames N] [--image camera.png] [--save last_frame.png]\n", argv[0]);
+    return 1;
+  }
+
+  setQtSurfaceFormat();
+  QApplication app(argc, argv);
+
+  QOffscreenSurface surface;
+  surface.create();
+  QOpenGLContext gl_ctx;
+  if (!gl_ctx.create() || !gl_ctx.makeCurrent(&surface)) {
+    fprintf(stderr, "can't make a GL context\n");
+    return 1;
+  }
+  QOpenGLFramebufferObject fbo(vwp_w, vwp_h, QOpenGLFramebufferObject::CombinedDepthStencil);
+  fbo.bind();
+
+  // the services of QUIState
+  UIState *s = &QUIState::ui_state;
+  s->sm = std::make_unique<SubMaster, const std::initializer_list<const char *>>({
+    "modelV2Compact", "controlsState", "liveCalibration", "radarState", "deviceState", "roadCameraState",
+    "pandaState", "carParams", "driverMonitoringState", "sensorEvents", "carState", "liveLocationKalman",
+    "ubloxGnss", "gpsLocationExternal", "radarState", "liveParameters", "lateralPlan", "liveMapData",
+  });
+
+  // the events by frame, a modelV2Compact ends one
+  struct Frame {
+    uint64_t t;
+    std::vector<std::pair<std::string, cereal::Event::Reader>> msgs;
+  };
+  std::string log = read_log(log_fn);
+  std::vector<capnp::word> words(log.size() / sizeof(capnp::word));
+  memcpy(words.data(), log.data(), words.size() * sizeof(capnp::word));
+  std::vector<std::unique_ptr<capnp::FlatArrayMessageReader>> readers;
+  std::vector<Frame> frames(1);
+  kj::ArrayPtr<const capnp::word> remaining(words.data(), words.size());
+  while (remaining.size() > 0 && frames.size() <= max_frames) {
+    readers.push_back(std::make_unique<capnp::FlatArrayMessageReader>(remaining));
+    auto event = readers.back()->getRoot<cereal::Event>();
+    KJ_IF_MAYBE(field, capnp::toDynamic(event).which()) {
+      frames.back().msgs.push_back({field->getProto().getName().cStr(), event});
+      if (event.isModelV2Compact()) {
+        frames.back().t = event.getLogMonoTime();
+        frames.emplace_back();
+      }
+    }
+    remaining = kj::arrayPtr(readers.back()->getEnd(), remaining.end());
+  }
+  frames.pop_back();
+  if (frames.empty()) {
+    fprintf(stderr, "no modelV2Compact in %s\n", log_fn);
+    return 1;
+  }
+
+  // a static road camera frame, as camerad sends it
+  const int cam_w = Hardware::TICI() ? 1928 : 1164, cam_h = Hardware::TICI() ? 1208 : 874;
+  VisionIpcServer vipc_server("camerad");
+  vipc_server.create_buffers(VISION_STREAM_RGB_BACK, 4, true, cam_w, cam_h);
+  vipc_server.start_listener();
+  std::vector<uint8_t> bgr;
+
+  s->vision_rear = s->vision_wide = s->vision = new VisionReceiver("camerad", VISION_STREAM_RGB_BACK);
+  std::atomic<bool> frame_received = false;
+  QObject::connect(s->vision, &VisionReceiver::connected, [=]() {
+    s->vision_connected = true;
+    s->vision_textures_stale = true;
+    s->last_frame = nullptr;
+  });
+  QObject::connect(s->vision, &VisionReceiver::frameReceived, [&]() { frame_received = true; }, Qt::DirectConnection);
+
+  s->fb_w = vwp_w;
+  s->fb_h = vwp_h;
+  ui_nvg_init(s);
+  ui_resize(s, vwp_w, vwp_h);
+
+  std::vector<double> draw_ms, finish_ms;
+  uint64_t total_calls = 0, total_draws = 0;
+  uint32_t frame_id = 0;
+  for (const Frame &f : frames) {
+    s->sm->update_msgs(f.t, f.msgs);
+    ui_update_state(s);
+
+    VisionBuf *buf = vipc_server.get_buffer(VISION_STREAM_RGB_BACK);
+    if (bgr.empty()) bgr = camera_frame(image_fn, cam_w, cam_h, buf->stride);
+    memcpy(buf->addr, bgr.data(), std::min(bgr.size(), buf->len));
+    VisionIpcBufExtra extra = {frame_id++, f.t, f.t};
+    frame_received = false;
+    vipc_server.send(buf, &extra);
+
+    // like a paint of the onroad view, after the frame arrived. Not before the textures exist
+    for (int i = 0; i < 40 && s->vision_connected && !s->vision_textures_stale && !frame_received; i++) {
+      usleep(500);
+    }
+    app.processEvents();
+    if (!s->scene.started || !s->vision_connected) continue;
+
+    gl_calls = gl_draws = 0;
+    const double t1 = millis_since_boot();
+    ui_draw(s, vwp_w, vwp_h);
+    const double t2 = millis_since_boot();
+    glFinish();
+    const double t3 = millis_since_boot();
+    draw_ms.push_back(t2 - t1);
+    finish_ms.push_back(t3 - t1);
+    total_calls += gl_calls;
+    total_draws += gl_draws;
+  }
+
+  printf("%zu frames in %s, %zu drawn\n", frames.size(), log_fn, draw_ms.size());
+  if (draw_ms.empty()) {
+    printf("nothing drawn, the log needs a started deviceState and pandaState\n");
+    return 1;
+  }
+  printf("%-16s %9s %9s %9s\n", "", "p50 ms", "p90 ms", "p99 ms");
+  for (auto &[name, ms] : {std::pair{"ui_draw", &draw_ms}, std::pair{"with glFinish", &finish_ms}}) {
+    printf("%-16s %9.2f %9.2f %9.2f\n", name, percentile(*ms, 0.5), percentile(*ms, 0.9), percentile(*ms, 0.99));
+  }
+  printf("%.1f gl calls/frame, %.1f draws/frame\n", (double)total_calls / draw_ms.size(), (double)total_draws / draw_ms.size());
+
+  if (save_fn) {
+    fbo.toImage().save(save_fn);
+  }
+  return 0;
+}